@@ -13,23 +13,53 @@
 // limitations under the License.
 //
 #include <iostream>
+#include <sstream>
 #include "base/at_exit.h"
 #include "base/command_line.h"
+#include "base/file_util.h"
 #include "base/logging.h"
 #include "base/stringprintf.h"
+#include "base/string_number_conversions.h"
 #include "base/string_piece.h"
+#include "base/sys_info.h"
+#include "base/time.h"
 #include "base/utf_string_conversions.h"
+#include "base/threading/simple_thread.h"
 #include "base/win/event_trace_consumer.h"
+#include "sawbuck/log_lib/event_capture.h"
 #include "sawbuck/log_lib/kernel_log_consumer.h"
 #include "sawbuck/log_lib/log_consumer.h"
 
+namespace {
+
+// The number of events of a capture each worker parses and formats at a
+// time.
+const size_t kEventsPerChunk = 16 * 1024;
+
+}  // namespace
+
+// Parses events, and routes them to whichever sinks are set.
+class DumpLogParser
+    : public KernelLogParser,
+      public LogParser {
+ public:
+  DumpLogParser() : num_events_(0) {
+  }
+
+  void ProcessOneEvent(EVENT_TRACE* event);
+
+  // Returns the number of events processed so far.
+  size_t num_events() const { return num_events_; }
+
+ private:
+  size_t num_events_;
+};
 
 // The log consumer class we use to parse the logs on our behalf.
 // There can only be one instance of this class in existence at a time.
 class DumpLogConsumer
     : public base::win::EtwTraceConsumerBase<DumpLogConsumer>,
-      public KernelLogParser,
-      public LogParser {
+      public DumpLogParser {
  public:
   DumpLogConsumer();
   ~DumpLogConsumer();
@@ -37,8 +67,6 @@ class DumpLogConsumer
   static void ProcessEvent(EVENT_TRACE* event);
 
  private:
-  virtual void ProcessOneEvent(EVENT_TRACE* event);
-
   // Our current instance pointer, used to route the
   // log events to our sole instance.
   static DumpLogConsumer* current_;
@@ -62,7 +90,8 @@ void DumpLogConsumer::ProcessEvent(EVENT_TRACE* event) {
     current_->ProcessOneEvent(event);
 }
 
-void DumpLogConsumer::ProcessOneEvent(EVENT_TRACE* event) {
+void DumpLogParser::ProcessOneEvent(EVENT_TRACE* event) {
+  ++num_events_;
   if (!LogParser::ProcessOneEvent(event) &&
       !KernelLogParser::ProcessOneEvent(event)) {
     LOG(INFO) << "Unhandled event";
@@ -74,6 +103,15 @@ class LogDumpHandler
       public KernelPageFaultEvents,
       public KernelProcessEvents,
       public LogEvents {
+ public:
+  // @param out the stream the events are written to.
+  explicit LogDumpHandler(std::wostream* out) : out_(out) {
+    DCHECK(out != NULL);
+  }
+
+  // Routes the events of @p parser to this handler.
+  void Attach(DumpLogParser* parser);
+
  protected:
   // KernelModuleEvents implementation.
   virtual void OnModuleIsLoaded(DWORD process_id,
@@ -144,8 +182,19 @@ class LogDumpHandler
       const TraceEvents::TraceMessage& trace_message);
   virtual void OnTraceEventInstant(
       const TraceEvents::TraceMessage& trace_message);
+
+ private:
+  std::wostream* out_;
 };
 
+void LogDumpHandler::Attach(DumpLogParser* parser) {
+  DCHECK(parser != NULL);
+  parser->set_module_event_sink(this);
+  parser->set_page_fault_event_sink(this);
+  parser->set_process_event_sink(this);
+  parser->set_event_sink(this);
+}
+
 void LogDumpHandler::OnModuleIsLoaded(DWORD process_id,
                                       const base::Time& time,
                                       const ModuleInformation& module_info) {
@@ -259,18 +308,18 @@ std::wostream& operator<< (std::wostream& str,
 // KernelProcessEvents implementation.
 void LogDumpHandler::OnProcessIsRunning(const base::Time& time,
                                         const ProcessInfo& process_info) {
-  std::wcout << L"Running:\n" << process_info;
+  *out_ << L"Running:\n" << process_info;
 }
 
 void LogDumpHandler::OnProcessStarted(const base::Time& time,
                                       const ProcessInfo& process_info) {
-  std::wcout << L"Started:\n" << process_info;
+  *out_ << L"Started:\n" << process_info;
 }
 
 void LogDumpHandler::OnProcessEnded(const base::Time& time,
                                     const ProcessInfo& process_info,
                                     ULONG exit_status) {
-  std::wcout << L"Ended:\n" << process_info;
+  *out_ << L"Ended:\n" << process_info;
 }
 
 // LogEvents implementation.
@@ -299,13 +348,160 @@ int Error(const std::wstring& error) {
   return 1;
 }
 
-int wmain(int argc, const wchar_t** argv) {
-  base::AtExitManager at_exit;
-  CommandLine::Init(0, NULL);
+// Parses and formats a range of the events of a capture, on whichever
+// thread it's run on.
+class ChunkDumper : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param data the capture, which must outlive the dumper.
+  // @param size the size of the capture.
+  // @param begin the offset of the first record of the range.
+  // @param end the offset of the record following the range.
+  // @param is_64_bit_log the bitness of the log at the start of the range.
+  ChunkDumper(const uint8* data, size_t size, size_t begin, size_t end,
+              bool is_64_bit_log)
+      : data_(data), size_(size), begin_(begin), end_(end),
+        is_64_bit_log_(is_64_bit_log), num_events_(0), error_(false) {
+    DCHECK(data != NULL);
+    DCHECK_LT(begin, end);
+  }
 
-  CommandLine* cmd_line = CommandLine::ForCurrentProcess();
-  std::vector<std::wstring> args = cmd_line->args();
-  DumpLogConsumer consumer;
+  virtual void Run() {
+    EventCaptureReader reader;
+    if (!reader.Init(data_, size_) || !reader.Seek(begin_)) {
+      error_ = true;
+      return;
+    }
+
+    std::wostringstream out;
+    LogDumpHandler handler(&out);
+    DumpLogParser parser;
+    parser.set_is_64_bit_log(is_64_bit_log_);
+    handler.Attach(&parser);
+
+    EVENT_TRACE event;
+    while (reader.position() < end_ && reader.ReadEvent(&event))
+      parser.ProcessOneEvent(&event);
+
+    error_ = reader.error() || reader.position() != end_;
+    num_events_ = parser.num_events();
+    output_ = out.str();
+  }
+
+  const std::wstring& output() const { return output_; }
+  size_t num_events() const { return num_events_; }
+  bool error() const { return error_; }
+
+ private:
+  const uint8* data_;
+  size_t size_;
+  size_t begin_;
+  size_t end_;
+  bool is_64_bit_log_;
+
+  // The formatted events of the range.
+  std::wstring output_;
+  size_t num_events_;
+  bool error_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkDumper);
+};
+
+// Dumps the captures @p args one after the other. The events are parsed and
+// formatted in chunks on up to @p num_threads threads, and the output of
+// each chunk is written out in order once it's ready.
+// @param num_events on success, returns the number of events dumped.
+// @returns true on success.
+bool DumpCaptures(const std::vector<std::wstring>& args,
+                  size_t num_threads,
+                  size_t* num_events) {
+  DCHECK_LT(0U, num_threads);
+  DCHECK(num_events != NULL);
+
+  *num_events = 0;
+
+  // The bitness of a log is inferred from its header event, which only the
+  // chunk containing it sees. We follow along as we split the captures, so
+  // as to start each chunk with the right bitness.
+  KernelLogParser bitness_parser;
+  for (size_t i = 0; i < args.size(); ++i) {
+    file_util::MemoryMappedFile capture;
+    EventCaptureReader scanner;
+    if (!capture.Initialize(FilePath(args[i])) ||
+        !scanner.Init(capture.data(), capture.length())) {
+      Error(StringPrintf(L"Error opening capture \"%ls\"", args[i].c_str()));
+      return false;
+    }
+
+    while (true) {
+      std::vector<ChunkDumper*> chunks;
+      EVENT_TRACE event;
+      while (chunks.size() < num_threads) {
+        size_t begin = scanner.position();
+        bool is_64_bit_log = bitness_parser.is_64_bit_log();
+        size_t chunk_events = 0;
+        for (; chunk_events < kEventsPerChunk; ++chunk_events) {
+          if (!scanner.ReadEvent(&event))
+            break;
+          bitness_parser.ProcessOneEvent(&event);
+        }
+        if (chunk_events == 0)
+          break;
+
+        chunks.push_back(new ChunkDumper(capture.data(), capture.length(),
+                                         begin, scanner.position(),
+                                         is_64_bit_log));
+      }
+
+      // The first chunk is dumped on this thread, the rest on threads of
+      // their own.
+      std::vector<base::DelegateSimpleThread*> threads;
+      for (size_t j = 1; j < chunks.size(); ++j) {
+        threads.push_back(
+            new base::DelegateSimpleThread(chunks[j], "Dump worker"));
+        threads.back()->Start();
+      }
+
+      if (!chunks.empty())
+        chunks[0]->Run();
+
+      for (size_t j = 0; j < threads.size(); ++j) {
+        threads[j]->Join();
+        delete threads[j];
+      }
+
+      bool error = false;
+      for (size_t j = 0; j < chunks.size(); ++j) {
+        const std::wstring& output = chunks[j]->output();
+        std::wcout.write(output.data(), output.size());
+        *num_events += chunks[j]->num_events();
+        error = error || chunks[j]->error();
+        delete chunks[j];
+      }
+
+      if (error || scanner.error()) {
+        Error(StringPrintf(L"Error reading capture \"%ls\"",
+                           args[i].c_str()));
+        return false;
+      }
+
+      if (chunks.size() < num_threads)
+        break;
+    }
+  }
+
+  return true;
+}
+
+// Writes the events of the ETW logs @p args to the capture @p capture_path,
+// so that they can later be dumped without the help of the OS.
+int CaptureLogs(const std::vector<std::wstring>& args,
+                const FilePath& capture_path) {
+  EventCaptureWriter writer;
+  if (!writer.Open(capture_path))
+    return Error(StringPrintf(L"Error creating capture \"%ls\"",
+                              capture_path.value().c_str()));
+
+  EventCaptureConsumer consumer(&writer);
   for (size_t i = 0; i < args.size(); ++i) {
     HRESULT hr = consumer.OpenFileSession(args[i].c_str());
 
@@ -314,15 +510,81 @@ int wmain(int argc, const wchar_t** argv) {
                                 hr, args[i].c_str()));
   }
 
-  LogDumpHandler handler;
-  consumer.set_module_event_sink(&handler);
-  consumer.set_page_fault_event_sink(&handler);
-  consumer.set_process_event_sink(&handler);
-  consumer.set_event_sink(&handler);
-
   HRESULT hr = consumer.Consume();
   if (FAILED(hr))
     return Error(StringPrintf(L"Error 0x%08X consuming log files", hr));
 
+  size_t num_events = writer.num_events();
+  if (!writer.Close())
+    return Error(StringPrintf(L"Error writing capture \"%ls\"",
+                              capture_path.value().c_str()));
+
+  std::wcout << L"Captured " << num_events << L" events." << std::endl;
+  return 0;
+}
+
+int wmain(int argc, const wchar_t** argv) {
+  base::AtExitManager at_exit;
+  CommandLine::Init(0, NULL);
+
+  CommandLine* cmd_line = CommandLine::ForCurrentProcess();
+  std::vector<std::wstring> args = cmd_line->args();
+  if (cmd_line->HasSwitch("capture"))
+    return CaptureLogs(args, cmd_line->GetSwitchValuePath("capture"));
+
+  int num_threads = base::SysInfo::NumberOfProcessors();
+  if (cmd_line->HasSwitch("threads") &&
+      (!base::StringToInt(cmd_line->GetSwitchValueASCII("threads"),
+                          &num_threads) || num_threads < 1)) {
+    return Error(L"--threads must be a positive number.");
+  }
+  bool print_stats = cmd_line->HasSwitch("stats");
+  base::Time start_time = base::Time::Now();
+
+  // The inputs are either all ETW logs, which the OS merges in order of
+  // time, or all captures, which are replayed one after the other.
+  size_t num_captures = 0;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (EventCaptureReader::IsCaptureFile(FilePath(args[i])))
+      ++num_captures;
+  }
+  if (num_captures != 0 && num_captures != args.size())
+    return Error(L"Captures and ETW logs can't be dumped together.");
+
+  size_t num_events = 0;
+  if (num_captures != 0) {
+    if (!DumpCaptures(args, num_threads, &num_events))
+      return 1;
+  } else {
+    DumpLogConsumer consumer;
+    for (size_t i = 0; i < args.size(); ++i) {
+      HRESULT hr = consumer.OpenFileSession(args[i].c_str());
+
+      if (FAILED(hr))
+        return Error(StringPrintf(L"Error 0x%08X, opening file \"%ls\"",
+                                  hr, args[i].c_str()));
+    }
+
+    LogDumpHandler handler(&std::wcout);
+    handler.Attach(&consumer);
+
+    HRESULT hr = consumer.Consume();
+    if (FAILED(hr))
+      return Error(StringPrintf(L"Error 0x%08X consuming log files", hr));
+
+    num_events = consumer.num_events();
+  }
+
+  if (print_stats) {
+    double seconds = (base::Time::Now() - start_time).InSecondsF();
+    std::wcerr << L"Dumped " << num_events << L" events in " << seconds
+               << L" seconds";
+    if (seconds > 0) {
+      std::wcerr << L", " << static_cast<int64>(num_events / seconds)
+                 << L" events/second";
+    }
+    std::wcerr << L"." << std::endl;
+  }
+
   return 0;
 }
@@ -0,0 +1,238 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Event capture implementation.
+#include "sawbuck/log_lib/event_capture.h"
+
+#include "base/logging.h"
+
+namespace {
+
+// Identifies an event capture. The version must be bumped whenever the
+// layout of the records changes.
+const uint32 kEventCaptureMagic = 0x50414345;
+const uint32 kEventCaptureVersion = 1;
+
+// The alignment of the records.
+const size_t kRecordAlignment = 8;
+
+// We write the buffered events out once they reach this size.
+const size_t kWriteBufferSize = 1024 * 1024;
+
+size_t AlignRecordSize(size_t size) {
+  return (size + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+}  // namespace
+
+EventCaptureWriter::EventCaptureWriter() : num_events_(0), failed_(false) {
+}
+
+EventCaptureWriter::~EventCaptureWriter() {
+  if (file_.get() != NULL)
+    Close();
+}
+
+bool EventCaptureWriter::Open(const FilePath& path) {
+  DCHECK(file_.get() == NULL);
+
+  file_.reset(file_util::OpenFile(path, "wb"));
+  if (file_.get() == NULL) {
+    LOG(ERROR) << "Unable to create capture \"" << path.value() << "\".";
+    return false;
+  }
+
+  buffer_.clear();
+  buffer_.reserve(kWriteBufferSize);
+  num_events_ = 0;
+  failed_ = false;
+
+  EventCaptureHeader header = { kEventCaptureMagic, kEventCaptureVersion };
+  const uint8* header_data = reinterpret_cast<const uint8*>(&header);
+  buffer_.insert(buffer_.end(), header_data, header_data + sizeof(header));
+  return true;
+}
+
+bool EventCaptureWriter::WriteEvent(const EVENT_TRACE& event) {
+  DCHECK(file_.get() != NULL);
+
+  EventCaptureRecord record = {};
+  record.size = AlignRecordSize(sizeof(record) + event.MofLength);
+  record.mof_length = event.MofLength;
+  record.guid = event.Header.Guid;
+  record.time_stamp = event.Header.TimeStamp.QuadPart;
+  record.process_id = event.Header.ProcessId;
+  record.thread_id = event.Header.ThreadId;
+  record.type = event.Header.Class.Type;
+  record.level = event.Header.Class.Level;
+  record.version = event.Header.Class.Version;
+
+  const uint8* record_data = reinterpret_cast<const uint8*>(&record);
+  const uint8* mof_data = reinterpret_cast<const uint8*>(event.MofData);
+  buffer_.insert(buffer_.end(), record_data, record_data + sizeof(record));
+  if (event.MofLength != 0)
+    buffer_.insert(buffer_.end(), mof_data, mof_data + event.MofLength);
+  buffer_.resize(buffer_.size() + record.size - sizeof(record) -
+                 event.MofLength);
+  ++num_events_;
+
+  if (buffer_.size() >= kWriteBufferSize)
+    return Flush();
+
+  return !failed_;
+}
+
+bool EventCaptureWriter::Close() {
+  DCHECK(file_.get() != NULL);
+
+  bool flushed = Flush();
+  if (fclose(file_.release()) != 0) {
+    LOG(ERROR) << "Unable to close capture.";
+    failed_ = true;
+  }
+
+  return flushed && !failed_;
+}
+
+bool EventCaptureWriter::Flush() {
+  if (!buffer_.empty() &&
+      fwrite(&buffer_[0], 1, buffer_.size(), file_.get()) != buffer_.size()) {
+    LOG(ERROR) << "Unable to write capture.";
+    failed_ = true;
+  }
+
+  buffer_.clear();
+  return !failed_;
+}
+
+EventCaptureReader::EventCaptureReader()
+    : data_(NULL), size_(0), position_(0), error_(false) {
+}
+
+EventCaptureReader::~EventCaptureReader() {
+}
+
+bool EventCaptureReader::Open(const FilePath& path) {
+  mapped_file_.reset(new file_util::MemoryMappedFile());
+  if (!mapped_file_->Initialize(path)) {
+    LOG(ERROR) << "Unable to map capture \"" << path.value() << "\".";
+    mapped_file_.reset();
+    return false;
+  }
+
+  if (!Init(mapped_file_->data(), mapped_file_->length())) {
+    LOG(ERROR) << "\"" << path.value() << "\" is not a capture.";
+    mapped_file_.reset();
+    return false;
+  }
+
+  return true;
+}
+
+bool EventCaptureReader::Init(const uint8* data, size_t size) {
+  DCHECK(data != NULL);
+  DCHECK_EQ(0U, reinterpret_cast<uintptr_t>(data) % kRecordAlignment);
+
+  data_ = NULL;
+  size_ = 0;
+  position_ = 0;
+  error_ = false;
+
+  const EventCaptureHeader* header =
+      reinterpret_cast<const EventCaptureHeader*>(data);
+  if (size < sizeof(*header) || header->magic != kEventCaptureMagic ||
+      header->version != kEventCaptureVersion) {
+    return false;
+  }
+
+  data_ = data;
+  size_ = size;
+  position_ = AlignRecordSize(sizeof(*header));
+  return true;
+}
+
+bool EventCaptureReader::ReadEvent(EVENT_TRACE* event) {
+  DCHECK(event != NULL);
+
+  if (error_ || position_ >= size_)
+    return false;
+
+  const EventCaptureRecord* record =
+      reinterpret_cast<const EventCaptureRecord*>(data_ + position_);
+  size_t remaining = size_ - position_;
+  if (remaining < sizeof(*record) || record->size > remaining ||
+      record->size < sizeof(*record) ||
+      record->size - sizeof(*record) < record->mof_length ||
+      record->size % kRecordAlignment != 0) {
+    LOG(ERROR) << "Malformed capture record at offset " << position_ << ".";
+    error_ = true;
+    return false;
+  }
+
+  memset(event, 0, sizeof(*event));
+  event->Header.Size = sizeof(*event);
+  event->Header.Guid = record->guid;
+  event->Header.TimeStamp.QuadPart = record->time_stamp;
+  event->Header.ProcessId = record->process_id;
+  event->Header.ThreadId = record->thread_id;
+  event->Header.Class.Type = record->type;
+  event->Header.Class.Level = record->level;
+  event->Header.Class.Version = record->version;
+  // The parsers only read the MOF data.
+  event->MofData = const_cast<EventCaptureRecord*>(record + 1);
+  event->MofLength = record->mof_length;
+
+  position_ += record->size;
+  return true;
+}
+
+bool EventCaptureReader::Seek(size_t position) {
+  if (data_ == NULL ||
+      position < AlignRecordSize(sizeof(EventCaptureHeader)) ||
+      position > size_ || position % kRecordAlignment != 0) {
+    return false;
+  }
+
+  position_ = position;
+  error_ = false;
+  return true;
+}
+
+bool EventCaptureReader::IsCaptureFile(const FilePath& path) {
+  file_util::ScopedFILE file(file_util::OpenFile(path, "rb"));
+  EventCaptureHeader header = {};
+  return file.get() != NULL &&
+      fread(&header, sizeof(header), 1, file.get()) == 1 &&
+      header.magic == kEventCaptureMagic;
+}
+
+EventCaptureConsumer* EventCaptureConsumer::current_ = NULL;
+
+EventCaptureConsumer::EventCaptureConsumer(EventCaptureWriter* writer)
+    : writer_(writer) {
+  DCHECK(writer != NULL);
+  DCHECK(current_ == NULL);
+  current_ = this;
+}
+
+EventCaptureConsumer::~EventCaptureConsumer() {
+  DCHECK(current_ == this);
+  current_ = NULL;
+}
+
+void EventCaptureConsumer::ProcessEvent(EVENT_TRACE* event) {
+  DCHECK(current_ != NULL);
+  // A failed write is reported when the capture is closed.
+  current_->writer_->WriteEvent(*event);
+}
@@ -0,0 +1,172 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Event capture declarations. An event capture holds the events of one or
+// more ETW logs in a compact file, which can be replayed through the log
+// parsers without the help of the OS. The file is a header followed by a
+// sequence of length-prefixed records, each holding the event header fields
+// the parsers look at and the event's MOF data:
+//
+//   EventCaptureHeader  header;
+//   {
+//     EventCaptureRecord  record;
+//     uint8               mof_data[record.mof_length];
+//     uint8               padding[];
+//   }                   records[];
+//
+// Records are padded to a multiple of 8 bytes, so a capture can be memory
+// mapped and each record read in place.
+#ifndef SAWBUCK_LOG_LIB_EVENT_CAPTURE_H_
+#define SAWBUCK_LOG_LIB_EVENT_CAPTURE_H_
+
+#include <vector>
+#include "base/basictypes.h"
+#include "base/file_path.h"
+#include "base/file_util.h"
+#include "base/scoped_ptr.h"
+#include "base/win/event_trace_consumer.h"
+
+// The header at the start of an event capture.
+struct EventCaptureHeader {
+  uint32 magic;
+  uint32 version;
+};
+
+// The header of each event record.
+struct EventCaptureRecord {
+  // The size of the record, including this header, the MOF data and the
+  // padding that follows it.
+  uint32 size;
+  uint32 mof_length;
+  GUID guid;
+  LONGLONG time_stamp;
+  DWORD process_id;
+  DWORD thread_id;
+  UCHAR type;
+  UCHAR level;
+  USHORT version;
+  uint32 unused;
+};
+COMPILE_ASSERT(sizeof(EventCaptureRecord) == 48, event_record_wrong_size);
+
+// Writes events to a capture file. The events are buffered, and written out
+// in large blocks.
+class EventCaptureWriter {
+ public:
+  EventCaptureWriter();
+  ~EventCaptureWriter();
+
+  // Creates a capture file, replacing any existing file.
+  // @param path the file to create.
+  // @returns true on success.
+  bool Open(const FilePath& path);
+
+  // Appends an event to the capture.
+  // @returns true on success.
+  bool WriteEvent(const EVENT_TRACE& event);
+
+  // Writes out any buffered events, and closes the capture file.
+  // @returns true iff all events were written successfully.
+  bool Close();
+
+  // Returns the number of events written so far.
+  size_t num_events() const { return num_events_; }
+
+ private:
+  // Writes out the buffered events.
+  bool Flush();
+
+  file_util::ScopedFILE file_;
+  std::vector<uint8> buffer_;
+  size_t num_events_;
+  // True iff a write has failed since the file was opened.
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventCaptureWriter);
+};
+
+// Reads the events of a capture, in the order they were written. The
+// reader doesn't modify its state other than on ReadEvent and Seek, so
+// separate readers may read different ranges of the same buffer at once.
+class EventCaptureReader {
+ public:
+  EventCaptureReader();
+  ~EventCaptureReader();
+
+  // Maps a capture file, and positions the reader at its first event.
+  // @param path the file to read.
+  // @returns true on success.
+  bool Open(const FilePath& path);
+
+  // Initializes the reader from a capture held in memory, and positions it
+  // at the first event.
+  // @param data the capture, which must be 8-byte aligned, and outlive the
+  //     reader.
+  // @param size the size of the capture.
+  // @returns true on success.
+  bool Init(const uint8* data, size_t size);
+
+  // Reads the next event.
+  // @param event on success, returns the event. Its MofData points into
+  //     the capture, and is valid for as long as the reader is.
+  // @returns true on success, false at the end of the capture or if the
+  //     next record is malformed, in which case error() returns true.
+  bool ReadEvent(EVENT_TRACE* event);
+
+  // Moves to a record.
+  // @param position the offset of the record, as returned by position().
+  // @returns true on success.
+  bool Seek(size_t position);
+
+  // Returns the offset of the next record in the capture.
+  size_t position() const { return position_; }
+  // Returns the size of the capture.
+  size_t size() const { return size_; }
+  // Returns true iff a malformed record has been read.
+  bool error() const { return error_; }
+
+  // Returns true iff @p path starts like a capture file.
+  static bool IsCaptureFile(const FilePath& path);
+
+ private:
+  // The capture, when mapped by Open.
+  scoped_ptr<file_util::MemoryMappedFile> mapped_file_;
+
+  const uint8* data_;
+  size_t size_;
+  size_t position_;
+  bool error_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventCaptureReader);
+};
+
+// Consumes the events of ETW logs or sessions, and writes them to a capture.
+// There can only be one instance of this class in existence at a time.
+class EventCaptureConsumer
+    : public base::win::EtwTraceConsumerBase<EventCaptureConsumer> {
+ public:
+  // @param writer the open capture to write the events to, which must
+  //     outlive the consumer.
+  explicit EventCaptureConsumer(EventCaptureWriter* writer);
+  ~EventCaptureConsumer();
+
+  static void ProcessEvent(EVENT_TRACE* event);
+
+ private:
+  EventCaptureWriter* writer_;
+
+  static EventCaptureConsumer* current_;
+};
+
+#endif  // SAWBUCK_LOG_LIB_EVENT_CAPTURE_H_
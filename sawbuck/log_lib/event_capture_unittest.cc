@@ -0,0 +1,356 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Event capture unittests.
+#include "sawbuck/log_lib/event_capture.h"
+
+#include "base/file_util.h"
+#include "base/logging.h"
+#include "base/logging_win.h"
+#include "base/path_service.h"
+#include "base/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "sawbuck/log_lib/kernel_log_consumer.h"
+#include "sawbuck/log_lib/kernel_log_unittest_data.h"
+#include "sawbuck/log_lib/log_consumer.h"
+#include <initguid.h>  // NOLINT - must be last.
+
+namespace {
+
+// {2E79E967-BB99-4c42-B888-792EED6CEB98}
+DEFINE_GUID(kRandomGuid,
+    0x2e79e967, 0xbb99,
+        0x4c42, 0xb8, 0x88, 0x79, 0x2e, 0xed, 0x6c, 0xeb, 0x98);
+
+using testing::_;
+using testing::AllOf;
+using testing::ByRef;
+using testing::Eq;
+using testing::Field;
+using testing::InSequence;
+using testing::StrEq;
+using testing::StrictMock;
+
+class MockLogEvents: public LogEvents {
+ public:
+  MOCK_METHOD1(OnLogMessage, void(const LogEvents::LogMessage& msg));
+};
+
+class MockKernelModuleEvents: public KernelModuleEvents {
+ public:
+  MOCK_METHOD3(OnModuleIsLoaded, void(DWORD process_id,
+                                      const base::Time& time,
+                                      const ModuleInformation& module_info));
+  MOCK_METHOD3(OnModuleUnload, void(DWORD process_id,
+                                    const base::Time& time,
+                                    const ModuleInformation& module_info));
+  MOCK_METHOD3(OnModuleLoad, void(DWORD process_id,
+                                  const base::Time& time,
+                                  const ModuleInformation& module_info));
+};
+
+// Counts the log messages it's handed.
+class CountingLogEvents: public LogEvents {
+ public:
+  CountingLogEvents() : num_messages_(0) {
+  }
+
+  virtual void OnLogMessage(const LogEvents::LogMessage& msg) {
+    ++num_messages_;
+  }
+
+  size_t num_messages() const { return num_messages_; }
+
+ private:
+  size_t num_messages_;
+};
+
+class EventTrace: public EVENT_TRACE {
+ public:
+  EventTrace(const GUID& provider_name, UCHAR type, UCHAR level,
+      DWORD process_id, DWORD thread_id, const base::Time& time,
+      size_t data_len, void* data) {
+    memset(this, 0, sizeof(*this));
+
+    Header.Size = sizeof(*this);
+    Header.Class.Type = type;
+    Header.Class.Level = level;
+    Header.Class.Version = 0;
+    Header.ThreadId = thread_id;
+    Header.ProcessId = process_id;
+    reinterpret_cast<FILETIME&>(Header.TimeStamp) = time.ToFileTime();
+    Header.Guid = provider_name;
+    MofData = data;
+    MofLength = data_len;
+  }
+};
+
+char kMsgText[] = "Nothing to see here, please move on";
+
+class EventCaptureTest: public testing::Test {
+ public:
+  virtual void SetUp() {
+    ASSERT_TRUE(file_util::CreateTemporaryFile(&capture_path_));
+  }
+
+  virtual void TearDown() {
+    file_util::Delete(capture_path_, false);
+  }
+
+  // Expects @p event to be a copy of @p expected.
+  void ExpectSameEvent(const EVENT_TRACE& expected,
+                       const EVENT_TRACE& event) {
+    EXPECT_TRUE(expected.Header.Guid == event.Header.Guid);
+    EXPECT_EQ(expected.Header.TimeStamp.QuadPart,
+              event.Header.TimeStamp.QuadPart);
+    EXPECT_EQ(expected.Header.ProcessId, event.Header.ProcessId);
+    EXPECT_EQ(expected.Header.ThreadId, event.Header.ThreadId);
+    EXPECT_EQ(expected.Header.Class.Type, event.Header.Class.Type);
+    EXPECT_EQ(expected.Header.Class.Level, event.Header.Class.Level);
+    EXPECT_EQ(expected.Header.Class.Version, event.Header.Class.Version);
+    ASSERT_EQ(expected.MofLength, event.MofLength);
+    EXPECT_EQ(0, memcmp(expected.MofData, event.MofData, event.MofLength));
+  }
+
+ protected:
+  FilePath capture_path_;
+};
+
+}  // namespace
+
+TEST_F(EventCaptureTest, WriteAndRead) {
+  // Write events with payloads of various sizes.
+  const size_t kNumEvents = 20;
+  char payload[kNumEvents];
+  for (size_t i = 0; i < kNumEvents; ++i)
+    payload[i] = static_cast<char>(i);
+
+  std::vector<EventTrace> events;
+  base::Time now = base::Time::Now();
+  for (size_t i = 0; i < kNumEvents; ++i) {
+    events.push_back(EventTrace(i % 2 ? kRandomGuid : logging::kLogEventId,
+                                i, i + 1, 1000 + i, 2000 + i,
+                                now + base::TimeDelta::FromMilliseconds(i),
+                                i, payload));
+    events.back().Header.Class.Version = i % 3;
+  }
+
+  EventCaptureWriter writer;
+  ASSERT_TRUE(writer.Open(capture_path_));
+  for (size_t i = 0; i < kNumEvents; ++i)
+    ASSERT_TRUE(writer.WriteEvent(events[i]));
+  EXPECT_EQ(kNumEvents, writer.num_events());
+  ASSERT_TRUE(writer.Close());
+
+  EXPECT_TRUE(EventCaptureReader::IsCaptureFile(capture_path_));
+
+  EventCaptureReader reader;
+  ASSERT_TRUE(reader.Open(capture_path_));
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < kNumEvents; ++i) {
+    positions.push_back(reader.position());
+    EVENT_TRACE event = {};
+    ASSERT_TRUE(reader.ReadEvent(&event));
+    ASSERT_NO_FATAL_FAILURE(ExpectSameEvent(events[i], event));
+    // The payloads are aligned.
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(event.MofData) % 8);
+  }
+
+  EVENT_TRACE event = {};
+  EXPECT_FALSE(reader.ReadEvent(&event));
+  EXPECT_FALSE(reader.error());
+  EXPECT_EQ(reader.size(), reader.position());
+
+  // We can go back to any of the events.
+  ASSERT_TRUE(reader.Seek(positions[7]));
+  ASSERT_TRUE(reader.ReadEvent(&event));
+  ASSERT_NO_FATAL_FAILURE(ExpectSameEvent(events[7], event));
+  EXPECT_FALSE(reader.Seek(positions[7] + 1));
+  EXPECT_FALSE(reader.Seek(0));
+  EXPECT_FALSE(reader.Seek(reader.size() + 8));
+}
+
+TEST_F(EventCaptureTest, ReplayThroughLogParser) {
+  EventTrace log_msg(logging::kLogEventId, logging::LOG_MESSAGE,
+      TRACE_LEVEL_INFORMATION, ::GetCurrentProcessId(),
+      ::GetCurrentThreadId(), base::Time::Now(), sizeof(kMsgText), kMsgText);
+
+  EventCaptureWriter writer;
+  ASSERT_TRUE(writer.Open(capture_path_));
+  ASSERT_TRUE(writer.WriteEvent(log_msg));
+  ASSERT_TRUE(writer.Close());
+
+  StrictMock<MockLogEvents> events;
+  LogParser parser;
+  parser.set_event_sink(&events);
+
+  typedef LogEvents::LogMessage Msg;
+  EXPECT_CALL(events, OnLogMessage(AllOf(
+      AllOf(
+          Field(&Msg::level, TRACE_LEVEL_INFORMATION),
+          Field(&Msg::process_id, ::GetCurrentProcessId()),
+          Field(&Msg::thread_id, ::GetCurrentThreadId())),
+      Field(&Msg::message, StrEq(kMsgText)))))
+      .Times(1);
+
+  EventCaptureReader reader;
+  ASSERT_TRUE(reader.Open(capture_path_));
+  EVENT_TRACE event = {};
+  ASSERT_TRUE(reader.ReadEvent(&event));
+  EXPECT_TRUE(parser.ProcessOneEvent(&event));
+  EXPECT_FALSE(reader.ReadEvent(&event));
+}
+
+TEST_F(EventCaptureTest, RejectsMalformedCaptures) {
+  EventCaptureReader reader;
+
+  // Not a capture at all.
+  uint64 garbage[4] = { 0x1234, 0x5678 };
+  EXPECT_FALSE(reader.Init(reinterpret_cast<uint8*>(garbage),
+                           sizeof(garbage)));
+  EXPECT_FALSE(EventCaptureReader::IsCaptureFile(capture_path_));
+
+  EventTrace log_msg(logging::kLogEventId, logging::LOG_MESSAGE,
+      TRACE_LEVEL_INFORMATION, 1, 2, base::Time::Now(), sizeof(kMsgText),
+      kMsgText);
+  EventCaptureWriter writer;
+  ASSERT_TRUE(writer.Open(capture_path_));
+  ASSERT_TRUE(writer.WriteEvent(log_msg));
+  ASSERT_TRUE(writer.WriteEvent(log_msg));
+  ASSERT_TRUE(writer.Close());
+
+  std::string contents;
+  ASSERT_TRUE(file_util::ReadFileToString(capture_path_, &contents));
+  std::vector<uint64> data((contents.size() + 7) / 8);
+  memcpy(&data[0], contents.data(), contents.size());
+  const uint8* capture = reinterpret_cast<const uint8*>(&data[0]);
+
+  // A truncated capture yields the events that are whole.
+  EVENT_TRACE event = {};
+  ASSERT_TRUE(reader.Init(capture, contents.size() - 1));
+  EXPECT_TRUE(reader.ReadEvent(&event));
+  EXPECT_FALSE(reader.ReadEvent(&event));
+  EXPECT_TRUE(reader.error());
+
+  // As does one with a corrupt record size.
+  size_t second_record_offset = sizeof(EventCaptureHeader) +
+      (contents.size() - sizeof(EventCaptureHeader)) / 2;
+  EventCaptureRecord* second_record = reinterpret_cast<EventCaptureRecord*>(
+      reinterpret_cast<uint8*>(&data[0]) + second_record_offset);
+  second_record->size = 12;
+  ASSERT_TRUE(reader.Init(capture, contents.size()));
+  EXPECT_TRUE(reader.ReadEvent(&event));
+  EXPECT_FALSE(reader.ReadEvent(&event));
+  EXPECT_TRUE(reader.error());
+}
+
+TEST_F(EventCaptureTest, CaptureKernelLog) {
+  FilePath src_root;
+  ASSERT_TRUE(PathService::Get(base::DIR_SOURCE_ROOT, &src_root));
+  FilePath log_path =
+      src_root.AppendASCII("sawbuck\\log_lib\\test_data\\image_data_32_v2.etl");
+
+  EventCaptureWriter writer;
+  ASSERT_TRUE(writer.Open(capture_path_));
+  {
+    EventCaptureConsumer consumer(&writer);
+    ASSERT_HRESULT_SUCCEEDED(
+        consumer.OpenFileSession(log_path.value().c_str()));
+    ASSERT_HRESULT_SUCCEEDED(consumer.Consume());
+    ASSERT_HRESULT_SUCCEEDED(consumer.Close());
+  }
+  ASSERT_TRUE(writer.Close());
+
+  // Replaying the capture produces the same events as consuming the log.
+  StrictMock<MockKernelModuleEvents> module_events;
+  {
+    InSequence in;
+    for (size_t i = 0; i < testing::kNumModules; ++i) {
+      EXPECT_CALL(module_events,
+                  OnModuleIsLoaded(_, _, Eq(ByRef(testing::module_list[i]))))
+          .Times(1);
+    }
+    EXPECT_CALL(module_events, OnModuleUnload(_, _, testing::module_list[0]))
+        .Times(1);
+    EXPECT_CALL(module_events, OnModuleLoad(_, _, testing::module_list[0]))
+        .Times(1);
+  }
+
+  KernelLogParser parser;
+  parser.set_infer_bitness_from_log(false);
+  parser.set_is_64_bit_log(false);
+  parser.set_module_event_sink(&module_events);
+
+  EventCaptureReader reader;
+  ASSERT_TRUE(reader.Open(capture_path_));
+  EVENT_TRACE event = {};
+  while (reader.ReadEvent(&event))
+    parser.ProcessOneEvent(&event);
+  EXPECT_FALSE(reader.error());
+}
+
+// Writes half a gigabyte of log messages to a capture, then feeds the
+// capture through a LogParser several times, logging the write and replay
+// rates. It needs that much free disk space, so it's disabled by default.
+TEST_F(EventCaptureTest, DISABLED_ReplayBenchmark) {
+  // The capture is replayed several times over, so as to read a few GB
+  // without having to map that much at once.
+  const size_t kCaptureSize = 512 * 1024 * 1024;
+  const size_t kNumReplays = 8;
+
+  EventTrace log_msg(logging::kLogEventId, logging::LOG_MESSAGE,
+      TRACE_LEVEL_INFORMATION, 1, 2, base::Time::Now(), sizeof(kMsgText),
+      kMsgText);
+
+  EventCaptureWriter writer;
+  ASSERT_TRUE(writer.Open(capture_path_));
+  base::Time start = base::Time::Now();
+  size_t bytes_written = 0;
+  while (bytes_written < kCaptureSize) {
+    ASSERT_TRUE(writer.WriteEvent(log_msg));
+    bytes_written += sizeof(EventCaptureRecord) + sizeof(kMsgText);
+  }
+  size_t num_events = writer.num_events();
+  ASSERT_TRUE(writer.Close());
+  base::TimeDelta write_time = base::Time::Now() - start;
+
+  CountingLogEvents events;
+  LogParser parser;
+  parser.set_event_sink(&events);
+
+  EventCaptureReader reader;
+  ASSERT_TRUE(reader.Open(capture_path_));
+  start = base::Time::Now();
+  for (size_t i = 0; i < kNumReplays; ++i) {
+    ASSERT_TRUE(reader.Seek(sizeof(EventCaptureHeader)));
+    EVENT_TRACE event;
+    while (reader.ReadEvent(&event))
+      parser.ProcessOneEvent(&event);
+    ASSERT_FALSE(reader.error());
+  }
+  base::TimeDelta replay_time = base::Time::Now() - start;
+  EXPECT_EQ(num_events * kNumReplays, events.num_messages());
+
+  double replayed_mb =
+      static_cast<double>(reader.size()) * kNumReplays / (1024 * 1024);
+  LOG(INFO) << "Wrote " << num_events << " events, "
+            << reader.size() / (1024 * 1024) << " MB, in "
+            << write_time.InMilliseconds() << " ms.";
+  LOG(INFO) << "Replayed " << num_events * kNumReplays << " events, "
+            << static_cast<int64>(replayed_mb) << " MB, in "
+            << replay_time.InMilliseconds() << " ms, "
+            << static_cast<int64>(replayed_mb / replay_time.InSecondsF())
+            << " MB/s.";
+}
@@ -27,6 +27,8 @@
       'target_name': 'log_lib',
       'type': 'static_library',
       'sources': [
+        'event_capture.cc',
+        'event_capture.h',
         'kernel_log_consumer.cc',
         'kernel_log_consumer.h',
         'log_consumer.cc',
@@ -66,6 +68,7 @@
       'target_name': 'log_lib_unittests',
       'type': 'executable',
       'sources': [
+        'event_capture_unittest.cc',
         'kernel_log_consumer_unittest.cc',
         'log_consumer_unittest.cc',
         'log_lib_unittest_main.cc',
@@ -17,6 +17,43 @@
 
 #include <algorithm>
 #include "base/message_loop.h"
+#include "sawbuck/sym_util/symbol_cache.h"
+
+namespace {
+
+// Resolves symbols with dbghelp.
+class DbgHelpSymbolSource : public SymbolLookupService::SymbolSource {
+ public:
+  explicit DbgHelpSymbolSource(
+      SymbolLookupService::StatusCallback* status_callback) {
+    cache_.set_status_callback(status_callback);
+  }
+
+  virtual void SetSymbolPath(const wchar_t* symbol_path) {
+    cache_.SetSymbolPath(symbol_path);
+  }
+
+  virtual bool Initialize(
+      const std::vector<sym_util::ModuleInformation>& modules) {
+    std::vector<sym_util::ModuleInformation> copy(modules);
+    return cache_.Initialize(copy.size(), copy.empty() ? NULL : &copy[0]);
+  }
+
+  virtual bool GetSymbolForAddress(sym_util::Address address,
+                                   sym_util::Symbol* symbol) {
+    return cache_.GetSymbolForAddress(address, symbol);
+  }
+
+ private:
+  sym_util::SymbolCache cache_;
+};
+
+bool ModuleBaseLess(const sym_util::ModuleInformation& a,
+                    const sym_util::ModuleInformation& b) {
+  return a.base_address < b.base_address;
+}
+
+}  // namespace
 
 // We mandate that we outlive the background thread and the
 // UI thread we live on, so noop retention is safe.
@@ -38,29 +75,55 @@ struct RunnableMethodTraits<SymbolLookupService> {
 SymbolLookupService::SymbolLookupService() : background_thread_(NULL),
     foreground_thread_(MessageLoop::current()), status_callback_(NULL),
     resolve_task_(NULL), callback_task_(NULL), next_request_id_(0),
-    unprocessed_id_(0) {
+    unprocessed_id_(0),
+    symbol_cache_(sym_util::SharedSymbolCache::kDefaultMaxMemory) {
 }
 
 SymbolLookupService::~SymbolLookupService() {
   // Make sure there aren't any tasks pending for this object.
   DCHECK(resolve_task_ == NULL);
   DCHECK(callback_task_ == NULL);
+
+  LoadStateList::iterator it(load_states_.begin());
+  for (; it != load_states_.end(); ++it)
+    delete it->source;
 }
 
 SymbolLookupService::Handle SymbolLookupService::ResolveAddress(
     sym_util::ProcessId process_id, const base::Time& time,
     sym_util::Address address, SymbolResolvedCallback* callback) {
-  DCHECK_EQ(foreground_thread_, MessageLoop::current());
   DCHECK(callback != NULL);
 
+  return EnqueueRequest(process_id, time,
+                        std::vector<sym_util::Address>(1, address),
+                        callback, NULL);
+}
+
+SymbolLookupService::Handle SymbolLookupService::ResolveAddresses(
+    sym_util::ProcessId process_id, const base::Time& time,
+    const std::vector<sym_util::Address>& addresses,
+    SymbolsResolvedCallback* callback) {
+  DCHECK(callback != NULL);
+
+  return EnqueueRequest(process_id, time, addresses, NULL, callback);
+}
+
+SymbolLookupService::Handle SymbolLookupService::EnqueueRequest(
+    sym_util::ProcessId process_id, const base::Time& time,
+    const std::vector<sym_util::Address>& addresses,
+    SymbolResolvedCallback* callback,
+    SymbolsResolvedCallback* batch_callback) {
+  DCHECK_EQ(foreground_thread_, MessageLoop::current());
+
   base::AutoLock lock(resolution_lock_);
   Handle request_id = next_request_id_++;
   DCHECK(requests_.end() == requests_.find(request_id));
   Request& request = requests_[request_id];
   request.process_id_ = process_id;
   request.time_ = time;
-  request.address_ = address;
+  request.addresses_ = addresses;
   request.callback_ = callback;
+  request.batch_callback_ = batch_callback;
 
   // Post a task to do the symbol resolution unless one is already pending,
   // or currently executing. The task will NULL this field as it exits
@@ -81,6 +144,7 @@ void SymbolLookupService::CancelRequest(Handle request_handle) {
   RequestMap::iterator it = requests_.find(request_handle);
   DCHECK(it != requests_.end());
   delete it->second.callback_;
+  delete it->second.batch_callback_;
   requests_.erase(it);
 }
 
@@ -140,68 +204,109 @@ void SymbolLookupService::OnModuleLoad(
   module_cache_.ModuleLoaded(process_id, time, module_info);
 }
 
-bool SymbolLookupService::ResolveAddressImpl(sym_util::ProcessId pid,
-                                             const base::Time& time,
-                                             sym_util::Address address,
-                                             sym_util::Symbol* symbol) {
+SymbolLookupService::SymbolSource* SymbolLookupService::CreateSymbolSource() {
+  return new DbgHelpSymbolSource(status_callback_);
+}
+
+void SymbolLookupService::ResolveAddressesImpl(
+    sym_util::ProcessId pid, const base::Time& time,
+    const std::vector<sym_util::Address>& addresses,
+    std::vector<sym_util::Symbol>* symbols) {
+  DCHECK_EQ(background_thread_, MessageLoop::current());
+  DCHECK(symbols != NULL);
+
+  LoadState* load_state = GetLoadState(pid, time);
+  symbols->resize(addresses.size());
+  for (size_t i = 0; i < addresses.size(); ++i)
+    ResolveInLoadState(load_state, addresses[i], &symbols->at(i));
+
+  // Clear the last status we posted.
+  if (status_callback_)
+    status_callback_->Run(L"Ready\r\n");
+}
+
+SymbolLookupService::LoadState* SymbolLookupService::GetLoadState(
+    sym_util::ProcessId pid, const base::Time& time) {
   DCHECK_EQ(background_thread_, MessageLoop::current());
   using sym_util::ModuleCache;
-  using sym_util::SymbolCache;
-
-  ModuleCache::ModuleLoadStateId id;
-  SymbolCacheMap::iterator it;
-
-  {
-    // Hold the module lock only while accessing the module cache.
-    base::AutoLock lock(module_lock_);
-
-    id = module_cache_.GetStateId(pid, time);
-    it = symbol_caches_.find(id);
-    if (it == symbol_caches_.end()) {
-      // We have a miss, initialize a cache for this module id.
-      if (symbol_caches_.size() == kMaxCacheSize) {
-        // Evict the least recently used element.
-        ModuleCache::ModuleLoadStateId to_evict = lru_module_id_.front();
-        lru_module_id_.erase(lru_module_id_.begin());
-        symbol_caches_.erase(to_evict);
-      }
 
-      std::pair<SymbolCacheMap::iterator, bool> inserted =
-          symbol_caches_.insert(std::make_pair(id, SymbolCache()));
+  // The module cache is also updated from other threads.
+  base::AutoLock lock(module_lock_);
 
-      DCHECK_EQ(inserted.second, true);
-      SymbolCache& cache = inserted.first->second;
-      cache.set_status_callback(status_callback_);
+  ModuleCache::ModuleLoadStateId id = module_cache_.GetStateId(pid, time);
+  LoadStateMap::iterator it(load_state_map_.find(id));
+  if (it != load_state_map_.end()) {
+    // We have a hit, move it to the front of the LRU.
+    load_states_.splice(load_states_.begin(), load_states_, it->second);
+    return &load_states_.front();
+  }
 
-      std::vector<ModuleInformation> modules;
-      module_cache_.GetProcessModuleState(pid, time, &modules);
-      cache.SetSymbolPath(symbol_path_.c_str());
-      cache.Initialize(modules.size(), modules.size() ? &modules[0] : NULL);
+  // We have a miss, evict the least recently used load state if need be.
+  if (load_states_.size() == kMaxCacheSize) {
+    LoadState& evicted = load_states_.back();
+    delete evicted.source;
+    load_state_map_.erase(evicted.id);
+    load_states_.pop_back();
+  }
 
-      it = inserted.first;
-    } else {
-      // We have a hit, manage the LRU by removing our ID.
-      // It will be pushed to the back of the LRU just below.
-      lru_module_id_.erase(
-          std::find(lru_module_id_.begin(), lru_module_id_.end(), id));
-    }
+  load_states_.push_front(LoadState());
+  load_state_map_[id] = load_states_.begin();
+
+  LoadState& load_state = load_states_.front();
+  load_state.id = id;
+  module_cache_.GetProcessModuleState(pid, time, &load_state.modules);
+  std::sort(load_state.modules.begin(), load_state.modules.end(),
+            ModuleBaseLess);
+  for (size_t i = 0; i < load_state.modules.size(); ++i) {
+    load_state.module_keys.push_back(
+        symbol_cache_.GetModuleKey(load_state.modules[i]));
   }
 
-  // Push our id to the back of the lru list.
-  lru_module_id_.push_back(id);
+  return &load_state;
+}
+
+void SymbolLookupService::ResolveInLoadState(LoadState* load_state,
+                                             sym_util::Address address,
+                                             sym_util::Symbol* symbol) {
+  DCHECK(load_state != NULL);
+  DCHECK(symbol != NULL);
+
+  // Find the module containing address, there's nothing to resolve
+  // against if there's none.
+  sym_util::ModuleInformation key = { 0 };
+  key.base_address = address;
+  std::vector<sym_util::ModuleInformation>::const_iterator it(
+      std::upper_bound(load_state->modules.begin(),
+                       load_state->modules.end(),
+                       key,
+                       ModuleBaseLess));
+  if (it == load_state->modules.begin())
+    return;
+  --it;
+  if (address >= it->base_address + it->module_size)
+    return;
+
+  // Try the shared cache first, any process that loaded this module
+  // may have resolved the address.
+  size_t index = it - load_state->modules.begin();
+  sym_util::Offset rva = address - it->base_address;
+  sym_util::SharedSymbolCache::ModuleKey module_key =
+      load_state->module_keys[index];
+  if (symbol_cache_.Lookup(module_key, rva, symbol)) {
+    symbol->module_base = it->base_address;
+    return;
+  }
 
-  DCHECK(it != symbol_caches_.end());
-  SymbolCache& cache = it->second;
+  if (load_state->source == NULL) {
+    load_state->source = CreateSymbolSource();
+    load_state->source->SetSymbolPath(symbol_path_.c_str());
+    load_state->source->Initialize(load_state->modules);
+  }
 
   // This can take a long time, so it's important not to
   // hold the module lock over this operation.
-  bool ret = cache.GetSymbolForAddress(address, symbol);
-
-  // Clear the last status we posted.
-  if (status_callback_)
-    status_callback_->Run(L"Ready\r\n");
-
-  return ret;
+  if (load_state->source->GetSymbolForAddress(address, symbol))
+    symbol_cache_.Insert(module_key, rva, *symbol);
 }
 
 void SymbolLookupService::ResolveCallback() {
@@ -226,11 +331,11 @@ void SymbolLookupService::ResolveCallback() {
     }
 
     // Don't hold the lock over the symbol resolution proper.
-    sym_util::Symbol symbol;
-    ResolveAddressImpl(request.process_id_,
-                       request.time_,
-                       request.address_,
-                       &symbol);
+    std::vector<sym_util::Symbol> symbols;
+    ResolveAddressesImpl(request.process_id_,
+                         request.time_,
+                         request.addresses_,
+                         &symbols);
 
     // Store the result, mindfully of the fact that the request
     // might have been cancelled while we did the resolution.
@@ -239,7 +344,7 @@ void SymbolLookupService::ResolveCallback() {
 
       RequestMap::iterator it = requests_.find(request_id);
       if (it != requests_.end()) {
-        it->second.resolved_ = symbol;
+        it->second.resolved_.swap(symbols);
 
         if (!callback_task_) {
           callback_task_ = NewRunnableMethod(
@@ -257,9 +362,14 @@ void SymbolLookupService::SetSymbolPathCallback(const std::wstring& path) {
   DCHECK_EQ(background_thread_, MessageLoop::current());
 
   symbol_path_ = path;
-  SymbolCacheMap::iterator it(symbol_caches_.begin());
-  for (; it != symbol_caches_.end(); ++it)
-    it->second.SetSymbolPath(symbol_path_.c_str());
+  LoadStateList::iterator it(load_states_.begin());
+  for (; it != load_states_.end(); ++it) {
+    if (it->source != NULL)
+      it->source->SetSymbolPath(symbol_path_.c_str());
+  }
+
+  // Symbols may resolve differently with the new path.
+  symbol_cache_.Clear();
 }
 
 void SymbolLookupService::IssueCallbacks() {
@@ -283,12 +393,20 @@ void SymbolLookupService::IssueCallbacks() {
       requests_.erase(it);
     }
 
-    request.callback_->Run(request.process_id_,
-                           request.time_,
-                           request.address_,
-                           request_id,
-                           request.resolved_);
-
-    delete request.callback_;
+    if (request.callback_ != NULL) {
+      DCHECK_EQ(1U, request.resolved_.size());
+      request.callback_->Run(request.process_id_,
+                             request.time_,
+                             request.addresses_[0],
+                             request_id,
+                             request.resolved_[0]);
+      delete request.callback_;
+    } else {
+      request.batch_callback_->Run(request.process_id_,
+                                   request.time_,
+                                   request_id,
+                                   request.resolved_);
+      delete request.batch_callback_;
+    }
   }
 }
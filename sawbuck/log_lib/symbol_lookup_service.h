@@ -16,6 +16,8 @@
 #ifndef SAWBUCK_LOG_LIB_SYMBOL_LOOKUP_SERVICE_H_
 #define SAWBUCK_LOG_LIB_SYMBOL_LOOKUP_SERVICE_H_
 
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 #include "base/callback.h"
@@ -24,7 +26,7 @@
 #include "base/time.h"
 #include "sawbuck/log_lib/kernel_log_consumer.h"
 #include "sawbuck/sym_util/module_cache.h"
-#include "sawbuck/sym_util/symbol_cache.h"
+#include "sawbuck/sym_util/shared_symbol_cache.h"
 
 class ISymbolLookupService {
  public:
@@ -35,6 +37,9 @@ class ISymbolLookupService {
   // Type of the resolution callback.
   typedef Callback5<sym_util::ProcessId, base::Time, sym_util::Address,
       Handle, const sym_util::Symbol&>::Type SymbolResolvedCallback;
+  // Type of the batch resolution callback.
+  typedef Callback4<sym_util::ProcessId, base::Time, Handle,
+      const std::vector<sym_util::Symbol>&>::Type SymbolsResolvedCallback;
 
   // Enqueues an address resolution request for @p address in the context of
   // @p process_id at @p time.
@@ -49,9 +54,25 @@ class ISymbolLookupService {
                                 sym_util::Address address,
                                 SymbolResolvedCallback* callback) = 0;
 
+  // Enqueues a request to resolve all of @p addresses in the context of
+  // @p process_id at @p time, e.g. the frames of a stack trace. This is
+  // cheaper than resolving the addresses one by one.
+  // @param process_id the process where @p addresses were observed.
+  // @param time the time when @p addresses were observed.
+  // @param addresses the addresses to lookup.
+  // @param callback a callback object which gets invoked with the symbols
+  //    for @p addresses, in the same order, when resolution completes.
+  // @returns the request handle on success, or kInvalidHandle on error.
+  virtual Handle ResolveAddresses(
+      sym_util::ProcessId process_id,
+      const base::Time& time,
+      const std::vector<sym_util::Address>& addresses,
+      SymbolsResolvedCallback* callback) = 0;
+
   // Cancel a pending async symbol resolution request.
   // @param request_handle a request handle previously returned from
-  //    ResolveAddress, whose callback has not yet been invoked.
+  //    ResolveAddress or ResolveAddresses, whose callback has not yet been
+  //    invoked.
   virtual void CancelRequest(Handle request_handle) = 0;
 
   // Change the symbol path to @p symbol_path.
@@ -68,8 +89,26 @@ class SymbolLookupService
     : public ISymbolLookupService,
       public KernelModuleEvents {
  public:
+  // Resolves addresses against the modules of a module load state.
+  // SymbolLookupService resolves through dbghelp by default, but a
+  // subclass can substitute its own source for testing.
+  class SymbolSource {
+   public:
+    virtual ~SymbolSource() {
+    }
+
+    // Sets the symbol path to search for symbols.
+    virtual void SetSymbolPath(const wchar_t* symbol_path) = 0;
+    // Initializes the source to the set of modules provided.
+    virtual bool Initialize(
+        const std::vector<sym_util::ModuleInformation>& modules) = 0;
+    // Resolves @p address to @p symbol.
+    virtual bool GetSymbolForAddress(sym_util::Address address,
+                                     sym_util::Symbol* symbol) = 0;
+  };
+
   SymbolLookupService();
-  ~SymbolLookupService();
+  virtual ~SymbolLookupService();
 
   typedef Callback1<const wchar_t*>::Type StatusCallback;
   void set_status_callback(StatusCallback* status_callback) {
@@ -88,6 +127,11 @@ class SymbolLookupService
                                 const base::Time& time,
                                 sym_util::Address address,
                                 SymbolResolvedCallback* callback);
+  virtual Handle ResolveAddresses(
+      sym_util::ProcessId process_id,
+      const base::Time& time,
+      const std::vector<sym_util::Address>& addresses,
+      SymbolsResolvedCallback* callback);
   virtual void CancelRequest(Handle request_handle);
   virtual void SetSymbolPath(const wchar_t* symbol_path);
 
@@ -102,12 +146,45 @@ class SymbolLookupService
                             const base::Time& time,
                             const ModuleInformation& module_info);
 
+ protected:
+  // Creates a symbol source, invoked on the background thread.
+  virtual SymbolSource* CreateSymbolSource();
+
  private:
-  virtual bool ResolveAddressImpl(sym_util::ProcessId process_id,
-                                  const base::Time& time,
-                                  sym_util::Address address,
-                                  sym_util::Symbol* symbol);
+  // The modules of a module load state, and the symbol source we resolve
+  // addresses in that state with, which we create on first use.
+  struct LoadState {
+    LoadState() : id(0), source(NULL) {
+    }
+
+    sym_util::ModuleCache::ModuleLoadStateId id;
+    // Sorted by base address.
+    std::vector<sym_util::ModuleInformation> modules;
+    // The shared symbol cache keys of the above.
+    std::vector<sym_util::SharedSymbolCache::ModuleKey> module_keys;
+    SymbolSource* source;
+  };
+  typedef std::list<LoadState> LoadStateList;
+  typedef std::map<sym_util::ModuleCache::ModuleLoadStateId,
+      LoadStateList::iterator> LoadStateMap;
 
+  void ResolveAddressesImpl(sym_util::ProcessId process_id,
+                            const base::Time& time,
+                            const std::vector<sym_util::Address>& addresses,
+                            std::vector<sym_util::Symbol>* symbols);
+  // Returns the load state of @p process_id at @p time.
+  LoadState* GetLoadState(sym_util::ProcessId process_id,
+                          const base::Time& time);
+  // Resolves @p address in @p load_state.
+  void ResolveInLoadState(LoadState* load_state,
+                          sym_util::Address address,
+                          sym_util::Symbol* symbol);
+
+  Handle EnqueueRequest(sym_util::ProcessId process_id,
+                        const base::Time& time,
+                        const std::vector<sym_util::Address>& addresses,
+                        SymbolResolvedCallback* callback,
+                        SymbolsResolvedCallback* batch_callback);
   void SetSymbolPathCallback(const std::wstring& path);
   void ResolveCallback();
   void IssueCallbacks();
@@ -115,24 +192,28 @@ class SymbolLookupService
   base::Lock module_lock_;
   sym_util::ModuleCache module_cache_;  // Under module_lock_.
 
-  // We keep a cache of symbol cache instances keyed on module
-  // load state id with an lru replacement policy.
-  typedef std::map<sym_util::ModuleCache::ModuleLoadStateId,
-      sym_util::SymbolCache> SymbolCacheMap;
+  // We keep the most recently used load states, with the most recently
+  // used at the front of the list.
   static const size_t kMaxCacheSize = 10;
-  typedef std::vector<sym_util::ModuleCache::ModuleLoadStateId>
-      LoadStateVector;
-  LoadStateVector lru_module_id_;
-  SymbolCacheMap symbol_caches_;
+  LoadStateList load_states_;
+  LoadStateMap load_state_map_;
   std::wstring symbol_path_;
 
+  // The symbols we've resolved, shared across all load states.
+  sym_util::SharedSymbolCache symbol_cache_;
+
   base::Lock resolution_lock_;
   struct Request {
+    Request() : callback_(NULL), batch_callback_(NULL) {
+    }
+
     sym_util::ProcessId process_id_;
     base::Time time_;
-    sym_util::Address address_;
+    std::vector<sym_util::Address> addresses_;
+    // Exactly one of these is set.
     SymbolResolvedCallback* callback_;
-    sym_util::Symbol resolved_;
+    SymbolsResolvedCallback* batch_callback_;
+    std::vector<sym_util::Symbol> resolved_;
   };
   // Under resolution_lock_.
   typedef std::map<Handle, Request> RequestMap;
@@ -18,6 +18,7 @@
 #include <vector>
 #include <tlhelp32.h>
 #include "base/message_loop.h"
+#include "base/stringprintf.h"
 #include "base/threading/thread.h"
 #include "base/win/pe_image.h"
 #include "base/win/scoped_handle.h"
@@ -167,4 +168,168 @@ TEST_F(SymbolLookupServiceTest, LookupFooCancel) {
   ASSERT_EQ(5, resolved_.size());
 }
 
+// A symbol source that makes symbols up from module relative addresses,
+// and counts the lookups it does.
+class FakeSymbolSource : public SymbolLookupService::SymbolSource {
+ public:
+  explicit FakeSymbolSource(int* lookups) : lookups_(lookups) {
+  }
+
+  virtual void SetSymbolPath(const wchar_t* symbol_path) {
+  }
+
+  virtual bool Initialize(
+      const std::vector<sym_util::ModuleInformation>& modules) {
+    modules_ = modules;
+    return true;
+  }
+
+  virtual bool GetSymbolForAddress(sym_util::Address address,
+                                   sym_util::Symbol* symbol) {
+    ++*lookups_;
+    for (size_t i = 0; i < modules_.size(); ++i) {
+      const sym_util::ModuleInformation& module = modules_[i];
+      if (address >= module.base_address &&
+          address < module.base_address + module.module_size) {
+        symbol->module = module.image_file_name;
+        symbol->module_base = module.base_address;
+        symbol->name = StringPrintf(L"Function_%llX",
+                                    address - module.base_address);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+ private:
+  std::vector<sym_util::ModuleInformation> modules_;
+  int* lookups_;
+};
+
+class FakeSymbolLookupService : public SymbolLookupService {
+ public:
+  FakeSymbolLookupService() : sources_(0), lookups_(0) {
+  }
+
+  // The number of symbol sources created, and lookups done through them.
+  int sources_;
+  int lookups_;
+
+ protected:
+  virtual SymbolSource* CreateSymbolSource() {
+    ++sources_;
+    return new FakeSymbolSource(&lookups_);
+  }
+};
+
+const sym_util::ProcessId kPid1 = 42;
+const sym_util::ProcessId kPid2 = 43;
+
+class FakeSymbolLookupServiceTest: public testing::Test {
+ public:
+  FakeSymbolLookupServiceTest() : background_thread_("Background Thread") {
+  }
+
+  virtual void SetUp() {
+    ASSERT_TRUE(background_thread_.Start());
+    service_.set_background_thread(background_thread_.message_loop());
+
+    // Two processes load the same module at different addresses.
+    base::Time start(base::Time::Now());
+    service_.OnModuleLoad(kPid1, start, MakeModule(L"foo.dll", 0x10000000));
+    service_.OnModuleLoad(kPid1, start, MakeModule(L"bar.dll", 0x20000000));
+    service_.OnModuleLoad(kPid2, start, MakeModule(L"foo.dll", 0x30000000));
+  }
+
+  virtual void TearDown() {
+    background_thread_.Stop();
+  }
+
+  static sym_util::ModuleInformation MakeModule(const wchar_t* name,
+                                                sym_util::ModuleBase base) {
+    sym_util::ModuleInformation module = { 0 };
+    module.base_address = base;
+    module.module_size = 0x100000;
+    module.image_file_name = name;
+    return module;
+  }
+
+  void Resolve(sym_util::ProcessId pid,
+               const std::vector<sym_util::Address>& addresses) {
+    SymbolLookupService::Handle h =
+        service_.ResolveAddresses(
+            pid, base::Time::Now(), addresses,
+            NewCallback(static_cast<FakeSymbolLookupServiceTest*>(this),
+                        &FakeSymbolLookupServiceTest::SymbolsResolved));
+    ASSERT_NE(SymbolLookupService::kInvalidHandle, h);
+
+    background_thread_.message_loop()->PostTask(FROM_HERE,
+        NewRunnableFunction(QuitMessageLoop, MessageLoop::current()));
+    message_loop_.Run();
+  }
+
+  void SymbolsResolved(sym_util::ProcessId pid, base::Time time,
+      SymbolLookupService::Handle handle,
+      const std::vector<sym_util::Symbol>& symbols) {
+    EXPECT_EQ(&message_loop_, MessageLoop::current());
+    symbols_ = symbols;
+  }
+
+ protected:
+  std::vector<sym_util::Symbol> symbols_;
+
+  MessageLoop message_loop_;
+  base::Thread background_thread_;
+  FakeSymbolLookupService service_;
+};
+
+TEST_F(FakeSymbolLookupServiceTest, ResolveAddresses) {
+  std::vector<sym_util::Address> addresses;
+  addresses.push_back(0x10000100);
+  addresses.push_back(0x20000200);
+  addresses.push_back(0x00000300);
+  addresses.push_back(0x10000100);
+  Resolve(kPid1, addresses);
+
+  ASSERT_EQ(4, symbols_.size());
+  EXPECT_EQ(L"foo.dll", symbols_[0].module);
+  EXPECT_EQ(0x10000000, symbols_[0].module_base);
+  EXPECT_EQ(L"Function_100", symbols_[0].name);
+  EXPECT_EQ(L"bar.dll", symbols_[1].module);
+  EXPECT_EQ(L"Function_200", symbols_[1].name);
+  // The third address isn't in any module.
+  EXPECT_EQ(L"", symbols_[2].name);
+  EXPECT_EQ(L"Function_100", symbols_[3].name);
+
+  // The whole batch was resolved against a single source, and the repeated
+  // address was only looked up once.
+  EXPECT_EQ(1, service_.sources_);
+  EXPECT_EQ(2, service_.lookups_);
+}
+
+TEST_F(FakeSymbolLookupServiceTest, SharesModulesAcrossProcesses) {
+  Resolve(kPid1, std::vector<sym_util::Address>(1, 0x10000100));
+  ASSERT_EQ(1, symbols_.size());
+  EXPECT_EQ(L"Function_100", symbols_[0].name);
+  EXPECT_EQ(1, service_.lookups_);
+
+  // The second process gets the symbol from the cache, relocated to where
+  // it loaded the module.
+  Resolve(kPid2, std::vector<sym_util::Address>(1, 0x30000100));
+  ASSERT_EQ(1, symbols_.size());
+  EXPECT_EQ(L"Function_100", symbols_[0].name);
+  EXPECT_EQ(0x30000000, symbols_[0].module_base);
+  EXPECT_EQ(1, service_.sources_);
+  EXPECT_EQ(1, service_.lookups_);
+
+  // A new symbol path invalidates the cached symbols.
+  service_.SetSymbolPath(L"c:\\symbols");
+  Resolve(kPid2, std::vector<sym_util::Address>(1, 0x30000100));
+  ASSERT_EQ(1, symbols_.size());
+  EXPECT_EQ(L"Function_100", symbols_[0].name);
+  EXPECT_EQ(2, service_.sources_);
+  EXPECT_EQ(2, service_.lookups_);
+}
+
 }  // namespace
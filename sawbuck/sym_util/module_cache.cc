@@ -15,13 +15,32 @@
 // Module cache implementation.
 #include "sawbuck/sym_util/module_cache.h"
 
+#include "base/basictypes.h"
+#include "base/logging.h"
+
 namespace sym_util {
 
-// The empty module load state.
-ModuleCache::ModuleLoadState ModuleCache::empty_;
+namespace {
+
+// The number of node hash buckets we start out with.
+const size_t kInitialNodeBuckets = 1024;
+
+// Scrambles the bits of @p value.
+size_t Mix(size_t value) {
+  uint32 x = static_cast<uint32>(value);
+  x = (x ^ (x >> 16)) * 0x45D9F3B;
+  x = (x ^ (x >> 16)) * 0x45D9F3B;
+  return x ^ (x >> 16);
+}
+
+}  // namespace
 
+const ModuleCache::NodeId ModuleCache::kEmptyState;
 
-ModuleCache::ModuleCache() : next_module_load_state_id_(0) {
+ModuleCache::ModuleCache() : node_buckets_(kInitialNodeBuckets, kEmptyState) {
+  // The empty treap.
+  Node empty = { 0, kEmptyState, kEmptyState, 0, kEmptyState };
+  nodes_.push_back(empty);
 }
 
 void ModuleCache::ModuleLoaded(ProcessId pid,
@@ -29,14 +48,10 @@ void ModuleCache::ModuleLoaded(ProcessId pid,
                                const ModuleInformation& module) {
   ModuleStateKey key(pid, time);
 
-  // Find the state we have for this process.
-  ModuleLoadState state(GetStateForProcess(key));
-
-  // Add the new module.
-  state.insert(GetModuleId(module));
-
-  // And store it.
-  SetProcessState(key, GetModuleLoadStateId(state));
+  // Find the state we have for this process, add the new module,
+  // and store it.
+  NodeId state = GetStateForProcess(key);
+  SetProcessState(key, InsertModule(state, GetModuleId(module)));
 }
 
 void ModuleCache::ModuleUnloaded(ProcessId pid,
@@ -44,14 +59,10 @@ void ModuleCache::ModuleUnloaded(ProcessId pid,
                                  const ModuleInformation& module) {
   ModuleStateKey key(pid, time);
 
-  // Find the state we have for this process.
-  ModuleLoadState state(GetStateForProcess(key));
-
-  // Remove the module.
-  state.erase(GetModuleId(module));
-
-  // And store it.
-  SetProcessState(key, GetModuleLoadStateId(state));
+  // Find the state we have for this process, remove the module,
+  // and store it.
+  NodeId state = GetStateForProcess(key);
+  SetProcessState(key, EraseModule(state, GetModuleId(module)));
 }
 
 bool ModuleCache::GetProcessModuleState(
@@ -61,14 +72,11 @@ bool ModuleCache::GetProcessModuleState(
 
   ModuleStateKey key(pid, time);
   // Find the state we have for this process.
-  const ModuleLoadState& state(GetStateForProcess(key));
-  if (state.empty())
+  NodeId state = GetStateForProcess(key);
+  if (state == kEmptyState)
     return false;
 
-  ModuleLoadState::const_iterator it(state.begin());
-  ModuleLoadState::const_iterator end(state.end());
-  for (; it != end; ++it)
-    modules->push_back(GetModule(*it));
+  AppendModules(state, modules);
 
   return true;
 }
@@ -96,23 +104,143 @@ const ModuleInformation& ModuleCache::GetModule(ModuleId id) {
   return modules_[id];
 }
 
-ModuleCache::ModuleLoadStateId ModuleCache::GetModuleLoadStateId(
-    const ModuleLoadState& state) {
-  ModuleLoadStateMap::iterator it(module_load_state_ids_.find(state));
+ModuleCache::NodeId ModuleCache::GetNode(ModuleId module,
+                                         NodeId left,
+                                         NodeId right) {
+  size_t hash = HashNode(module, left, right);
+  size_t bucket = hash % node_buckets_.size();
+  for (NodeId id = node_buckets_[bucket]; id != kEmptyState;
+       id = nodes_[id].next) {
+    const Node& node = nodes_[id];
+    if (node.module == module && node.left == left && node.right == right)
+      return id;
+  }
 
-  if (it != module_load_state_ids_.end())
-    return it->second;
+  // Grow the table as needed to keep the chains short.
+  if (nodes_.size() >= node_buckets_.size()) {
+    std::vector<NodeId> buckets(node_buckets_.size() * 2, kEmptyState);
+    for (NodeId id = 1; id < nodes_.size(); ++id) {
+      Node& node = nodes_[id];
+      size_t new_bucket = node.hash % buckets.size();
+      node.next = buckets[new_bucket];
+      buckets[new_bucket] = id;
+    }
+    node_buckets_.swap(buckets);
+    bucket = hash % node_buckets_.size();
+  }
 
-  ModuleLoadStateId id = next_module_load_state_id_++;
-  module_load_state_ids_.insert(std::make_pair(state, id));
-  module_load_states_.push_back(state);
+  Node node = { module, left, right, hash, node_buckets_[bucket] };
+  NodeId id = nodes_.size();
+  nodes_.push_back(node);
+  node_buckets_[bucket] = id;
 
   return id;
 }
 
-const ModuleCache::ModuleLoadState& ModuleCache::GetModuleLoadState(
-    ModuleLoadStateId id) {
-  return module_load_states_[id];
+ModuleCache::NodeId ModuleCache::InsertModule(NodeId root, ModuleId module) {
+  if (root == kEmptyState)
+    return GetNode(module, kEmptyState, kEmptyState);
+
+  // Note that we copy the node, as nodes_ may grow under us.
+  Node node = nodes_[root];
+  if (module == node.module)
+    return root;
+
+  if (module < node.module) {
+    NodeId left = InsertModule(node.left, module);
+    const Node& child = nodes_[left];
+    if (HasHigherPriority(child.module, node.module)) {
+      // The new module belongs above this node, rotate it up.
+      Node rotated = child;
+      return GetNode(rotated.module,
+                     rotated.left,
+                     GetNode(node.module, rotated.right, node.right));
+    }
+    return GetNode(node.module, left, node.right);
+  } else {
+    NodeId right = InsertModule(node.right, module);
+    const Node& child = nodes_[right];
+    if (HasHigherPriority(child.module, node.module)) {
+      Node rotated = child;
+      return GetNode(rotated.module,
+                     GetNode(node.module, node.left, rotated.left),
+                     rotated.right);
+    }
+    return GetNode(node.module, node.left, right);
+  }
+}
+
+ModuleCache::NodeId ModuleCache::EraseModule(NodeId root, ModuleId module) {
+  if (root == kEmptyState)
+    return root;
+
+  Node node = nodes_[root];
+  if (module < node.module) {
+    NodeId left = EraseModule(node.left, module);
+    if (left == node.left)
+      return root;
+    return GetNode(node.module, left, node.right);
+  } else if (node.module < module) {
+    NodeId right = EraseModule(node.right, module);
+    if (right == node.right)
+      return root;
+    return GetNode(node.module, node.left, right);
+  }
+
+  return Merge(node.left, node.right);
+}
+
+ModuleCache::NodeId ModuleCache::Merge(NodeId left, NodeId right) {
+  if (left == kEmptyState)
+    return right;
+  if (right == kEmptyState)
+    return left;
+
+  Node left_node = nodes_[left];
+  Node right_node = nodes_[right];
+  DCHECK(left_node.module < right_node.module);
+  if (HasHigherPriority(left_node.module, right_node.module)) {
+    return GetNode(left_node.module,
+                   left_node.left,
+                   Merge(left_node.right, right));
+  } else {
+    return GetNode(right_node.module,
+                   Merge(left, right_node.left),
+                   right_node.right);
+  }
+}
+
+void ModuleCache::AppendModules(NodeId root,
+                                std::vector<ModuleInformation>* modules) {
+  // Walk the treap in order, without recursing.
+  std::vector<NodeId> stack;
+  while (root != kEmptyState || !stack.empty()) {
+    if (root != kEmptyState) {
+      stack.push_back(root);
+      root = nodes_[root].left;
+    } else {
+      const Node& node = nodes_[stack.back()];
+      stack.pop_back();
+      modules->push_back(GetModule(node.module));
+      root = node.right;
+    }
+  }
+}
+
+bool ModuleCache::HasHigherPriority(ModuleId a, ModuleId b) {
+  size_t priority_a = Mix(a);
+  size_t priority_b = Mix(b);
+  if (priority_a != priority_b)
+    return priority_a > priority_b;
+
+  // Break ties by id, so that every set of modules has a unique shape.
+  return a < b;
+}
+
+size_t ModuleCache::HashNode(ModuleId module, NodeId left, NodeId right) {
+  size_t hash = Mix(module);
+  hash = Mix(hash ^ left) + right;
+  return Mix(hash);
 }
 
 ModuleCache::ModuleLoadStateId ModuleCache::GetStateIdForProcess(
@@ -129,14 +257,14 @@ ModuleCache::ModuleLoadStateId ModuleCache::GetStateIdForProcess(
   return kInvalidModuleLoadState;
 }
 
-const ModuleCache::ModuleLoadState& ModuleCache::GetStateForProcess(
+ModuleCache::NodeId ModuleCache::GetStateForProcess(
     const ModuleStateKey& key) {
   ModuleLoadStateId id = GetStateIdForProcess(key);
 
   if (id == kInvalidModuleLoadState)
-    return empty_;
+    return kEmptyState;
 
-  return GetModuleLoadState(id);
+  return id;
 }
 
 void ModuleCache::SetProcessState(const ModuleStateKey& key,
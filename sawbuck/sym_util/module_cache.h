@@ -18,7 +18,6 @@
 
 #include "base/time.h"
 #include <map>
-#include <set>
 #include <string>
 #include <vector>
 #include "sawbuck/sym_util/types.h"
@@ -73,20 +72,43 @@ class ModuleCache {
   const ModuleInformation& GetModule(ModuleId id);
 
   // The module load state of any process at any given time is
-  // encoded as a set of module ids. And since we tend to have
-  // multiple occurrences of the same module load state, e.g. when
-  // you have multiple instances of the same executable running, we
-  // encode entire module load states into an integer as well.
-  typedef std::set<ModuleId> ModuleLoadState;
-  typedef std::map<ModuleLoadState, ModuleLoadStateId> ModuleLoadStateMap;
-  // Maps from module load state to id.
-  ModuleLoadStateMap module_load_state_ids_;
-  // Maps from id to module load state.
-  std::vector<ModuleLoadState> module_load_states_;
-  ModuleId next_module_load_state_id_;
-
-  ModuleLoadStateId GetModuleLoadStateId(const ModuleLoadState& state);
-  const ModuleLoadState& GetModuleLoadState(ModuleLoadStateId id);
+  // a set of module ids, which we store as a treap. A node's priority
+  // is derived from its module id, so the shape of a treap depends only
+  // on the set of modules it contains. Nodes are hash-consed - there's
+  // only ever one node for a given module and pair of subtrees - which
+  // means that a set of modules always maps to the same root node.
+  // We use the id of the root node as the module load state id, and since
+  // the treaps are persistent, loading or unloading a module creates
+  // O(log n) new nodes and shares the rest with the previous state.
+  typedef ModuleLoadStateId NodeId;
+  struct Node {
+    ModuleId module;
+    NodeId left;
+    NodeId right;
+    // Hash of the above, and the next node in the same hash bucket.
+    size_t hash;
+    NodeId next;
+  };
+  // All nodes, indexed by id. The first node stands for the empty treap.
+  std::vector<Node> nodes_;
+  // Hash buckets of node ids, chained through Node::next.
+  std::vector<NodeId> node_buckets_;
+
+  // Returns the node for @p module with subtrees @p left and @p right,
+  // creating it if necessary.
+  NodeId GetNode(ModuleId module, NodeId left, NodeId right);
+  // Returns @p root with @p module added.
+  NodeId InsertModule(NodeId root, ModuleId module);
+  // Returns @p root with @p module removed.
+  NodeId EraseModule(NodeId root, ModuleId module);
+  // Returns the union of @p left and @p right, where every module in
+  // @p left must be ordered before every module in @p right.
+  NodeId Merge(NodeId left, NodeId right);
+  // Appends the modules of @p root to @p modules in order.
+  void AppendModules(NodeId root, std::vector<ModuleInformation>* modules);
+  // Returns true iff @p a belongs above @p b in a treap.
+  static bool HasHigherPriority(ModuleId a, ModuleId b);
+  static size_t HashNode(ModuleId module, NodeId left, NodeId right);
 
   struct ModuleStateKey {
     ModuleStateKey(ProcessId pid, const base::Time& time)
@@ -118,15 +140,16 @@ class ModuleCache {
   // Set the module load state for a process at a time.
   void SetProcessState(const ModuleStateKey& key, ModuleLoadStateId id);
 
-  // Retrieves the module load state for a process at a time.
-  const ModuleLoadState& GetStateForProcess(const ModuleStateKey& key);
+  // Retrieves the module load state for a process at a time, or the
+  // empty state if none is known.
+  NodeId GetStateForProcess(const ModuleStateKey& key);
 
   // Maps from {pid, time} -> load state id.
   typedef std::map<ModuleStateKey, ModuleLoadStateId> ProcessLoadStateMap;
   ProcessLoadStateMap process_states_;
 
   static const ModuleLoadStateId kInvalidModuleLoadState = -1;
-  static ModuleLoadState empty_;
+  static const NodeId kEmptyState = 0;
 };
 
 }  // namespace sym_util
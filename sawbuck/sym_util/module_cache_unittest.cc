@@ -14,13 +14,45 @@
 //
 // Module cache unittests.
 #include "sawbuck/sym_util/module_cache.h"
+
+#include <algorithm>
+#include <set>
 #include "base/at_exit.h"
 #include "base/command_line.h"
+#include "base/logging.h"
+#include "base/stringprintf.h"
 #include "gtest/gtest.h"
 
 namespace sym_util {
 
 const ProcessId kPid1 = 42;
+const ProcessId kPid2 = 43;
+
+namespace {
+
+ModuleInformation MakeModule(int i) {
+  ModuleInformation module = { 0 };
+  module.base_address = 0x10000000 + i * 0x10000;
+  module.module_size = 0x10000;
+  module.image_file_name = StringPrintf(L"module%d.dll", i);
+  return module;
+}
+
+// Returns the names of the modules loaded in @p pid at @p time, sorted.
+std::vector<std::wstring> GetModuleNames(ModuleCache* cache,
+                                         ProcessId pid,
+                                         const base::Time& time) {
+  std::vector<ModuleInformation> modules;
+  cache->GetProcessModuleState(pid, time, &modules);
+
+  std::vector<std::wstring> names;
+  for (size_t i = 0; i < modules.size(); ++i)
+    names.push_back(modules[i].image_file_name);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+}  // namespace
 
 TEST(ModuleCacheTest, Insert) {
   ModuleCache cache;
@@ -70,6 +102,154 @@ TEST(ModuleCacheTest, Insert) {
             cache.GetStateId(kPid1, t2 + base::TimeDelta::FromMilliseconds(1)));
 }
 
+TEST(ModuleCacheTest, SharesIdenticalStates) {
+  ModuleCache cache;
+
+  // Load the same modules into two processes, in different orders.
+  base::Time t0(base::Time::Now());
+  base::Time time(t0);
+  for (int i = 0; i < 100; ++i) {
+    time += base::TimeDelta::FromMilliseconds(1);
+    cache.ModuleLoaded(kPid1, time, MakeModule(i));
+    cache.ModuleLoaded(kPid2, time, MakeModule(99 - i));
+  }
+  base::Time loaded(time);
+  EXPECT_EQ(cache.GetStateId(kPid1, loaded), cache.GetStateId(kPid2, loaded));
+
+  std::vector<ModuleInformation> modules;
+  EXPECT_TRUE(cache.GetProcessModuleState(kPid1, loaded, &modules));
+  EXPECT_EQ(100, modules.size());
+
+  // Unloading and reloading a module gets us back to the same state.
+  time += base::TimeDelta::FromMilliseconds(1);
+  cache.ModuleUnloaded(kPid1, time, MakeModule(50));
+  base::Time unloaded(time);
+  EXPECT_NE(cache.GetStateId(kPid1, loaded),
+            cache.GetStateId(kPid1, unloaded));
+  EXPECT_TRUE(cache.GetProcessModuleState(kPid1, unloaded, &modules));
+  EXPECT_EQ(99, modules.size());
+
+  time += base::TimeDelta::FromMilliseconds(1);
+  cache.ModuleLoaded(kPid1, time, MakeModule(50));
+  EXPECT_EQ(cache.GetStateId(kPid1, loaded), cache.GetStateId(kPid1, time));
+
+  // Loading a module twice, or unloading one that isn't loaded, changes
+  // nothing.
+  time += base::TimeDelta::FromMilliseconds(1);
+  cache.ModuleLoaded(kPid2, time, MakeModule(10));
+  cache.ModuleUnloaded(kPid2, time, MakeModule(100));
+  EXPECT_EQ(cache.GetStateId(kPid2, loaded), cache.GetStateId(kPid2, time));
+
+  // Unloading everything leaves no modules behind.
+  for (int i = 0; i < 100; ++i) {
+    time += base::TimeDelta::FromMilliseconds(1);
+    cache.ModuleUnloaded(kPid2, time, MakeModule(i));
+  }
+  EXPECT_FALSE(cache.GetProcessModuleState(kPid2, time, &modules));
+  EXPECT_TRUE(modules.empty());
+}
+
+TEST(ModuleCacheTest, MatchesReferenceSets) {
+  ModuleCache cache;
+  const int kNumModules = 64;
+  const ProcessId kPids[] = { kPid1, kPid2 };
+
+  // Replay a pseudo-random stream of loads and unloads, and keep track of
+  // the expected state of each process in a plain set.
+  struct Snapshot {
+    ProcessId pid;
+    base::Time time;
+    std::set<int> modules;
+  };
+  std::vector<Snapshot> snapshots;
+  std::set<int> states[arraysize(kPids)];
+  base::Time time(base::Time::Now());
+  uint32 seed = 1;
+  for (int i = 0; i < 5000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t process = (seed >> 8) % arraysize(kPids);
+    int module = (seed >> 12) % kNumModules;
+    bool load = ((seed >> 24) % 3) != 0;
+
+    time += base::TimeDelta::FromMilliseconds(1);
+    if (load) {
+      cache.ModuleLoaded(kPids[process], time, MakeModule(module));
+      states[process].insert(module);
+    } else {
+      cache.ModuleUnloaded(kPids[process], time, MakeModule(module));
+      states[process].erase(module);
+    }
+
+    Snapshot snapshot = { kPids[process], time, states[process] };
+    snapshots.push_back(snapshot);
+  }
+
+  for (size_t i = 0; i < snapshots.size(); ++i) {
+    const Snapshot& snapshot = snapshots[i];
+    std::vector<std::wstring> expected;
+    std::set<int>::const_iterator it(snapshot.modules.begin());
+    for (; it != snapshot.modules.end(); ++it)
+      expected.push_back(MakeModule(*it).image_file_name);
+    std::sort(expected.begin(), expected.end());
+
+    ASSERT_TRUE(expected ==
+                GetModuleNames(&cache, snapshot.pid, snapshot.time));
+  }
+
+  // State ids are equal exactly when the states are.
+  for (size_t i = 0; i < snapshots.size(); i += 7) {
+    for (size_t j = 0; j < snapshots.size(); j += 11) {
+      const Snapshot& a = snapshots[i];
+      const Snapshot& b = snapshots[j];
+      ASSERT_EQ(a.modules == b.modules,
+                cache.GetStateId(a.pid, a.time) ==
+                    cache.GetStateId(b.pid, b.time));
+    }
+  }
+}
+
+// Replays the module events of a long kernel log: twenty processes each
+// load 400 modules, load and unload 2000 transient ones, and unload the
+// rest. Each event used to copy and look up the process's whole module
+// set, which is the cost this measures. Disabled to keep the suite quick.
+TEST(ModuleCacheBenchmark, DISABLED_Replay) {
+  const int kNumProcesses = 20;
+  const int kModulesPerProcess = 400;
+  const int kChurnPerProcess = 2000;
+
+  std::vector<ModuleInformation> modules;
+  for (int i = 0; i < kModulesPerProcess + kChurnPerProcess; ++i)
+    modules.push_back(MakeModule(i));
+
+  base::TimeTicks start = base::TimeTicks::HighResNow();
+  ModuleCache cache;
+  base::Time time(base::Time::Now());
+  int events = 0;
+  for (int pid = 0; pid < kNumProcesses; ++pid) {
+    // Each process loads its modules, then loads and unloads a series of
+    // transient ones, before shutting down.
+    for (int i = 0; i < kModulesPerProcess; ++i, ++events) {
+      time += base::TimeDelta::FromMicroseconds(1);
+      cache.ModuleLoaded(pid, time, modules[i]);
+    }
+    for (int i = 0; i < kChurnPerProcess; ++i, events += 2) {
+      time += base::TimeDelta::FromMicroseconds(1);
+      cache.ModuleLoaded(pid, time, modules[kModulesPerProcess + i]);
+      time += base::TimeDelta::FromMicroseconds(1);
+      cache.ModuleUnloaded(pid, time, modules[kModulesPerProcess + i]);
+    }
+    for (int i = 0; i < kModulesPerProcess; ++i, ++events) {
+      time += base::TimeDelta::FromMicroseconds(1);
+      cache.ModuleUnloaded(pid, time, modules[i]);
+    }
+  }
+  base::TimeDelta elapsed = base::TimeTicks::HighResNow() - start;
+
+  LOG(INFO) << "Replayed " << events << " module events for "
+            << kNumProcesses << " processes in "
+            << elapsed.InMilliseconds() << " ms.";
+}
+
 }  //  namespace sym_util
 
 
@@ -0,0 +1,236 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Shared symbol cache implementation.
+#include "sawbuck/sym_util/shared_symbol_cache.h"
+
+#include <list>
+#include <string>
+#include "base/hash_tables.h"
+#include "base/logging.h"
+
+namespace sym_util {
+
+namespace {
+
+// Approximate bookkeeping costs of an entry and of an interned string,
+// over and above their contents.
+const size_t kEntryOverhead = 8 * sizeof(void*);
+const size_t kStringOverhead = sizeof(std::wstring) + 6 * sizeof(void*);
+
+}  // namespace
+
+// A shard holds the symbols whose keys hash to it in a hash map, and keeps
+// them in a list in order of use.
+class SharedSymbolCache::Shard {
+ public:
+  Shard() : max_memory_(0), memory_(0) {
+  }
+
+  void set_max_memory(size_t max_memory) { max_memory_ = max_memory; }
+
+  bool Lookup(uint64 key, Symbol* symbol) {
+    DCHECK(symbol != NULL);
+
+    base::AutoLock lock(lock_);
+    EntryMap::iterator it(index_.find(key));
+    if (it == index_.end())
+      return false;
+
+    // Move the entry to the front of the list.
+    entries_.splice(entries_.begin(), entries_, it->second);
+
+    const Entry& entry = *it->second;
+    symbol->module = entry.module->first;
+    symbol->name = entry.name->first;
+    symbol->mangled_name = entry.mangled_name->first;
+    symbol->offset = entry.offset;
+    symbol->size = entry.size;
+    symbol->file = entry.file->first;
+    symbol->line = entry.line;
+
+    return true;
+  }
+
+  void Insert(uint64 key, const Symbol& symbol) {
+    base::AutoLock lock(lock_);
+    EntryMap::iterator it(index_.find(key));
+    if (it != index_.end())
+      Evict(it->second);
+
+    Entry entry;
+    entry.key = key;
+    entry.module = Intern(symbol.module);
+    entry.name = Intern(symbol.name);
+    entry.mangled_name = Intern(symbol.mangled_name);
+    entry.offset = symbol.offset;
+    entry.size = symbol.size;
+    entry.file = Intern(symbol.file);
+    entry.line = symbol.line;
+    entries_.push_front(entry);
+    index_[key] = entries_.begin();
+    memory_ += sizeof(Entry) + kEntryOverhead;
+
+    while (memory_ > max_memory_ && !entries_.empty())
+      Evict(--entries_.end());
+  }
+
+  void Clear() {
+    base::AutoLock lock(lock_);
+    index_.clear();
+    entries_.clear();
+    strings_.clear();
+    memory_ = 0;
+  }
+
+  size_t size() const {
+    base::AutoLock lock(lock_);
+    return entries_.size();
+  }
+
+  size_t memory() const {
+    base::AutoLock lock(lock_);
+    return memory_;
+  }
+
+ private:
+  // Maps interned strings to their number of references.
+  typedef std::map<std::wstring, size_t> StringTable;
+  typedef StringTable::iterator String;
+
+  struct Entry {
+    uint64 key;
+    String module;
+    String name;
+    String mangled_name;
+    size_t offset;
+    size_t size;
+    String file;
+    size_t line;
+  };
+  typedef std::list<Entry> EntryList;
+  typedef base::hash_map<uint64, EntryList::iterator> EntryMap;
+
+  String Intern(const std::wstring& str) {
+    std::pair<String, bool> inserted(strings_.insert(std::make_pair(str, 0)));
+    if (inserted.second)
+      memory_ += str.size() * sizeof(wchar_t) + kStringOverhead;
+
+    ++inserted.first->second;
+    return inserted.first;
+  }
+
+  void Release(String str) {
+    DCHECK_LT(0U, str->second);
+    if (--str->second != 0)
+      return;
+
+    memory_ -= str->first.size() * sizeof(wchar_t) + kStringOverhead;
+    strings_.erase(str);
+  }
+
+  void Evict(EntryList::iterator entry) {
+    Release(entry->module);
+    Release(entry->name);
+    Release(entry->mangled_name);
+    Release(entry->file);
+    memory_ -= sizeof(Entry) + kEntryOverhead;
+
+    index_.erase(entry->key);
+    entries_.erase(entry);
+  }
+
+  mutable base::Lock lock_;
+  size_t max_memory_;
+  size_t memory_;  // Under lock_.
+
+  StringTable strings_;  // Under lock_.
+  // The most recently used entry is at the front.
+  EntryList entries_;  // Under lock_.
+  EntryMap index_;  // Under lock_.
+};
+
+SharedSymbolCache::SharedSymbolCache(size_t max_memory)
+    : shards_(new Shard[kNumShards]) {
+  for (size_t i = 0; i < kNumShards; ++i)
+    shards_[i].set_max_memory(max_memory / kNumShards);
+}
+
+SharedSymbolCache::~SharedSymbolCache() {
+}
+
+SharedSymbolCache::ModuleKey SharedSymbolCache::GetModuleKey(
+    const ModuleInformation& module) {
+  // Modules are identified by everything but their base address.
+  ModuleInformation identity(module);
+  identity.base_address = 0;
+
+  base::AutoLock lock(module_keys_lock_);
+  ModuleKeyMap::iterator it(module_keys_.find(identity));
+  if (it != module_keys_.end())
+    return it->second;
+
+  ModuleKey key = module_keys_.size();
+  module_keys_.insert(std::make_pair(identity, key));
+  return key;
+}
+
+bool SharedSymbolCache::Lookup(ModuleKey module,
+                               Offset rva,
+                               Symbol* symbol) {
+  uint64 key = MakeKey(module, rva);
+  return GetShard(key).Lookup(key, symbol);
+}
+
+void SharedSymbolCache::Insert(ModuleKey module,
+                               Offset rva,
+                               const Symbol& symbol) {
+  uint64 key = MakeKey(module, rva);
+  GetShard(key).Insert(key, symbol);
+}
+
+void SharedSymbolCache::Clear() {
+  for (size_t i = 0; i < kNumShards; ++i)
+    shards_[i].Clear();
+}
+
+size_t SharedSymbolCache::GetSize() const {
+  size_t size = 0;
+  for (size_t i = 0; i < kNumShards; ++i)
+    size += shards_[i].size();
+  return size;
+}
+
+size_t SharedSymbolCache::GetMemoryUsage() const {
+  size_t memory = 0;
+  for (size_t i = 0; i < kNumShards; ++i)
+    memory += shards_[i].memory();
+  return memory;
+}
+
+SharedSymbolCache::Shard& SharedSymbolCache::GetShard(uint64 key) {
+  // Mix the bits, so that neighbouring addresses spread over the shards.
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDULL;
+  key ^= key >> 33;
+  return shards_[key % kNumShards];
+}
+
+uint64 SharedSymbolCache::MakeKey(ModuleKey module, Offset rva) {
+  // Modules are less than 4GB in size.
+  DCHECK_EQ(rva, static_cast<uint32>(rva));
+  return (static_cast<uint64>(module) << 32) | static_cast<uint32>(rva);
+}
+
+}  // namespace sym_util
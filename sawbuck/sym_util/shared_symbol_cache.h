@@ -0,0 +1,90 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Shared symbol cache declaration.
+#ifndef SAWBUCK_SYM_UTIL_SHARED_SYMBOL_CACHE_H_
+#define SAWBUCK_SYM_UTIL_SHARED_SYMBOL_CACHE_H_
+
+#include <map>
+#include "base/basictypes.h"
+#include "base/scoped_ptr.h"
+#include "base/synchronization/lock.h"
+#include "sawbuck/sym_util/types.h"
+
+namespace sym_util {
+
+// A thread safe cache of resolved symbols, keyed on module identity and
+// module-relative address rather than on absolute address. This allows
+// the symbols of a module to be shared by every process that loads it,
+// wherever it's loaded.
+//
+// The cache is split into shards, each under its own lock and with its
+// own share of the memory budget. Each shard evicts its least recently
+// used symbols to stay within budget, and interns the strings of its
+// symbols, since most symbols share their module and file names with
+// many others.
+class SharedSymbolCache {
+ public:
+  // Identifies a module independent of where it's loaded.
+  typedef uint32 ModuleKey;
+
+  // The default memory budget.
+  static const size_t kDefaultMaxMemory = 16 * 1024 * 1024;
+
+  // @param max_memory the most memory the cached symbols may use, in bytes.
+  explicit SharedSymbolCache(size_t max_memory);
+  ~SharedSymbolCache();
+
+  // Returns the key for @p module, which is the same for any two modules
+  // that differ only in their base address.
+  ModuleKey GetModuleKey(const ModuleInformation& module);
+
+  // Looks up the symbol at @p rva in @p module.
+  // @param symbol on success returns the symbol. Its module_base is left
+  //     alone, as it varies from process to process.
+  // @returns true iff the symbol was found.
+  bool Lookup(ModuleKey module, Offset rva, Symbol* symbol);
+
+  // Stores @p symbol as the symbol at @p rva in @p module, evicting the
+  // least recently used symbols as needed.
+  void Insert(ModuleKey module, Offset rva, const Symbol& symbol);
+
+  // Drops all cached symbols.
+  void Clear();
+
+  // Returns the number of cached symbols.
+  size_t GetSize() const;
+  // Returns the memory used by the cached symbols, in bytes.
+  size_t GetMemoryUsage() const;
+
+ private:
+  class Shard;
+
+  static const size_t kNumShards = 16;
+
+  Shard& GetShard(uint64 key);
+  static uint64 MakeKey(ModuleKey module, Offset rva);
+
+  base::Lock module_keys_lock_;
+  typedef std::map<ModuleInformation, ModuleKey> ModuleKeyMap;
+  ModuleKeyMap module_keys_;  // Under module_keys_lock_.
+
+  scoped_array<Shard> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedSymbolCache);
+};
+
+}  // namespace sym_util
+
+#endif  // SAWBUCK_SYM_UTIL_SHARED_SYMBOL_CACHE_H_
@@ -0,0 +1,163 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Shared symbol cache unittests.
+#include "sawbuck/sym_util/shared_symbol_cache.h"
+
+#include "base/stringprintf.h"
+#include "gtest/gtest.h"
+
+namespace sym_util {
+
+namespace {
+
+ModuleInformation MakeModule(const wchar_t* name, ModuleBase base) {
+  ModuleInformation module = { 0 };
+  module.base_address = base;
+  module.module_size = 0x100000;
+  module.image_checksum = 0xCAFEBABE;
+  module.time_date_stamp = 0x4D000000;
+  module.image_file_name = name;
+  return module;
+}
+
+Symbol MakeSymbol(int i) {
+  Symbol symbol;
+  symbol.module = L"foo.dll";
+  symbol.module_base = 0;
+  symbol.name = StringPrintf(L"Function%d", i);
+  symbol.mangled_name = StringPrintf(L"?Function%d@@YAXXZ", i);
+  symbol.offset = i % 16;
+  symbol.size = 32;
+  symbol.file = L"c:\\src\\foo.cc";
+  symbol.line = i;
+  return symbol;
+}
+
+}  // namespace
+
+TEST(SharedSymbolCacheTest, ModuleKeys) {
+  SharedSymbolCache cache(SharedSymbolCache::kDefaultMaxMemory);
+
+  // The same module at different addresses has the same key.
+  SharedSymbolCache::ModuleKey foo =
+      cache.GetModuleKey(MakeModule(L"foo.dll", 0x10000000));
+  EXPECT_EQ(foo, cache.GetModuleKey(MakeModule(L"foo.dll", 0x20000000)));
+
+  // Different modules don't.
+  EXPECT_NE(foo, cache.GetModuleKey(MakeModule(L"bar.dll", 0x10000000)));
+  ModuleInformation rebuilt(MakeModule(L"foo.dll", 0x10000000));
+  rebuilt.time_date_stamp++;
+  EXPECT_NE(foo, cache.GetModuleKey(rebuilt));
+}
+
+TEST(SharedSymbolCacheTest, LookupAndInsert) {
+  SharedSymbolCache cache(SharedSymbolCache::kDefaultMaxMemory);
+  SharedSymbolCache::ModuleKey foo =
+      cache.GetModuleKey(MakeModule(L"foo.dll", 0x10000000));
+  SharedSymbolCache::ModuleKey bar =
+      cache.GetModuleKey(MakeModule(L"bar.dll", 0x10000000));
+
+  Symbol symbol;
+  EXPECT_FALSE(cache.Lookup(foo, 0x1000, &symbol));
+
+  cache.Insert(foo, 0x1000, MakeSymbol(1));
+  cache.Insert(foo, 0x2000, MakeSymbol(2));
+  EXPECT_EQ(2, cache.GetSize());
+
+  symbol.module_base = 0x20000000;
+  ASSERT_TRUE(cache.Lookup(foo, 0x1000, &symbol));
+  EXPECT_EQ(L"Function1", symbol.name);
+  EXPECT_EQ(L"?Function1@@YAXXZ", symbol.mangled_name);
+  EXPECT_EQ(L"foo.dll", symbol.module);
+  EXPECT_EQ(L"c:\\src\\foo.cc", symbol.file);
+  EXPECT_EQ(1, symbol.offset);
+  EXPECT_EQ(32, symbol.size);
+  EXPECT_EQ(1, symbol.line);
+  // The module base is left alone.
+  EXPECT_EQ(0x20000000, symbol.module_base);
+
+  ASSERT_TRUE(cache.Lookup(foo, 0x2000, &symbol));
+  EXPECT_EQ(L"Function2", symbol.name);
+  EXPECT_FALSE(cache.Lookup(bar, 0x1000, &symbol));
+
+  // Inserting again replaces the symbol.
+  cache.Insert(foo, 0x1000, MakeSymbol(3));
+  EXPECT_EQ(2, cache.GetSize());
+  ASSERT_TRUE(cache.Lookup(foo, 0x1000, &symbol));
+  EXPECT_EQ(L"Function3", symbol.name);
+
+  cache.Clear();
+  EXPECT_EQ(0, cache.GetSize());
+  EXPECT_EQ(0, cache.GetMemoryUsage());
+  EXPECT_FALSE(cache.Lookup(foo, 0x1000, &symbol));
+}
+
+TEST(SharedSymbolCacheTest, StaysWithinBudget) {
+  const size_t kMaxMemory = 64 * 1024;
+  SharedSymbolCache cache(kMaxMemory);
+  SharedSymbolCache::ModuleKey foo =
+      cache.GetModuleKey(MakeModule(L"foo.dll", 0x10000000));
+
+  for (int i = 0; i < 10000; ++i) {
+    cache.Insert(foo, i * 16, MakeSymbol(i));
+    ASSERT_GE(kMaxMemory, cache.GetMemoryUsage());
+  }
+  EXPECT_LT(0U, cache.GetSize());
+  EXPECT_GT(10000U, cache.GetSize());
+
+  // The most recent symbols survive.
+  Symbol symbol;
+  ASSERT_TRUE(cache.Lookup(foo, 9999 * 16, &symbol));
+  EXPECT_EQ(L"Function9999", symbol.name);
+  EXPECT_FALSE(cache.Lookup(foo, 0, &symbol));
+}
+
+TEST(SharedSymbolCacheTest, EvictsLeastRecentlyUsed) {
+  const size_t kMaxMemory = 64 * 1024;
+  SharedSymbolCache cache(kMaxMemory);
+  SharedSymbolCache::ModuleKey foo =
+      cache.GetModuleKey(MakeModule(L"foo.dll", 0x10000000));
+
+  // Keep looking up the first symbol while filling the cache up.
+  Symbol symbol;
+  cache.Insert(foo, 0, MakeSymbol(0));
+  for (int i = 1; i < 10000; ++i) {
+    ASSERT_TRUE(cache.Lookup(foo, 0, &symbol));
+    cache.Insert(foo, i * 16, MakeSymbol(i));
+  }
+
+  ASSERT_TRUE(cache.Lookup(foo, 0, &symbol));
+  EXPECT_EQ(L"Function0", symbol.name);
+  EXPECT_FALSE(cache.Lookup(foo, 16, &symbol));
+}
+
+TEST(SharedSymbolCacheTest, InternsStrings) {
+  SharedSymbolCache cache(SharedSymbolCache::kDefaultMaxMemory);
+  SharedSymbolCache::ModuleKey foo =
+      cache.GetModuleKey(MakeModule(L"foo.dll", 0x10000000));
+
+  Symbol symbol(MakeSymbol(1));
+  cache.Insert(foo, 0, symbol);
+  size_t one_symbol = cache.GetMemoryUsage();
+
+  // Symbols that share their strings cost a lot less than the first.
+  const int kNumSymbols = 1000;
+  for (int i = 1; i < kNumSymbols; ++i)
+    cache.Insert(foo, i * 16, symbol);
+  EXPECT_EQ(kNumSymbols, cache.GetSize());
+  EXPECT_GT(kNumSymbols * one_symbol / 2, cache.GetMemoryUsage());
+}
+
+}  // namespace sym_util
@@ -33,6 +33,8 @@
       'sources': [
         'module_cache.cc',
         'module_cache.h',
+        'shared_symbol_cache.cc',
+        'shared_symbol_cache.h',
         'symbol_cache.cc',
         'symbol_cache.h',
         'types.cc',
@@ -47,6 +49,7 @@
       'type': 'executable',
       'sources': [
         'module_cache_unittest.cc',
+        'shared_symbol_cache_unittest.cc',
       ],
       'dependencies': [
         'sym_util',
@@ -106,6 +106,8 @@ class Filter {
   bool operator==(const Filter& other) const;
 
  private:
+  // Evaluates our regular expression in its slow paths.
+  friend class FilterProgram;
 
   bool ValueMatchesInt(int check_value) const;
   bool ValueMatchesString(const std::string& check_string) const;
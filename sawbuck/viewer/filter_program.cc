@@ -0,0 +1,479 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Filter program implementation.
+#include "sawbuck/viewer/filter_program.h"
+
+#include <wmistr.h>
+#include <evntrace.h>
+#include <algorithm>
+#include "base/logging.h"
+#include "base/string_number_conversions.h"
+
+namespace {
+
+// The rough cost of each kind of test, relative to comparing an integer
+// column.
+const double kIntCost = 1.0;
+const double kIntContainsCost = 4.0;
+const double kTimeCost = 20.0;
+const double kStringCost = 10.0;
+const double kRegexCost = 100.0;
+
+// The rough likelihood of each kind of test matching a row.
+const double kIntEqualsLikelihood = 0.05;
+const double kIntContainsLikelihood = 0.2;
+const double kTimeLikelihood = 0.001;
+const double kStringEqualsLikelihood = 0.05;
+const double kRegexLikelihood = 0.2;
+// No likelihood is taken to be less than this.
+const double kMinLikelihood = 0.001;
+
+// The number of distinct severities, as the log views display them.
+const size_t kNumSeverities = 256;
+
+char ToLowerASCII(char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+char ToUpperASCII(char c) {
+  return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// Returns true iff @p pattern matches only itself, ignoring case. Patterns
+// with non-ASCII characters are left to the regular expression engine,
+// which knows how to fold their case.
+bool IsLiteralPattern(const std::string& pattern) {
+  static const char kMetacharacters[] = "\\^$.[]|()?*+{}";
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    char c = pattern[i];
+    if ((c & 0x80) != 0 || c == '\0' ||
+        strchr(kMetacharacters, c) != NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns true iff @p text is valid UTF-8, by the same rules as the regular
+// expression engine: no overlong forms, surrogates, or code points past
+// U+10FFFF.
+bool IsValidUTF8(const std::string& text) {
+  const unsigned char* pos = reinterpret_cast<const unsigned char*>(
+      text.data());
+  const unsigned char* end = pos + text.size();
+  while (pos != end) {
+    unsigned char c = *pos++;
+    if (c < 0x80)
+      continue;
+
+    size_t num_trailing = 0;
+    unsigned char min_second = 0x80;
+    unsigned char max_second = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      num_trailing = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      num_trailing = 2;
+      if (c == 0xE0)
+        min_second = 0xA0;
+      else if (c == 0xED)
+        max_second = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      num_trailing = 3;
+      if (c == 0xF0)
+        min_second = 0x90;
+      else if (c == 0xF4)
+        max_second = 0x8F;
+    } else {
+      return false;
+    }
+
+    if (static_cast<size_t>(end - pos) < num_trailing ||
+        pos[0] < min_second || pos[0] > max_second) {
+      return false;
+    }
+    for (size_t i = 1; i < num_trailing; ++i) {
+      if ((pos[i] & 0xC0) != 0x80)
+        return false;
+    }
+    pos += num_trailing;
+  }
+  return true;
+}
+
+// Returns true iff the @p length characters at @p text equal those at
+// @p lower, which are in lower case, ignoring case.
+bool EqualsIgnoringCase(const char* text, const char* lower, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    if (ToLowerASCII(text[i]) != lower[i])
+      return false;
+  }
+  return true;
+}
+
+// Returns true iff @p text contains @p lower, which is in lower case,
+// ignoring case. Candidates are found by scanning for the first character
+// of @p lower in either case with memchr, which is vectorized.
+bool ContainsIgnoringCase(const std::string& text, const std::string& lower) {
+  if (lower.empty())
+    return true;
+  if (text.size() < lower.size())
+    return false;
+
+  char first_lower = lower[0];
+  char first_upper = ToUpperASCII(first_lower);
+  const char* pos = text.data();
+  // The last position at which |lower| may start.
+  const char* last = text.data() + text.size() - lower.size();
+  while (pos <= last) {
+    size_t remaining = last - pos + 1;
+    const char* found =
+        reinterpret_cast<const char*>(memchr(pos, first_lower, remaining));
+    if (first_upper != first_lower) {
+      // Look for the upper case character before the lower case one.
+      const char* found_upper = reinterpret_cast<const char*>(
+          memchr(pos, first_upper, found != NULL ? found - pos : remaining));
+      if (found_upper != NULL)
+        found = found_upper;
+    }
+
+    if (found == NULL)
+      return false;
+    if (EqualsIgnoringCase(found + 1, lower.data() + 1, lower.size() - 1))
+      return true;
+
+    pos = found + 1;
+  }
+
+  return false;
+}
+
+// Formats @p value in decimal, as IntToString does, into @p buffer, which
+// must have room for 11 characters. Returns the number of characters.
+size_t FormatInt(int value, char* buffer) {
+  char digits[10];
+  size_t num_digits = 0;
+  unsigned int magnitude = value < 0 ? 0U - static_cast<unsigned int>(value) :
+      static_cast<unsigned int>(value);
+  do {
+    digits[num_digits++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude != 0);
+
+  size_t length = 0;
+  if (value < 0)
+    buffer[length++] = '-';
+  while (num_digits != 0)
+    buffer[length++] = digits[--num_digits];
+
+  return length;
+}
+
+// Parses @p text as a time of day, as the log views display it, into the
+// milliseconds since midnight. Returns false if @p text isn't one.
+bool ParseTimeOfDay(const std::string& text, int* time_of_day) {
+  DCHECK(time_of_day != NULL);
+
+  // The format is "HH:MM:SS-mmm".
+  static const char kFormat[] = "00:00:00-000";
+  if (text.size() != arraysize(kFormat) - 1)
+    return false;
+
+  int fields[4] = { 0, 0, 0, 0 };
+  size_t field = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (kFormat[i] != '0') {
+      if (text[i] != kFormat[i])
+        return false;
+      ++field;
+    } else if (text[i] >= '0' && text[i] <= '9') {
+      fields[field] = fields[field] * 10 + text[i] - '0';
+    } else {
+      return false;
+    }
+  }
+
+  *time_of_day = ((fields[0] * 60 + fields[1]) * 60 + fields[2]) * 1000 +
+      fields[3];
+  return true;
+}
+
+}  // namespace
+
+// Fetches the columns of a row from a log view when first asked for them.
+class FilterProgram::RowValues {
+ public:
+  RowValues(ILogView* log_view, int row)
+      : log_view_(log_view), row_(row), has_file_(false),
+        has_message_(false), has_time_text_(false), time_of_day_(-1) {
+    DCHECK(log_view != NULL);
+  }
+
+  int GetInt(Filter::Column column) {
+    switch (column) {
+      case Filter::PROCESS_ID:
+        return log_view_->GetProcessId(row_);
+      case Filter::THREAD_ID:
+        return log_view_->GetThreadId(row_);
+      case Filter::LINE:
+        return log_view_->GetLine(row_);
+      default:
+        NOTREACHED() << "Not an integer column.";
+        return 0;
+    }
+  }
+
+  int GetSeverity() {
+    return log_view_->GetSeverity(row_);
+  }
+
+  const std::string& GetString(Filter::Column column) {
+    switch (column) {
+      case Filter::FILE:
+        if (!has_file_) {
+          file_ = log_view_->GetFileName(row_);
+          has_file_ = true;
+        }
+        return file_;
+
+      case Filter::MESSAGE:
+        if (!has_message_) {
+          message_ = log_view_->GetMessage(row_);
+          has_message_ = true;
+        }
+        return message_;
+
+      case Filter::TIME:
+        if (!has_time_text_) {
+          LogViewFormatter formatter;
+          formatter.FormatColumn(log_view_, row_, LogViewFormatter::TIME,
+                                 &time_text_);
+          has_time_text_ = true;
+        }
+        return time_text_;
+
+      default:
+        NOTREACHED() << "Not a string column.";
+        return file_;
+    }
+  }
+
+  int GetTimeOfDay() {
+    if (time_of_day_ < 0) {
+      base::Time::Exploded exploded;
+      log_view_->GetTime(row_).LocalExplode(&exploded);
+      time_of_day_ = ((exploded.hour * 60 + exploded.minute) * 60 +
+          exploded.second) * 1000 + exploded.millisecond;
+    }
+    return time_of_day_;
+  }
+
+ private:
+  ILogView* log_view_;
+  int row_;
+
+  bool has_file_;
+  std::string file_;
+  bool has_message_;
+  std::string message_;
+  bool has_time_text_;
+  std::string time_text_;
+  // Negative until fetched.
+  int time_of_day_;
+
+  DISALLOW_COPY_AND_ASSIGN(RowValues);
+};
+
+FilterProgram::Term::Term(const Filter& filter)
+    : filter(filter), type(REGEX), rank(0), int_value(0) {
+}
+
+FilterProgram::FilterProgram() {
+}
+
+FilterProgram::~FilterProgram() {
+}
+
+void FilterProgram::Compile(const std::vector<Filter>& filters) {
+  inclusion_terms_.clear();
+  exclusion_terms_.clear();
+
+  for (size_t i = 0; i < filters.size(); ++i) {
+    Term term(filters[i]);
+    CompileTerm(filters[i], &term);
+
+    if (filters[i].action() == Filter::INCLUDE) {
+      inclusion_terms_.push_back(term);
+    } else {
+      DCHECK_EQ(Filter::EXCLUDE, filters[i].action());
+      exclusion_terms_.push_back(term);
+    }
+  }
+
+  // Either list is satisfied by its first matching term, so it pays to try
+  // the cheapest and likeliest terms first.
+  std::stable_sort(inclusion_terms_.begin(), inclusion_terms_.end(),
+                   CompareRank);
+  std::stable_sort(exclusion_terms_.begin(), exclusion_terms_.end(),
+                   CompareRank);
+}
+
+bool FilterProgram::Matches(ILogView* log_view, int row) const {
+  RowValues values(log_view, row);
+
+  if (!inclusion_terms_.empty() && !MatchesAny(inclusion_terms_, &values))
+    return false;
+
+  return !MatchesAny(exclusion_terms_, &values);
+}
+
+void FilterProgram::CompileTerm(const Filter& filter, Term* term) {
+  DCHECK(term != NULL);
+
+  std::string value(filter.value());
+  double cost = kRegexCost;
+  double likelihood = kRegexLikelihood;
+
+  switch (filter.column()) {
+    case Filter::PROCESS_ID:
+    case Filter::THREAD_ID:
+    case Filter::LINE:
+      if (filter.relation() == Filter::IS) {
+        term->type = INT_EQUALS;
+        base::StringToInt(value, &term->int_value);
+        cost = kIntCost;
+        likelihood = kIntEqualsLikelihood;
+      } else {
+        DCHECK_EQ(Filter::CONTAINS, filter.relation());
+        term->type = INT_CONTAINS;
+        term->literal = value;
+        cost = kIntContainsCost;
+        likelihood = kIntContainsLikelihood;
+      }
+      break;
+
+    case Filter::SEVERITY: {
+      // There are few enough severities to try them all up front.
+      term->type = SEVERITY_IN;
+      term->severities.resize(kNumSeverities);
+      for (size_t i = 0; i < kNumSeverities; ++i) {
+        term->severities[i] = filter.ValueMatchesString(
+            LogViewFormatter::GetSeverityText(static_cast<UCHAR>(i)));
+      }
+
+      // Most rows have one of the usual severities.
+      size_t usual_matches = 0;
+      for (size_t i = TRACE_LEVEL_FATAL; i <= TRACE_LEVEL_VERBOSE; ++i)
+        usual_matches += term->severities[i] ? 1 : 0;
+      cost = kIntCost;
+      likelihood = static_cast<double>(usual_matches) /
+          (TRACE_LEVEL_VERBOSE - TRACE_LEVEL_FATAL + 1);
+      break;
+    }
+
+    case Filter::TIME:
+      if (filter.relation() == Filter::IS &&
+          ParseTimeOfDay(value, &term->int_value)) {
+        term->type = TIME_EQUALS;
+        cost = kTimeCost;
+        likelihood = kTimeLikelihood;
+      } else {
+        term->type = REGEX;
+        cost = kTimeCost + kRegexCost;
+      }
+      break;
+
+    case Filter::FILE:
+    case Filter::MESSAGE:
+      if (IsLiteralPattern(value)) {
+        term->literal.resize(value.size());
+        std::transform(value.begin(), value.end(), term->literal.begin(),
+                       ToLowerASCII);
+        cost = kStringCost;
+        if (filter.relation() == Filter::IS) {
+          term->type = LITERAL_EQUALS;
+          likelihood = kStringEqualsLikelihood;
+        } else {
+          DCHECK_EQ(Filter::CONTAINS, filter.relation());
+          term->type = LITERAL_CONTAINS;
+          // Longer strings are less likely to turn up.
+          likelihood = 1.0 / (1 + value.size());
+        }
+      } else {
+        term->type = REGEX;
+        cost = kStringCost + kRegexCost;
+      }
+      break;
+
+    default:
+      NOTREACHED() << "Invalid column type in filter!";
+  }
+
+  term->rank = cost / std::max(likelihood, kMinLikelihood);
+}
+
+bool FilterProgram::MatchesAny(const std::vector<Term>& terms,
+                               RowValues* values) {
+  for (size_t i = 0; i < terms.size(); ++i) {
+    if (MatchesTerm(terms[i], values))
+      return true;
+  }
+  return false;
+}
+
+bool FilterProgram::MatchesTerm(const Term& term, RowValues* values) {
+  DCHECK(values != NULL);
+
+  Filter::Column column = term.filter.column();
+  switch (term.type) {
+    case INT_EQUALS:
+      return values->GetInt(column) == term.int_value;
+
+    case INT_CONTAINS: {
+      char buffer[16];
+      size_t length = FormatInt(values->GetInt(column), buffer);
+      return std::search(buffer, buffer + length, term.literal.begin(),
+                         term.literal.end()) != buffer + length;
+    }
+
+    case SEVERITY_IN:
+      return term.severities[static_cast<UCHAR>(values->GetSeverity())];
+
+    case TIME_EQUALS:
+      return values->GetTimeOfDay() == term.int_value;
+
+    case LITERAL_EQUALS: {
+      const std::string& text = values->GetString(column);
+      return text.size() == term.literal.size() &&
+          EqualsIgnoringCase(text.data(), term.literal.data(),
+                             term.literal.size());
+    }
+
+    case LITERAL_CONTAINS: {
+      // The regular expression engine doesn't match text that isn't valid
+      // UTF-8, so neither may we. Text that doesn't contain the literal
+      // needn't be checked. Text equal to the literal is ASCII, so
+      // LITERAL_EQUALS needs no check at all.
+      const std::string& text = values->GetString(column);
+      return ContainsIgnoringCase(text, term.literal) && IsValidUTF8(text);
+    }
+
+    case REGEX:
+      return term.filter.ValueMatchesString(values->GetString(column));
+
+    default:
+      NOTREACHED();
+      return false;
+  }
+}
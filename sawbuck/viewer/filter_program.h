@@ -0,0 +1,104 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Filter program declaration.
+#ifndef SAWBUCK_VIEWER_FILTER_PROGRAM_H_
+#define SAWBUCK_VIEWER_FILTER_PROGRAM_H_
+
+#include <string>
+#include <vector>
+#include "sawbuck/viewer/filter.h"
+
+// A list of filters compiled into a single predicate over the rows of a log
+// view. A row passes the predicate if it matches one of the inclusion
+// filters, if there are any, and none of the exclusion filters.
+//
+// Each filter is compiled to the cheapest test that gives the same result
+// as Filter::Matches: integer columns are compared to a value parsed once,
+// severities are looked up in a table, times are compared on their exploded
+// fields, and patterns without regular expression metacharacters are
+// searched for as plain strings. Only the remaining patterns go to the
+// regular expression engine. The tests are run in order of increasing cost
+// per expected match, and each column is fetched at most once per row.
+//
+// A program may be evaluated on several threads at once.
+class FilterProgram {
+ public:
+  FilterProgram();
+  ~FilterProgram();
+
+  // Compiles @p filters, replacing the current program.
+  void Compile(const std::vector<Filter>& filters);
+
+  // Returns true iff the row at @p row of @p log_view passes the filters.
+  bool Matches(ILogView* log_view, int row) const;
+
+  // Returns true iff the program has no filters, and so passes all rows.
+  bool empty() const {
+    return inclusion_terms_.empty() && exclusion_terms_.empty();
+  }
+
+ private:
+  // Holds the columns of a row as they're fetched.
+  class RowValues;
+
+  enum TermType {
+    // The column is an integer equal to the value.
+    INT_EQUALS,
+    // The decimal representation of the column contains the value.
+    INT_CONTAINS,
+    // The severity is one of those set in the table.
+    SEVERITY_IN,
+    // The time of day is the value.
+    TIME_EQUALS,
+    // The column equals the value, ignoring ASCII case.
+    LITERAL_EQUALS,
+    // The column contains the value, ignoring ASCII case.
+    LITERAL_CONTAINS,
+    // The column matches the filter's regular expression.
+    REGEX
+  };
+
+  struct Term {
+    explicit Term(const Filter& filter);
+
+    Filter filter;
+    TermType type;
+    // The estimated cost per match, by which terms are ordered.
+    double rank;
+
+    // INT_EQUALS and INT_CONTAINS use |int_value| and |literal|
+    // respectively. TIME_EQUALS uses |int_value| as the milliseconds since
+    // midnight. The literal types use |literal|, in lower case.
+    int int_value;
+    std::string literal;
+    // SEVERITY_IN only.
+    std::vector<bool> severities;
+  };
+
+  // Compiles @p filter into @p term.
+  static void CompileTerm(const Filter& filter, Term* term);
+  // Returns true iff the row in @p values matches any of @p terms.
+  static bool MatchesAny(const std::vector<Term>& terms, RowValues* values);
+  static bool MatchesTerm(const Term& term, RowValues* values);
+
+  static bool CompareRank(const Term& a, const Term& b) {
+    return a.rank < b.rank;
+  }
+
+  std::vector<Term> inclusion_terms_;
+  std::vector<Term> exclusion_terms_;
+};
+
+#endif  // SAWBUCK_VIEWER_FILTER_PROGRAM_H_
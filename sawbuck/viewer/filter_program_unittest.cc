@@ -0,0 +1,337 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Filter program unittests.
+#include "sawbuck/viewer/filter_program.h"
+
+#include "base/logging.h"
+#include "base/stringprintf.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+struct Row {
+  int severity;
+  DWORD process_id;
+  DWORD thread_id;
+  base::Time time;
+  std::string file;
+  int line;
+  std::string message;
+};
+
+// A log view over a list of rows.
+class TestLogView : public ILogView {
+ public:
+  void AddRow(const Row& row) { rows_.push_back(row); }
+
+  virtual int GetNumRows() { return static_cast<int>(rows_.size()); }
+  virtual void ClearAll() { rows_.clear(); }
+  virtual int GetSeverity(int row) { return rows_[row].severity; }
+  virtual DWORD GetProcessId(int row) { return rows_[row].process_id; }
+  virtual DWORD GetThreadId(int row) { return rows_[row].thread_id; }
+  virtual base::Time GetTime(int row) { return rows_[row].time; }
+  virtual std::string GetFileName(int row) { return rows_[row].file; }
+  virtual int GetLine(int row) { return rows_[row].line; }
+  virtual std::string GetMessage(int row) { return rows_[row].message; }
+  virtual void GetStackTrace(int row, std::vector<void*>* trace) {}
+  virtual void Register(ILogViewEvents* event_sink,
+                        int* registration_cookie) {
+    *registration_cookie = 1;
+  }
+  virtual void Unregister(int registration_cookie) {}
+
+ private:
+  std::vector<Row> rows_;
+};
+
+// Evaluates @p filters one at a time, the way FilteredLogView used to.
+bool MatchesFilterList(const std::vector<Filter>& filters,
+                       Filter::Action action,
+                       ILogView* log_view,
+                       int row) {
+  for (size_t i = 0; i < filters.size(); ++i) {
+    if (filters[i].action() == action && filters[i].Matches(log_view, row))
+      return true;
+  }
+  return false;
+}
+
+bool PassesFilters(const std::vector<Filter>& filters,
+                   ILogView* log_view,
+                   int row) {
+  bool has_inclusion_filters = false;
+  for (size_t i = 0; i < filters.size(); ++i)
+    has_inclusion_filters |= filters[i].action() == Filter::INCLUDE;
+
+  if (has_inclusion_filters &&
+      !MatchesFilterList(filters, Filter::INCLUDE, log_view, row)) {
+    return false;
+  }
+  return !MatchesFilterList(filters, Filter::EXCLUDE, log_view, row);
+}
+
+// Makes a synthetic row, numbered @p i.
+Row MakeRow(int i) {
+  static const char* kFiles[] = {
+    "c:\\src\\chrome\\browser\\browser.cc",
+    "c:\\src\\chrome\\renderer\\render_view.cc",
+    "c:\\src\\net\\http\\http_cache.cc",
+    "c:\\src\\base\\message_loop.cc",
+  };
+  static const char* kWords[] = {
+    "Loading", "frame", "URL", "cache", "miss", "hit", "Timeout",
+    "error", "[tab]", "(1+2)*3", "done", "ok",
+  };
+
+  Row row;
+  row.severity = 1 + i % 5;
+  row.process_id = 1000 + i % 7;
+  // Some thread ids don't fit an int.
+  row.thread_id = i % 11 == 0 ? 0xFFFFFF00 + i % 13 : 2000 + i % 13;
+  row.time = base::Time::FromInternalValue(
+      12900000000000000LL + i * 1234567LL);
+  row.file = kFiles[i % arraysize(kFiles)];
+  row.line = i % 1000;
+  row.message = StringPrintf("%s %s %d %s", kWords[i % arraysize(kWords)],
+                             kWords[(i / 3) % arraysize(kWords)], i,
+                             kWords[(i / 7) % arraysize(kWords)]);
+  return row;
+}
+
+class FilterProgramTest : public testing::Test {
+ public:
+  virtual void SetUp() {
+    for (int i = 0; i < kNumRows; ++i)
+      log_view_.AddRow(MakeRow(i));
+  }
+
+  // Checks that a program compiled from @p filters agrees with the filters
+  // on every row.
+  void CheckFilters(const std::vector<Filter>& filters) {
+    FilterProgram program;
+    program.Compile(filters);
+    for (int i = 0; i < log_view_.GetNumRows(); ++i) {
+      ASSERT_EQ(PassesFilters(filters, &log_view_, i),
+                program.Matches(&log_view_, i)) << "Row " << i;
+    }
+  }
+
+  // Checks @p filter on its own, as an inclusion and as an exclusion
+  // filter.
+  void CheckFilter(Filter::Column column,
+                   Filter::Relation relation,
+                   const wchar_t* value) {
+    std::vector<Filter> filters;
+    filters.push_back(Filter(column, relation, Filter::INCLUDE, value));
+    ASSERT_NO_FATAL_FAILURE(CheckFilters(filters));
+
+    filters[0] = Filter(column, relation, Filter::EXCLUDE, value);
+    ASSERT_NO_FATAL_FAILURE(CheckFilters(filters));
+  }
+
+ protected:
+  static const int kNumRows = 2000;
+  TestLogView log_view_;
+};
+
+}  // namespace
+
+TEST_F(FilterProgramTest, Empty) {
+  FilterProgram program;
+  EXPECT_TRUE(program.empty());
+  EXPECT_TRUE(program.Matches(&log_view_, 0));
+
+  std::vector<Filter> filters;
+  filters.push_back(
+      Filter(Filter::LINE, Filter::IS, Filter::EXCLUDE, L"0"));
+  program.Compile(filters);
+  EXPECT_FALSE(program.empty());
+  EXPECT_FALSE(program.Matches(&log_view_, 0));
+  EXPECT_TRUE(program.Matches(&log_view_, 1));
+
+  program.Compile(std::vector<Filter>());
+  EXPECT_TRUE(program.empty());
+}
+
+TEST_F(FilterProgramTest, IntegerColumns) {
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::PROCESS_ID, Filter::IS,
+                                      L"1003"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::PROCESS_ID, Filter::CONTAINS,
+                                      L"00"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::THREAD_ID, Filter::IS,
+                                      L"-250"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::THREAD_ID, Filter::CONTAINS,
+                                      L"-2"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::LINE, Filter::IS, L"42"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::LINE, Filter::CONTAINS,
+                                      L"9"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::LINE, Filter::CONTAINS, L""));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::LINE, Filter::IS, L"x"));
+}
+
+TEST_F(FilterProgramTest, Severity) {
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::SEVERITY, Filter::IS,
+                                      L"error"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::SEVERITY, Filter::CONTAINS,
+                                      L"R"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::SEVERITY, Filter::CONTAINS,
+                                      L"^(WARN|INFO)"));
+}
+
+TEST_F(FilterProgramTest, Time) {
+  // Pick out the time of an actual row.
+  LogViewFormatter formatter;
+  std::string time;
+  ASSERT_TRUE(formatter.FormatColumn(&log_view_, 17, LogViewFormatter::TIME,
+                                     &time));
+  std::wstring wide_time(time.begin(), time.end());
+
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::TIME, Filter::IS,
+                                      wide_time.c_str()));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::TIME, Filter::CONTAINS,
+                                      wide_time.c_str()));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::TIME, Filter::IS,
+                                      L"12:34:56-789"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::TIME, Filter::CONTAINS,
+                                      L"-00"));
+}
+
+TEST_F(FilterProgramTest, StringColumns) {
+  // Literals, in either case.
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"cache"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"TIMEOUT ok"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"7 "));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::IS,
+                                      L"url loading 2 loading"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::FILE, Filter::CONTAINS,
+                                      L"RENDER_"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::FILE, Filter::CONTAINS,
+                                      L"zzz"));
+
+  // Regular expressions.
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"^Loading"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"hit|miss"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"\\(1\\+2\\)"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::IS,
+                                      L"frame.*"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::FILE, Filter::IS,
+                                      L".*\\.cc"));
+}
+
+TEST_F(FilterProgramTest, InvalidUTF8) {
+  static const char* kMessages[] = {
+    "cache \xC3\xA9t\xC3\xA9",  // Valid.
+    "cache \xFF",  // Not a lead byte.
+    "cache \xC0\xAF",  // Overlong.
+    "\xED\xA0\x80 cache",  // A surrogate.
+    "cache \xF4\x90\x80\x80",  // Past U+10FFFF.
+    "cache \xE2\x82",  // Truncated.
+  };
+  const int kNumMessages = arraysize(kMessages);
+  log_view_.ClearAll();
+  for (int i = 0; i < kNumMessages; ++i) {
+    Row row = MakeRow(i);
+    row.message = kMessages[i];
+    log_view_.AddRow(row);
+  }
+
+  // Literals only match what the regular expression engine would, which
+  // is nothing that isn't valid UTF-8.
+  std::vector<Filter> filters;
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS,
+                           Filter::INCLUDE, L"CACHE"));
+  FilterProgram program;
+  program.Compile(filters);
+  EXPECT_TRUE(program.Matches(&log_view_, 0));
+  for (int i = 1; i < kNumMessages; ++i)
+    EXPECT_FALSE(program.Matches(&log_view_, i)) << "Row " << i;
+
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L"cache"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilter(Filter::MESSAGE, Filter::CONTAINS,
+                                      L""));
+}
+
+TEST_F(FilterProgramTest, FilterLists) {
+  std::vector<Filter> filters;
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS,
+                           Filter::INCLUDE, L"frame"));
+  filters.push_back(Filter(Filter::FILE, Filter::CONTAINS,
+                           Filter::INCLUDE, L"net\\\\"));
+  filters.push_back(Filter(Filter::SEVERITY, Filter::IS,
+                           Filter::INCLUDE, L"ERROR"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilters(filters));
+
+  filters.push_back(Filter(Filter::PROCESS_ID, Filter::IS,
+                           Filter::EXCLUDE, L"1002"));
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS,
+                           Filter::EXCLUDE, L"miss"));
+  ASSERT_NO_FATAL_FAILURE(CheckFilters(filters));
+
+  // Exclusion filters only.
+  filters.erase(filters.begin(), filters.begin() + 3);
+  ASSERT_NO_FATAL_FAILURE(CheckFilters(filters));
+}
+
+// Runs a typical mix of message, process and severity filters over a
+// million synthetic rows, first one filter at a time as FilteredLogView used
+// to, then through a compiled program. Disabled, as it takes a while.
+TEST(FilterProgramBenchmark, DISABLED_MatchesFilterList) {
+  const int kNumRows = 1000000;
+  TestLogView log_view;
+  for (int i = 0; i < kNumRows; ++i)
+    log_view.AddRow(MakeRow(i));
+
+  // A typical set of filters: a couple of substrings to look for, and a
+  // process and some noise to ignore.
+  std::vector<Filter> filters;
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS,
+                           Filter::INCLUDE, L"timeout"));
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS,
+                           Filter::INCLUDE, L"error"));
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS,
+                           Filter::EXCLUDE, L"frame"));
+  filters.push_back(Filter(Filter::PROCESS_ID, Filter::IS,
+                           Filter::EXCLUDE, L"1003"));
+  filters.push_back(Filter(Filter::SEVERITY, Filter::IS,
+                           Filter::EXCLUDE, L"VERBOSE"));
+
+  base::TimeTicks start = base::TimeTicks::HighResNow();
+  int expected_matches = 0;
+  for (int i = 0; i < kNumRows; ++i)
+    expected_matches += PassesFilters(filters, &log_view, i) ? 1 : 0;
+  base::TimeDelta list_time = base::TimeTicks::HighResNow() - start;
+
+  start = base::TimeTicks::HighResNow();
+  FilterProgram program;
+  program.Compile(filters);
+  int matches = 0;
+  for (int i = 0; i < kNumRows; ++i)
+    matches += program.Matches(&log_view, i) ? 1 : 0;
+  base::TimeDelta program_time = base::TimeTicks::HighResNow() - start;
+
+  EXPECT_EQ(expected_matches, matches);
+  LOG(INFO) << "Filtered " << kNumRows << " rows to " << matches
+            << " rows in " << list_time.InMilliseconds()
+            << " ms one filter at a time, and in "
+            << program_time.InMilliseconds() << " ms compiled.";
+}
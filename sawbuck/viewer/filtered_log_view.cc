@@ -15,7 +15,11 @@
 // Filtered list view implementation.
 #include "sawbuck/viewer/filtered_log_view.h"
 
+#include <algorithm>
 #include "base/logging.h"
+#include "base/message_loop.h"
+#include "base/task.h"
+#include "base/threading/simple_thread.h"
 #include "pcrecpp.h"  // NOLINT
 
 namespace {
@@ -37,10 +41,72 @@ struct RunnableMethodTraits<FilteredLogView> {
 };
 }  // namespace
 
+// Filters a range of rows within one block of the original view, on
+// whichever thread it's run on. The filters and the bitmaps of the view
+// must not change while it runs.
+class FilteredLogView::BlockFilter
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  BlockFilter(FilteredLogView* view, size_t block, int begin, int end)
+      : view_(view), block_(block), begin_(begin), end_(end),
+        words_(RowBitmap::kBlockWords) {
+    DCHECK(view != NULL);
+    DCHECK_LT(begin, end);
+
+    // Start from the rows of the block filtered so far, if any.
+    if (block < view->included_rows_.num_blocks())
+      view->included_rows_.GetBlock(block, &words_[0]);
+
+    // And pick up the previous results if we're refining them.
+    if (begin < view->refined_rows_) {
+      previous_words_.resize(RowBitmap::kBlockWords);
+      view->previous_rows_.GetBlock(block, &previous_words_[0]);
+    }
+  }
+
+  virtual void Run() {
+    int block_start = block_start_row();
+    for (int row = begin_; row < end_; ++row) {
+      size_t offset = row - block_start;
+      uint32 mask = 1U << (offset % 32);
+
+      bool included = false;
+      if (row < view_->refined_rows_) {
+        bool was_included = (previous_words_[offset / 32] & mask) != 0;
+        included = view_->IsStillIncluded(row, was_included);
+      } else {
+        included = view_->IsIncluded(row);
+      }
+
+      if (included)
+        words_[offset / 32] |= mask;
+    }
+
+    view_->OnBlockFiltered();
+  }
+
+  size_t block() const { return block_; }
+  int block_start_row() const { return block_ << RowBitmap::kBlockShift; }
+  int end() const { return end_; }
+  const uint32* words() const { return &words_[0]; }
+
+ private:
+  FilteredLogView* view_;
+  size_t block_;
+  int begin_;
+  int end_;
+  std::vector<uint32> words_;
+  std::vector<uint32> previous_words_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockFilter);
+};
+
 FilteredLogView::FilteredLogView(ILogView* original,
                                  const std::vector<Filter>& filters) :
-    filtered_rows_(0), task_(NULL), original_(original),
-    registration_cookie_(0), next_sink_cookie_(1) {
+    may_include_new_rows_(false), filtered_rows_(0), refined_rows_(0),
+    task_(NULL), cancelled_(false), num_threads_(1), unfiltered_blocks_(0),
+    blocks_filtered_(false, false), progress_sink_(NULL),
+    original_(original), registration_cookie_(0), next_sink_cookie_(1) {
   DCHECK(original_ != NULL);
   original_->Register(this, &registration_cookie_);
   SetFilters(filters);
@@ -51,22 +117,44 @@ FilteredLogView::~FilteredLogView() {
   if (task_ != NULL)
     task_->Cancel();
 
+  StopWorkers();
   original_->Unregister(registration_cookie_);
 }
 
+void FilteredLogView::set_num_threads(size_t num_threads) {
+  DCHECK_LT(0U, num_threads);
+
+  // The workers are sized for the number of threads, so they're restarted
+  // by the next step that needs them.
+  if (num_threads != num_threads_)
+    StopWorkers();
+  num_threads_ = num_threads;
+}
+
+void FilteredLogView::CancelFiltering() {
+  if (task_ != NULL) {
+    task_->Cancel();
+    task_ = NULL;
+  }
+
+  // Rows left unrefined won't be, now.
+  previous_rows_.clear();
+  refined_rows_ = 0;
+  cancelled_ = true;
+}
+
 void FilteredLogView::LogViewNewItems() {
-  PostFilteringTask();
+  if (!cancelled_)
+    PostFilteringTask();
 }
 
 void FilteredLogView::LogViewCleared() {
   RestartFiltering();
-  EventSinkMap::iterator it(event_sinks_.begin());
-  for (; it != event_sinks_.end(); ++it)
-    it->second->LogViewCleared();
+  NotifyCleared();
 }
 
 int FilteredLogView::GetNumRows() {
-  return included_rows_.size();
+  return included_rows_.count();
 }
 
 void FilteredLogView::ClearAll() {
@@ -76,49 +164,49 @@ void FilteredLogView::ClearAll() {
 int FilteredLogView::GetSeverity(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetSeverity(included_rows_[row]);
+  return original_->GetSeverity(included_rows_.Select(row));
 }
 
 DWORD FilteredLogView::GetProcessId(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetProcessId(included_rows_[row]);
+  return original_->GetProcessId(included_rows_.Select(row));
 }
 
 DWORD FilteredLogView::GetThreadId(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetThreadId(included_rows_[row]);
+  return original_->GetThreadId(included_rows_.Select(row));
 }
 
 base::Time FilteredLogView::GetTime(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetTime(included_rows_[row]);
+  return original_->GetTime(included_rows_.Select(row));
 }
 
 std::string FilteredLogView::GetFileName(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetFileName(included_rows_[row]);
+  return original_->GetFileName(included_rows_.Select(row));
 }
 
 int FilteredLogView::GetLine(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetLine(included_rows_[row]);
+  return original_->GetLine(included_rows_.Select(row));
 }
 
 std::string FilteredLogView::GetMessage(int row) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetMessage(included_rows_[row]);
+  return original_->GetMessage(included_rows_.Select(row));
 }
 
 void FilteredLogView::GetStackTrace(int row, std::vector<void*>* trace) {
   DCHECK(row < GetNumRows());
 
-  return original_->GetStackTrace(included_rows_[row], trace);
+  return original_->GetStackTrace(included_rows_.Select(row), trace);
 }
 
 void FilteredLogView::Register(ILogViewEvents* event_sink,
@@ -133,15 +221,18 @@ void FilteredLogView::Unregister(int registration_cookie) {
   event_sinks_.erase(registration_cookie);
 }
 
-bool FilteredLogView::MatchesFilterList(const std::vector<Filter>& list,
-                                        int index) {
-  std::vector<Filter>::const_iterator iter(list.begin());
-  for (; iter != list.end(); ++iter) {
-    if (iter->Matches(original_, index)) {
-      return true;
-    }
-  }
-  return false;
+bool FilteredLogView::IsIncluded(int index) {
+  return program_.Matches(original_, index);
+}
+
+bool FilteredLogView::IsStillIncluded(int index, bool was_included) {
+  if (was_included)
+    return still_included_program_.Matches(original_, index);
+
+  // The row was either excluded, which still holds, or it matched none of
+  // the inclusion filters, in which case it may match one of the new ones.
+  return may_include_new_rows_ &&
+      newly_included_program_.Matches(original_, index);
 }
 
 void FilteredLogView::FilterChunk() {
@@ -150,69 +241,159 @@ void FilteredLogView::FilterChunk() {
   // Stash our starting row count.
   int starting_rows = GetNumRows();
 
-  // Figure the range we're going to filter.
-  const int kMaxFilterRows = 1000;
-  int start = filtered_rows_;
-  int end = std::min(filtered_rows_ + kMaxFilterRows, original_->GetNumRows());
-
+  // Filter a block per thread, starting with the block containing the next
+  // row to filter.
+  int total_rows = original_->GetNumRows();
+  std::vector<BlockFilter*> blocks;
+  size_t block = filtered_rows_ >> RowBitmap::kBlockShift;
+  for (size_t i = 0; i < num_threads_; ++i, ++block) {
+    int block_start = block << RowBitmap::kBlockShift;
+    int begin = std::max(block_start, filtered_rows_);
+    int end = std::min<int>(block_start + RowBitmap::kBlockRows, total_rows);
+    if (begin >= end)
+      break;
+
+    blocks.push_back(new BlockFilter(this, block, begin, end));
+  }
 
-  if (inclusion_filters_.empty()) {
-    // If the inclusion_filters_ list is empty, show all rows that do not match
-    // a filter in the exclusion list
-    for (int i = start; i < end; ++i) {
-      // Run the exclusion filters here..
-      if (!MatchesFilterList(exclusion_filters_, i)) {
-        included_rows_.push_back(i);
-      }
+  if (!blocks.empty()) {
+    // The first block is filtered on this thread, the rest on the workers.
+    if (blocks.size() > 1 && worker_pool_ == NULL) {
+      worker_pool_.reset(new base::DelegateSimpleThreadPool(
+          "Filter worker", static_cast<int>(num_threads_ - 1)));
+      worker_pool_->Start();
     }
-  } else {
-    // Otherwise, show all rows that match a filter in the inclusion list but
-    // match no rows in the exclusion list.
-    for (int i = start; i < end; ++i) {
-      if (MatchesFilterList(inclusion_filters_, i) &&
-          !MatchesFilterList(exclusion_filters_, i)) {
-        included_rows_.push_back(i);
-      }
+
+    base::subtle::NoBarrier_Store(&unfiltered_blocks_,
+                                  static_cast<base::subtle::Atomic32>(
+                                      blocks.size()));
+    for (size_t i = 1; i < blocks.size(); ++i)
+      worker_pool_->AddWork(blocks[i]);
+
+    blocks[0]->Run();
+    blocks_filtered_.Wait();
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      included_rows_.SetBlock(blocks[i]->block(), blocks[i]->words(),
+                              blocks[i]->end() - blocks[i]->block_start_row());
     }
+
+    // Update our cursor.
+    filtered_rows_ = blocks.back()->end();
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+      delete blocks[i];
   }
 
-  // Update our cursor.
-  filtered_rows_ = end;
+  // Let go of the previous results once we're done refining them.
+  if (refined_rows_ != 0 && filtered_rows_ >= refined_rows_) {
+    previous_rows_.clear();
+    refined_rows_ = 0;
+  }
 
   // Post again if we're not done.
-  if (end != original_->GetNumRows())
+  if (filtered_rows_ != original_->GetNumRows())
     PostFilteringTask();
 
+  if (progress_sink_ != NULL)
+    progress_sink_->FilterProgress(filtered_rows_, original_->GetNumRows());
+
   // If we added rows, signal the change.
-  if (starting_rows != GetNumRows()) {
-    EventSinkMap::iterator it(event_sinks_.begin());
-    for (; it != event_sinks_.end(); ++it)
-      it->second->LogViewNewItems();
+  if (starting_rows != GetNumRows())
+    NotifyNewItems();
+}
+
+void FilteredLogView::OnBlockFiltered() {
+  if (base::subtle::Barrier_AtomicIncrement(&unfiltered_blocks_, -1) == 0)
+    blocks_filtered_.Signal();
+}
+
+void FilteredLogView::StopWorkers() {
+  if (worker_pool_ != NULL) {
+    worker_pool_->JoinAll();
+    worker_pool_.reset();
   }
 }
 
 void FilteredLogView::SetFilters(const std::vector<Filter>& filters) {
-  inclusion_filters_.clear();
-  exclusion_filters_.clear();
-
-  std::vector<Filter>::const_iterator iter(filters.begin());
-  for (; iter != filters.end(); ++iter) {
-    if (iter->action() == Filter::INCLUDE) {
-      inclusion_filters_.push_back(*iter);
-    } else if (iter->action() == Filter::EXCLUDE) {
-      exclusion_filters_.push_back(*iter);
+  // If filters are only being added, we can refine the rows we've filtered
+  // so far, unless we're still refining earlier results.
+  bool refine = filters.size() > filters_.size() &&
+      filtered_rows_ != 0 && previous_rows_.size() == 0 &&
+      std::equal(filters_.begin(), filters_.end(), filters.begin());
+
+  bool had_inclusion_filters = !inclusion_filters_.empty();
+  std::vector<Filter> appended_inclusion_filters;
+  std::vector<Filter> appended_exclusion_filters;
+
+  size_t first_new_filter = 0;
+  if (refine) {
+    first_new_filter = filters_.size();
+  } else {
+    inclusion_filters_.clear();
+    exclusion_filters_.clear();
+  }
+
+  for (size_t i = first_new_filter; i < filters.size(); ++i) {
+    const Filter& filter = filters[i];
+    if (filter.action() == Filter::INCLUDE) {
+      inclusion_filters_.push_back(filter);
+      appended_inclusion_filters.push_back(filter);
+    } else if (filter.action() == Filter::EXCLUDE) {
+      exclusion_filters_.push_back(filter);
+      appended_exclusion_filters.push_back(filter);
     } else {
       NOTREACHED();
     }
   }
+  filters_ = filters;
+  program_.Compile(filters_);
+
+  if (refine) {
+    // Included rows stay so unless they match an appended exclusion filter.
+    // Absent inclusion filters, every row that wasn't excluded was included,
+    // so the first inclusion filters may drop rows too.
+    std::vector<Filter> still_included_filters(appended_exclusion_filters);
+    if (!had_inclusion_filters) {
+      still_included_filters.insert(still_included_filters.end(),
+                                    appended_inclusion_filters.begin(),
+                                    appended_inclusion_filters.end());
+    }
+    still_included_program_.Compile(still_included_filters);
+
+    // Rows that matched none of the inclusion filters may match one of the
+    // appended ones, so long as they match no exclusion filter.
+    may_include_new_rows_ = had_inclusion_filters &&
+        !appended_inclusion_filters.empty();
+    std::vector<Filter> newly_included_filters;
+    if (may_include_new_rows_) {
+      newly_included_filters = appended_inclusion_filters;
+      newly_included_filters.insert(newly_included_filters.end(),
+                                    exclusion_filters_.begin(),
+                                    exclusion_filters_.end());
+    }
+    newly_included_program_.Compile(newly_included_filters);
 
-  RestartFiltering();
+    previous_rows_.swap(included_rows_);
+    included_rows_.clear();
+    refined_rows_ = filtered_rows_;
+    filtered_rows_ = 0;
+    cancelled_ = false;
+    PostFilteringTask();
+  } else {
+    RestartFiltering();
+  }
+
+  NotifyCleared();
 }
 
 void FilteredLogView::RestartFiltering() {
   // Reset our included state and our filtering state.
   filtered_rows_ = 0;
   included_rows_.clear();
+  previous_rows_.clear();
+  refined_rows_ = 0;
+  cancelled_ = false;
   PostFilteringTask();
 }
 
@@ -223,3 +404,15 @@ void FilteredLogView::PostFilteringTask() {
     MessageLoop::current()->PostTask(FROM_HERE, task_);
   }
 }
+
+void FilteredLogView::NotifyNewItems() {
+  EventSinkMap::iterator it(event_sinks_.begin());
+  for (; it != event_sinks_.end(); ++it)
+    it->second->LogViewNewItems();
+}
+
+void FilteredLogView::NotifyCleared() {
+  EventSinkMap::iterator it(event_sinks_.begin());
+  for (; it != event_sinks_.end(); ++it)
+    it->second->LogViewCleared();
+}
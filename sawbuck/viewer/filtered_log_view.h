@@ -20,14 +20,36 @@
 #include <string>
 #include <vector>
 
+#include "base/atomicops.h"
+#include "base/logging.h"
 #include "base/scoped_ptr.h"
+#include "base/synchronization/waitable_event.h"
 #include "sawbuck/viewer/filter.h"
+#include "sawbuck/viewer/filter_program.h"
 #include "sawbuck/viewer/log_list_view.h"
+#include "sawbuck/viewer/row_bitmap.h"
 
-// Forward decl.
+// Forward decls.
 class CancelableTask;
+namespace base {
+class DelegateSimpleThreadPool;
+}  // namespace base
+
+// Receives reports on the progress of a FilteredLogView's filtering.
+class IFilterProgressEvents {
+ public:
+  // Called after each step of filtering.
+  // @param filtered_rows the number of rows of the original view filtered
+  //     so far.
+  // @param total_rows the number of rows in the original view.
+  virtual void FilterProgress(int filtered_rows, int total_rows) = 0;
+};
 
 // Provides a filtered view on a log.
+// Filtering is done in steps, each of which filters a block of rows per
+// thread, so as to keep the UI responsive. When filters are only appended
+// to the current ones, the rows filtered so far are refined with the new
+// filters, rather than filtered from scratch.
 class FilteredLogView
     : public ILogViewEvents,
       public ILogView {
@@ -36,6 +58,21 @@ class FilteredLogView
                            const std::vector<Filter>& filters);
   ~FilteredLogView();
 
+  // Sets the number of threads to filter with. The original view must
+  // support concurrent reads if this is more than one. Defaults to one.
+  void set_num_threads(size_t num_threads);
+
+  void set_progress_sink(IFilterProgressEvents* progress_sink) {
+    progress_sink_ = progress_sink;
+  }
+
+  // Returns true while there are rows left to filter.
+  bool IsFiltering() const { return task_ != NULL; }
+
+  // Stops filtering, leaving the view with the rows filtered so far. New
+  // rows are ignored until the filters are next set.
+  void CancelFiltering();
+
   // ILogViewEvents implementation.
   virtual void LogViewNewItems();
   virtual void LogViewCleared();
@@ -57,28 +94,77 @@ class FilteredLogView
   virtual void Unregister(int registration_cookie);
   // @}
 
- void SetFilters(const std::vector<Filter>& filters);
+  // Sets the filters to @p filters, and starts filtering afresh, or
+  // refines the rows filtered so far if @p filters only adds to the current
+  // filters. Notifies our event sinks that the view was cleared.
+  void SetFilters(const std::vector<Filter>& filters);
 
  protected:
+  // Filters the rows of one block of the original view.
+  class BlockFilter;
+
   void PostFilteringTask();
   void FilterChunk();
   virtual void RestartFiltering();
 
-  // Returns true if the item at |index| would match a filter in |list|,
-  // false otherwise.
-  bool MatchesFilterList(const std::vector<Filter>& list, int index);
+  // Called by each BlockFilter of a step once it's done.
+  void OnBlockFiltered();
+  // Waits for and releases the worker threads, if any.
+  void StopWorkers();
 
-  // The filters we are using. We break them into two lists, one that contains
-  // inclusion filters, the other exclusion filters.
+  // Returns true iff the row at |index| passes the filters.
+  bool IsIncluded(int index);
+  // Returns true iff the row at |index| passes the filters, given whether it
+  // passed them before the last filters were appended.
+  bool IsStillIncluded(int index, bool was_included);
+
+  // Notifies our event sinks.
+  void NotifyNewItems();
+  void NotifyCleared();
+
+  // The filters we are using, in order.
+  std::vector<Filter> filters_;
+  // We break them into two lists, one that contains inclusion filters, the
+  // other exclusion filters.
   std::vector<Filter> inclusion_filters_;
   std::vector<Filter> exclusion_filters_;
+  // And compile them for evaluation.
+  FilterProgram program_;
+
+  // When refining, the programs that rows included in the previous results
+  // must pass to stay included, and that the other rows must pass to become
+  // included, if any may.
+  FilterProgram still_included_program_;
+  FilterProgram newly_included_program_;
+  bool may_include_new_rows_;
 
   // The included rows we have filtered.
-  std::vector<int> included_rows_;
+  RowBitmap included_rows_;
   // Row number of last row in |original_| that we've processed.
   int filtered_rows_;
+
+  // The results computed with the filters in place before the last ones were
+  // appended, which are refined rather than computed afresh for rows below
+  // |refined_rows_|. Empty if there's nothing to refine.
+  RowBitmap previous_rows_;
+  int refined_rows_;
+
   // Non-NULL if there's a task pending to process additional rows.
   CancelableTask* task_;
+  // True if filtering has been cancelled.
+  bool cancelled_;
+
+  size_t num_threads_;
+  // Filters all but the first block of each step when there's more than one
+  // thread. It's started by the first step that needs it, and its threads
+  // are kept for the lifetime of the view.
+  scoped_ptr<base::DelegateSimpleThreadPool> worker_pool_;
+  // The number of blocks of the current step that have yet to be filtered,
+  // and the event signaled once the last of them is.
+  volatile base::subtle::Atomic32 unfiltered_blocks_;
+  base::WaitableEvent blocks_filtered_;
+
+  IFilterProgressEvents* progress_sink_;
 
   ILogView* original_;
   int registration_cookie_;
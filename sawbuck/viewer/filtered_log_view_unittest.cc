@@ -14,6 +14,7 @@
 #include "sawbuck/viewer/filtered_log_view.h"
 
 #include "base/message_loop.h"
+#include "base/stringprintf.h"
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 #include "sawbuck/viewer/mock_log_view_interfaces.h"
@@ -22,6 +23,7 @@ namespace {
 
 using testing::_;
 using testing::AtLeast;
+using testing::InSequence;
 using testing::Return;
 using testing::SetArgumentPointee;
 using testing::StrictMock;
@@ -37,6 +39,52 @@ class TestingFilteredLogView: public FilteredLogView {
   CancelableTask* task() const { return task_; }
 };
 
+// A log view over a list of messages, which may be read concurrently.
+class FakeLogView : public ILogView {
+ public:
+  explicit FakeLogView(int num_rows) {
+    for (int i = 0; i < num_rows; ++i)
+      messages_.push_back(StringPrintf("Message %d", i));
+  }
+
+  virtual int GetNumRows() { return static_cast<int>(messages_.size()); }
+  virtual void ClearAll() { messages_.clear(); }
+  virtual int GetSeverity(int row) { return 0; }
+  virtual DWORD GetProcessId(int row) { return 0; }
+  virtual DWORD GetThreadId(int row) { return 0; }
+  virtual base::Time GetTime(int row) { return base::Time(); }
+  virtual std::string GetFileName(int row) { return ""; }
+  virtual int GetLine(int row) { return 0; }
+  virtual std::string GetMessage(int row) { return messages_[row]; }
+  virtual void GetStackTrace(int row, std::vector<void*>* trace) {}
+  virtual void Register(ILogViewEvents* event_sink,
+                        int* registration_cookie) {
+    *registration_cookie = 1;
+  }
+  virtual void Unregister(int registration_cookie) {}
+
+ private:
+  std::vector<std::string> messages_;
+};
+
+class MockFilterProgressEvents : public IFilterProgressEvents {
+ public:
+  MOCK_METHOD2(FilterProgress, void(int filtered_rows, int total_rows));
+};
+
+// Cancels filtering after the first step.
+class CancellingProgressSink : public IFilterProgressEvents {
+ public:
+  CancellingProgressSink() : view_(NULL) {
+  }
+
+  virtual void FilterProgress(int filtered_rows, int total_rows) {
+    view_->CancelFiltering();
+  }
+
+  FilteredLogView* view_;
+};
+
 class FilteredLogViewTest: public testing::Test {
  public:
   static const int kRegCookie = 42;
@@ -196,6 +244,130 @@ TEST_F(FilteredLogViewTest, Filtering) {
   ExpectUnregistration();
 }
 
+TEST_F(FilteredLogViewTest, RefineAppendedFilters) {
+  const int kNumRows = 3;
+  ExpectCreation(kNumRows);
+
+  std::vector<Filter> filters;
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS, Filter::INCLUDE,
+                           L"I'm incl"));
+  TestingFilteredLogView filtered(&mock_view_, filters);
+
+  EXPECT_CALL(mock_view_, GetNumRows())
+      .WillRepeatedly(Return(kNumRows));
+  EXPECT_CALL(mock_view_, GetMessage(0))
+      .WillOnce(Return("I'm not included"));
+  EXPECT_CALL(mock_view_, GetMessage(1))
+      .WillRepeatedly(Return("I'm Included"));
+  EXPECT_CALL(mock_view_, GetMessage(2))
+      .WillRepeatedly(Return("I'm Included but also Excluded"));
+
+  message_loop_.RunAllPending();
+  ASSERT_EQ(2, filtered.GetNumRows());
+
+  // Appending an exclusion filter only looks at the included rows.
+  EXPECT_CALL(mock_view_, GetMessage(0)).Times(0);
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS, Filter::EXCLUDE,
+                           L"Excluded"));
+  filtered.SetFilters(filters);
+  EXPECT_EQ(0, filtered.GetNumRows());
+
+  message_loop_.RunAllPending();
+  ASSERT_EQ(1, filtered.GetNumRows());
+  EXPECT_STREQ("I'm Included", filtered.GetMessage(0).c_str());
+
+  // Appending an inclusion filter only looks at the rows that matched no
+  // inclusion filter.
+  EXPECT_CALL(mock_view_, GetMessage(1)).Times(0);
+  EXPECT_CALL(mock_view_, GetMessage(0))
+      .WillRepeatedly(Return("I'm not included"));
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS, Filter::INCLUDE,
+                           L"not"));
+  filtered.SetFilters(filters);
+
+  message_loop_.RunAllPending();
+  ASSERT_EQ(2, filtered.GetNumRows());
+  EXPECT_STREQ("I'm not included", filtered.GetMessage(0).c_str());
+
+  ExpectUnregistration();
+}
+
+TEST_F(FilteredLogViewTest, MultiThreaded) {
+  // Enough rows for a few blocks, and a partial one.
+  const int kBlockRows = static_cast<int>(RowBitmap::kBlockRows);
+  const int kNumRows = 3 * kBlockRows + 1000;
+  FakeLogView original(kNumRows);
+
+  std::vector<Filter> filters;
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS, Filter::INCLUDE,
+                           L"7"));
+  filters.push_back(Filter(Filter::MESSAGE, Filter::CONTAINS, Filter::EXCLUDE,
+                           L"77"));
+  FilteredLogView filtered(&original, filters);
+  filtered.set_num_threads(2);
+
+  StrictMock<MockFilterProgressEvents> progress;
+  filtered.set_progress_sink(&progress);
+  {
+    InSequence in_sequence;
+    EXPECT_CALL(progress, FilterProgress(2 * kBlockRows, kNumRows));
+    EXPECT_CALL(progress, FilterProgress(kNumRows, kNumRows));
+  }
+
+  message_loop_.RunAllPending();
+  EXPECT_FALSE(filtered.IsFiltering());
+
+  std::vector<int> expected;
+  for (int i = 0; i < kNumRows; ++i) {
+    std::string message = original.GetMessage(i);
+    if (message.find('7') != std::string::npos &&
+        message.find("77") == std::string::npos) {
+      expected.push_back(i);
+    }
+  }
+
+  ASSERT_EQ(static_cast<int>(expected.size()), filtered.GetNumRows());
+  for (size_t i = 0; i < expected.size(); ++i)
+    ASSERT_EQ(original.GetMessage(expected[i]), filtered.GetMessage(i));
+
+  // Filtering afresh with more threads replaces the workers.
+  filtered.set_progress_sink(NULL);
+  filtered.set_num_threads(4);
+  filtered.SetFilters(filters);
+  message_loop_.RunAllPending();
+  EXPECT_FALSE(filtered.IsFiltering());
+
+  ASSERT_EQ(static_cast<int>(expected.size()), filtered.GetNumRows());
+  for (size_t i = 0; i < expected.size(); ++i)
+    ASSERT_EQ(original.GetMessage(expected[i]), filtered.GetMessage(i));
+}
+
+TEST_F(FilteredLogViewTest, CancelFiltering) {
+  const int kBlockRows = static_cast<int>(RowBitmap::kBlockRows);
+  const int kNumRows = 2 * kBlockRows;
+  FakeLogView original(kNumRows);
+
+  FilteredLogView filtered(&original, filters_);
+  CancellingProgressSink progress;
+  progress.view_ = &filtered;
+  filtered.set_progress_sink(&progress);
+
+  message_loop_.RunAllPending();
+  EXPECT_FALSE(filtered.IsFiltering());
+  EXPECT_EQ(kBlockRows, filtered.GetNumRows());
+
+  // New rows are ignored once cancelled.
+  filtered.LogViewNewItems();
+  EXPECT_FALSE(filtered.IsFiltering());
+
+  // Until the filters are set anew.
+  filtered.set_progress_sink(NULL);
+  filtered.SetFilters(filters_);
+  EXPECT_TRUE(filtered.IsFiltering());
+  message_loop_.RunAllPending();
+  EXPECT_EQ(kNumRows, filtered.GetNumRows());
+}
+
 class MockFilteredLogView : public TestingFilteredLogView {
  public:
   explicit MockFilteredLogView(ILogView* original,
@@ -0,0 +1,155 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Log ingestion queue implementation.
+#include "sawbuck/viewer/log_ingestion_queue.h"
+
+#include <algorithm>
+#include "base/logging.h"
+
+using base::subtle::Acquire_Load;
+using base::subtle::AtomicWord;
+using base::subtle::NoBarrier_Load;
+using base::subtle::Release_Store;
+
+LogIngestionQueue::LogIngestionQueue() : tail_(NULL), head_(NULL),
+    head_index_(0) {
+  tail_ = head_ = AllocateBatch(kBatchTextSize);
+}
+
+LogIngestionQueue::~LogIngestionQueue() {
+  while (head_ != NULL) {
+    Batch* next = reinterpret_cast<Batch*>(NoBarrier_Load(&head_->next));
+    FreeBatch(head_);
+    head_ = next;
+  }
+}
+
+void LogIngestionQueue::Push(const LogStore::Message& message) {
+  DCHECK(message.file_len == 0 || message.file != NULL);
+  DCHECK(message.message_len == 0 || message.message != NULL);
+  DCHECK(message.trace_depth == 0 || message.traces != NULL);
+
+  size_t traces_len = message.trace_depth * sizeof(message.traces[0]);
+  // Leave room to align the stack trace.
+  size_t text_len = traces_len + message.file_len + message.message_len +
+      sizeof(void*);
+
+  // We're the only writer of the count, so we needn't synchronize with
+  // ourselves.
+  Batch* batch = tail_;
+  size_t count = NoBarrier_Load(&batch->count);
+  if (count == kBatchSize || text_len > batch->text_size - batch->text_used) {
+    Batch* next = AllocateBatch(std::max(text_len, kBatchTextSize));
+
+    // Everything in the full batch has already been published, so the
+    // consumer may retire it as soon as it sees the next one.
+    Release_Store(&batch->next, reinterpret_cast<AtomicWord>(next));
+    tail_ = batch = next;
+    count = 0;
+  }
+
+  // The stack trace goes first so that it's aligned.
+  batch->text_used = (batch->text_used + sizeof(void*) - 1) &
+      ~(sizeof(void*) - 1);
+
+  Entry& entry = batch->entries[count];
+  entry.level = message.level;
+  entry.process_id = message.process_id;
+  entry.thread_id = message.thread_id;
+  entry.time = message.time.ToInternalValue();
+  entry.line = message.line;
+  entry.traces_offset = CopyText(batch, message.traces, traces_len);
+  entry.trace_depth = message.trace_depth;
+  entry.file_offset = CopyText(batch, message.file, message.file_len);
+  entry.file_len = message.file_len;
+  entry.message_offset = CopyText(batch, message.message,
+                                  message.message_len);
+  entry.message_len = message.message_len;
+
+  // Publish the entry.
+  Release_Store(&batch->count, count + 1);
+}
+
+bool LogIngestionQueue::Pop(LogStore::Message* message) {
+  DCHECK(message != NULL);
+
+  Batch* batch = head_;
+  if (head_index_ == Acquire_Load(&batch->count)) {
+    Batch* next = reinterpret_cast<Batch*>(Acquire_Load(&batch->next));
+    if (next == NULL)
+      return false;
+
+    // The producer publishes the last entry of a batch before linking the
+    // next one, so we must look at the count again before moving on.
+    if (head_index_ == Acquire_Load(&batch->count)) {
+      FreeBatch(batch);
+      head_ = batch = next;
+      head_index_ = 0;
+
+      // The producer links a batch before filling it.
+      if (Acquire_Load(&batch->count) == 0)
+        return false;
+    }
+  }
+
+  const Entry& entry = batch->entries[head_index_++];
+  message->level = entry.level;
+  message->process_id = entry.process_id;
+  message->thread_id = entry.thread_id;
+  message->time = base::Time::FromInternalValue(entry.time);
+  message->file = batch->text + entry.file_offset;
+  message->file_len = entry.file_len;
+  message->line = entry.line;
+  message->message = batch->text + entry.message_offset;
+  message->message_len = entry.message_len;
+  message->trace_depth = entry.trace_depth;
+  message->traces =
+      reinterpret_cast<void* const*>(batch->text + entry.traces_offset);
+
+  return true;
+}
+
+LogIngestionQueue::Batch* LogIngestionQueue::AllocateBatch(
+    size_t text_size) {
+  Batch* batch = new Batch;
+  batch->count = 0;
+  batch->next = 0;
+  batch->text = new char[text_size];
+  batch->text_size = text_size;
+  batch->text_used = 0;
+
+  return batch;
+}
+
+void LogIngestionQueue::FreeBatch(Batch* batch) {
+  DCHECK(batch != NULL);
+
+  delete [] batch->text;
+  delete batch;
+}
+
+uint32 LogIngestionQueue::CopyText(Batch* batch,
+                                   const void* data,
+                                   size_t length) {
+  DCHECK(batch != NULL);
+  DCHECK_LE(length, batch->text_size - batch->text_used);
+
+  uint32 offset = batch->text_used;
+  if (length != 0)
+    memcpy(batch->text + offset, data, length);
+  batch->text_used += length;
+
+  return offset;
+}
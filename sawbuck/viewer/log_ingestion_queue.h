@@ -0,0 +1,102 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Log ingestion queue declaration.
+#ifndef SAWBUCK_VIEWER_LOG_INGESTION_QUEUE_H_
+#define SAWBUCK_VIEWER_LOG_INGESTION_QUEUE_H_
+
+#include "base/atomicops.h"
+#include "base/basictypes.h"
+#include "sawbuck/viewer/log_store.h"
+
+// A lock-free queue that carries log messages from a single producer thread
+// to a single consumer thread. Messages are copied into batches, each of
+// which holds many messages and their text. The producer publishes each
+// message by bumping its batch's message count, and links a new batch onto
+// the queue once the current one is full, so the two threads never wait on
+// each other. The queue is unbounded, so a producer is never held up by a
+// consumer that's busy elsewhere.
+class LogIngestionQueue {
+ public:
+  LogIngestionQueue();
+  // The producer and consumer must both be done with the queue by now.
+  ~LogIngestionQueue();
+
+  // Copies @p message onto the queue. Must only be called by the producer.
+  void Push(const LogStore::Message& message);
+
+  // Retrieves the oldest message on the queue. Must only be called by the
+  // consumer.
+  // @param message on success, describes the message. Its strings and stack
+  //     trace remain valid until the next call to Pop.
+  // @returns true if a message was retrieved, false if the queue is empty.
+  bool Pop(LogStore::Message* message);
+
+ private:
+  // The number of messages in a batch.
+  static const size_t kBatchSize = 1024;
+  // The default size of a batch's text buffer. Batches for messages too
+  // large for this get a buffer big enough for the one message.
+  static const size_t kBatchTextSize = 128 * 1024;
+
+  // A message in a batch. Its strings and stack trace are stored in the
+  // batch's text buffer.
+  struct Entry {
+    uint8 level;
+    DWORD process_id;
+    DWORD thread_id;
+    int64 time;
+    int line;
+    uint32 file_offset;
+    uint32 file_len;
+    uint32 message_offset;
+    uint32 message_len;
+    uint32 traces_offset;
+    uint32 trace_depth;
+  };
+
+  struct Batch {
+    // The number of entries published by the producer.
+    volatile base::subtle::Atomic32 count;
+    // The batch following this one, set by the producer once it's done
+    // with this batch.
+    volatile base::subtle::AtomicWord next;
+    Entry entries[kBatchSize];
+
+    // Holds the strings and stack traces of the entries.
+    char* text;
+    size_t text_size;
+    // The number of bytes of text used. Producer only.
+    size_t text_used;
+  };
+
+  static Batch* AllocateBatch(size_t text_size);
+  static void FreeBatch(Batch* batch);
+
+  // Copies @p length bytes of @p data to the text buffer of @p batch.
+  // @returns the offset of the copy in the text buffer.
+  static uint32 CopyText(Batch* batch, const void* data, size_t length);
+
+  // The batch the producer is filling. Producer only.
+  Batch* tail_;
+
+  // The batch the consumer is reading, and the index of the next entry to
+  // read from it. Consumer only.
+  Batch* head_;
+  size_t head_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogIngestionQueue);
+};
+
+#endif  // SAWBUCK_VIEWER_LOG_INGESTION_QUEUE_H_
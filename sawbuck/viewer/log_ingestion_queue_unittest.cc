@@ -0,0 +1,138 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Log ingestion queue unittests.
+#include "sawbuck/viewer/log_ingestion_queue.h"
+
+#include "base/stringprintf.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Pushes a message numbered @p i, which CheckMessage can recognize.
+void PushMessage(LogIngestionQueue* queue, int i, size_t padding) {
+  std::string file = StringPrintf("file%d.cc", i % 7);
+  std::string message = StringPrintf("Message %d", i);
+  message.append(padding, 'x');
+  void* traces[] = { reinterpret_cast<void*>(i),
+                     reinterpret_cast<void*>(i + 1) };
+
+  LogStore::Message msg;
+  msg.level = i % 5;
+  msg.process_id = i;
+  msg.thread_id = i + 1;
+  msg.time = base::Time::FromInternalValue(i * 10);
+  msg.file = file.data();
+  msg.file_len = file.size();
+  msg.line = i % 1000;
+  msg.message = message.data();
+  msg.message_len = message.size();
+  msg.trace_depth = i % 3;
+  msg.traces = traces;
+  queue->Push(msg);
+}
+
+void CheckMessage(const LogStore::Message& msg, int i, size_t padding) {
+  std::string message = StringPrintf("Message %d", i);
+  message.append(padding, 'x');
+
+  ASSERT_EQ(i % 5, msg.level);
+  ASSERT_EQ(static_cast<DWORD>(i), msg.process_id);
+  ASSERT_EQ(static_cast<DWORD>(i + 1), msg.thread_id);
+  ASSERT_EQ(i * 10, msg.time.ToInternalValue());
+  ASSERT_EQ(StringPrintf("file%d.cc", i % 7),
+            std::string(msg.file, msg.file_len));
+  ASSERT_EQ(i % 1000, msg.line);
+  ASSERT_EQ(message, std::string(msg.message, msg.message_len));
+  ASSERT_EQ(static_cast<size_t>(i % 3), msg.trace_depth);
+  for (size_t j = 0; j < msg.trace_depth; ++j)
+    ASSERT_EQ(reinterpret_cast<void*>(i + j), msg.traces[j]);
+}
+
+class ProducerThread : public base::DelegateSimpleThread::Delegate {
+ public:
+  ProducerThread(LogIngestionQueue* queue, int num_messages)
+      : queue_(queue), num_messages_(num_messages) {
+  }
+
+  virtual void Run() {
+    for (int i = 0; i < num_messages_; ++i)
+      PushMessage(queue_, i, i % 100);
+  }
+
+ private:
+  LogIngestionQueue* queue_;
+  int num_messages_;
+};
+
+}  // namespace
+
+TEST(LogIngestionQueueTest, PushAndPop) {
+  LogIngestionQueue queue;
+  LogStore::Message msg;
+  EXPECT_FALSE(queue.Pop(&msg));
+
+  PushMessage(&queue, 1, 0);
+  PushMessage(&queue, 2, 0);
+  ASSERT_TRUE(queue.Pop(&msg));
+  ASSERT_NO_FATAL_FAILURE(CheckMessage(msg, 1, 0));
+  ASSERT_TRUE(queue.Pop(&msg));
+  ASSERT_NO_FATAL_FAILURE(CheckMessage(msg, 2, 0));
+  EXPECT_FALSE(queue.Pop(&msg));
+
+  // The queue may be reused once it's empty.
+  PushMessage(&queue, 3, 0);
+  ASSERT_TRUE(queue.Pop(&msg));
+  ASSERT_NO_FATAL_FAILURE(CheckMessage(msg, 3, 0));
+  EXPECT_FALSE(queue.Pop(&msg));
+}
+
+TEST(LogIngestionQueueTest, SpansBatches) {
+  LogIngestionQueue queue;
+
+  // Enough messages to fill several batches, with a few too large for
+  // a batch thrown in.
+  const int kNumMessages = 10000;
+  for (int i = 0; i < kNumMessages; ++i)
+    PushMessage(&queue, i, i % 2500 == 0 ? 1024 * 1024 : 0);
+
+  LogStore::Message msg;
+  for (int i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(queue.Pop(&msg));
+    ASSERT_NO_FATAL_FAILURE(
+        CheckMessage(msg, i, i % 2500 == 0 ? 1024 * 1024 : 0));
+  }
+  EXPECT_FALSE(queue.Pop(&msg));
+}
+
+TEST(LogIngestionQueueTest, ConcurrentProducer) {
+  LogIngestionQueue queue;
+  const int kNumMessages = 200000;
+  ProducerThread producer(&queue, kNumMessages);
+  base::DelegateSimpleThread thread(&producer, "producer");
+  thread.Start();
+
+  // Every message arrives intact, and in order.
+  LogStore::Message msg;
+  for (int i = 0; i < kNumMessages; ) {
+    if (queue.Pop(&msg)) {
+      ASSERT_NO_FATAL_FAILURE(CheckMessage(msg, i, i % 100));
+      ++i;
+    }
+  }
+
+  thread.Join();
+  EXPECT_FALSE(queue.Pop(&msg));
+}
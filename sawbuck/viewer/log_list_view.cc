@@ -26,38 +26,12 @@
 #include "pcrecpp.h"  // NOLINT
 #include "sawbuck/log_lib/process_info_service.h"
 #include "sawbuck/viewer/const_config.h"
+#include "sawbuck/viewer/message_index.h"
 #include "sawbuck/viewer/resource.h"
 #include "sawbuck/viewer/stack_trace_list_view.h"
 
 namespace {
 
-const char* GetSeverityText(UCHAR severity) {
-  switch (severity)  {
-    case TRACE_LEVEL_NONE:
-      return "NONE";
-    case TRACE_LEVEL_FATAL:
-      return "FATAL";
-    case TRACE_LEVEL_ERROR:
-      return "ERROR";
-    case TRACE_LEVEL_WARNING:
-      return "WARNING";
-    case TRACE_LEVEL_INFORMATION:
-      return "INFORMATION";
-    case TRACE_LEVEL_VERBOSE:
-      return "VERBOSE";
-    case TRACE_LEVEL_RESERVED6:
-      return "RESERVED6";
-    case TRACE_LEVEL_RESERVED7:
-      return "RESERVED7";
-    case TRACE_LEVEL_RESERVED8:
-      return "RESERVED8";
-    case TRACE_LEVEL_RESERVED9:
-      return "RESERVED9";
-  }
-
-  return "UNKNOWN";
-}
-
 // Returns true iff state indicates a selected listview item.
 bool IsSelected(UINT state) {
   return (state & LVIS_SELECTED) == LVIS_SELECTED;
@@ -88,6 +62,33 @@ const wchar_t* LogListView::kColumnWidthValueName =
 LogViewFormatter::LogViewFormatter() {
 }
 
+const char* LogViewFormatter::GetSeverityText(UCHAR severity) {
+  switch (severity)  {
+    case TRACE_LEVEL_NONE:
+      return "NONE";
+    case TRACE_LEVEL_FATAL:
+      return "FATAL";
+    case TRACE_LEVEL_ERROR:
+      return "ERROR";
+    case TRACE_LEVEL_WARNING:
+      return "WARNING";
+    case TRACE_LEVEL_INFORMATION:
+      return "INFORMATION";
+    case TRACE_LEVEL_VERBOSE:
+      return "VERBOSE";
+    case TRACE_LEVEL_RESERVED6:
+      return "RESERVED6";
+    case TRACE_LEVEL_RESERVED7:
+      return "RESERVED7";
+    case TRACE_LEVEL_RESERVED8:
+      return "RESERVED8";
+    case TRACE_LEVEL_RESERVED9:
+      return "RESERVED9";
+  }
+
+  return "UNKNOWN";
+}
+
 bool LogViewFormatter::FormatColumn(ILogView* log_view,
                                     int row,
                                     Column col,
@@ -178,6 +179,9 @@ LogListView::LogListView(CUpdateUIBase* update_ui)
                  wrong_number_of_column_info);
 }
 
+LogListView::~LogListView() {
+}
+
 void LogListView::SetLogView(ILogView* log_view) {
   if (log_view_ == log_view)
     return;
@@ -188,8 +192,13 @@ void LogListView::SetLogView(ILogView* log_view) {
     event_cookie_ = 0;
   }
 
-  // Store the new one.
+  // Store the new one, and index it.
   log_view_ = log_view;
+  message_index_.reset();
+  if (log_view_ != NULL) {
+    message_index_.reset(
+        new MessageIndex(log_view_, MessageIndex::kDefaultMaxMemory));
+  }
 
   // Adjust our size if we've been created already.
   if (IsWindow()) {
@@ -513,24 +522,15 @@ void LogListView::OnAutoSizeColumns(UINT code, int id, CWindow window) {
 }
 
 void LogListView::FindNext() {
-  pcrecpp::RE_Options options = PCRE_UTF8;
-  options.set_caseless(!find_params_.match_case_);
-  pcrecpp::RE expression(find_params_.expression_, options);
+  DCHECK(message_index_.get() != NULL);
 
   int start = GetNextItem(-1, LVIS_FOCUSED);
-  int num_rows = log_view_->GetNumRows();
-  bool down = find_params_.direction_down_;
-  int i = down ? start + 1 : start - 1;
-  if (i < 0)
-    i = 0;  // in case start == -1.
-
-  for (; down ? i < num_rows : i >= 0; down ? ++i : --i) {
-    std::string message(log_view_->GetMessage(i));
-    if (expression.PartialMatch(message))
-      break;
-  }
+  int i = message_index_->FindNext(find_params_.expression_,
+                                   find_params_.match_case_,
+                                   start,
+                                   find_params_.direction_down_);
 
-  if (i >= 0 && i < num_rows) {
+  if (i >= 0) {
     // Clear the existing selection.
     if (start >= 0)
       SetItemState(start, 0, LVIS_SELECTED | LVIS_FOCUSED);
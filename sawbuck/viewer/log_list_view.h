@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 #include "base/message_loop.h"
+#include "base/scoped_ptr.h"
 #include "sawbuck/viewer/find_dialog.h"
 #include "sawbuck/viewer/list_view_base.h"
 #include "sawbuck/viewer/resource.h"
@@ -83,6 +84,9 @@ class LogViewFormatter {
                     Column col,
                     std::string* str);
 
+  // Returns the text displayed for @p severity.
+  static const char* GetSeverityText(UCHAR severity);
+
   base::Time base_time() const { return base_time_; }
   void set_base_time(base::Time base_time) { base_time_ = base_time; }
 
@@ -92,6 +96,7 @@ class LogViewFormatter {
 };
 
 // Forward decls.
+class MessageIndex;
 class StackTraceListView;
 class IProcessInfoService;
 namespace WTL {
@@ -132,6 +137,7 @@ class LogListView
   END_MSG_MAP()
 
   explicit LogListView(CUpdateUIBase* update_ui);
+  ~LogListView();
 
   void set_stack_trace_view(StackTraceListView* stack_trace_view) {
     stack_trace_view_ = stack_trace_view;
@@ -212,6 +218,9 @@ class LogListView
   ILogView* log_view_;
   int event_cookie_;
 
+  // Indexes the messages of |log_view_| to speed up finding them.
+  scoped_ptr<MessageIndex> message_index_;
+
   // Image indexes for severity, stored by severity value.
   std::vector<int> image_indexes_;
   int GetImageIndexForSeverity(int severity);
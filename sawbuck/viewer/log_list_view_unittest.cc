@@ -19,6 +19,7 @@
 
 namespace {
 
+using testing::_;
 using testing::NotNull;
 using testing::StrictMock;
 
@@ -41,8 +42,10 @@ class TestingLogListView : public StrictMock<MockLogListView> {
 };
 
 TEST_F(LogListViewTest, ClearAll) {
-  TestingLogListView test_log_list_view;
   StrictMock<testing::MockILogView> mock_log_view;
+  TestingLogListView test_log_list_view;
+  // The list view indexes the messages of the log view it's given.
+  EXPECT_CALL(mock_log_view, Register(_, NotNull())).Times(1);
   EXPECT_CALL(mock_log_view, Register(&test_log_list_view, NotNull())).Times(1);
   test_log_list_view.SetLogView(&mock_log_view);
 
@@ -51,6 +54,8 @@ TEST_F(LogListViewTest, ClearAll) {
 
   EXPECT_CALL(test_log_list_view, DeleteAllItems()).Times(1);
   test_log_list_view.LogViewCleared();
+
+  EXPECT_CALL(mock_log_view, Unregister(_)).Times(1);
 }
 
 }  // namespace
@@ -0,0 +1,329 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Log store implementation.
+#include "sawbuck/viewer/log_store.h"
+
+#include <algorithm>
+#include "base/message_loop.h"
+#include "base/task.h"
+#include "sawbuck/viewer/log_ingestion_queue.h"
+
+namespace {
+
+// The size of the blocks message text is allocated from. Longer messages
+// get a block of their own.
+const size_t kTextBlockSize = 1024 * 1024;
+
+}  // namespace
+
+// We only keep one outstanding task and we cancel it on destruction,
+// so a noop retain is safe.
+template <>
+struct RunnableMethodTraits<LogStore> {
+  RunnableMethodTraits() {
+  }
+
+  ~RunnableMethodTraits() {
+  }
+
+  void RetainCallee(LogStore* store) {
+  }
+
+  void ReleaseCallee(LogStore* store) {
+  }
+};
+
+LogStore::InternTable::InternTable() : bytes_(0) {
+  Intern("", 0);
+}
+
+uint32 LogStore::InternTable::Intern(const char* data, size_t length) {
+  std::pair<IndexMap::iterator, bool> inserted = indices_.insert(
+      std::make_pair(std::string(data, length),
+                     static_cast<uint32>(strings_.size())));
+  if (inserted.second) {
+    strings_.push_back(&inserted.first->first);
+    bytes_ += length;
+  }
+
+  return inserted.first->second;
+}
+
+size_t LogStore::InternTable::GetMemoryUsage() const {
+  // This is an estimate, as we don't know the overhead of the hash map.
+  return bytes_ + strings_.size() *
+      (sizeof(std::string) + sizeof(uint32) + 2 * sizeof(void*));
+}
+
+void LogStore::InternTable::clear() {
+  indices_.clear();
+  strings_.clear();
+  bytes_ = 0;
+  Intern("", 0);
+}
+
+LogStore::LogStore()
+    : queue_(new LogIngestionQueue()),
+      drain_pending_(0),
+      drain_task_(NULL),
+      committed_rows_(0),
+      text_next_(NULL),
+      text_remaining_(0),
+      text_bytes_(0),
+      loop_(MessageLoop::current()),
+      next_sink_cookie_(1) {
+  DCHECK(loop_ != NULL);
+}
+
+LogStore::~LogStore() {
+  {
+    base::AutoLock lock(drain_task_lock_);
+    if (drain_task_ != NULL) {
+      drain_task_->Cancel();
+      drain_task_ = NULL;
+    }
+  }
+
+  ClearRows();
+}
+
+void LogStore::Append(const Message& message) {
+  queue_->Push(message);
+
+  // The message must be visible to the store's thread before we look at
+  // drain_pending_, or we could miss a drain that's just finishing.
+  base::subtle::MemoryBarrier();
+  if (base::subtle::NoBarrier_Load(&drain_pending_) == 0 &&
+      base::subtle::Acquire_CompareAndSwap(&drain_pending_, 0, 1) == 0) {
+    ScheduleDrainQueue();
+  }
+}
+
+size_t LogStore::GetMemoryUsage() {
+  DCHECK_EQ(loop_, MessageLoop::current());
+  return levels_.GetMemoryUsage() + process_ids_.GetMemoryUsage() +
+      thread_ids_.GetMemoryUsage() + times_.GetMemoryUsage() +
+      files_.GetMemoryUsage() + lines_.GetMemoryUsage() +
+      messages_.GetMemoryUsage() + traces_.GetMemoryUsage() +
+      file_names_.GetMemoryUsage() + stack_traces_.GetMemoryUsage() +
+      text_bytes_;
+}
+
+int LogStore::GetNumRows() {
+  return base::subtle::Acquire_Load(&committed_rows_);
+}
+
+void LogStore::ClearAll() {
+  DCHECK_EQ(loop_, MessageLoop::current());
+
+  // Discard the messages still in the queue, as they were received before
+  // the clear.
+  Message message;
+  while (queue_->Pop(&message)) {
+  }
+
+  base::subtle::Release_Store(&committed_rows_, 0);
+  ClearRows();
+  NotifyCleared();
+}
+
+int LogStore::GetSeverity(int row) {
+  DCHECK_LT(row, GetNumRows());
+  return levels_[row];
+}
+
+DWORD LogStore::GetProcessId(int row) {
+  DCHECK_LT(row, GetNumRows());
+  return process_ids_[row];
+}
+
+DWORD LogStore::GetThreadId(int row) {
+  DCHECK_LT(row, GetNumRows());
+  return thread_ids_[row];
+}
+
+base::Time LogStore::GetTime(int row) {
+  DCHECK_LT(row, GetNumRows());
+  return base::Time::FromInternalValue(times_[row]);
+}
+
+std::string LogStore::GetFileName(int row) {
+  DCHECK_LT(row, GetNumRows());
+  return file_names_.Get(files_[row]);
+}
+
+int LogStore::GetLine(int row) {
+  DCHECK_LT(row, GetNumRows());
+  return lines_[row];
+}
+
+std::string LogStore::GetMessage(int row) {
+  DCHECK_LT(row, GetNumRows());
+  const TextRef& text = messages_[row];
+  return std::string(text.data, text.length);
+}
+
+void LogStore::GetStackTrace(int row, std::vector<void*>* trace) {
+  DCHECK_LT(row, GetNumRows());
+  DCHECK(trace != NULL);
+
+  const std::string& bytes = stack_traces_.Get(traces_[row]);
+  void* const* begin = reinterpret_cast<void* const*>(bytes.data());
+  trace->assign(begin, begin + bytes.size() / sizeof(void*));
+}
+
+void LogStore::Register(ILogViewEvents* event_sink,
+                        int* registration_cookie) {
+  int cookie = next_sink_cookie_++;
+
+  event_sinks_.insert(std::make_pair(cookie, event_sink));
+  *registration_cookie = cookie;
+}
+
+void LogStore::Unregister(int registration_cookie) {
+  event_sinks_.erase(registration_cookie);
+}
+
+void LogStore::AppendRow(const Message& message) {
+  DCHECK(message.file_len == 0 || message.file != NULL);
+  DCHECK(message.message_len == 0 || message.message != NULL);
+  DCHECK(message.trace_depth == 0 || message.traces != NULL);
+
+  TextRef text = { AllocateText(message.message, message.message_len),
+                   message.message_len };
+  uint32 file = file_names_.Intern(message.file, message.file_len);
+  uint32 trace = stack_traces_.Intern(
+      reinterpret_cast<const char*>(message.traces),
+      message.trace_depth * sizeof(message.traces[0]));
+
+  levels_.push_back(message.level);
+  process_ids_.push_back(message.process_id);
+  thread_ids_.push_back(message.thread_id);
+  times_.push_back(message.time.ToInternalValue());
+  files_.push_back(file);
+  lines_.push_back(message.line);
+  messages_.push_back(text);
+  traces_.push_back(trace);
+}
+
+const char* LogStore::AllocateText(const char* data, size_t length) {
+  if (length == 0)
+    return NULL;
+
+  if (length > text_remaining_) {
+    // Start a new block, unless the text is too big for one. In that case
+    // it gets a block of its own, and we carry on with the current one.
+    size_t block_size = std::max(length, kTextBlockSize);
+    char* block = new char[block_size];
+    text_blocks_.push_back(block);
+    text_bytes_ += block_size;
+
+    if (block_size == length) {
+      memcpy(block, data, length);
+      return block;
+    }
+
+    text_next_ = block;
+    text_remaining_ = block_size;
+  }
+
+  char* text = text_next_;
+  memcpy(text, data, length);
+  text_next_ += length;
+  text_remaining_ -= length;
+  return text;
+}
+
+void LogStore::ClearRows() {
+  levels_.clear();
+  process_ids_.clear();
+  thread_ids_.clear();
+  times_.clear();
+  files_.clear();
+  lines_.clear();
+  messages_.clear();
+  traces_.clear();
+  file_names_.clear();
+  stack_traces_.clear();
+
+  for (size_t i = 0; i < text_blocks_.size(); ++i)
+    delete [] text_blocks_[i];
+  text_blocks_.clear();
+  text_next_ = NULL;
+  text_remaining_ = 0;
+  text_bytes_ = 0;
+}
+
+void LogStore::ScheduleDrainQueue() {
+  base::AutoLock lock(drain_task_lock_);
+
+  DCHECK(drain_task_ == NULL);
+  drain_task_ = NewRunnableMethod(this, &LogStore::DrainQueue);
+  DCHECK(drain_task_ != NULL);
+
+  if (drain_task_ != NULL)
+    loop_->PostTask(FROM_HERE, drain_task_);
+}
+
+void LogStore::DrainQueue() {
+  DCHECK_EQ(loop_, MessageLoop::current());
+  {
+    base::AutoLock lock(drain_task_lock_);
+
+    // Drain no longer pending.
+    drain_task_ = NULL;
+  }
+
+  // Allow the producer to schedule another drain before we look at the
+  // queue, so that anything it pushes after we're done isn't stranded.
+  base::subtle::NoBarrier_Store(&drain_pending_, 0);
+  base::subtle::MemoryBarrier();
+
+  Message message;
+  int num_drained = 0;
+  while (num_drained < kMaxRowsPerDrain && queue_->Pop(&message)) {
+    AppendRow(message);
+    ++num_drained;
+  }
+
+  // If we stopped short, leave the rest to another drain, unless the
+  // producer has already scheduled one.
+  if (num_drained == kMaxRowsPerDrain &&
+      base::subtle::Acquire_CompareAndSwap(&drain_pending_, 0, 1) == 0) {
+    ScheduleDrainQueue();
+  }
+
+  // Publish the new rows.
+  int num_rows = levels_.size();
+  if (num_rows == base::subtle::NoBarrier_Load(&committed_rows_))
+    return;
+  base::subtle::Release_Store(&committed_rows_, num_rows);
+
+  NotifyNewItems();
+}
+
+void LogStore::NotifyNewItems() {
+  DCHECK_EQ(loop_, MessageLoop::current());
+  EventSinkMap::iterator it(event_sinks_.begin());
+  for (; it != event_sinks_.end(); ++it)
+    it->second->LogViewNewItems();
+}
+
+void LogStore::NotifyCleared() {
+  DCHECK_EQ(loop_, MessageLoop::current());
+  EventSinkMap::iterator it(event_sinks_.begin());
+  for (; it != event_sinks_.end(); ++it)
+    it->second->LogViewCleared();
+}
@@ -0,0 +1,299 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Log store declaration.
+#ifndef SAWBUCK_VIEWER_LOG_STORE_H_
+#define SAWBUCK_VIEWER_LOG_STORE_H_
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "base/atomicops.h"
+#include "base/basictypes.h"
+#include "base/hash_tables.h"
+#include "base/logging.h"
+#include "base/scoped_ptr.h"
+#include "base/synchronization/lock.h"
+#include "base/time.h"
+#include "sawbuck/viewer/log_list_view.h"
+
+// Forward decls.
+class CancelableTask;
+class LogIngestionQueue;
+class MessageLoop;
+
+// An append-only column of values, stored in fixed-size chunks so that
+// appending never moves the existing values. A column has a single writer,
+// but may be read from other threads while it's being appended to.
+template <typename T>
+class LogStoreColumn {
+ public:
+  // Each chunk holds 2^kChunkShift values.
+  static const size_t kChunkShift = 16;
+  static const size_t kChunkSize = 1 << kChunkShift;
+
+  LogStoreColumn() : directory_(0), directory_capacity_(0), num_chunks_(0),
+      size_(0) {
+  }
+
+  ~LogStoreColumn() {
+    clear();
+  }
+
+  // Appends @p value. Must only be called by the writer.
+  void push_back(const T& value) {
+    size_t chunk = size_ >> kChunkShift;
+    if (chunk == num_chunks_)
+      AddChunk();
+    directory()[chunk][size_ & (kChunkSize - 1)] = value;
+    ++size_;
+  }
+
+  // Returns the value at @p index. This may be called from any thread,
+  // concurrently with push_back, as long as the value was published to the
+  // calling thread with release semantics after being appended.
+  const T& operator[](size_t index) const {
+    return directory()[index >> kChunkShift][index & (kChunkSize - 1)];
+  }
+
+  // Returns the number of values. Must only be called by the writer.
+  size_t size() const { return size_; }
+
+  // Returns the number of bytes allocated for the values.
+  // Must only be called by the writer.
+  size_t GetMemoryUsage() const {
+    return num_chunks_ * kChunkSize * sizeof(T);
+  }
+
+  // Frees all the values. This must not race with readers.
+  void clear() {
+    for (size_t i = 0; i < num_chunks_; ++i)
+      delete [] directory()[i];
+    for (size_t i = 0; i < directories_.size(); ++i)
+      delete [] directories_[i];
+    directories_.clear();
+    base::subtle::NoBarrier_Store(&directory_, 0);
+    directory_capacity_ = 0;
+    num_chunks_ = 0;
+    size_ = 0;
+  }
+
+ private:
+  T** directory() const {
+    return reinterpret_cast<T**>(base::subtle::NoBarrier_Load(&directory_));
+  }
+
+  void AddChunk() {
+    if (num_chunks_ == directory_capacity_) {
+      // Readers may be using the current directory, so rather than grow it
+      // in place we publish a larger copy, and hang on to the old one.
+      size_t capacity = std::max<size_t>(16, 2 * directory_capacity_);
+      T** new_directory = new T*[capacity];
+      std::copy(directory(), directory() + num_chunks_, new_directory);
+      directories_.push_back(new_directory);
+      base::subtle::Release_Store(
+          &directory_, reinterpret_cast<base::subtle::AtomicWord>(
+              new_directory));
+      directory_capacity_ = capacity;
+    }
+
+    directory()[num_chunks_++] = new T[kChunkSize];
+  }
+
+  // Points to the chunks, in order.
+  volatile base::subtle::AtomicWord directory_;
+  // All the directories allocated, the current one last.
+  std::vector<T**> directories_;
+  size_t directory_capacity_;
+  size_t num_chunks_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogStoreColumn);
+};
+
+// Stores log messages compactly, and provides a view on them. Each field
+// is stored in its own column. File names and stack traces are interned,
+// as there are few distinct ones, and the message text is allocated from
+// large blocks rather than individually.
+// Messages are appended by a producer thread through a lock-free queue,
+// which is drained into the columns on the thread the store was created on.
+// That thread then publishes the new row count, and issues change
+// notifications. Published rows never change, so the getters may be called
+// from any thread without locking for any row below GetNumRows(). The rest
+// of the ILogView interface must be used on the store's thread, and
+// ClearAll must not race with readers on other threads.
+class LogStore : public ILogView {
+ public:
+  // A message to append to the store. The strings and stack trace are
+  // copied, so they need only be valid for the duration of the call.
+  struct Message {
+    Message() : level(0), process_id(0), thread_id(0), file(NULL),
+        file_len(0), line(0), message(NULL), message_len(0),
+        trace_depth(0), traces(NULL) {
+    }
+
+    uint8 level;
+    DWORD process_id;
+    DWORD thread_id;
+    base::Time time;
+    const char* file;
+    size_t file_len;
+    int line;
+    const char* message;
+    size_t message_len;
+    size_t trace_depth;
+    void* const* traces;
+  };
+
+  // The most messages a single drain moves from the queue to the columns,
+  // which is sixteen of the queue's batches. A drain that reaches this posts
+  // another drain rather than carrying on, so that a flood of messages
+  // can't keep the store's thread from its other work.
+  static const int kMaxRowsPerDrain = 16 * 1024;
+
+  LogStore();
+  ~LogStore();
+
+  // Queues @p message for appending to the store, and schedules the queue
+  // to be drained on the store's thread. This may be called from any
+  // thread, but only from one thread at a time.
+  void Append(const Message& message);
+
+  // Returns the number of bytes used to hold the messages.
+  size_t GetMemoryUsage();
+
+  // ILogView implementation.
+  // @{
+  virtual int GetNumRows();
+  virtual void ClearAll();
+  virtual int GetSeverity(int row);
+  virtual DWORD GetProcessId(int row);
+  virtual DWORD GetThreadId(int row);
+  virtual base::Time GetTime(int row);
+  virtual std::string GetFileName(int row);
+  virtual int GetLine(int row);
+  virtual std::string GetMessage(int row);
+  virtual void GetStackTrace(int row, std::vector<void*>* trace);
+  virtual void Register(ILogViewEvents* event_sink,
+                        int* registration_cookie);
+  virtual void Unregister(int registration_cookie);
+  // @}
+
+ private:
+  // Where a message's text lives in the arena.
+  struct TextRef {
+    const char* data;
+    uint32 length;
+  };
+
+  // Assigns indices to distinct strings. Index 0 is the empty string.
+  // Like the columns, a table has a single writer, but may be read from
+  // other threads.
+  class InternTable {
+   public:
+    InternTable();
+
+    uint32 Intern(const char* data, size_t length);
+    const std::string& Get(uint32 index) const {
+      return *strings_[index];
+    }
+
+    size_t size() const { return strings_.size(); }
+    size_t GetMemoryUsage() const;
+    void clear();
+
+   private:
+    typedef base::hash_map<std::string, uint32> IndexMap;
+    IndexMap indices_;
+    // Points to the keys of indices_, in order of index.
+    LogStoreColumn<const std::string*> strings_;
+    size_t bytes_;
+
+    DISALLOW_COPY_AND_ASSIGN(InternTable);
+  };
+
+  // Appends @p message to the columns. Store's thread only.
+  void AppendRow(const Message& message);
+
+  // Copies @p length bytes of @p data into the text arena.
+  // Store's thread only.
+  const char* AllocateText(const char* data, size_t length);
+
+  // Frees all the message data. Store's thread only.
+  void ClearRows();
+
+  // Schedule the queue to be drained on the store's thread.
+  void ScheduleDrainQueue();
+
+  // Called on the store's thread to move up to kMaxRowsPerDrain queued
+  // messages to the columns, and to notify listeners of them.
+  void DrainQueue();
+
+  void NotifyNewItems();
+  void NotifyCleared();
+
+  // Carries messages from the producer to the store's thread.
+  scoped_ptr<LogIngestionQueue> queue_;
+
+  // Non-zero while a drain of the queue is pending.
+  volatile base::subtle::Atomic32 drain_pending_;
+
+  // Protects drain_task_, which is set by the producer and cancelled on
+  // destruction. This is only taken once per drain.
+  base::Lock drain_task_lock_;
+  // Keeps the task pending to drain the queue, if any.
+  // Under drain_task_lock_.
+  CancelableTask* drain_task_;
+
+  // The number of rows published to readers.
+  volatile base::subtle::Atomic32 committed_rows_;
+
+  // The columns, one value per row. Store's thread only, bar reads of
+  // published rows.
+  LogStoreColumn<uint8> levels_;
+  LogStoreColumn<DWORD> process_ids_;
+  LogStoreColumn<DWORD> thread_ids_;
+  LogStoreColumn<int64> times_;
+  LogStoreColumn<uint32> files_;
+  LogStoreColumn<int> lines_;
+  LogStoreColumn<TextRef> messages_;
+  LogStoreColumn<uint32> traces_;
+
+  // The interned file names.
+  InternTable file_names_;
+  // The interned stack traces, each stored as the raw bytes of its
+  // addresses.
+  InternTable stack_traces_;
+
+  // The blocks the message text is allocated from. Store's thread only.
+  std::vector<char*> text_blocks_;
+  // The unused part of the last block. Store's thread only.
+  char* text_next_;
+  size_t text_remaining_;
+  // The total size of the text blocks. Store's thread only.
+  size_t text_bytes_;
+
+  // The message loop we're instantiated on, where the queue is drained and
+  // notifications are issued.
+  MessageLoop* loop_;
+
+  typedef std::map<int, ILogViewEvents*> EventSinkMap;
+  EventSinkMap event_sinks_;
+  int next_sink_cookie_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogStore);
+};
+
+#endif  // SAWBUCK_VIEWER_LOG_STORE_H_
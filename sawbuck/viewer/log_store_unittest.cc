@@ -0,0 +1,412 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Log store unittests.
+#include "sawbuck/viewer/log_store.h"
+
+#include "base/atomicops.h"
+#include "base/message_loop.h"
+#include "base/stringprintf.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "sawbuck/viewer/mock_log_view_interfaces.h"
+
+namespace {
+
+using testing::StrictMock;
+
+void AppendMessage(LogStore* store,
+                   const std::string& file,
+                   const std::string& message,
+                   size_t trace_depth,
+                   void* const* traces) {
+  LogStore::Message msg;
+  msg.level = 3;
+  msg.process_id = 1234;
+  msg.thread_id = 5678;
+  msg.time = base::Time::FromInternalValue(42);
+  msg.file = file.data();
+  msg.file_len = file.size();
+  msg.line = 17;
+  msg.message = message.data();
+  msg.message_len = message.size();
+  msg.trace_depth = trace_depth;
+  msg.traces = traces;
+  store->Append(msg);
+}
+
+// The files the stress test's messages come from.
+const char* const kStressFiles[] = {
+  "browser.cc", "renderer.cc", "plugin.cc"
+};
+
+// Appends numbered messages to a store as fast as it can.
+class StressProducer : public base::DelegateSimpleThread::Delegate {
+ public:
+  StressProducer(LogStore* store, int num_messages)
+      : store_(store), num_messages_(num_messages) {
+  }
+
+  virtual void Run() {
+    void* const traces[] = { reinterpret_cast<void*>(0x1000),
+                             reinterpret_cast<void*>(0x2000),
+                             reinterpret_cast<void*>(0x3000) };
+    std::string message;
+    for (int i = 0; i < num_messages_; ++i) {
+      LogStore::Message msg;
+      msg.level = i % 5;
+      msg.time = base::Time::FromInternalValue(i);
+      msg.file = kStressFiles[i % arraysize(kStressFiles)];
+      msg.file_len = strlen(msg.file);
+      message = StringPrintf("Message %d", i);
+      msg.message = message.data();
+      msg.message_len = message.size();
+      msg.trace_depth = i % arraysize(traces);
+      msg.traces = traces;
+      store_->Append(msg);
+    }
+  }
+
+ private:
+  LogStore* store_;
+  int num_messages_;
+};
+
+// Reads random published rows from a store until told to stop, checking
+// their contents and timing each read.
+class StressReader : public base::DelegateSimpleThread::Delegate {
+ public:
+  StressReader(LogStore* store, int seed)
+      : store_(store), seed_(seed), stop_(0), num_reads_(0), num_errors_(0) {
+  }
+
+  virtual void Run() {
+    uint32 random = seed_;
+    while (base::subtle::Acquire_Load(&stop_) == 0) {
+      int num_rows = store_->GetNumRows();
+      if (num_rows == 0)
+        continue;
+
+      random = random * 1103515245 + 12345;
+      int row = (random >> 8) % num_rows;
+
+      base::TimeTicks start = base::TimeTicks::HighResNow();
+      std::string message = store_->GetMessage(row);
+      std::string file = store_->GetFileName(row);
+      base::Time time = store_->GetTime(row);
+      base::TimeDelta latency = base::TimeTicks::HighResNow() - start;
+
+      if (message != StringPrintf("Message %d", row) ||
+          file != kStressFiles[row % arraysize(kStressFiles)] ||
+          time.ToInternalValue() != row) {
+        ++num_errors_;
+      }
+
+      ++num_reads_;
+      total_latency_ += latency;
+      if (max_latency_ < latency)
+        max_latency_ = latency;
+    }
+  }
+
+  void Stop() {
+    base::subtle::Release_Store(&stop_, 1);
+  }
+
+  int num_reads() const { return num_reads_; }
+  int num_errors() const { return num_errors_; }
+  base::TimeDelta total_latency() const { return total_latency_; }
+  base::TimeDelta max_latency() const { return max_latency_; }
+
+ private:
+  LogStore* store_;
+  int seed_;
+  volatile base::subtle::Atomic32 stop_;
+  int num_reads_;
+  int num_errors_;
+  base::TimeDelta total_latency_;
+  base::TimeDelta max_latency_;
+};
+
+class LogStoreTest: public testing::Test {
+ public:
+  // Appends @p num_messages messages to a store from one thread, while
+  // @p num_readers threads read published rows from it, and this thread
+  // drains the store's queue. Logs the ingest rate and the read latency.
+  void RunStressTest(int num_messages, int num_readers) {
+    LogStore store;
+    StressProducer producer(&store, num_messages);
+    base::DelegateSimpleThread producer_thread(&producer, "producer");
+
+    std::vector<StressReader*> readers;
+    std::vector<base::DelegateSimpleThread*> reader_threads;
+    for (int i = 0; i < num_readers; ++i) {
+      readers.push_back(new StressReader(&store, i + 1));
+      reader_threads.push_back(
+          new base::DelegateSimpleThread(readers.back(), "reader"));
+      reader_threads.back()->Start();
+    }
+
+    base::Time start = base::Time::Now();
+    producer_thread.Start();
+    while (store.GetNumRows() < num_messages)
+      message_loop_.RunAllPending();
+    base::TimeDelta elapsed = base::Time::Now() - start;
+    producer_thread.Join();
+
+    int num_reads = 0;
+    base::TimeDelta total_latency;
+    base::TimeDelta max_latency;
+    for (int i = 0; i < num_readers; ++i) {
+      readers[i]->Stop();
+      reader_threads[i]->Join();
+
+      EXPECT_EQ(0, readers[i]->num_errors());
+      num_reads += readers[i]->num_reads();
+      total_latency += readers[i]->total_latency();
+      if (max_latency < readers[i]->max_latency())
+        max_latency = readers[i]->max_latency();
+
+      delete reader_threads[i];
+      delete readers[i];
+    }
+
+    LOG(INFO) << "Ingested " << num_messages << " messages in "
+              << elapsed.InMilliseconds() << " ms, with " << num_readers
+              << " concurrent readers.";
+    if (num_reads != 0) {
+      LOG(INFO) << num_reads << " reads, mean latency "
+                << total_latency.InMicroseconds() / num_reads
+                << " us, max latency " << max_latency.InMicroseconds()
+                << " us.";
+    }
+  }
+
+ protected:
+  MessageLoop message_loop_;
+};
+
+TEST_F(LogStoreTest, Append) {
+  LogStore store;
+  EXPECT_EQ(0, store.GetNumRows());
+
+  void* const kTrace[] = { reinterpret_cast<void*>(0x1000),
+                           reinterpret_cast<void*>(0x2000) };
+  AppendMessage(&store, "file.cc", "A message", arraysize(kTrace), kTrace);
+  AppendMessage(&store, "", "", 0, NULL);
+
+  // Rows are published once the store's thread drains the queue.
+  EXPECT_EQ(0, store.GetNumRows());
+  message_loop_.RunAllPending();
+  ASSERT_EQ(2, store.GetNumRows());
+
+  EXPECT_EQ(3, store.GetSeverity(0));
+  EXPECT_EQ(1234, store.GetProcessId(0));
+  EXPECT_EQ(5678, store.GetThreadId(0));
+  EXPECT_EQ(42, store.GetTime(0).ToInternalValue());
+  EXPECT_EQ("file.cc", store.GetFileName(0));
+  EXPECT_EQ(17, store.GetLine(0));
+  EXPECT_EQ("A message", store.GetMessage(0));
+
+  std::vector<void*> trace;
+  store.GetStackTrace(0, &trace);
+  ASSERT_EQ(2U, trace.size());
+  EXPECT_EQ(kTrace[0], trace[0]);
+  EXPECT_EQ(kTrace[1], trace[1]);
+
+  EXPECT_EQ("", store.GetFileName(1));
+  EXPECT_EQ("", store.GetMessage(1));
+  store.GetStackTrace(1, &trace);
+  EXPECT_TRUE(trace.empty());
+}
+
+TEST_F(LogStoreTest, AppendManyMessages) {
+  LogStore store;
+
+  // Enough messages to span several column chunks and text blocks, with
+  // a few messages too large for a text block thrown in.
+  const int kNumMessages = 200000;
+  for (int i = 0; i < kNumMessages; ++i) {
+    std::string message = StringPrintf("Message %d", i);
+    if (i % 50000 == 0)
+      message.append(2 * 1024 * 1024, 'x');
+    void* trace = reinterpret_cast<void*>(i % 10);
+    AppendMessage(&store, StringPrintf("file%d.cc", i % 7), message,
+                  1, &trace);
+  }
+
+  message_loop_.RunAllPending();
+  ASSERT_EQ(kNumMessages, store.GetNumRows());
+  for (int i = 0; i < kNumMessages; i += 997) {
+    std::string message = store.GetMessage(i);
+    EXPECT_EQ(0U, message.find(StringPrintf("Message %d", i)));
+    EXPECT_EQ(StringPrintf("file%d.cc", i % 7), store.GetFileName(i));
+
+    std::vector<void*> trace;
+    store.GetStackTrace(i, &trace);
+    ASSERT_EQ(1U, trace.size());
+    EXPECT_EQ(reinterpret_cast<void*>(i % 10), trace[0]);
+  }
+}
+
+TEST_F(LogStoreTest, NewItemsNotification) {
+  LogStore store;
+
+  int cookie = 0;
+  StrictMock<testing::MockILogViewEvents> mock_event_sink;
+  store.Register(&mock_event_sink, &cookie);
+
+  // Appends are coalesced into a single notification.
+  AppendMessage(&store, "file.cc", "One", 0, NULL);
+  AppendMessage(&store, "file.cc", "Two", 0, NULL);
+  EXPECT_CALL(mock_event_sink, LogViewNewItems()).Times(1);
+  message_loop_.RunAllPending();
+
+  AppendMessage(&store, "file.cc", "Three", 0, NULL);
+  EXPECT_CALL(mock_event_sink, LogViewNewItems()).Times(1);
+  message_loop_.RunAllPending();
+
+  store.Unregister(cookie);
+}
+
+// Records the number of published rows at each new items notification.
+class RowCountRecorder : public ILogViewEvents {
+ public:
+  explicit RowCountRecorder(LogStore* store) : store_(store) {
+  }
+
+  virtual void LogViewNewItems() {
+    row_counts_.push_back(store_->GetNumRows());
+  }
+
+  virtual void LogViewCleared() {
+  }
+
+  const std::vector<int>& row_counts() const { return row_counts_; }
+
+ private:
+  LogStore* store_;
+  std::vector<int> row_counts_;
+};
+
+TEST_F(LogStoreTest, DrainsInSlices) {
+  LogStore store;
+
+  int cookie = 0;
+  RowCountRecorder recorder(&store);
+  store.Register(&recorder, &cookie);
+
+  // A backlog of messages is moved to the columns over several drains,
+  // each of which publishes what it moved.
+  const int kMaxRowsPerDrain = LogStore::kMaxRowsPerDrain;
+  const int kNumMessages = 3 * kMaxRowsPerDrain + 10;
+  for (int i = 0; i < kNumMessages; ++i)
+    AppendMessage(&store, "file.cc", StringPrintf("Message %d", i), 0, NULL);
+  message_loop_.RunAllPending();
+
+  const std::vector<int>& row_counts = recorder.row_counts();
+  ASSERT_EQ(4U, row_counts.size());
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ((i + 1) * kMaxRowsPerDrain, row_counts[i]);
+  EXPECT_EQ(kNumMessages, row_counts[3]);
+  EXPECT_EQ("Message 0", store.GetMessage(0));
+  EXPECT_EQ(StringPrintf("Message %d", kNumMessages - 1),
+            store.GetMessage(kNumMessages - 1));
+
+  store.Unregister(cookie);
+}
+
+TEST_F(LogStoreTest, ClearAll) {
+  LogStore store;
+  AppendMessage(&store, "file.cc", "A message", 0, NULL);
+  message_loop_.RunAllPending();
+  size_t memory_usage = store.GetMemoryUsage();
+
+  int cookie = 0;
+  StrictMock<testing::MockILogViewEvents> mock_event_sink;
+  store.Register(&mock_event_sink, &cookie);
+
+  EXPECT_CALL(mock_event_sink, LogViewCleared()).Times(1);
+  store.ClearAll();
+  EXPECT_EQ(0, store.GetNumRows());
+  EXPECT_GT(memory_usage, store.GetMemoryUsage());
+
+  // Messages still queued at the time of the clear are discarded.
+  AppendMessage(&store, "file.cc", "A queued message", 0, NULL);
+  EXPECT_CALL(mock_event_sink, LogViewCleared()).Times(1);
+  store.ClearAll();
+  message_loop_.RunAllPending();
+  EXPECT_EQ(0, store.GetNumRows());
+
+  // The store is usable after being cleared.
+  AppendMessage(&store, "other.cc", "Another message", 0, NULL);
+  EXPECT_CALL(mock_event_sink, LogViewNewItems()).Times(1);
+  message_loop_.RunAllPending();
+  ASSERT_EQ(1, store.GetNumRows());
+  EXPECT_EQ("other.cc", store.GetFileName(0));
+  EXPECT_EQ("Another message", store.GetMessage(0));
+
+  store.Unregister(cookie);
+}
+
+// Appends ten million messages resembling Chrome's logging from this
+// thread and drains them, then logs the time taken and the store's memory
+// overhead per message. Disabled by default; it needs about a gigabyte.
+TEST_F(LogStoreTest, DISABLED_IngestBenchmark) {
+  const int kNumMessages = 10000000;
+  const int kNumFiles = 500;
+  const int kNumTraces = 1000;
+
+  std::vector<std::string> files;
+  for (int i = 0; i < kNumFiles; ++i)
+    files.push_back(StringPrintf("src/chrome/browser/file%d.cc", i));
+
+  std::vector<void*> traces;
+  for (int i = 0; i < kNumTraces + 8; ++i)
+    traces.push_back(reinterpret_cast<void*>(0x10000 + i * 16));
+
+  LogStore store;
+  size_t text_bytes = 0;
+  base::Time start = base::Time::Now();
+  for (int i = 0; i < kNumMessages; ++i) {
+    std::string message = StringPrintf(
+        "Something happened to object 0x%08X, its state is now %d", i, i % 13);
+    text_bytes += message.size();
+    AppendMessage(&store, files[i % kNumFiles], message, 8,
+                  &traces[i % kNumTraces]);
+  }
+  message_loop_.RunAllPending();
+  base::TimeDelta elapsed = base::Time::Now() - start;
+
+  size_t memory_usage = store.GetMemoryUsage();
+  LOG(INFO) << "Ingested " << kNumMessages << " messages in "
+            << elapsed.InMilliseconds() << " ms.";
+  LOG(INFO) << "Memory usage " << memory_usage / 1024 << " KB, or "
+            << (memory_usage - text_bytes) / kNumMessages
+            << " bytes per message excluding the message text.";
+}
+
+TEST_F(LogStoreTest, Stress) {
+  RunStressTest(200000, 2);
+}
+
+// The stress test at full scale: ten million messages from a producer
+// running flat out, with four readers timing their fetches of published
+// rows. Too slow to run by default.
+TEST_F(LogStoreTest, DISABLED_StressBenchmark) {
+  RunStressTest(10000000, 4);
+}
+
+}  // namespace
@@ -18,6 +18,8 @@
 #include <atlbase.h>
 #include <atlframe.h>
 #include "base/string_util.h"
+#include "base/stringprintf.h"
+#include "base/sys_info.h"
 #include "base/utf_string_conversions.h"
 #include "pcrecpp.h"  // NOLINT
 #include "sawbuck/viewer/filtered_log_view.h"
@@ -29,7 +31,8 @@ LogViewer::LogViewer(CUpdateUIBase* update_ui)
     : log_list_view_(update_ui),
       stack_trace_list_view_(update_ui),
       log_view_(NULL),
-      update_ui_(update_ui) {
+      update_ui_(update_ui),
+      showing_filter_progress_(false) {
 }
 
 LogViewer::~LogViewer() {
@@ -64,6 +67,8 @@ int LogViewer::OnCreate(LPCREATESTRUCT create_struct) {
 
   // This is enabled so long as we live.
   update_ui_->UIEnable(ID_LOG_FILTER, true);
+  // And this while we're filtering.
+  update_ui_->UIEnable(ID_LOG_CANCEL_FILTER, false);
 
   // Read in any previously set filters.
   std::string filter_string;
@@ -71,12 +76,8 @@ int LogViewer::OnCreate(LPCREATESTRUCT create_struct) {
   prefs.ReadStringValue(config::kFilterValues, &filter_string, "");
   if (!filter_string.empty()) {
     std::vector<Filter> filters(Filter::DeserializeFilters(filter_string));
-    if (!filters.empty()) {
-      scoped_ptr<FilteredLogView> new_view(new FilteredLogView(log_view_,
-                                                               filters));
-      log_list_view_.SetLogView(new_view.get());
-      filtered_log_view_.reset(new_view.release());
-    }
+    if (!filters.empty())
+      SetFilters(filters);
   }
 
   SetMsgHandled(FALSE);
@@ -102,13 +103,53 @@ void LogViewer::OnLogFilter(UINT code, int id, CWindow window) {
 
     // TODO(robertshield): If dialog.get_filters() is empty, we should set it
     // back to the non filtered log view.
-    scoped_ptr<FilteredLogView> new_view(new FilteredLogView(log_view_,
-                                                             filters));
-    log_list_view_.SetLogView(new_view.get());
-    filtered_log_view_.reset(new_view.release());
+    SetFilters(filters);
   }
 }
 
+void LogViewer::OnCancelFilter(UINT code, int id, CWindow window) {
+  if (filtered_log_view_ != NULL && filtered_log_view_->IsFiltering()) {
+    filtered_log_view_->CancelFiltering();
+    FilterProgress(0, 0);
+  }
+}
+
+void LogViewer::FilterProgress(int filtered_rows, int total_rows) {
+  bool filtering = filtered_log_view_ != NULL &&
+      filtered_log_view_->IsFiltering();
+  update_ui_->UIEnable(ID_LOG_CANCEL_FILTER, filtering);
+
+  if (filtering) {
+    int percent = static_cast<int>(100LL * filtered_rows / total_rows);
+    update_ui_->UISetText(0, StringPrintf(L"Filtering (%d%%)",
+                                          percent).c_str());
+    update_ui_->UIUpdateStatusBar();
+    showing_filter_progress_ = true;
+  } else if (showing_filter_progress_) {
+    update_ui_->UISetText(0, L"Ready");
+    update_ui_->UIUpdateStatusBar();
+    showing_filter_progress_ = false;
+  }
+}
+
+void LogViewer::SetFilters(const std::vector<Filter>& filters) {
+  // Reuse the filtered view we have, as it may be able to refine the rows
+  // it's filtered rather than start afresh.
+  if (filtered_log_view_ != NULL) {
+    filtered_log_view_->SetFilters(filters);
+    return;
+  }
+
+  scoped_ptr<FilteredLogView> new_view(new FilteredLogView(log_view_,
+                                                           filters));
+  // The log view we're handed is backed by a log store, which supports
+  // concurrent reads.
+  new_view->set_num_threads(base::SysInfo::NumberOfProcessors());
+  new_view->set_progress_sink(this);
+  log_list_view_.SetLogView(new_view.get());
+  filtered_log_view_.reset(new_view.release());
+}
+
 void LogViewer::OnIncludeColumn(UINT code, int id, CWindow window) {
   // TODO(siggi): write me.
 }
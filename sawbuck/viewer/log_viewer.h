@@ -23,6 +23,7 @@
 #include <atlsplit.h>
 #include <atlmisc.h>
 #include "base/scoped_ptr.h"
+#include "sawbuck/viewer/filtered_log_view.h"
 #include "sawbuck/viewer/log_list_view.h"
 #include "sawbuck/viewer/resource.h"
 #include "sawbuck/viewer/stack_trace_list_view.h"
@@ -31,12 +32,13 @@
 namespace WTL {
 class CUpdateUIBase;
 };
-class FilteredLogView;
 class IProcessInfoService;
 
 // The log viewer window plays host to a listview, taking care of handling
 // its notification requests etc.
-class LogViewer : public CSplitterWindowImpl<LogViewer, false> {
+class LogViewer
+    : public CSplitterWindowImpl<LogViewer, false>,
+      public IFilterProgressEvents {
  public:
   typedef CSplitterWindowImpl<LogViewer, false> Super;
 
@@ -45,6 +47,7 @@ class LogViewer : public CSplitterWindowImpl<LogViewer, false> {
     MSG_WM_CREATE(OnCreate)
     REFLECT_NOTIFICATIONS()
     COMMAND_ID_HANDLER_EX(ID_LOG_FILTER, OnLogFilter)
+    COMMAND_ID_HANDLER_EX(ID_LOG_CANCEL_FILTER, OnCancelFilter)
     COMMAND_ID_HANDLER_EX(ID_INCLUDE_COLUMN, OnIncludeColumn)
     COMMAND_ID_HANDLER_EX(ID_EXCLUDE_COLUMN, OnExcludeColumn)
     MESSAGE_HANDLER(WM_COMMAND, OnCommand)
@@ -64,16 +67,26 @@ class LogViewer : public CSplitterWindowImpl<LogViewer, false> {
     log_list_view_.set_process_info_service(process_info_service);
   }
 
+  // IFilterProgressEvents implementation.
+  virtual void FilterProgress(int filtered_rows, int total_rows);
+
  private:
   int OnCreate(LPCREATESTRUCT create_struct);
   LRESULT OnCommand(UINT msg, WPARAM wparam, LPARAM lparam, BOOL& handled);
   void OnLogFilter(UINT code, int id, CWindow window);
+  void OnCancelFilter(UINT code, int id, CWindow window);
   void OnIncludeColumn(UINT code, int id, CWindow window);
   void OnExcludeColumn(UINT code, int id, CWindow window);
 
+  // Sets the filters of our filtered view, creating it if need be.
+  void SetFilters(const std::vector<Filter>& filters);
+
   // Non-null iff filtering is enabled.
   scoped_ptr<FilteredLogView> filtered_log_view_;
 
+  // True while we're reporting filtering progress in the status bar.
+  bool showing_filter_progress_;
+
   // The original log view we're handed.
   ILogView* log_view_;
 
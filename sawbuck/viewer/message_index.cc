@@ -0,0 +1,541 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Message index implementation.
+#include "sawbuck/viewer/message_index.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string.h>
+#include "base/logging.h"
+#include "base/message_loop.h"
+#include "base/task.h"
+
+namespace {
+
+// We only keep one outstanding task and we cancel it on destruction,
+// so a noop retain is safe.
+template <>
+struct RunnableMethodTraits<MessageIndex> {
+  RunnableMethodTraits() {
+  }
+
+  ~RunnableMethodTraits() {
+  }
+
+  void RetainCallee(MessageIndex* index) {
+  }
+
+  void ReleaseCallee(MessageIndex* index) {
+  }
+};
+
+uint8 ToLowerASCII(uint8 c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+uint32 MakeTrigram(const uint8* text) {
+  return (ToLowerASCII(text[0]) << 16) | (ToLowerASCII(text[1]) << 8) |
+      ToLowerASCII(text[2]);
+}
+
+// Returns true iff @p expression has a counted repeat, such as "{2,3}", at
+// @p start, and if so returns the position of its closing brace in @p end.
+bool IsCountedRepeat(const std::string& expression, size_t start,
+                     size_t* end) {
+  DCHECK_EQ('{', expression[start]);
+  DCHECK(end != NULL);
+
+  size_t i = start + 1;
+  size_t num_digits = 0;
+  for (; i < expression.size() && isdigit(expression[i]); ++i)
+    ++num_digits;
+  if (num_digits == 0)
+    return false;
+
+  if (i < expression.size() && expression[i] == ',') {
+    ++i;
+    while (i < expression.size() && isdigit(expression[i]))
+      ++i;
+  }
+
+  if (i == expression.size() || expression[i] != '}')
+    return false;
+
+  *end = i;
+  return true;
+}
+
+// Ends the current literal run, keeping it if it's long enough to have
+// trigrams.
+void EndRun(std::string* run, std::vector<std::string>* runs) {
+  if (run->size() >= 3)
+    runs->push_back(*run);
+  run->clear();
+}
+
+// Accumulates matching rows into a bitmap, in order.
+class RowBitmapBuilder {
+ public:
+  explicit RowBitmapBuilder(RowBitmap* bitmap)
+      : bitmap_(bitmap), block_(0), words_(RowBitmap::kBlockWords) {
+    DCHECK(bitmap != NULL);
+    bitmap_->clear();
+  }
+
+  void Set(int row) {
+    while (static_cast<size_t>(row) >= (block_ + 1) * RowBitmap::kBlockRows)
+      FlushBlock(RowBitmap::kBlockRows);
+
+    size_t offset = row - block_ * RowBitmap::kBlockRows;
+    words_[offset / 32] |= 1U << (offset % 32);
+  }
+
+  // Completes the bitmap, which covers @p num_rows rows.
+  void Finish(int num_rows) {
+    size_t rows = num_rows;
+    while (rows > block_ * RowBitmap::kBlockRows) {
+      size_t block_rows = RowBitmap::kBlockRows;
+      FlushBlock(std::min(rows - block_ * block_rows, block_rows));
+    }
+  }
+
+ private:
+  void FlushBlock(size_t num_rows) {
+    bitmap_->SetBlock(block_++, &words_[0], num_rows);
+    std::fill(words_.begin(), words_.end(), 0);
+  }
+
+  RowBitmap* bitmap_;
+  size_t block_;
+  std::vector<uint32> words_;
+};
+
+}  // namespace
+
+MessageIndex::MessageIndex(ILogView* log_view, size_t max_memory)
+    : log_view_(log_view), registration_cookie_(0), max_memory_(max_memory),
+      posting_bytes_(0), indexed_rows_(0),
+      rows_per_block_(kInitialRowsPerBlock), task_(NULL) {
+  DCHECK(log_view_ != NULL);
+  Reset();
+  log_view_->Register(this, &registration_cookie_);
+  PostIndexingTask();
+}
+
+MessageIndex::~MessageIndex() {
+  // Make sure we're not pinged post-destruction.
+  if (task_ != NULL)
+    task_->Cancel();
+
+  log_view_->Unregister(registration_cookie_);
+}
+
+int MessageIndex::FindNext(const std::string& expression,
+                           bool match_case,
+                           int start,
+                           bool down) {
+  pcrecpp::RE_Options options(PCRE_UTF8);
+  options.set_caseless(!match_case);
+  pcrecpp::RE re(expression, options);
+
+  int num_rows = log_view_->GetNumRows();
+  int indexed_rows = std::min(indexed_rows_, num_rows);
+  int i = down ? start + 1 : std::min(start - 1, num_rows - 1);
+  if (i < 0)
+    i = 0;  // in case start == -1.
+
+  std::vector<uint32> trigrams;
+  GetRequiredTrigrams(expression, &trigrams);
+  if (trigrams.empty()) {
+    // There's no narrowing the search down.
+    indexed_rows = 0;
+  }
+
+  std::vector<uint32> blocks;
+  if (indexed_rows != 0)
+    GetCandidateBlocks(trigrams, &blocks);
+
+  if (down) {
+    // Search the candidate rows among those indexed first.
+    if (i < indexed_rows) {
+      std::vector<uint32>::const_iterator it =
+          std::lower_bound(blocks.begin(), blocks.end(),
+                           static_cast<uint32>(i / rows_per_block_));
+      for (; it != blocks.end(); ++it) {
+        int begin = std::max<int>(i, *it * rows_per_block_);
+        int end = std::min<int>((*it + 1) * rows_per_block_, indexed_rows);
+        for (int row = begin; row < end; ++row) {
+          if (RowMatches(re, row))
+            return row;
+        }
+      }
+      i = indexed_rows;
+    }
+
+    for (; i < num_rows; ++i) {
+      if (RowMatches(re, i))
+        return i;
+    }
+  } else {
+    // Search the rows yet to be indexed first.
+    for (; i >= indexed_rows; --i) {
+      if (RowMatches(re, i))
+        return i;
+    }
+
+    std::vector<uint32>::const_reverse_iterator it(
+        std::upper_bound(blocks.begin(), blocks.end(),
+                         static_cast<uint32>(i / rows_per_block_)));
+    for (; i >= 0 && it != blocks.rend(); ++it) {
+      int begin = *it * rows_per_block_;
+      int end = std::min<int>(i, (*it + 1) * rows_per_block_ - 1);
+      for (int row = end; row >= begin; --row) {
+        if (RowMatches(re, row))
+          return row;
+      }
+    }
+  }
+
+  return -1;
+}
+
+void MessageIndex::FindAll(const std::string& expression,
+                           bool match_case,
+                           RowBitmap* rows) {
+  DCHECK(rows != NULL);
+
+  pcrecpp::RE_Options options(PCRE_UTF8);
+  options.set_caseless(!match_case);
+  pcrecpp::RE re(expression, options);
+
+  int num_rows = log_view_->GetNumRows();
+  int indexed_rows = std::min(indexed_rows_, num_rows);
+  RowBitmapBuilder builder(rows);
+
+  std::vector<uint32> trigrams;
+  GetRequiredTrigrams(expression, &trigrams);
+  int row = 0;
+  if (!trigrams.empty() && indexed_rows != 0) {
+    std::vector<uint32> blocks;
+    GetCandidateBlocks(trigrams, &blocks);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      int begin = blocks[i] * rows_per_block_;
+      int end = std::min<int>(begin + rows_per_block_, indexed_rows);
+      for (row = begin; row < end; ++row) {
+        if (RowMatches(re, row))
+          builder.Set(row);
+      }
+    }
+    row = indexed_rows;
+  }
+
+  for (; row < num_rows; ++row) {
+    if (RowMatches(re, row))
+      builder.Set(row);
+  }
+
+  builder.Finish(num_rows);
+}
+
+void MessageIndex::GetRequiredTrigrams(const std::string& expression,
+                                       std::vector<uint32>* trigrams) {
+  DCHECK(trigrams != NULL);
+  trigrams->clear();
+
+  // Collect the runs of literal characters outside of any group, which any
+  // match must contain.
+  std::vector<std::string> runs;
+  std::string run;
+  int depth = 0;
+  for (size_t i = 0; i < expression.size(); ++i) {
+    uint8 c = expression[i];
+    switch (c) {
+      case '|':
+        // Either side of an alternative may match, so nothing is required.
+        return;
+
+      case '(':
+        // Options, such as extended mode, may change the meaning of the
+        // rest of the expression.
+        if (i + 1 < expression.size() && expression[i + 1] == '?')
+          return;
+        ++depth;
+        EndRun(&run, &runs);
+        break;
+
+      case ')':
+        if (--depth < 0)
+          return;
+        EndRun(&run, &runs);
+        break;
+
+      case '[': {
+        // Skip the character class.
+        size_t j = i + 1;
+        if (j < expression.size() && expression[j] == '^')
+          ++j;
+        if (j < expression.size() && expression[j] == ']')
+          ++j;
+        for (; j < expression.size() && expression[j] != ']'; ++j) {
+          // POSIX classes such as [:alpha:] hold a ']' of their own. Rather
+          // than parse them, we give up on any class holding a '['.
+          if (expression[j] == '[')
+            return;
+          if (expression[j] == '\\')
+            ++j;
+        }
+        if (j >= expression.size())
+          return;
+        i = j;
+        EndRun(&run, &runs);
+        break;
+      }
+
+      case '{': {
+        size_t end = 0;
+        if (!IsCountedRepeat(expression, i, &end)) {
+          // A lone brace is literal, but we don't count on it.
+          EndRun(&run, &runs);
+          break;
+        }
+        i = end;
+      }
+      // Fall through, the repeat may be zero.
+      case '?':
+      case '*':
+        // The preceding character is optional.
+        if (!run.empty())
+          run.erase(run.size() - 1);
+        EndRun(&run, &runs);
+        break;
+
+      case '+':
+        // The preceding character may repeat.
+        EndRun(&run, &runs);
+        break;
+
+      case '.':
+      case '^':
+      case '$':
+        EndRun(&run, &runs);
+        break;
+
+      case '\\':
+        if (++i == expression.size())
+          return;
+        c = expression[i];
+        // Some escapes take arguments, such as the digits of a character
+        // code or the name of a property, which would otherwise read as
+        // literals. Rather than parse each form, we give up on them.
+        if (isdigit(c) || strchr("xpPcgkQNo", c) != NULL)
+          return;
+        // Other escaped letters are classes, anchors and the like. Anything
+        // else stands for itself.
+        if (isalpha(c)) {
+          EndRun(&run, &runs);
+          break;
+        }
+        // Fall through.
+
+      default:
+        // Non-ASCII characters span several bytes, and have case variants
+        // we don't fold, so we don't count on them.
+        if ((c & 0x80) != 0 || depth != 0)
+          EndRun(&run, &runs);
+        else
+          run.push_back(c);
+        break;
+    }
+  }
+  EndRun(&run, &runs);
+
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const uint8* text = reinterpret_cast<const uint8*>(runs[i].data());
+    for (size_t j = 0; j + 3 <= runs[i].size(); ++j)
+      trigrams->push_back(MakeTrigram(text + j));
+  }
+
+  std::sort(trigrams->begin(), trigrams->end());
+  trigrams->erase(std::unique(trigrams->begin(), trigrams->end()),
+                  trigrams->end());
+}
+
+size_t MessageIndex::GetMemoryUsage() const {
+  size_t usage = buckets_.capacity() * sizeof(buckets_[0]);
+  for (size_t i = 0; i < buckets_.size(); ++i)
+    usage += buckets_[i].deltas.capacity();
+  return usage;
+}
+
+void MessageIndex::LogViewNewItems() {
+  PostIndexingTask();
+}
+
+void MessageIndex::LogViewCleared() {
+  Reset();
+  PostIndexingTask();
+}
+
+void MessageIndex::PostIndexingTask() {
+  if (!task_) {
+    task_ = NewRunnableMethod(this, &MessageIndex::IndexChunk);
+    DCHECK(task_ != NULL);
+    MessageLoop::current()->PostTask(FROM_HERE, task_);
+  }
+}
+
+void MessageIndex::IndexChunk() {
+  task_ = NULL;
+
+  int num_rows = log_view_->GetNumRows();
+  if (num_rows < indexed_rows_) {
+    // The rows changed under us.
+    Reset();
+  }
+
+  int end = std::min(num_rows, indexed_rows_ + kRowsPerStep);
+  for (; indexed_rows_ < end; ++indexed_rows_)
+    IndexRow(indexed_rows_);
+
+  // Post again if we're not done.
+  if (indexed_rows_ != num_rows)
+    PostIndexingTask();
+}
+
+void MessageIndex::IndexRow(int row) {
+  std::string message(log_view_->GetMessage(row));
+  const uint8* text = reinterpret_cast<const uint8*>(message.data());
+  uint32 block = row / rows_per_block_;
+  for (size_t i = 0; i + 3 <= message.size(); ++i)
+    AddBlock(block, &buckets_[GetBucket(MakeTrigram(text + i))]);
+
+  while (posting_bytes_ > max_memory_ && rows_per_block_ < kMaxRowsPerBlock)
+    Coarsen();
+}
+
+void MessageIndex::Reset() {
+  buckets_.clear();
+  buckets_.resize(kNumBuckets);
+  posting_bytes_ = 0;
+  indexed_rows_ = 0;
+  rows_per_block_ = kInitialRowsPerBlock;
+}
+
+void MessageIndex::AddBlock(uint32 block, Postings* postings) {
+  DCHECK(postings != NULL);
+
+  if (postings->num_blocks != 0 && postings->last_block == block)
+    return;
+
+  DCHECK(postings->num_blocks == 0 || postings->last_block < block);
+  // Account for what the deltas allocate, rather than what they use.
+  size_t capacity = postings->deltas.capacity();
+  uint32 delta = block - postings->last_block;
+  do {
+    uint8 byte = delta & 0x7F;
+    delta >>= 7;
+    if (delta != 0)
+      byte |= 0x80;
+    postings->deltas.push_back(byte);
+  } while (delta != 0);
+  posting_bytes_ += postings->deltas.capacity() - capacity;
+
+  postings->last_block = block;
+  ++postings->num_blocks;
+}
+
+void MessageIndex::Coarsen() {
+  posting_bytes_ = 0;
+  std::vector<uint32> blocks;
+  for (size_t i = 0; i < buckets_.size(); ++i) {
+    DecodeBlocks(buckets_[i], &blocks);
+
+    Postings postings;
+    for (size_t j = 0; j < blocks.size(); ++j)
+      AddBlock(blocks[j] / 2, &postings);
+    buckets_[i].deltas.swap(postings.deltas);
+    buckets_[i].last_block = postings.last_block;
+    buckets_[i].num_blocks = postings.num_blocks;
+  }
+
+  rows_per_block_ *= 2;
+}
+
+void MessageIndex::GetCandidateBlocks(const std::vector<uint32>& trigrams,
+                                      std::vector<uint32>* blocks) const {
+  DCHECK(blocks != NULL);
+  blocks->clear();
+
+  // Start with the bucket that occurs in the fewest blocks.
+  std::vector<std::pair<uint32, size_t> > buckets;
+  for (size_t i = 0; i < trigrams.size(); ++i) {
+    size_t bucket = GetBucket(trigrams[i]);
+    buckets.push_back(std::make_pair(buckets_[bucket].num_blocks, bucket));
+  }
+  std::sort(buckets.begin(), buckets.end());
+  buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+
+  std::vector<uint32> bucket_blocks;
+  std::vector<uint32> intersection;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    const Postings& postings = buckets_[buckets[i].second];
+    if (i == 0) {
+      DecodeBlocks(postings, blocks);
+    } else {
+      DecodeBlocks(postings, &bucket_blocks);
+      intersection.clear();
+      std::set_intersection(blocks->begin(), blocks->end(),
+                            bucket_blocks.begin(), bucket_blocks.end(),
+                            std::back_inserter(intersection));
+      blocks->swap(intersection);
+    }
+
+    if (blocks->empty())
+      break;
+  }
+}
+
+void MessageIndex::DecodeBlocks(const Postings& postings,
+                                std::vector<uint32>* blocks) {
+  DCHECK(blocks != NULL);
+  blocks->clear();
+  blocks->reserve(postings.num_blocks);
+
+  uint32 block = 0;
+  uint32 delta = 0;
+  int shift = 0;
+  for (size_t i = 0; i < postings.deltas.size(); ++i) {
+    uint8 byte = postings.deltas[i];
+    delta |= (byte & 0x7F) << shift;
+    shift += 7;
+    if ((byte & 0x80) == 0) {
+      block += delta;
+      blocks->push_back(block);
+      delta = 0;
+      shift = 0;
+    }
+  }
+  DCHECK_EQ(postings.num_blocks, blocks->size());
+}
+
+size_t MessageIndex::GetBucket(uint32 trigram) {
+  // Spread the trigrams with Fibonacci hashing.
+  return ((trigram * 0x9E3779B1U) >> 16) & (kNumBuckets - 1);
+}
+
+bool MessageIndex::RowMatches(const pcrecpp::RE& expression, int row) {
+  std::string message(log_view_->GetMessage(row));
+  return expression.PartialMatch(message);
+}
@@ -0,0 +1,147 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Message index declaration.
+#ifndef SAWBUCK_VIEWER_MESSAGE_INDEX_H_
+#define SAWBUCK_VIEWER_MESSAGE_INDEX_H_
+
+#include <string>
+#include <vector>
+#include "base/basictypes.h"
+#include "pcrecpp.h"  // NOLINT
+#include "sawbuck/viewer/log_list_view.h"
+#include "sawbuck/viewer/row_bitmap.h"
+
+// Forward decl.
+class CancelableTask;
+
+// A trigram index over the messages of a log view, which narrows down the
+// rows a regular expression search needs to look at.
+//
+// The index records, for each trigram of lower-cased message text, the
+// blocks of rows it occurs in. A search extracts the trigrams any match of
+// its expression must contain, and only runs the expression on the rows of
+// the blocks that contain them all. Trigrams are hashed into a fixed number
+// of buckets, and when the index outgrows its memory budget, it doubles the
+// number of rows per block, so its size stays bounded no matter how many
+// rows it covers.
+//
+// The index is built in steps posted to the current message loop, and kept
+// up to date as rows are added to the log view. Rows that have yet to be
+// indexed are searched the slow way.
+class MessageIndex : public ILogViewEvents {
+ public:
+  // The default memory budget.
+  static const size_t kDefaultMaxMemory = 64 * 1024 * 1024;
+
+  // @param log_view the log view to index.
+  // @param max_memory the most memory the index's postings may use, in
+  //     bytes.
+  MessageIndex(ILogView* log_view, size_t max_memory);
+  ~MessageIndex();
+
+  // Finds the next row whose message matches @p expression.
+  // @param expression a UTF8 encoded regular expression.
+  // @param match_case true iff the search is case sensitive.
+  // @param start the row to start from, which is itself not searched, or -1
+  //     to start from the first row.
+  // @param down true to search towards the end of the log.
+  // @returns the matching row, or -1 if there is none.
+  int FindNext(const std::string& expression,
+               bool match_case,
+               int start,
+               bool down);
+
+  // Finds all the rows whose message matches @p expression.
+  // @param expression a UTF8 encoded regular expression.
+  // @param match_case true iff the search is case sensitive.
+  // @param rows returns the matching rows.
+  void FindAll(const std::string& expression,
+               bool match_case,
+               RowBitmap* rows);
+
+  // Returns the trigrams any match of @p expression must contain, or none
+  // if we can't tell. This errs on the side of returning fewer trigrams.
+  static void GetRequiredTrigrams(const std::string& expression,
+                                  std::vector<uint32>* trigrams);
+
+  // Returns the number of rows indexed so far.
+  int indexed_rows() const { return indexed_rows_; }
+  // Returns the number of rows per block.
+  int rows_per_block() const { return rows_per_block_; }
+  // Returns the number of bytes used by the index.
+  size_t GetMemoryUsage() const;
+
+  // ILogViewEvents implementation.
+  virtual void LogViewNewItems();
+  virtual void LogViewCleared();
+
+ protected:
+  // The number of rows we index per step.
+  static const int kRowsPerStep = 50000;
+  // The number of buckets trigrams are hashed into.
+  static const size_t kNumBuckets = 1 << 16;
+  // The number of rows per block we start out with, and the most we'll
+  // coarsen to.
+  static const int kInitialRowsPerBlock = 8;
+  static const int kMaxRowsPerBlock = 64 * 1024;
+
+  // The blocks a bucket of trigrams occur in, as variable length encoded
+  // increasing deltas.
+  struct Postings {
+    Postings() : last_block(0), num_blocks(0) {
+    }
+
+    std::vector<uint8> deltas;
+    uint32 last_block;
+    uint32 num_blocks;
+  };
+
+  void PostIndexingTask();
+  void IndexChunk();
+  void IndexRow(int row);
+  void Reset();
+
+  // Appends @p block to @p postings, unless it's already there.
+  void AddBlock(uint32 block, Postings* postings);
+  // Doubles the number of rows per block.
+  void Coarsen();
+
+  // Returns the blocks containing all of @p trigrams, in order.
+  void GetCandidateBlocks(const std::vector<uint32>& trigrams,
+                          std::vector<uint32>* blocks) const;
+  static void DecodeBlocks(const Postings& postings,
+                           std::vector<uint32>* blocks);
+  static size_t GetBucket(uint32 trigram);
+
+  // Returns true iff the message of @p row matches @p expression.
+  bool RowMatches(const pcrecpp::RE& expression, int row);
+
+  ILogView* log_view_;
+  int registration_cookie_;
+  size_t max_memory_;
+
+  std::vector<Postings> buckets_;
+  // The bytes allocated for posting deltas in |buckets_|.
+  size_t posting_bytes_;
+  int indexed_rows_;
+  int rows_per_block_;
+
+  // Non-NULL if there's a task pending to index additional rows.
+  CancelableTask* task_;
+
+  DISALLOW_COPY_AND_ASSIGN(MessageIndex);
+};
+
+#endif  // SAWBUCK_VIEWER_MESSAGE_INDEX_H_
@@ -0,0 +1,336 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Message index unittests.
+#include "sawbuck/viewer/message_index.h"
+
+#include "base/logging.h"
+#include "base/message_loop.h"
+#include "base/stringprintf.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// A log view whose messages are made up from their row numbers.
+class SyntheticLogView : public ILogView {
+ public:
+  SyntheticLogView() : num_rows_(0), event_sink_(NULL) {
+  }
+
+  void AddRows(int num_rows) {
+    num_rows_ += num_rows;
+    if (event_sink_ != NULL)
+      event_sink_->LogViewNewItems();
+  }
+
+  virtual int GetNumRows() { return num_rows_; }
+  virtual void ClearAll() {
+    num_rows_ = 0;
+    if (event_sink_ != NULL)
+      event_sink_->LogViewCleared();
+  }
+  virtual int GetSeverity(int row) { return 0; }
+  virtual DWORD GetProcessId(int row) { return 0; }
+  virtual DWORD GetThreadId(int row) { return 0; }
+  virtual base::Time GetTime(int row) { return base::Time(); }
+  virtual std::string GetFileName(int row) { return ""; }
+  virtual int GetLine(int row) { return 0; }
+  virtual std::string GetMessage(int row) { return MakeMessage(row); }
+  virtual void GetStackTrace(int row, std::vector<void*>* trace) {}
+  virtual void Register(ILogViewEvents* event_sink,
+                        int* registration_cookie) {
+    event_sink_ = event_sink;
+    *registration_cookie = 1;
+  }
+  virtual void Unregister(int registration_cookie) {
+    event_sink_ = NULL;
+  }
+
+  // Every so often, a row has a needle in it.
+  static const int kNeedleInterval = 499;
+
+  static std::string MakeMessage(int row) {
+    static const char* kWords[] = {
+      "Loading", "frame", "URL", "cache", "miss", "hit", "Timeout",
+      "error", "request", "response", "done", "Navigation", "tab",
+      "renderer", "plugin", "socket",
+    };
+
+    uint32 hash = row * 2654435761U;
+    std::string message(StringPrintf("%s %s %s %d",
+        kWords[hash % arraysize(kWords)],
+        kWords[(hash >> 8) % arraysize(kWords)],
+        kWords[(hash >> 16) % arraysize(kWords)],
+        row % 1000));
+    if (row % kNeedleInterval == 0)
+      message.append(StringPrintf(" Needle%d", row / kNeedleInterval));
+    return message;
+  }
+
+ private:
+  int num_rows_;
+  ILogViewEvents* event_sink_;
+};
+
+// Searches @p log_view the slow way.
+int LinearFindNext(ILogView* log_view,
+                   const std::string& expression,
+                   bool match_case,
+                   int start,
+                   bool down) {
+  pcrecpp::RE_Options options(PCRE_UTF8);
+  options.set_caseless(!match_case);
+  pcrecpp::RE re(expression, options);
+
+  int num_rows = log_view->GetNumRows();
+  int i = down ? start + 1 : std::min(start - 1, num_rows - 1);
+  if (i < 0)
+    i = 0;
+
+  for (; down ? i < num_rows : i >= 0; down ? ++i : --i) {
+    if (re.PartialMatch(log_view->GetMessage(i)))
+      return i;
+  }
+  return -1;
+}
+
+const char* kExpressions[] = {
+  "needle1",
+  "Needle12$",
+  "timeout error",
+  "TAB RENDERER",
+  "cache miss 99",
+  "frame (hit|miss)",
+  "^url.*done",
+  "Navigation ?tab",
+  "plugin{2}",
+  "socket\\s+hit",
+  "e.r.r",
+  "nothing like it",
+};
+
+class MessageIndexTest : public testing::Test {
+ public:
+  // Checks searches from a sample of rows against linear searches.
+  void CheckFindNext(MessageIndex* index) {
+    int num_rows = log_view_.GetNumRows();
+    for (size_t i = 0; i < arraysize(kExpressions); ++i) {
+      for (int start = -1; start < num_rows; start += 2999) {
+        for (int down = 0; down < 2; ++down) {
+          for (int match_case = 0; match_case < 2; ++match_case) {
+            ASSERT_EQ(LinearFindNext(&log_view_, kExpressions[i],
+                                     match_case != 0, start, down != 0),
+                      index->FindNext(kExpressions[i], match_case != 0,
+                                      start, down != 0))
+                << kExpressions[i] << " from " << start;
+          }
+        }
+      }
+    }
+  }
+
+  void CheckFindAll(MessageIndex* index) {
+    int num_rows = log_view_.GetNumRows();
+    for (size_t i = 0; i < arraysize(kExpressions); ++i) {
+      RowBitmap rows;
+      index->FindAll(kExpressions[i], false, &rows);
+      ASSERT_EQ(static_cast<size_t>(num_rows), rows.size());
+
+      pcrecpp::RE_Options options(PCRE_UTF8);
+      options.set_caseless(true);
+      pcrecpp::RE re(kExpressions[i], options);
+      for (int row = 0; row < num_rows; ++row) {
+        ASSERT_EQ(re.PartialMatch(log_view_.GetMessage(row)),
+                  rows.Get(row)) << kExpressions[i] << " at " << row;
+      }
+    }
+  }
+
+ protected:
+  MessageLoop message_loop_;
+  SyntheticLogView log_view_;
+};
+
+// Returns the trigrams of @p runs, which ends with NULL.
+std::vector<uint32> GetTrigrams(const char** runs) {
+  std::string text;
+  for (; *runs != NULL; ++runs) {
+    text.append(*runs);
+    // Separate the runs with a character we don't expect in them.
+    text.push_back('\x01');
+  }
+
+  std::vector<uint32> trigrams;
+  for (size_t i = 0; i + 3 <= text.size(); ++i) {
+    std::string trigram(text.substr(i, 3));
+    if (trigram.find('\x01') != std::string::npos)
+      continue;
+
+    // Trigrams are required of themselves, once escaped.
+    std::string expression;
+    for (size_t j = 0; j < trigram.size(); ++j) {
+      if (!isalnum(trigram[j]))
+        expression.push_back('\\');
+      expression.push_back(trigram[j]);
+    }
+    std::vector<uint32> required;
+    MessageIndex::GetRequiredTrigrams(expression, &required);
+    EXPECT_EQ(1U, required.size());
+    trigrams.insert(trigrams.end(), required.begin(), required.end());
+  }
+
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                 trigrams.end());
+  return trigrams;
+}
+
+}  // namespace
+
+TEST_F(MessageIndexTest, RequiredTrigrams) {
+  struct {
+    const char* expression;
+    const char* runs[4];
+  } kTestCases[] = {
+    { "abc", { "abc", NULL } },
+    { "ABC", { "abc", NULL } },
+    { "abcd", { "abcd", NULL } },
+    { "ab", { NULL } },
+    { "abc.def", { "abc", "def", NULL } },
+    { "abcd?efg", { "abc", "efg", NULL } },
+    { "abcd*efg", { "abc", "efg", NULL } },
+    { "abcd+efg", { "abcd", "efg", NULL } },
+    { "abcd{0,2}efg", { "abc", "efg", NULL } },
+    { "abc{efg", { "abc", "efg", NULL } },
+    { "abc(def)?ghi", { "abc", "ghi", NULL } },
+    { "abc[def]ghi", { "abc", "ghi", NULL } },
+    { "abc[]x]ghi", { "abc", "ghi", NULL } },
+    { "abc[[:alpha:]]def", { NULL } },
+    { "abc[x[]def", { NULL } },
+    { "^abc$", { "abc", NULL } },
+    { "ab\\.cd", { "ab.cd", NULL } },
+    { "abc\\dxyz", { "abc", "xyz", NULL } },
+    { "\\x41bc", { NULL } },
+    { "\\p{Lu}xy", { NULL } },
+    { "\\cAbc", { NULL } },
+    { "abc\\101de", { NULL } },
+    { "abc\\1xyz", { NULL } },
+    { "abc|def", { NULL } },
+    { "(?i)abc", { NULL } },
+    { "abc\xC3\xA9xyz", { "abc", "xyz", NULL } },
+  };
+
+  for (size_t i = 0; i < arraysize(kTestCases); ++i) {
+    std::vector<uint32> trigrams;
+    MessageIndex::GetRequiredTrigrams(kTestCases[i].expression, &trigrams);
+    EXPECT_TRUE(GetTrigrams(kTestCases[i].runs) == trigrams)
+        << kTestCases[i].expression;
+  }
+}
+
+TEST_F(MessageIndexTest, FindNext) {
+  MessageIndex index(&log_view_, MessageIndex::kDefaultMaxMemory);
+  log_view_.AddRows(12000);
+  message_loop_.RunAllPending();
+  EXPECT_EQ(12000, index.indexed_rows());
+  ASSERT_NO_FATAL_FAILURE(CheckFindNext(&index));
+
+  // New rows are searched before they're indexed.
+  log_view_.AddRows(3000);
+  EXPECT_EQ(12000, index.indexed_rows());
+  ASSERT_NO_FATAL_FAILURE(CheckFindNext(&index));
+
+  message_loop_.RunAllPending();
+  EXPECT_EQ(15000, index.indexed_rows());
+  ASSERT_NO_FATAL_FAILURE(CheckFindNext(&index));
+}
+
+TEST_F(MessageIndexTest, FindAll) {
+  MessageIndex index(&log_view_, MessageIndex::kDefaultMaxMemory);
+  log_view_.AddRows(RowBitmap::kBlockRows + 1000);
+  message_loop_.RunAllPending();
+  ASSERT_NO_FATAL_FAILURE(CheckFindAll(&index));
+
+  log_view_.AddRows(1000);
+  ASSERT_NO_FATAL_FAILURE(CheckFindAll(&index));
+}
+
+TEST_F(MessageIndexTest, StaysWithinBudget) {
+  const size_t kMaxMemory = 16 * 1024;
+  MessageIndex index(&log_view_, kMaxMemory);
+  MessageIndex unbounded(&log_view_, MessageIndex::kDefaultMaxMemory);
+  log_view_.AddRows(20000);
+  message_loop_.RunAllPending();
+
+  // The index coarsens its blocks to stay within its budget, which only
+  // leaves it with more rows to look at.
+  EXPECT_LT(unbounded.rows_per_block(), index.rows_per_block());
+  EXPECT_GT(unbounded.GetMemoryUsage(), index.GetMemoryUsage());
+  ASSERT_NO_FATAL_FAILURE(CheckFindNext(&index));
+}
+
+TEST_F(MessageIndexTest, Cleared) {
+  MessageIndex index(&log_view_, MessageIndex::kDefaultMaxMemory);
+  log_view_.AddRows(10000);
+  message_loop_.RunAllPending();
+  EXPECT_EQ(10000, index.indexed_rows());
+
+  log_view_.ClearAll();
+  EXPECT_EQ(0, index.indexed_rows());
+  EXPECT_EQ(-1, index.FindNext("needle1", false, -1, true));
+
+  log_view_.AddRows(10000);
+  message_loop_.RunAllPending();
+  EXPECT_EQ(10000, index.indexed_rows());
+  ASSERT_NO_FATAL_FAILURE(CheckFindNext(&index));
+}
+
+// Indexes five million rows, then times a handful of literal, anchored and
+// alternating searches through the index and through a linear scan of the
+// log. Disabled by default, as building the index alone takes a while.
+TEST_F(MessageIndexTest, DISABLED_Benchmark) {
+  const int kNumRows = 5000000;
+  MessageIndex index(&log_view_, MessageIndex::kDefaultMaxMemory);
+  log_view_.AddRows(kNumRows);
+
+  base::TimeTicks start = base::TimeTicks::HighResNow();
+  message_loop_.RunAllPending();
+  base::TimeDelta build_time = base::TimeTicks::HighResNow() - start;
+  LOG(INFO) << "Indexed " << kNumRows << " rows in "
+            << build_time.InMilliseconds() << " ms, using "
+            << index.GetMemoryUsage() / 1024 << " KB with "
+            << index.rows_per_block() << " rows per block.";
+
+  const char* kQueries[] = {
+    "needle999",
+    "Needle123$",
+    "timeout socket plugin 42",
+    "frame (hit|miss)",
+    "no such message",
+  };
+  for (size_t i = 0; i < arraysize(kQueries); ++i) {
+    start = base::TimeTicks::HighResNow();
+    int row = index.FindNext(kQueries[i], false, -1, true);
+    base::TimeDelta query_time = base::TimeTicks::HighResNow() - start;
+
+    start = base::TimeTicks::HighResNow();
+    EXPECT_EQ(LinearFindNext(&log_view_, kQueries[i], false, -1, true), row);
+    base::TimeDelta linear_time = base::TimeTicks::HighResNow() - start;
+
+    LOG(INFO) << "Found \"" << kQueries[i] << "\" at row " << row << " in "
+              << query_time.InMilliseconds() << " ms indexed, and "
+              << linear_time.InMilliseconds() << " ms linearly.";
+  }
+}
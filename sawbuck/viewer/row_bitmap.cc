@@ -0,0 +1,245 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Row bitmap implementation.
+#include "sawbuck/viewer/row_bitmap.h"
+
+#include <algorithm>
+#include "base/logging.h"
+
+namespace {
+
+// Blocks with fewer set rows than this are stored as a list of the rows,
+// which is then no bigger than a plain bitmap.
+const size_t kMaxSparseRows =
+    RowBitmap::kBlockWords * sizeof(uint32) / sizeof(uint16);
+
+uint32 CountBits(uint32 word) {
+  word = word - ((word >> 1) & 0x55555555);
+  word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+  return (((word + (word >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// Returns the position of the @p n th set bit of @p word.
+size_t SelectBit(uint32 word, size_t n) {
+  DCHECK_LT(n, CountBits(word));
+  for (; n != 0; --n)
+    word &= word - 1;
+
+  size_t bit = 0;
+  while ((word & 1) == 0) {
+    word >>= 1;
+    ++bit;
+  }
+  return bit;
+}
+
+}  // namespace
+
+RowBitmap::RowBitmap() : size_(0) {
+}
+
+RowBitmap::~RowBitmap() {
+  clear();
+}
+
+void RowBitmap::SetBlock(size_t index, const uint32* words,
+                         size_t num_rows) {
+  DCHECK(words != NULL);
+  DCHECK_LE(index, blocks_.size());
+  DCHECK_LE(num_rows, kBlockRows);
+  DCHECK(num_rows == kBlockRows || index + 1 >= blocks_.size());
+
+  if (index == blocks_.size()) {
+    DCHECK(index == 0 || blocks_[index - 1]->num_rows == kBlockRows);
+    counts_.push_back(count());
+    blocks_.push_back(new Block);
+  }
+
+  Block* block = blocks_[index];
+  size_ += num_rows;
+  size_ -= block->num_rows;
+  block->num_rows = num_rows;
+
+  block->count = 0;
+  for (size_t i = 0; i < kBlockWords; ++i)
+    block->count += CountBits(words[i]);
+
+  std::vector<uint16>().swap(block->rows);
+  std::vector<uint32>().swap(block->words);
+  std::vector<uint16>().swap(block->group_counts);
+
+  if (block->count == 0) {
+    block->encoding = NONE_SET;
+  } else if (block->count == num_rows) {
+    block->encoding = ALL_SET;
+  } else if (block->count < kMaxSparseRows) {
+    block->encoding = SPARSE;
+    block->rows.reserve(block->count);
+    for (size_t i = 0; i < kBlockWords; ++i) {
+      for (uint32 word = words[i]; word != 0; word &= word - 1) {
+        size_t row = i * 32 + SelectBit(word, 0);
+        block->rows.push_back(static_cast<uint16>(row));
+      }
+    }
+  } else {
+    block->encoding = DENSE;
+    block->words.assign(words, words + kBlockWords);
+    block->group_counts.resize(kNumGroups);
+    uint32 count = 0;
+    for (size_t i = 0; i < kBlockWords; ++i) {
+      if (i % kGroupWords == 0)
+        block->group_counts[i / kGroupWords] = count;
+      count += CountBits(words[i]);
+    }
+  }
+
+  // Update the counts of the following blocks.
+  for (size_t i = index + 1; i < blocks_.size(); ++i)
+    counts_[i] = counts_[i - 1] + blocks_[i - 1]->count;
+}
+
+void RowBitmap::GetBlock(size_t index, uint32* words) const {
+  DCHECK_LT(index, blocks_.size());
+  DCHECK(words != NULL);
+
+  const Block* block = blocks_[index];
+  switch (block->encoding) {
+    case NONE_SET:
+      memset(words, 0, kBlockWords * sizeof(words[0]));
+      break;
+
+    case ALL_SET: {
+      size_t full_words = block->num_rows / 32;
+      memset(words, 0xFF, full_words * sizeof(words[0]));
+      memset(words + full_words, 0,
+             (kBlockWords - full_words) * sizeof(words[0]));
+      if (block->num_rows % 32 != 0)
+        words[full_words] = (1U << (block->num_rows % 32)) - 1;
+      break;
+    }
+
+    case SPARSE:
+      memset(words, 0, kBlockWords * sizeof(words[0]));
+      for (size_t i = 0; i < block->rows.size(); ++i)
+        words[block->rows[i] / 32] |= 1U << (block->rows[i] % 32);
+      break;
+
+    case DENSE:
+      std::copy(block->words.begin(), block->words.end(), words);
+      break;
+
+    default:
+      NOTREACHED();
+  }
+}
+
+bool RowBitmap::Get(size_t row) const {
+  DCHECK_LT(row, size_);
+
+  const Block* block = blocks_[row >> kBlockShift];
+  uint16 offset = static_cast<uint16>(row & (kBlockRows - 1));
+  switch (block->encoding) {
+    case NONE_SET:
+      return false;
+
+    case ALL_SET:
+      return true;
+
+    case SPARSE:
+      return std::binary_search(block->rows.begin(), block->rows.end(),
+                                offset);
+
+    case DENSE:
+      return (block->words[offset / 32] & (1U << (offset % 32))) != 0;
+
+    default:
+      NOTREACHED();
+      return false;
+  }
+}
+
+size_t RowBitmap::Select(size_t n) const {
+  DCHECK_LT(n, count());
+
+  size_t index = FindBlock(n);
+  const Block* block = blocks_[index];
+  size_t block_start = index << kBlockShift;
+  n -= counts_[index];
+
+  switch (block->encoding) {
+    case ALL_SET:
+      return block_start + n;
+
+    case SPARSE:
+      return block_start + block->rows[n];
+
+    case DENSE: {
+      // Find the group, then the word, then the bit.
+      size_t group = std::upper_bound(block->group_counts.begin(),
+                                      block->group_counts.end(), n) -
+          block->group_counts.begin() - 1;
+      n -= block->group_counts[group];
+
+      size_t word = group * kGroupWords;
+      for (; ; ++word) {
+        size_t bits = CountBits(block->words[word]);
+        if (n < bits)
+          break;
+        n -= bits;
+      }
+
+      return block_start + word * 32 + SelectBit(block->words[word], n);
+    }
+
+    default:
+      NOTREACHED();
+      return 0;
+  }
+}
+
+size_t RowBitmap::GetMemoryUsage() const {
+  size_t usage = blocks_.size() * (sizeof(Block) + sizeof(Block*)) +
+      counts_.size() * sizeof(size_t);
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    usage += blocks_[i]->rows.size() * sizeof(uint16) +
+        blocks_[i]->words.size() * sizeof(uint32) +
+        blocks_[i]->group_counts.size() * sizeof(uint16);
+  }
+  return usage;
+}
+
+void RowBitmap::clear() {
+  for (size_t i = 0; i < blocks_.size(); ++i)
+    delete blocks_[i];
+  blocks_.clear();
+  counts_.clear();
+  size_ = 0;
+}
+
+void RowBitmap::swap(RowBitmap& other) {
+  blocks_.swap(other.blocks_);
+  counts_.swap(other.counts_);
+  std::swap(size_, other.size_);
+}
+
+size_t RowBitmap::FindBlock(size_t n) const {
+  // Find the last block preceded by at most n set rows. Empty blocks are
+  // preceded by as many set rows as the block after them, so this skips
+  // them.
+  size_t index = std::upper_bound(counts_.begin(), counts_.end(), n) -
+      counts_.begin() - 1;
+  DCHECK_LT(n - counts_[index], blocks_[index]->count);
+  return index;
+}
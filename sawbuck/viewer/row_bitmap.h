@@ -0,0 +1,117 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Row bitmap declaration.
+#ifndef SAWBUCK_VIEWER_ROW_BITMAP_H_
+#define SAWBUCK_VIEWER_ROW_BITMAP_H_
+
+#include <vector>
+#include "base/basictypes.h"
+
+// A compressed bitmap over the rows of a log, used to keep track of the rows
+// that pass a filter. The rows are divided into blocks, and each block is
+// stored in whichever form is smallest: nothing at all if none or all of its
+// rows are set, a sorted list of the set rows if few are, or a plain bitmap
+// otherwise. Blocks are read and written whole, as plain bitmaps, so that
+// they may be computed independently of one another.
+class RowBitmap {
+ public:
+  // Each block covers 2^kBlockShift rows.
+  static const size_t kBlockShift = 16;
+  static const size_t kBlockRows = 1 << kBlockShift;
+  // The number of words in a plain bitmap of a block.
+  static const size_t kBlockWords = kBlockRows / 32;
+
+  RowBitmap();
+  ~RowBitmap();
+
+  // Sets the contents of a block.
+  // @param index the block to set. This may be num_blocks(), in which case
+  //     the block is appended.
+  // @param words the bits of the block, in kBlockWords words. Row i of the
+  //     block is bit (i % 32) of word (i / 32). Bits past @p num_rows must be
+  //     clear.
+  // @param num_rows the number of rows in the block. Only the last block may
+  //     have fewer than kBlockRows rows.
+  void SetBlock(size_t index, const uint32* words, size_t num_rows);
+
+  // Expands the block at @p index into @p words, which must have room for
+  // kBlockWords words.
+  void GetBlock(size_t index, uint32* words) const;
+
+  // Returns true iff @p row is set.
+  bool Get(size_t row) const;
+
+  // Returns the @p n th set row. @p n must be less than count().
+  size_t Select(size_t n) const;
+
+  // Returns the number of rows.
+  size_t size() const { return size_; }
+  // Returns the number of set rows.
+  size_t count() const {
+    return blocks_.empty() ? 0 : counts_.back() + blocks_.back()->count;
+  }
+  size_t num_blocks() const { return blocks_.size(); }
+
+  // Returns the number of bytes used by the bitmap.
+  size_t GetMemoryUsage() const;
+
+  void clear();
+  void swap(RowBitmap& other);
+
+ private:
+  enum Encoding {
+    NONE_SET,
+    ALL_SET,
+    // The block holds the sorted list of its set rows.
+    SPARSE,
+    // The block holds a plain bitmap.
+    DENSE
+  };
+
+  // A plain bitmap is divided into groups of this many words, and we keep
+  // the number of set bits preceding each group, so as not to have to count
+  // them all on Select.
+  static const size_t kGroupWords = 16;
+  static const size_t kNumGroups = kBlockWords / kGroupWords;
+
+  struct Block {
+    Block() : encoding(NONE_SET), num_rows(0), count(0) {
+    }
+
+    Encoding encoding;
+    uint32 num_rows;
+    uint32 count;
+    // The set rows, relative to the start of the block. SPARSE only.
+    std::vector<uint16> rows;
+    // The bitmap, and the number of set bits preceding each group of
+    // words. DENSE only.
+    std::vector<uint32> words;
+    std::vector<uint16> group_counts;
+  };
+
+  // Returns the index of the block containing the @p n th set row.
+  size_t FindBlock(size_t n) const;
+
+  // The blocks, in order. Owned.
+  std::vector<Block*> blocks_;
+  // The number of set rows preceding each block.
+  std::vector<size_t> counts_;
+  // The number of rows.
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(RowBitmap);
+};
+
+#endif  // SAWBUCK_VIEWER_ROW_BITMAP_H_
@@ -0,0 +1,158 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Row bitmap unittests.
+#include "sawbuck/viewer/row_bitmap.h"
+
+#include <algorithm>
+#include "gtest/gtest.h"
+
+namespace {
+
+class RowBitmapTest : public testing::Test {
+ public:
+  RowBitmapTest() : words_(RowBitmap::kBlockWords) {
+  }
+
+  void ClearWords() {
+    std::fill(words_.begin(), words_.end(), 0);
+  }
+
+  void SetRow(size_t row) {
+    words_[row / 32] |= 1U << (row % 32);
+  }
+
+  // Checks @p bitmap against the rows in @p expected, which are sorted.
+  void CheckBitmap(const RowBitmap& bitmap,
+                   size_t num_rows,
+                   const std::vector<size_t>& expected) {
+    ASSERT_EQ(num_rows, bitmap.size());
+    ASSERT_EQ(expected.size(), bitmap.count());
+
+    for (size_t i = 0; i < expected.size(); ++i)
+      ASSERT_EQ(expected[i], bitmap.Select(i));
+
+    std::vector<size_t>::const_iterator it = expected.begin();
+    for (size_t row = 0; row < num_rows; ++row) {
+      bool is_set = it != expected.end() && *it == row;
+      ASSERT_EQ(is_set, bitmap.Get(row));
+      if (is_set)
+        ++it;
+    }
+  }
+
+ protected:
+  std::vector<uint32> words_;
+};
+
+}  // namespace
+
+TEST_F(RowBitmapTest, Empty) {
+  RowBitmap bitmap;
+  EXPECT_EQ(0U, bitmap.size());
+  EXPECT_EQ(0U, bitmap.count());
+  EXPECT_EQ(0U, bitmap.num_blocks());
+}
+
+TEST_F(RowBitmapTest, Encodings) {
+  RowBitmap bitmap;
+  std::vector<size_t> expected;
+
+  // An empty block.
+  ClearWords();
+  bitmap.SetBlock(0, &words_[0], RowBitmap::kBlockRows);
+
+  // A full block.
+  ClearWords();
+  for (size_t i = 0; i < RowBitmap::kBlockRows; ++i) {
+    SetRow(i);
+    expected.push_back(RowBitmap::kBlockRows + i);
+  }
+  bitmap.SetBlock(1, &words_[0], RowBitmap::kBlockRows);
+
+  // A sparse block.
+  ClearWords();
+  for (size_t i = 0; i < RowBitmap::kBlockRows; i += 1000) {
+    SetRow(i);
+    expected.push_back(2 * RowBitmap::kBlockRows + i);
+  }
+  bitmap.SetBlock(2, &words_[0], RowBitmap::kBlockRows);
+
+  // A dense block.
+  ClearWords();
+  for (size_t i = 0; i < RowBitmap::kBlockRows; i += 3) {
+    SetRow(i);
+    expected.push_back(3 * RowBitmap::kBlockRows + i);
+  }
+  bitmap.SetBlock(3, &words_[0], RowBitmap::kBlockRows);
+
+  // A partial block with all its rows set.
+  const size_t kPartialRows = 100;
+  ClearWords();
+  for (size_t i = 0; i < kPartialRows; ++i) {
+    SetRow(i);
+    expected.push_back(4 * RowBitmap::kBlockRows + i);
+  }
+  bitmap.SetBlock(4, &words_[0], kPartialRows);
+
+  EXPECT_EQ(5U, bitmap.num_blocks());
+  ASSERT_NO_FATAL_FAILURE(
+      CheckBitmap(bitmap, 4 * RowBitmap::kBlockRows + kPartialRows,
+                  expected));
+
+  // Blocks read back as they were written.
+  std::vector<uint32> words(RowBitmap::kBlockWords);
+  bitmap.GetBlock(4, &words[0]);
+  EXPECT_TRUE(words == words_);
+  bitmap.GetBlock(0, &words[0]);
+  EXPECT_EQ(0U, words[0]);
+
+  // The sparse and full blocks take less space than a plain bitmap.
+  EXPECT_GT(2 * RowBitmap::kBlockWords * sizeof(uint32),
+            bitmap.GetMemoryUsage());
+}
+
+TEST_F(RowBitmapTest, ReplaceBlocks) {
+  RowBitmap bitmap;
+
+  ClearWords();
+  SetRow(5);
+  bitmap.SetBlock(0, &words_[0], RowBitmap::kBlockRows);
+  bitmap.SetBlock(1, &words_[0], 10);
+  EXPECT_EQ(2U, bitmap.count());
+  EXPECT_EQ(RowBitmap::kBlockRows + 5, bitmap.Select(1));
+
+  // Grow the last block.
+  SetRow(20);
+  bitmap.SetBlock(1, &words_[0], 30);
+  EXPECT_EQ(RowBitmap::kBlockRows + 30, bitmap.size());
+  EXPECT_EQ(3U, bitmap.count());
+  EXPECT_EQ(RowBitmap::kBlockRows + 20, bitmap.Select(2));
+
+  // Empty the first block, and the rows of the second move down.
+  ClearWords();
+  bitmap.SetBlock(0, &words_[0], RowBitmap::kBlockRows);
+  EXPECT_EQ(2U, bitmap.count());
+  EXPECT_EQ(RowBitmap::kBlockRows + 5, bitmap.Select(0));
+  EXPECT_EQ(RowBitmap::kBlockRows + 20, bitmap.Select(1));
+
+  RowBitmap other;
+  other.swap(bitmap);
+  EXPECT_EQ(0U, bitmap.size());
+  EXPECT_EQ(2U, other.count());
+
+  other.clear();
+  EXPECT_EQ(0U, other.size());
+  EXPECT_EQ(0U, other.count());
+}
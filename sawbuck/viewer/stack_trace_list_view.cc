@@ -41,7 +41,8 @@ const wchar_t* StackTraceListView::kColumnWidthValueName =
     config::kStackTraceColumnWidths;
 
 StackTraceListView::StackTraceListView(CUpdateUIBase* update_ui)
-    : update_ui_(update_ui), lookup_service_(NULL), pid_(0) {
+    : update_ui_(update_ui), lookup_service_(NULL), pid_(0),
+      lookup_handle_(ISymbolLookupService::kInvalidHandle) {
   COMPILE_ASSERT(arraysize(kColumns) == COL_MAX,
                  wrong_number_of_column_names);
 }
@@ -58,14 +59,12 @@ void StackTraceListView::SetStackTrace(sym_util::ProcessId pid,
   pid_ = pid;
   time_ = time;
 
-  // Cancel any in-progress symbol resolutions.
-  TraceList::iterator it(trace_.begin());
-  for (; it != trace_.end(); ++it)
-    CancelResolution(&*it);
+  // Cancel any in-progress symbol resolution.
+  CancelResolution();
 
   trace_.clear();
   for (size_t i = 0; i < num_traces; ++i)
-    trace_.push_back(TraceItem(traces[i]));
+    trace_.push_back(reinterpret_cast<sym_util::Address>(traces[i]));
 
   DeleteAllItems();
 
@@ -79,6 +78,10 @@ void StackTraceListView::SetStackTrace(sym_util::ProcessId pid,
       SetItem(item, 1, LVIF_TEXT, LPSTR_TEXTCALLBACK, 0, 0, 0, NULL);
     }
   }
+
+  // Resolve the whole trace in one go.
+  if (!trace_.empty())
+    StartResolution();
 }
 
 LRESULT StackTraceListView::OnCreate(UINT msg,
@@ -108,13 +111,11 @@ LRESULT StackTraceListView::OnGetDispInfo(NMHDR* pnmh) {
   int col = info->item.iSubItem;
   size_t row = info->item.iItem;
 
-  sym_util::Address address = trace_[row].address_;
+  sym_util::Address address = trace_[row];
 
   if (col == COL_ADDRESS) {
     item_text_ = StringPrintf(L"0x%08llX", address);
   } else {
-    EnsureResolution(&trace_[row]);
-
     switch (col) {
       case COL_MODULE:
         item_text_ = L"Resolving...";
@@ -145,42 +146,39 @@ LRESULT StackTraceListView::OnItemChanged(NMHDR* pnmh) {
   return 0;
 }
 
-void StackTraceListView::EnsureResolution(TraceItem* item) {
-  DCHECK(item != NULL);
-  if (item->lookup_handle_ != ISymbolLookupService::kInvalidHandle)
-    return;
+void StackTraceListView::StartResolution() {
+  DCHECK(lookup_handle_ == ISymbolLookupService::kInvalidHandle);
 
   DCHECK(lookup_service_ != NULL);
-  item->lookup_handle_ = lookup_service_->ResolveAddress(
-      pid_, time_, item->address_,
-      NewCallback(this, &StackTraceListView::SymbolResolved));
+  lookup_handle_ = lookup_service_->ResolveAddresses(
+      pid_, time_, trace_,
+      NewCallback(this, &StackTraceListView::SymbolsResolved));
 }
 
-void StackTraceListView::CancelResolution(TraceItem* item) {
-  DCHECK(item != NULL);
-  if (item->lookup_handle_ == ISymbolLookupService::kInvalidHandle)
+void StackTraceListView::CancelResolution() {
+  if (lookup_handle_ == ISymbolLookupService::kInvalidHandle)
     return;
 
   DCHECK(lookup_service_ != NULL);
-  lookup_service_->CancelRequest(item->lookup_handle_);
-  item->lookup_handle_ = ISymbolLookupService::kInvalidHandle;
+  lookup_service_->CancelRequest(lookup_handle_);
+  lookup_handle_ = ISymbolLookupService::kInvalidHandle;
 }
 
-void StackTraceListView::SymbolResolved(sym_util::ProcessId pid,
-    base::Time time, sym_util::Address address,
-    ISymbolLookupService::Handle handle, const sym_util::Symbol& symbol) {
-
-  size_t row = 0;
-  for (; row < trace_.size(); ++row) {
-    if (trace_[row].lookup_handle_ == handle)
-      break;
-  }
-
-  // We should always find our associated handle.
-  DCHECK(trace_[row].lookup_handle_ == handle);
+void StackTraceListView::SymbolsResolved(sym_util::ProcessId pid,
+    base::Time time, ISymbolLookupService::Handle handle,
+    const std::vector<sym_util::Symbol>& symbols) {
+  // We should always get the results for our pending lookup.
+  DCHECK(lookup_handle_ == handle);
+  DCHECK_EQ(trace_.size(), symbols.size());
   // No longer pending, make sure we don't cancel it later.
-  trace_[row].lookup_handle_ = ISymbolLookupService::kInvalidHandle;
+  lookup_handle_ = ISymbolLookupService::kInvalidHandle;
+
+  for (size_t row = 0; row < symbols.size(); ++row)
+    SetSymbolText(row, symbols[row]);
+}
 
+void StackTraceListView::SetSymbolText(size_t row,
+                                       const sym_util::Symbol& symbol) {
   for (int col = COL_MODULE; col < COL_MAX; ++col) {
     std::wstring item_text;
     switch (col) {
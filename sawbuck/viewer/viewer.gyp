@@ -69,20 +69,30 @@
         'filter.h',
         'filter_dialog.cc',
         'filter_dialog.h',
+        'filter_program.cc',
+        'filter_program.h',
         'filtered_log_view.cc',
         'filtered_log_view.h',
         'find_dialog.cc',
         'find_dialog.h',
+        'log_ingestion_queue.cc',
+        'log_ingestion_queue.h',
         'log_viewer.h',
         'log_viewer.cc',
         'log_list_view.h',
         'log_list_view.cc',
+        'log_store.cc',
+        'log_store.h',
+        'message_index.cc',
+        'message_index.h',
         'preferences.cc',
         'preferences.h',
         'provider_configuration.cc',
         'provider_configuration.h',
         'provider_dialog.cc',
         'provider_dialog.h',
+        'row_bitmap.cc',
+        'row_bitmap.h',
         'sawbuck_guids.h',
         'stack_trace_list_view.h',
         'stack_trace_list_view.cc',
@@ -146,10 +156,15 @@
       'target_name': 'viewer_unittests',
       'type': 'executable',
       'sources': [
+        'filter_program_unittest.cc',
         'filter_unittest.cc',
         'filtered_log_view_unittest.cc',
+        'log_ingestion_queue_unittest.cc',
+        'log_store_unittest.cc',
+        'message_index_unittest.cc',
         'preferences_unittest.cc',
         'provider_configuration_unittest.cc',
+        'row_bitmap_unittest.cc',
         'registry_test.h',
         'registry_test.cc',
         'sawbuck_guids.h',
@@ -103,9 +103,7 @@ void ViewerWindow::CompileAsserts() {
 }
 
 ViewerWindow::ViewerWindow()
-     : notify_log_view_new_items_(NULL),
-       symbol_lookup_worker_("Symbol Lookup Worker"),
-       next_sink_cookie_(1),
+     : symbol_lookup_worker_("Symbol Lookup Worker"),
        update_status_task_(NULL),
        log_viewer_(this),
        ui_loop_(NULL),
@@ -135,11 +133,6 @@ ViewerWindow::~ViewerWindow() {
   StopCapturing();
 
   symbol_lookup_worker_.Stop();
-
-  if (notify_log_view_new_items_ != NULL) {
-    notify_log_view_new_items_->Cancel();
-    notify_log_view_new_items_ = NULL;
-  }
 }
 
 namespace {
@@ -426,39 +419,46 @@ void ViewerWindow::EnableProviders(
 }
 
 void ViewerWindow::OnLogMessage(const LogEvents::LogMessage& log_message) {
-  ViewerWindow::LogMessage msg;
+  LogStore::Message msg;
   msg.level = log_message.level;
   msg.process_id = log_message.process_id;
   msg.thread_id = log_message.thread_id;
-  msg.time_stamp = log_message.time;
+  msg.time = log_message.time;
 
   // Use regular expression matching to extract the
   // file/line/message from the log string, which is of
   // format "[<stuff>:<file>(<line>)] <message><ws>".
-  if (!kFileRe.FullMatch(
+  // The parts are extracted in place, as the store copies them.
+  pcrecpp::StringPiece file;
+  pcrecpp::StringPiece message;
+  if (kFileRe.FullMatch(
       pcrecpp::StringPiece(log_message.message, log_message.message_len),
-                           &msg.file, &msg.line, &msg.message)) {
+                           &file, &msg.line, &message)) {
+    msg.file = file.data();
+    msg.file_len = file.size();
+    msg.message = message.data();
+    msg.message_len = message.size();
+  } else {
     // As fallback, just slurp the entire string.
-    msg.message.assign(log_message.message, log_message.message_len);
+    msg.message = log_message.message;
+    msg.message_len = log_message.message_len;
   }
 
   // If the message carried file information, use that
   // in preference to the above.
   if (log_message.file_len != 0) {
-    msg.file.assign(log_message.file, log_message.file_len);
+    msg.file = log_message.file;
+    msg.file_len = log_message.file_len;
     msg.line = log_message.line;
   }
 
   if (log_message.trace_depth > 0) {
-    msg.trace.insert(msg.trace.begin(),
-                     &log_message.traces[0],
-                     &log_message.traces[log_message.trace_depth - 1]);
+    msg.trace_depth = log_message.trace_depth - 1;
+    msg.traces = log_message.traces;
   }
 
-  base::AutoLock lock(list_lock_);
-  log_messages_.push_back(msg);
-
-  ScheduleNewItemsNotification();
+  base::AutoLock lock(append_lock_);
+  log_store_.Append(msg);
 }
 
 void ViewerWindow::OnStatusUpdate(const wchar_t* status) {
@@ -514,66 +514,28 @@ void ViewerWindow::OnTraceEventInstant(
 
 void ViewerWindow::AddTraceEventToLog(const char* type,
     const TraceEvents::TraceMessage& trace_message) {
-  ViewerWindow::LogMessage msg;
+  LogStore::Message msg;
   msg.level = trace_message.level;
   msg.process_id = trace_message.process_id;
   msg.thread_id = trace_message.thread_id;
-  msg.time_stamp = trace_message.time;
+  msg.time = trace_message.time;
 
   // The message will be of form "{BEGIN|END|INSTANT}(<name>, 0x<id>): <extra>"
-  msg.message = StringPrintf("%s(%*s, 0x%08X): %*s",
-                             type,
-                             trace_message.name_len,
-                             trace_message.name,
-                             trace_message.id,
-                             trace_message.extra_len,
-                             trace_message.extra);
-
-  for (size_t i = 0; i < trace_message.trace_depth; ++i)
-    msg.trace.push_back(trace_message.traces[i]);
-
-  base::AutoLock lock(list_lock_);
-  log_messages_.push_back(msg);
-
-  ScheduleNewItemsNotification();
-}
-
-void ViewerWindow::ScheduleNewItemsNotification() {
-  // The list lock must be held.
-  list_lock_.AssertAcquired();
-
-  if (notify_log_view_new_items_ == NULL) {
-    notify_log_view_new_items_ =
-        NewRunnableMethod(this, &ViewerWindow::NotifyLogViewNewItems);
-    DCHECK(notify_log_view_new_items_ != NULL);
-
-    if (notify_log_view_new_items_ != NULL) {
-      ui_loop_->PostTask(FROM_HERE, notify_log_view_new_items_ );
-    }
-  }
-}
-
-void ViewerWindow::NotifyLogViewNewItems() {
-  DCHECK_EQ(ui_loop_, MessageLoop::current());
-  {
-    base::AutoLock lock(list_lock_);
-
-    // Notification no longer pending.
-    notify_log_view_new_items_ = NULL;
-  }
+  std::string message = StringPrintf("%s(%*s, 0x%08X): %*s",
+                                     type,
+                                     trace_message.name_len,
+                                     trace_message.name,
+                                     trace_message.id,
+                                     trace_message.extra_len,
+                                     trace_message.extra);
+  msg.message = message.data();
+  msg.message_len = message.size();
 
-  EventSinkMap::iterator it(event_sinks_.begin());
-  for (; it != event_sinks_.end(); ++it) {
-    it->second->LogViewNewItems();
-  }
-}
+  msg.trace_depth = trace_message.trace_depth;
+  msg.traces = trace_message.traces;
 
-void ViewerWindow::NotifyLogViewCleared() {
-  DCHECK_EQ(ui_loop_, MessageLoop::current());
-  EventSinkMap::iterator it(event_sinks_.begin());
-  for (; it != event_sinks_.end(); ++it) {
-    it->second->LogViewCleared();
-  }
+  base::AutoLock lock(append_lock_);
+  log_store_.Append(msg);
 }
 
 LRESULT ViewerWindow::OnConfigureProviders(WORD code,
@@ -761,68 +723,52 @@ void ViewerWindow::OnDestroy() {
 }
 
 int ViewerWindow::GetNumRows() {
-  base::AutoLock lock(list_lock_);
-  return log_messages_.size();
+  return log_store_.GetNumRows();
 }
 
 void ViewerWindow::ClearAll() {
-  {
-    base::AutoLock lock(list_lock_);
-    log_messages_.clear();
-  }
-  NotifyLogViewCleared();
+  log_store_.ClearAll();
 }
 
 int ViewerWindow::GetSeverity(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].level;
+  return log_store_.GetSeverity(row);
 }
 
 DWORD ViewerWindow::GetProcessId(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].process_id;
+  return log_store_.GetProcessId(row);
 }
 
 DWORD ViewerWindow::GetThreadId(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].thread_id;
+  return log_store_.GetThreadId(row);
 }
 
 base::Time ViewerWindow::GetTime(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].time_stamp;
+  return log_store_.GetTime(row);
 }
 
 std::string ViewerWindow::GetFileName(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].file;
+  return log_store_.GetFileName(row);
 }
 
 int ViewerWindow::GetLine(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].line;
+  return log_store_.GetLine(row);
 }
 
 std::string ViewerWindow::GetMessage(int row) {
-  base::AutoLock lock(list_lock_);
-  return log_messages_[row].message;
+  return log_store_.GetMessage(row);
 }
 
 void ViewerWindow::GetStackTrace(int row, std::vector<void*>* trace) {
-  base::AutoLock lock(list_lock_);
-  *trace = log_messages_[row].trace;
+  log_store_.GetStackTrace(row, trace);
 }
 
 void ViewerWindow::Register(ILogViewEvents* event_sink,
                             int* registration_cookie) {
-  int cookie = next_sink_cookie_++;
-
-  event_sinks_.insert(std::make_pair(cookie, event_sink));
-  *registration_cookie = cookie;
+  log_store_.Register(event_sink, registration_cookie);
 }
 
 void ViewerWindow::Unregister(int registration_cookie) {
-  event_sinks_.erase(registration_cookie);
+  log_store_.Unregister(registration_cookie);
 }
 
 void ViewerWindow::InitSymbolPath() {
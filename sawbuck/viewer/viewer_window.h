@@ -37,6 +37,7 @@
 #include "sawbuck/log_lib/log_consumer.h"
 #include "sawbuck/log_lib/process_info_service.h"
 #include "sawbuck/log_lib/symbol_lookup_service.h"
+#include "sawbuck/viewer/log_store.h"
 #include "sawbuck/viewer/log_viewer.h"
 #include "sawbuck/viewer/provider_configuration.h"
 #include "sawbuck/viewer/resource.h"
@@ -73,6 +74,7 @@ class ViewerWindow
     UPDATE_ELEMENT(ID_FILE_IMPORT, UPDUI_MENUBAR)
     UPDATE_ELEMENT(ID_LOG_CAPTURE, UPDUI_MENUBAR)
     UPDATE_ELEMENT(ID_LOG_FILTER, UPDUI_MENUBAR)
+    UPDATE_ELEMENT(ID_LOG_CANCEL_FILTER, UPDUI_MENUBAR)
     UPDATE_ELEMENT(ID_EDIT_AUTOSIZE_COLUMNS, UPDUI_MENUBAR)
     UPDATE_ELEMENT(ID_EDIT_CUT, UPDUI_MENUBAR)
     UPDATE_ELEMENT(ID_EDIT_COPY, UPDUI_MENUBAR)
@@ -134,10 +136,6 @@ class ViewerWindow
   // Initializes the symbol path.
   void InitSymbolPath();
 
-  // Called on UI thread to dispatch notifications to listeners.
-  void NotifyLogViewNewItems();
-  void NotifyLogViewCleared();
-
   // LogEvents implementation.
   void OnLogMessage(const LogEvents::LogMessage& log_message);
 
@@ -155,46 +153,27 @@ class ViewerWindow
   void AddTraceEventToLog(const char* type,
                           const TraceEvents::TraceMessage& trace_message);
 
-  // Schedule a notification of new items on UI thread.
-  // Must be called under list_lock_.
-  void ScheduleNewItemsNotification();
-
   void EnableProviders(const ProviderConfiguration& settings);
 
   // The currently configured symbol path.
   std::wstring symbol_path_;
 
-  struct LogMessage {
-    LogMessage() : level(0), process_id(0), thread_id(0), line(0) {
-    }
-
-    UCHAR level;
-    DWORD process_id;
-    DWORD thread_id;
-    base::Time time_stamp;
-    std::string file;
-    int line;
-    std::string message;
-    std::vector<void*> trace;
-  };
-
   // We dedicate a thread to the symbol lookup work.
   base::Thread symbol_lookup_worker_;
 
-  base::Lock list_lock_;
-  typedef std::vector<LogMessage> LogMessageList;
-  LogMessageList log_messages_;  // Under list_lock_.
-  // Keeps the task pending to notify event sinks on the UI thread.
-  CancelableTask* notify_log_view_new_items_;  // Under list_lock_.
+  // Holds the log messages, and notifies our log view's event sinks of
+  // changes to them.
+  LogStore log_store_;
+
+  // The log store takes messages from one thread at a time, but we may be
+  // importing logs on the UI thread while the consumer thread captures.
+  // This is uncontended unless that happens, and is never taken by readers.
+  base::Lock append_lock_;
 
   // The message loop we're instantiated on, used to signal
   // back to the main thread from workers.
   MessageLoop* ui_loop_;
 
-  typedef std::map<int, ILogViewEvents*> EventSinkMap;
-  EventSinkMap event_sinks_;
-  int next_sink_cookie_;
-
   // The symbol lookup service we provide to the log list view.
   SymbolLookupService symbol_lookup_service_;
   typedef Callback1<const wchar_t*>::Type StatusCallback;
@@ -207,7 +186,7 @@ class ViewerWindow
   // Takes care of sinking KernelProcessEvents for us.
   ProcessInfoService process_info_service_;
 
-  // The list view control that displays log_messages_.
+  // The list view control that displays the log messages.
   LogViewer log_viewer_;
 
   // Controller for the logging session.
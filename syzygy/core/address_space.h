@@ -14,24 +14,66 @@
 #ifndef SYZYGY_CORE_ADDRESS_SPACE_H_
 #define SYZYGY_CORE_ADDRESS_SPACE_H_
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include "base/logging.h"
+#include "syzygy/core/flat_map.h"
 
 namespace core {
 
 // Forward declaration.
 template <typename AddressType, typename SizeType> class AddressRange;
 
+namespace internal {
+
+// Orders (range, item) pairs by their ranges alone.
+template <typename RangeItemPair> struct RangeItemPairLess {
+  bool operator()(const RangeItemPair& pair1,
+                  const RangeItemPair& pair2) const {
+    return pair1.first < pair2.first;
+  }
+};
+
+}  // namespace internal
+
+// Policies selecting the container an AddressSpace keeps its ranges in.
+//
+// MapRangeMapPolicy, the default, keeps the ranges in a std::map. It copes
+// well with insertions and lookups being interleaved, and its iterators are
+// stable across insertions and removals.
+struct MapRangeMapPolicy {
+  template <typename Range, typename ItemType> struct RangeMap {
+    typedef std::map<Range, ItemType> Type;
+  };
+};
+
+// FlatRangeMapPolicy keeps the ranges in a sorted vector, which is searched
+// with a branch-free binary search. Lookups are several times faster than with
+// the std::map, but insertion is linear unless it happens in increasing
+// address order or through BulkInsert, and every insertion or removal
+// invalidates all iterators. It suits address spaces that are built up front
+// and then queried heavily.
+struct FlatRangeMapPolicy {
+  template <typename Range, typename ItemType> struct RangeMap {
+    typedef FlatMap<Range, ItemType> Type;
+  };
+};
+
 // An address space is a mapping from a set of non-overlapping address ranges
 // (AddressSpace::Range), each of non-zero size, to an ItemType.
-template <typename AddressType, typename SizeType, typename ItemType>
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy = MapRangeMapPolicy>
 class AddressSpace {
  public:
   // Typedef we use for convenience throughout.
   typedef AddressRange<AddressType, SizeType> Range;
-  typedef std::map<Range, ItemType> RangeMap;
-  typedef typename std::map<Range, ItemType>::iterator RangeMapIter;
-  typedef typename std::map<Range, ItemType>::const_iterator RangeMapConstIter;
+  typedef typename RangeMapPolicy::template RangeMap<Range, ItemType>::Type
+      RangeMap;
+  typedef typename RangeMap::iterator RangeMapIter;
+  typedef typename RangeMap::const_iterator RangeMapConstIter;
   typedef std::pair<RangeMapConstIter, RangeMapConstIter> RangeMapConstIterPair;
   typedef std::pair<RangeMapIter, RangeMapIter> RangeMapIterPair;
 
@@ -92,6 +134,15 @@ class AddressSpace {
                    const ItemType& item,
                    typename RangeMap::iterator* ret_it = NULL);
 
+  // Inserts all the ranges in [@p first, @p last), which must be an iterator
+  // range over std::pair<Range, ItemType>. The ranges may come in any order,
+  // but must not intersect each other or any existing range. This is much
+  // cheaper than inserting the ranges one at a time into an address space
+  // using the FlatRangeMapPolicy.
+  // @returns true on success. On failure, the address space is unchanged.
+  template <typename InputIterator>
+  bool BulkInsert(InputIterator first, InputIterator last);
+
   // Remove the range that exactly matches @p range.
   // Returns true iff @p range is removed.
   bool Remove(const Range& range);
@@ -226,12 +277,14 @@ class AddressRange {
   SizeType size_;
 };
 
-template <typename AddressType, typename SizeType, typename ItemType>
-AddressSpace<AddressType, SizeType, ItemType>::AddressSpace() {
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::AddressSpace() {
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Insert(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Insert(
     const Range& range,
     const ItemType& item,
     typename RangeMap::iterator* ret_it) {
@@ -249,11 +302,12 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Insert(
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::SubsumeInsert(
-    const Range& range,
-    const ItemType& item,
-    typename RangeMap::iterator* ret_it) {
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    SubsumeInsert(const Range& range,
+                  const ItemType& item,
+                  typename RangeMap::iterator* ret_it) {
   RangeMapIterPair its = FindIntersecting(range);
 
   // We only need to check how we intersect the first and last ranges; we
@@ -301,8 +355,9 @@ bool AddressSpace<AddressType, SizeType, ItemType>::SubsumeInsert(
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-void AddressSpace<AddressType, SizeType, ItemType>::MergeInsert(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+void AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::MergeInsert(
     const Range& range,
     const ItemType& item,
     typename RangeMap::iterator* ret_it) {
@@ -342,8 +397,33 @@ void AddressSpace<AddressType, SizeType, ItemType>::MergeInsert(
   return;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Remove(const Range& range) {
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+template <typename InputIterator>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::BulkInsert(
+    InputIterator first, InputIterator last) {
+  typedef std::pair<Range, ItemType> RangeItemPair;
+  std::vector<RangeItemPair> new_ranges(first, last);
+  std::sort(new_ranges.begin(), new_ranges.end(),
+            internal::RangeItemPairLess<RangeItemPair>());
+
+  // Now that the new ranges are sorted, each one only has to be checked
+  // against its predecessor for intersections among them.
+  for (size_t i = 0; i < new_ranges.size(); ++i) {
+    if (i > 0 && new_ranges[i - 1].first.Intersects(new_ranges[i].first))
+      return false;
+    if (FindFirstIntersection(new_ranges[i].first) != ranges_.end())
+      return false;
+  }
+
+  ranges_.insert(new_ranges.begin(), new_ranges.end());
+  return true;
+}
+
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Remove(
+    const Range& range) {
   RangeMap::iterator it = ranges_.find(range);
   if (it == ranges_.end())
     return false;
@@ -352,17 +432,21 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Remove(const Range& range) {
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::const_iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
-    const Range& range) const {
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType,
+                      RangeMapPolicy>::RangeMapConstIter
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    FindFirstIntersection(const Range& range) const {
   return const_cast<AddressSpace*>(this)->FindFirstIntersection(range);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
-    const Range& range) {
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType,
+                      RangeMapPolicy>::RangeMapIter
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    FindFirstIntersection(const Range& range) {
   RangeMap::iterator it(ranges_.lower_bound(range));
 
   // There are three cases we need to handle here:
@@ -387,16 +471,20 @@ AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
   return ranges_.end();
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMapConstIterPair
-AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMapConstIterPair
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindIntersecting(
     const Range& range) const {
   return const_cast<AddressSpace*>(this)->FindIntersecting(range);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMapIterPair
-AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMapIterPair
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindIntersecting(
     const Range& range) {
   // Find the start of the range first.
   RangeMap::iterator begin(FindFirstIntersection(range));
@@ -420,24 +508,27 @@ AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
   return std::make_pair(begin, end);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Intersects(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Intersects(
     const Range& range) const {
   RangeMapConstIterPair its = FindIntersecting(range);
   return (its.first != its.second);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::ContainsExactly(
-    const Range& range) const {
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    ContainsExactly(const Range& range) const {
   RangeMapConstIterPair its = FindIntersecting(range);
   if (its.first == its.second)
     return false;
   return its.first->first == range;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Contains(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Contains(
     const Range& range) const {
   RangeMapConstIterPair its = FindIntersecting(range);
   if (its.first == its.second)
@@ -445,9 +536,11 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Contains(
   return its.first->first.Contains(range);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::const_iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindContaining(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType,
+                      RangeMapPolicy>::RangeMapConstIter
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindContaining(
     const Range& range) const {
   // If there is a containing range, it must be the first intersection.
   RangeMap::const_iterator it(FindFirstIntersection(range));
@@ -457,9 +550,11 @@ AddressSpace<AddressType, SizeType, ItemType>::FindContaining(
   return ranges_.end();
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindContaining(
+template <typename AddressType, typename SizeType, typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType,
+                      RangeMapPolicy>::RangeMapIter
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindContaining(
     const Range& range) {
   // If there is a containing range, it must be the first intersection.
   RangeMap::iterator it(FindFirstIntersection(range));
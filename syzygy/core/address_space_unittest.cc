@@ -14,7 +14,9 @@
 //
 #include "syzygy/core/address_space.h"
 #include <limits>
+#include "base/time.h"
 #include "gtest/gtest.h"
+#include "syzygy/core/random_number_generator.h"
 
 namespace core {
 
@@ -335,4 +337,165 @@ TEST(AddressSpaceTest, FindIntersecting) {
   EXPECT_EQ(120, it_pair.second->first.start());
 }
 
+typedef AddressSpace<size_t, size_t, void*, FlatRangeMapPolicy>
+    FlatIntegerAddressSpace;
+
+TEST(AddressSpaceTest, FlatPolicyMatchesMapPolicy) {
+  IntegerAddressSpace map_space;
+  FlatIntegerAddressSpace flat_space;
+  RandomNumberGenerator random(0xF1A7);
+
+  // Apply the same random sequence of operations to both address spaces,
+  // and check that they agree on every result.
+  for (size_t i = 0; i < 5000; ++i) {
+    IntegerAddressSpace::Range range(random(10000), random(50) + 1);
+    void* item = reinterpret_cast<void*>(i);
+
+    switch (random(5)) {
+      case 0:
+        EXPECT_EQ(map_space.Insert(range, item),
+                  flat_space.Insert(range, item));
+        break;
+      case 1:
+        EXPECT_EQ(map_space.SubsumeInsert(range, item),
+                  flat_space.SubsumeInsert(range, item));
+        break;
+      case 2:
+        map_space.MergeInsert(range, item);
+        flat_space.MergeInsert(range, item);
+        break;
+      case 3: {
+        IntegerAddressSpace::RangeMapConstIter map_it =
+            map_space.FindFirstIntersection(range);
+        FlatIntegerAddressSpace::RangeMapConstIter flat_it =
+            flat_space.FindFirstIntersection(range);
+        ASSERT_EQ(map_it == map_space.end(), flat_it == flat_space.end());
+        if (map_it != map_space.end()) {
+          EXPECT_TRUE(map_it->first == flat_it->first);
+          EXPECT_EQ(map_it->second, flat_it->second);
+        }
+        if (map_it != map_space.end() && random(2) == 0) {
+          EXPECT_TRUE(map_space.Remove(map_it->first));
+          EXPECT_TRUE(flat_space.Remove(flat_it->first));
+        }
+        break;
+      }
+      case 4:
+        EXPECT_EQ(map_space.Contains(range), flat_space.Contains(range));
+        EXPECT_EQ(map_space.Intersects(range), flat_space.Intersects(range));
+        break;
+    }
+  }
+
+  ASSERT_EQ(map_space.size(), flat_space.size());
+  IntegerAddressSpace::RangeMapConstIter map_it = map_space.begin();
+  FlatIntegerAddressSpace::RangeMapConstIter flat_it = flat_space.begin();
+  for (; map_it != map_space.end(); ++map_it, ++flat_it) {
+    EXPECT_TRUE(map_it->first == flat_it->first);
+    EXPECT_EQ(map_it->second, flat_it->second);
+  }
+}
+
+TEST(AddressSpaceTest, BulkInsert) {
+  typedef std::vector<std::pair<FlatIntegerAddressSpace::Range, void*> >
+      RangeVector;
+  FlatIntegerAddressSpace address_space;
+  void* item = "Something to point at";
+
+  ASSERT_TRUE(address_space.Insert(
+      FlatIntegerAddressSpace::Range(100, 10), item));
+
+  RangeVector ranges;
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(120, 10),
+                                  item));
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(50, 10),
+                                  item));
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(110, 10),
+                                  item));
+  EXPECT_TRUE(address_space.BulkInsert(ranges.begin(), ranges.end()));
+  EXPECT_EQ(4, address_space.size());
+  EXPECT_TRUE(address_space.ContainsExactly(50, 10));
+  EXPECT_TRUE(address_space.ContainsExactly(110, 10));
+
+  // Ranges that intersect an existing range should be rejected, and leave
+  // the address space untouched.
+  ranges.clear();
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(200, 10),
+                                  item));
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(125, 10),
+                                  item));
+  EXPECT_FALSE(address_space.BulkInsert(ranges.begin(), ranges.end()));
+  EXPECT_EQ(4, address_space.size());
+
+  // As should ranges that intersect each other.
+  ranges.clear();
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(200, 10),
+                                  item));
+  ranges.push_back(std::make_pair(FlatIntegerAddressSpace::Range(205, 10),
+                                  item));
+  EXPECT_FALSE(address_space.BulkInsert(ranges.begin(), ranges.end()));
+  EXPECT_EQ(4, address_space.size());
+}
+
+namespace {
+
+// Builds an address space of @p num_ranges adjacent ranges of random size,
+// and times @p num_lookups lookups of random addresses in it.
+template <typename AddressSpaceType>
+base::TimeDelta BenchmarkLookups(size_t num_ranges,
+                                 size_t num_lookups,
+                                 size_t* found) {
+  typedef typename AddressSpaceType::Range Range;
+  RandomNumberGenerator random(0xADD5);
+
+  std::vector<std::pair<Range, void*> > ranges;
+  size_t addr = 0;
+  for (size_t i = 0; i < num_ranges; ++i) {
+    size_t size = random(64) + 1;
+    ranges.push_back(std::make_pair(Range(addr, size),
+                                    reinterpret_cast<void*>(i)));
+    // Leave some holes.
+    addr += size + random(4);
+  }
+
+  AddressSpaceType address_space;
+  EXPECT_TRUE(address_space.BulkInsert(ranges.begin(), ranges.end()));
+
+  std::vector<size_t> addresses;
+  for (size_t i = 0; i < num_lookups; ++i)
+    addresses.push_back(random(addr));
+
+  *found = 0;
+  base::Time start = base::Time::Now();
+  for (size_t i = 0; i < num_lookups; ++i) {
+    if (address_space.FindContaining(Range(addresses[i], 1)) !=
+        address_space.end()) {
+      ++(*found);
+    }
+  }
+  return base::Time::Now() - start;
+}
+
+}  // namespace
+
+// Times FindContaining over a million ranges with each range map policy.
+// The lookups are scattered, which is the worst case for the std::map and
+// the case the flat policy is meant for. Disabled, as it takes a while.
+TEST(AddressSpaceTest, DISABLED_LookupBenchmark) {
+  const size_t kNumRanges = 1000000;
+  const size_t kNumLookups = 10000000;
+
+  size_t map_found = 0;
+  base::TimeDelta map_time = BenchmarkLookups<IntegerAddressSpace>(
+      kNumRanges, kNumLookups, &map_found);
+  size_t flat_found = 0;
+  base::TimeDelta flat_time = BenchmarkLookups<FlatIntegerAddressSpace>(
+      kNumRanges, kNumLookups, &flat_found);
+  EXPECT_EQ(map_found, flat_found);
+
+  LOG(INFO) << kNumLookups << " lookups in " << kNumRanges << " ranges.";
+  LOG(INFO) << "MapRangeMapPolicy: " << map_time.InMilliseconds() << " ms.";
+  LOG(INFO) << "FlatRangeMapPolicy: " << flat_time.InMilliseconds() << " ms.";
+}
+
 }  // namespace core
@@ -0,0 +1,260 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares ArenaMap, a map from small, densely allocated integer ids to
+// values. It is intended as a drop-in replacement for a std::map keyed by such
+// an id, and shares its value_type and iteration order.
+//
+// The values are allocated in large chunks and never move once inserted, so
+// pointers and references to them remain valid until they are erased or the
+// map is destroyed. Lookup by id is a single index into a dense vector.
+
+#ifndef SYZYGY_CORE_ARENA_MAP_H_
+#define SYZYGY_CORE_ARENA_MAP_H_
+
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+#include "base/basictypes.h"
+#include "base/logging.h"
+
+namespace core {
+
+namespace internal {
+
+// Iterates over the occupied slots of an ArenaMap in increasing id order.
+// ItemType is either ValueType or const ValueType.
+template<typename ValueType, typename ItemType> class ArenaMapIterator {
+ public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef ValueType value_type;
+  typedef ptrdiff_t difference_type;
+  typedef ItemType* pointer;
+  typedef ItemType& reference;
+  typedef std::vector<ValueType*> Index;
+
+  ArenaMapIterator() : index_(NULL), pos_(0) {
+  }
+
+  ArenaMapIterator(const Index* index, size_t pos)
+      : index_(index), pos_(pos) {
+    DCHECK(index_ != NULL);
+    SkipEmptyForward();
+  }
+
+  // This doubles as the copy constructor, and as the conversion from
+  // iterator to const_iterator.
+  ArenaMapIterator(const ArenaMapIterator<ValueType, ValueType>& other)
+      : index_(other.index_), pos_(other.pos_) {
+  }
+
+  reference operator*() const {
+    DCHECK(index_ != NULL);
+    DCHECK_LT(pos_, index_->size());
+    return *(*index_)[pos_];
+  }
+  pointer operator->() const { return &operator*(); }
+
+  ArenaMapIterator& operator++() {
+    DCHECK(index_ != NULL);
+    DCHECK_LT(pos_, index_->size());
+    ++pos_;
+    SkipEmptyForward();
+    return *this;
+  }
+  ArenaMapIterator operator++(int) {
+    ArenaMapIterator it(*this);
+    ++(*this);
+    return it;
+  }
+
+  ArenaMapIterator& operator--() {
+    DCHECK(index_ != NULL);
+    do {
+      DCHECK_LT(0U, pos_);
+      --pos_;
+    } while ((*index_)[pos_] == NULL);
+    return *this;
+  }
+  ArenaMapIterator operator--(int) {
+    ArenaMapIterator it(*this);
+    --(*this);
+    return it;
+  }
+
+  friend bool operator==(const ArenaMapIterator& it1,
+                         const ArenaMapIterator& it2) {
+    DCHECK(it1.index_ == it2.index_);
+    return it1.pos_ == it2.pos_;
+  }
+  friend bool operator!=(const ArenaMapIterator& it1,
+                         const ArenaMapIterator& it2) {
+    return !(it1 == it2);
+  }
+
+ private:
+  template<typename V, typename I> friend class ArenaMapIterator;
+
+  void SkipEmptyForward() {
+    while (pos_ < index_->size() && (*index_)[pos_] == NULL)
+      ++pos_;
+  }
+
+  const Index* index_;
+  size_t pos_;
+};
+
+}  // namespace internal
+
+// IdType must be an unsigned integral type. Ids should be allocated densely
+// from a small base, as the index is a vector with a slot for every id up to
+// the largest one inserted. Callers inserting ids that come from untrusted
+// input, such as a file, must bound them first.
+template<typename IdType, typename ValueType>
+class ArenaMap {
+ public:
+  typedef IdType key_type;
+  typedef ValueType mapped_type;
+  typedef std::pair<const IdType, ValueType> value_type;
+  typedef size_t size_type;
+  typedef internal::ArenaMapIterator<value_type, value_type> iterator;
+  typedef internal::ArenaMapIterator<value_type, const value_type>
+      const_iterator;
+
+  // The number of values allocated at a time.
+  static const size_t kChunkSize = 1024;
+
+  ArenaMap() : size_(0), chunk_used_(kChunkSize) {
+  }
+
+  ~ArenaMap() {
+    clear();
+  }
+
+  iterator begin() { return iterator(&index_, 0); }
+  const_iterator begin() const { return const_iterator(&index_, 0); }
+  iterator end() { return iterator(&index_, index_.size()); }
+  const_iterator end() const { return const_iterator(&index_, index_.size()); }
+
+  bool empty() const { return size_ == 0; }
+  size_type size() const { return size_; }
+
+  // Reserves index space for ids up to @p max_id.
+  void reserve(IdType max_id) {
+    index_.reserve(static_cast<size_t>(max_id) + 1);
+  }
+
+  // Inserts @p value unless a value with the same id already exists.
+  // @returns an iterator to the value with the id of @p value, and true iff
+  //     @p value was inserted.
+  std::pair<iterator, bool> insert(const value_type& value) {
+    size_t pos = static_cast<size_t>(value.first);
+    if (pos >= index_.size()) {
+      // Growing the index to pos + 1 would wrap around, or can't succeed.
+      CHECK_LT(pos, index_.max_size());
+      index_.resize(pos + 1, NULL);
+    }
+
+    if (index_[pos] != NULL)
+      return std::make_pair(iterator(&index_, pos), false);
+
+    index_[pos] = new(AllocateSlot()) value_type(value);
+    ++size_;
+
+    return std::make_pair(iterator(&index_, pos), true);
+  }
+
+  iterator find(IdType id) {
+    size_t pos = static_cast<size_t>(id);
+    if (pos >= index_.size() || index_[pos] == NULL)
+      return end();
+    return iterator(&index_, pos);
+  }
+  const_iterator find(IdType id) const {
+    size_t pos = static_cast<size_t>(id);
+    if (pos >= index_.size() || index_[pos] == NULL)
+      return end();
+    return const_iterator(&index_, pos);
+  }
+
+  // Removes the value with id @p id. Its slot is recycled by a later insert.
+  // @returns the number of values removed.
+  size_type erase(IdType id) {
+    size_t pos = static_cast<size_t>(id);
+    if (pos >= index_.size() || index_[pos] == NULL)
+      return 0;
+
+    value_type* value = index_[pos];
+    value->~value_type();
+    free_slots_.push_back(value);
+    index_[pos] = NULL;
+    --size_;
+
+    return 1;
+  }
+  void erase(iterator it) { erase(it->first); }
+
+  // Destroys all values and releases all memory.
+  void clear() {
+    for (size_t i = 0; i < index_.size(); ++i) {
+      if (index_[i] != NULL)
+        index_[i]->~value_type();
+    }
+    for (size_t i = 0; i < chunks_.size(); ++i)
+      ::operator delete(chunks_[i]);
+
+    index_.clear();
+    chunks_.clear();
+    free_slots_.clear();
+    size_ = 0;
+    chunk_used_ = kChunkSize;
+  }
+
+ private:
+  // Returns uninitialized storage for a single value.
+  void* AllocateSlot() {
+    if (!free_slots_.empty()) {
+      void* slot = free_slots_.back();
+      free_slots_.pop_back();
+      return slot;
+    }
+
+    if (chunk_used_ == kChunkSize) {
+      chunks_.push_back(
+          static_cast<value_type*>(
+              ::operator new(kChunkSize * sizeof(value_type))));
+      chunk_used_ = 0;
+    }
+
+    return chunks_.back() + chunk_used_++;
+  }
+
+  // Maps each id to its value, or NULL if there's no value with that id.
+  std::vector<value_type*> index_;
+  // The raw storage the values live in.
+  std::vector<value_type*> chunks_;
+  // Slots in chunks_ that were vacated by erase.
+  std::vector<value_type*> free_slots_;
+  // The number of values in the map.
+  size_t size_;
+  // The number of slots handed out from the last chunk.
+  size_t chunk_used_;
+
+  DISALLOW_COPY_AND_ASSIGN(ArenaMap);
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_ARENA_MAP_H_
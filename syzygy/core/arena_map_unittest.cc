@@ -0,0 +1,200 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/core/arena_map.h"
+
+#include <map>
+#include <string>
+#include "base/logging.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+
+namespace core {
+
+namespace {
+
+typedef ArenaMap<size_t, std::string> StringArenaMap;
+
+// Counts the number of live instances, to check that the map destroys
+// the values it holds.
+class Counted {
+ public:
+  Counted() { ++count_; }
+  Counted(const Counted& other) { ++count_; }
+  ~Counted() { --count_; }
+
+  static int count_;
+};
+
+int Counted::count_ = 0;
+
+// A value of about the size of a BlockGraph::Block.
+struct Payload {
+  Payload() : size(0) {
+    memset(fields, 0, sizeof(fields));
+  }
+
+  size_t size;
+  std::string name;
+  uint32 fields[24];
+};
+
+// Inserts @p num_values values into @p map in id order, looks each of them
+// up in a scattered order, and walks the map, as BlockGraph does with its
+// blocks. Reports the time taken by each step, prefixed with @p name.
+template<typename MapType>
+void TimeBlockMapOperations(const char* name, size_t num_values,
+                            MapType* map) {
+  base::Time start = base::Time::Now();
+  for (size_t i = 1; i <= num_values; ++i) {
+    Payload payload;
+    payload.size = i;
+    map->insert(std::make_pair(i, payload));
+  }
+  base::TimeDelta insert_time = base::Time::Now() - start;
+
+  start = base::Time::Now();
+  size_t found = 0;
+  for (size_t i = 0; i < num_values; ++i) {
+    size_t id = (i * 7919) % num_values + 1;
+    if (map->find(id)->second.size == id)
+      ++found;
+  }
+  base::TimeDelta find_time = base::Time::Now() - start;
+  EXPECT_EQ(num_values, found);
+
+  start = base::Time::Now();
+  size_t sum = 0;
+  typename MapType::const_iterator it = map->begin();
+  for (; it != map->end(); ++it)
+    sum += it->second.size;
+  base::TimeDelta walk_time = base::Time::Now() - start;
+  EXPECT_EQ(num_values * (num_values + 1) / 2, sum);
+
+  start = base::Time::Now();
+  map->clear();
+  base::TimeDelta clear_time = base::Time::Now() - start;
+
+  LOG(INFO) << name << ": insert " << insert_time.InMilliseconds()
+            << " ms, find " << find_time.InMilliseconds() << " ms, walk "
+            << walk_time.InMilliseconds() << " ms, clear "
+            << clear_time.InMilliseconds() << " ms.";
+}
+
+}  // namespace
+
+TEST(ArenaMapTest, InsertAndFind) {
+  StringArenaMap map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.begin() == map.end());
+
+  EXPECT_TRUE(map.insert(std::make_pair(3, std::string("three"))).second);
+  EXPECT_TRUE(map.insert(std::make_pair(1, std::string("one"))).second);
+  EXPECT_FALSE(map.insert(std::make_pair(3, std::string("drei"))).second);
+  EXPECT_EQ(2, map.size());
+
+  StringArenaMap::iterator it = map.find(3);
+  ASSERT_TRUE(it != map.end());
+  EXPECT_EQ(3, it->first);
+  EXPECT_EQ("three", it->second);
+
+  EXPECT_TRUE(map.find(0) == map.end());
+  EXPECT_TRUE(map.find(2) == map.end());
+  EXPECT_TRUE(map.find(1000) == map.end());
+}
+
+TEST(ArenaMapTest, IteratesInIdOrder) {
+  StringArenaMap map;
+  map.insert(std::make_pair(7, std::string("seven")));
+  map.insert(std::make_pair(2, std::string("two")));
+  map.insert(std::make_pair(5, std::string("five")));
+
+  // Mixing iterator and const_iterator should work as it does for std::map.
+  const StringArenaMap& const_map = map;
+  StringArenaMap::iterator it = map.begin();
+  ASSERT_TRUE(it != const_map.end());
+  EXPECT_EQ(2, it->first);
+  ++it;
+  EXPECT_EQ(5, it->first);
+  ++it;
+  EXPECT_EQ(7, it->first);
+  ++it;
+  EXPECT_TRUE(it == const_map.end());
+
+  --it;
+  EXPECT_EQ(7, it->first);
+  --it;
+  EXPECT_EQ(5, it->first);
+}
+
+TEST(ArenaMapTest, ValuesDoNotMove) {
+  StringArenaMap map;
+  std::string* first = &map.insert(
+      std::make_pair(1, std::string("one"))).first->second;
+
+  // Insert enough values to span several chunks, and to grow the index.
+  for (size_t i = 2; i < 10 * StringArenaMap::kChunkSize; ++i)
+    map.insert(std::make_pair(i, std::string("value")));
+
+  EXPECT_EQ(first, &map.find(1)->second);
+  EXPECT_EQ("one", *first);
+}
+
+TEST(ArenaMapTest, EraseRecyclesSlots) {
+  StringArenaMap map;
+  std::string* two = &map.insert(
+      std::make_pair(2, std::string("two"))).first->second;
+  map.insert(std::make_pair(3, std::string("three")));
+
+  EXPECT_EQ(0, map.erase(1));
+  EXPECT_EQ(1, map.erase(2));
+  EXPECT_EQ(1, map.size());
+  EXPECT_TRUE(map.find(2) == map.end());
+  EXPECT_EQ(3, map.begin()->first);
+
+  std::string* four = &map.insert(
+      std::make_pair(4, std::string("four"))).first->second;
+  EXPECT_EQ(two, four);
+}
+
+TEST(ArenaMapTest, DestroysValues) {
+  {
+    ArenaMap<size_t, Counted> map;
+    for (size_t i = 0; i < 3000; ++i)
+      map.insert(std::make_pair(i, Counted()));
+    EXPECT_EQ(3000, Counted::count_);
+
+    map.erase(10);
+    EXPECT_EQ(2999, Counted::count_);
+  }
+  EXPECT_EQ(0, Counted::count_);
+}
+
+// Inserts half a million blocks by increasing id, as BlockGraph hands them
+// out, then looks them up in a scattered order, walks them and clears them.
+// The ArenaMap is timed against the std::map that BlockGraph used to keep
+// its blocks in. Disabled, as it's only of interest when tuning the map.
+TEST(ArenaMapTest, DISABLED_StdMapComparisonBenchmark) {
+  const size_t kNumValues = 500000;
+
+  {
+    std::map<size_t, Payload> map;
+    TimeBlockMapOperations("std::map", kNumValues, &map);
+  }
+  {
+    ArenaMap<size_t, Payload> map;
+    TimeBlockMapOperations("ArenaMap", kNumValues, &map);
+  }
+}
+
+}  // namespace core
@@ -16,11 +16,15 @@
 
 #include "syzygy/core/basic_block_disassembler.h"
 
+#include <algorithm>
 #include <vector>
 #include "base/scoped_ptr.h"
+#include "base/sys_info.h"
+#include "base/time.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/address.h"
+#include "syzygy/core/parallel_loop.h"
 
 using testing::_;
 
@@ -44,6 +48,65 @@ int bb_ext_func2() {
 
 namespace core {
 
+namespace {
+
+// The prologue, body and epilogue of the functions in the synthetic code
+// section used by the benchmark. The body is an if/else diamond:
+//   cmp dword ptr [ebp+8], 0
+//   je else
+//   mov eax, 1
+//   jmp end
+// else:
+//   mov eax, 2
+// end:
+const uint8 kPrologue[] = { 0x55, 0x8B, 0xEC };
+const uint8 kDiamond[] = { 0x83, 0x7D, 0x08, 0x00,
+                           0x74, 0x07,
+                           0xB8, 0x01, 0x00, 0x00, 0x00,
+                           0xEB, 0x05,
+                           0xB8, 0x02, 0x00, 0x00, 0x00 };
+const uint8 kEpilogue[] = { 0x5D, 0xC3 };
+
+// Breaks up each of the functions in a synthetic code section into basic
+// blocks, one function per loop iteration.
+class DisassembleFunctionsLoop : public ParallelLoopBody {
+ public:
+  DisassembleFunctionsLoop(const std::vector<uint8>& code,
+                           AbsoluteAddress code_addr,
+                           size_t function_size)
+      : code_(code),
+        code_addr_(code_addr),
+        function_size_(function_size),
+        block_counts_(code.size() / function_size, 0) {
+  }
+
+  virtual void Run(size_t index) {
+    size_t offset = index * function_size_;
+    AbsoluteAddress function_addr(code_addr_ + offset);
+    Disassembler::AddressSet labels;
+    labels.insert(function_addr);
+
+    BasicBlockDisassembler disasm(&code_[offset],
+                                  function_size_,
+                                  function_addr,
+                                  labels,
+                                  "function",
+                                  NULL);
+    if (disasm.Walk() == Disassembler::kWalkSuccess)
+      block_counts_[index] = disasm.GetBasicBlockRanges().size();
+  }
+
+  const std::vector<size_t>& block_counts() const { return block_counts_; }
+
+ private:
+  const std::vector<uint8>& code_;
+  AbsoluteAddress code_addr_;
+  size_t function_size_;
+  std::vector<size_t> block_counts_;
+};
+
+}  // namespace
+
 class BasicBlockDisassemblerTest : public testing::Test {
  public:
   virtual void SetUp() {
@@ -153,4 +216,53 @@ TEST_F(BasicBlockDisassemblerTest, BasicCoverageWithLabels) {
   EXPECT_TRUE(block_starts_at_external_label);
 }
 
+// Disassembles a hundred thousand synthetic functions over a parallel loop,
+// as the decomposer does, to see how the disassembler alone scales with the
+// number of threads. DecomposerTest.DISABLED_BasicBlockDecompositionBenchmark
+// times the decomposer's BuildBasicBlockGraph on a real image.
+TEST_F(BasicBlockDisassemblerTest, DISABLED_ParallelDisassemblyBenchmark) {
+  const size_t kFunctionCount = 100000;
+  const size_t kDiamondCount = 16;
+  const AbsoluteAddress kCodeAddr(0x10000000);
+
+  // Build a synthetic code section.
+  std::vector<uint8> function(kPrologue, kPrologue + arraysize(kPrologue));
+  for (size_t i = 0; i < kDiamondCount; ++i)
+    function.insert(function.end(), kDiamond, kDiamond + arraysize(kDiamond));
+  function.insert(function.end(), kEpilogue, kEpilogue + arraysize(kEpilogue));
+
+  std::vector<uint8> code;
+  code.reserve(kFunctionCount * function.size());
+  for (size_t i = 0; i < kFunctionCount; ++i)
+    code.insert(code.end(), function.begin(), function.end());
+
+  size_t max_threads = base::SysInfo::NumberOfProcessors();
+  base::TimeDelta serial_time;
+  std::vector<size_t> serial_block_counts;
+  for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    DisassembleFunctionsLoop loop(code, kCodeAddr, function.size());
+    base::Time start = base::Time::Now();
+    RunParallelLoop(kFunctionCount, num_threads, &loop);
+    base::TimeDelta time = base::Time::Now() - start;
+
+    // Every function should have been broken up, and identically so no
+    // matter how many threads did the work.
+    if (num_threads == 1) {
+      serial_time = time;
+      serial_block_counts = loop.block_counts();
+      ASSERT_LT(kDiamondCount, serial_block_counts[0]);
+      ASSERT_EQ(kFunctionCount,
+                static_cast<size_t>(std::count(serial_block_counts.begin(),
+                                               serial_block_counts.end(),
+                                               serial_block_counts[0])));
+    }
+    ASSERT_TRUE(serial_block_counts == loop.block_counts());
+
+    LOG(INFO) << "Disassembled " << kFunctionCount << " functions ("
+        << code.size() << " bytes) on " << num_threads << " thread(s) in "
+        << time.InMillisecondsF() << " ms, a speedup of "
+        << serial_time.InMillisecondsF() / time.InMillisecondsF() << "x.";
+  }
+}
+
 }  // namespace core
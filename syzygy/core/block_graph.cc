@@ -14,10 +14,44 @@
 //
 #include "syzygy/core/block_graph.h"
 
+#include <algorithm>
 #include "base/logging.h"
 
 namespace core {
 
+namespace {
+
+// The fixed-width record that holds the properties of a block in the compact
+// format. These are written and read in place, in increasing order of id.
+struct CompactBlockRecord {
+  uint32 id;
+  uint32 type;
+  uint32 size;
+  uint32 alignment;
+  // The index of the block name in the string table.
+  uint32 name;
+  uint32 addr;
+  uint32 original_addr;
+  uint32 section;
+  uint32 attributes;
+  uint32 data_size;
+  // Non-zero iff the block owns its data, which is then stored in the data
+  // blob that follows the references.
+  uint32 owns_data;
+  uint32 label_count;
+  uint32 reference_count;
+};
+
+// The compact format stores kInvalidSection as this, as size_t may be wider.
+const uint32 kCompactInvalidSection = 0xFFFFFFFF;
+
+// A reference from a block, along with the block it refers to. This is used
+// to build the referrer sets in bulk when loading a compact graph.
+typedef std::pair<BlockGraph::Block*, BlockGraph::Block::Referrer>
+    ReferrerEntry;
+
+}  // namespace
+
 const RelativeAddress kInvalidAddress(0xFFFFFFFF);
 const size_t kInvalidSection = -1;
 
@@ -85,16 +119,37 @@ bool BlockGraph::Load(InArchive* in_archive) {
   if (!in_archive->Load(&next_block_id_) || !in_archive->Load(&num_blocks))
     return false;
 
+  // Blocks are never removed, so the ids of a graph run from 1 to
+  // next_block_id_, and Save writes them in that order. The counts and ids
+  // come from the archive, so we hold them to this before trusting them to
+  // size the block index.
+  if (num_blocks != next_block_id_) {
+    LOG(ERROR) << "Block count " << num_blocks << " doesn't match next block "
+               << "id " << next_block_id_ << ".";
+    return false;
+  }
+
+  // Block ids are allocated densely, so this sizes the block index once. We
+  // don't reserve more than a large image needs, so that an archive can't
+  // get us to allocate more than its contents warrant.
+  const size_t kMaxReservedBlocks = 1 << 20;
+  blocks_.reserve(std::min(next_block_id_, kMaxReservedBlocks));
+
   // Load the basic block properties first, and keep track of the
   // order of the blocks. We do this because we can't guarantee that the
   // underlying map will provide us the blocks in the order that we created
   // them, and this is the order in which the references are provided.
   std::vector<BlockGraph::Block*> order;
+  order.reserve(std::min(num_blocks, kMaxReservedBlocks));
   for (size_t i = 0; i < num_blocks; ++i) {
     BlockGraph::BlockId id = 0;
     Block block;
     if (!in_archive->Load(&id) || !block.LoadProps(in_archive))
       return false;
+    if (id != i + 1) {
+      LOG(ERROR) << "Unexpected block id " << id << ".";
+      return false;
+    }
     BlockMap::iterator it = blocks_.insert(std::make_pair(id, block)).first;
     order.push_back(&it->second);
 
@@ -114,6 +169,238 @@ bool BlockGraph::Load(InArchive* in_archive) {
   return true;
 }
 
+void BlockGraph::SaveCompact(StringTableBuilder* strings,
+                             CompactWriter* writer) const {
+  DCHECK(strings != NULL);
+  DCHECK(writer != NULL);
+
+  writer->WriteUint32(next_block_id_);
+  writer->WriteUint32(blocks_.size());
+
+  // Output the fixed-width block records first.
+  writer->Align(sizeof(uint32));
+  BlockMap::const_iterator it = blocks_.begin();
+  for (; it != blocks_.end(); ++it) {
+    const Block& block = it->second;
+    CompactBlockRecord record = {};
+    record.id = block.id_;
+    record.type = block.type_;
+    record.size = block.size_;
+    record.alignment = block.alignment_;
+    record.name = strings->Add(block.name_);
+    record.addr = block.addr_.value();
+    record.original_addr = block.original_addr_.value();
+    record.section = block.section_ == kInvalidSection ?
+        kCompactInvalidSection : block.section_;
+    record.attributes = block.attributes_;
+    record.data_size = block.data_size_;
+    record.owns_data = block.owns_data_;
+    record.label_count = block.labels_.size();
+    record.reference_count = block.references_.size();
+    writer->WriteBytes(sizeof(record), &record);
+  }
+
+  // Then the labels of each block. These are sorted by offset, so each offset
+  // is written as the difference from the previous one.
+  for (it = blocks_.begin(); it != blocks_.end(); ++it) {
+    Offset last_offset = 0;
+    Block::LabelMap::const_iterator label_it = it->second.labels_.begin();
+    for (; label_it != it->second.labels_.end(); ++label_it) {
+      writer->WriteVarInt(label_it->first - last_offset);
+      writer->WriteVarUint(strings->Add(label_it->second));
+      last_offset = label_it->first;
+    }
+  }
+
+  // Then the references. The referenced block is written as the difference
+  // between its id and that of the referring block, as most references are
+  // to nearby blocks.
+  for (it = blocks_.begin(); it != blocks_.end(); ++it) {
+    Offset last_offset = 0;
+    Block::ReferenceMap::const_iterator ref_it =
+        it->second.references_.begin();
+    for (; ref_it != it->second.references_.end(); ++ref_it) {
+      const Reference& ref = ref_it->second;
+      DCHECK(ref.referenced() != NULL);
+      writer->WriteVarInt(ref_it->first - last_offset);
+      writer->WriteVarUint(ref.type());
+      writer->WriteVarUint(ref.size());
+      writer->WriteVarInt(ref.referenced()->id() - it->first);
+      writer->WriteVarInt(ref.offset());
+      last_offset = ref_it->first;
+    }
+  }
+
+  // Finally, the data owned by the blocks.
+  for (it = blocks_.begin(); it != blocks_.end(); ++it) {
+    if (it->second.owns_data_)
+      writer->WriteBytes(it->second.data_size_, it->second.data_);
+  }
+}
+
+bool BlockGraph::LoadCompact(const StringTable& strings,
+                             CompactReader* reader) {
+  DCHECK(reader != NULL);
+
+  uint32 next_block_id = 0;
+  uint32 num_blocks = 0;
+  const uint8* records_data = NULL;
+  if (!reader->ReadUint32(&next_block_id) ||
+      !reader->ReadUint32(&num_blocks) ||
+      !reader->Align(sizeof(uint32)) ||
+      num_blocks > reader->remaining() / sizeof(CompactBlockRecord) ||
+      !reader->ReadBytes(num_blocks * sizeof(CompactBlockRecord),
+                         &records_data)) {
+    LOG(ERROR) << "Unable to load block records.";
+    return false;
+  }
+  const CompactBlockRecord* records =
+      reinterpret_cast<const CompactBlockRecord*>(records_data);
+
+  // As in Load, the ids of the blocks run from 1 to the next block id, and
+  // the records are in id order. The records are bounded by the size of the
+  // data, so holding the next block id to their count bounds the block index.
+  if (num_blocks != next_block_id) {
+    LOG(ERROR) << "Block count " << num_blocks << " doesn't match next block "
+               << "id " << next_block_id << ".";
+    return false;
+  }
+
+  next_block_id_ = next_block_id;
+  blocks_.reserve(next_block_id_);
+
+  // Create the blocks in place, and keep track of them in the order of their
+  // records, which is the order in which their labels, references and data
+  // follow.
+  std::vector<Block*> order;
+  order.reserve(num_blocks);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const CompactBlockRecord& record = records[i];
+    if (record.id != i + 1) {
+      LOG(ERROR) << "Unexpected block id " << record.id << ".";
+      return false;
+    }
+    if (record.type >= BLOCK_TYPE_MAX) {
+      LOG(ERROR) << "Block " << record.id << " has invalid type "
+                 << record.type << ".";
+      return false;
+    }
+
+    std::pair<BlockMap::iterator, bool> result =
+        blocks_.insert(std::make_pair(record.id, Block()));
+    if (!result.second) {
+      LOG(ERROR) << "Duplicate block id " << record.id << ".";
+      return false;
+    }
+
+    Block& block = result.first->second;
+    block.id_ = record.id;
+    block.type_ = static_cast<BlockType>(record.type);
+    block.size_ = record.size;
+    block.alignment_ = record.alignment;
+    block.addr_ = RelativeAddress(record.addr);
+    block.original_addr_ = RelativeAddress(record.original_addr);
+    block.section_ = record.section == kCompactInvalidSection ?
+        kInvalidSection : record.section;
+    block.attributes_ = record.attributes;
+    block.data_size_ = record.data_size;
+    if (!strings.Get(record.name, &block.name_)) {
+      LOG(ERROR) << "Block " << record.id << " has an invalid name.";
+      return false;
+    }
+    order.push_back(&block);
+  }
+
+  // Load the labels.
+  for (size_t i = 0; i < num_blocks; ++i) {
+    Block* block = order[i];
+    Offset offset = 0;
+    block->labels_.reserve(records[i].label_count);
+    for (size_t j = 0; j < records[i].label_count; ++j) {
+      int32 delta = 0;
+      uint32 name = 0;
+      std::string label;
+      if (!reader->ReadVarInt(&delta) || !reader->ReadVarUint(&name) ||
+          !strings.Get(name, &label)) {
+        LOG(ERROR) << "Unable to load label of block " << block->id_ << ".";
+        return false;
+      }
+      offset += delta;
+      if (!block->labels_.insert(std::make_pair(offset, label)).second) {
+        LOG(ERROR) << "Duplicate label at offset " << offset << " of block "
+                   << block->id_ << ".";
+        return false;
+      }
+    }
+  }
+
+  // Load the references, collecting the referrers as we go.
+  std::vector<ReferrerEntry> referrers;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    Block* block = order[i];
+    Offset offset = 0;
+    block->references_.reserve(records[i].reference_count);
+    for (size_t j = 0; j < records[i].reference_count; ++j) {
+      int32 delta = 0;
+      uint32 type = 0;
+      uint32 size = 0;
+      int32 id_delta = 0;
+      int32 remote_offset = 0;
+      if (!reader->ReadVarInt(&delta) || !reader->ReadVarUint(&type) ||
+          !reader->ReadVarUint(&size) || !reader->ReadVarInt(&id_delta) ||
+          !reader->ReadVarInt(&remote_offset)) {
+        LOG(ERROR) << "Unable to load reference of block " << block->id_
+                   << ".";
+        return false;
+      }
+      offset += delta;
+
+      BlockId id = block->id_ + id_delta;
+      Block* referenced = GetBlockById(id);
+      if (referenced == NULL) {
+        LOG(ERROR) << "Unable to load block with id " << id << ".";
+        return false;
+      }
+
+      bool inserted = block->references_.insert(std::make_pair(
+          offset, Reference(static_cast<ReferenceType>(type), size,
+                            referenced, remote_offset))).second;
+      if (!inserted) {
+        LOG(ERROR) << "Duplicate reference at offset " << offset
+                   << " of block " << block->id_ << ".";
+        return false;
+      }
+      referrers.push_back(
+          std::make_pair(referenced, Block::Referrer(block, offset)));
+    }
+  }
+
+  // Sorting the referrers groups them by referenced block, and puts each
+  // group in order, so every insertion below takes the fast path.
+  std::sort(referrers.begin(), referrers.end());
+  for (size_t i = 0; i < referrers.size(); ++i)
+    referrers[i].first->referrers_.insert(referrers[i].second);
+
+  // Finally, load the data owned by the blocks.
+  for (size_t i = 0; i < num_blocks; ++i) {
+    Block* block = order[i];
+    block->owns_data_ = records[i].owns_data != 0;
+    if (!block->owns_data_ || block->data_size_ == 0)
+      continue;
+
+    const uint8* data = NULL;
+    if (!reader->ReadBytes(block->data_size_, &data)) {
+      LOG(ERROR) << "Unable to load data of block " << block->id_ << ".";
+      return false;
+    }
+    uint8* copy = new uint8[block->data_size_];
+    memcpy(copy, data, block->data_size_);
+    block->data_ = copy;
+  }
+
+  return true;
+}
+
 BlockGraph::AddressSpace::AddressSpace(BlockGraph* graph)
     : graph_(graph) {
   DCHECK(graph != NULL);
@@ -385,6 +672,53 @@ bool BlockGraph::AddressSpace::Load(InArchive* in_archive) {
   return true;
 }
 
+void BlockGraph::AddressSpace::SaveCompact(CompactWriter* writer) const {
+  DCHECK(writer != NULL);
+
+  // The ids are written as differences from the previous one, as blocks are
+  // mostly created in address order.
+  writer->WriteVarUint(address_space_.size());
+  BlockId last_id = 0;
+  RangeMapConstIter it = address_space_.begin();
+  for (; it != address_space_.end(); ++it) {
+    writer->WriteVarInt(it->second->id() - last_id);
+    last_id = it->second->id();
+  }
+}
+
+bool BlockGraph::AddressSpace::LoadCompact(CompactReader* reader) {
+  DCHECK(reader != NULL);
+
+  uint32 num_blocks = 0;
+  if (!reader->ReadVarUint(&num_blocks)) {
+    LOG(ERROR) << "Unable to load BlockGraph::AddressSpace size.";
+    return false;
+  }
+
+  BlockId id = 0;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    int32 delta = 0;
+    if (!reader->ReadVarInt(&delta)) {
+      LOG(ERROR) << "Unable to load block id.";
+      return false;
+    }
+    id += delta;
+
+    Block* block = graph_->GetBlockById(id);
+    if (block == NULL) {
+      LOG(ERROR) << "No block found with id " << id << ".";
+      return false;
+    }
+
+    if (!InsertBlock(block->addr(), block)) {
+      LOG(ERROR) << "Unable to insert block in BlockGraph::AddressSpace.";
+      return false;
+    }
+  }
+
+  return true;
+}
+
 BlockGraph::Block::Block()
     : id_(0),
       type_(BlockGraph::CODE_BLOCK),
@@ -625,6 +959,7 @@ bool BlockGraph::Block::LoadRefs(BlockGraph& block_graph,
     LOG(ERROR) << "Unable to load block reference count.";
     return false;
   }
+  references_.reserve(num_references);
 
   // Load the references.
   for (size_t i = 0; i < num_references; ++i) {
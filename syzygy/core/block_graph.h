@@ -27,6 +27,9 @@
 #include "base/basictypes.h"
 #include "syzygy/core/address.h"
 #include "syzygy/core/address_space.h"
+#include "syzygy/core/arena_map.h"
+#include "syzygy/core/compact_file.h"
+#include "syzygy/core/flat_map.h"
 
 namespace core {
 
@@ -84,8 +87,10 @@ class BlockGraph {
   class Reference;
   class AddressSpace;
 
-  // The block map contains all blocks, indexed by id.
-  typedef std::map<BlockId, Block> BlockMap;
+  // The block map contains all blocks, indexed by id. Blocks are allocated
+  // in chunks and are never moved, so pointers to blocks remain valid for the
+  // lifetime of the graph.
+  typedef ArenaMap<BlockId, Block> BlockMap;
 
   BlockGraph();
   ~BlockGraph();
@@ -112,6 +117,20 @@ class BlockGraph {
   // it did not own. This will be resolved by DecomposedImage serialization.
   bool Load(InArchive* in_archive);
 
+  // Serializes the graph to the compact file format declared in
+  // compact_file.h. Block properties are written as fixed-width records that
+  // are read in place on load, while labels and references are written as
+  // variable length deltas.
+  // @param strings the table to which block names and labels are added.
+  // @param writer the writer to which everything else is written.
+  void SaveCompact(StringTableBuilder* strings, CompactWriter* writer) const;
+  // As with Load, blocks that didn't own their data are left with a NULL
+  // data pointer.
+  // @param strings the table holding block names and labels.
+  // @param reader the reader from which the graph is read.
+  // @returns true on success, false if the data is malformed.
+  bool LoadCompact(const StringTable& strings, CompactReader* reader);
+
  private:
   // All blocks we contain.
   BlockMap blocks_;
@@ -133,10 +152,14 @@ class BlockGraph::Block {
   // This is keyed on block and source offset (not destination offset),
   // to allow easily locate and remove the backreferences on change or
   // deletion.
+  // These are flat sorted vectors rather than node based containers, as
+  // there are several per block and most of them hold only a few entries.
+  // Note that changing the references or labels of a block invalidates any
+  // iterators into them.
   typedef std::pair<Block*, Offset> Referrer;
-  typedef std::set<Referrer> ReferrerSet;
-  typedef std::map<Offset, Reference> ReferenceMap;
-  typedef std::map<Offset, std::string> LabelMap;
+  typedef FlatSet<Referrer> ReferrerSet;
+  typedef FlatMap<Offset, Reference> ReferenceMap;
+  typedef FlatMap<Offset, std::string> LabelMap;
 
   // Blocks need to be default constructible for serialization.
   Block();
@@ -388,6 +411,11 @@ class BlockGraph::AddressSpace {
   bool Save(OutArchive* out_archive) const;
   bool Load(InArchive* in_archive);
 
+  // For compact serialization. As with Save and Load, only the ids of the
+  // blocks are stored, so the graph must be loaded first.
+  void SaveCompact(CompactWriter* writer) const;
+  bool LoadCompact(CompactReader* reader);
+
  private:
   bool InsertImpl(RelativeAddress addr, Block* block);
 
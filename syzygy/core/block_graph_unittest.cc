@@ -12,12 +12,53 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "syzygy/core/block_graph.h"
+#include "base/process_util.h"
+#include "base/stringprintf.h"
+#include "base/time.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/core/random_number_generator.h"
 #include "syzygy/core/unittest_util.h"
 
 namespace core {
 
+namespace {
+
+// Populates @p image with @p num_blocks blocks, each of which has a label and
+// @p refs_per_block references to randomly chosen blocks.
+void BuildSyntheticBlockGraph(size_t num_blocks,
+                              size_t refs_per_block,
+                              BlockGraph* image) {
+  const size_t kBlockSize = 0x40;
+  RandomNumberGenerator random(0xB10C);
+
+  std::vector<BlockGraph::Block*> blocks;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    BlockGraph::Block* block = image->AddBlock(
+        BlockGraph::CODE_BLOCK, kBlockSize,
+        base::StringPrintf("block%u", i).c_str());
+    block->SetLabel(0, "entry");
+    blocks.push_back(block);
+  }
+
+  for (size_t i = 0; i < num_blocks; ++i) {
+    for (size_t j = 0; j < refs_per_block; ++j) {
+      BlockGraph::Block* referenced = blocks[random(num_blocks)];
+      blocks[i]->SetReference(j * 4,
+          BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, referenced, 0));
+    }
+  }
+}
+
+size_t GetPeakWorkingSetSize() {
+  scoped_ptr<base::ProcessMetrics> metrics(
+      base::ProcessMetrics::CreateProcessMetrics(
+          base::GetCurrentProcessHandle()));
+  return metrics->GetPeakWorkingSetSize();
+}
+
+}  // namespace
+
 TEST(BlockGraphTest, Create) {
   BlockGraph image;
 }
@@ -470,4 +511,370 @@ TEST(BlockGraphTest, Serialization) {
   EXPECT_TRUE(testing::BlockGraphsEqual(image, image_copy));
 }
 
+TEST(BlockGraphTest, SerializationFailsOnCorruptIds) {
+  BlockGraph image;
+  image.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "b1");
+  image.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "b2");
+
+  ByteVector byte_vector;
+  ScopedOutStreamPtr out_stream(
+      CreateByteOutStream(std::back_inserter(byte_vector)));
+  NativeBinaryOutArchive out_archive(out_stream.get());
+  ASSERT_TRUE(out_archive.Save(image));
+
+  // The archive starts with the next block id, the block count, and the id
+  // of the first block.
+  const size_t kNextBlockIdOffset = 0;
+  const size_t kFirstBlockIdOffset = 2 * sizeof(size_t);
+  ASSERT_LT(kFirstBlockIdOffset + sizeof(size_t), byte_vector.size());
+
+  // A next block id that doesn't match the block count.
+  ByteVector corrupt(byte_vector);
+  size_t huge_id = 0xFFFFFFFF;
+  memcpy(&corrupt[kNextBlockIdOffset], &huge_id, sizeof(huge_id));
+  {
+    BlockGraph image_copy;
+    ScopedInStreamPtr in_stream(
+        CreateByteInStream(corrupt.begin(), corrupt.end()));
+    NativeBinaryInArchive in_archive(in_stream.get());
+    EXPECT_FALSE(in_archive.Load(&image_copy));
+  }
+
+  // A block id far beyond the next block id.
+  corrupt = byte_vector;
+  memcpy(&corrupt[kFirstBlockIdOffset], &huge_id, sizeof(huge_id));
+  {
+    BlockGraph image_copy;
+    ScopedInStreamPtr in_stream(
+        CreateByteInStream(corrupt.begin(), corrupt.end()));
+    NativeBinaryInArchive in_archive(in_stream.get());
+    EXPECT_FALSE(in_archive.Load(&image_copy));
+  }
+}
+
+TEST(BlockGraphTest, CompactSerialization) {
+  BlockGraph image;
+  BlockGraph::AddressSpace address_space(&image);
+
+  BlockGraph::Block* b1 = address_space.AddBlock(
+      BlockGraph::CODE_BLOCK, RelativeAddress(0x1000), 0x20, "b1");
+  BlockGraph::Block* b2 = address_space.AddBlock(
+      BlockGraph::DATA_BLOCK, RelativeAddress(0x1020), 0x20, "b2");
+  // This block isn't in the address space, and has no section. Being data,
+  // it may be referred to from outside of its extent.
+  BlockGraph::Block* b3 = image.AddBlock(BlockGraph::DATA_BLOCK, 0x20, "b1");
+  ASSERT_TRUE(b1 != NULL && b2 != NULL && b3 != NULL);
+
+  b1->set_section(1);
+  b1->set_attributes(BlockGraph::NON_RETURN_FUNCTION);
+  b1->set_alignment(16);
+  uint8* b1_data = b1->AllocateData(b1->size());
+  for (size_t i = 0; i < b1->size(); ++i)
+    b1_data[i] = static_cast<uint8>(i);
+
+  // This data belongs to someone else, and so isn't saved.
+  static const uint8 kB2Data[] = { 1, 2, 3, 4 };
+  b2->set_data(kB2Data);
+  b2->set_data_size(sizeof(kB2Data));
+
+  ASSERT_TRUE(b1->SetLabel(0, "b1"));
+  ASSERT_TRUE(b1->SetLabel(0x10, "b1+0x10"));
+  ASSERT_TRUE(b3->SetLabel(4, "b1"));
+
+  ASSERT_TRUE(b1->SetReference(0,
+      BlockGraph::Reference(BlockGraph::PC_RELATIVE_REF, 1, b2, 9)));
+  ASSERT_TRUE(b1->SetReference(4,
+      BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, b3, -4)));
+  ASSERT_TRUE(b3->SetReference(8,
+      BlockGraph::Reference(BlockGraph::FILE_OFFSET_REF, 4, b1, 0x10)));
+  ASSERT_TRUE(b2->SetReference(0,
+      BlockGraph::Reference(BlockGraph::RELATIVE_REF, 4, b1, 0)));
+
+  StringTableBuilder strings;
+  std::vector<uint8> graph_data;
+  CompactWriter writer(&graph_data);
+  image.SaveCompact(&strings, &writer);
+  address_space.SaveCompact(&writer);
+  // Names and labels are shared.
+  EXPECT_EQ(3U, strings.size());
+
+  std::vector<uint8> string_data;
+  CompactWriter string_writer(&string_data);
+  strings.Write(&string_writer);
+
+  StringTable string_table;
+  ASSERT_TRUE(string_table.Init(&string_data[0], string_data.size()));
+
+  BlockGraph image_copy;
+  BlockGraph::AddressSpace address_space_copy(&image_copy);
+  CompactReader reader(&graph_data[0], graph_data.size());
+  ASSERT_TRUE(image_copy.LoadCompact(string_table, &reader));
+  ASSERT_TRUE(address_space_copy.LoadCompact(&reader));
+  EXPECT_EQ(0U, reader.remaining());
+
+  // The data of b2 is left for the caller to fix up. Once it has been, the
+  // graphs should be identical.
+  BlockGraph::Block* b2_copy = image_copy.GetBlockById(b2->id());
+  ASSERT_TRUE(b2_copy != NULL);
+  EXPECT_TRUE(b2_copy->data() == NULL);
+  EXPECT_EQ(sizeof(kB2Data), b2_copy->data_size());
+  b2_copy->set_data(kB2Data);
+
+  EXPECT_TRUE(testing::BlockGraphsEqual(image, image_copy));
+  EXPECT_EQ(address_space.address_space_impl().size(),
+            address_space_copy.address_space_impl().size());
+  EXPECT_EQ(b2_copy, address_space_copy.GetBlockByAddress(
+      RelativeAddress(0x1020)));
+
+  // BlockGraphsEqual only checks the ids of referenced blocks.
+  BlockGraph::Block* b1_copy = image_copy.GetBlockById(b1->id());
+  ASSERT_TRUE(b1_copy != NULL);
+  EXPECT_EQ(kInvalidSection, image_copy.GetBlockById(b3->id())->section());
+  BlockGraph::Reference ref;
+  ASSERT_TRUE(b1_copy->GetReference(4, &ref));
+  EXPECT_EQ(BlockGraph::ABSOLUTE_REF, ref.type());
+  EXPECT_EQ(4U, ref.size());
+  EXPECT_EQ(b3->id(), ref.referenced()->id());
+  EXPECT_EQ(-4, ref.offset());
+}
+
+TEST(BlockGraphTest, CompactSerializationFailsOnTruncatedData) {
+  BlockGraph image;
+  BuildSyntheticBlockGraph(10, 2, &image);
+
+  StringTableBuilder strings;
+  std::vector<uint8> graph_data;
+  CompactWriter writer(&graph_data);
+  image.SaveCompact(&strings, &writer);
+
+  std::vector<uint8> string_data;
+  CompactWriter string_writer(&string_data);
+  strings.Write(&string_writer);
+  StringTable string_table;
+  ASSERT_TRUE(string_table.Init(&string_data[0], string_data.size()));
+
+  BlockGraph image_copy;
+  CompactReader reader(&graph_data[0], graph_data.size() - 1);
+  EXPECT_FALSE(image_copy.LoadCompact(string_table, &reader));
+}
+
+TEST(BlockGraphTest, CompactSerializationFailsOnCorruptIds) {
+  BlockGraph image;
+  BuildSyntheticBlockGraph(10, 2, &image);
+
+  StringTableBuilder strings;
+  std::vector<uint8> graph_data;
+  CompactWriter writer(&graph_data);
+  image.SaveCompact(&strings, &writer);
+
+  std::vector<uint8> string_data;
+  CompactWriter string_writer(&string_data);
+  strings.Write(&string_writer);
+  StringTable string_table;
+  ASSERT_TRUE(string_table.Init(&string_data[0], string_data.size()));
+
+  // The data starts with the next block id and the block count, followed by
+  // the block records, each of which starts with the id of its block.
+  const size_t kNextBlockIdOffset = 0;
+  const size_t kFirstBlockIdOffset = 2 * sizeof(uint32);
+  ASSERT_LT(kFirstBlockIdOffset + sizeof(uint32), graph_data.size());
+  const uint32 kHugeId = 0xFFFFFFFF;
+
+  // A next block id that doesn't match the block count.
+  std::vector<uint8> corrupt(graph_data);
+  memcpy(&corrupt[kNextBlockIdOffset], &kHugeId, sizeof(kHugeId));
+  {
+    BlockGraph image_copy;
+    CompactReader reader(&corrupt[0], corrupt.size());
+    EXPECT_FALSE(image_copy.LoadCompact(string_table, &reader));
+  }
+
+  // A block id far beyond the next block id.
+  corrupt = graph_data;
+  memcpy(&corrupt[kFirstBlockIdOffset], &kHugeId, sizeof(kHugeId));
+  {
+    BlockGraph image_copy;
+    CompactReader reader(&corrupt[0], corrupt.size());
+    EXPECT_FALSE(image_copy.LoadCompact(string_table, &reader));
+  }
+}
+
+TEST(BlockGraphTest, CompactSerializationFailsOnDuplicateOffsets) {
+  // Two graphs that differ only in the offset of their second label and
+  // reference, so that the bytes holding those offsets can be found.
+  BlockGraph images[2];
+  std::vector<uint8> graph_data[2];
+  std::vector<uint8> string_data[2];
+  for (size_t i = 0; i < arraysize(images); ++i) {
+    BlockGraph::Block* block =
+        images[i].AddBlock(BlockGraph::CODE_BLOCK, 0x20, "block");
+    ASSERT_TRUE(block != NULL);
+    BlockGraph::Offset offset = 4 + 4 * i;
+    ASSERT_TRUE(block->SetLabel(0, "label"));
+    ASSERT_TRUE(block->SetLabel(offset, "label"));
+    ASSERT_TRUE(block->SetReference(0,
+        BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, block, 0)));
+    ASSERT_TRUE(block->SetReference(offset,
+        BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, block, 0)));
+
+    StringTableBuilder strings;
+    CompactWriter writer(&graph_data[i]);
+    images[i].SaveCompact(&strings, &writer);
+    CompactWriter string_writer(&string_data[i]);
+    strings.Write(&string_writer);
+  }
+  ASSERT_TRUE(string_data[0] == string_data[1]);
+  ASSERT_EQ(graph_data[0].size(), graph_data[1].size());
+
+  StringTable string_table;
+  ASSERT_TRUE(string_table.Init(&string_data[0][0], string_data[0].size()));
+
+  // The labels come before the references, and the offset of each is
+  // written as the difference from that of the previous one.
+  std::vector<size_t> deltas;
+  for (size_t i = 0; i < graph_data[0].size(); ++i) {
+    if (graph_data[0][i] != graph_data[1][i])
+      deltas.push_back(i);
+  }
+  ASSERT_EQ(2U, deltas.size());
+
+  // Each label is a delta and a string, and each reference a delta, a type,
+  // a size, a block id delta and an offset, all of them a byte long here.
+  // Copying the delta of the first entry, which is zero, to the second
+  // places both at the same offset.
+  const size_t kEntrySizes[] = { 2, 5 };
+  for (size_t i = 0; i < deltas.size(); ++i) {
+    std::vector<uint8> corrupt(graph_data[0]);
+    corrupt[deltas[i]] = corrupt[deltas[i] - kEntrySizes[i]];
+    BlockGraph image_copy;
+    CompactReader reader(&corrupt[0], corrupt.size());
+    EXPECT_FALSE(image_copy.LoadCompact(string_table, &reader));
+  }
+}
+
+// Loads a synthetic graph about the size of a decomposed Chrome DLL, then
+// visits every reference the way most transforms do. The load and walk times
+// and the peak working set are logged. Disabled by default because of its
+// size.
+TEST(BlockGraphTest, DISABLED_LargeGraphBenchmark) {
+  const size_t kNumBlocks = 500000;
+  const size_t kRefsPerBlock = 8;
+
+  ByteVector byte_vector;
+  {
+    BlockGraph image;
+    BuildSyntheticBlockGraph(kNumBlocks, kRefsPerBlock, &image);
+
+    ScopedOutStreamPtr out_stream(
+        CreateByteOutStream(std::back_inserter(byte_vector)));
+    NativeBinaryOutArchive out_archive(out_stream.get());
+    ASSERT_TRUE(out_archive.Save(image));
+  }
+
+  BlockGraph image;
+  base::Time start = base::Time::Now();
+  ScopedInStreamPtr in_stream(
+      CreateByteInStream(byte_vector.begin(), byte_vector.end()));
+  NativeBinaryInArchive in_archive(in_stream.get());
+  ASSERT_TRUE(in_archive.Load(&image));
+  base::TimeDelta load_time = base::Time::Now() - start;
+  ASSERT_EQ(kNumBlocks, image.blocks().size());
+
+  // Walk every reference and referrer of every block, as most of the
+  // transforms do.
+  start = base::Time::Now();
+  size_t num_refs = 0;
+  size_t num_referrers = 0;
+  BlockGraph::BlockMap::const_iterator it = image.blocks().begin();
+  for (; it != image.blocks().end(); ++it) {
+    const BlockGraph::Block& block = it->second;
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block.references().begin();
+    for (; ref_it != block.references().end(); ++ref_it) {
+      if (ref_it->second.referenced()->HasLabel(ref_it->second.offset()))
+        ++num_refs;
+    }
+    num_referrers += block.referrers().size();
+  }
+  base::TimeDelta traversal_time = base::Time::Now() - start;
+  EXPECT_EQ(num_refs, num_referrers);
+
+  LOG(INFO) << "Loaded " << kNumBlocks << " blocks in "
+            << load_time.InMilliseconds() << " ms.";
+  LOG(INFO) << "Traversed " << num_refs << " references in "
+            << traversal_time.InMilliseconds() << " ms.";
+  LOG(INFO) << "Peak working set: " << GetPeakWorkingSetSize() / 1024
+            << " KB.";
+}
+
+// Saves and reloads the same synthetic graph through a NativeBinaryOutArchive
+// and through the compact format, string table included, and logs the size
+// of each file and how long each round trip took. Disabled by default.
+TEST(BlockGraphTest, DISABLED_CompactSerializationBenchmark) {
+  const uint32 kBenchmarkMagic = 0xB10C;
+  const uint32 kGraphSectionTag = 1;
+  const uint32 kStringSectionTag = 2;
+  const size_t kNumBlocks = 500000;
+  const size_t kRefsPerBlock = 8;
+
+  BlockGraph image;
+  BuildSyntheticBlockGraph(kNumBlocks, kRefsPerBlock, &image);
+
+  // Save and load with the archive.
+  base::Time start = base::Time::Now();
+  ByteVector archive_data;
+  ScopedOutStreamPtr out_stream(
+      CreateByteOutStream(std::back_inserter(archive_data)));
+  NativeBinaryOutArchive out_archive(out_stream.get());
+  ASSERT_TRUE(out_archive.Save(image));
+  base::TimeDelta archive_save_time = base::Time::Now() - start;
+
+  start = base::Time::Now();
+  {
+    BlockGraph image_copy;
+    ScopedInStreamPtr in_stream(
+        CreateByteInStream(archive_data.begin(), archive_data.end()));
+    NativeBinaryInArchive in_archive(in_stream.get());
+    ASSERT_TRUE(in_archive.Load(&image_copy));
+  }
+  base::TimeDelta archive_load_time = base::Time::Now() - start;
+
+  // Save and load in the compact format, including the string table.
+  start = base::Time::Now();
+  SectionedFileWriter file_writer(kBenchmarkMagic, 1);
+  StringTableBuilder strings;
+  CompactWriter writer(file_writer.AddSection(kGraphSectionTag));
+  image.SaveCompact(&strings, &writer);
+  CompactWriter string_writer(file_writer.AddSection(kStringSectionTag));
+  strings.Write(&string_writer);
+  std::vector<uint8> compact_data;
+  file_writer.Finish(&compact_data);
+  base::TimeDelta compact_save_time = base::Time::Now() - start;
+
+  start = base::Time::Now();
+  {
+    SectionedFileReader file_reader;
+    ASSERT_TRUE(file_reader.Init(kBenchmarkMagic, 1, &compact_data[0],
+                                 compact_data.size()));
+    const uint8* data = NULL;
+    size_t size = 0;
+    StringTable string_table;
+    ASSERT_TRUE(file_reader.GetSection(kStringSectionTag, &data, &size));
+    ASSERT_TRUE(string_table.Init(data, size));
+    ASSERT_TRUE(file_reader.GetSection(kGraphSectionTag, &data, &size));
+    CompactReader reader(data, size);
+    BlockGraph image_copy;
+    ASSERT_TRUE(image_copy.LoadCompact(string_table, &reader));
+    ASSERT_EQ(kNumBlocks, image_copy.blocks().size());
+  }
+  base::TimeDelta compact_load_time = base::Time::Now() - start;
+
+  LOG(INFO) << "Archive: " << archive_data.size() / 1024 << " KB, saved in "
+            << archive_save_time.InMilliseconds() << " ms, loaded in "
+            << archive_load_time.InMilliseconds() << " ms.";
+  LOG(INFO) << "Compact: " << compact_data.size() / 1024 << " KB, saved in "
+            << compact_save_time.InMilliseconds() << " ms, loaded in "
+            << compact_load_time.InMilliseconds() << " ms.";
+}
+
 }  // namespace core
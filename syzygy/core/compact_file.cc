@@ -0,0 +1,353 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/compact_file.h"
+
+#include <stdio.h>
+#include "base/file_path.h"
+#include "base/file_util.h"
+#include "base/logging.h"
+
+namespace core {
+
+namespace {
+
+// Sections start on this boundary, relative to the start of the file.
+const size_t kSectionAlignment = 4;
+
+// A 32-bit value encoded 7 bits at a time takes at most this many bytes.
+const size_t kMaxVarUintSize = 5;
+
+}  // namespace
+
+CompactWriter::CompactWriter(std::vector<uint8>* buffer) : buffer_(buffer) {
+  DCHECK(buffer != NULL);
+}
+
+void CompactWriter::WriteUint32(uint32 value) {
+  uint8 bytes[sizeof(value)] = { static_cast<uint8>(value),
+                                 static_cast<uint8>(value >> 8),
+                                 static_cast<uint8>(value >> 16),
+                                 static_cast<uint8>(value >> 24) };
+  buffer_->insert(buffer_->end(), bytes, bytes + sizeof(bytes));
+}
+
+void CompactWriter::WriteVarUint(uint32 value) {
+  while (value >= 0x80) {
+    buffer_->push_back(static_cast<uint8>(value | 0x80));
+    value >>= 7;
+  }
+  buffer_->push_back(static_cast<uint8>(value));
+}
+
+void CompactWriter::WriteVarInt(int32 value) {
+  // Zigzag encoding maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+  WriteVarUint((static_cast<uint32>(value) << 1) ^
+               static_cast<uint32>(value >> 31));
+}
+
+void CompactWriter::WriteBytes(size_t length, const void* bytes) {
+  DCHECK(length == 0 || bytes != NULL);
+  const uint8* begin = reinterpret_cast<const uint8*>(bytes);
+  buffer_->insert(buffer_->end(), begin, begin + length);
+}
+
+void CompactWriter::Align(size_t alignment) {
+  DCHECK_LT(0U, alignment);
+  size_t remainder = buffer_->size() % alignment;
+  if (remainder != 0)
+    buffer_->resize(buffer_->size() + alignment - remainder, 0);
+}
+
+CompactReader::CompactReader(const uint8* data, size_t size)
+    : data_(data), size_(size), position_(0) {
+  DCHECK(size == 0 || data != NULL);
+}
+
+bool CompactReader::ReadUint32(uint32* value) {
+  DCHECK(value != NULL);
+  if (remaining() < sizeof(*value))
+    return false;
+
+  const uint8* bytes = data_ + position_;
+  *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+      (static_cast<uint32>(bytes[3]) << 24);
+  position_ += sizeof(*value);
+  return true;
+}
+
+bool CompactReader::ReadVarUint(uint32* value) {
+  DCHECK(value != NULL);
+
+  uint32 result = 0;
+  size_t position = position_;
+  for (size_t i = 0; i < kMaxVarUintSize; ++i) {
+    if (position == size_)
+      return false;
+    uint8 byte = data_[position++];
+    result |= static_cast<uint32>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      position_ = position;
+      return true;
+    }
+  }
+
+  // The encoding is longer than any 32-bit value needs.
+  return false;
+}
+
+bool CompactReader::ReadVarInt(int32* value) {
+  DCHECK(value != NULL);
+  uint32 encoded = 0;
+  if (!ReadVarUint(&encoded))
+    return false;
+  *value = static_cast<int32>((encoded >> 1) ^ (0 - (encoded & 1)));
+  return true;
+}
+
+bool CompactReader::ReadBytes(size_t length, const uint8** bytes) {
+  DCHECK(bytes != NULL);
+  if (remaining() < length)
+    return false;
+  *bytes = data_ + position_;
+  position_ += length;
+  return true;
+}
+
+bool CompactReader::Align(size_t alignment) {
+  DCHECK_LT(0U, alignment);
+  size_t remainder = position_ % alignment;
+  if (remainder == 0)
+    return true;
+  size_t padding = alignment - remainder;
+  if (remaining() < padding)
+    return false;
+  position_ += padding;
+  return true;
+}
+
+StringTableBuilder::StringTableBuilder() {
+}
+
+uint32 StringTableBuilder::Add(const std::string& str) {
+  std::pair<IndexMap::iterator, bool> result = indices_.insert(
+      std::make_pair(str, static_cast<uint32>(offsets_.size())));
+  if (result.second) {
+    offsets_.push_back(static_cast<uint32>(data_.size()));
+    data_.append(str);
+  }
+  return result.first->second;
+}
+
+void StringTableBuilder::Write(CompactWriter* writer) const {
+  DCHECK(writer != NULL);
+
+  // The count and offsets are fixed-width so that the table can be used in
+  // place. The final offset marks the end of the last string.
+  writer->WriteUint32(static_cast<uint32>(offsets_.size()));
+  for (size_t i = 0; i < offsets_.size(); ++i)
+    writer->WriteUint32(offsets_[i]);
+  writer->WriteUint32(static_cast<uint32>(data_.size()));
+  writer->WriteBytes(data_.size(), data_.data());
+}
+
+StringTable::StringTable() : count_(0), offsets_(NULL), data_(NULL) {
+}
+
+bool StringTable::Init(const uint8* data, size_t size) {
+  DCHECK(data != NULL);
+  DCHECK_EQ(0U, reinterpret_cast<uintptr_t>(data) % sizeof(uint32));
+
+  CompactReader reader(data, size);
+  uint32 count = 0;
+  const uint8* offsets = NULL;
+  if (!reader.ReadUint32(&count) ||
+      count >= reader.remaining() / sizeof(uint32) ||
+      !reader.ReadBytes((count + 1) * sizeof(uint32), &offsets)) {
+    LOG(ERROR) << "String table is truncated.";
+    return false;
+  }
+
+  // The offsets must be increasing, and lie within the string data.
+  const uint32* offsets32 = reinterpret_cast<const uint32*>(offsets);
+  for (size_t i = 0; i < count; ++i) {
+    if (offsets32[i] > offsets32[i + 1]) {
+      LOG(ERROR) << "String table is malformed.";
+      return false;
+    }
+  }
+  if (offsets32[count] != reader.remaining()) {
+    LOG(ERROR) << "String table has an unexpected size.";
+    return false;
+  }
+
+  const uint8* strings = NULL;
+  bool read = reader.ReadBytes(reader.remaining(), &strings);
+  DCHECK(read);
+
+  count_ = count;
+  offsets_ = offsets32;
+  data_ = reinterpret_cast<const char*>(strings);
+  return true;
+}
+
+bool StringTable::Get(uint32 index, std::string* str) const {
+  DCHECK(str != NULL);
+  if (index >= count_)
+    return false;
+  str->assign(data_ + offsets_[index], data_ + offsets_[index + 1]);
+  return true;
+}
+
+SectionedFileWriter::SectionedFileWriter(uint32 magic, uint32 version)
+    : magic_(magic), version_(version) {
+}
+
+SectionedFileWriter::~SectionedFileWriter() {
+  for (size_t i = 0; i < sections_.size(); ++i)
+    delete sections_[i];
+}
+
+std::vector<uint8>* SectionedFileWriter::AddSection(uint32 tag) {
+  for (size_t i = 0; i < sections_.size(); ++i)
+    DCHECK_NE(tag, sections_[i]->tag);
+
+  Section* section = new Section;
+  section->tag = tag;
+  sections_.push_back(section);
+  return &section->data;
+}
+
+void SectionedFileWriter::Finish(std::vector<uint8>* buffer) const {
+  DCHECK(buffer != NULL);
+
+  buffer->clear();
+  CompactWriter writer(buffer);
+  writer.WriteUint32(magic_);
+  writer.WriteUint32(version_);
+  writer.WriteUint32(static_cast<uint32>(sections_.size()));
+
+  // Lay out the sections after the directory.
+  size_t offset = sizeof(CompactFileHeader) +
+      sections_.size() * sizeof(CompactSectionEntry);
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    offset += (kSectionAlignment - offset % kSectionAlignment) %
+        kSectionAlignment;
+    writer.WriteUint32(sections_[i]->tag);
+    writer.WriteUint32(static_cast<uint32>(offset));
+    writer.WriteUint32(static_cast<uint32>(sections_[i]->data.size()));
+    offset += sections_[i]->data.size();
+  }
+
+  buffer->reserve(offset);
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    writer.Align(kSectionAlignment);
+    const std::vector<uint8>& data = sections_[i]->data;
+    if (!data.empty())
+      writer.WriteBytes(data.size(), &data[0]);
+  }
+  DCHECK_EQ(offset, buffer->size());
+}
+
+bool SectionedFileWriter::WriteToFile(const FilePath& path) const {
+  std::vector<uint8> buffer;
+  Finish(&buffer);
+
+  file_util::ScopedFILE file(file_util::OpenFile(path, "wb"));
+  if (file.get() == NULL ||
+      fwrite(&buffer[0], 1, buffer.size(), file.get()) != buffer.size()) {
+    LOG(ERROR) << "Unable to write \"" << path.value() << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+SectionedFileReader::SectionedFileReader()
+    : data_(NULL), sections_(NULL), section_count_(0) {
+}
+
+bool SectionedFileReader::Init(uint32 magic,
+                               uint32 version,
+                               const uint8* data,
+                               size_t size) {
+  DCHECK(data != NULL);
+  DCHECK_EQ(0U, reinterpret_cast<uintptr_t>(data) % kSectionAlignment);
+
+  CompactReader reader(data, size);
+  uint32 file_magic = 0;
+  uint32 file_version = 0;
+  uint32 section_count = 0;
+  if (!reader.ReadUint32(&file_magic) || !reader.ReadUint32(&file_version) ||
+      !reader.ReadUint32(&section_count)) {
+    LOG(ERROR) << "File header is truncated.";
+    return false;
+  }
+
+  if (file_magic != magic) {
+    LOG(ERROR) << "File has an unexpected type.";
+    return false;
+  }
+
+  if (file_version != version) {
+    LOG(ERROR) << "File has version " << file_version << ", expected "
+               << version << ".";
+    return false;
+  }
+
+  const uint8* sections = NULL;
+  if (section_count > reader.remaining() / sizeof(CompactSectionEntry) ||
+      !reader.ReadBytes(section_count * sizeof(CompactSectionEntry),
+                        &sections)) {
+    LOG(ERROR) << "File section directory is truncated.";
+    return false;
+  }
+
+  const CompactSectionEntry* entries =
+      reinterpret_cast<const CompactSectionEntry*>(sections);
+  for (size_t i = 0; i < section_count; ++i) {
+    const CompactSectionEntry& entry = entries[i];
+    if (entry.offset > size || entry.size > size - entry.offset ||
+        entry.offset % kSectionAlignment != 0) {
+      LOG(ERROR) << "File section " << entry.tag << " is out of bounds.";
+      return false;
+    }
+  }
+
+  data_ = data;
+  sections_ = entries;
+  section_count_ = section_count;
+  return true;
+}
+
+bool SectionedFileReader::GetSection(uint32 tag,
+                                     const uint8** data,
+                                     size_t* size) const {
+  DCHECK(data != NULL);
+  DCHECK(size != NULL);
+
+  // There are only ever a handful of sections, so a linear search will do.
+  for (size_t i = 0; i < section_count_; ++i) {
+    if (sections_[i].tag == tag) {
+      *data = data_ + sections_[i].offset;
+      *size = sections_[i].size;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace core
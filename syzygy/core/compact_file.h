@@ -0,0 +1,255 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the building blocks of a compact, versioned binary file format.
+// Unlike the archives in serialization.h, which write one field at a time
+// through a virtual stream interface, these write to and read from flat byte
+// buffers. This means a file can be memory mapped and its contents read in
+// place, with fixed-width records read in bulk and everything else encoded
+// as variable length integers.
+//
+// A file consists of a header, a directory of sections and the sections
+// themselves. Each section is identified by a tag, and starts on a 4-byte
+// boundary so that arrays of fixed-width records can be read in place:
+//
+//   CompactFileHeader    header;
+//   CompactSectionEntry  sections[header.section_count];
+//   uint8                section_data[];
+//
+// Strings are typically stored once in a string table section, and referred
+// to elsewhere by their index.
+
+#ifndef SYZYGY_CORE_COMPACT_FILE_H_
+#define SYZYGY_CORE_COMPACT_FILE_H_
+
+#include <hash_map>
+#include <string>
+#include <vector>
+#include "base/basictypes.h"
+
+class FilePath;
+
+namespace core {
+
+// The header at the start of every sectioned file.
+struct CompactFileHeader {
+  uint32 magic;
+  uint32 version;
+  uint32 section_count;
+};
+
+// Describes a single section of a sectioned file. The offset is relative to
+// the start of the file.
+struct CompactSectionEntry {
+  uint32 tag;
+  uint32 offset;
+  uint32 size;
+};
+
+// Appends little-endian encoded values to a byte vector.
+class CompactWriter {
+ public:
+  // @param buffer the vector to which data is appended. This must outlive
+  //     the writer.
+  explicit CompactWriter(std::vector<uint8>* buffer);
+
+  // Writes a fixed-width 32-bit value.
+  void WriteUint32(uint32 value);
+
+  // Writes an unsigned value as a variable length integer, using 7 bits per
+  // byte. Values under 128 take a single byte.
+  void WriteVarUint(uint32 value);
+
+  // Writes a signed value as a variable length integer. The value is zigzag
+  // encoded first, so that values of small magnitude take few bytes
+  // regardless of their sign.
+  void WriteVarInt(int32 value);
+
+  // Writes @p length bytes from @p bytes.
+  void WriteBytes(size_t length, const void* bytes);
+
+  // Pads the buffer with zeros until its size is a multiple of @p alignment.
+  void Align(size_t alignment);
+
+  // Returns the number of bytes in the buffer.
+  size_t size() const { return buffer_->size(); }
+
+ private:
+  std::vector<uint8>* buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompactWriter);
+};
+
+// Reads values written by CompactWriter from a buffer. All reads are bounds
+// checked, and fail without consuming any data if the buffer is too short.
+class CompactReader {
+ public:
+  // @param data the buffer to read from. This must outlive the reader.
+  // @param size the size of the buffer.
+  CompactReader(const uint8* data, size_t size);
+
+  // Each of these reads a value written by the corresponding function of
+  // CompactWriter.
+  // @returns true on success, false if the data is truncated or malformed.
+  bool ReadUint32(uint32* value);
+  bool ReadVarUint(uint32* value);
+  bool ReadVarInt(int32* value);
+
+  // Reads @p length bytes in place.
+  // @param bytes on success, is set to point to the bytes in the underlying
+  //     buffer.
+  // @returns true on success, false if fewer than @p length bytes remain.
+  bool ReadBytes(size_t length, const uint8** bytes);
+
+  // Skips the padding written by CompactWriter::Align. Alignment is relative
+  // to the start of the buffer.
+  // @returns true on success, false if the buffer ends in the padding.
+  bool Align(size_t alignment);
+
+  // Returns the number of bytes left to read.
+  size_t remaining() const { return size_ - position_; }
+
+ private:
+  const uint8* data_;
+  size_t size_;
+  size_t position_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompactReader);
+};
+
+// Accumulates a table of unique strings, and assigns each an index.
+class StringTableBuilder {
+ public:
+  StringTableBuilder();
+
+  // Adds @p str to the table, unless it's already there.
+  // @returns the index of @p str in the table.
+  uint32 Add(const std::string& str);
+
+  // Writes the table. It may be read back with StringTable.
+  void Write(CompactWriter* writer) const;
+
+  // Returns the number of unique strings in the table.
+  size_t size() const { return offsets_.size(); }
+
+ private:
+  typedef stdext::hash_map<std::string, uint32> IndexMap;
+
+  // Maps each string to its index.
+  IndexMap indices_;
+  // The offset of each string in data_, in order of index.
+  std::vector<uint32> offsets_;
+  // The concatenated strings.
+  std::string data_;
+
+  DISALLOW_COPY_AND_ASSIGN(StringTableBuilder);
+};
+
+// A read-only view of a string table written by StringTableBuilder. The
+// strings are not copied, so the underlying buffer must outlive the table.
+class StringTable {
+ public:
+  StringTable();
+
+  // Initializes the table from the buffer @p data of @p size bytes.
+  // @returns true on success, false if the table is malformed.
+  bool Init(const uint8* data, size_t size);
+
+  // Retrieves the string with the given @p index.
+  // @returns true on success, false if @p index is out of range.
+  bool Get(uint32 index, std::string* str) const;
+
+  // Returns the number of strings in the table.
+  size_t size() const { return count_; }
+
+ private:
+  // The number of strings.
+  size_t count_;
+  // The offsets of the strings, with an extra offset marking the end of the
+  // last one.
+  const uint32* offsets_;
+  // The concatenated strings.
+  const char* data_;
+
+  DISALLOW_COPY_AND_ASSIGN(StringTable);
+};
+
+// Builds a sectioned file in memory.
+class SectionedFileWriter {
+ public:
+  // @param magic identifies the type of file.
+  // @param version the version of the file format.
+  SectionedFileWriter(uint32 magic, uint32 version);
+  ~SectionedFileWriter();
+
+  // Adds a new, empty section.
+  // @param tag the tag of the section, which must be unique within the file.
+  // @returns the buffer holding the section's contents. This remains valid
+  //     for the lifetime of the writer.
+  std::vector<uint8>* AddSection(uint32 tag);
+
+  // Lays out the file and writes it to @p buffer, replacing its contents.
+  void Finish(std::vector<uint8>* buffer) const;
+
+  // Lays out the file and writes it to @p path.
+  // @returns true on success, false otherwise.
+  bool WriteToFile(const FilePath& path) const;
+
+ private:
+  struct Section {
+    uint32 tag;
+    std::vector<uint8> data;
+  };
+
+  uint32 magic_;
+  uint32 version_;
+  // The sections are allocated individually so that the buffers handed out
+  // by AddSection aren't moved by later additions.
+  std::vector<Section*> sections_;
+
+  DISALLOW_COPY_AND_ASSIGN(SectionedFileWriter);
+};
+
+// Provides access to the sections of a sectioned file held in memory. The
+// contents are not copied, so the buffer must outlive the reader.
+class SectionedFileReader {
+ public:
+  SectionedFileReader();
+
+  // Initializes the reader from @p size bytes at @p data, validating the
+  // header and section directory.
+  // @param magic the expected type of file.
+  // @param version the expected version of the file format. Files of any
+  //     other version are rejected.
+  // @returns true on success, false otherwise.
+  bool Init(uint32 magic, uint32 version, const uint8* data, size_t size);
+
+  // Looks up a section.
+  // @param tag the tag of the section to find.
+  // @param data on success, points to the contents of the section.
+  // @param size on success, is set to the size of the section.
+  // @returns true on success, false if there is no such section.
+  bool GetSection(uint32 tag, const uint8** data, size_t* size) const;
+
+ private:
+  const uint8* data_;
+  const CompactSectionEntry* sections_;
+  size_t section_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(SectionedFileReader);
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_COMPACT_FILE_H_
@@ -0,0 +1,236 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/compact_file.h"
+
+#include "gtest/gtest.h"
+
+namespace core {
+
+namespace {
+
+const uint32 kMagic = 0xC0FFEE;
+const uint32 kVersion = 3;
+
+}  // namespace
+
+TEST(CompactFileTest, Uint32RoundTrip) {
+  std::vector<uint8> buffer;
+  CompactWriter writer(&buffer);
+  writer.WriteUint32(0);
+  writer.WriteUint32(0x12345678);
+  writer.WriteUint32(0xFFFFFFFF);
+  ASSERT_EQ(12U, buffer.size());
+
+  // Values are little-endian.
+  EXPECT_EQ(0x78, buffer[4]);
+  EXPECT_EQ(0x12, buffer[7]);
+
+  CompactReader reader(&buffer[0], buffer.size());
+  uint32 value = 1;
+  EXPECT_TRUE(reader.ReadUint32(&value));
+  EXPECT_EQ(0U, value);
+  EXPECT_TRUE(reader.ReadUint32(&value));
+  EXPECT_EQ(0x12345678U, value);
+  EXPECT_TRUE(reader.ReadUint32(&value));
+  EXPECT_EQ(0xFFFFFFFFU, value);
+  EXPECT_EQ(0U, reader.remaining());
+  EXPECT_FALSE(reader.ReadUint32(&value));
+}
+
+TEST(CompactFileTest, VarUintRoundTrip) {
+  const uint32 kValues[] = { 0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0xFFFFFFFF };
+  const size_t kSizes[] = { 1, 1, 1, 2, 2, 3, 5 };
+
+  std::vector<uint8> buffer;
+  CompactWriter writer(&buffer);
+  for (size_t i = 0; i < arraysize(kValues); ++i) {
+    size_t size = writer.size();
+    writer.WriteVarUint(kValues[i]);
+    EXPECT_EQ(kSizes[i], writer.size() - size);
+  }
+
+  CompactReader reader(&buffer[0], buffer.size());
+  for (size_t i = 0; i < arraysize(kValues); ++i) {
+    uint32 value = 0;
+    EXPECT_TRUE(reader.ReadVarUint(&value));
+    EXPECT_EQ(kValues[i], value);
+  }
+  EXPECT_EQ(0U, reader.remaining());
+}
+
+TEST(CompactFileTest, VarIntRoundTrip) {
+  const int32 kValues[] = { 0, -1, 1, -64, 63, -65, 64, kint32max, kint32min };
+
+  std::vector<uint8> buffer;
+  CompactWriter writer(&buffer);
+  for (size_t i = 0; i < arraysize(kValues); ++i)
+    writer.WriteVarInt(kValues[i]);
+
+  // Small values take a single byte regardless of their sign.
+  EXPECT_EQ(0x01, buffer[1]);
+  EXPECT_EQ(0x02, buffer[2]);
+
+  CompactReader reader(&buffer[0], buffer.size());
+  for (size_t i = 0; i < arraysize(kValues); ++i) {
+    int32 value = 0;
+    EXPECT_TRUE(reader.ReadVarInt(&value));
+    EXPECT_EQ(kValues[i], value);
+  }
+  EXPECT_EQ(0U, reader.remaining());
+}
+
+TEST(CompactFileTest, ReadFailsOnMalformedVarUint) {
+  // Truncated in the middle of a value.
+  const uint8 kTruncated[] = { 0x80, 0x80 };
+  CompactReader truncated_reader(kTruncated, sizeof(kTruncated));
+  uint32 value = 0;
+  EXPECT_FALSE(truncated_reader.ReadVarUint(&value));
+  EXPECT_EQ(sizeof(kTruncated), truncated_reader.remaining());
+
+  // Longer than any 32-bit value.
+  const uint8 kTooLong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+  CompactReader too_long_reader(kTooLong, sizeof(kTooLong));
+  EXPECT_FALSE(too_long_reader.ReadVarUint(&value));
+}
+
+TEST(CompactFileTest, BytesAndAlignment) {
+  const uint8 kBytes[] = { 1, 2, 3 };
+
+  std::vector<uint8> buffer;
+  CompactWriter writer(&buffer);
+  writer.WriteBytes(sizeof(kBytes), kBytes);
+  writer.Align(4);
+  EXPECT_EQ(4U, writer.size());
+  writer.Align(4);
+  EXPECT_EQ(4U, writer.size());
+  writer.WriteUint32(42);
+
+  CompactReader reader(&buffer[0], buffer.size());
+  const uint8* bytes = NULL;
+  EXPECT_TRUE(reader.ReadBytes(sizeof(kBytes), &bytes));
+  EXPECT_EQ(&buffer[0], bytes);
+  EXPECT_TRUE(reader.Align(4));
+  uint32 value = 0;
+  EXPECT_TRUE(reader.ReadUint32(&value));
+  EXPECT_EQ(42U, value);
+
+  EXPECT_FALSE(reader.ReadBytes(1, &bytes));
+  EXPECT_TRUE(reader.ReadBytes(0, &bytes));
+}
+
+TEST(CompactFileTest, StringTable) {
+  StringTableBuilder builder;
+  EXPECT_EQ(0U, builder.Add("foo"));
+  EXPECT_EQ(1U, builder.Add(""));
+  EXPECT_EQ(2U, builder.Add("bar"));
+  EXPECT_EQ(0U, builder.Add("foo"));
+  EXPECT_EQ(3U, builder.size());
+
+  std::vector<uint8> buffer;
+  CompactWriter writer(&buffer);
+  builder.Write(&writer);
+
+  StringTable table;
+  ASSERT_TRUE(table.Init(&buffer[0], buffer.size()));
+  EXPECT_EQ(3U, table.size());
+
+  std::string str;
+  EXPECT_TRUE(table.Get(0, &str));
+  EXPECT_EQ("foo", str);
+  EXPECT_TRUE(table.Get(1, &str));
+  EXPECT_EQ("", str);
+  EXPECT_TRUE(table.Get(2, &str));
+  EXPECT_EQ("bar", str);
+  EXPECT_FALSE(table.Get(3, &str));
+}
+
+TEST(CompactFileTest, StringTableFailsOnMalformedData) {
+  StringTableBuilder builder;
+  builder.Add("foo");
+  builder.Add("bar");
+
+  std::vector<uint8> buffer;
+  CompactWriter writer(&buffer);
+  builder.Write(&writer);
+
+  StringTable table;
+  EXPECT_FALSE(table.Init(&buffer[0], buffer.size() - 1));
+  EXPECT_FALSE(table.Init(&buffer[0], 8));
+
+  // Make the offsets decrease.
+  buffer[8] = 0xFF;
+  EXPECT_FALSE(table.Init(&buffer[0], buffer.size()));
+}
+
+TEST(CompactFileTest, SectionedFileRoundTrip) {
+  SectionedFileWriter file_writer(kMagic, kVersion);
+  CompactWriter writer1(file_writer.AddSection(7));
+  writer1.WriteVarUint(300);
+  // This section is left empty.
+  file_writer.AddSection(9);
+  CompactWriter writer2(file_writer.AddSection(8));
+  writer2.WriteUint32(0xDEADBEEF);
+
+  std::vector<uint8> buffer;
+  file_writer.Finish(&buffer);
+
+  SectionedFileReader file_reader;
+  ASSERT_TRUE(file_reader.Init(kMagic, kVersion, &buffer[0], buffer.size()));
+
+  const uint8* data = NULL;
+  size_t size = 0;
+  ASSERT_TRUE(file_reader.GetSection(7, &data, &size));
+  EXPECT_EQ(2U, size);
+  CompactReader reader1(data, size);
+  uint32 value = 0;
+  EXPECT_TRUE(reader1.ReadVarUint(&value));
+  EXPECT_EQ(300U, value);
+
+  // Sections are aligned, so that fixed-width values can be read in place.
+  ASSERT_TRUE(file_reader.GetSection(8, &data, &size));
+  EXPECT_EQ(4U, size);
+  EXPECT_EQ(0U, (data - &buffer[0]) % 4);
+  EXPECT_EQ(0xDEADBEEF, *reinterpret_cast<const uint32*>(data));
+
+  ASSERT_TRUE(file_reader.GetSection(9, &data, &size));
+  EXPECT_EQ(0U, size);
+
+  EXPECT_FALSE(file_reader.GetSection(10, &data, &size));
+}
+
+TEST(CompactFileTest, SectionedFileRejectsMismatches) {
+  SectionedFileWriter file_writer(kMagic, kVersion);
+  CompactWriter writer(file_writer.AddSection(1));
+  writer.WriteUint32(1);
+
+  std::vector<uint8> buffer;
+  file_writer.Finish(&buffer);
+
+  SectionedFileReader file_reader;
+  EXPECT_FALSE(file_reader.Init(kMagic + 1, kVersion, &buffer[0],
+                                buffer.size()));
+  EXPECT_FALSE(file_reader.Init(kMagic, kVersion + 1, &buffer[0],
+                                buffer.size()));
+
+  // Truncated in the directory, and in the section data.
+  EXPECT_FALSE(file_reader.Init(kMagic, kVersion, &buffer[0],
+                                sizeof(CompactFileHeader) + 1));
+  EXPECT_FALSE(file_reader.Init(kMagic, kVersion, &buffer[0],
+                                buffer.size() - 1));
+
+  EXPECT_TRUE(file_reader.Init(kMagic, kVersion, &buffer[0], buffer.size()));
+}
+
+}  // namespace core
@@ -30,12 +30,18 @@
         'address.h',
         'address_space.cc',
         'address_space.h',
+        'arena_map.h',
         'basic_block_disassembler.cc',
         'basic_block_disassembler.h',
         'block_graph.cc',
         'block_graph.h',
+        'compact_file.cc',
+        'compact_file.h',
         'disassembler.cc',
         'disassembler.h',
+        'flat_map.h',
+        'parallel_loop.cc',
+        'parallel_loop.h',
         'random_number_generator.cc',
         'random_number_generator.h',
         'serialization.cc',
@@ -67,12 +73,16 @@
       'sources': [
         'address_unittest.cc',
         'address_space_unittest.cc',
+        'arena_map_unittest.cc',
         'basic_block_disassembler_unittest.cc',
         'basic_block_test_code.asm',
         'block_graph_unittest.cc',
+        'compact_file_unittest.cc',
         'core_unittests_main.cc',
         'disassembler_test_code.asm',
         'disassembler_unittest.cc',
+        'flat_map_unittest.cc',
+        'parallel_loop_unittest.cc',
         'serialization_unittest.cc',
       ],
       'dependencies': [
@@ -0,0 +1,295 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares FlatMap and FlatSet, sorted associative containers that keep their
+// elements in a single contiguous vector. They provide the subset of the
+// std::map and std::set interfaces that is used throughout syzygy, and
+// serialize to the same format as the standard containers.
+//
+// Lookups are branch-free binary searches over contiguous memory and iteration
+// is a linear walk, which makes these a good deal cheaper than the node based
+// containers for the many small maps that hang off each block in a BlockGraph.
+// Insertion and removal are linear in the size of the container, but inserting
+// in increasing key order (the common case) is amortized constant, and range
+// insertion sorts and merges in a single pass.
+//
+// NOTE: Unlike the node based containers, insertion and removal invalidate
+//     all iterators into the container.
+
+#ifndef SYZYGY_CORE_FLAT_MAP_H_
+#define SYZYGY_CORE_FLAT_MAP_H_
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "base/logging.h"
+
+namespace core {
+
+namespace internal {
+
+// Extracts the key from a FlatMap value.
+template<typename Key, typename Value> struct FlatMapKeyOf {
+  const Key& operator()(const std::pair<Key, Value>& value) const {
+    return value.first;
+  }
+};
+
+// Extracts the key from a FlatSet value, which is the value itself.
+template<typename Key> struct FlatSetKeyOf {
+  const Key& operator()(const Key& value) const {
+    return value;
+  }
+};
+
+// The shared implementation of FlatMap and FlatSet. Maintains a vector of
+// ValueType sorted by the key returned by KeyOf, with unique keys.
+template<typename Key, typename ValueType, typename KeyOf, typename Compare>
+class FlatTree {
+ public:
+  typedef Key key_type;
+  typedef ValueType value_type;
+  typedef Compare key_compare;
+  typedef std::vector<ValueType> ValueVector;
+  typedef typename ValueVector::size_type size_type;
+  typedef typename ValueVector::difference_type difference_type;
+  typedef typename ValueVector::reference reference;
+  typedef typename ValueVector::const_reference const_reference;
+  typedef typename ValueVector::iterator iterator;
+  typedef typename ValueVector::const_iterator const_iterator;
+  typedef typename ValueVector::reverse_iterator reverse_iterator;
+  typedef typename ValueVector::const_reverse_iterator const_reverse_iterator;
+
+  FlatTree() {
+  }
+
+  // Iterators.
+  iterator begin() { return values_.begin(); }
+  const_iterator begin() const { return values_.begin(); }
+  iterator end() { return values_.end(); }
+  const_iterator end() const { return values_.end(); }
+  reverse_iterator rbegin() { return values_.rbegin(); }
+  const_reverse_iterator rbegin() const { return values_.rbegin(); }
+  reverse_iterator rend() { return values_.rend(); }
+  const_reverse_iterator rend() const { return values_.rend(); }
+
+  // Capacity.
+  bool empty() const { return values_.empty(); }
+  size_type size() const { return values_.size(); }
+  void reserve(size_type size) { values_.reserve(size); }
+
+  // Inserts @p value unless an element with an equivalent key exists.
+  // @returns an iterator to the element with the key of @p value, and true
+  //     iff @p value was inserted.
+  std::pair<iterator, bool> insert(const value_type& value) {
+    const Key& key = KeyOf()(value);
+
+    // Fast path for the common case of insertion in increasing key order.
+    if (values_.empty() || Compare()(KeyOf()(values_.back()), key)) {
+      values_.push_back(value);
+      return std::make_pair(values_.end() - 1, true);
+    }
+
+    iterator it = lower_bound(key);
+    if (it != values_.end() && !Compare()(key, KeyOf()(*it)))
+      return std::make_pair(it, false);
+
+    it = values_.insert(it, value);
+    return std::make_pair(it, true);
+  }
+
+  // Inserts all the values in [@p first, @p last), skipping those whose key
+  // is already present. This sorts and merges the new values in one go, so
+  // it is much cheaper than inserting them one at a time.
+  template<typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    size_type old_size = values_.size();
+    values_.insert(values_.end(), first, last);
+    iterator middle = values_.begin() + old_size;
+
+    // Both the sort and the merge are stable, so the first of several values
+    // with equivalent keys is the one that was already present or, failing
+    // that, the one that came first in the input. That's the one we keep.
+    std::stable_sort(middle, values_.end(), ValueCompare());
+    std::inplace_merge(values_.begin(), middle, values_.end(), ValueCompare());
+    values_.erase(std::unique(values_.begin(), values_.end(),
+                              ValueEquivalent()),
+                  values_.end());
+  }
+
+  // Removes the element at @p it.
+  void erase(iterator it) { values_.erase(it); }
+  // Removes the elements in [@p first, @p last).
+  void erase(iterator first, iterator last) { values_.erase(first, last); }
+  // Removes the element with key @p key.
+  // @returns the number of elements removed.
+  size_type erase(const key_type& key) {
+    iterator it = find(key);
+    if (it == values_.end())
+      return 0;
+    values_.erase(it);
+    return 1;
+  }
+
+  void clear() { values_.clear(); }
+  void swap(FlatTree& other) { values_.swap(other.values_); }
+
+  // Lookup.
+  iterator find(const key_type& key) {
+    iterator it = lower_bound(key);
+    if (it == values_.end() || Compare()(key, KeyOf()(*it)))
+      return values_.end();
+    return it;
+  }
+  const_iterator find(const key_type& key) const {
+    return const_cast<FlatTree*>(this)->find(key);
+  }
+  size_type count(const key_type& key) const {
+    return find(key) == values_.end() ? 0 : 1;
+  }
+
+  iterator lower_bound(const key_type& key) {
+    if (values_.empty())
+      return values_.end();
+
+    // This is a branch-free binary search. The loop runs a number of times
+    // that depends only on the size of the container, and the comparison
+    // selects the next base rather than branching on it, which compilers turn
+    // into a conditional move. This avoids the mispredicted branches that
+    // dominate the cost of a conventional binary search.
+    const value_type* base = &values_[0];
+    size_type count = values_.size();
+    while (count > 1) {
+      size_type half = count / 2;
+      base = Compare()(KeyOf()(base[half]), key) ? base + half : base;
+      count -= half;
+    }
+    if (Compare()(KeyOf()(*base), key))
+      ++base;
+
+    return values_.begin() + (base - &values_[0]);
+  }
+  const_iterator lower_bound(const key_type& key) const {
+    return const_cast<FlatTree*>(this)->lower_bound(key);
+  }
+  iterator upper_bound(const key_type& key) {
+    iterator it = lower_bound(key);
+    if (it != values_.end() && !Compare()(key, KeyOf()(*it)))
+      ++it;
+    return it;
+  }
+  const_iterator upper_bound(const key_type& key) const {
+    return const_cast<FlatTree*>(this)->upper_bound(key);
+  }
+
+  bool operator==(const FlatTree& other) const {
+    return values_ == other.values_;
+  }
+  bool operator!=(const FlatTree& other) const {
+    return values_ != other.values_;
+  }
+
+  // Serialization. This matches the layout used for std::map and std::set,
+  // so archives written with either container type are interchangeable.
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    DCHECK(out_archive != NULL);
+    if (!out_archive->Save(values_.size()))
+      return false;
+    const_iterator it = values_.begin();
+    for (; it != values_.end(); ++it) {
+      if (!out_archive->Save(*it))
+        return false;
+    }
+    return true;
+  }
+
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    DCHECK(in_archive != NULL);
+    values_.clear();
+    size_type size = 0;
+    if (!in_archive->Load(&size))
+      return false;
+    values_.reserve(size);
+    for (size_type i = 0; i < size; ++i) {
+      value_type value;
+      if (!in_archive->Load(&value))
+        return false;
+      if (!insert(value).second)
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  // Orders values by their keys.
+  struct ValueCompare {
+    bool operator()(const value_type& value1,
+                    const value_type& value2) const {
+      return Compare()(KeyOf()(value1), KeyOf()(value2));
+    }
+  };
+
+  // Determines whether two values have equivalent keys.
+  struct ValueEquivalent {
+    bool operator()(const value_type& value1,
+                    const value_type& value2) const {
+      return !Compare()(KeyOf()(value1), KeyOf()(value2)) &&
+          !Compare()(KeyOf()(value2), KeyOf()(value1));
+    }
+  };
+
+  ValueVector values_;
+};
+
+}  // namespace internal
+
+// A sorted map with unique keys, backed by a vector of key-value pairs.
+// Unlike std::map the key is not const in the value type, so that the values
+// may be stored contiguously. Callers must not modify the keys of elements
+// through iterators.
+template<typename Key, typename Value, typename Compare = std::less<Key> >
+class FlatMap
+    : public internal::FlatTree<Key,
+                                std::pair<Key, Value>,
+                                internal::FlatMapKeyOf<Key, Value>,
+                                Compare> {
+ public:
+  typedef internal::FlatTree<Key,
+                             std::pair<Key, Value>,
+                             internal::FlatMapKeyOf<Key, Value>,
+                             Compare> Base;
+  typedef Value mapped_type;
+  typedef typename Base::value_type value_type;
+  typedef typename Base::iterator iterator;
+
+  // Returns a reference to the value mapped to @p key, inserting a default
+  // constructed value if there is none.
+  Value& operator[](const Key& key) {
+    return this->insert(value_type(key, Value())).first->second;
+  }
+};
+
+// A sorted set with unique keys, backed by a vector.
+template<typename Key, typename Compare = std::less<Key> >
+class FlatSet
+    : public internal::FlatTree<Key,
+                                Key,
+                                internal::FlatSetKeyOf<Key>,
+                                Compare> {
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_FLAT_MAP_H_
@@ -0,0 +1,201 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/core/flat_map.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/random_number_generator.h"
+#include "syzygy/core/unittest_util.h"
+
+namespace core {
+
+namespace {
+
+typedef FlatMap<int, std::string> IntStringMap;
+typedef FlatSet<int> IntSet;
+
+}  // namespace
+
+TEST(FlatMapTest, InsertAndFind) {
+  IntStringMap map;
+  EXPECT_TRUE(map.empty());
+
+  EXPECT_TRUE(map.insert(std::make_pair(5, "five")).second);
+  EXPECT_TRUE(map.insert(std::make_pair(1, "one")).second);
+  EXPECT_TRUE(map.insert(std::make_pair(3, "three")).second);
+  EXPECT_FALSE(map.insert(std::make_pair(3, "drei")).second);
+  EXPECT_EQ(3, map.size());
+
+  IntStringMap::const_iterator it = map.find(3);
+  ASSERT_TRUE(it != map.end());
+  EXPECT_EQ(3, it->first);
+  EXPECT_EQ("three", it->second);
+  EXPECT_TRUE(map.find(2) == map.end());
+  EXPECT_TRUE(map.find(6) == map.end());
+
+  EXPECT_EQ("five", map[5]);
+  map[4] = "four";
+  EXPECT_EQ(4, map.size());
+
+  // The elements should come out sorted.
+  std::vector<int> keys;
+  for (it = map.begin(); it != map.end(); ++it)
+    keys.push_back(it->first);
+  EXPECT_THAT(keys, testing::ElementsAre(1, 3, 4, 5));
+}
+
+TEST(FlatMapTest, Bounds) {
+  IntStringMap map;
+  map[10] = "ten";
+  map[20] = "twenty";
+
+  EXPECT_EQ(10, map.lower_bound(5)->first);
+  EXPECT_EQ(10, map.lower_bound(10)->first);
+  EXPECT_EQ(20, map.upper_bound(10)->first);
+  EXPECT_EQ(20, map.lower_bound(11)->first);
+  EXPECT_TRUE(map.lower_bound(21) == map.end());
+  EXPECT_TRUE(map.upper_bound(20) == map.end());
+}
+
+TEST(FlatMapTest, LowerBoundMatchesStdLowerBound) {
+  // Exercise the branch-free search on every size up to a few dozen, and on
+  // every key in and around the container.
+  for (int size = 0; size < 40; ++size) {
+    IntSet set;
+    std::vector<int> keys;
+    for (int i = 0; i < size; ++i) {
+      set.insert(i * 2);
+      keys.push_back(i * 2);
+    }
+
+    for (int key = -1; key <= size * 2; ++key) {
+      EXPECT_EQ(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin(),
+                set.lower_bound(key) - set.begin());
+      EXPECT_EQ(std::upper_bound(keys.begin(), keys.end(), key) - keys.begin(),
+                set.upper_bound(key) - set.begin());
+    }
+  }
+}
+
+TEST(FlatMapTest, RangeInsert) {
+  IntStringMap map;
+  map[2] = "two";
+  map[4] = "four";
+
+  std::vector<std::pair<int, std::string> > values;
+  values.push_back(std::make_pair(5, "five"));
+  values.push_back(std::make_pair(4, "vier"));
+  values.push_back(std::make_pair(1, "one"));
+  values.push_back(std::make_pair(3, "three"));
+  values.push_back(std::make_pair(1, "eins"));
+  map.insert(values.begin(), values.end());
+
+  // Existing values win over new ones, and earlier new values win over later
+  // ones, just as with std::map.
+  std::map<int, std::string> expected;
+  expected[2] = "two";
+  expected[4] = "four";
+  expected.insert(values.begin(), values.end());
+  EXPECT_THAT(map, testing::ElementsAreArray(
+      std::vector<std::pair<int, std::string> >(expected.begin(),
+                                                expected.end())));
+}
+
+TEST(FlatMapTest, Erase) {
+  IntStringMap map;
+  map[1] = "one";
+  map[2] = "two";
+  map[3] = "three";
+
+  EXPECT_EQ(0, map.erase(4));
+  EXPECT_EQ(1, map.erase(2));
+  EXPECT_TRUE(map.find(2) == map.end());
+  map.erase(map.find(1));
+  EXPECT_EQ(1, map.size());
+  EXPECT_EQ(3, map.begin()->first);
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+}
+
+TEST(FlatMapTest, MatchesStdMap) {
+  IntStringMap flat_map;
+  std::map<int, std::string> std_map;
+  RandomNumberGenerator random(12345);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    int key = random(500);
+    std::string value(1, 'a' + random(26));
+    if (random(4) == 0) {
+      EXPECT_EQ(std_map.erase(key), flat_map.erase(key));
+    } else {
+      EXPECT_EQ(std_map.insert(std::make_pair(key, value)).second,
+                flat_map.insert(std::make_pair(key, value)).second);
+    }
+  }
+
+  EXPECT_THAT(flat_map, testing::ElementsAreArray(
+      std::vector<std::pair<int, std::string> >(std_map.begin(),
+                                                std_map.end())));
+}
+
+TEST(FlatMapTest, Serialization) {
+  IntStringMap map;
+  map[1] = "one";
+  map[7] = "seven";
+  map[42] = "forty two";
+  EXPECT_TRUE(testing::TestSerialization(map));
+
+  // The serialized form matches that of the equivalent std::map.
+  std::map<int, std::string> std_map(map.begin(), map.end());
+  ByteVector flat_bytes;
+  ScopedOutStreamPtr out_stream;
+  out_stream.reset(CreateByteOutStream(std::back_inserter(flat_bytes)));
+  NativeBinaryOutArchive flat_archive(out_stream.get());
+  EXPECT_TRUE(flat_archive.Save(map));
+
+  ByteVector std_bytes;
+  out_stream.reset(CreateByteOutStream(std::back_inserter(std_bytes)));
+  NativeBinaryOutArchive std_archive(out_stream.get());
+  EXPECT_TRUE(std_archive.Save(std_map));
+
+  EXPECT_EQ(std_bytes, flat_bytes);
+}
+
+TEST(FlatSetTest, InsertFindErase) {
+  IntSet set;
+  EXPECT_TRUE(set.insert(3).second);
+  EXPECT_TRUE(set.insert(1).second);
+  EXPECT_TRUE(set.insert(2).second);
+  EXPECT_FALSE(set.insert(2).second);
+  EXPECT_THAT(set, testing::ElementsAre(1, 2, 3));
+
+  EXPECT_EQ(1, set.count(1));
+  EXPECT_EQ(0, set.count(4));
+
+  EXPECT_EQ(1, set.erase(1));
+  EXPECT_EQ(0, set.erase(1));
+  EXPECT_THAT(set, testing::ElementsAre(2, 3));
+
+  IntSet other;
+  other.insert(3);
+  EXPECT_TRUE(set != other);
+  other.insert(2);
+  EXPECT_TRUE(set == other);
+}
+
+}  // namespace core
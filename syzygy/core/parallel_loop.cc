@@ -0,0 +1,80 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/parallel_loop.h"
+
+#include "base/atomicops.h"
+#include "base/basictypes.h"
+#include "base/logging.h"
+#include "base/threading/simple_thread.h"
+
+namespace {
+
+// Each thread in the pool runs this, pulling indices from a shared counter
+// until they run out.
+class ParallelLoopWorker : public base::DelegateSimpleThread::Delegate {
+ public:
+  ParallelLoopWorker(size_t count, core::ParallelLoopBody* body)
+      : count_(count), body_(body), next_index_(0) {
+    DCHECK(body != NULL);
+    DCHECK_GE(static_cast<size_t>(kint32max), count);
+  }
+
+  virtual void Run() {
+    while (true) {
+      // The increment returns the incremented value, so the index we've
+      // claimed is one less.
+      size_t index = static_cast<size_t>(
+          base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1)) - 1;
+      if (index >= count_)
+        return;
+      body_->Run(index);
+    }
+  }
+
+ private:
+  const size_t count_;
+  core::ParallelLoopBody* body_;
+  volatile base::subtle::Atomic32 next_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelLoopWorker);
+};
+
+}  // namespace
+
+namespace core {
+
+void RunParallelLoop(size_t count,
+                     size_t num_threads,
+                     ParallelLoopBody* body) {
+  DCHECK(body != NULL);
+
+  if (num_threads > count)
+    num_threads = count;
+
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      body->Run(i);
+    return;
+  }
+
+  ParallelLoopWorker worker(count, body);
+  base::DelegateSimpleThreadPool pool("ParallelLoop",
+                                      static_cast<int>(num_threads));
+  pool.AddWork(&worker, static_cast<int>(num_threads));
+  pool.Start();
+  pool.JoinAll();
+}
+
+}  // namespace core
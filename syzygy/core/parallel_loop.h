@@ -0,0 +1,47 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a utility for running the independent iterations of a loop
+// concurrently on a pool of worker threads.
+
+#ifndef SYZYGY_CORE_PARALLEL_LOOP_H_
+#define SYZYGY_CORE_PARALLEL_LOOP_H_
+
+#include <stddef.h>
+
+namespace core {
+
+// The body of a loop run by RunParallelLoop.
+class ParallelLoopBody {
+ public:
+  virtual ~ParallelLoopBody() {
+  }
+
+  // Runs iteration @p index of the loop. This is called exactly once for each
+  // index, and may be called concurrently from several threads.
+  virtual void Run(size_t index) = 0;
+};
+
+// Runs @p body for each index in [0, @p count) on up to @p num_threads
+// threads, returning once every iteration has completed. Indices are handed
+// out one at a time to whichever thread is free next, so a few expensive
+// iterations don't leave the other threads idle. If @p num_threads is one or
+// less the iterations are run on the calling thread, in increasing order.
+void RunParallelLoop(size_t count,
+                     size_t num_threads,
+                     ParallelLoopBody* body);
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_PARALLEL_LOOP_H_
@@ -0,0 +1,105 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/parallel_loop.h"
+
+#include <vector>
+#include "gtest/gtest.h"
+
+namespace core {
+
+namespace {
+
+// Counts the number of times each index is visited, and the order in which
+// they're visited. This isn't thread-safe, so it's only for serial loops.
+class CountingBody : public ParallelLoopBody {
+ public:
+  explicit CountingBody(size_t count) : counts_(count, 0) {
+  }
+
+  virtual void Run(size_t index) {
+    ASSERT_GT(counts_.size(), index);
+    ++counts_[index];
+    order_.push_back(index);
+  }
+
+  bool AllVisitedOnce() const {
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      if (counts_[i] != 1)
+        return false;
+    }
+    return true;
+  }
+
+  const std::vector<size_t>& order() const { return order_; }
+
+ private:
+  std::vector<size_t> counts_;
+  std::vector<size_t> order_;
+};
+
+// Records the index it is run with, without touching any shared state.
+class RecordingBody : public ParallelLoopBody {
+ public:
+  explicit RecordingBody(size_t count) : results_(count, 0) {
+  }
+
+  virtual void Run(size_t index) {
+    results_[index] = index * index;
+  }
+
+  const std::vector<size_t>& results() const { return results_; }
+
+ private:
+  std::vector<size_t> results_;
+};
+
+}  // namespace
+
+TEST(ParallelLoopTest, EmptyLoop) {
+  CountingBody body(0);
+  RunParallelLoop(0, 4, &body);
+  EXPECT_TRUE(body.order().empty());
+}
+
+TEST(ParallelLoopTest, SerialLoopRunsInOrder) {
+  const size_t kCount = 100;
+  CountingBody body(kCount);
+  RunParallelLoop(kCount, 1, &body);
+
+  EXPECT_TRUE(body.AllVisitedOnce());
+  ASSERT_EQ(kCount, body.order().size());
+  for (size_t i = 0; i < kCount; ++i)
+    EXPECT_EQ(i, body.order()[i]);
+}
+
+TEST(ParallelLoopTest, ParallelLoopVisitsEachIndexOnce) {
+  const size_t kCount = 10000;
+  RecordingBody body(kCount);
+  RunParallelLoop(kCount, 4, &body);
+
+  for (size_t i = 0; i < kCount; ++i)
+    EXPECT_EQ(i * i, body.results()[i]);
+}
+
+TEST(ParallelLoopTest, MoreThreadsThanIterations) {
+  const size_t kCount = 3;
+  RecordingBody body(kCount);
+  RunParallelLoop(kCount, 16, &body);
+
+  for (size_t i = 0; i < kCount; ++i)
+    EXPECT_EQ(i * i, body.results()[i]);
+}
+
+}  // namespace core
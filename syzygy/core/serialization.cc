@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <dbghelp.h>
 #include <stdio.h>
+#include <string.h>
 
 namespace core {
 
@@ -36,6 +37,105 @@ bool FileInStream::Read(size_t length, Byte* bytes) {
   return fread(bytes, sizeof(Byte), length, file_) == length;
 }
 
+BufferedFileOutStream::BufferedFileOutStream(FILE* file)
+    : file_(file), buffer_(kDefaultBufferSize), buffer_used_(0) {
+  DCHECK(file != NULL);
+}
+
+BufferedFileOutStream::BufferedFileOutStream(FILE* file, size_t buffer_size)
+    : file_(file), buffer_(buffer_size), buffer_used_(0) {
+  DCHECK(file != NULL);
+  DCHECK_LT(0U, buffer_size);
+}
+
+BufferedFileOutStream::~BufferedFileOutStream() {
+  if (!Flush())
+    LOG(ERROR) << "Unable to write buffered data.";
+}
+
+bool BufferedFileOutStream::Write(size_t length, const Byte* bytes) {
+  // Small writes are gathered in the buffer.
+  if (length <= buffer_.size() - buffer_used_) {
+    memcpy(&buffer_[buffer_used_], bytes, length);
+    buffer_used_ += length;
+    return true;
+  }
+
+  if (!Flush())
+    return false;
+
+  // Writes that won't fit in the buffer go straight to the file.
+  if (length >= buffer_.size())
+    return fwrite(bytes, sizeof(Byte), length, file_) == length;
+
+  memcpy(&buffer_[0], bytes, length);
+  buffer_used_ = length;
+  return true;
+}
+
+bool BufferedFileOutStream::Flush() {
+  if (buffer_used_ == 0)
+    return true;
+  size_t length = buffer_used_;
+  buffer_used_ = 0;
+  return fwrite(&buffer_[0], sizeof(Byte), length, file_) == length;
+}
+
+BufferedFileInStream::BufferedFileInStream(FILE* file)
+    : file_(file), buffer_(kDefaultBufferSize), buffer_begin_(0),
+      buffer_end_(0) {
+  DCHECK(file != NULL);
+}
+
+BufferedFileInStream::BufferedFileInStream(FILE* file, size_t buffer_size)
+    : file_(file), buffer_(buffer_size), buffer_begin_(0), buffer_end_(0) {
+  DCHECK(file != NULL);
+  DCHECK_LT(0U, buffer_size);
+}
+
+bool BufferedFileInStream::Read(size_t length, Byte* bytes) {
+  while (length > 0) {
+    // Hand out whatever is buffered first.
+    size_t buffered = buffer_end_ - buffer_begin_;
+    if (buffered > 0) {
+      size_t chunk = std::min(length, buffered);
+      memcpy(bytes, &buffer_[buffer_begin_], chunk);
+      buffer_begin_ += chunk;
+      bytes += chunk;
+      length -= chunk;
+      continue;
+    }
+
+    // Reads that won't fit in the buffer go straight to the file.
+    if (length >= buffer_.size())
+      return fread(bytes, sizeof(Byte), length, file_) == length;
+
+    buffer_begin_ = 0;
+    buffer_end_ = fread(&buffer_[0], sizeof(Byte), buffer_.size(), file_);
+    if (buffer_end_ == 0)
+      return false;
+  }
+
+  return true;
+}
+
+ByteVectorOutStream::ByteVectorOutStream(ByteVector* vector)
+    : vector_(vector) {
+  DCHECK(vector != NULL);
+}
+
+bool ByteVectorOutStream::Write(size_t length, const Byte* bytes) {
+  // The minimum amount by which the vector is grown.
+  const size_t kMinGrowth = 64 * 1024;
+  size_t size = vector_->size();
+  if (vector_->capacity() - size < length) {
+    size_t growth = std::max(std::max(length, kMinGrowth), size);
+    vector_->reserve(size + growth);
+  }
+  vector_->insert(vector_->end(), bytes, bytes + length);
+  return true;
+}
+
 // Serialization of base::Time.
 // We serialize to 'number of seconds since epoch' (represented as a double)
 // as this is consistent regardless of the underlying representation used in
@@ -38,10 +38,18 @@
 // supported by default. Support can be added for further types by extending
 // the serialization system directly.
 //
-// There are currently two stream types defined: File*Stream, which uses a
-// FILE* under the hood; and Byte*Stream, which uses iterators to containers
-// of Bytes. Adding further stream types is trivial. Refer to to the comments/
-// declarations of File*Stream and Byte*Stream for details.
+// There are currently three stream types defined: File*Stream, which uses a
+// FILE* under the hood; BufferedFile*Stream, which does the same through a
+// large buffer of its own; and Byte*Stream, which uses iterators to
+// containers of Bytes, along with ByteVectorOutStream, which appends to a
+// ByteVector in bulk. Adding further stream types is trivial. Refer to to
+// the comments/declarations of File*Stream, BufferedFile*Stream and
+// Byte*Stream for details.
+//
+// Archives save each primitive value with a separate call to their stream,
+// so for anything larger than a handful of values BufferedFile*Stream should
+// be preferred to File*Stream. Vectors and strings of primitive types are
+// saved and loaded with a single call, through SaveRaw and LoadRaw.
 //
 // There is currently a single archive type defined, NativeBinary, which is a
 // non-portable binary format. Additional archive formats may be easily added
@@ -167,6 +175,58 @@ class FileInStream : public InStream {
   FILE* file_;
 };
 
+// An OutStream that writes to a FILE through a large buffer, so that saving
+// many small values results in a few large writes. The buffered data is
+// written when the buffer fills up, on Flush, and on destruction. It must be
+// flushed before the file is read or written by any other means.
+class BufferedFileOutStream : public OutStream {
+ public:
+  // The size of the buffer used by default.
+  static const size_t kDefaultBufferSize = 1024 * 1024;
+
+  explicit BufferedFileOutStream(FILE* file);
+  BufferedFileOutStream(FILE* file, size_t buffer_size);
+  virtual ~BufferedFileOutStream();
+
+  virtual bool Write(size_t length, const Byte* bytes);
+
+  // Writes out any buffered data.
+  // @returns true on success, false otherwise.
+  bool Flush();
+
+ private:
+  FILE* file_;
+  ByteVector buffer_;
+  // The number of bytes of buffer_ in use.
+  size_t buffer_used_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferedFileOutStream);
+};
+
+// An InStream that reads from a FILE through a large buffer, so that loading
+// many small values results in a few large reads. The stream reads ahead, so
+// the position of the file is undefined while it is in use.
+class BufferedFileInStream : public InStream {
+ public:
+  // The size of the buffer used by default.
+  static const size_t kDefaultBufferSize = 1024 * 1024;
+
+  explicit BufferedFileInStream(FILE* file);
+  BufferedFileInStream(FILE* file, size_t buffer_size);
+  virtual ~BufferedFileInStream() { }
+
+  virtual bool Read(size_t length, Byte* bytes);
+
+ private:
+  FILE* file_;
+  ByteVector buffer_;
+  // The range of buffer_ holding data that has yet to be read.
+  size_t buffer_begin_;
+  size_t buffer_end_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferedFileInStream);
+};
+
 // A simple OutStream wrapper for containers of bytes. Uses an output iterator
 // to push data to some container, or a pair of non-const iterators to write
 // data to a preallocated container. The underlying container should store
@@ -213,6 +273,23 @@ OutStream* CreateByteOutStream(OutputIterator iter, OutputIterator end) {
   return new ByteOutStream<OutputIterator>(iter, end);
 }
 
+// An OutStream that appends to a ByteVector. This does what a ByteOutStream
+// around back_inserter(*vector) does, but appends each write in bulk rather
+// than a byte at a time, and grows the vector in large steps, so that saving
+// many small values doesn't repeatedly reallocate it.
+class ByteVectorOutStream : public OutStream {
+ public:
+  explicit ByteVectorOutStream(ByteVector* vector);
+  virtual ~ByteVectorOutStream() { }
+
+  virtual bool Write(size_t length, const Byte* bytes);
+
+ private:
+  ByteVector* vector_;
+
+  DISALLOW_COPY_AND_ASSIGN(ByteVectorOutStream);
+};
+
 // A simple InStream wrapper for containers of bytes. Uses a range of input
 // iterators to traverse a container. The value type of the iterator must be
 // 'byte-like' (integer type of size 1). Use with ScopedInStreamPtr.
@@ -231,6 +308,14 @@ template<typename InputIterator> class ByteInStream : public InStream {
   virtual bool Read(size_t length, Byte* bytes);
 
  private:
+  typedef typename std::iterator_traits<InputIterator>::iterator_category
+      IteratorTag;
+
+  // Reads a byte at a time.
+  bool ReadImpl(size_t length, Byte* bytes, std::input_iterator_tag);
+  // Reads in bulk, which for pointers and vector iterators is a memcpy.
+  bool ReadImpl(size_t length, Byte* bytes, std::random_access_iterator_tag);
+
   InputIterator iter_;
   InputIterator end_;
 };
@@ -247,7 +332,7 @@ ByteInStream<InputIterator>* CreateByteInStream(InputIterator iter,
 class NativeBinaryOutArchive {
  public:
   // All classes implementing the OutArchive concept must implement the
-  // following 2 functions.
+  // following 3 functions.
 
   explicit NativeBinaryOutArchive(OutStream* out_stream)
       : out_stream_(out_stream) {
@@ -258,6 +343,16 @@ class NativeBinaryOutArchive {
     return core::Save(data, this);
   }
 
+  // Saves the @p count primitive values at @p values, as saving each of them
+  // in turn would. This is what vectors and strings of primitive types are
+  // saved with.
+  template<class Type> bool SaveRaw(const Type* values, size_t count) {
+    DCHECK(out_stream_ != NULL);
+    DCHECK(values != NULL || count == 0);
+    return out_stream_->Write(count * sizeof(Type),
+                              reinterpret_cast<const Byte*>(values));
+  }
+
   // The following are specializations for primitive data types. Every
   // OutArchive should implement these types directly.
 #define NATIVE_BINARY_OUT_ARCHIVE_SAVE(Type) \
@@ -295,7 +390,7 @@ typedef NativeBinaryOutArchive OutArchive;
 class NativeBinaryInArchive {
  public:
   // All classes implementing the InArchive concept must implement the
-  // following 3 functions.
+  // following 4 functions.
 
   explicit NativeBinaryInArchive(InStream* in_stream)
       : in_stream_(in_stream) {
@@ -306,6 +401,16 @@ class NativeBinaryInArchive {
     return core::Load(data, this);
   }
 
+  // Loads @p count primitive values to @p values, as loading each of them in
+  // turn would. This is what vectors and strings of primitive types are
+  // loaded with.
+  template<class Type> bool LoadRaw(Type* values, size_t count) {
+    DCHECK(in_stream_ != NULL);
+    DCHECK(values != NULL || count == 0);
+    return in_stream_->Read(count * sizeof(Type),
+                            reinterpret_cast<Byte*>(values));
+  }
+
   // The following are specializations for primitive data types. Every
   // InArchive should implement these types directly.
 #define NATIVE_BINARY_IN_ARCHIVE_LOAD(Type) \
@@ -19,6 +19,7 @@
 #ifndef SYZYGY_CORE_SERIALIZATION_IMPL_H_
 #define SYZYGY_CORE_SERIALIZATION_IMPL_H_
 
+#include <algorithm>
 #include <iterator>
 
 // Forward declare base::Time, defined in "base/time.h".
@@ -63,6 +64,32 @@ template<> struct IteratorsAreEqualFunctor<std::output_iterator_tag> {
   }
 };
 
+// This identifies the primitive types that NativeBinary archives save as
+// their raw bytes. A contiguous container of these can be saved or loaded
+// with a single call to SaveRaw or LoadRaw. bool is deliberately left out,
+// as std::vector<bool> isn't contiguous.
+template<typename T> struct IsRawSerializable {
+  enum { Value = 0 };
+};
+#define DECLARE_RAW_SERIALIZABLE(Type) \
+  template<> struct IsRawSerializable<Type> { \
+    enum { Value = 1 }; \
+  }
+DECLARE_RAW_SERIALIZABLE(char);
+DECLARE_RAW_SERIALIZABLE(wchar_t);
+DECLARE_RAW_SERIALIZABLE(float);
+DECLARE_RAW_SERIALIZABLE(double);
+DECLARE_RAW_SERIALIZABLE(int8);
+DECLARE_RAW_SERIALIZABLE(int16);
+DECLARE_RAW_SERIALIZABLE(int32);
+DECLARE_RAW_SERIALIZABLE(int64);
+DECLARE_RAW_SERIALIZABLE(uint8);
+DECLARE_RAW_SERIALIZABLE(uint16);
+DECLARE_RAW_SERIALIZABLE(uint32);
+DECLARE_RAW_SERIALIZABLE(uint64);
+DECLARE_RAW_SERIALIZABLE(unsigned long);
+#undef DECLARE_RAW_SERIALIZABLE
+
 // Serialization for STL containers. This expects the container to implement
 // 'size', and iterators.
 template<class Container, class OutArchive> bool SaveContainer(
@@ -120,6 +147,62 @@ bool LoadContainer(Container* container, OutputIterator output_iterator,
   return true;
 }
 
+// Serialization for contiguous STL containers (vector and basic_string). If
+// the value type is raw serializable, the values are saved and loaded in
+// bulk. The result is exactly what SaveContainer would produce.
+template<bool kIsRawSerializable> struct ContiguousContainerSerializer {
+  template<class Container, class OutArchive>
+  static bool Save(const Container& container, OutArchive* out_archive) {
+    return SaveContainer(container, out_archive);
+  }
+
+  template<class Container, class InArchive>
+  static bool Load(Container* container, InArchive* in_archive) {
+    container->clear();
+    return LoadContainer(container, std::back_inserter(*container),
+                         in_archive);
+  }
+};
+
+template<> struct ContiguousContainerSerializer<true> {
+  template<class Container, class OutArchive>
+  static bool Save(const Container& container, OutArchive* out_archive) {
+    DCHECK(out_archive != NULL);
+    if (!out_archive->Save(container.size()))
+      return false;
+    if (container.empty())
+      return true;
+    return out_archive->SaveRaw(&container[0], container.size());
+  }
+
+  template<class Container, class InArchive>
+  static bool Load(Container* container, InArchive* in_archive) {
+    DCHECK(container != NULL);
+    DCHECK(in_archive != NULL);
+
+    typedef typename Container::size_type SizeType;
+    typedef typename Container::value_type ValueType;
+
+    SizeType size = 0;
+    if (!in_archive->Load(&size))
+      return false;
+
+    // The container is grown a chunk at a time, so that a corrupt size makes
+    // for a failed read rather than an enormous allocation.
+    const SizeType kMaxChunkSize = (1024 * 1024) / sizeof(ValueType);
+    container->clear();
+    while (container->size() < size) {
+      SizeType offset = container->size();
+      SizeType chunk_size = std::min(size - offset, kMaxChunkSize);
+      container->resize(offset + chunk_size);
+      if (!in_archive->LoadRaw(&(*container)[offset], chunk_size))
+        return false;
+    }
+
+    return true;
+  }
+};
+
 }  // namespace internal
 
 template<typename OutputIterator> bool ByteOutStream<OutputIterator>::Write(
@@ -137,6 +220,11 @@ template<typename OutputIterator> bool ByteOutStream<OutputIterator>::Write(
 
 template<typename InputIterator> bool ByteInStream<InputIterator>::Read(
     size_t length, Byte* bytes) {
+  return ReadImpl(length, bytes, IteratorTag());
+}
+
+template<typename InputIterator> bool ByteInStream<InputIterator>::ReadImpl(
+    size_t length, Byte* bytes, std::input_iterator_tag) {
   for (size_t i = 0; i < length; ++i, ++bytes) {
     if (iter_ == end_)
       return false;
@@ -146,6 +234,16 @@ template<typename InputIterator> bool ByteInStream<InputIterator>::Read(
   return true;
 }
 
+template<typename InputIterator> bool ByteInStream<InputIterator>::ReadImpl(
+    size_t length, Byte* bytes, std::random_access_iterator_tag) {
+  if (static_cast<size_t>(end_ - iter_) < length)
+    return false;
+  InputIterator end = iter_ + length;
+  std::copy(iter_, end, bytes);
+  iter_ = end;
+  return true;
+}
+
 // Default implementations of core::Save and core::Load.
 
 // This delegates to Data::Save.
@@ -169,7 +267,8 @@ template<typename Char, typename Traits, typename Alloc, class OutArchive>
 bool Save(const std::basic_string<Char, Traits, Alloc>& string,
           OutArchive* out_archive) {
   DCHECK(out_archive != NULL);
-  return internal::SaveContainer(string, out_archive);
+  return internal::ContiguousContainerSerializer<
+      internal::IsRawSerializable<Char>::Value>::Save(string, out_archive);
 }
 
 template<typename Key, typename Data, typename Compare, typename Alloc,
@@ -198,7 +297,8 @@ template<typename Type, typename Alloc, class OutArchive>
 bool Save(const std::vector<Type, Alloc>& vector,
           OutArchive* out_archive) {
   DCHECK(out_archive != NULL);
-  return internal::SaveContainer(vector, out_archive);
+  return internal::ContiguousContainerSerializer<
+      internal::IsRawSerializable<Type>::Value>::Save(vector, out_archive);
 }
 
 // Implementation of STL Load specializations.
@@ -208,10 +308,8 @@ bool Load(std::basic_string<Char, Traits, Alloc>* string,
           InArchive* in_archive) {
   DCHECK(string != NULL);
   DCHECK(in_archive != NULL);
-  string->clear();
-  return internal::LoadContainer(string,
-                                 std::back_inserter(*string),
-                                 in_archive);
+  return internal::ContiguousContainerSerializer<
+      internal::IsRawSerializable<Char>::Value>::Load(string, in_archive);
 }
 
 template<typename Key, typename Data, typename Compare, typename Alloc,
@@ -250,9 +348,8 @@ bool Load(std::vector<Type, Alloc>* vector,
           InArchive* in_archive) {
   DCHECK(vector != NULL);
   DCHECK(in_archive != NULL);
-  return internal::LoadContainer(vector,
-                                 std::back_inserter(*vector),
-                                 in_archive);
+  return internal::ContiguousContainerSerializer<
+      internal::IsRawSerializable<Type>::Value>::Load(vector, in_archive);
 }
 
 // Implementation of serialization for C-style arrays.
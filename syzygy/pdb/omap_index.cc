@@ -0,0 +1,115 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/omap_index.h"
+
+#include <algorithm>
+#include "base/logging.h"
+
+namespace pdb {
+
+namespace {
+
+// The number of addresses TranslateBatch searches for in lockstep.
+const size_t kBatchSize = 8;
+
+bool OmapRvaLess(const OMAP& omap1, const OMAP& omap2) {
+  return omap1.rva < omap2.rva;
+}
+
+}  // namespace
+
+OmapIndex::OmapIndex() {
+}
+
+void OmapIndex::Init(const std::vector<OMAP>& omap) {
+  std::vector<OMAP> sorted(omap);
+  std::stable_sort(sorted.begin(), sorted.end(), OmapRvaLess);
+
+  rvas_.resize(sorted.size());
+  rvas_to_.resize(sorted.size());
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    rvas_[i] = sorted[i].rva;
+    rvas_to_[i] = sorted[i].rvaTo;
+  }
+}
+
+uint32 OmapIndex::Translate(uint32 address) const {
+  if (rvas_.empty())
+    return address;
+
+  // Narrow down the last entry not greater than the address. Each step
+  // halves the range without branching on the comparison.
+  const uint32* rvas = &rvas_[0];
+  size_t entry = 0;
+  for (size_t n = rvas_.size(); n > 1; n -= n / 2) {
+    size_t half = n / 2;
+    entry = rvas[entry + half] <= address ? entry + half : entry;
+  }
+
+  return TranslateWithEntry(entry, address);
+}
+
+void OmapIndex::TranslateBatch(size_t count,
+                               const uint32* addresses,
+                               uint32* translated) const {
+  DCHECK(count == 0 || addresses != NULL);
+  DCHECK(count == 0 || translated != NULL);
+
+  if (rvas_.empty()) {
+    std::copy(addresses, addresses + count, translated);
+    return;
+  }
+
+  // Every search takes the same sequence of steps, as these only depend on
+  // the size of the table. We can thus run a batch of searches in lockstep.
+  const uint32* rvas = &rvas_[0];
+  size_t i = 0;
+  for (; i + kBatchSize <= count; i += kBatchSize) {
+    uint32 batch[kBatchSize];
+    size_t entries[kBatchSize];
+    for (size_t j = 0; j < kBatchSize; ++j) {
+      batch[j] = addresses[i + j];
+      entries[j] = 0;
+    }
+
+    for (size_t n = rvas_.size(); n > 1; n -= n / 2) {
+      size_t half = n / 2;
+      for (size_t j = 0; j < kBatchSize; ++j) {
+        size_t probe = entries[j] + half;
+        entries[j] = rvas[probe] <= batch[j] ? probe : entries[j];
+      }
+    }
+
+    for (size_t j = 0; j < kBatchSize; ++j)
+      translated[i + j] = TranslateWithEntry(entries[j], batch[j]);
+  }
+
+  // Translate whatever doesn't fill a batch one at a time.
+  for (; i < count; ++i)
+    translated[i] = Translate(addresses[i]);
+}
+
+uint32 OmapIndex::TranslateWithEntry(size_t entry, uint32 address) const {
+  DCHECK_LT(entry, rvas_.size());
+
+  // The search only stops on an entry greater than the address when every
+  // entry is, in which case the address is before any that are mapped.
+  if (rvas_[entry] > address)
+    return address;
+
+  return rvas_to_[entry] + (address - rvas_[entry]);
+}
+
+}  // namespace pdb
@@ -0,0 +1,82 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares OmapIndex, which translates addresses through an OMAP table.
+
+#ifndef SYZYGY_PDB_OMAP_INDEX_H_
+#define SYZYGY_PDB_OMAP_INDEX_H_
+
+#include <windows.h>
+#include <dbghelp.h>
+#include <vector>
+#include "base/basictypes.h"
+
+namespace pdb {
+
+// An index over an OMAP table, which maps ranges of addresses in one image
+// to another. Each entry maps the addresses from its rva up to the next
+// entry's rva to the same offsets from its rvaTo. Addresses preceding the
+// first entry are left untouched. Either an OMAPTO or an OMAPFROM table may
+// be indexed; the decomposer only needs the latter.
+//
+// The table is stored as two parallel arrays, so that a search only touches
+// the source addresses, and is searched without data-dependent branches.
+// Batches of addresses are searched in lockstep, which lets the compiler
+// vectorize the search, and overlaps the cache misses of the searches.
+class OmapIndex {
+ public:
+  OmapIndex();
+
+  // Initializes the index from @p omap, replacing its contents.
+  // @param omap the table to index. This needn't be sorted.
+  void Init(const std::vector<OMAP>& omap);
+
+  // Translates a single address.
+  // @param address the address to translate.
+  // @returns the translated address.
+  uint32 Translate(uint32 address) const;
+
+  // Translates a batch of addresses. This is considerably faster than
+  // translating the addresses one at a time.
+  // @param count the number of addresses to translate.
+  // @param addresses the addresses to translate.
+  // @param translated receives the @p count translated addresses. This may
+  //     be the same as @p addresses.
+  void TranslateBatch(size_t count,
+                      const uint32* addresses,
+                      uint32* translated) const;
+
+  // Returns true if the index contains no entries, in which case all
+  // addresses translate to themselves.
+  bool empty() const { return rvas_.empty(); }
+
+  // Returns the number of entries in the index.
+  size_t size() const { return rvas_.size(); }
+
+ private:
+  // Returns the translation of @p address, given the index @p entry of the
+  // last entry whose rva isn't greater than @p address, if there is one.
+  uint32 TranslateWithEntry(size_t entry, uint32 address) const;
+
+  // The source addresses of the entries, in increasing order.
+  std::vector<uint32> rvas_;
+  // The destination addresses of the entries, in the same order.
+  std::vector<uint32> rvas_to_;
+
+  DISALLOW_COPY_AND_ASSIGN(OmapIndex);
+};
+
+}  // namespace pdb
+
+#endif  // SYZYGY_PDB_OMAP_INDEX_H_
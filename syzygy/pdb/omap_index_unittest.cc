@@ -0,0 +1,200 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/omap_index.h"
+
+#include <algorithm>
+#include "base/logging.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+
+namespace pdb {
+
+namespace {
+
+// The straightforward translation that OmapIndex should agree with.
+uint32 TranslateBySearch(const std::vector<OMAP>& omap, uint32 address) {
+  size_t entry = omap.size();
+  for (size_t i = 0; i < omap.size(); ++i) {
+    if (omap[i].rva <= address)
+      entry = i;
+  }
+  if (entry == omap.size())
+    return address;
+  return omap[entry].rvaTo + (address - omap[entry].rva);
+}
+
+bool OmapRvaLessForTest(const OMAP& omap1, const OMAP& omap2) {
+  return omap1.rva < omap2.rva;
+}
+
+// A simple linear congruential generator, so that the tests are repeatable.
+class SimpleRandom {
+ public:
+  explicit SimpleRandom(uint32 seed) : state_(seed) {
+  }
+
+  uint32 operator()(uint32 limit) {
+    state_ = state_ * 1664525 + 1013904223;
+    return (state_ >> 8) % limit;
+  }
+
+ private:
+  uint32 state_;
+};
+
+// Builds a table of @p count entries, mapping increasing ranges of random
+// size to shuffled destinations.
+void BuildRandomOmap(size_t count, SimpleRandom* random,
+                     std::vector<OMAP>* omap) {
+  omap->clear();
+  uint32 rva = 0x1000;
+  for (size_t i = 0; i < count; ++i) {
+    OMAP entry = { rva, 0x1000 + (*random)(0x10000000) };
+    omap->push_back(entry);
+    rva += (*random)(64) + 1;
+  }
+}
+
+}  // namespace
+
+TEST(OmapIndexTest, EmptyIndex) {
+  OmapIndex index;
+  index.Init(std::vector<OMAP>());
+  EXPECT_TRUE(index.empty());
+  EXPECT_EQ(0x1234U, index.Translate(0x1234));
+
+  uint32 addresses[] = { 1, 2, 3 };
+  index.TranslateBatch(arraysize(addresses), addresses, addresses);
+  EXPECT_EQ(1U, addresses[0]);
+  EXPECT_EQ(3U, addresses[2]);
+}
+
+TEST(OmapIndexTest, Translate) {
+  // This is deliberately not sorted.
+  const OMAP kOmap[] = {
+    { 0x3000, 0x1000 },
+    { 0x1000, 0x2000 },
+    { 0x2000, 0x5000 },
+  };
+  OmapIndex index;
+  index.Init(std::vector<OMAP>(kOmap, kOmap + arraysize(kOmap)));
+  EXPECT_EQ(3U, index.size());
+
+  // Addresses before the first entry are untouched.
+  EXPECT_EQ(0x0000U, index.Translate(0x0000));
+  EXPECT_EQ(0x0FFFU, index.Translate(0x0FFF));
+
+  EXPECT_EQ(0x2000U, index.Translate(0x1000));
+  EXPECT_EQ(0x2FFFU, index.Translate(0x1FFF));
+  EXPECT_EQ(0x5000U, index.Translate(0x2000));
+  EXPECT_EQ(0x5010U, index.Translate(0x2010));
+  EXPECT_EQ(0x1000U, index.Translate(0x3000));
+  EXPECT_EQ(0x1FFFU, index.Translate(0x3FFF));
+}
+
+TEST(OmapIndexTest, TranslateBatchMatchesSearch) {
+  SimpleRandom random(0x0BAD);
+
+  // Try tables of every small size, as well as a larger one, with batches
+  // that are and aren't multiples of the lockstep width.
+  const size_t kTableSizes[] = { 1, 2, 3, 4, 5, 7, 8, 9, 16, 1000 };
+  for (size_t i = 0; i < arraysize(kTableSizes); ++i) {
+    std::vector<OMAP> omap;
+    BuildRandomOmap(kTableSizes[i], &random, &omap);
+    OmapIndex index;
+    index.Init(omap);
+
+    uint32 max_address = omap.back().rva + 0x1000;
+    std::vector<uint32> addresses;
+    for (size_t j = 0; j < 101; ++j)
+      addresses.push_back(random(max_address));
+    // Include the boundaries of the entries.
+    for (size_t j = 0; j < omap.size(); ++j) {
+      addresses.push_back(omap[j].rva);
+      addresses.push_back(omap[j].rva - 1);
+    }
+
+    std::vector<uint32> translated(addresses.size());
+    index.TranslateBatch(addresses.size(), &addresses[0], &translated[0]);
+    for (size_t j = 0; j < addresses.size(); ++j) {
+      uint32 expected = TranslateBySearch(omap, addresses[j]);
+      EXPECT_EQ(expected, index.Translate(addresses[j]));
+      EXPECT_EQ(expected, translated[j]);
+    }
+
+    // Translating in place gives the same results.
+    index.TranslateBatch(addresses.size(), &addresses[0], &addresses[0]);
+    EXPECT_TRUE(addresses == translated);
+  }
+}
+
+// Pits the std::upper_bound lookup that OmapAndValidateFixups used to do
+// against Translate and TranslateBatch, on a table of a million entries.
+// Left disabled; it builds tens of megabytes of tables and addresses.
+TEST(OmapIndexTest, DISABLED_TranslationBenchmark) {
+  const size_t kNumEntries = 1000000;
+  const size_t kNumAddresses = 10000000;
+
+  SimpleRandom random(0xFAB);
+  std::vector<OMAP> omap;
+  BuildRandomOmap(kNumEntries, &random, &omap);
+  OmapIndex index;
+  index.Init(omap);
+
+  std::vector<uint32> addresses;
+  uint32 max_address = omap.back().rva + 0x1000;
+  for (size_t i = 0; i < kNumAddresses; ++i)
+    addresses.push_back(random(max_address));
+
+  // A plain binary search over the table, as was done before.
+  std::vector<uint32> expected(kNumAddresses);
+  base::Time start = base::Time::Now();
+  for (size_t i = 0; i < kNumAddresses; ++i) {
+    OMAP key = { addresses[i], 0 };
+    std::vector<OMAP>::const_iterator it = std::upper_bound(
+        omap.begin(), omap.end(), key, OmapRvaLessForTest);
+    if (it == omap.begin()) {
+      expected[i] = addresses[i];
+    } else {
+      --it;
+      expected[i] = it->rvaTo + (addresses[i] - it->rva);
+    }
+  }
+  base::TimeDelta search_time = base::Time::Now() - start;
+
+  std::vector<uint32> single(kNumAddresses);
+  start = base::Time::Now();
+  for (size_t i = 0; i < kNumAddresses; ++i)
+    single[i] = index.Translate(addresses[i]);
+  base::TimeDelta single_time = base::Time::Now() - start;
+
+  std::vector<uint32> batched(kNumAddresses);
+  start = base::Time::Now();
+  index.TranslateBatch(kNumAddresses, &addresses[0], &batched[0]);
+  base::TimeDelta batched_time = base::Time::Now() - start;
+
+  EXPECT_TRUE(expected == single);
+  EXPECT_TRUE(expected == batched);
+
+  LOG(INFO) << kNumAddresses << " translations through " << kNumEntries
+            << " OMAP entries.";
+  LOG(INFO) << "std::upper_bound: " << search_time.InMilliseconds() << " ms.";
+  LOG(INFO) << "OmapIndex::Translate: " << single_time.InMilliseconds()
+            << " ms.";
+  LOG(INFO) << "OmapIndex::TranslateBatch: " << batched_time.InMilliseconds()
+            << " ms.";
+}
+
+}  // namespace pdb
@@ -26,6 +26,8 @@
       'target_name': 'pdb_lib',
       'type': 'static_library',
       'sources': [
+        'omap_index.cc',
+        'omap_index.h',
         'pdb_byte_stream.cc',
         'pdb_byte_stream.h',
         'pdb_constants.cc',
@@ -33,10 +35,14 @@
         'pdb_data.h',
         'pdb_file_stream.cc',
         'pdb_file_stream.h',
+        'pdb_mapped_stream.cc',
+        'pdb_mapped_stream.h',
         'pdb_reader.cc',
         'pdb_reader.h',
         'pdb_stream.cc',
         'pdb_stream.h',
+        'pdb_symbolizer.cc',
+        'pdb_symbolizer.h',
         'pdb_util.cc',
         'pdb_util.h',
         'pdb_writer.cc',
@@ -45,16 +51,20 @@
       'dependencies': [
         '<(DEPTH)/base/base.gyp:base',
         '<(DEPTH)/sawbuck/common/common.gyp:common',
+        '<(DEPTH)/syzygy/core/core.gyp:core_lib',
       ],
     },
     {
       'target_name': 'pdb_unittests',
       'type': 'executable',
       'sources': [
+        'omap_index_unittest.cc',
         'pdb_byte_stream_unittest.cc',
         'pdb_file_stream_unittest.cc',
+        'pdb_mapped_stream_unittest.cc',
         'pdb_reader_unittest.cc',
         'pdb_stream_unittest.cc',
+        'pdb_symbolizer_unittest.cc',
         'pdb_util_unittest.cc',
         'pdb_unittests_main.cc',
         'pdb_writer_unittest.cc',
@@ -73,6 +73,43 @@ struct DbiDbgHeader {
   int16 section_header_origin;
 };
 
+// Dbi Section Contribution, which describes a range of a section that a
+// module contributes to the image.
+struct DbiSectionContrib {
+  int16 section;
+  int16 pad1;
+  int32 offset;
+  int32 size;
+  uint32 flags;
+  int16 module;
+  int16 pad2;
+  uint32 data_crc;
+  uint32 reloc_crc;
+};
+
+// Dbi Module Info. The module info records follow the Dbi header, each of
+// them made up of this fixed part, followed by the zero terminated module
+// and object names, and padded to a multiple of 4 bytes.
+// See http://code.google.com/p/pdbparser/wiki/DBI_Format
+struct DbiModuleInfoBase {
+  uint32 opened;
+  DbiSectionContrib section;
+  uint16 flags;
+  // The stream holding the module's symbols and line numbers, or -1.
+  int16 module_sym_stream;
+  // The sizes of the symbols, the C11 line numbers and the C13 line numbers,
+  // which appear in this order in the module's stream.
+  uint32 sym_byte_size;
+  uint32 c11_byte_size;
+  uint32 c13_byte_size;
+  uint16 num_files;
+  uint16 pad;
+  uint32 file_names_offset;
+  uint32 src_file_name_index;
+  uint32 pdb_file_name_index;
+};
+COMPILE_ASSERT(sizeof(DbiModuleInfoBase) == 64, dbi_module_info_wrong_size);
+
 // Multi-Stream Format (MSF) Header
 // See http://code.google.com/p/pdbparser/wiki/MSF_Format
 struct PdbHeader {
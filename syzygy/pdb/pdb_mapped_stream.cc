@@ -0,0 +1,111 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_mapped_stream.h"
+
+#include <algorithm>
+#include "base/logging.h"
+
+namespace pdb {
+
+PdbMappedStream::PdbMappedStream(const uint8* file_data,
+                                 size_t length,
+                                 const uint32* pages,
+                                 size_t page_size)
+    : PdbStream(length),
+      current_view_(0) {
+  DCHECK(file_data != NULL);
+  DCHECK_LT(0U, page_size);
+
+  // Use the stream's length as seen by the base class, which normalizes the
+  // length of nil streams.
+  size_t offset = 0;
+  while (offset < this->length()) {
+    size_t page_index = offset / page_size;
+    size_t chunk_size = std::min(page_size, this->length() - offset);
+    const uint8* data = file_data + pages[page_index] * page_size;
+
+    // Extend the current view if this page immediately follows it.
+    if (!views_.empty()) {
+      View& last = views_.back();
+      if (last.data + last.length == data) {
+        last.length += chunk_size;
+        offset += chunk_size;
+        continue;
+      }
+    }
+
+    View view = { data, offset, chunk_size };
+    views_.push_back(view);
+    offset += chunk_size;
+  }
+}
+
+PdbMappedStream::~PdbMappedStream() {
+}
+
+bool PdbMappedStream::ReadBytes(void* dest, size_t count, size_t* bytes_read) {
+  DCHECK(dest != NULL);
+  DCHECK(bytes_read != NULL);
+
+  // Return 0 once we've reached the end of the stream.
+  if (pos() == length()) {
+    *bytes_read = 0;
+    return true;
+  }
+
+  // Don't read beyond the end of the known stream length.
+  count = std::min(count, length() - pos());
+  *bytes_read = count;
+
+  // Find the view containing the read position. Reads are usually
+  // sequential, so start from the one we last read from.
+  DCHECK(!views_.empty());
+  if (current_view_ >= views_.size() ||
+      views_[current_view_].offset > pos()) {
+    current_view_ = 0;
+  }
+  while (views_[current_view_].offset + views_[current_view_].length <= pos())
+    ++current_view_;
+
+  // Copy the data out of as many views as necessary.
+  uint8* out = reinterpret_cast<uint8*>(dest);
+  size_t position = pos();
+  while (count > 0) {
+    DCHECK_LT(current_view_, views_.size());
+    const View& view = views_[current_view_];
+    size_t view_offset = position - view.offset;
+    size_t chunk_size = std::min(count, view.length - view_offset);
+    memcpy(out, view.data + view_offset, chunk_size);
+
+    out += chunk_size;
+    position += chunk_size;
+    count -= chunk_size;
+    if (view_offset + chunk_size == view.length &&
+        current_view_ + 1 < views_.size()) {
+      ++current_view_;
+    }
+  }
+
+  Seek(position);
+  return true;
+}
+
+const uint8* PdbMappedStream::contiguous_data() const {
+  if (views_.size() != 1)
+    return NULL;
+  return views_[0].data;
+}
+
+}  // namespace pdb
@@ -0,0 +1,77 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SYZYGY_PDB_PDB_MAPPED_STREAM_H_
+#define SYZYGY_PDB_PDB_MAPPED_STREAM_H_
+
+#include <vector>
+#include "base/basictypes.h"
+#include "syzygy/pdb/pdb_stream.h"
+
+namespace pdb {
+
+// This class represents a PDB stream in a memory mapped pdb file. Rather than
+// reading the stream's pages from disk as it goes, it keeps a list of views
+// into the mapping, merging runs of adjacent pages into a single view. Reads
+// are then a memcpy per view, and a stream whose pages are all adjacent can
+// be accessed in place through contiguous_data().
+class PdbMappedStream : public PdbStream {
+ public:
+  // @param file_data the start of the mapped pdb file. This must outlive the
+  //     stream.
+  // @param length the length of the stream, in bytes.
+  // @param pages the pages of the stream. These are only used during
+  //     construction, and must all lie within the mapping.
+  // @param page_size the size of the pages in the pdb file.
+  PdbMappedStream(const uint8* file_data,
+                  size_t length,
+                  const uint32* pages,
+                  size_t page_size);
+  ~PdbMappedStream();
+
+  // PdbStream implementation.
+  bool ReadBytes(void* dest, size_t count, size_t* bytes_read);
+
+  // Returns a pointer to the stream's data if it is stored contiguously in
+  // the file, NULL otherwise.
+  const uint8* contiguous_data() const;
+
+  // Returns the number of discontiguous views the stream is made up of.
+  size_t view_count() const { return views_.size(); }
+
+ private:
+  // A run of adjacent pages in the mapping.
+  struct View {
+    // The start of the run.
+    const uint8* data;
+    // The offset of the run within the stream.
+    size_t offset;
+    // The length of the run. This is a whole number of pages, except for the
+    // last run of the stream.
+    size_t length;
+  };
+
+  // The runs making up the stream, in order.
+  std::vector<View> views_;
+
+  // The index of the view containing the read position. This spares us a
+  // search for the typical sequential read.
+  size_t current_view_;
+
+  DISALLOW_COPY_AND_ASSIGN(PdbMappedStream);
+};
+
+}  // namespace pdb
+
+#endif  // SYZYGY_PDB_PDB_MAPPED_STREAM_H_
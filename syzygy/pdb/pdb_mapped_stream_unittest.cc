@@ -0,0 +1,119 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_mapped_stream.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using pdb::PdbMappedStream;
+
+const size_t kPageSize = 4;
+const size_t kNumPages = 6;
+
+class PdbMappedStreamTest : public testing::Test {
+ public:
+  virtual void SetUp() {
+    // Fill each page with its page number, followed by its offset within the
+    // page.
+    for (size_t i = 0; i < kNumPages * kPageSize; ++i)
+      data_[i] = static_cast<uint8>((i / kPageSize) << 4 | (i % kPageSize));
+  }
+
+ protected:
+  uint8 data_[kNumPages * kPageSize];
+};
+
+}  // namespace
+
+TEST_F(PdbMappedStreamTest, Constructor) {
+  const uint32 kPages[] = { 1, 2, 3 };
+  PdbMappedStream stream(data_, 10, kPages, kPageSize);
+  EXPECT_EQ(10, stream.length());
+  EXPECT_EQ(1, stream.view_count());
+}
+
+TEST_F(PdbMappedStreamTest, NilStream) {
+  PdbMappedStream stream(data_, 0xFFFFFFFF, NULL, kPageSize);
+  EXPECT_EQ(0, stream.length());
+  EXPECT_EQ(0, stream.view_count());
+  EXPECT_TRUE(stream.contiguous_data() == NULL);
+
+  uint8 buffer[4] = { 0 };
+  size_t bytes_read = 1;
+  EXPECT_TRUE(stream.ReadBytes(buffer, sizeof(buffer), &bytes_read));
+  EXPECT_EQ(0, bytes_read);
+}
+
+TEST_F(PdbMappedStreamTest, AdjacentPagesAreContiguous) {
+  const uint32 kPages[] = { 2, 3, 4 };
+  PdbMappedStream stream(data_, 11, kPages, kPageSize);
+  EXPECT_EQ(1, stream.view_count());
+  EXPECT_EQ(data_ + 2 * kPageSize, stream.contiguous_data());
+}
+
+TEST_F(PdbMappedStreamTest, ScatteredPagesAreMerged) {
+  // Pages 4 and 5 are adjacent, as are 0 and 1, but 5 and 0 are not.
+  const uint32 kPages[] = { 4, 5, 0, 1, 3 };
+  PdbMappedStream stream(data_, 18, kPages, kPageSize);
+  EXPECT_EQ(3, stream.view_count());
+  EXPECT_TRUE(stream.contiguous_data() == NULL);
+}
+
+TEST_F(PdbMappedStreamTest, ReadBytes) {
+  const uint32 kPages[] = { 4, 5, 0, 1, 3 };
+  const size_t kLength = 18;
+  const uint8 kExpected[kLength] = {
+      0x40, 0x41, 0x42, 0x43, 0x50, 0x51, 0x52, 0x53, 0x00,
+      0x01, 0x02, 0x03, 0x10, 0x11, 0x12, 0x13, 0x30, 0x31 };
+
+  // Read the stream with every chunk size, so that reads start and end at
+  // every position within the pages and views.
+  for (size_t chunk_size = 1; chunk_size <= kLength + 1; ++chunk_size) {
+    PdbMappedStream stream(data_, kLength, kPages, kPageSize);
+    uint8 buffer[kLength + 1] = { 0 };
+    size_t total = 0;
+    while (true) {
+      size_t bytes_read = 0;
+      ASSERT_TRUE(stream.ReadBytes(buffer + total, chunk_size, &bytes_read));
+      if (bytes_read == 0)
+        break;
+      EXPECT_EQ(std::min(chunk_size, kLength - total), bytes_read);
+      total += bytes_read;
+    }
+    EXPECT_EQ(kLength, total);
+    EXPECT_EQ(0, memcmp(kExpected, buffer, kLength));
+  }
+}
+
+TEST_F(PdbMappedStreamTest, ReadAfterSeek) {
+  const uint32 kPages[] = { 4, 5, 0, 1, 3 };
+  PdbMappedStream stream(data_, 18, kPages, kPageSize);
+
+  // Seek forwards past a view boundary, then back again.
+  uint8 buffer[3] = { 0 };
+  EXPECT_TRUE(stream.Seek(11));
+  EXPECT_TRUE(stream.Read(buffer, 3));
+  const uint8 kExpected1[] = { 0x03, 0x10, 0x11 };
+  EXPECT_EQ(0, memcmp(kExpected1, buffer, sizeof(buffer)));
+
+  EXPECT_TRUE(stream.Seek(2));
+  EXPECT_TRUE(stream.Read(buffer, 3));
+  const uint8 kExpected2[] = { 0x42, 0x43, 0x50 };
+  EXPECT_EQ(0, memcmp(kExpected2, buffer, sizeof(buffer)));
+
+  EXPECT_TRUE(stream.Seek(16));
+  EXPECT_FALSE(stream.Read(buffer, 3));
+}
@@ -15,7 +15,7 @@
 
 #include "base/logging.h"
 #include "base/string_util.h"
-#include "syzygy/pdb/pdb_file_stream.h"
+#include "syzygy/pdb/pdb_mapped_stream.h"
 
 namespace pdb {
 
@@ -28,32 +28,32 @@ PdbReader::~PdbReader() {
 
 bool PdbReader::Read(const FilePath& pdb_path,
                      std::vector<PdbStream*>* streams) {
-  FreeStreams();
+  DCHECK(streams != NULL);
 
-  file_.reset(file_util::OpenFile(pdb_path, "rb"));
-  if (!file_.get()) {
-    LOG(ERROR) << "Unable to open '" << pdb_path.value() << "'";
-    return false;
-  }
+  // The streams point into the mapping, so they must go first.
+  FreeStreams();
+  directory_.reset();
+  path_ = pdb_path;
 
-  // Get the file size.
-  uint32 file_size = 0;
-  if (!GetFileSize(file_.get(), &file_size)) {
-    LOG(ERROR) << "Unable to determine size of '" << pdb_path.value() << "'";
+  mapped_file_.reset(new file_util::MemoryMappedFile());
+  if (!mapped_file_->Initialize(pdb_path)) {
+    LOG(ERROR) << "Unable to map '" << pdb_path.value() << "'";
+    mapped_file_.reset();
     return false;
   }
+  const uint8* file_data = mapped_file_->data();
+  size_t file_size = mapped_file_->length();
 
-  // Read the header from the first page in the file.
-  uint32 header_page = 0;
-  PdbFileStream header_stream(file_.get(), sizeof(header_), &header_page,
-                              kPdbPageSize);
-  if (!header_stream.Read(&header_, 1)) {
-    LOG(ERROR) << "Failed to read PDB file header";
+  // Read the header from the start of the file.
+  if (file_size < sizeof(header_)) {
+    LOG(ERROR) << "PDB file is too short to contain a header";
     return false;
   }
+  memcpy(&header_, file_data, sizeof(header_));
 
   // Sanity checks.
-  if (header_.num_pages * header_.page_size != file_size) {
+  if (header_.page_size == 0 ||
+      header_.num_pages * header_.page_size != file_size) {
     LOG(ERROR) << "Invalid PDB file size";
     return false;
   }
@@ -68,74 +68,97 @@ bool PdbReader::Read(const FilePath& pdb_path,
   // itself written across multiple root pages). To do this we need to know how
   // many pages are required to represent the directory, then we load a stream
   // containing that many page pointers from the root pages array.
-  int num_dir_pages = static_cast<int>(GetNumPages(header_.directory_size));
-  PdbFileStream dir_page_stream(file_.get(), num_dir_pages * sizeof(uint32),
-                                header_.root_pages, header_.page_size);
-  scoped_array<uint32> dir_pages(new uint32[num_dir_pages]);
-  if (dir_pages.get() == NULL) {
-    LOG(ERROR) << "Failed to allocate directory pages";
+  uint32 num_dir_pages = GetNumPages(header_.directory_size);
+  uint32 num_root_pages = GetNumPages(num_dir_pages * sizeof(uint32));
+  if (num_root_pages > arraysize(header_.root_pages) ||
+      !ValidatePages(header_.root_pages, num_root_pages)) {
+    LOG(ERROR) << "Invalid PDB directory root pages";
     return false;
   }
-  if (!dir_page_stream.Read(dir_pages.get(), num_dir_pages)) {
+  PdbMappedStream dir_page_stream(file_data, num_dir_pages * sizeof(uint32),
+                                  header_.root_pages, header_.page_size);
+  scoped_array<uint32> dir_pages(new uint32[num_dir_pages]);
+  if (!dir_page_stream.Read(dir_pages.get(), num_dir_pages) ||
+      !ValidatePages(dir_pages.get(), num_dir_pages)) {
     LOG(ERROR) << "Failed to read directory page stream";
     return false;
   }
 
   // Load the actual directory.
-  int dir_size = static_cast<int>(header_.directory_size / sizeof(uint32));
-  PdbFileStream dir_stream(file_.get(), header_.directory_size,
-                           dir_pages.get(), header_.page_size);
+  size_t dir_size = header_.directory_size / sizeof(uint32);
+  PdbMappedStream dir_stream(file_data, header_.directory_size,
+                             dir_pages.get(), header_.page_size);
   directory_.reset(new uint32[dir_size]);
-  if (directory_.get() == NULL) {
-    LOG(ERROR) << "Failed to allocate directory";
-    return false;
-  }
-  if (!dir_stream.Read(directory_.get(), dir_size)) {
+  if (dir_size == 0 || !dir_stream.Read(directory_.get(), dir_size)) {
     LOG(ERROR) << "Failed to read directory stream";
     return false;
   }
 
-  // Iterate through the streams and construct PdbStreams.
+  // Iterate through the streams and construct PdbStreams. The directory is
+  // untrusted, so make sure that it describes as many pages as it claims to,
+  // and that they're all within the file.
   const uint32& num_streams = directory_[0];
+  if (num_streams > dir_size - 1) {
+    LOG(ERROR) << "Invalid PDB directory";
+    return false;
+  }
   const uint32* stream_lengths = &(directory_[1]);
   const uint32* stream_pages = &(directory_[1 + num_streams]);
+  size_t num_stream_pages = dir_size - 1 - num_streams;
 
-  uint32 page_index = 0;
+  size_t page_index = 0;
   for (uint32 stream_index = 0; stream_index < num_streams; ++stream_index) {
-    streams_.push_back(new PdbFileStream(file_.get(),
-                                         stream_lengths[stream_index],
-                                         stream_pages + page_index,
-                                         header_.page_size));
-    page_index += GetNumPages(stream_lengths[stream_index]);
+    uint32 num_pages = GetNumPages(stream_lengths[stream_index]);
+    if (num_pages > num_stream_pages - page_index ||
+        !ValidatePages(stream_pages + page_index, num_pages)) {
+      LOG(ERROR) << "Invalid page list for PDB stream " << stream_index;
+      FreeStreams();
+      return false;
+    }
+
+    streams_.push_back(new PdbMappedStream(file_data,
+                                           stream_lengths[stream_index],
+                                           stream_pages + page_index,
+                                           header_.page_size));
+    stream_pages_.push_back(stream_pages + page_index);
+    page_index += num_pages;
   }
 
   *streams = streams_;
   return true;
 }
 
-bool PdbReader::GetFileSize(FILE* file, uint32* size) const {
-  DCHECK(file != NULL);
-  DCHECK(size != NULL);
-
-  if (fseek(file, 0, SEEK_END) != 0) {
-    LOG(ERROR) << "Failed seeking to end of file";
-    return false;
-  }
-
-  long temp = ftell(file);
-  if (temp == -1L) {
-    LOG(ERROR) << "Failed to read stream position";
-    return false;
+const uint32* PdbReader::GetStreamPages(const PdbStream* stream,
+                                       uint32* num_pages) const {
+  DCHECK(stream != NULL);
+  DCHECK(num_pages != NULL);
+  DCHECK_EQ(streams_.size(), stream_pages_.size());
+
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (streams_[i] == stream) {
+      *num_pages = GetNumPages(stream->length());
+      return stream_pages_[i];
+    }
   }
 
-  (*size) = static_cast<uint32>(temp);
-  return true;
+  return NULL;
 }
 
 uint32 PdbReader::GetNumPages(uint32 num_bytes) const {
   return (num_bytes + header_.page_size - 1) / header_.page_size;
 }
 
+bool PdbReader::ValidatePages(const uint32* pages, uint32 num_pages) const {
+  DCHECK(num_pages == 0 || pages != NULL);
+
+  for (uint32 i = 0; i < num_pages; ++i) {
+    if (pages[i] >= header_.num_pages)
+      return false;
+  }
+
+  return true;
+}
+
 void PdbReader::FreeStreams() {
   for (std::vector<PdbStream*>::const_iterator iter = streams_.begin();
        iter != streams_.end(); iter++) {
@@ -143,6 +166,7 @@ void PdbReader::FreeStreams() {
   }
 
   streams_.clear();
+  stream_pages_.clear();
 }
 
 }  // namespace pdb
@@ -17,6 +17,7 @@
 #include <vector>
 #include "base/file_path.h"
 #include "base/file_util.h"
+#include "base/scoped_ptr.h"
 #include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_data.h"
 #include "syzygy/pdb/pdb_stream.h"
@@ -24,15 +25,17 @@
 namespace pdb {
 
 // This class is used to read a pdb file and provide access to the file's
-// symbol streams.
+// symbol streams. The file is memory mapped for as long as the reader is
+// alive, and its streams are read directly from the mapping.
 class PdbReader {
  public:
   // Construct a PdbReader for the given pdb path.
   PdbReader();
   ~PdbReader();
 
-  // Read the pdb file. Load the file's header and directory into memory and
-  // construct a list of PdbStreams that can be used to read the file's streams.
+  // Read the pdb file. Map the file into memory, load its header and directory
+  // and construct a list of PdbStreams that can be used to read the file's
+  // streams.
   // @p pdb_path is the path to the pdb file to be read, and @p pdb_streams is
   // a pointer to an already instantiated vector of PdbStream pointers which
   // will contain a list of PdbStreams on a successful file read.
@@ -41,19 +44,40 @@ class PdbReader {
   // out of scope.
   bool Read(const FilePath& pdb_path, std::vector<PdbStream*>* streams);
 
- protected:
-  // Get the file size in bytes for an already opened file handle.
-  // Will set stream cursor to end of file.
-  bool GetFileSize(FILE* file, uint32* size) const;
+  // Gets the pages that one of the streams returned by Read occupies in the
+  // pdb file.
+  // @param stream the stream to look up.
+  // @param num_pages on success, is set to the number of pages in the stream.
+  // @returns a pointer to the stream's page numbers, or NULL if @p stream
+  //     isn't one of this reader's streams.
+  const uint32* GetStreamPages(const PdbStream* stream,
+                               uint32* num_pages) const;
+
+  // Returns the path of the pdb file last read.
+  const FilePath& path() const { return path_; }
+
+  // Returns the page size of the pdb file last read.
+  uint32 page_size() const { return header_.page_size; }
+
+  // Returns the number of pages in the pdb file last read.
+  uint32 num_pages() const { return header_.num_pages; }
 
+ protected:
   // Get the number of pages required to store specified number of bytes.
   uint32 GetNumPages(uint32 num_bytes) const;
 
+  // Checks that each of the @p num_pages pages at @p pages lies within the
+  // file.
+  bool ValidatePages(const uint32* pages, uint32 num_pages) const;
+
   // Free any allocated PDB streams.
   void FreeStreams();
 
-  // The current file handle open for reading.
-  file_util::ScopedFILE file_;
+  // The path of the file currently being read.
+  FilePath path_;
+
+  // The mapping of the file currently being read.
+  scoped_ptr<file_util::MemoryMappedFile> mapped_file_;
 
   // The pdb file's header.
   PdbHeader header_;
@@ -64,6 +88,10 @@ class PdbReader {
   // The list of pdb streams in the pdb file.
   std::vector<PdbStream*> streams_;
 
+  // The page numbers of each of the streams in streams_. These point into
+  // directory_.
+  std::vector<const uint32*> stream_pages_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(PdbReader);
 };
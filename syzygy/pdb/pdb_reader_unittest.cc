@@ -15,9 +15,11 @@
 #include "base/path_service.h"
 #include "gtest/gtest.h"
 #include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_file_stream.h"
 
 namespace {
 
+using pdb::PdbFileStream;
 using pdb::PdbHeader;
 using pdb::PdbReader;
 using pdb::PdbStream;
@@ -36,7 +38,7 @@ class TestPdbReader : public PdbReader {
   TestPdbReader() {
   }
 
-  FILE* file() { return file_.get(); }
+  file_util::MemoryMappedFile* mapped_file() { return mapped_file_.get(); }
   PdbHeader header() { return header_; }
   void set_header(PdbHeader header) {
     header_ = header;
@@ -44,8 +46,8 @@ class TestPdbReader : public PdbReader {
   uint32* directory() { return directory_.get(); }
   std::vector<PdbStream*>& streams() { return streams_; }
 
-  using PdbReader::GetFileSize;
   using PdbReader::GetNumPages;
+  using PdbReader::ValidatePages;
 };
 
 }  // namespace
@@ -58,8 +60,11 @@ TEST(PdbReaderTest, Read) {
   EXPECT_TRUE(reader.Read(testDllFilePath, &streams));
   EXPECT_GT(streams.size(), 0U);
 
-  // Test that the file handle remains open.
-  EXPECT_TRUE(reader.file() != NULL);
+  // Test that the file remains mapped.
+  ASSERT_TRUE(reader.mapped_file() != NULL);
+  int64 file_size = 0;
+  ASSERT_TRUE(file_util::GetFileSize(testDllFilePath, &file_size));
+  EXPECT_EQ(file_size, reader.mapped_file()->length());
 
   // Test that the header has been populated.
   PdbHeader header = reader.header();
@@ -79,20 +84,60 @@ TEST(PdbReaderTest, Read) {
   EXPECT_EQ(streams, reader.streams());
 }
 
-TEST(PdbReaderTest, GetFileSize) {
+TEST(PdbReaderTest, ReadMatchesFileStreams) {
   FilePath testDllFilePath = GetSrcRelativePath(kTestDllFilePath);
 
+  TestPdbReader reader;
+  std::vector<PdbStream*> streams;
+  ASSERT_TRUE(reader.Read(testDllFilePath, &streams));
+
   file_util::ScopedFILE file(file_util::OpenFile(testDllFilePath, "rb"));
-  EXPECT_TRUE(file.get() != NULL);
+  ASSERT_TRUE(file.get() != NULL);
+
+  // Each of the mapped streams should have the same contents as the same
+  // stream read from disk.
+  uint32* directory = reader.directory();
+  uint32 num_streams = directory[0];
+  const uint32* stream_pages = directory + 1 + num_streams;
+  for (uint32 i = 0; i < num_streams; ++i) {
+    PdbFileStream file_stream(file.get(), directory[1 + i], stream_pages,
+                              reader.header().page_size);
+    stream_pages += reader.GetNumPages(directory[1 + i]);
+
+    ASSERT_EQ(file_stream.length(), streams[i]->length());
+    if (file_stream.length() == 0)
+      continue;
+
+    std::vector<uint8> expected(file_stream.length());
+    std::vector<uint8> actual(streams[i]->length());
+    ASSERT_TRUE(file_stream.Read(&expected[0], expected.size()));
+    ASSERT_TRUE(streams[i]->Read(&actual[0], actual.size()));
+    EXPECT_TRUE(expected == actual);
+  }
+}
 
+TEST(PdbReaderTest, ReadFailsOnMissingFile) {
   TestPdbReader reader;
-  uint32 size1;
-  EXPECT_TRUE(reader.GetFileSize(file.get(), &size1));
+  std::vector<PdbStream*> streams;
+  EXPECT_FALSE(reader.Read(GetSrcRelativePath(L"syzygy\\pdb\\test_data\\"
+                                              L"does_not_exist.pdb"),
+                           &streams));
+  EXPECT_TRUE(reader.streams().empty());
+}
 
-  int64 size2;
-  EXPECT_TRUE(file_util::GetFileSize(testDllFilePath, &size2));
+TEST(PdbReaderTest, ValidatePages) {
+  PdbHeader header = { 0 };
+  header.page_size = 4;
+  header.num_pages = 3;
+
+  TestPdbReader reader;
+  reader.set_header(header);
 
-  EXPECT_EQ(size2, size1);
+  const uint32 kValidPages[] = { 0, 2, 1 };
+  const uint32 kInvalidPages[] = { 0, 3 };
+  EXPECT_TRUE(reader.ValidatePages(kValidPages, arraysize(kValidPages)));
+  EXPECT_TRUE(reader.ValidatePages(NULL, 0));
+  EXPECT_FALSE(reader.ValidatePages(kInvalidPages, arraysize(kInvalidPages)));
 }
 
 TEST(PdbReaderTest, GetNumPages) {
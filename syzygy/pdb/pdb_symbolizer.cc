@@ -0,0 +1,985 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_symbolizer.h"
+
+#include <dbghelp.h>
+#include <algorithm>
+#include <hash_map>
+#include <map>
+#include <string>
+#include "base/logging.h"
+#include "sawbuck/common/buffer_parser.h"
+#include "syzygy/core/compact_file.h"
+#include "syzygy/pdb/omap_index.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_data.h"
+#include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pdb/pdb_util.h"
+
+namespace pdb {
+
+namespace {
+
+// Identifies a symbolizer cache file. The version must be bumped whenever
+// the layout of any of the sections changes.
+const uint32 kSymbolCacheMagic = 0x4D595350;
+const uint32 kSymbolCacheVersion = 1;
+
+// The sections of a symbolizer cache file.
+enum SymbolCacheSection {
+  // The signature and age of the PDB file.
+  INFO_SECTION,
+  // The function table, as an array of FunctionEntry.
+  FUNCTION_SECTION,
+  // The line table, as an array of LineEntry.
+  LINE_SECTION,
+  // The zero terminated strings the tables refer to.
+  STRING_SECTION,
+};
+
+// The CodeView symbol and line number records we read. See cvinfo.h.
+const uint16 kS_PUB32 = 0x110E;
+const uint16 kS_GPROC32 = 0x110F;
+const uint16 kS_LPROC32 = 0x1110;
+const uint16 kS_LPROC32_ID = 0x1146;
+const uint16 kS_GPROC32_ID = 0x1147;
+
+const uint32 kDebugSubsectionLines = 0xF2;
+const uint32 kDebugSubsectionFileChecksums = 0xF4;
+
+// The public symbol flags that mark code.
+const uint32 kPublicCode = 0x1;
+const uint32 kPublicFunction = 0x2;
+
+// The line numbers the compiler uses to mark code that has no source line.
+const uint32 kHiddenLine = 0xFEEFEE;
+const uint32 kHiddenLine2 = 0xF00F00;
+const uint32 kLineNumberMask = 0xFFFFFF;
+
+// The magic number at the start of the /names stream.
+const uint32 kNamesStreamMagic = 0xEFFEEFFE;
+
+// The number of addresses SymbolizeBatch looks up in lockstep.
+const size_t kBatchSize = 8;
+
+#pragma pack(push)
+#pragma pack(1)
+struct SymbolRecordHeader {
+  // The length of the record, excluding this field.
+  uint16 length;
+  uint16 type;
+};
+
+struct ProcSym {
+  uint32 parent;
+  uint32 end;
+  uint32 next;
+  uint32 length;
+  uint32 debug_start;
+  uint32 debug_end;
+  uint32 type_index;
+  uint32 offset;
+  uint16 segment;
+  uint8 flags;
+  // Followed by the zero terminated name.
+};
+
+struct PublicSym {
+  uint32 flags;
+  uint32 offset;
+  uint16 segment;
+  // Followed by the zero terminated name.
+};
+#pragma pack(pop)
+
+struct DebugSubsectionHeader {
+  uint32 type;
+  uint32 length;
+};
+
+struct LinesHeader {
+  uint32 offset;
+  uint16 segment;
+  uint16 flags;
+  uint32 code_size;
+};
+
+struct LinesBlockHeader {
+  // The offset of the block's file in the file checksums subsection.
+  uint32 file_id;
+  uint32 num_lines;
+  // The size of the block, including this header.
+  uint32 block_size;
+};
+
+struct LineNumber {
+  uint32 offset;
+  uint32 flags;
+};
+
+struct FileChecksumHeader {
+  uint32 name_offset;
+  uint8 checksum_size;
+  uint8 checksum_kind;
+};
+
+struct NamesStreamHeader {
+  uint32 magic;
+  uint32 version;
+  uint32 size;
+};
+
+// Returns the index of the last of the @p num_entries @p entries whose rva
+// isn't greater than @p rva, or @p num_entries if there is none.
+template <typename Entry>
+size_t FindEntry(const Entry* entries, size_t num_entries, uint32 rva) {
+  if (num_entries == 0)
+    return 0;
+
+  size_t entry = 0;
+  for (size_t n = num_entries; n > 1; n -= n / 2) {
+    size_t half = n / 2;
+    entry = entries[entry + half].rva <= rva ? entry + half : entry;
+  }
+
+  return entries[entry].rva <= rva ? entry : num_entries;
+}
+
+// Does what FindEntry does for each of kBatchSize addresses. The searches
+// all take the same steps, so they're run in lockstep, which overlaps their
+// cache misses.
+template <typename Entry>
+void FindEntries(const Entry* entries,
+                 size_t num_entries,
+                 const uint32* rvas,
+                 size_t* found) {
+  for (size_t j = 0; j < kBatchSize; ++j)
+    found[j] = 0;
+  if (num_entries == 0)
+    return;
+
+  for (size_t n = num_entries; n > 1; n -= n / 2) {
+    size_t half = n / 2;
+    for (size_t j = 0; j < kBatchSize; ++j) {
+      size_t probe = found[j] + half;
+      found[j] = entries[probe].rva <= rvas[j] ? probe : found[j];
+    }
+  }
+
+  for (size_t j = 0; j < kBatchSize; ++j) {
+    if (entries[found[j]].rva > rvas[j])
+      found[j] = num_entries;
+  }
+}
+
+template <typename Entry>
+bool EntryRvaLess(const Entry& entry1, const Entry& entry2) {
+  return entry1.rva < entry2.rva;
+}
+
+template <typename Entry>
+bool EntryRvaEqual(const Entry& entry1, const Entry& entry2) {
+  return entry1.rva == entry2.rva;
+}
+
+// Points @p table and @p count at a section of @p file_reader holding an
+// array of @p Entry.
+template <typename Entry>
+bool GetTableSection(const core::SectionedFileReader& file_reader,
+                     SymbolCacheSection section,
+                     const Entry** table,
+                     size_t* count) {
+  const uint8* data = NULL;
+  size_t size = 0;
+  if (!file_reader.GetSection(section, &data, &size) ||
+      size % sizeof(Entry) != 0) {
+    LOG(ERROR) << "Symbol cache has a missing or malformed section "
+               << section << ".";
+    return false;
+  }
+
+  *table = reinterpret_cast<const Entry*>(data);
+  *count = size / sizeof(Entry);
+  return true;
+}
+
+}  // namespace
+
+// Reads the tables of a PdbSymbolizer out of a PDB file.
+class PdbSymbolizer::Builder {
+ public:
+  explicit Builder(PdbSymbolizer* symbolizer)
+      : symbolizer_(symbolizer), has_omap_(false) {
+    DCHECK(symbolizer != NULL);
+  }
+
+  bool Build(const FilePath& pdb_path);
+
+ private:
+  // Returns the stream with the given index, or NULL if there is none.
+  PdbStream* GetStream(int index) const;
+
+  // Reads the signature and age of the PDB file, and the /names stream.
+  bool ReadInfoStream();
+  // Reads the image's section headers and OMAP table.
+  bool ReadDebugStreams(const DbiDbgHeader& dbg_header);
+  // Reads the procedures and line numbers of a module.
+  bool ReadModule(const DbiModuleInfoBase& module_info);
+  bool ReadProcedures(BinaryBufferParser* parser, size_t end);
+  bool ReadLines(BinaryBufferParser* parser, size_t start, size_t end);
+  bool ReadLinesSubsection(BinaryBufferParser* parser,
+                           size_t start,
+                           size_t end,
+                           const std::map<uint32, uint32>& files);
+  // Reads the public symbols in code.
+  bool ReadPublics(int stream_index);
+
+  // Sorts the tables, and drops redundant entries.
+  void FinishTables();
+  // Orders line entries by rva, with the starts of runs before the ends of
+  // runs at the same rva.
+  static bool LineEntryLess(const LineEntry& line1, const LineEntry& line2);
+  static bool IsSameLine(const LineEntry& line1, const LineEntry& line2);
+
+  // Translates a section relative address to an rva in the image.
+  // @returns false if there's no such address in the image.
+  bool GetRva(uint16 segment, uint32 offset, uint32* rva) const;
+
+  // Adds @p str to the string pool, unless it's already there.
+  // @returns the offset of @p str in the string pool.
+  uint32 AddString(const char* str);
+
+  PdbSymbolizer* symbolizer_;
+
+  PdbReader reader_;
+  std::vector<PdbStream*> streams_;
+
+  // The /names stream, which holds the source file names.
+  PdbByteStream names_;
+
+  // The image's section headers. If the image has been relinked, these are
+  // the headers of the original image, and addresses in them are translated
+  // to the relinked image by omap_.
+  std::vector<IMAGE_SECTION_HEADER> sections_;
+  bool has_omap_;
+  OmapIndex omap_;
+
+  // The offset of each string in the string pool.
+  typedef stdext::hash_map<std::string, uint32> StringMap;
+  StringMap string_offsets_;
+
+  DISALLOW_COPY_AND_ASSIGN(Builder);
+};
+
+bool PdbSymbolizer::Builder::Build(const FilePath& pdb_path) {
+  if (!reader_.Read(pdb_path, &streams_)) {
+    LOG(ERROR) << "Unable to read \"" << pdb_path.value() << "\".";
+    return false;
+  }
+
+  // Offset 0 in the string pool is the empty string.
+  AddString("");
+
+  if (!ReadInfoStream())
+    return false;
+
+  PdbByteStream dbi_stream;
+  if (GetStream(kDbiStream) == NULL ||
+      !dbi_stream.Init(GetStream(kDbiStream))) {
+    LOG(ERROR) << "Unable to read Dbi stream.";
+    return false;
+  }
+
+  BinaryBufferParser parser(dbi_stream.data(), dbi_stream.length());
+  const DbiHeader* dbi_header = NULL;
+  const DbiDbgHeader* dbg_header = NULL;
+  if (!parser.GetAt(0, &dbi_header) ||
+      !parser.GetAt(GetDbiDbgHeaderOffset(*dbi_header), &dbg_header)) {
+    LOG(ERROR) << "Dbi stream is too short.";
+    return false;
+  }
+
+  if (!ReadDebugStreams(*dbg_header))
+    return false;
+
+  // Walk the module info records.
+  size_t pos = sizeof(DbiHeader);
+  size_t end = pos + dbi_header->gp_modi_size;
+  while (pos < end) {
+    const DbiModuleInfoBase* module_info = NULL;
+    const char* module_name = NULL;
+    const char* object_name = NULL;
+    size_t module_name_length = 0;
+    size_t object_name_length = 0;
+    if (!parser.GetAt(pos, &module_info) ||
+        !parser.GetStringAt(pos + sizeof(*module_info), &module_name,
+                            &module_name_length) ||
+        !parser.GetStringAt(pos + sizeof(*module_info) +
+                                module_name_length + 1,
+                            &object_name, &object_name_length)) {
+      LOG(ERROR) << "Dbi stream has a truncated module info record.";
+      return false;
+    }
+
+    if (!ReadModule(*module_info)) {
+      LOG(ERROR) << "Unable to read module \"" << module_name << "\".";
+      return false;
+    }
+
+    pos += sizeof(*module_info) + module_name_length + 1 +
+        object_name_length + 1;
+    pos = (pos + 3) & ~3;
+  }
+
+  if (!ReadPublics(dbi_header->symbol_record_stream))
+    return false;
+
+  FinishTables();
+  return true;
+}
+
+PdbStream* PdbSymbolizer::Builder::GetStream(int index) const {
+  if (index < 0 || static_cast<size_t>(index) >= streams_.size())
+    return NULL;
+  return streams_[index];
+}
+
+bool PdbSymbolizer::Builder::ReadInfoStream() {
+  PdbByteStream info_stream;
+  if (GetStream(kPdbHeaderInfoStream) == NULL ||
+      !info_stream.Init(GetStream(kPdbHeaderInfoStream))) {
+    LOG(ERROR) << "Unable to read Pdb info stream.";
+    return false;
+  }
+
+  BinaryBufferParser parser(info_stream.data(), info_stream.length());
+  const PdbInfoHeader70* header = NULL;
+  if (!parser.GetAt(0, &header)) {
+    LOG(ERROR) << "Pdb info stream is too short.";
+    return false;
+  }
+  symbolizer_->signature_ = header->signature;
+  symbolizer_->age_ = header->pdb_age;
+
+  // The header is followed by a map of stream names to stream indices. This
+  // is made up of a buffer of names, and a hash table whose entries follow
+  // two bit vectors that mark which of its buckets are present and deleted.
+  size_t pos = sizeof(*header);
+  const uint32* names_size = NULL;
+  if (!parser.GetAt(pos, &names_size)) {
+    LOG(ERROR) << "Pdb info stream has no name map.";
+    return false;
+  }
+  size_t names_pos = pos + sizeof(*names_size);
+  pos = names_pos + *names_size;
+
+  const uint32* num_entries = NULL;
+  if (!parser.GetAt(pos, &num_entries)) {
+    LOG(ERROR) << "Pdb info stream has a truncated name map.";
+    return false;
+  }
+  // Skip the entry count and bucket count.
+  pos += 2 * sizeof(uint32);
+  for (size_t i = 0; i < 2; ++i) {
+    const uint32* num_words = NULL;
+    if (!parser.GetAt(pos, &num_words)) {
+      LOG(ERROR) << "Pdb info stream has a truncated name map.";
+      return false;
+    }
+    pos += sizeof(*num_words) + *num_words * sizeof(uint32);
+  }
+
+  int names_stream = -1;
+  for (size_t i = 0; i < *num_entries; ++i) {
+    const uint32* entry = NULL;
+    const char* name = NULL;
+    size_t name_length = 0;
+    if (!parser.GetAt(pos, 2 * sizeof(uint32), &entry) ||
+        !parser.GetStringAt(names_pos + entry[0], &name, &name_length)) {
+      LOG(ERROR) << "Pdb info stream has a truncated name map.";
+      return false;
+    }
+    if (strcmp(name, "/names") == 0)
+      names_stream = entry[1];
+    pos += 2 * sizeof(uint32);
+  }
+
+  // Without the names stream, we still have the functions, just not the
+  // names of their source files.
+  if (GetStream(names_stream) == NULL) {
+    LOG(WARNING) << "Pdb file has no names stream.";
+    return true;
+  }
+
+  const NamesStreamHeader* names_header = NULL;
+  if (!names_.Init(GetStream(names_stream)) ||
+      !BinaryBufferParser(names_.data(), names_.length()).GetAt(
+          0, &names_header) ||
+      names_header->magic != kNamesStreamMagic) {
+    LOG(ERROR) << "Unable to read names stream.";
+    return false;
+  }
+
+  return true;
+}
+
+bool PdbSymbolizer::Builder::ReadDebugStreams(
+    const DbiDbgHeader& dbg_header) {
+  // When the image has been relinked, the symbols refer to the sections of
+  // the original image. The linker keeps these apart from the headers of
+  // the relinked image, whereas AddOmapStreamToPdbFile leaves them in place.
+  has_omap_ = dbg_header.omap_from_src != -1;
+  PdbStream* section_stream = GetStream(
+      dbg_header.section_header_origin != -1 ?
+          dbg_header.section_header_origin : dbg_header.section_header);
+  if (section_stream == NULL) {
+    LOG(ERROR) << "Pdb file has no section headers.";
+    return false;
+  }
+
+  sections_.resize(section_stream->length() / sizeof(IMAGE_SECTION_HEADER));
+  if (!sections_.empty() &&
+      (!section_stream->Seek(0) ||
+       !section_stream->Read(&sections_[0], sections_.size()))) {
+    LOG(ERROR) << "Unable to read section headers.";
+    return false;
+  }
+
+  if (!has_omap_)
+    return true;
+
+  PdbStream* omap_stream = GetStream(dbg_header.omap_from_src);
+  if (omap_stream == NULL) {
+    LOG(ERROR) << "Pdb file has no OMAP from stream.";
+    return false;
+  }
+
+  std::vector<OMAP> omap(omap_stream->length() / sizeof(OMAP));
+  if (!omap.empty() &&
+      (!omap_stream->Seek(0) || !omap_stream->Read(&omap[0], omap.size()))) {
+    LOG(ERROR) << "Unable to read OMAP from stream.";
+    return false;
+  }
+  omap_.Init(omap);
+
+  return true;
+}
+
+bool PdbSymbolizer::Builder::ReadModule(
+    const DbiModuleInfoBase& module_info) {
+  // Modules such as imports have no stream.
+  if (module_info.module_sym_stream == -1)
+    return true;
+
+  PdbByteStream module_stream;
+  if (GetStream(module_info.module_sym_stream) == NULL ||
+      !module_stream.Init(GetStream(module_info.module_sym_stream))) {
+    LOG(ERROR) << "Unable to read module stream.";
+    return false;
+  }
+
+  // The symbols are followed by the C11 line numbers, which we don't
+  // support, as the compilers we use have long since stopped emitting them,
+  // and then by the C13 line numbers.
+  size_t lines_start = module_info.sym_byte_size + module_info.c11_byte_size;
+  size_t lines_end = lines_start + module_info.c13_byte_size;
+  if (lines_end > module_stream.length()) {
+    LOG(ERROR) << "Module stream is too short.";
+    return false;
+  }
+
+  BinaryBufferParser parser(module_stream.data(), module_stream.length());
+  return ReadProcedures(&parser, module_info.sym_byte_size) &&
+      ReadLines(&parser, lines_start, lines_end);
+}
+
+bool PdbSymbolizer::Builder::ReadProcedures(BinaryBufferParser* parser,
+                                            size_t end) {
+  DCHECK(parser != NULL);
+
+  // The symbols follow the stream's signature.
+  size_t pos = sizeof(uint32);
+  while (pos < end) {
+    const SymbolRecordHeader* record = NULL;
+    if (!parser->GetAt(pos, &record) ||
+        record->length < sizeof(record->type)) {
+      LOG(ERROR) << "Module stream has a malformed symbol record.";
+      return false;
+    }
+
+    if (record->type == kS_GPROC32 || record->type == kS_LPROC32 ||
+        record->type == kS_GPROC32_ID || record->type == kS_LPROC32_ID) {
+      const ProcSym* proc = NULL;
+      const char* name = NULL;
+      size_t name_length = 0;
+      if (!parser->GetAt(pos + sizeof(*record), &proc) ||
+          !parser->GetStringAt(pos + sizeof(*record) + sizeof(*proc),
+                               &name, &name_length)) {
+        LOG(ERROR) << "Module stream has a truncated procedure.";
+        return false;
+      }
+
+      FunctionEntry function = {};
+      if (GetRva(proc->segment, proc->offset, &function.rva)) {
+        function.size = proc->length;
+        function.name = AddString(name);
+        symbolizer_->owned_functions_.push_back(function);
+      }
+    }
+
+    pos += sizeof(record->length) + record->length;
+  }
+
+  return true;
+}
+
+bool PdbSymbolizer::Builder::ReadLines(BinaryBufferParser* parser,
+                                       size_t start,
+                                       size_t end) {
+  DCHECK(parser != NULL);
+
+  // The line number subsections refer to the file checksums subsection for
+  // their files, which may come after them, so we find it first. The
+  // checksums identify their files by offset in the names stream.
+  std::map<uint32, uint32> files;
+  for (size_t pos = start; pos < end; ) {
+    const DebugSubsectionHeader* header = NULL;
+    if (!parser->GetAt(pos, &header) ||
+        header->length > end - pos - sizeof(*header)) {
+      LOG(ERROR) << "Module stream has a malformed line number subsection.";
+      return false;
+    }
+
+    size_t data_start = pos + sizeof(*header);
+    size_t data_end = data_start + header->length;
+    if (header->type == kDebugSubsectionFileChecksums) {
+      BinaryBufferParser names_parser(names_.data(), names_.length());
+      for (size_t entry_pos = data_start; entry_pos < data_end; ) {
+        const FileChecksumHeader* checksum = NULL;
+        if (!parser->GetAt(entry_pos, &checksum)) {
+          LOG(ERROR) << "Module stream has a truncated file checksum.";
+          return false;
+        }
+
+        const char* name = NULL;
+        size_t name_length = 0;
+        uint32 name_offset = 0;
+        if (names_parser.GetStringAt(
+                sizeof(NamesStreamHeader) + checksum->name_offset,
+                &name, &name_length)) {
+          name_offset = AddString(name);
+        }
+        files[entry_pos - data_start] = name_offset;
+
+        entry_pos += sizeof(*checksum) + checksum->checksum_size;
+        entry_pos = (entry_pos + 3) & ~3;
+      }
+    }
+
+    pos = (data_end + 3) & ~3;
+  }
+
+  for (size_t pos = start; pos < end; ) {
+    const DebugSubsectionHeader* header = NULL;
+    bool found = parser->GetAt(pos, &header);
+    DCHECK(found);
+
+    size_t data_start = pos + sizeof(*header);
+    size_t data_end = data_start + header->length;
+    if (header->type == kDebugSubsectionLines &&
+        !ReadLinesSubsection(parser, data_start, data_end, files)) {
+      return false;
+    }
+
+    pos = (data_end + 3) & ~3;
+  }
+
+  return true;
+}
+
+bool PdbSymbolizer::Builder::ReadLinesSubsection(
+    BinaryBufferParser* parser,
+    size_t start,
+    size_t end,
+    const std::map<uint32, uint32>& files) {
+  DCHECK(parser != NULL);
+
+  const LinesHeader* header = NULL;
+  if (!parser->GetAt(start, &header)) {
+    LOG(ERROR) << "Module stream has a truncated line number subsection.";
+    return false;
+  }
+
+  std::vector<LineEntry>& lines = symbolizer_->owned_lines_;
+  size_t pos = start + sizeof(*header);
+  while (pos < end) {
+    const LinesBlockHeader* block = NULL;
+    const LineNumber* line_numbers = NULL;
+    if (!parser->GetAt(pos, &block) ||
+        block->block_size < sizeof(*block) ||
+        block->block_size > end - pos ||
+        !parser->GetAt(pos + sizeof(*block),
+                       block->num_lines * sizeof(LineNumber),
+                       &line_numbers)) {
+      LOG(ERROR) << "Module stream has a malformed line number block.";
+      return false;
+    }
+
+    std::map<uint32, uint32>::const_iterator file(files.find(block->file_id));
+    uint32 file_name = file != files.end() ? file->second : 0;
+
+    for (size_t i = 0; i < block->num_lines; ++i) {
+      LineEntry line = {};
+      if (!GetRva(header->segment,
+                  header->offset + line_numbers[i].offset,
+                  &line.rva)) {
+        continue;
+      }
+
+      line.line = line_numbers[i].flags & kLineNumberMask;
+      if (line.line == kHiddenLine || line.line == kHiddenLine2)
+        line.line = 0;
+      line.file = line.line != 0 ? file_name : 0;
+      lines.push_back(line);
+    }
+
+    pos += block->block_size;
+  }
+
+  // End the last run of lines at the end of the code.
+  LineEntry line = {};
+  if (GetRva(header->segment, header->offset + header->code_size, &line.rva))
+    lines.push_back(line);
+
+  return true;
+}
+
+bool PdbSymbolizer::Builder::ReadPublics(int stream_index) {
+  PdbByteStream symbol_stream;
+  if (GetStream(stream_index) == NULL ||
+      !symbol_stream.Init(GetStream(stream_index))) {
+    LOG(ERROR) << "Unable to read symbol record stream.";
+    return false;
+  }
+
+  BinaryBufferParser parser(symbol_stream.data(), symbol_stream.length());
+  size_t pos = 0;
+  while (pos < symbol_stream.length()) {
+    const SymbolRecordHeader* record = NULL;
+    if (!parser.GetAt(pos, &record) ||
+        record->length < sizeof(record->type)) {
+      LOG(ERROR) << "Symbol record stream has a malformed record.";
+      return false;
+    }
+
+    if (record->type == kS_PUB32) {
+      const PublicSym* symbol = NULL;
+      const char* name = NULL;
+      size_t name_length = 0;
+      if (!parser.GetAt(pos + sizeof(*record), &symbol) ||
+          !parser.GetStringAt(pos + sizeof(*record) + sizeof(*symbol),
+                              &name, &name_length)) {
+        LOG(ERROR) << "Symbol record stream has a truncated public symbol.";
+        return false;
+      }
+
+      // Publics have no size, so they're taken to extend to the end of
+      // their section, until FinishTables cuts them short at the next
+      // function.
+      FunctionEntry function = {};
+      if ((symbol->flags & (kPublicCode | kPublicFunction)) != 0 &&
+          GetRva(symbol->segment, symbol->offset, &function.rva)) {
+        const IMAGE_SECTION_HEADER& section = sections_[symbol->segment - 1];
+        if (symbol->offset < section.Misc.VirtualSize)
+          function.size = section.Misc.VirtualSize - symbol->offset;
+        function.name = AddString(name);
+        symbolizer_->owned_functions_.push_back(function);
+      }
+    }
+
+    pos += sizeof(record->length) + record->length;
+  }
+
+  return true;
+}
+
+void PdbSymbolizer::Builder::FinishTables() {
+  // The procedures precede the publics, and we keep the first function at
+  // each address, so procedures take precedence over the publics for the
+  // same functions, which carry decorated names.
+  std::vector<FunctionEntry>& functions = symbolizer_->owned_functions_;
+  std::stable_sort(functions.begin(), functions.end(),
+                   EntryRvaLess<FunctionEntry>);
+  functions.erase(std::unique(functions.begin(), functions.end(),
+                              EntryRvaEqual<FunctionEntry>),
+                  functions.end());
+  for (size_t i = 0; i + 1 < functions.size(); ++i) {
+    uint32 gap = functions[i + 1].rva - functions[i].rva;
+    functions[i].size = std::min(functions[i].size, gap);
+  }
+
+  // Likewise, a run of lines takes precedence over the end of another at
+  // the same address. Consecutive runs of the same line are merged.
+  std::vector<LineEntry>& lines = symbolizer_->owned_lines_;
+  std::sort(lines.begin(), lines.end(), LineEntryLess);
+  lines.erase(std::unique(lines.begin(), lines.end(),
+                          EntryRvaEqual<LineEntry>),
+              lines.end());
+  lines.erase(std::unique(lines.begin(), lines.end(), IsSameLine),
+              lines.end());
+}
+
+bool PdbSymbolizer::Builder::LineEntryLess(const LineEntry& line1,
+                                           const LineEntry& line2) {
+  if (line1.rva != line2.rva)
+    return line1.rva < line2.rva;
+  return line1.line != 0 && line2.line == 0;
+}
+
+bool PdbSymbolizer::Builder::IsSameLine(const LineEntry& line1,
+                                        const LineEntry& line2) {
+  return line1.file == line2.file && line1.line == line2.line;
+}
+
+bool PdbSymbolizer::Builder::GetRva(uint16 segment,
+                                    uint32 offset,
+                                    uint32* rva) const {
+  DCHECK(rva != NULL);
+
+  // Segments are numbered from 1.
+  if (segment == 0 || segment > sections_.size())
+    return false;
+
+  *rva = sections_[segment - 1].VirtualAddress + offset;
+  if (has_omap_)
+    *rva = omap_.Translate(*rva);
+
+  // OMAP maps addresses that were dropped from the image to 0.
+  return *rva != 0;
+}
+
+uint32 PdbSymbolizer::Builder::AddString(const char* str) {
+  DCHECK(str != NULL);
+
+  std::vector<char>& strings = symbolizer_->owned_strings_;
+  std::pair<StringMap::iterator, bool> inserted(
+      string_offsets_.insert(std::make_pair(str, strings.size())));
+  if (inserted.second)
+    strings.insert(strings.end(), str, str + strlen(str) + 1);
+
+  return inserted.first->second;
+}
+
+PdbSymbolizer::PdbSymbolizer() {
+  Reset();
+}
+
+PdbSymbolizer::~PdbSymbolizer() {
+}
+
+bool PdbSymbolizer::Init(const FilePath& pdb_path) {
+  Reset();
+
+  Builder builder(this);
+  if (!builder.Build(pdb_path)) {
+    Reset();
+    return false;
+  }
+
+  UseOwnedTables();
+  return true;
+}
+
+bool PdbSymbolizer::Save(const FilePath& path) const {
+  core::SectionedFileWriter file_writer(kSymbolCacheMagic,
+                                        kSymbolCacheVersion);
+
+  core::CompactWriter info_writer(file_writer.AddSection(INFO_SECTION));
+  info_writer.WriteBytes(sizeof(signature_), &signature_);
+  info_writer.WriteUint32(age_);
+
+  // The tables and strings are written raw, so that they can be used in
+  // place when the file is mapped.
+  core::CompactWriter function_writer(
+      file_writer.AddSection(FUNCTION_SECTION));
+  function_writer.WriteBytes(num_functions_ * sizeof(FunctionEntry),
+                             functions_);
+  core::CompactWriter line_writer(file_writer.AddSection(LINE_SECTION));
+  line_writer.WriteBytes(num_lines_ * sizeof(LineEntry), lines_);
+  core::CompactWriter string_writer(file_writer.AddSection(STRING_SECTION));
+  string_writer.WriteBytes(strings_size_, strings_);
+
+  if (!file_writer.WriteToFile(path)) {
+    LOG(ERROR) << "Unable to write symbol cache \"" << path.value() << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+bool PdbSymbolizer::Load(const FilePath& path) {
+  Reset();
+
+  mapped_file_.reset(new file_util::MemoryMappedFile());
+  if (!mapped_file_->Initialize(path)) {
+    LOG(ERROR) << "Unable to map symbol cache \"" << path.value() << "\".";
+    Reset();
+    return false;
+  }
+
+  core::SectionedFileReader file_reader;
+  if (!file_reader.Init(kSymbolCacheMagic, kSymbolCacheVersion,
+                        mapped_file_->data(), mapped_file_->length())) {
+    LOG(ERROR) << "\"" << path.value() << "\" is not a symbol cache.";
+    Reset();
+    return false;
+  }
+
+  const uint8* info = NULL;
+  size_t info_size = 0;
+  const char* strings = NULL;
+  if (!file_reader.GetSection(INFO_SECTION, &info, &info_size) ||
+      !GetTableSection(file_reader, FUNCTION_SECTION, &functions_,
+                       &num_functions_) ||
+      !GetTableSection(file_reader, LINE_SECTION, &lines_, &num_lines_) ||
+      !GetTableSection(file_reader, STRING_SECTION, &strings,
+                       &strings_size_)) {
+    Reset();
+    return false;
+  }
+  strings_ = strings;
+
+  core::CompactReader info_reader(info, info_size);
+  const uint8* signature = NULL;
+  if (!info_reader.ReadBytes(sizeof(signature_), &signature) ||
+      !info_reader.ReadUint32(&age_)) {
+    LOG(ERROR) << "Symbol cache has a truncated info section.";
+    Reset();
+    return false;
+  }
+  memcpy(&signature_, signature, sizeof(signature_));
+
+  // Make sure every string the tables refer to is terminated within the
+  // pool, so that lookups needn't check.
+  bool valid = strings_size_ != 0 && strings_[strings_size_ - 1] == '\0';
+  for (size_t i = 0; valid && i < num_functions_; ++i)
+    valid = functions_[i].name < strings_size_;
+  for (size_t i = 0; valid && i < num_lines_; ++i)
+    valid = lines_[i].file < strings_size_;
+  if (!valid) {
+    LOG(ERROR) << "Symbol cache has a malformed string section.";
+    Reset();
+    return false;
+  }
+
+  return true;
+}
+
+bool PdbSymbolizer::Symbolize(uint32 rva, Symbol* symbol) const {
+  DCHECK(symbol != NULL);
+
+  return MakeSymbol(rva,
+                    FindEntry(functions_, num_functions_, rva),
+                    FindEntry(lines_, num_lines_, rva),
+                    symbol);
+}
+
+size_t PdbSymbolizer::SymbolizeBatch(size_t count,
+                                     const uint32* rvas,
+                                     Symbol* symbols) const {
+  DCHECK(count == 0 || rvas != NULL);
+  DCHECK(count == 0 || symbols != NULL);
+
+  size_t num_found = 0;
+  size_t i = 0;
+  for (; i + kBatchSize <= count; i += kBatchSize) {
+    size_t functions[kBatchSize];
+    size_t lines[kBatchSize];
+    FindEntries(functions_, num_functions_, rvas + i, functions);
+    FindEntries(lines_, num_lines_, rvas + i, lines);
+
+    for (size_t j = 0; j < kBatchSize; ++j) {
+      if (MakeSymbol(rvas[i + j], functions[j], lines[j], &symbols[i + j]))
+        ++num_found;
+    }
+  }
+
+  // Look up whatever doesn't fill a batch one at a time.
+  for (; i < count; ++i) {
+    if (Symbolize(rvas[i], &symbols[i]))
+      ++num_found;
+  }
+
+  return num_found;
+}
+
+void PdbSymbolizer::Reset() {
+  memset(&signature_, 0, sizeof(signature_));
+  age_ = 0;
+
+  functions_ = NULL;
+  num_functions_ = 0;
+  lines_ = NULL;
+  num_lines_ = 0;
+  strings_ = NULL;
+  strings_size_ = 0;
+
+  owned_functions_.clear();
+  owned_lines_.clear();
+  owned_strings_.clear();
+  mapped_file_.reset();
+}
+
+void PdbSymbolizer::UseOwnedTables() {
+  functions_ = owned_functions_.empty() ? NULL : &owned_functions_[0];
+  num_functions_ = owned_functions_.size();
+  lines_ = owned_lines_.empty() ? NULL : &owned_lines_[0];
+  num_lines_ = owned_lines_.size();
+  strings_ = owned_strings_.empty() ? NULL : &owned_strings_[0];
+  strings_size_ = owned_strings_.size();
+}
+
+bool PdbSymbolizer::MakeSymbol(uint32 rva,
+                               size_t function,
+                               size_t line,
+                               Symbol* symbol) const {
+  DCHECK(symbol != NULL);
+
+  symbol->name = NULL;
+  symbol->offset = 0;
+  symbol->size = 0;
+  symbol->file = NULL;
+  symbol->line = 0;
+
+  if (function >= num_functions_ ||
+      rva - functions_[function].rva >= functions_[function].size) {
+    return false;
+  }
+
+  const FunctionEntry& entry = functions_[function];
+  symbol->name = strings_ + entry.name;
+  symbol->offset = rva - entry.rva;
+  symbol->size = entry.size;
+
+  if (line < num_lines_ && lines_[line].line != 0) {
+    symbol->file = strings_ + lines_[line].file;
+    symbol->line = lines_[line].line;
+  }
+
+  return true;
+}
+
+}  // namespace pdb
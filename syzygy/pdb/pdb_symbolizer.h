@@ -0,0 +1,165 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares PdbSymbolizer, which symbolizes addresses straight from a PDB
+// file, without the help of dbghelp.
+
+#ifndef SYZYGY_PDB_PDB_SYMBOLIZER_H_
+#define SYZYGY_PDB_PDB_SYMBOLIZER_H_
+
+#include <windows.h>
+#include <vector>
+#include "base/basictypes.h"
+#include "base/file_path.h"
+#include "base/file_util.h"
+#include "base/scoped_ptr.h"
+
+namespace pdb {
+
+// Maps addresses in an image to the functions and source lines they belong
+// to, using the image's PDB file.
+//
+// The symbolizer reads the procedures and line numbers of each module in the
+// DBI stream, as well as the public symbols, once. These are kept in two
+// sorted tables of fixed-width entries, which refer to a pool of strings.
+// The tables can be saved to a cache file, which is memory mapped when
+// loaded, so that subsequent runs needn't parse the PDB file at all.
+//
+// Once initialized, a symbolizer is never modified, so it may be used from
+// any number of threads at once.
+class PdbSymbolizer {
+ public:
+  // The result of a lookup. The strings belong to the symbolizer, and are
+  // valid for as long as it's initialized.
+  struct Symbol {
+    // The name of the function, or NULL if the address is in none.
+    const char* name;
+    // The offset of the address from the start of the function.
+    uint32 offset;
+    // The size of the function.
+    uint32 size;
+    // The source file and line of the address, or NULL and 0 if they
+    // aren't known.
+    const char* file;
+    uint32 line;
+  };
+
+  PdbSymbolizer();
+  ~PdbSymbolizer();
+
+  // Reads the symbols and line numbers of a PDB file.
+  // @param pdb_path the PDB file to read.
+  // @returns true on success.
+  bool Init(const FilePath& pdb_path);
+
+  // Saves the symbols and line numbers to a cache file.
+  // @param path the file to write.
+  // @returns true on success.
+  bool Save(const FilePath& path) const;
+
+  // Loads the symbols and line numbers from a cache file written by Save.
+  // The file is mapped for as long as the symbolizer is initialized from it.
+  // @param path the file to load.
+  // @returns true on success.
+  bool Load(const FilePath& path);
+
+  // Looks up a single address.
+  // @param rva the relative address to look up.
+  // @param symbol returns the function and line of @p rva.
+  // @returns true iff @p rva lies in a function.
+  bool Symbolize(uint32 rva, Symbol* symbol) const;
+
+  // Looks up a batch of addresses. This is considerably faster than
+  // looking up the addresses one at a time.
+  // @param count the number of addresses to look up.
+  // @param rvas the relative addresses to look up.
+  // @param symbols returns the @p count functions and lines of @p rvas.
+  // @returns the number of addresses that lie in a function.
+  size_t SymbolizeBatch(size_t count,
+                        const uint32* rvas,
+                        Symbol* symbols) const;
+
+  // Returns the signature of the PDB file, which matches the signature in
+  // the debug directory of its image.
+  const GUID& signature() const { return signature_; }
+  // Returns the age of the PDB file.
+  uint32 age() const { return age_; }
+
+  // Returns the number of functions.
+  size_t num_functions() const { return num_functions_; }
+  // Returns the number of line number entries, including those that mark the
+  // end of a run of lines.
+  size_t num_lines() const { return num_lines_; }
+
+ protected:
+  // A function, in order of rva.
+  struct FunctionEntry {
+    uint32 rva;
+    uint32 size;
+    // The offset of the function's name in the string pool.
+    uint32 name;
+  };
+
+  // The start of a run of addresses with the same source line, in order of
+  // rva. A run ends where the next one starts, and runs that aren't followed
+  // by another are ended by an entry for line 0.
+  struct LineEntry {
+    uint32 rva;
+    // The offset of the source file's name in the string pool.
+    uint32 file;
+    uint32 line;
+  };
+
+  class Builder;
+
+  // Drops the current symbols.
+  void Reset();
+  // Points the tables at the contents of the owned vectors.
+  void UseOwnedTables();
+
+  // Fills in @p symbol, given the indices of the last function and line
+  // entries at or before @p rva, or an index past the end of the tables if
+  // there are none.
+  bool MakeSymbol(uint32 rva,
+                  size_t function,
+                  size_t line,
+                  Symbol* symbol) const;
+
+  GUID signature_;
+  uint32 age_;
+
+  // The tables and string pool. These point either into the owned vectors
+  // or into the mapped cache file.
+  const FunctionEntry* functions_;
+  size_t num_functions_;
+  const LineEntry* lines_;
+  size_t num_lines_;
+  const char* strings_;
+  size_t strings_size_;
+
+  // The tables and string pool, when read from a PDB file.
+  std::vector<FunctionEntry> owned_functions_;
+  std::vector<LineEntry> owned_lines_;
+  std::vector<char> owned_strings_;
+
+  // The cache file, when loaded from one.
+  scoped_ptr<file_util::MemoryMappedFile> mapped_file_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PdbSymbolizer);
+};
+
+}  // namespace pdb
+
+#endif  // SYZYGY_PDB_PDB_SYMBOLIZER_H_
@@ -0,0 +1,314 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_symbolizer.h"
+
+#include <algorithm>
+#include "base/file_util.h"
+#include "base/logging.h"
+#include "base/path_service.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/pdb/pdb_util.h"
+
+namespace pdb {
+
+namespace {
+
+const wchar_t* kTestPdbFilePath =
+    L"syzygy\\pdb\\test_data\\test_dll.pdb";
+
+// The test DLL's code section, and two of the functions in it.
+const uint32 kTextStart = 0x1000;
+const uint32 kTextSize = 43640;
+const uint32 kDllMainRva = 0x1000;
+const uint32 kDllMainSize = 344;
+const uint32 kTestExportRva = 0x1160;
+
+FilePath GetSrcRelativePath(const wchar_t* path) {
+  FilePath src_dir;
+  PathService::Get(base::DIR_SOURCE_ROOT, &src_dir);
+  return src_dir.Append(path);
+}
+
+bool EndsWith(const char* str, const char* suffix) {
+  size_t str_length = strlen(str);
+  size_t suffix_length = strlen(suffix);
+  return str_length >= suffix_length &&
+      strcmp(str + str_length - suffix_length, suffix) == 0;
+}
+
+bool SymbolsEqual(const PdbSymbolizer::Symbol& symbol1,
+                  const PdbSymbolizer::Symbol& symbol2) {
+  if ((symbol1.name == NULL) != (symbol2.name == NULL) ||
+      (symbol1.file == NULL) != (symbol2.file == NULL)) {
+    return false;
+  }
+  return (symbol1.name == NULL || strcmp(symbol1.name, symbol2.name) == 0) &&
+      (symbol1.file == NULL || strcmp(symbol1.file, symbol2.file) == 0) &&
+      symbol1.offset == symbol2.offset &&
+      symbol1.size == symbol2.size &&
+      symbol1.line == symbol2.line;
+}
+
+class PdbSymbolizerTest : public testing::Test {
+ public:
+  void SetUp() {
+    FilePath temp_dir;
+    ASSERT_TRUE(file_util::GetTempDir(&temp_dir));
+    temp_cache_path_ = temp_dir.Append(L"pdb_symbolizer_unittest.cache");
+    temp_pdb_path_ = temp_dir.Append(L"pdb_symbolizer_unittest.pdb");
+  }
+
+  void TearDown() {
+    file_util::Delete(temp_cache_path_, false);
+    file_util::Delete(temp_pdb_path_, false);
+  }
+
+  // Expects @p symbolizer2 to symbolize every address around the code
+  // section just like @p symbolizer1.
+  void ExpectSameSymbols(const PdbSymbolizer& symbolizer1,
+                         const PdbSymbolizer& symbolizer2) {
+    for (uint32 rva = 0; rva < kTextStart + kTextSize + 0x100; ++rva) {
+      PdbSymbolizer::Symbol symbol1 = {};
+      PdbSymbolizer::Symbol symbol2 = {};
+      ASSERT_EQ(symbolizer1.Symbolize(rva, &symbol1),
+                symbolizer2.Symbolize(rva, &symbol2));
+      ASSERT_TRUE(SymbolsEqual(symbol1, symbol2)) << "At " << rva << ".";
+    }
+  }
+
+ protected:
+  FilePath temp_cache_path_;
+  FilePath temp_pdb_path_;
+};
+
+}  // namespace
+
+TEST_F(PdbSymbolizerTest, Init) {
+  PdbSymbolizer symbolizer;
+  ASSERT_TRUE(symbolizer.Init(GetSrcRelativePath(kTestPdbFilePath)));
+
+  EXPECT_LT(0U, symbolizer.num_functions());
+  EXPECT_LT(0U, symbolizer.num_lines());
+  GUID null_guid = {};
+  EXPECT_NE(0, memcmp(&null_guid, &symbolizer.signature(),
+                      sizeof(null_guid)));
+  EXPECT_LT(0U, symbolizer.age());
+}
+
+TEST_F(PdbSymbolizerTest, InitFailsOnMissingFile) {
+  PdbSymbolizer symbolizer;
+  EXPECT_FALSE(symbolizer.Init(temp_pdb_path_));
+  EXPECT_EQ(0U, symbolizer.num_functions());
+}
+
+TEST_F(PdbSymbolizerTest, Symbolize) {
+  PdbSymbolizer symbolizer;
+  ASSERT_TRUE(symbolizer.Init(GetSrcRelativePath(kTestPdbFilePath)));
+
+  PdbSymbolizer::Symbol symbol = {};
+  ASSERT_TRUE(symbolizer.Symbolize(kDllMainRva, &symbol));
+  EXPECT_STREQ("DllMain", symbol.name);
+  EXPECT_EQ(0U, symbol.offset);
+  EXPECT_EQ(kDllMainSize, symbol.size);
+  ASSERT_TRUE(symbol.file != NULL);
+  EXPECT_TRUE(EndsWith(symbol.file, "test_dll.cc")) << symbol.file;
+  EXPECT_LT(0U, symbol.line);
+  uint32 first_line = symbol.line;
+
+  // The last byte of the function is later in the same file.
+  ASSERT_TRUE(symbolizer.Symbolize(kDllMainRva + kDllMainSize - 1, &symbol));
+  EXPECT_STREQ("DllMain", symbol.name);
+  EXPECT_EQ(kDllMainSize - 1, symbol.offset);
+  ASSERT_TRUE(symbol.file != NULL);
+  EXPECT_TRUE(EndsWith(symbol.file, "test_dll.cc")) << symbol.file;
+  EXPECT_LT(first_line, symbol.line);
+
+  ASSERT_TRUE(symbolizer.Symbolize(kTestExportRva + 4, &symbol));
+  EXPECT_STREQ("TestExport", symbol.name);
+  EXPECT_EQ(4U, symbol.offset);
+
+  // Addresses outside any function come up empty.
+  EXPECT_FALSE(symbolizer.Symbolize(0, &symbol));
+  EXPECT_TRUE(symbol.name == NULL);
+  EXPECT_TRUE(symbol.file == NULL);
+  EXPECT_FALSE(symbolizer.Symbolize(0xFFFFFFFF, &symbol));
+  EXPECT_TRUE(symbol.name == NULL);
+}
+
+TEST_F(PdbSymbolizerTest, CoversCodeSection) {
+  PdbSymbolizer symbolizer;
+  ASSERT_TRUE(symbolizer.Init(GetSrcRelativePath(kTestPdbFilePath)));
+
+  // Most of the code section is made up of functions, most of which have
+  // line numbers.
+  size_t num_functions = 0;
+  size_t num_lines = 0;
+  for (uint32 rva = kTextStart; rva < kTextStart + kTextSize; ++rva) {
+    PdbSymbolizer::Symbol symbol = {};
+    if (!symbolizer.Symbolize(rva, &symbol))
+      continue;
+    ASSERT_TRUE(symbol.name != NULL);
+    ASSERT_LT(symbol.offset, symbol.size);
+    ++num_functions;
+    if (symbol.file != NULL)
+      ++num_lines;
+  }
+  EXPECT_LT(kTextSize * 3 / 4, num_functions);
+  EXPECT_LT(num_functions / 2, num_lines);
+}
+
+TEST_F(PdbSymbolizerTest, SymbolizeBatchMatchesSymbolize) {
+  PdbSymbolizer symbolizer;
+  ASSERT_TRUE(symbolizer.Init(GetSrcRelativePath(kTestPdbFilePath)));
+
+  // Include a few addresses that don't fill a batch.
+  std::vector<uint32> rvas;
+  for (uint32 rva = 0; rva < kTextStart + kTextSize + 0x103; ++rva)
+    rvas.push_back(rva);
+  std::reverse(rvas.begin(), rvas.end());
+
+  std::vector<PdbSymbolizer::Symbol> symbols(rvas.size());
+  size_t num_found =
+      symbolizer.SymbolizeBatch(rvas.size(), &rvas[0], &symbols[0]);
+
+  size_t expected_found = 0;
+  for (size_t i = 0; i < rvas.size(); ++i) {
+    PdbSymbolizer::Symbol symbol = {};
+    if (symbolizer.Symbolize(rvas[i], &symbol))
+      ++expected_found;
+    ASSERT_TRUE(SymbolsEqual(symbol, symbols[i])) << "At " << rvas[i] << ".";
+  }
+  EXPECT_EQ(expected_found, num_found);
+}
+
+TEST_F(PdbSymbolizerTest, SaveAndLoad) {
+  PdbSymbolizer symbolizer;
+  ASSERT_TRUE(symbolizer.Init(GetSrcRelativePath(kTestPdbFilePath)));
+  ASSERT_TRUE(symbolizer.Save(temp_cache_path_));
+
+  PdbSymbolizer loaded;
+  ASSERT_TRUE(loaded.Load(temp_cache_path_));
+  EXPECT_EQ(symbolizer.num_functions(), loaded.num_functions());
+  EXPECT_EQ(symbolizer.num_lines(), loaded.num_lines());
+  EXPECT_EQ(0, memcmp(&symbolizer.signature(), &loaded.signature(),
+                      sizeof(GUID)));
+  EXPECT_EQ(symbolizer.age(), loaded.age());
+
+  ASSERT_NO_FATAL_FAILURE(ExpectSameSymbols(symbolizer, loaded));
+}
+
+TEST_F(PdbSymbolizerTest, LoadRejectsOtherFiles) {
+  PdbSymbolizer symbolizer;
+  EXPECT_FALSE(symbolizer.Load(temp_cache_path_));
+  EXPECT_FALSE(symbolizer.Load(GetSrcRelativePath(kTestPdbFilePath)));
+  EXPECT_EQ(0U, symbolizer.num_functions());
+
+  PdbSymbolizer::Symbol symbol = {};
+  EXPECT_FALSE(symbolizer.Symbolize(kDllMainRva, &symbol));
+}
+
+TEST_F(PdbSymbolizerTest, TranslatesThroughOmap) {
+  PdbSymbolizer original;
+  ASSERT_TRUE(original.Init(GetSrcRelativePath(kTestPdbFilePath)));
+
+  // Move the code section up by a page, and leave the rest alone.
+  const uint32 kShift = 0x1000;
+  std::vector<OMAP> omap_to;
+  std::vector<OMAP> omap_from;
+  OMAP to_text = { kTextStart + kShift, kTextStart };
+  OMAP to_rest = { kTextStart + kShift + kTextSize, kTextStart + kTextSize };
+  omap_to.push_back(to_text);
+  omap_to.push_back(to_rest);
+  OMAP from_text = { kTextStart, kTextStart + kShift };
+  OMAP from_rest = { kTextStart + kTextSize, kTextStart + kTextSize };
+  omap_from.push_back(from_text);
+  omap_from.push_back(from_rest);
+
+  GUID guid = { 0x12345678, 0x1234, 0x5678,
+                { 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0 } };
+  ASSERT_TRUE(AddOmapStreamToPdbFile(GetSrcRelativePath(kTestPdbFilePath),
+                                     temp_pdb_path_,
+                                     guid,
+                                     omap_to,
+                                     omap_from));
+
+  PdbSymbolizer relinked;
+  ASSERT_TRUE(relinked.Init(temp_pdb_path_));
+  EXPECT_EQ(0, memcmp(&guid, &relinked.signature(), sizeof(guid)));
+
+  PdbSymbolizer::Symbol symbol = {};
+  ASSERT_TRUE(relinked.Symbolize(kDllMainRva + kShift, &symbol));
+  EXPECT_STREQ("DllMain", symbol.name);
+  EXPECT_EQ(0U, symbol.offset);
+
+  for (uint32 rva = kTextStart; rva < kTextStart + kTextSize; ++rva) {
+    PdbSymbolizer::Symbol expected = {};
+    PdbSymbolizer::Symbol moved = {};
+    original.Symbolize(rva, &expected);
+    relinked.Symbolize(rva + kShift, &moved);
+    ASSERT_TRUE(SymbolsEqual(expected, moved)) << "At " << rva << ".";
+  }
+}
+
+// Times building the symbolizer from the test PDB against loading it back
+// from its cache, then symbolizes ten million addresses scattered over the
+// code section one at a time and as one batch. Disabled by default.
+TEST_F(PdbSymbolizerTest, DISABLED_SymbolizationBenchmark) {
+  const size_t kNumAddresses = 10000000;
+
+  PdbSymbolizer symbolizer;
+  base::Time start = base::Time::Now();
+  ASSERT_TRUE(symbolizer.Init(GetSrcRelativePath(kTestPdbFilePath)));
+  base::TimeDelta init_time = base::Time::Now() - start;
+  ASSERT_TRUE(symbolizer.Save(temp_cache_path_));
+
+  PdbSymbolizer loaded;
+  start = base::Time::Now();
+  ASSERT_TRUE(loaded.Load(temp_cache_path_));
+  base::TimeDelta load_time = base::Time::Now() - start;
+
+  // Scatter the addresses over the code section.
+  std::vector<uint32> rvas(kNumAddresses);
+  uint32 seed = 0xFAB;
+  for (size_t i = 0; i < kNumAddresses; ++i) {
+    seed = seed * 1103515245 + 12345;
+    rvas[i] = kTextStart + (seed >> 8) % kTextSize;
+  }
+
+  std::vector<PdbSymbolizer::Symbol> symbols(kNumAddresses);
+  start = base::Time::Now();
+  for (size_t i = 0; i < kNumAddresses; ++i)
+    loaded.Symbolize(rvas[i], &symbols[i]);
+  base::TimeDelta single_time = base::Time::Now() - start;
+
+  start = base::Time::Now();
+  loaded.SymbolizeBatch(kNumAddresses, &rvas[0], &symbols[0]);
+  base::TimeDelta batched_time = base::Time::Now() - start;
+
+  LOG(INFO) << loaded.num_functions() << " functions and "
+            << loaded.num_lines() << " line entries.";
+  LOG(INFO) << "PdbSymbolizer::Init: " << init_time.InMilliseconds()
+            << " ms.";
+  LOG(INFO) << "PdbSymbolizer::Load: " << load_time.InMilliseconds()
+            << " ms.";
+  LOG(INFO) << kNumAddresses << " lookups.";
+  LOG(INFO) << "PdbSymbolizer::Symbolize: " << single_time.InMilliseconds()
+            << " ms.";
+  LOG(INFO) << "PdbSymbolizer::SymbolizeBatch: "
+            << batched_time.InMilliseconds() << " ms.";
+}
+
+}  // namespace pdb
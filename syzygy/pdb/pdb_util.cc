@@ -123,9 +123,10 @@ bool AddOmapStreamToPdbFile(const FilePath& input_file,
     streams[dbi_dbg_header->omap_from_src] = &omap_from_stream;
   }
 
-  // Write the new Pdb file.
+  // Write the new Pdb file. Only the streams replaced above have changed, so
+  // the rest are left where they are in a copy of the input file.
   PdbWriter writer;
-  if (!writer.Write(output_file, streams)) {
+  if (!writer.WriteIncremental(reader, output_file, streams)) {
     LOG(ERROR) << "Failed to write '" << output_file.value() << "'";
     return false;
   }
@@ -14,14 +14,28 @@
 
 #include "syzygy/pdb/pdb_writer.h"
 
+#include <algorithm>
 #include "base/logging.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_data.h"
+#include "syzygy/pdb/pdb_reader.h"
 
 namespace pdb {
 
 const uint32 kZeroBuffer[kPdbPageSize] = { 0 };
 
+namespace {
+
+// The free page maps occupy the second and third pages of every interval of
+// kPdbPageSize pages, so other data must not be written there.
+bool IsFreePageMapPage(uint32 page) {
+  uint32 index = page % kPdbPageSize;
+  return index == 1 || index == 2;
+}
+
+}  // namespace
+
 PdbWriter::PdbWriter() {
 }
 
@@ -72,19 +86,94 @@ bool PdbWriter::Write(const FilePath& pdb_path,
     return false;
   total_bytes += bytes_written;
 
-  // Map out the directory roots: i.e., pages on which the directory has been
-  // written.
-  uint32 dir_root_size = 0;
-  uint32 dir_root_page = (total_bytes / kPdbPageSize);
-  if (!WriteDirectoryPages(dir_size, dir_page, &dir_root_size, &bytes_written))
+  return WriteDirectoryPagesAndHeader(dir_size, dir_page, total_bytes);
+}
+
+bool PdbWriter::WriteIncremental(const PdbReader& source,
+                                 const FilePath& pdb_path,
+                                 const std::vector<PdbStream*>& streams) {
+  // The helpers used to write the new pages assume the default page size.
+  if (source.page_size() != kPdbPageSize) {
+    LOG(ERROR) << "Unable to update '" << source.path().value()
+               << "' with page size " << source.page_size();
     return false;
-  total_bytes += bytes_written;
+  }
 
-  // Fill in the MSF header.
-  if (!WriteHeader(total_bytes, dir_size, dir_root_size, dir_root_page))
+  // Start from a copy of the original file. Copying it wholesale lets the
+  // OS do it as efficiently as it can, rather than us reading and writing
+  // it page by page.
+  file_.reset();
+  if (!file_util::CopyFile(source.path(), pdb_path)) {
+    LOG(ERROR) << "Failed to copy '" << source.path().value() << "' to '"
+               << pdb_path.value() << "'";
     return false;
+  }
 
-  return true;
+  file_.reset(file_util::OpenFile(pdb_path, "r+b"));
+  if (!file_.get()) {
+    LOG(ERROR) << "Failed to open " << pdb_path.value();
+    return false;
+  }
+
+  // New pages go after the end of the original file.
+  uint32 next_page = source.num_pages();
+  if (fseek(file_.get(), next_page * kPdbPageSize, SEEK_SET) != 0) {
+    LOG(ERROR) << "Failed to seek to the end of " << pdb_path.value();
+    return false;
+  }
+
+  // Lay out the directory as we go. The stream lengths are known up front,
+  // but the page numbers are only known once each stream is placed.
+  std::vector<uint32> directory;
+  directory.push_back(streams.size());
+  for (size_t i = 0; i < streams.size(); ++i)
+    directory.push_back(streams[i]->length());
+
+  for (size_t i = 0; i < streams.size(); ++i) {
+    // Streams from the original file are left where they are, unless they
+    // sit where the free page map goes, as they may in files made by Write.
+    uint32 num_pages = 0;
+    const uint32* pages = source.GetStreamPages(streams[i], &num_pages);
+    if (pages != NULL &&
+        std::find_if(pages, pages + num_pages, IsFreePageMapPage) ==
+            pages + num_pages) {
+      directory.insert(directory.end(), pages, pages + num_pages);
+      continue;
+    }
+
+    if (!AppendStreamPages(streams[i], &next_page, &directory))
+      return false;
+  }
+
+  // The directory and the list of its pages are written the same way as the
+  // streams, so that they too steer clear of the free page map.
+  PdbByteStream directory_stream;
+  std::vector<uint32> dir_pages;
+  if (!directory_stream.Init(reinterpret_cast<const uint8*>(&directory[0]),
+                             directory.size() * sizeof(directory[0])) ||
+      !AppendStreamPages(&directory_stream, &next_page, &dir_pages)) {
+    return false;
+  }
+
+  PdbByteStream dir_pages_stream;
+  std::vector<uint32> root_pages;
+  if (!dir_pages_stream.Init(reinterpret_cast<const uint8*>(&dir_pages[0]),
+                             dir_pages.size() * sizeof(dir_pages[0])) ||
+      !AppendStreamPages(&dir_pages_stream, &next_page, &root_pages)) {
+    return false;
+  }
+
+  // Pages of the original file that the new directory doesn't refer to are
+  // now free.
+  std::vector<uint32> used_pages(directory.begin() + 1 + streams.size(),
+                                 directory.end());
+  used_pages.insert(used_pages.end(), dir_pages.begin(), dir_pages.end());
+  used_pages.insert(used_pages.end(), root_pages.begin(), root_pages.end());
+  if (!WriteFreePageMap(used_pages, next_page))
+    return false;
+
+  return WriteHeader(next_page * kPdbPageSize, directory_stream.length(),
+                     root_pages);
 }
 
 // Write an unsigned 32 bit value to the output file.
@@ -148,52 +237,132 @@ bool PdbWriter::AppendStream(PdbStream* stream, uint32* bytes_written) {
   return true;
 }
 
+bool PdbWriter::AppendStreamPages(PdbStream* stream,
+                                  uint32* next_page,
+                                  std::vector<uint32>* pages) {
+  DCHECK(stream != NULL);
+  DCHECK(next_page != NULL);
+  DCHECK(pages != NULL);
+
+  stream->Seek(0);
+  uint8 buffer[kPdbPageSize];
+  for (uint32 offset = 0; offset < stream->length(); offset += kPdbPageSize) {
+    // Leave the pages of the free page map to WriteFreePageMap.
+    while (IsFreePageMapPage(*next_page)) {
+      if (fwrite(kZeroBuffer, 1, kPdbPageSize, file_.get()) != kPdbPageSize) {
+        LOG(ERROR) << "Error skipping free page map page";
+        return false;
+      }
+      ++(*next_page);
+    }
+
+    uint32 count = std::min(kPdbPageSize,
+                            static_cast<uint32>(stream->length() - offset));
+    if (!stream->Read(buffer, count)) {
+      LOG(ERROR) << "Error reading from pdb stream";
+      return false;
+    }
+    memset(buffer + count, 0, kPdbPageSize - count);
+    if (fwrite(buffer, 1, kPdbPageSize, file_.get()) != kPdbPageSize) {
+      LOG(ERROR) << "Error appending pdb stream to file";
+      return false;
+    }
+
+    pages->push_back(*next_page);
+    ++(*next_page);
+  }
+
+  return true;
+}
+
+bool PdbWriter::WriteFreePageMap(const std::vector<uint32>& used_pages,
+                                 uint32 num_pages) {
+  // Each page of the map covers kPdbPageSize * 8 pages of the file, with a
+  // set bit marking a free page. Its pages are the first of the two free
+  // page map pages of each kPdbPageSize page interval.
+  const uint32 kPagesPerMapPage = kPdbPageSize * 8;
+  uint32 num_map_pages = (num_pages + kPagesPerMapPage - 1) / kPagesPerMapPage;
+  std::vector<uint8> map(num_map_pages * kPdbPageSize, 0xFF);
+
+  // The header and the free page maps are always in use.
+  map[0] &= ~1;
+  for (uint32 page = 1; page < num_pages; page += kPdbPageSize) {
+    map[page / 8] &= ~(1 << (page % 8));
+    if (page + 1 < num_pages)
+      map[(page + 1) / 8] &= ~(1 << ((page + 1) % 8));
+  }
+  for (size_t i = 0; i < used_pages.size(); ++i) {
+    DCHECK_LT(used_pages[i], num_pages);
+    map[used_pages[i] / 8] &= ~(1 << (used_pages[i] % 8));
+  }
+
+  for (uint32 i = 0; i < num_map_pages; ++i) {
+    if (fseek(file_.get(), (1 + i * kPdbPageSize) * kPdbPageSize,
+              SEEK_SET) != 0 ||
+        fwrite(&map[i * kPdbPageSize], 1, kPdbPageSize, file_.get()) !=
+            kPdbPageSize) {
+      LOG(ERROR) << "Error writing free page map";
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool PdbWriter::WriteDirectory(const StreamInfoList& stream_info_list,
                                uint32* dir_size,
                                uint32* bytes_written) {
-  static const char* func = "WriteDirectory";
-
   VLOG(1) << "Writing directory ...";
   DCHECK(dir_size != NULL);
   DCHECK(bytes_written != NULL);
 
-
   // The directory format is:
   //    num_streams   (32-bit)
   //    + stream_length (32-bit) for each stream in num_streams
   //    + page_offset   (32-bit) for each page in each stream in num_streams
 
-  uint32 byte_count = 0;
+  // The directory is laid out in memory and written in one go.
+  std::vector<uint32> directory;
 
-  // Write the number of streams.
-  if (!WriteUint32(func, "stream count", stream_info_list.size()))
-    return false;
-  byte_count += sizeof(uint32);
+  // Add the number of streams.
+  directory.push_back(stream_info_list.size());
 
-  // Write the length of each stream.
+  // Add the length of each stream.
   for (StreamInfoList::const_iterator iter = stream_info_list.begin();
        iter != stream_info_list.end(); ++iter) {
-    if (!WriteUint32(func, "stream length", iter->length))
-      return false;
-    byte_count += sizeof(uint32);
+    directory.push_back(iter->length);
   }
 
-  // Write the page numbers for each page in each stream.
+  // Add the page numbers for each page in each stream.
   for (StreamInfoList::const_iterator iter = stream_info_list.begin();
        iter != stream_info_list.end(); ++iter) {
     DCHECK_EQ(0U, iter->offset % kPdbPageSize);
     for (uint32 length = 0, page_number = iter->offset / kPdbPageSize;
          length < iter->length;
          length += kPdbPageSize, ++page_number) {
-      if (!WriteUint32(func, "page offset", page_number))
-        return false;
-      byte_count += sizeof(uint32);
+      directory.push_back(page_number);
     }
   }
 
+  return WriteDirectoryEntries(directory, dir_size, bytes_written);
+}
+
+bool PdbWriter::WriteDirectoryEntries(const std::vector<uint32>& directory,
+                                      uint32* dir_size,
+                                      uint32* bytes_written) {
+  DCHECK(!directory.empty());
+  DCHECK(dir_size != NULL);
+  DCHECK(bytes_written != NULL);
+
+  uint32 byte_count = directory.size() * sizeof(directory[0]);
+  if (fwrite(&directory[0], 1, byte_count, file_.get()) != byte_count) {
+    LOG(ERROR) << "Error writing directory";
+    return false;
+  }
+
   // Pad the directory to the next page boundary.
   uint32 padding = 0;
-  if (!PadToPageBoundary(func, byte_count, &padding))
+  if (!PadToPageBoundary("WriteDirectoryEntries", byte_count, &padding))
     return false;
 
   // Return the output values
@@ -204,6 +373,25 @@ bool PdbWriter::WriteDirectory(const StreamInfoList& stream_info_list,
   return true;
 }
 
+bool PdbWriter::WriteDirectoryPagesAndHeader(uint32 dir_size,
+                                             uint32 dir_page,
+                                             uint32 total_bytes) {
+  // Map out the directory roots: i.e., pages on which the directory has been
+  // written.
+  uint32 dir_root_size = 0;
+  uint32 dir_root_page = (total_bytes / kPdbPageSize);
+  uint32 bytes_written = 0;
+  if (!WriteDirectoryPages(dir_size, dir_page, &dir_root_size, &bytes_written))
+    return false;
+  total_bytes += bytes_written;
+
+  // Fill in the MSF header.
+  if (!WriteHeader(total_bytes, dir_size, dir_root_size, dir_root_page))
+    return false;
+
+  return true;
+}
+
 bool PdbWriter::WriteDirectoryPages(uint32 dir_size,
                                     uint32 dir_page,
                                     uint32* dir_pages_size,
@@ -239,11 +427,23 @@ bool PdbWriter::WriteHeader(uint32 file_size,
                             uint32 dir_size,
                             uint32 dir_root_size,
                             uint32 dir_root_page) {
+  std::vector<uint32> root_pages;
+  for (uint32 page_offset = 0; page_offset < dir_root_size;
+       page_offset += kPdbPageSize, ++dir_root_page) {
+    root_pages.push_back(dir_root_page);
+  }
+
+  return WriteHeader(file_size, dir_size, root_pages);
+}
+
+bool PdbWriter::WriteHeader(uint32 file_size,
+                            uint32 dir_size,
+                            const std::vector<uint32>& root_pages) {
   VLOG(1) << "Writing MSF Header ...";
   DCHECK_EQ(0U, file_size % kPdbPageSize);
 
   // Make sure the root pages list won't overflow.
-  if ((dir_root_size + kPdbPageSize - 1) / kPdbPageSize > kPdbMaxDirPages) {
+  if (root_pages.size() > kPdbMaxDirPages) {
     LOG(ERROR) << "Too many directory root pages";
     return false;
   }
@@ -262,10 +462,8 @@ bool PdbWriter::WriteHeader(uint32 file_size,
   header.directory_size = dir_size;
   header.reserved = 0;
 
-  for (uint32 page_offset = 0; page_offset < dir_root_size;
-       page_offset += kPdbPageSize, ++dir_root_page) {
-    header.root_pages[page_offset / kPdbPageSize] = dir_root_page;
-  }
+  for (size_t i = 0; i < root_pages.size(); ++i)
+    header.root_pages[i] = root_pages[i];
 
   if (fwrite(&header, sizeof(header), 1, file_.get()) != 1) {
     LOG(ERROR) << "Failed writing header";
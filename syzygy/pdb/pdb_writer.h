@@ -21,6 +21,8 @@
 
 namespace pdb {
 
+class PdbReader;
+
 // This class is used to write a pdb file to disk given a list of PdbStreams.
 // It will create a header and directory inside the pdb file that describe
 // the page layout of the streams in the file.
@@ -34,6 +36,22 @@ class PdbWriter {
   // PdbStreamList that contains the streams to be written to the file.
   bool Write(const FilePath& pdb_path, const std::vector<PdbStream*>& streams);
 
+  // Write a pdb file to disk by updating a copy of the file last read by
+  // @p source. Streams in @p streams that belong to @p source keep their
+  // pages in the copy, so only new streams are written, followed by a new
+  // directory, free page map and header. This is much faster than Write
+  // when only a few streams of a large pdb file are being replaced, at the
+  // cost of leaving the pages of the replaced streams free in the output.
+  // @param source the reader used to read the original pdb file. This must
+  //     have been used to read a file with pages of size kPdbPageSize.
+  // @param pdb_path the path of the file to write. This must differ from
+  //     the path of the original pdb file.
+  // @param streams the streams to be written to the file, as for Write.
+  // @returns true on success, false otherwise.
+  bool WriteIncremental(const PdbReader& source,
+                        const FilePath& pdb_path,
+                        const std::vector<PdbStream*>& streams);
+
  protected:
   // Info about a stream that's been written to the file.
   struct StreamInfo {
@@ -58,11 +76,39 @@ class PdbWriter {
   bool AppendStream(PdbStream* stream,
                     uint32* bytes_written);
 
+  // Append the contents of the stream a page at a time, starting at page
+  // @p next_page of the file, which must be where the file handle is.
+  // Pages of the free page map are skipped. On return, @p next_page is the
+  // page after the last one written, and the stream's pages have been
+  // appended to @p pages.
+  bool AppendStreamPages(PdbStream* stream,
+                         uint32* next_page,
+                         std::vector<uint32>* pages);
+
+  // Write a free page map that marks @p used_pages, the header and the free
+  // page maps themselves as used in a file of @p num_pages pages, and every
+  // other page as free.
+  bool WriteFreePageMap(const std::vector<uint32>& used_pages,
+                        uint32 num_pages);
+
   // Write the directory to the file handle.
   bool WriteDirectory(const StreamInfoList& stream_info_list,
                       uint32* dir_size,
                       uint32* bytes_written);
 
+  // Write a directory that has already been laid out in memory to the file
+  // handle, padded to the next page boundary.
+  bool WriteDirectoryEntries(const std::vector<uint32>& directory,
+                             uint32* dir_size,
+                             uint32* bytes_written);
+
+  // Write the directory pages and the header, once the directory of
+  // @p dir_size bytes has been written starting at page @p dir_page, and the
+  // file is @p total_bytes long.
+  bool WriteDirectoryPagesAndHeader(uint32 dir_size,
+                                    uint32 dir_page,
+                                    uint32 total_bytes);
+
   // Write the directory pages which form the MSF directory.
   bool WriteDirectoryPages(uint32 dir_size,
                            uint32 dir_page,
@@ -76,6 +122,11 @@ class PdbWriter {
                    uint32 dir_root_size,
                    uint32 dir_root_page);
 
+  // As above, for a directory whose root pages are @p root_pages.
+  bool WriteHeader(uint32 file_size,
+                   uint32 dir_size,
+                   const std::vector<uint32>& root_pages);
+
   // The current file handle open for writing.
   file_util::ScopedFILE file_;
 
@@ -13,8 +13,11 @@
 // limitations under the License.
 
 #include "syzygy/pdb/pdb_writer.h"
+
+#include <set>
 #include "base/file_util.h"
 #include "gtest/gtest.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_reader.h"
 
@@ -73,6 +76,7 @@ class TestPdbStream : public PdbStream {
 
 using pdb::kPdbHeaderMagicString;
 using pdb::kPdbPageSize;
+using pdb::PdbByteStream;
 using pdb::PdbHeader;
 using pdb::PdbReader;
 
@@ -102,6 +106,186 @@ TEST(PdbWriterTest, Write) {
   EXPECT_EQ(arraysize(test_streams), streams.size());
 }
 
+TEST(PdbWriterTest, WriteIncremental) {
+  // Create some streams, each filled with its own index.
+  const size_t kStreamLengths[] = {
+    (1 << 8) + 123,
+    (1 << 11) + 321,
+    0,
+    (1 << 10) + 456
+  };
+  std::vector<uint8> data[arraysize(kStreamLengths)];
+  PdbByteStream byte_streams[arraysize(kStreamLengths)];
+  std::vector<PdbStream*> streams;
+  for (uint32 i = 0; i < arraysize(kStreamLengths); ++i) {
+    data[i].resize(kStreamLengths[i], static_cast<uint8>(i));
+    ASSERT_TRUE(byte_streams[i].Init(
+        data[i].empty() ? NULL : &data[i][0], data[i].size()));
+    streams.push_back(&byte_streams[i]);
+  }
+
+  FilePath path;
+  ASSERT_TRUE(file_util::CreateTemporaryFile(&path));
+  {
+    PdbWriter writer;
+    ASSERT_TRUE(writer.Write(path, streams));
+  }
+
+  // Replace the second stream, and add another.
+  PdbReader source;
+  ASSERT_TRUE(source.Read(path, &streams));
+  std::vector<uint8> new_data(kPdbPageSize + 1, 0xAB);
+  PdbByteStream new_stream;
+  ASSERT_TRUE(new_stream.Init(&new_data[0], new_data.size()));
+  streams[1] = &new_stream;
+  streams.push_back(&new_stream);
+
+  FilePath incremental_path;
+  ASSERT_TRUE(file_util::CreateTemporaryFile(&incremental_path));
+  {
+    PdbWriter writer;
+    ASSERT_TRUE(writer.WriteIncremental(source, incremental_path, streams));
+  }
+
+  PdbReader reader;
+  std::vector<PdbStream*> incremental_streams;
+  ASSERT_TRUE(reader.Read(incremental_path, &incremental_streams));
+  ASSERT_EQ(streams.size(), incremental_streams.size());
+
+  // The unchanged streams should occupy the same pages as before, and the
+  // new ones should come after the original file.
+  for (size_t i = 0; i < streams.size(); ++i) {
+    uint32 source_num_pages = 0;
+    const uint32* source_pages = source.GetStreamPages(streams[i],
+                                                       &source_num_pages);
+    uint32 num_pages = 0;
+    const uint32* pages = reader.GetStreamPages(incremental_streams[i],
+                                                &num_pages);
+    ASSERT_TRUE(pages != NULL);
+    if (source_pages != NULL) {
+      ASSERT_EQ(source_num_pages, num_pages);
+      EXPECT_EQ(0, memcmp(source_pages, pages, num_pages * sizeof(uint32)));
+    } else {
+      for (uint32 j = 0; j < num_pages; ++j)
+        EXPECT_LE(source.num_pages(), pages[j]);
+    }
+
+    // The contents should be unchanged either way.
+    ASSERT_EQ(streams[i]->length(), incremental_streams[i]->length());
+    if (streams[i]->length() == 0)
+      continue;
+    std::vector<uint8> expected(streams[i]->length());
+    std::vector<uint8> actual(expected.size());
+    ASSERT_TRUE(streams[i]->Seek(0));
+    ASSERT_TRUE(streams[i]->Read(&expected[0], expected.size()));
+    ASSERT_TRUE(incremental_streams[i]->Read(&actual[0], actual.size()));
+    EXPECT_TRUE(expected == actual);
+  }
+
+  // Only the two new streams, the directory and its root page are added.
+  EXPECT_EQ(source.num_pages() + 2 * 2 + 1 + 1, reader.num_pages());
+
+  file_util::Delete(path, false);
+  file_util::Delete(incremental_path, false);
+}
+
+TEST(PdbWriterTest, WriteIncrementalFreePageMap) {
+  // Write places the first stream across the free page map pages of the
+  // second interval of kPdbPageSize pages.
+  std::vector<uint8> data[2];
+  data[0].resize(1100 * kPdbPageSize, 0x11);
+  data[1].resize(kPdbPageSize, 0x22);
+  PdbByteStream byte_streams[arraysize(data)];
+  std::vector<PdbStream*> streams;
+  for (uint32 i = 0; i < arraysize(data); ++i) {
+    ASSERT_TRUE(byte_streams[i].Init(&data[i][0], data[i].size()));
+    streams.push_back(&byte_streams[i]);
+  }
+
+  FilePath path;
+  ASSERT_TRUE(file_util::CreateTemporaryFile(&path));
+  {
+    PdbWriter writer;
+    ASSERT_TRUE(writer.Write(path, streams));
+  }
+
+  // Replace the second stream.
+  PdbReader source;
+  ASSERT_TRUE(source.Read(path, &streams));
+  std::vector<uint8> new_data(8 * kPdbPageSize, 0xAB);
+  PdbByteStream new_stream;
+  ASSERT_TRUE(new_stream.Init(&new_data[0], new_data.size()));
+  streams[1] = &new_stream;
+
+  FilePath incremental_path;
+  ASSERT_TRUE(file_util::CreateTemporaryFile(&incremental_path));
+  {
+    PdbWriter writer;
+    ASSERT_TRUE(writer.WriteIncremental(source, incremental_path, streams));
+  }
+
+  PdbReader reader;
+  std::vector<PdbStream*> incremental_streams;
+  ASSERT_TRUE(reader.Read(incremental_path, &incremental_streams));
+  ASSERT_EQ(streams.size(), incremental_streams.size());
+
+  // The first stream had to move, but is otherwise unchanged.
+  std::vector<uint8> actual(data[0].size());
+  ASSERT_EQ(actual.size(), incremental_streams[0]->length());
+  ASSERT_TRUE(incremental_streams[0]->Read(&actual[0], actual.size()));
+  EXPECT_TRUE(data[0] == actual);
+
+  // Collect the pages of the streams, the directory and its root page.
+  std::set<uint32> used_pages;
+  for (size_t i = 0; i < incremental_streams.size(); ++i) {
+    uint32 num_pages = 0;
+    const uint32* pages = reader.GetStreamPages(incremental_streams[i],
+                                                &num_pages);
+    ASSERT_TRUE(pages != NULL);
+    used_pages.insert(pages, pages + num_pages);
+  }
+
+  file_util::ScopedFILE file(file_util::OpenFile(incremental_path, "rb"));
+  ASSERT_TRUE(file.get() != NULL);
+  PdbHeader header = { 0 };
+  ASSERT_EQ(1, fread(&header, sizeof(header), 1, file.get()));
+  EXPECT_EQ(1, header.free_page_map);
+
+  uint32 num_dir_pages = GetNumPages(header.directory_size);
+  ASSERT_LE(num_dir_pages * sizeof(uint32), kPdbPageSize);
+  std::vector<uint32> dir_pages(num_dir_pages);
+  ASSERT_EQ(0, fseek(file.get(), header.root_pages[0] * kPdbPageSize,
+                     SEEK_SET));
+  ASSERT_EQ(num_dir_pages,
+            fread(&dir_pages[0], sizeof(uint32), num_dir_pages, file.get()));
+  used_pages.insert(header.root_pages[0]);
+  used_pages.insert(dir_pages.begin(), dir_pages.end());
+
+  // None of them may be where the free page maps go.
+  std::set<uint32>::const_iterator it = used_pages.begin();
+  for (; it != used_pages.end(); ++it) {
+    EXPECT_NE(1, *it % kPdbPageSize);
+    EXPECT_NE(2, *it % kPdbPageSize);
+  }
+
+  // The map should mark exactly those pages, the header and the free page
+  // maps as used. The file is small enough for the map to fit in a page.
+  ASSERT_LT(header.num_pages, kPdbPageSize * 8);
+  std::vector<uint8> map(kPdbPageSize);
+  ASSERT_EQ(0, fseek(file.get(), kPdbPageSize, SEEK_SET));
+  ASSERT_EQ(map.size(), fread(&map[0], 1, map.size(), file.get()));
+  for (uint32 page = 0; page < header.num_pages; ++page) {
+    bool used = page == 0 || page % kPdbPageSize == 1 ||
+        page % kPdbPageSize == 2 || used_pages.count(page) != 0;
+    bool free = (map[page / 8] & (1 << (page % 8))) != 0;
+    EXPECT_NE(used, free) << "page " << page;
+  }
+
+  file.reset();
+  file_util::Delete(path, false);
+  file_util::Delete(incremental_path, false);
+}
+
 TEST(PdbWriterTest, PadToPageBoundary) {
   // Test that the right amount is padded for the given offset.
   uint32 test_cases[][2] = {
@@ -19,6 +19,7 @@
 #include "base/command_line.h"
 #include "base/file_path.h"
 #include "base/file_util.h"
+#include "base/string_number_conversions.h"
 #include "base/string_util.h"
 #include "base/time.h"
 #include "syzygy/core/block_graph.h"
@@ -51,7 +52,12 @@ int Usage(char** argv, const char* message) {
       "    '.bg' to the image file.\n"
       "  --benchmark-load\n"
       "    Causes the output to be deserialized after serialization,\n"
-      "    for benchmarking.\n";
+      "    for benchmarking.\n"
+      "  --compact\n"
+      "    Writes the output in the compact format, which is smaller and\n"
+      "    faster to load.\n"
+      "  --threads=<count>\n"
+      "    The number of threads used to disassemble code. Defaults to 1.\n";
 
   return 1;
 }
@@ -188,6 +194,14 @@ int main(int argc, char** argv) {
 
   FilePath missing_contribs = cmd_line->GetSwitchValuePath("missing-contribs");
   bool benchmark_load = cmd_line->HasSwitch("benchmark-load");
+  bool compact = cmd_line->HasSwitch("compact");
+
+  int num_threads = 1;
+  if (cmd_line->HasSwitch("threads")) {
+    std::string threads = cmd_line->GetSwitchValueASCII("threads");
+    if (!base::StringToInt(threads, &num_threads) || num_threads <= 0)
+      return Usage(argv, "Invalid value for '--threads' parameter!");
+  }
 
   pe::Decomposer::Mode mode = cmd_line->HasSwitch("bb") ?
       pe::Decomposer::BASIC_BLOCK_DECOMPOSITION :
@@ -197,7 +211,7 @@ int main(int argc, char** argv) {
   LOG(INFO) << "Parsing PE file.\n";
   base::Time time = base::Time::Now();
   pe::PEFile pe_file;
-  if (!pe_file.Init(image))
+  if (!pe_file.Init(image, pe::PEFile::MAP_IMAGE_DATA))
     return 1;
   LOG(INFO) << "Parsing PE file took " <<
       (base::Time::Now() - time).InSecondsF() << " seconds.";
@@ -206,12 +220,18 @@ int main(int argc, char** argv) {
   time = base::Time::Now();
   pe::Decomposer::DecomposedImage decomposed_image;
   pe::Decomposer decomposer(pe_file, image);
-  if (!decomposer.Decompose(&decomposed_image, NULL, mode)) {
+  decomposer.set_num_threads(num_threads);
+  pe::Decomposer::CoverageStatistics stats;
+  if (!decomposer.Decompose(&decomposed_image, &stats, mode)) {
     LOG(ERROR) << "Decomposition failed.";
     return 1;
   }
   LOG(INFO) << "Decomposing image took " <<
       (base::Time::Now() - time).InSecondsF() << " seconds.";
+  LOG(INFO) << "Disassembling code on " << stats.disassembly.thread_count
+      << " thread(s) took " << stats.disassembly.time_ms << " ms, with "
+      << stats.disassembly.walk_count << " block disassemblies and "
+      << stats.disassembly.discarded_walk_count << " discarded.";
 
   if (!missing_contribs.empty()) {
     LOG(INFO) << "Writing missing section contributions to \""
@@ -225,11 +245,18 @@ int main(int argc, char** argv) {
     LOG(INFO) << "Saving decomposed image to \"" << output.value().c_str()
         << "\".\n";
     time = base::Time::Now();
-    file_util::ScopedFILE out_file(file_util::OpenFile(output, "wb"));
-    core::FileOutStream out_stream(out_file.get());
-    core::NativeBinaryOutArchive out_archive(&out_stream);
-    if (!pe::SaveDecomposition(pe_file, decomposed_image, &out_archive))
-      return 1;
+    if (compact) {
+      if (!pe::SaveCompactDecomposition(pe_file, decomposed_image, output))
+        return 1;
+    } else {
+      file_util::ScopedFILE out_file(file_util::OpenFile(output, "wb"));
+      core::BufferedFileOutStream out_stream(out_file.get());
+      core::NativeBinaryOutArchive out_archive(&out_stream);
+      if (!pe::SaveDecomposition(pe_file, decomposed_image, &out_archive) ||
+          !out_stream.Flush()) {
+        return 1;
+      }
+    }
     LOG(INFO) << "Saving decomposed image took " <<
         (base::Time::Now() - time).InSecondsF() << " seconds.";
   }
@@ -240,11 +267,16 @@ int main(int argc, char** argv) {
 
     LOG(INFO) << "Benchmarking decomposed image load.\n";
     time = base::Time::Now();
-    file_util::ScopedFILE in_file(file_util::OpenFile(output, "rb"));
-    core::FileInStream in_stream(in_file.get());
-    core::NativeBinaryInArchive in_archive(&in_stream);
-    if (!pe::LoadDecomposition(&in_pe_file, &in_image, &in_archive))
-      return 1;
+    if (compact) {
+      if (!pe::LoadCompactDecomposition(output, &in_pe_file, &in_image))
+        return 1;
+    } else {
+      file_util::ScopedFILE in_file(file_util::OpenFile(output, "rb"));
+      core::BufferedFileInStream in_stream(in_file.get());
+      core::NativeBinaryInArchive in_archive(&in_stream);
+      if (!pe::LoadDecomposition(&in_pe_file, &in_image, &in_archive))
+        return 1;
+    }
     LOG(INFO) << "Loading decomposed image took " <<
         (base::Time::Now() - time).InSecondsF() << " seconds.";
   }
@@ -17,6 +17,7 @@
 #include <cvconst.h>
 #include <diacreate.h>
 #include "base/file_path.h"
+#include "base/file_util.h"
 #include "base/path_service.h"
 #include "base/logging.h"
 #include "base/scoped_ptr.h"
@@ -27,6 +28,9 @@
 #include "base/win/scoped_comptr.h"
 #include "sawbuck/common/com_utils.h"
 #include "sawbuck/sym_util/types.h"
+#include "syzygy/core/compact_file.h"
+#include "syzygy/core/parallel_loop.h"
+#include "syzygy/pdb/omap_index.h"
 #include "syzygy/pe/metadata.h"
 #include "syzygy/pe/pe_file_parser.h"
 
@@ -108,34 +112,6 @@ template<typename T> bool LoadDebugStream(IDiaEnumDebugStreamData* stream,
   return true;
 }
 
-// A comparison functor, for comparing two OMAP entries based on 'rva'.
-struct OmapCompareFunctor {
-  bool operator()(const OMAP& omap1, const OMAP& omap2) {
-    return omap1.rva < omap2.rva;
-  }
-};
-
-// Maps an address through the given OMAP information. Assumes the address
-// is within the bounds of the image.
-RelativeAddress TranslateAddressViaOmap(const std::vector<OMAP>& omap,
-                                        RelativeAddress address) {
-  OMAP omap_address = { address.value(), 0 };
-
-  // Find the first element that is > than omap_address.
-  std::vector<OMAP>::const_iterator it =
-      std::upper_bound(omap.begin(), omap.end(), omap_address,
-                       OmapCompareFunctor());
-
-  // If we are at the first OMAP entry, the address is before any addresses
-  // that are OMAPped. Thus, we return the same address.
-  if (it == omap.begin())
-    return address;
-
-  // Otherwise, the previous OMAP entry tells us where we lie.
-  --it;
-  return RelativeAddress(it->rvaTo) + (address - RelativeAddress(it->rva));
-}
-
 // Adds a reference to the provided intermediate reference map. If one already
 // exists, will validate that they are consistent.
 bool AddReference(RelativeAddress src_addr,
@@ -594,6 +570,92 @@ bool LoadBlockPointer(BlockGraph& block_graph,
   return true;
 }
 
+// Identifies a compact decomposition file. The version must be bumped
+// whenever the layout of any of the sections changes, as older files are
+// then rejected rather than misread.
+const uint32 kCompactDecompositionMagic = 0x4D434453;
+const uint32 kCompactDecompositionVersion = 1;
+
+// The sections of a compact decomposition file.
+enum CompactDecompositionSection {
+  // The module and toolchain metadata, serialized with a NativeBinaryArchive.
+  METADATA_SECTION,
+  // The block names and labels of both block graphs.
+  STRING_TABLE_SECTION,
+  // The image block graph, followed by its address space.
+  IMAGE_SECTION,
+  // The basic block graph, followed by its address space.
+  BASIC_BLOCK_GRAPH_SECTION,
+  // The OMAP to and from vectors, each as a count followed by the entries.
+  OMAP_SECTION,
+  // The ids of the PE header blocks.
+  HEADER_SECTION,
+};
+
+// Writes @p omap to @p writer as a count followed by the raw entries, which
+// may then be read in place.
+void SaveCompactOmap(const std::vector<OMAP>& omap,
+                     core::CompactWriter* writer) {
+  writer->WriteUint32(omap.size());
+  if (!omap.empty())
+    writer->WriteBytes(omap.size() * sizeof(omap[0]), &omap[0]);
+}
+
+bool LoadCompactOmap(core::CompactReader* reader, std::vector<OMAP>* omap) {
+  uint32 count = 0;
+  const uint8* data = NULL;
+  if (!reader->ReadUint32(&count) ||
+      count > reader->remaining() / sizeof(OMAP) ||
+      !reader->ReadBytes(count * sizeof(OMAP), &data)) {
+    LOG(ERROR) << "Unable to load OMAP entries.";
+    return false;
+  }
+  const OMAP* entries = reinterpret_cast<const OMAP*>(data);
+  omap->assign(entries, entries + count);
+  return true;
+}
+
+// Saves a block pointer by id, as SaveBlockPointer does.
+void SaveCompactBlockPointer(const BlockGraph::Block* block,
+                             core::CompactWriter* writer) {
+  writer->WriteUint32(block == NULL ? kNullBlockId : block->id());
+}
+
+bool LoadCompactBlockPointer(BlockGraph& block_graph,
+                             BlockGraph::Block** block,
+                             core::CompactReader* reader) {
+  uint32 id = 0;
+  if (!reader->ReadUint32(&id))
+    return false;
+  if (id == static_cast<uint32>(kNullBlockId)) {
+    *block = NULL;
+    return true;
+  }
+
+  *block = block_graph.GetBlockById(id);
+  if (*block == NULL) {
+    LOG(ERROR) << "No block exists with given id: " << id << ".";
+    return false;
+  }
+
+  return true;
+}
+
+// Retrieves a section of a compact decomposition, and initializes @p reader
+// to read from it.
+bool GetCompactSection(const core::SectionedFileReader& file_reader,
+                       CompactDecompositionSection section,
+                       scoped_ptr<core::CompactReader>* reader) {
+  const uint8* data = NULL;
+  size_t size = 0;
+  if (!file_reader.GetSection(section, &data, &size)) {
+    LOG(ERROR) << "Decomposition is missing section " << section << ".";
+    return false;
+  }
+  reader->reset(new core::CompactReader(data, size));
+  return true;
+}
+
 // After deserialization of a block graph, blocks that did not own the data
 // they pointed to may be left with NULL data pointers, but a non-zero
 // data-size. These blocks pointed to data in a PEFile, and this function fixes
@@ -628,12 +690,126 @@ using builder::Star;
 using core::AbsoluteAddress;
 using core::BlockGraph;
 
+// Holds everything that disassembling a single code block turns up. The walk
+// itself only reads the decomposition, which lets blocks be disassembled on
+// worker threads. The results are applied to the decomposition afterwards by
+// ApplyCodeBlockDisassembly.
+class Decomposer::CodeBlockDisassembly {
+ public:
+  // A PC-relative reference from the block being disassembled.
+  struct CodeReference {
+    ValidateOrAddReferenceMode mode;
+    RelativeAddress src;
+    BlockGraph::Size size;
+    RelativeAddress dst;
+    // The block containing dst.
+    BlockGraph::Block* dst_block;
+    std::string name;
+  };
+  typedef std::vector<CodeReference> CodeReferences;
+  typedef std::vector<BlockGraph::AddressSpace::Range> RangeVector;
+
+  CodeBlockDisassembly()
+      : decomposer(NULL),
+        block(NULL),
+        label_count(0),
+        result(Disassembler::kWalkError) {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+  // Disassembles block, filling in the results.
+  void Disassemble() {
+    DCHECK(decomposer != NULL);
+    decomposer->DisassembleCodeBlock(block, this);
+  }
+
+  // Called by the disassembler for each instruction in the block.
+  void OnInstruction(const Disassembler& walker,
+                     const _DInst& instruction,
+                     Disassembler::CallbackDirective* directive) {
+    DCHECK(decomposer != NULL);
+    decomposer->OnInstruction(this, walker, instruction, directive);
+  }
+
+  // @returns true if no labels have been added to block since it was
+  //     disassembled. Labels are the only starting points for disassembly,
+  //     and they're only ever added while creating code references, so the
+  //     results are then exactly those a fresh disassembly would produce.
+  bool IsUpToDate() const {
+    DCHECK(block != NULL);
+    return block->labels().size() == label_count;
+  }
+
+  const Decomposer* decomposer;
+  BlockGraph::Block* block;
+  // The number of labels block had when it was disassembled.
+  size_t label_count;
+  Disassembler::WalkResult result;
+  DetailedCodeBlockStatistics stats;
+  // The references found in the block, in the order they were found.
+  CodeReferences references;
+  // The address ranges to be merged.
+  RangeVector merges;
+};
+
+// Holds the results of breaking a single code block up into basic blocks,
+// which is done on worker threads by BuildBasicBlockGraph.
+class Decomposer::BasicBlockDisassembly {
+ public:
+  BasicBlockDisassembly()
+      : decomposer(NULL),
+        block(NULL),
+        result(Disassembler::kWalkError) {
+  }
+
+  // Disassembles block, filling in the results.
+  void Disassemble() {
+    DCHECK(decomposer != NULL);
+    decomposer->DisassembleBasicBlocks(this);
+  }
+
+  Decomposer* decomposer;
+  const BlockGraph::Block* block;
+  RelativeAddress block_addr;
+  Disassembler::WalkResult result;
+  // The basic blocks making up block.
+  BasicBlockDisassembler::BBAddressSpace basic_blocks;
+};
+
+namespace {
+
+// Disassembles a batch of blocks, one per loop iteration. Disassembly is
+// one of Decomposer::CodeBlockDisassembly or BasicBlockDisassembly.
+template<typename Disassembly>
+class DisassembleLoop : public core::ParallelLoopBody {
+ public:
+  typedef std::vector<Disassembly*> DisassemblyVector;
+
+  explicit DisassembleLoop(const DisassemblyVector& disassemblies)
+      : disassemblies_(disassemblies) {
+  }
+
+  virtual void Run(size_t index) {
+    DCHECK_GT(disassemblies_.size(), index);
+    disassemblies_[index]->Disassemble();
+  }
+
+ private:
+  const DisassemblyVector& disassemblies_;
+
+  DISALLOW_COPY_AND_ASSIGN(DisassembleLoop);
+};
+
+}  // namespace
+
 Decomposer::Decomposer(const PEFile& image_file,
                        const FilePath& file_path)
     : image_(NULL),
       image_file_(image_file),
       file_path_(file_path),
-      current_block_(NULL) {
+      num_threads_(1),
+      code_block_walk_count_(0),
+      discarded_code_block_walk_count_(0) {
   // Register static initializer patterns that we know are always present.
   bool success =
       // CRT C/C++/etc initializers.
@@ -803,6 +979,11 @@ void Decomposer::CalcCoverageStatistics(CoverageStatistics* stats) const {
     const BlockGraph::Block* block = it->second;
     CalcBlockStats(block, stats);
   }
+
+  stats->disassembly.thread_count = num_threads_;
+  stats->disassembly.walk_count = code_block_walk_count_;
+  stats->disassembly.discarded_walk_count = discarded_code_block_walk_count_;
+  stats->disassembly.time_ms = code_references_time_.InMilliseconds();
 }
 
 void Decomposer::CalcBlockStats(const BlockGraph::Block* block,
@@ -1794,6 +1975,10 @@ bool Decomposer::CreateCodeLabelsFromFixups() {
 }
 
 bool Decomposer::CreateCodeReferences() {
+  base::Time start_time = base::Time::Now();
+  code_block_walk_count_ = 0;
+  discarded_code_block_walk_count_ = 0;
+
   // Queue all blocks for disassembly.
   BlockGraph::BlockMap::iterator it(image_->graph()->blocks_mutable().begin());
   BlockGraph::BlockMap::iterator end(image_->graph()->blocks_mutable().end());
@@ -1807,19 +1992,44 @@ bool Decomposer::CreateCodeReferences() {
   // as if disassembly turns up a PC-relative reference to another function
   // (block) at a location that didn't already have a label, it'll label that
   // location and re-queue the destination function for disassembly.
+  //
+  // When running on several threads, all queued blocks are disassembled
+  // speculatively up front. The results are then applied one block at a time
+  // in the order of the serial loop. A block whose results went stale, by
+  // having labels added to it in the meantime, causes the queue to be
+  // disassembled afresh before continuing.
   DCHECK(to_merge_.empty());
+  CodeBlockDisassemblyMap disassemblies;
   while (!to_disassemble_.empty()) {
     while (!to_disassemble_.empty()) {
       BlockSet::iterator it = to_disassemble_.begin();
       BlockGraph::Block* block = *it;
-      to_disassemble_.erase(it);
 
-      if (!CreateCodeReferencesForBlock(block)) {
-        return false;
+      if (num_threads_ <= 1) {
+        to_disassemble_.erase(it);
+        if (!CreateCodeReferencesForBlock(block))
+          return false;
+        continue;
+      }
+
+      CodeBlockDisassemblyMap::iterator disassembly_it =
+          disassemblies.find(block);
+      if (disassembly_it == disassemblies.end() ||
+          !disassembly_it->second.IsUpToDate()) {
+        DisassembleQueuedBlocks(&disassemblies);
+        disassembly_it = disassemblies.find(block);
+        DCHECK(disassembly_it != disassemblies.end());
       }
+
+      to_disassemble_.erase(it);
+      bool success = ApplyCodeBlockDisassembly(disassembly_it->second);
+      disassemblies.erase(disassembly_it);
+      if (!success)
+        return false;
     }
 
     DCHECK(to_disassemble_.empty());
+    DCHECK(disassemblies.empty());
 
     // Merge any ranges scheduled for merging, then re-schedule the
     // merged blocks for disassembly. Doing this outside the above loop
@@ -1837,27 +2047,43 @@ bool Decomposer::CreateCodeReferences() {
     }
   }
 
+  code_references_time_ = base::Time::Now() - start_time;
+
   return true;
 }
 
 bool Decomposer::CreateCodeReferencesForBlock(BlockGraph::Block* block) {
-  DCHECK(current_block_ == NULL);
-  current_block_ = block;
+  CodeBlockDisassembly disassembly;
+  disassembly.decomposer = this;
+  DisassembleCodeBlock(block, &disassembly);
+  return ApplyCodeBlockDisassembly(disassembly);
+}
+
+void Decomposer::DisassembleCodeBlock(
+    BlockGraph::Block* block, CodeBlockDisassembly* disassembly) const {
+  DCHECK(block != NULL);
+  DCHECK(disassembly != NULL);
+
+  disassembly->block = block;
+  disassembly->label_count = block->labels().size();
+  disassembly->result = Disassembler::kWalkError;
+  disassembly->references.clear();
+  disassembly->merges.clear();
 
   RelativeAddress block_addr;
   if (!image_->GetAddressOf(block, &block_addr)) {
     LOG(ERROR) << "Block " << block->name() << " has no address.";
-    return false;
+    return;
   }
 
   AbsoluteAddress abs_block_addr;
   if (!image_file_.Translate(block_addr, &abs_block_addr)) {
     LOG(ERROR) << "Unable to get absolute address for " << block_addr;
-    return false;
+    return;
   }
 
   scoped_ptr<Disassembler::InstructionCallback> on_instruction(
-      NewCallback(this, &Decomposer::OnInstruction));
+      NewCallback(disassembly, &CodeBlockDisassembly::OnInstruction));
 
   // Use block labels as starting points for disassembly. Any labels that
   // lie within a known data block or reloc should not be added.
@@ -1882,25 +2108,87 @@ bool Decomposer::CreateCodeReferencesForBlock(BlockGraph::Block* block) {
                       abs_block_addr,
                       labels,
                       on_instruction.get());
-  Disassembler::WalkResult result = disasm.Walk();
+  disassembly->result = disasm.Walk();
   CalcDetailedCodeBlockStats(
-      abs_block_addr, block, disasm, reloc_set_,
-      &code_block_stats_[block->id()]);
+      abs_block_addr, block, disasm, reloc_set_, &disassembly->stats);
+}
+
+bool Decomposer::ApplyCodeBlockDisassembly(
+    const CodeBlockDisassembly& disassembly) {
+  BlockGraph::Block* block = disassembly.block;
+  DCHECK(block != NULL);
+
+  ++code_block_walk_count_;
+  code_block_stats_[block->id()] = disassembly.stats;
+
+  CodeBlockDisassembly::CodeReferences::const_iterator ref_it =
+      disassembly.references.begin();
+  for (; ref_it != disassembly.references.end(); ++ref_it) {
+    // Validate or create the reference, as necessary.
+    if (!ValidateOrAddReference(ref_it->mode, ref_it->src,
+                                BlockGraph::PC_RELATIVE_REF, ref_it->size,
+                                ref_it->dst, 0, ref_it->name.c_str(),
+                                &fixup_map_, &references_)) {
+      return false;
+    }
 
-  DCHECK_EQ(block, current_block_);
-  current_block_ = NULL;
+    // See whether the block has a label at the offset.
+    BlockGraph::Block* dst_block = ref_it->dst_block;
+    BlockGraph::Offset offset = ref_it->dst - dst_block->addr();
+    if (!dst_block->HasLabel(offset)) {
+      // If it has no label here, we add one.
+      std::string label(base::StringPrintf("From 0x%08X",
+                                           ref_it->src.value()));
+      dst_block->SetLabel(offset, label.c_str());
+
+      // And then potentially re-schedule the block for disassembly,
+      // as we may have turned up another entry to a block we already
+      // disassembled.
+      to_disassemble_.insert(dst_block);
+    }
+  }
 
-  return (result == Disassembler::kWalkSuccess ||
-      result == Disassembler::kWalkIncomplete);
+  to_merge_.insert(disassembly.merges.begin(), disassembly.merges.end());
+
+  return (disassembly.result == Disassembler::kWalkSuccess ||
+      disassembly.result == Disassembler::kWalkIncomplete);
+}
+
+void Decomposer::DisassembleQueuedBlocks(
+    CodeBlockDisassemblyMap* disassemblies) {
+  DCHECK(disassemblies != NULL);
+
+  // Gather the blocks that need disassembling. Those whose results went
+  // stale are disassembled again.
+  std::vector<CodeBlockDisassembly*> batch;
+  BlockSet::const_iterator it = to_disassemble_.begin();
+  for (; it != to_disassemble_.end(); ++it) {
+    CodeBlockDisassembly& disassembly = (*disassemblies)[*it];
+    if (disassembly.block != NULL) {
+      if (disassembly.IsUpToDate())
+        continue;
+      ++discarded_code_block_walk_count_;
+    }
+    disassembly.decomposer = this;
+    disassembly.block = *it;
+    batch.push_back(&disassembly);
+  }
+
+  DisassembleLoop<CodeBlockDisassembly> loop(batch);
+  core::RunParallelLoop(batch.size(), num_threads_, &loop);
 }
 
 void Decomposer::ScheduleForMerging(BlockGraph::Block* block1,
-                                    BlockGraph::Block* block2) {
+                                    BlockGraph::Block* block2,
+                                    CodeBlockDisassembly* disassembly) {
+  DCHECK(disassembly != NULL);
+
   RelativeAddress start(std::min(block1->addr(), block2->addr()));
   RelativeAddress end(std::max(block1->addr() + block1->size(),
                                block2->addr() + block2->size()));
 
-  to_merge_.insert(BlockGraph::AddressSpace::Range(start, end - start));
+  disassembly->merges.push_back(
+      BlockGraph::AddressSpace::Range(start, end - start));
 }
 
 BlockGraph::Block* Decomposer::CreateBlock(BlockGraph::BlockType type,
@@ -2004,11 +2292,16 @@ void Decomposer::OnBasicInstruction(
     *directive = Disassembler::kDirectiveTerminatePath;
 }
 
-void Decomposer::OnInstruction(const Disassembler& walker,
-                               const _DInst& instruction,
-                               Disassembler::CallbackDirective* directive) {
+void Decomposer::OnInstruction(
+    CodeBlockDisassembly* disassembly,
+    const Disassembler& walker,
+    const _DInst& instruction,
+    Disassembler::CallbackDirective* directive) const {
+  DCHECK(disassembly != NULL);
   DCHECK(directive != NULL);
 
+  BlockGraph::Block* current_block = disassembly->block;
+
   AbsoluteAddress instr_abs(static_cast<uint32>(instruction.addr));
   RelativeAddress instr_rel;
   if (!image_file_.Translate(instr_abs, &instr_rel)) {
@@ -2105,32 +2398,23 @@ void Decomposer::OnInstruction(const Disassembler& walker,
         mode = FIXUP_MUST_EXIST;
     }
 
-    // Validate or create the reference, as necessary.
-    if (!ValidateOrAddReference(mode, src, BlockGraph::PC_RELATIVE_REF, size,
-                                dst, 0, label.c_str(), &fixup_map_,
-                                &references_)) {
-      *directive = Disassembler::kDirectiveAbort;
-      return;
-    }
-
-    // See whether the block has a label at the offset.
-    BlockGraph::Offset offset = dst - block->addr();
-    if (!block->HasLabel(offset)) {
-      // If it has no label here, we add one.
-      std::string label(base::StringPrintf("From 0x%08X", src.value()));
-      block->SetLabel(offset, label.c_str());
-
-      // And then potentially re-schedule the block for disassembly,
-      // as we may have turned up another entry to a block we already
-      // disassembled.
-      to_disassemble_.insert(block);
-    }
+    // Record the reference. It is validated or created, and the destination
+    // labelled and re-scheduled for disassembly if need be, when the results
+    // of this disassembly are applied.
+    CodeBlockDisassembly::CodeReference ref;
+    ref.mode = mode;
+    ref.src = src;
+    ref.size = size;
+    ref.dst = dst;
+    ref.dst_block = block;
+    ref.name = label;
+    disassembly->references.push_back(ref);
 
     // For short references across blocks, we want to make sure we merge
     // the two blocks. AFAICT, this only occurs in hand-coded assembly in
     // the CRT, and the "functions" involved are not independent.
-    if (block != current_block_ && size != sizeof(RelativeAddress))
-      ScheduleForMerging(current_block_, block);
+    if (block != current_block && size != sizeof(RelativeAddress))
+      ScheduleForMerging(current_block, block, disassembly);
   }
 
   // We want to find function blocks where control flow runs off the end
@@ -2139,7 +2423,7 @@ void Decomposer::OnInstruction(const Disassembler& walker,
   // assembly in the CRT.
   if (fc != FC_RET && fc != FC_BRANCH && fc != FC_INT) {
     RelativeAddress instr_end(instr_rel + instruction.size);
-    RelativeAddress block_end(current_block_->addr() + current_block_->size());
+    RelativeAddress block_end(current_block->addr() + current_block->size());
     if  (instr_end == block_end) {
       // Find the following block.
       BlockGraph::Block* next_block =
@@ -2147,7 +2431,7 @@ void Decomposer::OnInstruction(const Disassembler& walker,
       DCHECK(next_block != NULL);
 
       // And schedule the two for merging.
-      ScheduleForMerging(current_block_, next_block);
+      ScheduleForMerging(current_block, next_block, disassembly);
     }
   }
 
@@ -2393,6 +2677,23 @@ bool Decomposer::OmapAndValidateFixups(const std::vector<OMAP>& omap_from,
     return false;
   }
 
+  // Get the original addresses, and map them through OMAP information.
+  // Normally DIA takes care of this for us, but there is no API for
+  // getting DIA to give us FIXUP information, so we have to do it manually.
+  // The addresses are translated in a single batch, which is much faster
+  // than translating them one at a time.
+  std::vector<uint32> fixup_addresses(pdb_fixups.size() * 2);
+  for (size_t i = 0; i < pdb_fixups.size(); ++i) {
+    fixup_addresses[2 * i] = pdb_fixups[i].rva_location;
+    fixup_addresses[2 * i + 1] = pdb_fixups[i].rva_base;
+  }
+  if (have_omap && !fixup_addresses.empty()) {
+    pdb::OmapIndex omap_index;
+    omap_index.Init(omap_from);
+    omap_index.TranslateBatch(fixup_addresses.size(), &fixup_addresses[0],
+                              &fixup_addresses[0]);
+  }
+
   // Ensure the fixups are all valid, and populate the fixup map.
   size_t skipped = 0;
   for (size_t i = 0; i < pdb_fixups.size(); ++i) {
@@ -2402,15 +2703,8 @@ bool Decomposer::OmapAndValidateFixups(const std::vector<OMAP>& omap_from,
       return false;
     }
 
-    // Get the original addresses, and map them through OMAP information.
-    // Normally DIA takes care of this for us, but there is no API for
-    // getting DIA to give us FIXUP information, so we have to do it manually.
-    RelativeAddress rva_location(pdb_fixups[i].rva_location);
-    RelativeAddress rva_base(pdb_fixups[i].rva_base);
-    if (have_omap) {
-      rva_location = TranslateAddressViaOmap(omap_from, rva_location);
-      rva_base = TranslateAddressViaOmap(omap_from, rva_base);
-    }
+    RelativeAddress rva_location(fixup_addresses[2 * i]);
+    RelativeAddress rva_base(fixup_addresses[2 * i + 1]);
 
     // If these are part of the .rsrc section, ignore them.
     if (rva_location >= rsrc_start)
@@ -2445,15 +2739,19 @@ bool Decomposer::BuildBasicBlockGraph(DecomposedImage* decomposed_image) {
   DCHECK(image_ != NULL);
   BlockGraph::AddressSpace::RangeMapConstIter block_iter = image_->begin();
 
-  BlockGraph& basic_blocks = decomposed_image->basic_block_graph;
   BlockGraph::AddressSpace* basic_blocks_image =
       &decomposed_image->basic_block_address_space;
   DCHECK(basic_blocks_image != NULL);
 
-  bool success = true;
+  // Each code block is broken up independently of the others, so we set up
+  // the work for all of them, and then disassemble them on num_threads_
+  // threads. The results are merged into the basic block image in address
+  // order, exactly as if they'd been disassembled one after the other.
+  std::vector<BasicBlockDisassembly> disassemblies;
+  std::vector<BasicBlockDisassembly*> code_disassemblies;
+  disassemblies.reserve(image_->size());
   for (; block_iter != image_->end(); ++block_iter) {
     const BlockGraph::Block* block = block_iter->second;
-    const BlockGraph::Block::ReferenceMap& ref_map = block->references();
     RelativeAddress block_addr;
     if (!image_->GetAddressOf(block, &block_addr)) {
       LOG(DFATAL) << "Block " << block->name() << " has no address, "
@@ -2462,82 +2760,111 @@ bool Decomposer::BuildBasicBlockGraph(DecomposedImage* decomposed_image) {
       continue;
     }
 
+    disassemblies.push_back(BasicBlockDisassembly());
+    BasicBlockDisassembly& disassembly = disassemblies.back();
+    disassembly.decomposer = this;
+    disassembly.block = block;
+    disassembly.block_addr = block_addr;
+  }
+
+  for (size_t i = 0; i < disassemblies.size(); ++i) {
+    if (disassemblies[i].block->type() == BlockGraph::CODE_BLOCK)
+      code_disassemblies.push_back(&disassemblies[i]);
+  }
+
+  DisassembleLoop<BasicBlockDisassembly> loop(code_disassemblies);
+  core::RunParallelLoop(code_disassemblies.size(), num_threads_, &loop);
+
+  for (size_t i = 0; i < disassemblies.size(); ++i) {
+    const BasicBlockDisassembly& disassembly = disassemblies[i];
+    const BlockGraph::Block* block = disassembly.block;
+    RelativeAddress block_addr(disassembly.block_addr);
+
     if (block->type() != BlockGraph::CODE_BLOCK) {
       // Don't try to break up non-code blocks into basic blocks.
       basic_blocks_image->AddBlock(block->type(),   // Block type
                                    block_addr,      // Range start (rel)
                                    block->size(),   // Range size
                                    block->name());  // Block name
+      continue;
+    }
 
-    } else {
-      // We have a code block, disassemble it!
-      AbsoluteAddress abs_block_addr;
-      if (!image_file_.Translate(block_addr, &abs_block_addr)) {
+    // The failure has already been logged by DisassembleBasicBlocks.
+    if (disassembly.result != Disassembler::kWalkSuccess &&
+        disassembly.result != Disassembler::kWalkIncomplete) {
+      return false;
+    }
+
+    BasicBlockDisassembler::RangeMapConstIter iter(
+        disassembly.basic_blocks.begin());
+    for (; iter != disassembly.basic_blocks.end(); ++iter) {
+      RelativeAddress rva_start;
+      if (!image_file_.Translate(iter->first.start(), &rva_start)) {
         LOG(ERROR) << "Unable to get absolute address for " << block_addr;
         return false;
       }
 
-      // Build the set of labels that are points we want to disassemble from.
-      // For now we continue to use the that point into the function block.
-      // TODO(robertshield): See if we would be better served by considering all
-      // inbound references we have discovered in the previous traversal
-      // instead.
-      BlockGraph::Block::LabelMap::const_iterator it(block->labels().begin());
-      Disassembler::AddressSet labels;
-      for (; it != block->labels().end(); ++it) {
-        BlockGraph::Offset label = it->first;
-        DCHECK_LE(0, label);
-        DCHECK_GT(block->size(), static_cast<size_t>(label));
-
-        // We sometimes receive labels for lookup tables. Thus labels that point
-        // directly to a reloc should not be used as a starting point for
-        // disassembly.
-        RelativeAddress addr(block->addr() + static_cast<size_t>(label));
-        if (reloc_set_.find(addr) == reloc_set_.end())
-          labels.insert(abs_block_addr + it->first);
-      }
-
-      scoped_ptr<Disassembler::InstructionCallback> on_basic_instruction(
-          NewCallback(this, &Decomposer::OnBasicInstruction));
-
-      BasicBlockDisassembler disasm(block->data(),
-                                    block->data_size(),
-                                    abs_block_addr,
-                                    labels,
-                                    block->name(),
-                                    on_basic_instruction.get());
-      Disassembler::WalkResult result = disasm.Walk();
-
-      if (result == Disassembler::kWalkSuccess ||
-          result == Disassembler::kWalkIncomplete) {
-        BasicBlockDisassembler::BBAddressSpace basic_blocks(
-            disasm.GetBasicBlockRanges());
-
-        BasicBlockDisassembler::RangeMapConstIter iter(
-            basic_blocks.begin());
-        for (; iter != basic_blocks.end(); ++iter) {
-          RelativeAddress rva_start;
-          if (!image_file_.Translate(iter->first.start(), &rva_start)) {
-            LOG(ERROR) << "Unable to get absolute address for " << block_addr;
-            return false;
-          }
-
-          basic_blocks_image->AddBlock(
-              iter->second.type(),   // Block type
-              rva_start,             // Range start (rel)
-              iter->first.size(),    // Range size
-              iter->second.name());  // Block name
-        }
-      } else {
-        LOG(ERROR) << "Failed to disassemble block at "
-            << abs_block_addr.value();
-        success = false;
-        break;
-      }
+      basic_blocks_image->AddBlock(
+          iter->second.type(),   // Block type
+          rva_start,             // Range start (rel)
+          iter->first.size(),    // Range size
+          iter->second.name());  // Block name
     }
   }
 
-  return success;
+  return true;
+}
+
+void Decomposer::DisassembleBasicBlocks(BasicBlockDisassembly* disassembly) {
+  DCHECK(disassembly != NULL);
+  const BlockGraph::Block* block = disassembly->block;
+  DCHECK(block != NULL);
+  DCHECK_EQ(BlockGraph::CODE_BLOCK, block->type());
+
+  RelativeAddress block_addr(disassembly->block_addr);
+  AbsoluteAddress abs_block_addr;
+  if (!image_file_.Translate(block_addr, &abs_block_addr)) {
+    LOG(ERROR) << "Unable to get absolute address for " << block_addr;
+    return;
+  }
+
+  // Build the set of labels that are points we want to disassemble from.
+  // For now we continue to use the that point into the function block.
+  // TODO(robertshield): See if we would be better served by considering all
+  // inbound references we have discovered in the previous traversal
+  // instead.
+  BlockGraph::Block::LabelMap::const_iterator it(block->labels().begin());
+  Disassembler::AddressSet labels;
+  for (; it != block->labels().end(); ++it) {
+    BlockGraph::Offset label = it->first;
+    DCHECK_LE(0, label);
+    DCHECK_GT(block->size(), static_cast<size_t>(label));
+
+    // We sometimes receive labels for lookup tables. Thus labels that point
+    // directly to a reloc should not be used as a starting point for
+    // disassembly.
+    RelativeAddress addr(block->addr() + static_cast<size_t>(label));
+    if (reloc_set_.find(addr) == reloc_set_.end())
+      labels.insert(abs_block_addr + it->first);
+  }
+
+  scoped_ptr<Disassembler::InstructionCallback> on_basic_instruction(
+      NewCallback(this, &Decomposer::OnBasicInstruction));
+
+  BasicBlockDisassembler disasm(block->data(),
+                                block->data_size(),
+                                abs_block_addr,
+                                labels,
+                                block->name(),
+                                on_basic_instruction.get());
+  disassembly->result = disasm.Walk();
+  if (disassembly->result != Disassembler::kWalkSuccess &&
+      disassembly->result != Disassembler::kWalkIncomplete) {
+    LOG(ERROR) << "Failed to disassemble block at " << abs_block_addr.value();
+    return;
+  }
+
+  disassembly->basic_blocks = disasm.GetBasicBlockRanges();
 }
 
 bool Decomposer::RegisterStaticInitializerPatterns(const char* begin,
@@ -2596,10 +2923,13 @@ bool LoadDecomposition(PEFile* pe_file,
   DCHECK(image != NULL);
   DCHECK(in_archive != NULL);
 
-  // Load the metadata and initialize the PE file decomposition.
+  // Load the metadata and initialize the PE file decomposition. The image
+  // file is mapped, so only the pages holding data that's actually used by
+  // the blocks get read.
   Metadata metadata;
   if (!in_archive->Load(&metadata) ||
-      !pe_file->Init(FilePath(metadata.module_signature().path))) {
+      !pe_file->Init(FilePath(metadata.module_signature().path),
+                     PEFile::MAP_IMAGE_DATA)) {
     return false;
   }
 
@@ -2645,4 +2975,179 @@ bool LoadDecomposition(PEFile* pe_file,
   return true;
 }
 
+bool SaveCompactDecomposition(const PEFile& pe_file,
+                              const Decomposer::DecomposedImage& image,
+                              std::vector<uint8>* buffer) {
+  DCHECK(buffer != NULL);
+
+  core::SectionedFileWriter file_writer(kCompactDecompositionMagic,
+                                        kCompactDecompositionVersion);
+
+  // The metadata is small, and has its own serialization, so it's simply
+  // archived into its section.
+  Metadata metadata;
+  PEFile::Signature pe_file_signature;
+  pe_file.GetSignature(&pe_file_signature);
+  core::ScopedOutStreamPtr out_stream(core::CreateByteOutStream(
+      std::back_inserter(*file_writer.AddSection(METADATA_SECTION))));
+  core::NativeBinaryOutArchive out_archive(out_stream.get());
+  if (!metadata.Init(pe_file_signature) || !out_archive.Save(metadata))
+    return false;
+
+  // The block graphs share a single string table, as the basic blocks mostly
+  // carry the names of the blocks they were carved from.
+  core::StringTableBuilder strings;
+  core::CompactWriter image_writer(file_writer.AddSection(IMAGE_SECTION));
+  image.image.SaveCompact(&strings, &image_writer);
+  image.address_space.SaveCompact(&image_writer);
+
+  core::CompactWriter basic_block_writer(
+      file_writer.AddSection(BASIC_BLOCK_GRAPH_SECTION));
+  image.basic_block_graph.SaveCompact(&strings, &basic_block_writer);
+  image.basic_block_address_space.SaveCompact(&basic_block_writer);
+
+  core::CompactWriter string_writer(
+      file_writer.AddSection(STRING_TABLE_SECTION));
+  strings.Write(&string_writer);
+
+  core::CompactWriter omap_writer(file_writer.AddSection(OMAP_SECTION));
+  SaveCompactOmap(image.omap_to, &omap_writer);
+  SaveCompactOmap(image.omap_from, &omap_writer);
+
+  core::CompactWriter header_writer(file_writer.AddSection(HEADER_SECTION));
+  SaveCompactBlockPointer(image.header.dos_header, &header_writer);
+  SaveCompactBlockPointer(image.header.nt_headers, &header_writer);
+  for (size_t i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; ++i)
+    SaveCompactBlockPointer(image.header.data_directory[i], &header_writer);
+
+  file_writer.Finish(buffer);
+  return true;
+}
+
+bool SaveCompactDecomposition(const PEFile& pe_file,
+                              const Decomposer::DecomposedImage& image,
+                              const FilePath& path) {
+  std::vector<uint8> buffer;
+  if (!SaveCompactDecomposition(pe_file, image, &buffer))
+    return false;
+
+  file_util::ScopedFILE file(file_util::OpenFile(path, "wb"));
+  if (file.get() == NULL ||
+      fwrite(&buffer[0], 1, buffer.size(), file.get()) != buffer.size()) {
+    LOG(ERROR) << "Unable to write decomposition to \"" << path.value()
+               << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+bool LoadCompactDecomposition(const uint8* data,
+                              size_t size,
+                              PEFile* pe_file,
+                              Decomposer::DecomposedImage* image) {
+  DCHECK(data != NULL);
+  DCHECK(pe_file != NULL);
+  DCHECK(image != NULL);
+
+  core::SectionedFileReader file_reader;
+  if (!file_reader.Init(kCompactDecompositionMagic,
+                        kCompactDecompositionVersion,
+                        data,
+                        size)) {
+    return false;
+  }
+
+  // Load the metadata and initialize the PE file decomposition, exactly as
+  // LoadDecomposition does.
+  scoped_ptr<core::CompactReader> reader;
+  if (!GetCompactSection(file_reader, METADATA_SECTION, &reader))
+    return false;
+  const uint8* metadata_data = NULL;
+  size_t metadata_size = reader->remaining();
+  bool read = reader->ReadBytes(metadata_size, &metadata_data);
+  DCHECK(read);
+  core::ScopedInStreamPtr in_stream(core::CreateByteInStream(
+      metadata_data, metadata_data + metadata_size));
+  core::NativeBinaryInArchive in_archive(in_stream.get());
+  Metadata metadata;
+  if (!in_archive.Load(&metadata) ||
+      !pe_file->Init(FilePath(metadata.module_signature().path),
+                     PEFile::MAP_IMAGE_DATA)) {
+    return false;
+  }
+
+  PEFile::Signature pe_signature;
+  pe_file->GetSignature(&pe_signature);
+  if (!metadata.IsConsistent(pe_signature))
+    return false;
+
+  // The string table is used in place, straight out of the file.
+  const uint8* string_data = NULL;
+  size_t string_size = 0;
+  core::StringTable strings;
+  if (!file_reader.GetSection(STRING_TABLE_SECTION, &string_data,
+                              &string_size) ||
+      !strings.Init(string_data, string_size)) {
+    LOG(ERROR) << "Unable to load decomposition string table.";
+    return false;
+  }
+
+  if (!GetCompactSection(file_reader, IMAGE_SECTION, &reader) ||
+      !image->image.LoadCompact(strings, reader.get()) ||
+      !image->address_space.LoadCompact(reader.get())) {
+    return false;
+  }
+
+  if (!GetCompactSection(file_reader, BASIC_BLOCK_GRAPH_SECTION, &reader) ||
+      !image->basic_block_graph.LoadCompact(strings, reader.get()) ||
+      !image->basic_block_address_space.LoadCompact(reader.get())) {
+    return false;
+  }
+
+  if (!GetCompactSection(file_reader, OMAP_SECTION, &reader) ||
+      !LoadCompactOmap(reader.get(), &image->omap_to) ||
+      !LoadCompactOmap(reader.get(), &image->omap_from)) {
+    return false;
+  }
+
+  if (!SetBlockDataPointers(*pe_file, &image->image) ||
+      !SetBlockDataPointers(*pe_file, &image->basic_block_graph)) {
+    return false;
+  }
+
+  if (!GetCompactSection(file_reader, HEADER_SECTION, &reader) ||
+      !LoadCompactBlockPointer(image->image, &image->header.dos_header,
+                               reader.get()) ||
+      !LoadCompactBlockPointer(image->image, &image->header.nt_headers,
+                               reader.get())) {
+    return false;
+  }
+
+  for (size_t i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; ++i) {
+    if (!LoadCompactBlockPointer(image->image,
+                                 &image->header.data_directory[i],
+                                 reader.get())) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool LoadCompactDecomposition(const FilePath& path,
+                              PEFile* pe_file,
+                              Decomposer::DecomposedImage* image) {
+  // The file is mapped rather than read, so the only copies made are those
+  // of the block data and OMAP entries.
+  file_util::MemoryMappedFile mapped_file;
+  if (!mapped_file.Initialize(path)) {
+    LOG(ERROR) << "Unable to map decomposition \"" << path.value() << "\".";
+    return false;
+  }
+
+  return LoadCompactDecomposition(mapped_file.data(), mapped_file.length(),
+                                  pe_file, image);
+}
+
 }  // namespace pe
@@ -26,6 +26,8 @@
 #include <string>
 #include <vector>
 #include "base/file_path.h"
+#include "base/logging.h"
+#include "base/time.h"
 #include "pcrecpp.h"  // NOLINT
 #include "syzygy/core/basic_block_disassembler.h"
 #include "syzygy/core/block_graph.h"
@@ -51,6 +53,10 @@ class Decomposer {
   // Statistics regarding the decomposition.
   struct CoverageStatistics;
   struct DetailedCodeBlockStatistics;
+  // The results of disassembling a single code block.
+  class CodeBlockDisassembly;
+  // The results of breaking a single code block up into basic blocks.
+  class BasicBlockDisassembly;
 
   typedef core::RelativeAddress RelativeAddress;
   typedef core::AddressSpace<RelativeAddress, size_t, std::string> DataSpace;
@@ -89,9 +95,23 @@ class Decomposer {
   //     of any utility using Decomposer.
   bool RegisterStaticInitializerPatterns(const char* begin, const char* end);
 
+  // Sets the number of threads used to disassemble code blocks, both when
+  // creating code references and when breaking code blocks up into basic
+  // blocks. With more than one thread, blocks are disassembled in parallel
+  // and the results are applied in the same order as the serial decomposer
+  // would apply them, so the decomposition is identical regardless of the
+  // number of threads. Defaults to 1.
+  void set_num_threads(size_t num_threads) {
+    DCHECK_LT(0U, num_threads);
+    num_threads_ = num_threads;
+  }
+  size_t num_threads() const { return num_threads_; }
+
  protected:
   typedef std::map<RelativeAddress, std::string> DataLabels;
   typedef std::vector<pdb::PdbFixup> PdbFixups;
+  typedef std::map<BlockGraph::Block*, CodeBlockDisassembly>
+      CodeBlockDisassemblyMap;
 
   // Create blocks for all code.
   bool CreateCodeBlocks(IDiaSymbol* globals);
@@ -158,8 +178,13 @@ class Decomposer {
   bool FindPaddingBlocks();
 
   // Invokable once we have completed our original block graphs, this breaks
-  // up code-blocks into their basic sub-components.
+  // up code-blocks into their basic sub-components. The code blocks are
+  // disassembled on num_threads_ threads.
   bool BuildBasicBlockGraph(DecomposedImage* decomposed_image);
+  // Breaks up a single code block into basic blocks, storing them in
+  // @p disassembly. This only reads the decomposition, so it may be called
+  // concurrently for distinct blocks.
+  void DisassembleBasicBlocks(BasicBlockDisassembly* disassembly);
 
   // Parses the various debug streams. This populates fixup_map_ as well.
   bool LoadDebugStreams(IDiaSession* dia_session,
@@ -187,12 +212,26 @@ class Decomposer {
   bool CreateCodeLabelsFromFixups();
   // Disassemble all code blocks and create code->code references.
   bool CreateCodeReferences();
-  // Disassemble @p block and invoke @p on_instruction for each instruction
-  // encountered.
+  // Disassemble @p block and create the code->code references it contains.
   bool CreateCodeReferencesForBlock(BlockGraph::Block* block);
-
-  // Schedules the address range covering block1 and block2 for merging.
-  void ScheduleForMerging(BlockGraph::Block* block1, BlockGraph::Block* block2);
+  // Disassembles @p block, recording the references, labels and merges it
+  // turns up in @p disassembly rather than applying them. This only reads the
+  // decomposition, so it may be called concurrently for distinct blocks.
+  void DisassembleCodeBlock(BlockGraph::Block* block,
+                            CodeBlockDisassembly* disassembly) const;
+  // Applies the results of DisassembleCodeBlock to the decomposition.
+  // @returns false if the disassembly failed or its references conflict
+  //     with the fixups or with other references.
+  bool ApplyCodeBlockDisassembly(const CodeBlockDisassembly& disassembly);
+  // Disassembles, on num_threads_ threads, every block in to_disassemble_
+  // that doesn't already have an up-to-date entry in @p disassemblies.
+  void DisassembleQueuedBlocks(CodeBlockDisassemblyMap* disassemblies);
+
+  // Schedules the address range covering block1 and block2 for merging, by
+  // recording it in @p disassembly.
+  static void ScheduleForMerging(BlockGraph::Block* block1,
+                                 BlockGraph::Block* block2,
+                                 CodeBlockDisassembly* disassembly);
 
   // Parses the PE BlockGraph header and other important PE structures,
   // adds them as blocks to the image, and creates the references
@@ -228,10 +267,12 @@ class Decomposer {
                                        const char* name,
                                        FindOrCreateBlockDirective directive);
 
-  // Called through a callback during function disassembly.
-  void OnInstruction(const Disassembler& disassembler,
+  // Called through a callback during function disassembly. Records what the
+  // instruction turns up in @p disassembly.
+  void OnInstruction(CodeBlockDisassembly* disassembly,
+                     const Disassembler& disassembler,
                      const _DInst& instruction,
-                     Disassembler::CallbackDirective* directive);
+                     Disassembler::CallbackDirective* directive) const;
   // Called through a callback during function disassembly.
   void OnBasicInstruction(const Disassembler& disassembler,
                           const _DInst& instruction,
@@ -271,8 +312,6 @@ class Decomposer {
   typedef std::pair<RE, RE> REPair;
   typedef std::vector<REPair> REPairs;
 
-  // The block we're currently disassembling.
-  BlockGraph::Block* current_block_;
   // Keeps track of which blocks we've yet to disassemble.
   BlockSet to_disassemble_;
   // Keeps track of address ranges that we want to merge because
@@ -294,6 +333,13 @@ class Decomposer {
   // A set of static initializer search pattern pairs. These are used to
   // ensure we don't break up blocks of static initializer function pointers.
   REPairs static_initializer_patterns_;
+
+  // The number of threads used to disassemble code blocks.
+  size_t num_threads_;
+  // Keeps track of the work done by CreateCodeReferences.
+  size_t code_block_walk_count_;
+  size_t discarded_code_block_walk_count_;
+  base::TimeDelta code_references_time_;
 };
 
 // The results of the decomposition process are stored in this class.
@@ -324,6 +370,27 @@ bool LoadDecomposition(PEFile* pe_file,
                        Decomposer::DecomposedImage* image,
                        core::InArchive* in_archive);
 
+// These serialize a PEFile/DecomposedImage pair to the compact format
+// declared in core/compact_file.h. This holds the same information as
+// SaveDecomposition, but is a good deal smaller and faster to load, as files
+// are memory mapped and read in bulk.
+bool SaveCompactDecomposition(const PEFile& pe_file,
+                              const Decomposer::DecomposedImage& image,
+                              std::vector<uint8>* buffer);
+bool SaveCompactDecomposition(const PEFile& pe_file,
+                              const Decomposer::DecomposedImage& image,
+                              const FilePath& path);
+// @param data the serialized decomposition, which need only remain valid
+//     for the duration of the call.
+// @param size the size of @p data.
+bool LoadCompactDecomposition(const uint8* data,
+                              size_t size,
+                              PEFile* pe_file,
+                              Decomposer::DecomposedImage* image);
+bool LoadCompactDecomposition(const FilePath& path,
+                              PEFile* pe_file,
+                              Decomposer::DecomposedImage* image);
+
 // This stores fixups, but in a format more convenient for us than the
 // basic PdbFixup struct.
 struct Decomposer::Fixup {
@@ -407,6 +474,20 @@ struct Decomposer::CoverageStatistics {
     BlockStatistics data;
     SimpleBlockStatistics no_section;
   } blocks;
+
+  // Stores information about the disassembly of code blocks.
+  struct {
+    // The number of threads used.
+    size_t thread_count;
+    // The number of times a code block was disassembled. Blocks are
+    // disassembled again whenever new labels are found in them.
+    size_t walk_count;
+    // The number of speculative disassemblies that were thrown away because
+    // the block gained labels before they could be applied.
+    size_t discarded_walk_count;
+    // The wall-clock time spent creating code references, in milliseconds.
+    int64 time_ms;
+  } disassembly;
 };
 
 }  // namespace pe
@@ -15,7 +15,10 @@
 
 #include "base/file_util.h"
 #include "base/path_service.h"
+#include "base/scoped_ptr.h"
 #include "base/string_util.h"
+#include "base/sys_info.h"
+#include "base/time.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/pe/unittest_util.h"
@@ -129,6 +132,178 @@ TEST_F(DecomposerTest, BlockGraphSerializationRoundTrip) {
   }
 }
 
+TEST_F(DecomposerTest, CompactSerializationRoundTrip) {
+  FilePath image_path(GetExeRelativePath(kDllName));
+  PEFile image_file;
+
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer decomposer(image_file, image_path);
+
+  Decomposer::DecomposedImage decomposed;
+  Decomposer::CoverageStatistics stats;
+  ASSERT_TRUE(decomposer.Decompose(&decomposed, &stats,
+                                   Decomposer::BASIC_BLOCK_DECOMPOSITION));
+
+  FilePath temp_dir;
+  CreateTemporaryDir(&temp_dir);
+  FilePath temp_file_path = temp_dir.Append(L"test_dll.dll.bgc");
+
+  ASSERT_TRUE(SaveCompactDecomposition(image_file, decomposed,
+                                       temp_file_path));
+
+  PEFile in_image_file;
+  Decomposer::DecomposedImage in_decomposed;
+  ASSERT_TRUE(LoadCompactDecomposition(temp_file_path, &in_image_file,
+                                       &in_decomposed));
+
+  EXPECT_TRUE(testing::BlockGraphsEqual(decomposed.image,
+                                        in_decomposed.image));
+  EXPECT_TRUE(testing::BlockGraphsEqual(decomposed.basic_block_graph,
+                                        in_decomposed.basic_block_graph));
+  EXPECT_EQ(decomposed.address_space.address_space_impl().size(),
+            in_decomposed.address_space.address_space_impl().size());
+  EXPECT_EQ(
+      decomposed.basic_block_address_space.address_space_impl().size(),
+      in_decomposed.basic_block_address_space.address_space_impl().size());
+  EXPECT_EQ(decomposed.omap_to.size(), in_decomposed.omap_to.size());
+  EXPECT_EQ(decomposed.omap_from.size(), in_decomposed.omap_from.size());
+
+  ASSERT_TRUE(in_decomposed.header.nt_headers != NULL);
+  EXPECT_EQ(decomposed.header.nt_headers->id(),
+            in_decomposed.header.nt_headers->id());
+  for (size_t i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; ++i) {
+    EXPECT_EQ(decomposed.header.data_directory[i] == NULL,
+              in_decomposed.header.data_directory[i] == NULL);
+  }
+
+  // Anything without the right header is rejected.
+  std::vector<uint8> buffer;
+  ASSERT_TRUE(SaveCompactDecomposition(image_file, decomposed, &buffer));
+  buffer[0] ^= 0xFF;
+  PEFile bad_image_file;
+  Decomposer::DecomposedImage bad_decomposed;
+  EXPECT_FALSE(LoadCompactDecomposition(&buffer[0], buffer.size(),
+                                        &bad_image_file, &bad_decomposed));
+}
+
+TEST_F(DecomposerTest, ParallelDecompositionMatchesSerial) {
+  FilePath image_path(GetExeRelativePath(kDllName));
+  PEFile image_file;
+
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer serial_decomposer(image_file, image_path);
+  EXPECT_EQ(1U, serial_decomposer.num_threads());
+  Decomposer::DecomposedImage serial_decomposed;
+  Decomposer::CoverageStatistics serial_stats;
+  ASSERT_TRUE(serial_decomposer.Decompose(&serial_decomposed, &serial_stats,
+                                          Decomposer::STANDARD_DECOMPOSITION));
+
+  Decomposer parallel_decomposer(image_file, image_path);
+  parallel_decomposer.set_num_threads(4);
+  Decomposer::DecomposedImage parallel_decomposed;
+  Decomposer::CoverageStatistics parallel_stats;
+  ASSERT_TRUE(parallel_decomposer.Decompose(
+      &parallel_decomposed, &parallel_stats,
+      Decomposer::STANDARD_DECOMPOSITION));
+
+  // The decompositions must be identical, down to the block ids and labels.
+  EXPECT_TRUE(testing::BlockGraphsEqual(serial_decomposed.image,
+                                        parallel_decomposed.image));
+
+  // Every block that was applied was disassembled with the same labels, so
+  // the same number of disassemblies should have been applied.
+  EXPECT_EQ(1U, serial_stats.disassembly.thread_count);
+  EXPECT_EQ(0U, serial_stats.disassembly.discarded_walk_count);
+  EXPECT_EQ(4U, parallel_stats.disassembly.thread_count);
+  EXPECT_EQ(serial_stats.disassembly.walk_count,
+            parallel_stats.disassembly.walk_count);
+  EXPECT_LT(0U, parallel_stats.disassembly.walk_count);
+}
+
+TEST_F(DecomposerTest, ParallelBasicBlockDecompositionMatchesSerial) {
+  FilePath image_path(GetExeRelativePath(kDllName));
+  PEFile image_file;
+
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer serial_decomposer(image_file, image_path);
+  Decomposer::DecomposedImage serial_decomposed;
+  ASSERT_TRUE(serial_decomposer.Decompose(
+      &serial_decomposed, NULL, Decomposer::BASIC_BLOCK_DECOMPOSITION));
+
+  Decomposer parallel_decomposer(image_file, image_path);
+  parallel_decomposer.set_num_threads(4);
+  Decomposer::DecomposedImage parallel_decomposed;
+  ASSERT_TRUE(parallel_decomposer.Decompose(
+      &parallel_decomposed, NULL, Decomposer::BASIC_BLOCK_DECOMPOSITION));
+
+  // The basic blocks are merged in address order, so even their ids match.
+  EXPECT_LE(serial_decomposed.image.blocks().size(),
+            serial_decomposed.basic_block_graph.blocks().size());
+  EXPECT_TRUE(testing::BlockGraphsEqual(
+      serial_decomposed.basic_block_graph,
+      parallel_decomposed.basic_block_graph));
+}
+
+// Decomposes the test DLL with and without basic blocks at each power of two
+// threads up to the processor count. BuildBasicBlockGraph is the only
+// difference between the two kinds of decomposition, so the gap between
+// their times is the time spent in it. Disabled; it runs twenty
+// decompositions for each thread count.
+TEST_F(DecomposerTest, DISABLED_BasicBlockDecompositionBenchmark) {
+  const size_t kIterations = 10;
+  FilePath image_path(GetExeRelativePath(kDllName));
+  PEFile image_file;
+
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  size_t max_threads = base::SysInfo::NumberOfProcessors();
+  scoped_ptr<Decomposer::DecomposedImage> serial_decomposed;
+  base::TimeDelta serial_time;
+  for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    base::TimeDelta standard_time;
+    base::TimeDelta basic_block_time;
+    for (size_t i = 0; i < kIterations; ++i) {
+      Decomposer standard_decomposer(image_file, image_path);
+      standard_decomposer.set_num_threads(num_threads);
+      Decomposer::DecomposedImage standard_decomposed;
+      base::Time start = base::Time::Now();
+      ASSERT_TRUE(standard_decomposer.Decompose(
+          &standard_decomposed, NULL, Decomposer::STANDARD_DECOMPOSITION));
+      standard_time += base::Time::Now() - start;
+
+      Decomposer decomposer(image_file, image_path);
+      decomposer.set_num_threads(num_threads);
+      scoped_ptr<Decomposer::DecomposedImage> decomposed(
+          new Decomposer::DecomposedImage());
+      start = base::Time::Now();
+      ASSERT_TRUE(decomposer.Decompose(
+          decomposed.get(), NULL, Decomposer::BASIC_BLOCK_DECOMPOSITION));
+      basic_block_time += base::Time::Now() - start;
+
+      // The basic block graph doesn't depend on the number of threads.
+      if (serial_decomposed.get() == NULL) {
+        serial_decomposed.reset(decomposed.release());
+      } else {
+        ASSERT_TRUE(testing::BlockGraphsEqual(
+            serial_decomposed->basic_block_graph,
+            decomposed->basic_block_graph));
+      }
+    }
+
+    base::TimeDelta time = (basic_block_time - standard_time) / kIterations;
+    if (num_threads == 1)
+      serial_time = time;
+    LOG(INFO) << "Built a basic block graph of "
+        << serial_decomposed->basic_block_graph.blocks().size()
+        << " blocks on " << num_threads << " thread(s) in "
+        << time.InMillisecondsF() << " ms, a speedup of "
+        << serial_time.InMillisecondsF() / time.InMillisecondsF() << "x.";
+  }
+}
+
 // TODO(siggi): More tests.
 
 }  // namespace pe
@@ -15,6 +15,7 @@
 
 #include "base/file_util.h"
 #include "base/logging.h"
+#include "base/win/scoped_handle.h"
 
 namespace {
 
@@ -42,14 +43,29 @@ using core::RelativeAddress;
 PEFile::PEFile()
     : dos_header_(NULL),
       nt_headers_(NULL),
-      section_headers_(NULL) {
+      section_headers_(NULL),
+      view_(NULL),
+      view_size_(0) {
 }
 
 PEFile::~PEFile() {
+  UnmapImageFile();
 }
 
 bool PEFile::Init(const FilePath& path) {
+  return Init(path, READ_IMAGE_DATA);
+}
+
+bool PEFile::Init(const FilePath& path, LoadMode load_mode) {
   path_ = path;
+
+  if (load_mode == MAP_IMAGE_DATA) {
+    if (!MapImageFile())
+      return false;
+    return ReadHeaders(NULL) && ReadSections(NULL);
+  }
+
+  DCHECK_EQ(READ_IMAGE_DATA, load_mode);
   FILE* file = file_util::OpenFile(path, "rb");
   if (file == NULL) {
     LOG(ERROR) << "Failed to open file " << path.value().c_str();
@@ -65,6 +81,90 @@ bool PEFile::Init(const FilePath& path) {
   return success;
 }
 
+bool PEFile::MapImageFile() {
+  DCHECK(view_ == NULL);
+
+  base::win::ScopedHandle file_handle(
+      ::CreateFile(path_.value().c_str(), GENERIC_READ, FILE_SHARE_READ,
+                   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+  if (!file_handle.IsValid()) {
+    LOG(ERROR) << "Failed to open file " << path_.value().c_str();
+    return false;
+  }
+
+  LARGE_INTEGER file_size = {};
+  if (!::GetFileSizeEx(file_handle.Get(), &file_size) ||
+      file_size.HighPart != 0 || file_size.LowPart == 0) {
+    LOG(ERROR) << "Invalid size for file " << path_.value().c_str();
+    return false;
+  }
+
+  // The mapping is copy-on-write, so that callers of the non-const
+  // GetImageData may modify the image data without touching the file.
+  base::win::ScopedHandle mapping_handle(
+      ::CreateFileMapping(file_handle.Get(), NULL, PAGE_WRITECOPY, 0, 0,
+                          NULL));
+  if (!mapping_handle.IsValid()) {
+    LOG(ERROR) << "Failed to create mapping for file "
+        << path_.value().c_str();
+    return false;
+  }
+
+  // The view keeps the mapping, and thus the file, open after the handles
+  // are closed.
+  view_ = reinterpret_cast<uint8*>(
+      ::MapViewOfFile(mapping_handle.Get(), FILE_MAP_COPY, 0, 0, 0));
+  if (view_ == NULL) {
+    LOG(ERROR) << "Failed to map view of file " << path_.value().c_str();
+    return false;
+  }
+  view_size_ = file_size.LowPart;
+
+  return true;
+}
+
+void PEFile::UnmapImageFile() {
+  if (view_ == NULL)
+    return;
+
+  CHECK(::UnmapViewOfFile(view_));
+  view_ = NULL;
+  view_size_ = 0;
+}
+
+bool PEFile::ReadFileAt(FILE* file, size_t pos, void* buf, size_t len) const {
+  if (view_ == NULL)
+    return ReadAt(file, pos, buf, len);
+
+  if (pos > view_size_ || len > view_size_ - pos)
+    return false;
+
+  memcpy(buf, view_ + pos, len);
+  return true;
+}
+
+bool PEFile::LoadSectionData(FILE* file,
+                             size_t pos,
+                             size_t len,
+                             SectionInfo* info) {
+  DCHECK(info != NULL);
+  DCHECK_LT(0U, len);
+
+  if (view_ != NULL) {
+    if (pos > view_size_ || len > view_size_ - pos)
+      return false;
+    info->data = view_ + pos;
+  } else {
+    info->buffer.resize(len);
+    if (!ReadAt(file, pos, &info->buffer.at(0), len))
+      return false;
+    info->data = &info->buffer.at(0);
+  }
+
+  info->data_size = len;
+  return true;
+}
+
 void PEFile::GetSignature(Signature* signature) const {
   DCHECK(signature != NULL);
   DCHECK(nt_headers_ != NULL);
@@ -152,7 +252,7 @@ const IMAGE_SECTION_HEADER* PEFile::GetSectionHeader(const char* name) const {
 bool PEFile::ReadHeaders(FILE* file) {
   // Read the DOS header.
   IMAGE_DOS_HEADER dos_header = {};
-  if (!ReadAt(file, 0, &dos_header, sizeof(dos_header))) {
+  if (!ReadFileAt(file, 0, &dos_header, sizeof(dos_header))) {
     LOG(ERROR) << "Unable to read DOS header";
     return false;
   }
@@ -160,7 +260,7 @@ bool PEFile::ReadHeaders(FILE* file) {
   // And the NT headers.
   IMAGE_NT_HEADERS nt_headers = {};
   size_t pos = dos_header.e_lfanew;
-  if (!ReadAt(file, pos, &nt_headers, sizeof(nt_headers))) {
+  if (!ReadFileAt(file, pos, &nt_headers, sizeof(nt_headers))) {
     LOG(ERROR) << "Unable to read NT headers";
     return false;
   }
@@ -176,17 +276,17 @@ bool PEFile::ReadHeaders(FILE* file) {
     return false;
   }
 
-  SectionBuffer& header = it->second.buffer;
-  header.resize(header_size);
-  if (!ReadAt(file, 0, &header[0], header_size)) {
+  if (header_size == 0 ||
+      !LoadSectionData(file, 0, header_size, &it->second)) {
     LOG(ERROR) << "Unable to read header data";
     return false;
   }
 
   // TODO(siggi): Validate these pointers!
-  dos_header_ = reinterpret_cast<IMAGE_DOS_HEADER*>(&header.at(0));
-  nt_headers_ =
-      reinterpret_cast<IMAGE_NT_HEADERS*>(&header.at(dos_header_->e_lfanew));
+  const uint8* header = it->second.data;
+  dos_header_ = reinterpret_cast<const IMAGE_DOS_HEADER*>(header);
+  nt_headers_ = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+      header + dos_header_->e_lfanew);
   section_headers_ = IMAGE_FIRST_SECTION(nt_headers_);
 
   return true;
@@ -209,12 +309,11 @@ bool PEFile::ReadSections(FILE* file) {
     }
 
     it->second.id = i;
-    SectionBuffer& buf = it->second.buffer;
     if (hdr->SizeOfRawData == 0)
       continue;
 
-    buf.resize(hdr->SizeOfRawData);
-    if (!ReadAt(file, hdr->PointerToRawData, &buf.at(0), hdr->SizeOfRawData)) {
+    if (!LoadSectionData(file, hdr->PointerToRawData, hdr->SizeOfRawData,
+                         &it->second)) {
       LOG(ERROR) << "Unable to read data for section " << hdr->Name;
       return false;
     }
@@ -266,9 +365,9 @@ const uint8* PEFile::GetImageData(RelativeAddress rel, size_t len) const {
     ptrdiff_t offs = rel - it->first.start();
     DCHECK_GE(offs, 0);
 
-    const SectionBuffer& buf = it->second.buffer;
-    if (offs + len <= buf.size())
-      return &buf.at(offs);
+    const SectionInfo& info = it->second;
+    if (offs + len <= info.data_size)
+      return info.data + offs;
   }
 
   return NULL;
@@ -322,16 +421,20 @@ bool PEFile::ReadImageString(RelativeAddress rel, std::string* str) const {
   if (it != image_data_.ranges().end()) {
     ptrdiff_t offs = rel - it->first.start();
     DCHECK_GE(offs, 0);
+    const SectionInfo& info = it->second;
+    if (static_cast<size_t>(offs) >= info.data_size)
+      return false;
+
     // Stash the start position.
-    const SectionBuffer& buf = it->second.buffer;
-    const char* begin = reinterpret_cast<const char*>(&buf.at(offs));
+    const char* begin = reinterpret_cast<const char*>(info.data + offs);
     // And loop through until we find a zero-terminating byte,
     // or run off the end.
-    for (; static_cast<size_t>(offs) < buf.size() && buf.at(offs); ++offs) {
+    for (; static_cast<size_t>(offs) < info.data_size && info.data[offs];
+         ++offs) {
       // Intentionally empty.
     }
 
-    if (static_cast<size_t>(offs) == buf.size())
+    if (static_cast<size_t>(offs) == info.data_size)
       return false;
 
     str->assign(begin);
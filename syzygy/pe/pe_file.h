@@ -63,11 +63,26 @@ class PEFile {
   struct ImportDll;
   typedef std::vector<ImportDll> ImportDllVector;
 
+  // Determines how the image file is brought into memory by Init.
+  enum LoadMode {
+    // The headers and the raw data of each section are read into buffers
+    // owned by the PEFile.
+    READ_IMAGE_DATA,
+    // The image file is mapped into memory copy-on-write, and the image data
+    // is accessed in place. Pages are only read from disk when they are first
+    // touched, and no copy of unmodified data is made.
+    MAP_IMAGE_DATA,
+  };
+
   PEFile();
   ~PEFile();
 
-  // Read in the image file at path.
+  // Read in the image file at path, using READ_IMAGE_DATA.
   bool Init(const FilePath& path);
+  // Read in the image file at path, using @p load_mode. Pointers returned by
+  // GetImageData, and thus the data of blocks decomposed from this image,
+  // remain valid for the lifetime of the PEFile in either mode.
+  bool Init(const FilePath& path, LoadMode load_mode);
 
   // Populates a signature object with the signature of this PE file. This
   // is only valid if called after Init.
@@ -155,28 +170,56 @@ class PEFile {
     return NULL;
   }
 
- private:
-  bool ReadHeaders(FILE* file);
-  bool ReadSections(FILE* file);
-
-  FilePath path_;
-  const IMAGE_DOS_HEADER* dos_header_;
-  const IMAGE_NT_HEADERS* nt_headers_;
-  const IMAGE_SECTION_HEADER* section_headers_;
+  // @returns true if the image file is mapped into memory.
+  bool is_mapped() const { return view_ != NULL; }
 
+ private:
   typedef std::vector<uint8> SectionBuffer;
   struct SectionInfo {
-    SectionInfo() : id(kInvalidSection) {
+    SectionInfo() : id(kInvalidSection), data(NULL), data_size(0) {
     }
     size_t id;
+    // The raw data of the section. This points either into buffer or into
+    // the mapped image file, and may be shorter than the section itself.
+    const uint8* data;
+    size_t data_size;
+    // Owns the raw data when the image file isn't mapped.
     SectionBuffer buffer;
   };
   typedef core::AddressSpace<RelativeAddress, size_t, SectionInfo>
       ImageAddressSpace;
 
+  // Maps the image file at path_ into memory.
+  bool MapImageFile();
+  // Releases the mapping of the image file, if any.
+  void UnmapImageFile();
+
+  // Reads @p len bytes at @p pos in the image file to @p buf, from the mapped
+  // image file if there is one and from @p file otherwise.
+  bool ReadFileAt(FILE* file, size_t pos, void* buf, size_t len) const;
+  // Sets the data of @p info to the @p len bytes at @p pos in the image file.
+  // This refers to the mapped image file directly if there is one, and reads
+  // the data from @p file otherwise.
+  bool LoadSectionData(FILE* file,
+                       size_t pos,
+                       size_t len,
+                       SectionInfo* info);
+
+  bool ReadHeaders(FILE* file);
+  bool ReadSections(FILE* file);
+
+  FilePath path_;
+  const IMAGE_DOS_HEADER* dos_header_;
+  const IMAGE_NT_HEADERS* nt_headers_;
+  const IMAGE_SECTION_HEADER* section_headers_;
+
+  // The view of the image file, when it's mapped.
+  uint8* view_;
+  size_t view_size_;
+
   // Contains all data in the image. The address space has a range defined
   // for the header and each section in the image, with its associated
-  // SectionBuffer as the data.
+  // data.
   ImageAddressSpace image_data_;
 
   DISALLOW_COPY_AND_ASSIGN(PEFile);
@@ -13,6 +13,8 @@
 // limitations under the License.
 
 #include "syzygy/pe/pe_file.h"
+
+#include <algorithm>
 #include "base/file_path.h"
 #include "base/native_library.h"
 #include "base/path_service.h"
@@ -87,6 +89,54 @@ TEST_F(PEFileTest, GetImageData) {
       RelativeAddress(nt_headers->OptionalHeader.SizeOfHeaders), 1) == NULL);
 }
 
+TEST_F(PEFileTest, MappedImageMatchesReadImage) {
+  EXPECT_FALSE(image_file_.is_mapped());
+
+  PEFile mapped_file;
+  ASSERT_TRUE(mapped_file.Init(GetExeRelativePath(kDllName),
+                               PEFile::MAP_IMAGE_DATA));
+  EXPECT_TRUE(mapped_file.is_mapped());
+
+  const IMAGE_NT_HEADERS* nt_headers = mapped_file.nt_headers();
+  ASSERT_TRUE(nt_headers != NULL);
+  EXPECT_EQ(0, memcmp(image_file_.nt_headers(), nt_headers,
+                      sizeof(*nt_headers)));
+
+  // Every section should have the same data, at the same addresses.
+  for (size_t i = 0; i < nt_headers->FileHeader.NumberOfSections; ++i) {
+    const IMAGE_SECTION_HEADER* header = mapped_file.section_header(i);
+    ASSERT_TRUE(header != NULL);
+    RelativeAddress addr(header->VirtualAddress);
+    size_t size = std::min(header->SizeOfRawData,
+                           static_cast<DWORD>(header->Misc.VirtualSize));
+    if (size == 0)
+      continue;
+
+    const uint8* read_data = image_file_.GetImageData(addr, size);
+    const uint8* mapped_data = mapped_file.GetImageData(addr, size);
+    ASSERT_TRUE(read_data != NULL);
+    ASSERT_TRUE(mapped_data != NULL);
+    EXPECT_EQ(0, memcmp(read_data, mapped_data, size));
+    EXPECT_EQ(i, mapped_file.GetSectionIndex(addr, size));
+  }
+
+  // Strings are read in place.
+  const IMAGE_DATA_DIRECTORY* exports =
+      &nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+  IMAGE_EXPORT_DIRECTORY export_dir = {};
+  ASSERT_TRUE(mapped_file.ReadImage(RelativeAddress(exports->VirtualAddress),
+                                    &export_dir,
+                                    sizeof(export_dir)));
+  std::string read_name;
+  std::string mapped_name;
+  ASSERT_TRUE(image_file_.ReadImageString(RelativeAddress(export_dir.Name),
+                                          &read_name));
+  ASSERT_TRUE(mapped_file.ReadImageString(RelativeAddress(export_dir.Name),
+                                          &mapped_name));
+  EXPECT_EQ(read_name, mapped_name);
+  EXPECT_FALSE(mapped_name.empty());
+}
+
 TEST_F(PEFileTest, ReadImage) {
   const IMAGE_NT_HEADERS* nt_headers = image_file_.nt_headers();
   ASSERT_TRUE(nt_headers != NULL);
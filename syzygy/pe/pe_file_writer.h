@@ -56,8 +56,10 @@ class PEFileWriter {
                      FILE* file);
 
   // Maps from the relative offset to the start of a section to
-  // the file offset for the start of that same section.
-  typedef core::AddressSpace<RelativeAddress, size_t, FileOffsetAddress>
+  // the file offset for the start of that same section. This is built once
+  // and then consulted for every block we write, so we use the flat policy.
+  typedef core::AddressSpace<RelativeAddress, size_t, FileOffsetAddress,
+                             core::FlatRangeMapPolicy>
       SectionFileAddressSpace;
   SectionFileAddressSpace section_file_offsets_;
 
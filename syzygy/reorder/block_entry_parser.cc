@@ -0,0 +1,289 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/reorder/block_entry_parser.h"
+
+namespace reorder {
+
+BlockEntryParser::BlockEntryParser(
+    const FilePath& instrumented_path,
+    const pe::PEFile::Signature& instr_signature,
+    const BlockGraph::AddressSpace* address_space,
+    Delegate* delegate)
+    : instrumented_path_(instrumented_path),
+      instr_signature_(instr_signature),
+      delegate_(delegate),
+      num_block_entries_(0),
+      errored_(false) {
+  DCHECK(address_space != NULL);
+  DCHECK(delegate != NULL);
+
+  kernel_log_parser_.set_module_event_sink(this);
+  kernel_log_parser_.set_process_event_sink(this);
+  call_trace_parser_.set_call_trace_event_sink(this);
+  function_block_cache_.Init(address_space);
+}
+
+BlockEntryParser::~BlockEntryParser() {
+}
+
+void BlockEntryParser::ProcessEvent(EVENT_TRACE* event) {
+  DCHECK(event != NULL);
+
+  // Avoid doing needless work.
+  if (errored_)
+    return;
+
+  if (!call_trace_parser_.ProcessOneEvent(event))
+    kernel_log_parser_.ProcessOneEvent(event);
+}
+
+bool BlockEntryParser::MatchesInstrumentedModuleSignature(
+    const ModuleInformation& module_info) const {
+  // On Windows XP gathered traces, only the module size is non-zero.
+  if (module_info.image_checksum == 0 && module_info.time_date_stamp == 0) {
+    // If the size matches, then check that the names fit.
+    if (instr_signature_.module_size != module_info.module_size)
+      return false;
+
+    FilePath base_name = instrumented_path_.BaseName();
+    return (module_info.image_file_name.rfind(base_name.value()) !=
+        std::wstring::npos);
+  } else {
+    // On Vista and greater, we can check the full module signature.
+    return (instr_signature_.module_checksum == module_info.image_checksum &&
+        instr_signature_.module_size == module_info.module_size &&
+        instr_signature_.module_time_date_stamp == module_info.time_date_stamp);
+  }
+}
+
+// KernelModuleEvents implementation.
+void BlockEntryParser::OnModuleIsLoaded(DWORD process_id,
+                                        const base::Time& time,
+                                        const ModuleInformation& module_info) {
+  // Simply forward this to OnModuleLoad.
+  OnModuleLoad(process_id, time, module_info);
+}
+
+void BlockEntryParser::OnModuleUnload(DWORD process_id,
+                                      const base::Time& time,
+                                      const ModuleInformation& module_info) {
+  // Avoid doing needless work.
+  if (errored_ || module_info.module_size == 0)
+    return;
+
+  // This happens in Windows XP traces for some reason. They contain conflicing
+  // information, so we ignore them.
+  if (module_info.image_file_name.empty())
+    return;
+
+  if (last_event_time_ > time) {
+    LOG(ERROR) << "Messages out of temporal order.";
+    errored_ = true;
+    return;
+  }
+
+  ModuleSpace& module_space = processes_[process_id];
+  AbsoluteAddress64 addr(module_info.base_address);
+  ModuleSpace::Range range(addr, module_info.module_size);
+  ModuleSpace::RangeMapIter it =
+      module_space.FindFirstIntersection(range);
+  if (it == module_space.end()) {
+    // We occasionally see this, as certain modules fire off multiple Unload
+    // events, so we don't log an error. I'm looking at you, logman.exe.
+    return;
+  }
+  if (!(it->first == range)) {
+    LOG(ERROR) << "Trying to remove module with mismatching range: "
+               << module_info.image_file_name;
+    errored_ = true;
+    return;
+  }
+
+  module_space.Remove(it);
+  instrumented_module_ranges_.erase(process_id);
+  last_event_time_ = time;
+}
+
+void BlockEntryParser::OnModuleLoad(DWORD process_id,
+                                    const base::Time& time,
+                                    const ModuleInformation& module_info) {
+  // Avoid doing needless work.
+  if (errored_ || module_info.module_size == 0)
+    return;
+
+  // This happens in Windows XP traces for some reason. They contain conflicing
+  // information, so we ignore them.
+  if (module_info.image_file_name.empty())
+    return;
+
+  if (last_event_time_ > time) {
+    LOG(ERROR) << "Messages out of temporal order.";
+    errored_ = true;
+    return;
+  }
+
+  ModuleSpace& module_space = processes_[process_id];
+  AbsoluteAddress64 addr(module_info.base_address);
+  ModuleSpace::Range range(addr, module_info.module_size);
+  if (!module_space.Insert(range, module_info)) {
+    ModuleSpace::RangeMapIter it = module_space.FindFirstIntersection(range);
+    DCHECK(it != module_space.end());
+    // We actually see this behaviour on Windows XP gathered traces. Since this
+    // is one of the platforms we target, we simply print out a warning for
+    // now.
+    LOG(WARNING) << "Trying to insert conflicting module: "
+        << module_info.image_file_name;
+  }
+
+  instrumented_module_ranges_.erase(process_id);
+  last_event_time_ = time;
+}
+
+// KernelProcessEvents implementation.
+void BlockEntryParser::OnProcessIsRunning(const base::Time& time,
+                                          const ProcessInfo& process_info) {
+  // We don't care about these events.
+}
+
+void BlockEntryParser::OnProcessStarted(const base::Time& time,
+                                        const ProcessInfo& process_info) {
+  // We don't care about these events.
+}
+
+void BlockEntryParser::OnProcessEnded(const base::Time& time,
+                                      const ProcessInfo& process_info,
+                                      ULONG exit_status) {
+  uint32 process_id = process_info.process_id;
+  ProcessSet::iterator process_it = matching_process_ids_.find(process_id);
+  if (process_it == matching_process_ids_.end())
+    return;
+
+  matching_process_ids_.erase(process_it);
+
+  if (!delegate_->OnProcessEnded(process_id, time)) {
+    errored_ = true;
+    return;
+  }
+
+  return;
+}
+
+// CallTraceEvents implementation.
+void BlockEntryParser::OnTraceEntry(base::Time time,
+                                    DWORD process_id,
+                                    DWORD thread_id,
+                                    const TraceEnterExitEventData* data) {
+  // We currently don't care about TraceEntry events.
+}
+
+void BlockEntryParser::OnTraceExit(base::Time time,
+                                   DWORD process_id,
+                                   DWORD thread_id,
+                                   const TraceEnterExitEventData* data) {
+  // We currently don't care about TraceExit events.
+}
+
+void BlockEntryParser::OnTraceBatchEnter(base::Time time,
+                                         DWORD process_id,
+                                         DWORD thread_id,
+                                         const TraceBatchEnterData* data) {
+  // Avoid doing needless work.
+  if (errored_)
+    return;
+
+  // All the calls of a batch come from the same process, so we only need to
+  // find the instrumented module in the process once.
+  const ModuleRanges& module_ranges = GetInstrumentedModuleRanges(process_id);
+  if (module_ranges.empty())
+    return;
+
+  for (size_t i = 0; i < data->num_calls; ++i) {
+    AbsoluteAddress64 function_address =
+        reinterpret_cast<AbsoluteAddress64>(data->calls[i].function);
+
+    // Don't parse this event unless it belongs to the instrumented module
+    // of interest.
+    const ModuleSpace::Range* module_range = NULL;
+    for (size_t j = 0; j < module_ranges.size(); ++j) {
+      if (module_ranges[j].Contains(function_address)) {
+        module_range = &module_ranges[j];
+        break;
+      }
+    }
+    if (module_range == NULL)
+      continue;
+
+    // Get the block that this function call refers to. We can only instrument
+    // 32-bit DLLs, so we're sure that the following address conversion is safe.
+    RelativeAddress rva(
+        static_cast<uint32>(function_address - module_range->start()));
+    const BlockGraph::Block* block =
+        function_block_cache_.GetBlockByAddress(rva);
+    if (block == NULL) {
+      LOG(ERROR) << "Unable to map " << rva << " to a block.";
+      errored_ = true;
+      return;
+    }
+    if (block->type() != BlockGraph::CODE_BLOCK) {
+      LOG(ERROR) << rva << " maps to a non-code block.";
+      errored_ = true;
+      return;
+    }
+
+    // The time of the call is that of the batch. We ignore ticks_ago for
+    // now, as the low-resolution and rounding can cause inaccurate relative
+    // timings. We simply rely on the order of the calls to maintain relative
+    // ordering. For future reference, ticks_ago are in milliseconds,
+    // according to MSDN.
+    //
+    // If this is the first call of interest by a given process, send an
+    // OnProcessStarted event.
+    if (matching_process_ids_.insert(process_id).second) {
+      if (!delegate_->OnProcessStarted(process_id, time)) {
+        errored_ = true;
+        return;
+      }
+    }
+
+    ++num_block_entries_;
+    if (!delegate_->OnBlockEntry(block, rva, process_id, thread_id, time)) {
+      errored_ = true;
+      return;
+    }
+  }
+}
+
+const BlockEntryParser::ModuleRanges&
+    BlockEntryParser::GetInstrumentedModuleRanges(uint32 process_id) {
+  ModuleRangesMap::iterator ranges_it =
+      instrumented_module_ranges_.find(process_id);
+  if (ranges_it != instrumented_module_ranges_.end())
+    return ranges_it->second;
+
+  ModuleRanges& module_ranges = instrumented_module_ranges_[process_id];
+  ProcessMap::const_iterator processes_it = processes_.find(process_id);
+  if (processes_it == processes_.end())
+    return module_ranges;
+
+  const ModuleSpace& module_space(processes_it->second);
+  ModuleSpace::RangeMapConstIter module_it = module_space.begin();
+  for (; module_it != module_space.end(); ++module_it) {
+    if (MatchesInstrumentedModuleSignature(module_it->second))
+      module_ranges.push_back(module_it->first);
+  }
+
+  return module_ranges;
+}
+
+}  // namespace reorder
@@ -0,0 +1,179 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the BlockEntryParser, which follows the modules loaded in each
+// process through the kernel events of a trace, and maps the call trace
+// events of the instrumented module to entries into the blocks of the
+// original image.
+#ifndef SYZYGY_REORDER_BLOCK_ENTRY_PARSER_H_
+#define SYZYGY_REORDER_BLOCK_ENTRY_PARSER_H_
+
+#include <map>
+#include <set>
+#include <vector>
+#include "base/file_path.h"
+#include "base/time.h"
+#include "sawbuck/log_lib/kernel_log_consumer.h"
+#include "syzygy/call_trace/call_trace_parser.h"
+#include "syzygy/core/address_space.h"
+#include "syzygy/core/block_graph.h"
+#include "syzygy/pe/pe_file.h"
+#include "syzygy/reorder/function_block_cache.h"
+
+namespace reorder {
+
+typedef uint64 AbsoluteAddress64;
+typedef uint64 Size64;
+
+class BlockEntryParser
+    : public KernelModuleEvents,
+      public KernelProcessEvents,
+      public CallTraceEvents {
+ public:
+  typedef core::BlockGraph BlockGraph;
+  typedef core::RelativeAddress RelativeAddress;
+  class Delegate;
+
+  // @param instrumented_path the path to the instrumented module.
+  // @param instr_signature the signature of the instrumented module.
+  // @param address_space the address space of the original image, which
+  //     must outlive the parser.
+  // @param delegate receives the block entries, and must outlive the
+  //     parser.
+  BlockEntryParser(const FilePath& instrumented_path,
+                   const pe::PEFile::Signature& instr_signature,
+                   const BlockGraph::AddressSpace* address_space,
+                   Delegate* delegate);
+  virtual ~BlockEntryParser();
+
+  // Processes an event of a kernel or a call trace log. Events must be
+  // processed in temporal order.
+  void ProcessEvent(EVENT_TRACE* event);
+
+  // Returns true iff the parser or its delegate encountered an error, after
+  // which further events are ignored.
+  bool errored() const { return errored_; }
+
+  // Returns the number of block entries passed to the delegate.
+  size_t num_block_entries() const { return num_block_entries_; }
+
+ private:
+  typedef core::AddressSpace<AbsoluteAddress64, Size64, ModuleInformation>
+      ModuleSpace;
+  typedef std::map<uint32, ModuleSpace> ProcessMap;
+  typedef std::vector<ModuleSpace::Range> ModuleRanges;
+  typedef std::map<uint32, ModuleRanges> ModuleRangesMap;
+  typedef std::set<uint32> ProcessSet;
+  typedef KernelProcessEvents::ProcessInfo ProcessInfo;
+
+  // Returns true if the given ModuleInformation matches the instrumented
+  // module signature, false otherwise.
+  bool MatchesInstrumentedModuleSignature(
+      const ModuleInformation& module_info) const;
+
+  // Returns the address ranges the instrumented module is loaded at in the
+  // given process. These are looked up on first use, and cached until the
+  // next module load or unload in the process.
+  const ModuleRanges& GetInstrumentedModuleRanges(uint32 process_id);
+
+  // KernelModuleEvents implementation.
+  virtual void OnModuleIsLoaded(DWORD process_id,
+                                const base::Time& time,
+                                const ModuleInformation& module_info);
+  virtual void OnModuleUnload(DWORD process_id,
+                              const base::Time& time,
+                              const ModuleInformation& module_info);
+  virtual void OnModuleLoad(DWORD process_id,
+                            const base::Time& time,
+                            const ModuleInformation& module_info);
+
+  // KernelProcessEvents implementation.
+  virtual void OnProcessIsRunning(const base::Time& time,
+                                  const ProcessInfo& process_info);
+  virtual void OnProcessStarted(const base::Time& time,
+                                const ProcessInfo& process_info);
+  virtual void OnProcessEnded(const base::Time& time,
+                              const ProcessInfo& process_info,
+                              ULONG exit_status);
+
+  // CallTraceEvents implementation.
+  virtual void OnTraceEntry(base::Time time,
+                            DWORD process_id,
+                            DWORD thread_id,
+                            const TraceEnterExitEventData* data);
+  virtual void OnTraceExit(base::Time time,
+                           DWORD process_id,
+                           DWORD thread_id,
+                           const TraceEnterExitEventData* data);
+  virtual void OnTraceBatchEnter(base::Time time,
+                                 DWORD process_id,
+                                 DWORD thread_id,
+                                 const TraceBatchEnterData* data);
+
+  KernelLogParser kernel_log_parser_;
+  CallTraceParser call_trace_parser_;
+
+  FilePath instrumented_path_;
+  // Signature of the instrumented DLL. Used for filtering call-trace events.
+  pe::PEFile::Signature instr_signature_;
+  Delegate* delegate_;
+
+  // Number of block entries passed to the delegate.
+  size_t num_block_entries_;
+  // Is the parser errored?
+  bool errored_;
+  // The time of the last processed module event.
+  base::Time last_event_time_;
+  // For each process, we store its point of view of the world.
+  ProcessMap processes_;
+  // For each process, the ranges of the instrumented module, if known.
+  ModuleRangesMap instrumented_module_ranges_;
+  // The set of processes of interest. That is, those that have had code
+  // run in the instrumented module. These are the only processes for which
+  // we are interested in OnProcessEnded events.
+  ProcessSet matching_process_ids_;
+  // Maps the function addresses seen in the traces to the blocks of the
+  // original image.
+  FunctionBlockCache function_block_cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockEntryParser);
+};
+
+// Receives the block entries of the instrumented module. Each callback
+// returns true on success, or false on error, after which no further
+// callbacks are issued.
+class BlockEntryParser::Delegate {
+ public:
+  virtual ~Delegate() {}
+
+  // Issued before the first block entry of each process.
+  virtual bool OnProcessStarted(uint32 process_id,
+                                const base::Time& time) = 0;
+
+  // Issued when a process that has entered blocks ends.
+  virtual bool OnProcessEnded(uint32 process_id,
+                              const base::Time& time) = 0;
+
+  // Issued for each entry into a code block of the original image.
+  // @param address the address of the function entered.
+  virtual bool OnBlockEntry(const BlockGraph::Block* block,
+                            RelativeAddress address,
+                            uint32 process_id,
+                            uint32 thread_id,
+                            const base::Time& time) = 0;
+};
+
+}  // namespace reorder
+
+#endif  // SYZYGY_REORDER_BLOCK_ENTRY_PARSER_H_
@@ -0,0 +1,323 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/reorder/call_graph_order_generator.h"
+
+#include <algorithm>
+
+namespace reorder {
+
+namespace {
+
+// The affinity a transition between two blocks adds. A transition between
+// blocks that refer to each other is most likely a call, and counts for more
+// than two blocks that merely happened to run one after the other.
+const size_t kTransitionAffinity = 1;
+const size_t kCallAffinity = 4;
+
+// Returns true iff @p block1 refers to @p block2.
+bool RefersTo(const BlockGraph::Block* block1,
+              const BlockGraph::Block* block2) {
+  BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+      block1->references().begin();
+  for (; ref_it != block1->references().end(); ++ref_it) {
+    if (ref_it->second.referenced() == block2)
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+// Sorts edges by decreasing weight, then by the order in which their nodes
+// were added, so that the layout doesn't depend on where blocks live in
+// memory.
+struct ChainLayout::EdgeOrder {
+  bool operator()(const std::pair<size_t, Edge>& edge1,
+                  const std::pair<size_t, Edge>& edge2) const {
+    if (edge1.first != edge2.first)
+      return edge1.first > edge2.first;
+    return edge1.second < edge2.second;
+  }
+};
+
+// Sorts nodes by chain, in the order in which the chains' first blocks were
+// added, then by position within the chain.
+struct ChainLayout::NodeOrder {
+  explicit NodeOrder(const std::vector<Node>& nodes) : nodes_(nodes) {
+  }
+
+  bool operator()(size_t node1, size_t node2) const {
+    if (nodes_[node1].chain != nodes_[node2].chain)
+      return nodes_[node1].chain < nodes_[node2].chain;
+    return nodes_[node1].position < nodes_[node2].position;
+  }
+
+  const std::vector<Node>& nodes_;
+};
+
+ChainLayout::ChainLayout() : num_chains_(0) {
+}
+
+bool ChainLayout::AddBlock(const BlockGraph::Block* block) {
+  DCHECK(block != NULL);
+
+  if (!node_indices_.insert(std::make_pair(block, nodes_.size())).second)
+    return false;
+
+  Node node = { block, chains_.size(), 0 };
+  nodes_.push_back(node);
+
+  chains_.push_back(Chain());
+  Chain& chain = chains_.back();
+  chain.nodes.push_back(nodes_.size() - 1);
+  chain.start = 0;
+  chain.size = block->size();
+
+  ++num_chains_;
+  return true;
+}
+
+void ChainLayout::AddAffinity(const BlockGraph::Block* block1,
+                              const BlockGraph::Block* block2,
+                              size_t weight) {
+  std::map<const BlockGraph::Block*, size_t>::const_iterator it1 =
+      node_indices_.find(block1);
+  std::map<const BlockGraph::Block*, size_t>::const_iterator it2 =
+      node_indices_.find(block2);
+  DCHECK(it1 != node_indices_.end());
+  DCHECK(it2 != node_indices_.end());
+  if (it1->second == it2->second)
+    return;
+
+  Edge edge(std::min(it1->second, it2->second),
+            std::max(it1->second, it2->second));
+  edge_weights_[edge] += weight;
+}
+
+void ChainLayout::Layout(BlockList* blocks) {
+  DCHECK(blocks != NULL);
+
+  // Merge the chains, heaviest edges first.
+  std::vector<std::pair<size_t, Edge> > edges;
+  edges.reserve(edge_weights_.size());
+  EdgeWeightMap::const_iterator edge_it = edge_weights_.begin();
+  for (; edge_it != edge_weights_.end(); ++edge_it)
+    edges.push_back(std::make_pair(edge_it->second, edge_it->first));
+  std::sort(edges.begin(), edges.end(), EdgeOrder());
+
+  for (size_t i = 0; i < edges.size(); ++i) {
+    const Edge& edge = edges[i].second;
+    if (nodes_[edge.first].chain != nodes_[edge.second].chain)
+      MergeChains(edge.first, edge.second);
+  }
+
+  // A merged chain keeps the lowest index of the two, so sorting by chain
+  // lays the chains out in the order of their first blocks.
+  std::vector<size_t> order(nodes_.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), NodeOrder(nodes_));
+
+  for (size_t i = 0; i < order.size(); ++i)
+    blocks->push_back(nodes_[order[i]].block);
+}
+
+void ChainLayout::MergeChains(size_t node1, size_t node2) {
+  size_t chain1 = nodes_[node1].chain;
+  size_t chain2 = nodes_[node2].chain;
+  DCHECK_NE(chain1, chain2);
+
+  // Work out how far apart the starts of the two blocks would be with either
+  // chain first, and pick the closer of the two. On a tie, the chain that
+  // started running first stays first.
+  int64 offset1 = nodes_[node1].position - chains_[chain1].start;
+  int64 offset2 = nodes_[node2].position - chains_[chain2].start;
+  int64 distance_1_first = chains_[chain1].size - offset1 + offset2;
+  int64 distance_2_first = chains_[chain2].size - offset2 + offset1;
+  bool chain1_first = distance_1_first < distance_2_first ||
+      (distance_1_first == distance_2_first && chain1 < chain2);
+
+  // The merged chain keeps the lower index. We move the nodes of the
+  // smaller chain, though, which means the chain we keep may have to take
+  // on the other's index.
+  size_t kept = std::min(chain1, chain2);
+  size_t from = chain1;
+  size_t to = chain2;
+  bool before = chain1_first;
+  if (chains_[chain1].nodes.size() > chains_[chain2].nodes.size()) {
+    std::swap(from, to);
+    before = !before;
+  }
+  MoveChain(from, to, before);
+
+  if (to != kept) {
+    chains_[to].nodes.swap(chains_[kept].nodes);
+    chains_[kept].start = chains_[to].start;
+    chains_[kept].size = chains_[to].size;
+    for (size_t i = 0; i < chains_[kept].nodes.size(); ++i)
+      nodes_[chains_[kept].nodes[i]].chain = kept;
+  }
+
+  --num_chains_;
+}
+
+void ChainLayout::MoveChain(size_t from, size_t to, bool before) {
+  Chain& from_chain = chains_[from];
+  Chain& to_chain = chains_[to];
+
+  int64 new_start = to_chain.start;
+  if (before) {
+    to_chain.start -= from_chain.size;
+    new_start = to_chain.start;
+  } else {
+    new_start = to_chain.start + to_chain.size;
+  }
+
+  for (size_t i = 0; i < from_chain.nodes.size(); ++i) {
+    Node& node = nodes_[from_chain.nodes[i]];
+    node.position = new_start + (node.position - from_chain.start);
+    node.chain = to;
+    to_chain.nodes.push_back(from_chain.nodes[i]);
+  }
+  to_chain.size += from_chain.size;
+
+  from_chain.nodes.clear();
+  from_chain.size = 0;
+}
+
+struct CallGraphOrderGenerator::Transition {
+  Transition() : count(0), is_call(false) {
+  }
+
+  size_t count;
+  bool is_call;
+};
+
+CallGraphOrderGenerator::CallGraphOrderGenerator()
+    : Reorderer::OrderGenerator("Call Graph Order Generator") {
+}
+
+CallGraphOrderGenerator::~CallGraphOrderGenerator() {
+}
+
+bool CallGraphOrderGenerator::OnProcessEnded(const Reorderer& reorderer,
+                                             uint32 process_id,
+                                             const UniqueTime& time) {
+  // Forget the threads of the process, as their ids may be reused.
+  LastBlockMap::iterator begin =
+      last_blocks_.lower_bound(ThreadId(process_id, 0));
+  LastBlockMap::iterator end = begin;
+  while (end != last_blocks_.end() && end->first.first == process_id)
+    ++end;
+  last_blocks_.erase(begin, end);
+
+  return true;
+}
+
+bool CallGraphOrderGenerator::OnCodeBlockEntry(const Reorderer& reorderer,
+                                               const BlockGraph::Block* block,
+                                               RelativeAddress address,
+                                               uint32 process_id,
+                                               uint32 thread_id,
+                                               const UniqueTime& time) {
+  if (!reorderer.MustReorder(block))
+    return true;
+
+  // All code blocks should belong to a defined section.
+  DCHECK_NE(pe::kInvalidSection, block->section());
+
+  if (block_set_.insert(block).second)
+    blocks_.push_back(block);
+
+  const BlockGraph::Block*& last_block =
+      last_blocks_[ThreadId(process_id, thread_id)];
+  if (last_block != NULL && last_block != block &&
+      last_block->section() == block->section()) {
+    BlockPair blocks(std::min(last_block, block), std::max(last_block, block));
+    std::pair<TransitionMap::iterator, bool> inserted =
+        transitions_.insert(std::make_pair(blocks, Transition()));
+    Transition& transition = inserted.first->second;
+    if (inserted.second) {
+      transition.is_call = RefersTo(last_block, block) ||
+          RefersTo(block, last_block);
+    }
+    ++transition.count;
+  }
+  last_block = block;
+
+  return true;
+}
+
+bool CallGraphOrderGenerator::CalculateReordering(const Reorderer& reorderer,
+                                                  Order* order) {
+  DCHECK(order != NULL);
+
+  // Lay out the blocks of each section separately.
+  typedef std::map<size_t, ChainLayout*> SectionLayoutMap;
+  SectionLayoutMap layouts;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    ChainLayout*& layout = layouts[blocks_[i]->section()];
+    if (layout == NULL)
+      layout = new ChainLayout();
+    layout->AddBlock(blocks_[i]);
+  }
+
+  size_t num_calls = 0;
+  TransitionMap::const_iterator transition_it = transitions_.begin();
+  for (; transition_it != transitions_.end(); ++transition_it) {
+    const BlockPair& blocks = transition_it->first;
+    const Transition& transition = transition_it->second;
+    size_t affinity = transition.is_call ? kCallAffinity : kTransitionAffinity;
+    if (transition.is_call)
+      ++num_calls;
+
+    layouts[blocks.first->section()]->AddAffinity(
+        blocks.first, blocks.second, affinity * transition.count);
+  }
+
+  LOG(INFO) << "Encountered " << blocks_.size() << " blocks, and "
+      << transitions_.size() << " transitions between them, of which "
+      << num_calls << " are calls.";
+
+  // Order the code.
+  SectionLayoutMap::iterator layout_it = layouts.begin();
+  for (; layout_it != layouts.end(); ++layout_it) {
+    Order::BlockList& block_list = order->section_block_lists[layout_it->first];
+    layout_it->second->Layout(&block_list);
+    LOG(INFO) << "Laid out " << block_list.size() << " blocks of section "
+        << layout_it->first << " in " << layout_it->second->num_chains()
+        << " chains.";
+    delete layout_it->second;
+  }
+
+  // Order the data after the code that refers to it, if we were asked to.
+  if (reorderer.flags() & Reorderer::kFlagReorderData) {
+    BlockSet data_block_set;
+    for (layout_it = layouts.begin(); layout_it != layouts.end(); ++layout_it) {
+      // Copy the code blocks, as data may be inserted into the same list.
+      Order::BlockList code_blocks =
+          order->section_block_lists[layout_it->first];
+      for (size_t i = 0; i < code_blocks.size(); ++i) {
+        if (!InsertDataBlocks(kDataRecursionDepth, reorderer, code_blocks[i],
+                              &data_block_set, order)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace reorder
@@ -0,0 +1,153 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// An implementation of a Reorderer. The CallGraphOrderGenerator places code
+// blocks that run one after the other close together, in the manner of
+// Pettis and Hansen's "Profile Guided Code Positioning".
+//
+// Each time a thread enters a code block right after entering another, the
+// affinity of the two blocks grows. It grows faster if one of the blocks
+// refers to the other in the block graph, as the second block was then most
+// likely called by the first. Once the traces have been consumed, each block
+// starts out in a chain of its own, and the chains are merged greedily in
+// order of decreasing affinity, each merge putting the two blocks as close
+// together as the chains allow. The chains are then laid out in the order in
+// which their first blocks ran, so that startup code still comes first.
+//
+// If data ordering is enabled, the data blocks referred to by each code block
+// follow in the same order, as with the LinearOrderGenerator.
+
+#ifndef SYZYGY_REORDER_CALL_GRAPH_ORDER_GENERATOR_H_
+#define SYZYGY_REORDER_CALL_GRAPH_ORDER_GENERATOR_H_
+
+#include <map>
+#include <vector>
+#include "syzygy/reorder/reorderer.h"
+
+namespace reorder {
+
+// Lays out blocks by greedily merging chains of blocks, so that those with
+// the most affinity for each other end up next to each other.
+class ChainLayout {
+ public:
+  typedef std::vector<const BlockGraph::Block*> BlockList;
+
+  ChainLayout();
+
+  // Adds a block, in a chain of its own. The chains are laid out in the
+  // order in which their first blocks were added.
+  // @returns true if the block was added, false if it already was.
+  bool AddBlock(const BlockGraph::Block* block);
+
+  // Adds to the affinity of two blocks that have been added.
+  // @param weight the affinity to add.
+  void AddAffinity(const BlockGraph::Block* block1,
+                   const BlockGraph::Block* block2,
+                   size_t weight);
+
+  // Merges the chains, and appends the laid out blocks to @p blocks.
+  void Layout(BlockList* blocks);
+
+  // Returns the number of chains left after Layout.
+  size_t num_chains() const { return num_chains_; }
+
+ private:
+  struct Node {
+    const BlockGraph::Block* block;
+    // The chain the block is in.
+    size_t chain;
+    // The position of the block. Its offset in its chain is the difference
+    // between this and the start of the chain.
+    int64 position;
+  };
+
+  struct Chain {
+    // The nodes in the chain, in no particular order.
+    std::vector<size_t> nodes;
+    // The position of the start of the chain.
+    int64 start;
+    // The size of the blocks in the chain.
+    int64 size;
+  };
+
+  typedef std::pair<size_t, size_t> Edge;
+  typedef std::map<Edge, size_t> EdgeWeightMap;
+  struct EdgeOrder;
+  struct NodeOrder;
+
+  // Merges the chains of two nodes so as to bring them close together.
+  void MergeChains(size_t node1, size_t node2);
+
+  // Moves the nodes of chain @p from into chain @p to.
+  // @param before if true, the nodes go before those of @p to, otherwise
+  //     they go after them.
+  void MoveChain(size_t from, size_t to, bool before);
+
+  std::vector<Node> nodes_;
+  std::vector<Chain> chains_;
+  std::map<const BlockGraph::Block*, size_t> node_indices_;
+  EdgeWeightMap edge_weights_;
+  size_t num_chains_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChainLayout);
+};
+
+// The call graph order generator. See comment at top of this header file for
+// more details.
+class CallGraphOrderGenerator : public Reorderer::OrderGenerator {
+ public:
+  typedef Reorderer::UniqueTime UniqueTime;
+  typedef Reorderer::Order Order;
+
+  CallGraphOrderGenerator();
+  virtual ~CallGraphOrderGenerator();
+
+  // OrderGenerator implementation.
+  virtual bool OnProcessEnded(const Reorderer& reorderer,
+                              uint32 process_id,
+                              const UniqueTime& time);
+  virtual bool OnCodeBlockEntry(const Reorderer& reorderer,
+                                const BlockGraph::Block* block,
+                                RelativeAddress address,
+                                uint32 process_id,
+                                uint32 thread_id,
+                                const UniqueTime& time);
+  virtual bool CalculateReordering(const Reorderer& reorderer,
+                                   Order* order);
+
+ private:
+  typedef std::pair<uint32, uint32> ThreadId;
+  typedef std::map<ThreadId, const BlockGraph::Block*> LastBlockMap;
+  typedef std::pair<const BlockGraph::Block*, const BlockGraph::Block*>
+      BlockPair;
+  struct Transition;
+  typedef std::map<BlockPair, Transition> TransitionMap;
+
+  // The blocks that have been entered, in the order they were first entered.
+  std::vector<const BlockGraph::Block*> blocks_;
+  BlockSet block_set_;
+
+  // The last block each thread entered.
+  LastBlockMap last_blocks_;
+
+  // The transitions seen between pairs of blocks, keyed on the blocks in
+  // increasing order of address.
+  TransitionMap transitions_;
+
+  DISALLOW_COPY_AND_ASSIGN(CallGraphOrderGenerator);
+};
+
+}  // namespace reorder
+
+#endif  // SYZYGY_REORDER_CALL_GRAPH_ORDER_GENERATOR_H_
@@ -0,0 +1,382 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/call_graph_order_generator.h"
+
+#include "gtest/gtest.h"
+
+namespace reorder {
+
+namespace {
+
+typedef Reorderer::Order Order;
+typedef Reorderer::UniqueTime UniqueTime;
+
+// The sections of the test image. Blocks 0 to 5 are code in the first
+// section, 6 and 7 code in the second, and 8 and 9 data in the third.
+const size_t kCodeSection = 0;
+const size_t kOtherCodeSection = 1;
+const size_t kDataSection = 2;
+const size_t kNumSections = 3;
+const size_t kNumCodeBlocks = 6;
+const size_t kNumOtherCodeBlocks = 2;
+const size_t kNumDataBlocks = 2;
+
+// A reorderer that drives order generators over an image without parsing
+// any traces.
+class TestReorderer : public Reorderer {
+ public:
+  TestReorderer(const DecomposedImage& image,
+                const OrderGenerator& order_generator,
+                Flags flags)
+      : Reorderer(FilePath(), FilePath(), std::vector<FilePath>(), flags) {
+    InitSectionReorderabilityCache(image, order_generator);
+  }
+};
+
+// The headers of the test image.
+struct ImageHeaders {
+  IMAGE_NT_HEADERS nt_headers;
+  IMAGE_SECTION_HEADER sections[kNumSections];
+};
+
+class ChainLayoutTest : public testing::Test {
+ public:
+  // Adds @p num_blocks code blocks of @p block_size bytes to the image, and
+  // to @p layout.
+  void AddBlocks(size_t num_blocks, size_t block_size, ChainLayout* layout) {
+    for (size_t i = 0; i < num_blocks; ++i) {
+      BlockGraph::Block* block =
+          image_.AddBlock(BlockGraph::CODE_BLOCK, block_size, "block");
+      ASSERT_TRUE(block != NULL);
+      blocks_.push_back(block);
+      ASSERT_TRUE(layout->AddBlock(block));
+    }
+  }
+
+ protected:
+  BlockGraph image_;
+  ChainLayout::BlockList blocks_;
+};
+
+class CallGraphOrderGeneratorTest : public testing::Test {
+ public:
+  CallGraphOrderGeneratorTest() : time_(base::Time::Now()) {
+  }
+
+  virtual void SetUp() {
+    ImageHeaders headers;
+    memset(&headers, 0, sizeof(headers));
+    headers.nt_headers.FileHeader.NumberOfSections = kNumSections;
+    headers.sections[kCodeSection].Characteristics = IMAGE_SCN_CNT_CODE;
+    headers.sections[kOtherCodeSection].Characteristics = IMAGE_SCN_CNT_CODE;
+    memcpy(headers.sections[kDataSection].Name, ".data", 5);
+    headers.sections[kDataSection].Characteristics =
+        IMAGE_SCN_CNT_INITIALIZED_DATA;
+    image_.header.nt_headers = image_.image.AddBlock(BlockGraph::DATA_BLOCK,
+                                                     sizeof(headers),
+                                                     "nt_headers");
+    ASSERT_TRUE(image_.header.nt_headers != NULL);
+    image_.header.nt_headers->CopyData(sizeof(headers), &headers);
+
+    ASSERT_NO_FATAL_FAILURE(
+        AddBlocks(BlockGraph::CODE_BLOCK, kCodeSection, kNumCodeBlocks));
+    ASSERT_NO_FATAL_FAILURE(AddBlocks(BlockGraph::CODE_BLOCK,
+                                      kOtherCodeSection,
+                                      kNumOtherCodeBlocks));
+    ASSERT_NO_FATAL_FAILURE(
+        AddBlocks(BlockGraph::DATA_BLOCK, kDataSection, kNumDataBlocks));
+
+    InitReorderer(Reorderer::kFlagReorderCode);
+  }
+
+  virtual void TearDown() {
+    reorderer_.reset();
+  }
+
+  // Replaces the reorderer by one with @p flags. There may only be one
+  // reorderer at a time.
+  void InitReorderer(Reorderer::Flags flags) {
+    reorderer_.reset();
+    reorderer_.reset(
+        new TestReorderer(image_, CallGraphOrderGenerator(), flags));
+  }
+
+  // Makes block @p from refer to block @p to.
+  void AddReference(size_t from, size_t to) {
+    ASSERT_TRUE(blocks_[from]->SetReference(0,
+        BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, blocks_[to], 0)));
+  }
+
+  // Has thread @p thread_id of process @p process_id enter the blocks whose
+  // indices are the digits of @p calls, in order.
+  void EnterBlocks(uint32 process_id,
+                   uint32 thread_id,
+                   const char* calls,
+                   CallGraphOrderGenerator* generator) {
+    for (; *calls != '\0'; ++calls) {
+      size_t index = *calls - '0';
+      ASSERT_LT(index, blocks_.size());
+      ASSERT_TRUE(generator->OnCodeBlockEntry(*reorderer_,
+                                              blocks_[index],
+                                              blocks_[index]->addr(),
+                                              process_id,
+                                              thread_id,
+                                              NextTime()));
+    }
+  }
+
+  void EndProcess(uint32 process_id, CallGraphOrderGenerator* generator) {
+    ASSERT_TRUE(generator->OnProcessEnded(*reorderer_, process_id,
+                                          NextTime()));
+  }
+
+  // Calculates the ordering of @p generator, and returns the indices of the
+  // blocks ordered in each section as a string of digits.
+  bool CalculateOrder(CallGraphOrderGenerator* generator,
+                      std::map<size_t, std::string>* orders) {
+    Order reordering(pe_, image_);
+    if (!generator->CalculateReordering(*reorderer_, &reordering))
+      return false;
+
+    orders->clear();
+    std::map<size_t, Order::BlockList>::const_iterator it =
+        reordering.section_block_lists.begin();
+    for (; it != reordering.section_block_lists.end(); ++it) {
+      std::string& order = (*orders)[it->first];
+      for (size_t i = 0; i < it->second.size(); ++i)
+        order.push_back('0' + it->second[i]->id() - blocks_[0]->id());
+    }
+    return true;
+  }
+
+  // Returns the order of the first code section.
+  std::string CalculateCodeOrder(CallGraphOrderGenerator* generator) {
+    std::map<size_t, std::string> orders;
+    if (!CalculateOrder(generator, &orders))
+      return "error";
+    return orders[kCodeSection];
+  }
+
+ protected:
+  void AddBlocks(BlockGraph::BlockType type, size_t section,
+                 size_t num_blocks) {
+    for (size_t i = 0; i < num_blocks; ++i) {
+      BlockGraph::Block* block = image_.image.AddBlock(type, 16, "block");
+      ASSERT_TRUE(block != NULL);
+      block->set_section(section);
+      blocks_.push_back(block);
+    }
+  }
+
+  UniqueTime NextTime() {
+    time_ += base::TimeDelta::FromMilliseconds(1);
+    return UniqueTime(time_);
+  }
+
+  base::Time time_;
+  PEFile pe_;
+  Reorderer::DecomposedImage image_;
+  std::vector<BlockGraph::Block*> blocks_;
+  scoped_ptr<TestReorderer> reorderer_;
+};
+
+}  // namespace
+
+TEST_F(ChainLayoutTest, NoAffinityKeepsOrder) {
+  ChainLayout layout;
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(5, 16, &layout));
+  EXPECT_FALSE(layout.AddBlock(blocks_[2]));
+
+  ChainLayout::BlockList laid_out;
+  layout.Layout(&laid_out);
+  EXPECT_EQ(5U, layout.num_chains());
+  EXPECT_TRUE(laid_out == blocks_);
+}
+
+TEST_F(ChainLayoutTest, AffinityPullsBlocksTogether) {
+  ChainLayout layout;
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(5, 16, &layout));
+
+  // Block 0 calls block 4 a lot, and block 1 now and then.
+  layout.AddAffinity(blocks_[0], blocks_[4], 10);
+  layout.AddAffinity(blocks_[1], blocks_[0], 1);
+
+  ChainLayout::BlockList laid_out;
+  layout.Layout(&laid_out);
+  EXPECT_EQ(3U, layout.num_chains());
+
+  ASSERT_EQ(5U, laid_out.size());
+  EXPECT_EQ(blocks_[1], laid_out[0]);
+  EXPECT_EQ(blocks_[0], laid_out[1]);
+  EXPECT_EQ(blocks_[4], laid_out[2]);
+  EXPECT_EQ(blocks_[2], laid_out[3]);
+  EXPECT_EQ(blocks_[3], laid_out[4]);
+}
+
+TEST_F(ChainLayoutTest, MergesOnTheCloserSide) {
+  ChainLayout layout;
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(4, 16, &layout));
+
+  // Build the chains 0-1 and 2-3, then join them through blocks 0 and 3. The
+  // two blocks are closest with the second chain first.
+  layout.AddAffinity(blocks_[0], blocks_[1], 10);
+  layout.AddAffinity(blocks_[2], blocks_[3], 10);
+  layout.AddAffinity(blocks_[3], blocks_[0], 5);
+
+  ChainLayout::BlockList laid_out;
+  layout.Layout(&laid_out);
+  EXPECT_EQ(1U, layout.num_chains());
+
+  ASSERT_EQ(4U, laid_out.size());
+  EXPECT_EQ(blocks_[2], laid_out[0]);
+  EXPECT_EQ(blocks_[3], laid_out[1]);
+  EXPECT_EQ(blocks_[0], laid_out[2]);
+  EXPECT_EQ(blocks_[1], laid_out[3]);
+}
+
+TEST_F(ChainLayoutTest, AffinityAccumulates) {
+  ChainLayout layout;
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(3, 16, &layout));
+
+  // Two light edges outweigh a single heavier one.
+  layout.AddAffinity(blocks_[0], blocks_[1], 3);
+  layout.AddAffinity(blocks_[2], blocks_[0], 2);
+  layout.AddAffinity(blocks_[0], blocks_[2], 2);
+  layout.AddAffinity(blocks_[1], blocks_[2], 1);
+
+  ChainLayout::BlockList laid_out;
+  layout.Layout(&laid_out);
+  EXPECT_EQ(1U, layout.num_chains());
+
+  // 0 and 2 are merged first, then 1 goes next to 0.
+  ASSERT_EQ(3U, laid_out.size());
+  EXPECT_EQ(blocks_[1], laid_out[0]);
+  EXPECT_EQ(blocks_[0], laid_out[1]);
+  EXPECT_EQ(blocks_[2], laid_out[2]);
+}
+
+TEST_F(CallGraphOrderGeneratorTest, FollowsEachThreadSeparately) {
+  // Two threads of one process, and a thread of another process with the
+  // same id, take turns. Only the blocks entered by the same thread one after
+  // the other are drawn together.
+  CallGraphOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "0", &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 2, "2", &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(2, 1, "4", &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "1", &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 2, "3", &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(2, 1, "5", &generator));
+
+  EXPECT_EQ("012345", CalculateCodeOrder(&generator));
+}
+
+TEST_F(CallGraphOrderGeneratorTest, CallsOutweighTransitions) {
+  // Block 0 runs next to block 1 twice, and next to block 2 once. The
+  // heavier pair is merged first, and block 2 then goes on the near side of
+  // block 0, which is in front of it.
+  {
+    CallGraphOrderGenerator generator;
+    ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "0102", &generator));
+    EXPECT_EQ("201", CalculateCodeOrder(&generator));
+  }
+
+  // Once block 0 refers to block 2, the one transition between them counts
+  // as a call, which outweighs the other two.
+  ASSERT_NO_FATAL_FAILURE(AddReference(0, 2));
+  {
+    CallGraphOrderGenerator generator;
+    ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "0102", &generator));
+    EXPECT_EQ("102", CalculateCodeOrder(&generator));
+  }
+}
+
+TEST_F(CallGraphOrderGeneratorTest, LaysOutSectionsSeparately) {
+  // The thread hops between the sections. Each section is laid out on its
+  // own, and the hops don't tie the blocks of one section to the other.
+  CallGraphOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "06172", &generator));
+
+  std::map<size_t, std::string> orders;
+  ASSERT_TRUE(CalculateOrder(&generator, &orders));
+  EXPECT_EQ(2U, orders.size());
+  EXPECT_EQ("012", orders[kCodeSection]);
+  EXPECT_EQ("67", orders[kOtherCodeSection]);
+}
+
+TEST_F(CallGraphOrderGeneratorTest, ForgetsThreadsOfEndedProcesses) {
+  // Process 1 ends, and its id and thread id are reused. The new thread's
+  // first block is not drawn to the last block of the old one, so the
+  // blocks stay in the order they first ran.
+  CallGraphOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "0", &generator));
+  ASSERT_NO_FATAL_FAILURE(EndProcess(1, &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(2, 1, "1", &generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "2", &generator));
+
+  EXPECT_EQ("012", CalculateCodeOrder(&generator));
+
+  // Had process 1 still been running, block 2 would have followed block 0.
+  CallGraphOrderGenerator running_generator;
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "0", &running_generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(2, 1, "1", &running_generator));
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "2", &running_generator));
+
+  EXPECT_EQ("021", CalculateCodeOrder(&running_generator));
+}
+
+TEST_F(CallGraphOrderGeneratorTest, InsertsDataAfterCode) {
+  // Block 0 refers to data block 9, and block 1 to data block 8, which
+  // also refers to data block 9.
+  ASSERT_NO_FATAL_FAILURE(AddReference(0, 9));
+  ASSERT_NO_FATAL_FAILURE(AddReference(1, 8));
+  ASSERT_NO_FATAL_FAILURE(AddReference(8, 9));
+
+  // Without data ordering, only the code is ordered.
+  {
+    CallGraphOrderGenerator generator;
+    ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "01", &generator));
+    std::map<size_t, std::string> orders;
+    ASSERT_TRUE(CalculateOrder(&generator, &orders));
+    EXPECT_EQ(1U, orders.size());
+    EXPECT_EQ("01", orders[kCodeSection]);
+  }
+
+  // With it, the data follows the order of the code that refers to it, and
+  // each data block is placed once.
+  InitReorderer(Reorderer::kFlagReorderCode | Reorderer::kFlagReorderData);
+  {
+    CallGraphOrderGenerator generator;
+    ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "01", &generator));
+    std::map<size_t, std::string> orders;
+    ASSERT_TRUE(CalculateOrder(&generator, &orders));
+    EXPECT_EQ(2U, orders.size());
+    EXPECT_EQ("01", orders[kCodeSection]);
+    EXPECT_EQ("98", orders[kDataSection]);
+  }
+}
+
+TEST_F(CallGraphOrderGeneratorTest, IgnoresSectionsNotReordered) {
+  // Without code ordering, no section is reordered, and the entries are
+  // ignored altogether.
+  InitReorderer(0);
+  CallGraphOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(EnterBlocks(1, 1, "0167", &generator));
+
+  std::map<size_t, std::string> orders;
+  ASSERT_TRUE(CalculateOrder(&generator, &orders));
+  EXPECT_TRUE(orders.empty());
+}
+
+}  // namespace reorder
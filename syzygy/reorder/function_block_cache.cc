@@ -0,0 +1,83 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/reorder/function_block_cache.h"
+
+namespace reorder {
+
+namespace {
+
+// The log2 of the initial size of the table, which holds a typical trace's
+// worth of functions without growing.
+const size_t kInitialTableBits = 13;
+
+}  // namespace
+
+FunctionBlockCache::FunctionBlockCache()
+    : address_space_(NULL), size_(0), table_bits_(0) {
+  Clear();
+}
+
+void FunctionBlockCache::Init(const BlockGraph::AddressSpace* address_space) {
+  DCHECK(address_space != NULL);
+  address_space_ = address_space;
+  Clear();
+}
+
+void FunctionBlockCache::Clear() {
+  Entry empty = { kEmptyKey, NULL };
+  table_bits_ = kInitialTableBits;
+  entries_.assign(1 << table_bits_, empty);
+  size_ = 0;
+}
+
+const core::BlockGraph::Block* FunctionBlockCache::Insert(
+    RelativeAddress address) {
+  const BlockGraph::Block* block = address_space_->GetBlockByAddress(address);
+
+  if (2 * (size_ + 1) > entries_.size())
+    Grow();
+
+  size_t mask = entries_.size() - 1;
+  size_t i = Hash(address.value());
+  while (entries_[i].key != kEmptyKey)
+    i = (i + 1) & mask;
+
+  entries_[i].key = address.value();
+  entries_[i].block = block;
+  ++size_;
+
+  return block;
+}
+
+void FunctionBlockCache::Grow() {
+  std::vector<Entry> old_entries;
+  old_entries.swap(entries_);
+
+  Entry empty = { kEmptyKey, NULL };
+  ++table_bits_;
+  entries_.assign(1 << table_bits_, empty);
+
+  size_t mask = entries_.size() - 1;
+  for (size_t j = 0; j < old_entries.size(); ++j) {
+    if (old_entries[j].key == kEmptyKey)
+      continue;
+
+    size_t i = Hash(old_entries[j].key);
+    while (entries_[i].key != kEmptyKey)
+      i = (i + 1) & mask;
+    entries_[i] = old_entries[j];
+  }
+}
+
+}  // namespace reorder
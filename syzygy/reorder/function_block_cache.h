@@ -0,0 +1,104 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the FunctionBlockCache, which memoizes the translation of function
+// addresses to the blocks that contain them. A call trace holds the same few
+// thousand functions millions of times over, so most lookups hit the cache
+// rather than walking the image's address space.
+#ifndef SYZYGY_REORDER_FUNCTION_BLOCK_CACHE_H_
+#define SYZYGY_REORDER_FUNCTION_BLOCK_CACHE_H_
+
+#include <vector>
+#include "base/logging.h"
+#include "syzygy/core/block_graph.h"
+
+namespace reorder {
+
+class FunctionBlockCache {
+ public:
+  typedef core::BlockGraph BlockGraph;
+  typedef core::RelativeAddress RelativeAddress;
+
+  FunctionBlockCache();
+
+  // Sets the address space the blocks are looked up in, and empties the
+  // cache.
+  // @param address_space the address space, which must outlive the cache or
+  //     the next call to Init.
+  void Init(const BlockGraph::AddressSpace* address_space);
+
+  // Empties the cache. The cache must be emptied whenever blocks are added
+  // to or removed from the address space.
+  void Clear();
+
+  // Returns the block containing @p address, or NULL if there's no such
+  // block.
+  const BlockGraph::Block* GetBlockByAddress(RelativeAddress address) {
+    DCHECK(address_space_ != NULL);
+    DCHECK(address.value() != kEmptyKey);
+
+    size_t mask = entries_.size() - 1;
+    for (size_t i = Hash(address.value()); ; i = (i + 1) & mask) {
+      const Entry& entry = entries_[i];
+      if (entry.key == address.value())
+        return entry.block;
+      if (entry.key == kEmptyKey)
+        return Insert(address);
+    }
+  }
+
+  // Returns the number of distinct addresses cached.
+  size_t size() const { return size_; }
+
+ private:
+  struct Entry {
+    uint32 key;
+    const BlockGraph::Block* block;
+  };
+
+  // Marks unused entries. No function can live at this address.
+  static const uint32 kEmptyKey = 0xFFFFFFFF;
+
+  // Returns the index of the slot @p key hashes to.
+  size_t Hash(uint32 key) const {
+    // Fibonacci hashing, which spreads the closely packed addresses of a
+    // module over the table. The index is taken from the top bits of the
+    // product, which depend on all the bits of the key.
+    DCHECK_LT(0U, table_bits_);
+    DCHECK_GT(32U, table_bits_);
+    return static_cast<uint32>(key * 0x9E3779B1U) >> (32 - table_bits_);
+  }
+
+  // Looks up @p address in the address space, and caches the result.
+  const BlockGraph::Block* Insert(RelativeAddress address);
+
+  // Doubles the size of the table, rehashing its entries.
+  void Grow();
+
+  const BlockGraph::AddressSpace* address_space_;
+
+  // The table, whose size is a power of two. We probe linearly, and keep it
+  // at most half full.
+  std::vector<Entry> entries_;
+  size_t size_;
+
+  // The log2 of the size of the table.
+  size_t table_bits_;
+
+  DISALLOW_COPY_AND_ASSIGN(FunctionBlockCache);
+};
+
+}  // namespace reorder
+
+#endif  // SYZYGY_REORDER_FUNCTION_BLOCK_CACHE_H_
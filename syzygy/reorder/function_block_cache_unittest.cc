@@ -0,0 +1,170 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/function_block_cache.h"
+
+#include <vector>
+#include "base/logging.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+
+namespace reorder {
+
+namespace {
+
+using core::BlockGraph;
+using core::RelativeAddress;
+
+const RelativeAddress kCodeStart(0x1000);
+
+class FunctionBlockCacheTest : public testing::Test {
+ public:
+  FunctionBlockCacheTest() : address_space_(&image_) {
+  }
+
+  // Adds @p num_functions code blocks of @p function_size bytes, leaving a
+  // gap of the same size after each of them.
+  void AddFunctions(size_t num_functions, size_t function_size) {
+    for (size_t i = 0; i < num_functions; ++i) {
+      RelativeAddress addr(kCodeStart + 2 * i * function_size);
+      ASSERT_TRUE(address_space_.AddBlock(BlockGraph::CODE_BLOCK, addr,
+                                          function_size, "function") != NULL);
+    }
+  }
+
+ protected:
+  BlockGraph image_;
+  BlockGraph::AddressSpace address_space_;
+};
+
+}  // namespace
+
+TEST_F(FunctionBlockCacheTest, MatchesAddressSpace) {
+  const size_t kNumFunctions = 100;
+  const size_t kFunctionSize = 16;
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(kNumFunctions, kFunctionSize));
+
+  FunctionBlockCache cache;
+  cache.Init(&address_space_);
+  EXPECT_EQ(0U, cache.size());
+
+  // Look up every address twice, so that the second lookup hits the cache.
+  // This covers the gaps between the blocks too.
+  size_t num_addresses = 2 * kNumFunctions * kFunctionSize + 1;
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < num_addresses; ++i) {
+      RelativeAddress addr(kCodeStart + i - 1);
+      EXPECT_EQ(address_space_.GetBlockByAddress(addr),
+                cache.GetBlockByAddress(addr));
+    }
+    EXPECT_EQ(num_addresses, cache.size());
+  }
+}
+
+TEST_F(FunctionBlockCacheTest, Grows) {
+  // More addresses than fit in the initial table.
+  const size_t kNumFunctions = 50000;
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(kNumFunctions, 4));
+
+  FunctionBlockCache cache;
+  cache.Init(&address_space_);
+  for (size_t i = 0; i < kNumFunctions; ++i) {
+    RelativeAddress addr(kCodeStart + 8 * i);
+    const BlockGraph::Block* block = cache.GetBlockByAddress(addr);
+    ASSERT_TRUE(block != NULL);
+    EXPECT_EQ(addr, block->addr());
+  }
+  EXPECT_EQ(kNumFunctions, cache.size());
+
+  // All the entries survived the growth.
+  for (size_t i = 0; i < kNumFunctions; ++i) {
+    RelativeAddress addr(kCodeStart + 8 * i);
+    EXPECT_EQ(address_space_.GetBlockByAddress(addr),
+              cache.GetBlockByAddress(addr));
+  }
+  EXPECT_EQ(kNumFunctions, cache.size());
+}
+
+TEST_F(FunctionBlockCacheTest, Clear) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(1, 16));
+
+  FunctionBlockCache cache;
+  cache.Init(&address_space_);
+  EXPECT_TRUE(cache.GetBlockByAddress(kCodeStart + 16) == NULL);
+  EXPECT_EQ(1U, cache.size());
+
+  // A block added after the address was looked up is only seen once the
+  // cache is cleared.
+  ASSERT_TRUE(address_space_.AddBlock(BlockGraph::CODE_BLOCK, kCodeStart + 16,
+                                      16, "late") != NULL);
+  EXPECT_TRUE(cache.GetBlockByAddress(kCodeStart + 16) == NULL);
+  cache.Clear();
+  EXPECT_EQ(0U, cache.size());
+  EXPECT_TRUE(cache.GetBlockByAddress(kCodeStart + 16) != NULL);
+}
+
+// Maps a hundred million function addresses to blocks, through the address
+// space and then through the cache. Only the lookups are timed here;
+// TraceEventListTest.DISABLED_BatchEntryBenchmark times the whole batch path
+// of the BlockEntryParser, which the cache is part of. Disabled by default.
+TEST_F(FunctionBlockCacheTest, DISABLED_TranslationBenchmark) {
+  const size_t kNumFunctions = 4000;
+  const size_t kFunctionSize = 64;
+  const size_t kNumCalls = 100000000;
+  const size_t kBatchSize = 4096;
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(kNumFunctions, kFunctionSize));
+
+  // Build a batch of calls to random functions, skewed towards the first
+  // few, which is then replayed over and over.
+  std::vector<RelativeAddress> batch;
+  uint32 seed = 1;
+  for (size_t i = 0; i < kBatchSize; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t function = (seed >> 8) % kNumFunctions;
+    function = function * function / kNumFunctions;
+    batch.push_back(kCodeStart + 2 * function * kFunctionSize);
+  }
+
+  size_t uncached_found = 0;
+  base::Time start = base::Time::Now();
+  for (size_t i = 0; i < kNumCalls; ++i) {
+    if (address_space_.GetBlockByAddress(batch[i % kBatchSize]) != NULL)
+      ++uncached_found;
+  }
+  base::TimeDelta uncached_time = base::Time::Now() - start;
+
+  FunctionBlockCache cache;
+  cache.Init(&address_space_);
+  size_t cached_found = 0;
+  start = base::Time::Now();
+  for (size_t i = 0; i < kNumCalls; ++i) {
+    if (cache.GetBlockByAddress(batch[i % kBatchSize]) != NULL)
+      ++cached_found;
+  }
+  base::TimeDelta cached_time = base::Time::Now() - start;
+
+  EXPECT_EQ(kNumCalls, uncached_found);
+  EXPECT_EQ(kNumCalls, cached_found);
+
+  LOG(INFO) << kNumCalls << " calls to " << kNumFunctions << " functions.";
+  LOG(INFO) << "Address space: " << uncached_time.InMilliseconds() << " ms, "
+            << static_cast<int64>(kNumCalls / uncached_time.InSecondsF())
+            << " calls/s.";
+  LOG(INFO) << "FunctionBlockCache: " << cached_time.InMilliseconds()
+            << " ms, "
+            << static_cast<int64>(kNumCalls / cached_time.InSecondsF())
+            << " calls/s.";
+}
+
+}  // namespace reorder
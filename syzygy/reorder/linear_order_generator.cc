@@ -19,13 +19,15 @@ namespace reorder {
 
 namespace {
 
-// This is effectively arbitrarily chosen for now. Higher is better from
-// benchmarked reorderings. This value is effectively 'infinite' as far as the
-// chrome data goes.
-const size_t kDataRecursionDepth = 100;
-
 typedef LinearOrderGenerator::BlockCall BlockCall;
 
+// Marks blocks that haven't been called in the current process group.
+const size_t kNoCall = static_cast<size_t>(-1);
+
+// The version of the saved statistics. This must be incremented whenever
+// their format changes.
+const uint32 kStatisticsVersion = 2;
+
 // Comparator for sorting BlockCalls by increasing time.
 struct BlockCallSortIncrTime {
   bool operator()(const BlockCall& bc1, const BlockCall& bc2) {
@@ -36,12 +38,14 @@ struct BlockCallSortIncrTime {
 // Used for aggregating block call information across multiple runs.
 struct AverageBlockCall {
   const BlockGraph::Block* block;
-  size_t sum_order;
+  uint64 sum_order;
   // The number of runs of the instrumented binary in which this block was
   // seen, NOT the number of times it was seen called in aggregate.
   size_t call_count;
   // This is only meaningful if call_count == 1.
   uint32_t process_group_id;
+  // The number of times the block was called, in all runs.
+  uint64 touch_count;
 
   double AverageOrder() const {
     DCHECK(call_count > 0);
@@ -52,36 +56,38 @@ struct AverageBlockCall {
 // Sorts by decreasing call count. Anything with more than one call count
 // is sorted with a secondary key of increasing order. Anything with a single
 // call count has a secondary key of process_group_id, and a tertiary key of
-// increasing order.
+// increasing order. Blocks of the same order are sorted by decreasing touch
+// count, then by id, so that the ordering is the same from one run to the
+// next.
 struct AverageBlockCallSort {
   bool operator()(const AverageBlockCall& abc1, const AverageBlockCall& abc2) {
     if (abc1.call_count != abc2.call_count)
       return abc1.call_count > abc2.call_count;
 
-    if (abc1.call_count > 1 || abc1.process_group_id == abc2.process_group_id)
-      return abc1.AverageOrder() < abc2.AverageOrder();
+    if (abc1.call_count == 1 &&
+        abc1.process_group_id != abc2.process_group_id) {
+      return abc1.process_group_id < abc2.process_group_id;
+    }
 
-    return abc1.process_group_id < abc2.process_group_id;
-  }
-};
+    double order1 = abc1.AverageOrder();
+    double order2 = abc2.AverageOrder();
+    if (order1 != order2)
+      return order1 < order2;
 
-// Extract the values of a map to a vector.
-template<typename K, typename V> void MapToVector(const std::map<K, V> map,
-                                                  std::vector<V>* vector) {
-  DCHECK(vector != NULL);
+    if (abc1.touch_count != abc2.touch_count)
+      return abc1.touch_count > abc2.touch_count;
 
-  vector->clear();
-  std::map<K, V>::const_iterator it = map.begin();
-  for (; it != map.end(); ++it)
-    vector->push_back(it->second);
-}
+    return abc1.block->id() < abc2.block->id();
+  }
+};
 
 }  // namespace
 
 LinearOrderGenerator::LinearOrderGenerator()
     : Reorderer::OrderGenerator("Linear Order Generator"),
       active_process_count_(0),
-      next_process_group_id_(0) {
+      next_process_group_id_(0),
+      num_image_blocks_(0) {
 }
 
 LinearOrderGenerator::~LinearOrderGenerator() {
@@ -128,28 +134,41 @@ bool LinearOrderGenerator::CalculateReordering(const Reorderer& reorderer,
   if (!CloseProcessGroup())
     return false;
 
-  LOG(INFO) << "Encountered " << process_group_calls_.size()
+  LOG(INFO) << "Encountered " << next_process_group_id_
       << " process groups.";
 
-  // Aggregate the block calls.
-  std::map<const BlockGraph::Block*, AverageBlockCall> average_block_call_map;
-  ProcessGroupBlockCalls::const_iterator it = process_group_calls_.begin();
-  for (; it != process_group_calls_.end(); ++it) {
-    for (size_t i = 0; i < it->second.size(); ++i) {
-      const BlockCall& block_call = it->second[i];
-      AverageBlockCall& average_block_call =
-          average_block_call_map[block_call.block];
-      average_block_call.block = block_call.block;
-      average_block_call.sum_order += i;
-      ++average_block_call.call_count;
-      average_block_call.process_group_id = it->first;
+  // Make sure that merged statistics were gathered for this image.
+  BlockGraph& image = order->image.image;
+  if (num_image_blocks_ != 0 &&
+      (num_image_blocks_ != image.blocks().size() ||
+       !image_signature_.IsConsistent(reorderer.module_signature()))) {
+    LOG(ERROR) << "Statistics were gathered for a different image.";
+    return false;
+  }
+  num_image_blocks_ = image.blocks().size();
+  image_signature_ = reorderer.module_signature();
+
+  // Gather the blocks that were called.
+  std::vector<AverageBlockCall> average_block_calls;
+  for (size_t id = 0; id < block_statistics_.size(); ++id) {
+    const BlockStatistics& block_statistics = block_statistics_[id];
+    if (block_statistics.group_count == 0)
+      continue;
+
+    AverageBlockCall average_block_call;
+    average_block_call.block = image.GetBlockById(id);
+    if (average_block_call.block == NULL) {
+      LOG(ERROR) << "Statistics refer to nonexistent block " << id << ".";
+      return false;
     }
+    average_block_call.sum_order = block_statistics.sum_order;
+    average_block_call.call_count = block_statistics.group_count;
+    average_block_call.process_group_id = block_statistics.process_group_id;
+    average_block_call.touch_count = block_statistics.touch_count;
+    average_block_calls.push_back(average_block_call);
   }
 
   // Now create a sorted list.
-  std::vector<AverageBlockCall> average_block_calls;
-  MapToVector(average_block_call_map, &average_block_calls);
-  average_block_call_map.clear();
   std::sort(average_block_calls.begin(), average_block_calls.end(),
             AverageBlockCallSort());
 
@@ -166,10 +185,74 @@ bool LinearOrderGenerator::CalculateReordering(const Reorderer& reorderer,
 
     // Create an anologous data ordering if we were asked to.
     if (reorderer.flags() & Reorderer::kFlagReorderData) {
-      if (!InsertDataBlocks(kDataRecursionDepth, reorderer, code_block, order))
+      if (!InsertDataBlocks(kDataRecursionDepth, reorderer, code_block,
+                            &data_block_set_, order)) {
         return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool LinearOrderGenerator::SaveStatistics(
+    core::OutArchive* out_archive) const {
+  DCHECK(out_archive != NULL);
+  DCHECK(group_calls_.empty());
+  DCHECK_NE(0U, num_image_blocks_);
+
+  return out_archive->Save(kStatisticsVersion) &&
+      out_archive->Save(static_cast<uint32>(num_image_blocks_)) &&
+      out_archive->Save(image_signature_) &&
+      out_archive->Save(static_cast<uint32>(next_process_group_id_)) &&
+      out_archive->Save(block_statistics_);
+}
+
+bool LinearOrderGenerator::LoadStatistics(core::InArchive* in_archive) {
+  DCHECK(in_archive != NULL);
+
+  uint32 version = 0;
+  uint32 num_image_blocks = 0;
+  PEFile::Signature image_signature;
+  uint32 num_process_groups = 0;
+  BlockStatisticsVector block_statistics;
+  if (!in_archive->Load(&version) || version != kStatisticsVersion) {
+    LOG(ERROR) << "Unsupported statistics version.";
+    return false;
+  }
+  if (!in_archive->Load(&num_image_blocks) ||
+      !in_archive->Load(&image_signature) ||
+      !in_archive->Load(&num_process_groups) ||
+      !in_archive->Load(&block_statistics) ||
+      num_image_blocks == 0) {
+    LOG(ERROR) << "Unable to load statistics.";
+    return false;
+  }
+
+  if (num_image_blocks_ != 0 &&
+      (num_image_blocks_ != num_image_blocks ||
+       !image_signature_.IsConsistent(image_signature))) {
+    LOG(ERROR) << "Statistics were gathered for a different image.";
+    return false;
+  }
+  num_image_blocks_ = num_image_blocks;
+  image_signature_ = image_signature;
+
+  // The loaded process groups are numbered after those closed so far.
+  if (block_statistics_.size() < block_statistics.size())
+    block_statistics_.resize(block_statistics.size());
+  for (size_t id = 0; id < block_statistics.size(); ++id) {
+    const BlockStatistics& loaded = block_statistics[id];
+    BlockStatistics& merged = block_statistics_[id];
+    if (merged.group_count == 0) {
+      merged.process_group_id = static_cast<uint32>(
+          next_process_group_id_ + loaded.process_group_id);
     }
+    merged.sum_order += loaded.sum_order;
+    merged.group_count += loaded.group_count;
+    merged.touch_count += loaded.touch_count;
   }
+  next_process_group_id_ += num_process_groups;
 
   return true;
 }
@@ -179,88 +262,63 @@ bool LinearOrderGenerator::TouchBlock(const BlockCall& block_call) {
   // All code blocks should belong to a defined section.
   DCHECK_NE(pe::kInvalidSection, block_call.block->section());
 
+  size_t id = block_call.block->id();
+  if (id >= block_statistics_.size())
+    block_statistics_.resize(id + 1);
+  if (id >= group_call_indices_.size())
+    group_call_indices_.resize(id + 1, kNoCall);
+
+  ++block_statistics_[id].touch_count;
+
   // Store the block along with the earliest time it was called.
-  BlockCallMap::iterator it = block_call_map_.find(block_call.block);
-  if (it == block_call_map_.end()) {
-    std::pair<BlockCallMap::iterator, bool> insert_return;
-    insert_return = block_call_map_.insert(
-        std::make_pair(block_call.block, block_call));
-    it = insert_return.first;
-    DCHECK(insert_return.second);
-    DCHECK(it != block_call_map_.end());
-  } else {
+  size_t& index = group_call_indices_[id];
+  if (index == kNoCall) {
+    index = group_calls_.size();
+    group_calls_.push_back(block_call);
+  } else if (block_call.time < group_calls_[index].time) {
     // Keep around the earliest call to this block only.
-    if (block_call.time < it->second.time)
-      it->second = block_call;
+    group_calls_[index] = block_call;
   }
   return true;
 }
 
-bool LinearOrderGenerator::InsertDataBlocks(size_t max_recursion_depth,
-                                            const Reorderer& reorderer,
-                                            const BlockGraph::Block* block,
-                                            Order* order) {
-  DCHECK(block != NULL);
-  DCHECK(order != NULL);
-
-  // Stop the recursion.
-  if (max_recursion_depth == 0)
+bool LinearOrderGenerator::CloseProcessGroup() {
+  if (group_calls_.size() == 0)
     return true;
 
-  std::vector<const BlockGraph::Block*> data_blocks;
-
-  // Iterate through any data blocks that are referenced by this
-  // block, and also store them with the same time. This is a pessimistic
-  // optimization, and assumes that all data linked to a code block will
-  // be touched by that code block (and all data linked to by that data block,
-  // and so on, up to 'max_recursion_depth').
-  BlockGraph::Block::ReferenceMap::const_iterator ref_it =
-      block->references().begin();
-  for (; ref_it != block->references().end(); ++ref_it) {
-    const BlockGraph::Block* ref = ref_it->second.referenced();
-    DCHECK(ref != NULL);
-    // We only touch data blocks with a valid section id.
-    if (ref->type() != BlockGraph::DATA_BLOCK ||
-        ref->section() == pe::kInvalidSection)
-      continue;
-
-    // Only insert data blocks that have not yet been seen.
-    if (!data_block_set_.insert(ref).second)
-      continue;
-
-    // Finally, insert this block to the appropriate section ordering, but
-    // only if we're reordering that section.
-    if (reorderer.MustReorder(ref))
-      order->section_block_lists[ref->section()].push_back(ref);
+  uint32 process_group_id = static_cast<uint32>(next_process_group_id_);
+  ++next_process_group_id_;
 
-    data_blocks.push_back(ref);
-  }
-
-  // Recurse on the data blocks we just added.
-  if (max_recursion_depth > 1) {
-    for (size_t i = 0; i < data_blocks.size(); ++i) {
-      if (!InsertDataBlocks(max_recursion_depth - 1, reorderer,
-                            data_blocks[i], order))
-        return false;
-    }
+  // Fold the group's calls, in order, into the block statistics.
+  std::sort(group_calls_.begin(), group_calls_.end(), BlockCallSortIncrTime());
+  for (size_t i = 0; i < group_calls_.size(); ++i) {
+    size_t id = group_calls_[i].block->id();
+    BlockStatistics& block_statistics = block_statistics_[id];
+    if (block_statistics.group_count == 0)
+      block_statistics.process_group_id = process_group_id;
+    block_statistics.sum_order += i;
+    ++block_statistics.group_count;
+    group_call_indices_[id] = kNoCall;
   }
+  group_calls_.clear();
 
   return true;
 }
 
-bool LinearOrderGenerator::CloseProcessGroup() {
-  if (block_call_map_.size() == 0)
-    return true;
-
-  BlockCalls& block_calls = process_group_calls_[next_process_group_id_];
-  ++next_process_group_id_;
-
-  MapToVector(block_call_map_, &block_calls);
-  block_call_map_.clear();
-
-  std::sort(block_calls.begin(), block_calls.end(), BlockCallSortIncrTime());
+bool LinearOrderGenerator::BlockStatistics::Save(
+    core::OutArchive* out_archive) const {
+  return out_archive->Save(sum_order) &&
+      out_archive->Save(group_count) &&
+      out_archive->Save(process_group_id) &&
+      out_archive->Save(touch_count);
+}
 
-  return true;
+bool LinearOrderGenerator::BlockStatistics::Load(
+    core::InArchive* in_archive) {
+  return in_archive->Load(&sum_order) &&
+      in_archive->Load(&group_count) &&
+      in_archive->Load(&process_group_id) &&
+      in_archive->Load(&touch_count);
 }
 
 }  // namespace reorder
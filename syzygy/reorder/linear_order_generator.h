@@ -35,10 +35,16 @@
 // In the case where there is a single run of the instrumented binary, the
 // ordering will be a simple ordering of blocks by order of execution, as per
 // our original proof-of-concept ordering.
+//
+// Each run is folded into per-block statistics as soon as it ends, so memory
+// use depends on the size of the image rather than on the length of the
+// traces. The statistics may be saved, and merged into those of a later
+// invocation, which allows the traces to be consumed a batch at a time.
 
 #ifndef SYZYGY_REORDER_LINEAR_ORDER_GENERATOR_H_
 #define SYZYGY_REORDER_LINEAR_ORDER_GENERATOR_H_
 
+#include "syzygy/core/serialization.h"
 #include "syzygy/reorder/reorderer.h"
 
 namespace reorder {
@@ -70,22 +76,29 @@ class LinearOrderGenerator : public Reorderer::OrderGenerator {
   virtual bool CalculateReordering(const Reorderer& reorderer,
                                    Order* order);
 
+  // Saves the statistics gathered from all the runs seen so far, including
+  // those merged with LoadStatistics. This must be called after
+  // CalculateReordering.
+  // @returns true on success, false otherwise.
+  bool SaveStatistics(core::OutArchive* out_archive) const;
+
+  // Merges statistics saved by SaveStatistics into those of this generator.
+  // The runs they were gathered from count as having happened before any
+  // runs seen in the traces. This must be called before
+  // CalculateReordering, with statistics gathered for the same image.
+  // Statistics gathered for another image are rejected, here or by
+  // CalculateReordering.
+  // @returns true on success, false otherwise.
+  bool LoadStatistics(core::InArchive* in_archive);
+
  private:
+  struct BlockStatistics;
   typedef std::vector<BlockCall> BlockCalls;
-  typedef std::map<size_t, BlockCalls> ProcessGroupBlockCalls;
-  typedef std::map<const BlockGraph::Block*, BlockCall> BlockCallMap;
+  typedef std::vector<BlockStatistics> BlockStatisticsVector;
 
-  // Called by OnFunctionEntry to update block_calls_.
+  // Called by OnFunctionEntry to update group_calls_.
   bool TouchBlock(const BlockCall& block_call);
 
-  // Given a block, inserts the data blocks associated with it into
-  // the ordering. Will recursively traverse data blocks until the given
-  // maximum stack depth (that way, we include data referred to by data).
-  bool InsertDataBlocks(size_t max_recursion_depth,
-                        const Reorderer& reorderer,
-                        const BlockGraph::Block* block,
-                        Order* order);
-
   // This is called to indicate a process group closure.
   bool CloseProcessGroup();
 
@@ -100,15 +113,48 @@ class LinearOrderGenerator : public Reorderer::OrderGenerator {
   // to 1.
   size_t next_process_group_id_;
 
-  // Stores the linearized block list per process group.
-  ProcessGroupBlockCalls process_group_calls_;
+  // Stores the first call to each block in the current process group.
+  BlockCalls group_calls_;
+
+  // Stores the index in group_calls_ of the first call to each block, by
+  // block id, or kNoCall if the block hasn't been called in the current
+  // process group.
+  std::vector<size_t> group_call_indices_;
+
+  // Stores the statistics of the closed process groups, by block id.
+  BlockStatisticsVector block_statistics_;
 
-  // Stores pointers to blocks, and the first time at which they were accessed.
-  // There is one of these per 'process group'.
-  BlockCallMap block_call_map_;
+  // Stores the number of blocks in, and the signature of, the image the
+  // statistics were gathered for. These are only valid once statistics are
+  // loaded or calculated, at which point num_image_blocks_ is non-zero.
+  size_t num_image_blocks_;
+  PEFile::Signature image_signature_;
 
   // Stores a list of already-inserted data blocks.
-  std::set<const BlockGraph::Block*> data_block_set_;
+  BlockSet data_block_set_;
+};
+
+// Aggregates the calls to a block across process groups. Of the ranks of the
+// block's first calls, only their sum is kept, as the ordering only depends
+// on their mean.
+struct LinearOrderGenerator::BlockStatistics {
+  BlockStatistics()
+      : sum_order(0), group_count(0), process_group_id(0), touch_count(0) {
+  }
+
+  bool Save(core::OutArchive* out_archive) const;
+  bool Load(core::InArchive* in_archive);
+
+  // The sum over process groups of the rank of the block's first call in
+  // the group.
+  uint64 sum_order;
+  // The number of process groups in which the block was called.
+  uint32 group_count;
+  // The first process group in which the block was called. This is only
+  // meaningful if group_count == 1.
+  uint32 process_group_id;
+  // The number of times the block was called, in all process groups.
+  uint64 touch_count;
 };
 
 struct LinearOrderGenerator::BlockCall {
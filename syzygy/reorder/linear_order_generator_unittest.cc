@@ -0,0 +1,332 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/linear_order_generator.h"
+
+#include "gtest/gtest.h"
+
+namespace reorder {
+
+namespace {
+
+using core::ByteVector;
+using core::ScopedInStreamPtr;
+using core::ScopedOutStreamPtr;
+
+typedef Reorderer::Order Order;
+typedef Reorderer::UniqueTime UniqueTime;
+
+const size_t kNumBlocks = 6;
+const size_t kCodeSection = 0;
+const uint32 kThreadId = 1;
+const uint32 kModuleChecksum = 0xC0DE;
+
+// A reorderer that drives order generators over an image without parsing
+// any traces.
+class TestReorderer : public Reorderer {
+ public:
+  TestReorderer(const DecomposedImage& image,
+                const PEFile::Signature& module_signature,
+                const OrderGenerator& order_generator)
+      : Reorderer(FilePath(), FilePath(), std::vector<FilePath>(),
+                  kFlagReorderCode) {
+    InitSectionReorderabilityCache(image, order_generator);
+    set_module_signature(module_signature);
+  }
+
+  using Reorderer::set_module_signature;
+};
+
+// The headers of an image with a single code section.
+struct ImageHeaders {
+  IMAGE_NT_HEADERS nt_headers;
+  IMAGE_SECTION_HEADER code_section;
+};
+
+class LinearOrderGeneratorTest : public testing::Test {
+ public:
+  LinearOrderGeneratorTest() : time_(base::Time::Now()) {
+  }
+
+  virtual void SetUp() {
+    ImageHeaders headers;
+    memset(&headers, 0, sizeof(headers));
+    headers.nt_headers.FileHeader.NumberOfSections = 1;
+    headers.code_section.Characteristics = IMAGE_SCN_CNT_CODE;
+    image_.header.nt_headers = image_.image.AddBlock(BlockGraph::DATA_BLOCK,
+                                                     sizeof(headers),
+                                                     "nt_headers");
+    ASSERT_TRUE(image_.header.nt_headers != NULL);
+    image_.header.nt_headers->CopyData(sizeof(headers), &headers);
+
+    for (size_t i = 0; i < kNumBlocks; ++i) {
+      BlockGraph::Block* block =
+          image_.image.AddBlock(BlockGraph::CODE_BLOCK, 16, "block");
+      ASSERT_TRUE(block != NULL);
+      block->set_section(kCodeSection);
+      blocks_.push_back(block);
+    }
+
+    module_signature_.module_size = 0x10000;
+    module_signature_.module_checksum = kModuleChecksum;
+    reorderer_.reset(
+        new TestReorderer(image_, module_signature_, LinearOrderGenerator()));
+  }
+
+  virtual void TearDown() {
+    reorderer_.reset();
+  }
+
+  // Runs a process, alone in its process group, that calls the blocks whose
+  // indices are the digits of @p calls, in order.
+  void RunProcess(uint32 process_id,
+                  const char* calls,
+                  LinearOrderGenerator* generator) {
+    ASSERT_TRUE(generator->OnProcessStarted(*reorderer_, process_id,
+                                            NextTime()));
+    ASSERT_NO_FATAL_FAILURE(CallBlocks(process_id, calls, generator));
+    ASSERT_TRUE(generator->OnProcessEnded(*reorderer_, process_id,
+                                          NextTime()));
+  }
+
+  void CallBlocks(uint32 process_id,
+                  const char* calls,
+                  LinearOrderGenerator* generator) {
+    for (; *calls != '\0'; ++calls) {
+      size_t index = *calls - '0';
+      ASSERT_LT(index, blocks_.size());
+      ASSERT_TRUE(generator->OnCodeBlockEntry(*reorderer_,
+                                              blocks_[index],
+                                              RelativeAddress(0),
+                                              process_id,
+                                              kThreadId,
+                                              NextTime()));
+    }
+  }
+
+  // Calculates the ordering of @p generator, and returns the indices of the
+  // ordered blocks as a string of digits.
+  bool CalculateOrder(LinearOrderGenerator* generator, std::string* order) {
+    Order reordering(pe_, image_);
+    if (!generator->CalculateReordering(*reorderer_, &reordering))
+      return false;
+
+    order->clear();
+    const Order::BlockList& blocks =
+        reordering.section_block_lists[kCodeSection];
+    for (size_t i = 0; i < blocks.size(); ++i)
+      order->push_back('0' + blocks[i]->id() - blocks_[0]->id());
+    return true;
+  }
+
+  void SaveStatistics(const LinearOrderGenerator& generator,
+                      ByteVector* bytes) {
+    bytes->clear();
+    ScopedOutStreamPtr out_stream(
+        core::CreateByteOutStream(std::back_inserter(*bytes)));
+    core::NativeBinaryOutArchive out_archive(out_stream.get());
+    ASSERT_TRUE(generator.SaveStatistics(&out_archive));
+  }
+
+  bool LoadStatistics(const ByteVector& bytes,
+                      LinearOrderGenerator* generator) {
+    ScopedInStreamPtr in_stream(
+        core::CreateByteInStream(bytes.begin(), bytes.end()));
+    core::NativeBinaryInArchive in_archive(in_stream.get());
+    return generator->LoadStatistics(&in_archive);
+  }
+
+ protected:
+  UniqueTime NextTime() {
+    time_ += base::TimeDelta::FromMilliseconds(1);
+    return UniqueTime(time_);
+  }
+
+  base::Time time_;
+  PEFile pe_;
+  Reorderer::DecomposedImage image_;
+  std::vector<BlockGraph::Block*> blocks_;
+  PEFile::Signature module_signature_;
+  scoped_ptr<TestReorderer> reorderer_;
+};
+
+}  // namespace
+
+TEST_F(LinearOrderGeneratorTest, OrdersSingleRunByFirstCall) {
+  LinearOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "31302", &generator));
+
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  EXPECT_EQ("3102", order);
+}
+
+TEST_F(LinearOrderGeneratorTest, RanksBlocksByNumberOfRuns) {
+  // Each run is folded into the statistics as it closes. Block 1 is seen in
+  // both runs, the others are ordered by run, then by first call.
+  LinearOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "0122", &generator));
+  ASSERT_NO_FATAL_FAILURE(RunProcess(2, "31", &generator));
+
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  EXPECT_EQ("1023", order);
+}
+
+TEST_F(LinearOrderGeneratorTest, CoexistingProcessesFormOneRun) {
+  // Process 2 starts before process 1 ends, so that they form a single run
+  // in which block 0 is called before block 1.
+  LinearOrderGenerator generator;
+  ASSERT_TRUE(generator.OnProcessStarted(*reorderer_, 1, NextTime()));
+  ASSERT_NO_FATAL_FAILURE(CallBlocks(1, "0", &generator));
+  ASSERT_TRUE(generator.OnProcessStarted(*reorderer_, 2, NextTime()));
+  ASSERT_TRUE(generator.OnProcessEnded(*reorderer_, 1, NextTime()));
+  ASSERT_NO_FATAL_FAILURE(CallBlocks(2, "1", &generator));
+  ASSERT_TRUE(generator.OnProcessEnded(*reorderer_, 2, NextTime()));
+  ASSERT_NO_FATAL_FAILURE(RunProcess(3, "10", &generator));
+
+  // Both blocks were seen in both runs, at the same mean rank. Had process 2
+  // formed a run of its own, block 1 would come first.
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  EXPECT_EQ("01", order);
+}
+
+TEST_F(LinearOrderGeneratorTest, BreaksTiesByTouchCountThenId) {
+  LinearOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "10", &generator));
+  ASSERT_NO_FATAL_FAILURE(RunProcess(2, "01", &generator));
+
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  EXPECT_EQ("01", order);
+
+  LinearOrderGenerator touchy_generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "10", &touchy_generator));
+  ASSERT_NO_FATAL_FAILURE(RunProcess(2, "011", &touchy_generator));
+
+  ASSERT_TRUE(CalculateOrder(&touchy_generator, &order));
+  EXPECT_EQ("10", order);
+}
+
+TEST_F(LinearOrderGeneratorTest, MergedStatisticsGiveSameOrder) {
+  static const char* kRuns[] = { "02", "31", "4" };
+
+  LinearOrderGenerator all_runs_generator;
+  for (size_t i = 0; i < arraysize(kRuns); ++i) {
+    ASSERT_NO_FATAL_FAILURE(RunProcess(i + 1, kRuns[i], &all_runs_generator));
+  }
+  std::string expected_order;
+  ASSERT_TRUE(CalculateOrder(&all_runs_generator, &expected_order));
+  EXPECT_EQ("02314", expected_order);
+
+  // Save the statistics of the first two runs separately.
+  ByteVector statistics[2];
+  for (size_t i = 0; i < arraysize(statistics); ++i) {
+    LinearOrderGenerator generator;
+    ASSERT_NO_FATAL_FAILURE(RunProcess(i + 1, kRuns[i], &generator));
+    std::string order;
+    ASSERT_TRUE(CalculateOrder(&generator, &order));
+    ASSERT_NO_FATAL_FAILURE(SaveStatistics(generator, &statistics[i]));
+  }
+
+  // Merge them, and run the last run. The merged runs are renumbered so that
+  // the blocks of the second are placed after those of the first.
+  LinearOrderGenerator merged_generator;
+  ASSERT_TRUE(LoadStatistics(statistics[0], &merged_generator));
+  ASSERT_TRUE(LoadStatistics(statistics[1], &merged_generator));
+  ASSERT_NO_FATAL_FAILURE(RunProcess(3, kRuns[2], &merged_generator));
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&merged_generator, &order));
+  EXPECT_EQ(expected_order, order);
+
+  // The merged statistics can themselves be saved and merged.
+  ByteVector merged_statistics;
+  ASSERT_NO_FATAL_FAILURE(
+      SaveStatistics(merged_generator, &merged_statistics));
+  LinearOrderGenerator remerged_generator;
+  ASSERT_TRUE(LoadStatistics(merged_statistics, &remerged_generator));
+  ASSERT_TRUE(CalculateOrder(&remerged_generator, &order));
+  EXPECT_EQ(expected_order, order);
+}
+
+TEST_F(LinearOrderGeneratorTest, RejectsCorruptStatistics) {
+  LinearOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "012", &generator));
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  ByteVector statistics;
+  ASSERT_NO_FATAL_FAILURE(SaveStatistics(generator, &statistics));
+
+  // The version leads the statistics.
+  ByteVector bad_version(statistics);
+  ++bad_version[0];
+  LinearOrderGenerator bad_version_generator;
+  EXPECT_FALSE(LoadStatistics(bad_version, &bad_version_generator));
+
+  ByteVector truncated(statistics.begin(), statistics.end() - 1);
+  LinearOrderGenerator truncated_generator;
+  EXPECT_FALSE(LoadStatistics(truncated, &truncated_generator));
+}
+
+TEST_F(LinearOrderGeneratorTest, RejectsStatisticsOfAnotherModule) {
+  LinearOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "012", &generator));
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  ByteVector statistics;
+  ASSERT_NO_FATAL_FAILURE(SaveStatistics(generator, &statistics));
+
+  // Gather statistics for a rebuilt module, which decomposes to the same
+  // number of blocks.
+  PEFile::Signature other_signature(module_signature_);
+  ++other_signature.module_checksum;
+  reorderer_->set_module_signature(other_signature);
+
+  LinearOrderGenerator other_generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "345", &other_generator));
+  ASSERT_TRUE(CalculateOrder(&other_generator, &order));
+  ByteVector other_statistics;
+  ASSERT_NO_FATAL_FAILURE(SaveStatistics(other_generator, &other_statistics));
+
+  // The statistics can't be merged with each other, nor used to reorder the
+  // other module.
+  LinearOrderGenerator merged_generator;
+  ASSERT_TRUE(LoadStatistics(other_statistics, &merged_generator));
+  EXPECT_FALSE(LoadStatistics(statistics, &merged_generator));
+
+  LinearOrderGenerator loaded_generator;
+  ASSERT_TRUE(LoadStatistics(statistics, &loaded_generator));
+  EXPECT_FALSE(CalculateOrder(&loaded_generator, &order));
+}
+
+TEST_F(LinearOrderGeneratorTest, RejectsStatisticsOfAnotherDecomposition) {
+  LinearOrderGenerator generator;
+  ASSERT_NO_FATAL_FAILURE(RunProcess(1, "012", &generator));
+  std::string order;
+  ASSERT_TRUE(CalculateOrder(&generator, &order));
+  ByteVector statistics;
+  ASSERT_NO_FATAL_FAILURE(SaveStatistics(generator, &statistics));
+
+  // The block ids of the statistics don't hold for an image that decomposes
+  // differently, even though it's the same module.
+  ASSERT_TRUE(
+      image_.image.AddBlock(BlockGraph::CODE_BLOCK, 16, "extra") != NULL);
+
+  LinearOrderGenerator loaded_generator;
+  ASSERT_TRUE(LoadStatistics(statistics, &loaded_generator));
+  EXPECT_FALSE(CalculateOrder(&loaded_generator, &order));
+}
+
+}  // namespace reorder
@@ -26,16 +26,26 @@
       'target_name': 'reorder_lib',
       'type': 'static_library',
       'sources': [
+        'block_entry_parser.cc',
+        'block_entry_parser.h',
+        'call_graph_order_generator.cc',
+        'call_graph_order_generator.h',
         'comdat_order.cc',
         'comdat_order.h',
         'dead_code_finder.cc',
         'dead_code_finder.h',
+        'function_block_cache.cc',
+        'function_block_cache.h',
         'linear_order_generator.cc',
         'linear_order_generator.h',
         'random_order_generator.cc',
         'random_order_generator.h',
         'reorderer.cc',
         'reorderer.h',
+        'trace_event_list.cc',
+        'trace_event_list.h',
+        'working_set_simulator.cc',
+        'working_set_simulator.h',
       ],
       'dependencies': [
         '<(DEPTH)/sawbuck/log_lib/log_lib.gyp:log_lib',
@@ -70,5 +80,22 @@
         ]
       },
     },
+    {
+      'target_name': 'reorder_unittests',
+      'type': 'executable',
+      'sources': [
+        'call_graph_order_generator_unittest.cc',
+        'function_block_cache_unittest.cc',
+        'linear_order_generator_unittest.cc',
+        'reorder_unittests_main.cc',
+        'trace_event_list_unittest.cc',
+        'working_set_simulator_unittest.cc',
+      ],
+      'dependencies': [
+        'reorder_lib',
+        '<(DEPTH)/base/base.gyp:base',
+        '<(DEPTH)/testing/gtest.gyp:gtest',
+      ],
+    },
   ],
 }
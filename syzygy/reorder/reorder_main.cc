@@ -19,22 +19,32 @@
 #include "base/at_exit.h"
 #include "base/command_line.h"
 #include "base/file_path.h"
+#include "base/file_util.h"
 #include "base/string_number_conversions.h"
 #include "base/string_split.h"
 #include "base/stringprintf.h"
+#include "base/sys_info.h"
+#include "sawbuck/log_lib/event_capture.h"
+#include "syzygy/reorder/call_graph_order_generator.h"
 #include "syzygy/reorder/comdat_order.h"
 #include "syzygy/reorder/dead_code_finder.h"
 #include "syzygy/reorder/linear_order_generator.h"
 #include "syzygy/reorder/random_order_generator.h"
+#include "syzygy/reorder/working_set_simulator.h"
 
+using reorder::CallGraphOrderGenerator;
 using reorder::ComdatOrder;
 using reorder::DeadCodeFinder;
 using reorder::LinearOrderGenerator;
 using reorder::RandomOrderGenerator;
 using reorder::Reorderer;
+using reorder::WorkingSetRecorder;
+using reorder::WorkingSetSimulator;
 
 static const char kUsage[] =
     "Usage: reorder [options] [ETW log files ...]\n"
+    "  The ETW log files may instead be event captures, each holding both\n"
+    "  the kernel and the call_trace events of a trace.\n"
     "  Required Options:\n"
     "    --instrumented-dll=<path> the path to the instrumented DLL.\n"
     "    --output-file=<path> the output file.\n"
@@ -43,11 +53,34 @@ static const char kUsage[] =
     "        specified it will be inferred from the instrumented DLL\n"
     "        metadata.\n"
     "    --seed=INT generates a random ordering; don't specify ETW log files.\n"
+    "    --order-generator=<linear|call-graph> the way the ordering is\n"
+    "        generated from the traces. linear orders blocks by when they\n"
+    "        were first called, call-graph places blocks that call each\n"
+    "        other close together. Defaults to linear.\n"
+    "    --save-statistics=<path> saves the statistics the linear order\n"
+    "        generator gathered from the traces, so that they can be merged\n"
+    "        into a later ordering.\n"
+    "    --merge-statistics=<comma separated paths> merges statistics saved\n"
+    "        by earlier runs of the linear order generator for the same\n"
+    "        input DLL. The ETW log files may then be omitted.\n"
     "    --list-dead-code instead of an ordering, output the set of functions\n"
     "        not visited during the trace.\n"
     "    --pretty-print enables pretty printing of the JSON output file.\n"
     "    --output-stats outputs estimated startup page faults pre- and post-\n"
     "        reordering.\n"
+    "    --simulate-working-set replays the traces against the original and\n"
+    "        the reordered image, and outputs the page faults of each.\n"
+    "    --cluster-pages=INT the number of pages read in by a simulated\n"
+    "        fault. Defaults to 8.\n"
+    "    --working-set-pages=INT the maximum number of resident pages in the\n"
+    "        simulation. Defaults to no limit.\n"
+    "    --threads=INT the number of threads event captures are parsed on.\n"
+    "        Defaults to the number of processors.\n"
+    "    --capture-batch-size=INT the number of event captures whose events\n"
+    "        are held in memory at once, at 24 bytes per call. The captures\n"
+    "        are replayed a batch at a time in the order given, so captures\n"
+    "        that overlap in time should be in the same batch. Defaults to\n"
+    "        all of them.\n"
     "    --output-comdats=<path> an output file that will be populated\n"
     "        with an MS LINKER compatible COMDAT order file equivalent to\n"
     "        the generated ordering.\n"
@@ -57,7 +90,15 @@ static const char kUsage[] =
     "    no-data: Do not reorder data sections.\n";
 
 const char kFlags[] = "reorderer-flags";
+const char kOrderGenerator[] = "order-generator";
+const char kSaveStatistics[] = "save-statistics";
+const char kMergeStatistics[] = "merge-statistics";
 const char kOutputComdats[] = "output-comdats";
+const char kSimulateWorkingSet[] = "simulate-working-set";
+const char kClusterPages[] = "cluster-pages";
+const char kWorkingSetPages[] = "working-set-pages";
+const char kThreads[] = "threads";
+const char kCaptureBatchSize[] = "capture-batch-size";
 
 static int Usage(const char* message) {
   std::cerr << message << std::endl << kUsage;
@@ -98,6 +139,81 @@ static bool ParseReordererFlags(CommandLine* cmd_line,
   return true;
 }
 
+// Parses working set simulator options. Returns true on success, false
+// otherwise. On failure, also outputs Usage with an error message.
+static bool ParseWorkingSetOptions(CommandLine* cmd_line,
+                                   WorkingSetSimulator::Options* options) {
+  DCHECK(cmd_line != NULL);
+  DCHECK(options != NULL);
+
+  if (cmd_line->HasSwitch(kClusterPages)) {
+    int cluster_pages = 0;
+    if (!base::StringToInt(cmd_line->GetSwitchValueASCII(kClusterPages),
+                           &cluster_pages) || cluster_pages <= 0) {
+      Usage("Invalid cluster-pages value.");
+      return false;
+    }
+    options->cluster_pages = cluster_pages;
+  }
+
+  if (cmd_line->HasSwitch(kWorkingSetPages)) {
+    int working_set_pages = 0;
+    if (!base::StringToInt(cmd_line->GetSwitchValueASCII(kWorkingSetPages),
+                           &working_set_pages) || working_set_pages < 0) {
+      Usage("Invalid working-set-pages value.");
+      return false;
+    }
+    options->max_resident_pages = working_set_pages;
+  }
+
+  return true;
+}
+
+// Merges the linear order generator statistics saved in each of @p paths
+// into @p order_generator. Returns true on success, false otherwise.
+static bool MergeStatistics(const std::vector<FilePath>& paths,
+                            LinearOrderGenerator* order_generator) {
+  DCHECK(order_generator != NULL);
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    file_util::ScopedFILE in_file(file_util::OpenFile(paths[i], "rb"));
+    if (in_file.get() == NULL) {
+      LOG(ERROR) << "Unable to open \"" << paths[i].value() << "\".";
+      return false;
+    }
+
+    core::BufferedFileInStream in_stream(in_file.get());
+    core::NativeBinaryInArchive in_archive(&in_stream);
+    if (!order_generator->LoadStatistics(&in_archive)) {
+      LOG(ERROR) << "Unable to merge statistics from \""
+          << paths[i].value() << "\".";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Saves the statistics of @p order_generator to @p path. Returns true on
+// success, false otherwise.
+static bool SaveStatistics(const LinearOrderGenerator& order_generator,
+                           const FilePath& path) {
+  file_util::ScopedFILE out_file(file_util::OpenFile(path, "wb"));
+  if (out_file.get() == NULL) {
+    LOG(ERROR) << "Unable to open \"" << path.value() << "\".";
+    return false;
+  }
+
+  core::BufferedFileOutStream out_stream(out_file.get());
+  core::NativeBinaryOutArchive out_archive(&out_stream);
+  if (!order_generator.SaveStatistics(&out_archive) || !out_stream.Flush()) {
+    LOG(ERROR) << "Unable to save statistics to \"" << path.value() << "\".";
+    return false;
+  }
+
+  return true;
+}
+
 int main(int argc, char** argv) {
   base::AtExitManager at_exit_manager;
   CommandLine::Init(argc, argv);
@@ -129,6 +245,34 @@ int main(int argc, char** argv) {
     trace_paths.push_back(FilePath(cmd_line->args()[i]));
   bool pretty_print = cmd_line->HasSwitch("pretty-print");
   bool list_dead_code = cmd_line->HasSwitch("list-dead-code");
+  std::string order_generator_name =
+      cmd_line->GetSwitchValueASCII(kOrderGenerator);
+  bool simulate_working_set = cmd_line->HasSwitch(kSimulateWorkingSet);
+  FilePath save_statistics_path = cmd_line->GetSwitchValuePath(kSaveStatistics);
+  std::vector<FilePath> merge_statistics_paths;
+  if (cmd_line->HasSwitch(kMergeStatistics)) {
+    std::vector<StringType> paths;
+    base::SplitString(cmd_line->GetSwitchValueNative(kMergeStatistics),
+                      L',', &paths);
+    for (size_t i = 0; i < paths.size(); ++i) {
+      if (!paths[i].empty())
+        merge_statistics_paths.push_back(FilePath(paths[i]));
+    }
+  }
+
+  int num_threads = base::SysInfo::NumberOfProcessors();
+  if (cmd_line->HasSwitch(kThreads) &&
+      (!base::StringToInt(cmd_line->GetSwitchValueASCII(kThreads),
+                          &num_threads) || num_threads < 1)) {
+    return Usage("Invalid threads value.");
+  }
+
+  int capture_batch_size = 0;
+  if (cmd_line->HasSwitch(kCaptureBatchSize) &&
+      (!base::StringToInt(cmd_line->GetSwitchValueASCII(kCaptureBatchSize),
+                          &capture_batch_size) || capture_batch_size < 1)) {
+    return Usage("Invalid capture-batch-size value.");
+  }
 
   if (instrumented_dll_path.empty() || output_file.empty()) {
     return Usage(
@@ -136,7 +280,13 @@ int main(int argc, char** argv) {
   }
 
   if (seed_str.empty()) {
-    if (trace_paths.size() < 2) {
+    // Merged statistics can stand in for the traces.
+    bool have_traces = trace_paths.size() > 0 ||
+        merge_statistics_paths.empty();
+    // A single event capture holds both the kernel and the call_trace events.
+    bool single_capture = trace_paths.size() == 1 &&
+        EventCaptureReader::IsCaptureFile(trace_paths[0]);
+    if (have_traces && trace_paths.size() < 2 && !single_capture) {
       return Usage("You must specify at least two ETW trace files (kernel and "
           "call_trace) if you are not generating a random ordering.");
     }
@@ -147,6 +297,33 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (!order_generator_name.empty()) {
+    if (!seed_str.empty() || list_dead_code) {
+      return Usage("Do not specify order-generator when generating a random "
+          "ordering or listing dead code.");
+    }
+    if (order_generator_name != "linear" &&
+        order_generator_name != "call-graph") {
+      return Usage("Unknown order generator.");
+    }
+  }
+
+  if ((!save_statistics_path.empty() || !merge_statistics_paths.empty()) &&
+      (!seed_str.empty() || list_dead_code ||
+       (!order_generator_name.empty() && order_generator_name != "linear"))) {
+    return Usage("Statistics may only be saved and merged by the linear "
+        "order generator.");
+  }
+
+  if (simulate_working_set && (!seed_str.empty() || list_dead_code)) {
+    return Usage("Do not specify simulate-working-set when generating a "
+        "random ordering or listing dead code.");
+  }
+
+  WorkingSetSimulator::Options working_set_options;
+  if (!ParseWorkingSetOptions(cmd_line, &working_set_options))
+    return 1;
+
   Reorderer::Flags reorderer_flags = 0;
   if (!ParseReordererFlags(cmd_line, &reorderer_flags)) {
     return 1;
@@ -163,8 +340,22 @@ int main(int argc, char** argv) {
     order_generator.reset(new RandomOrderGenerator(seed));
   } else if (list_dead_code) {
     order_generator.reset(new DeadCodeFinder());
+  } else if (order_generator_name == "call-graph") {
+    order_generator.reset(new CallGraphOrderGenerator());
   } else {
-    order_generator.reset(new LinearOrderGenerator());
+    LinearOrderGenerator* linear_order_generator = new LinearOrderGenerator();
+    order_generator.reset(linear_order_generator);
+    if (!MergeStatistics(merge_statistics_paths, linear_order_generator))
+      return 1;
+  }
+
+  // Record the traces for the working set simulation as they go by.
+  WorkingSetSimulator simulator(working_set_options);
+  scoped_ptr<Reorderer::OrderGenerator> recorder;
+  Reorderer::OrderGenerator* reorder_generator = order_generator.get();
+  if (simulate_working_set) {
+    recorder.reset(new WorkingSetRecorder(order_generator.get(), &simulator));
+    reorder_generator = recorder.get();
   }
 
   pe::PEFile input_dll;
@@ -174,14 +365,28 @@ int main(int argc, char** argv) {
                       instrumented_dll_path,
                       trace_paths,
                       reorderer_flags);
-  if (!reorderer.Reorder(order_generator.get(), &order)) {
+  reorderer.set_num_threads(num_threads);
+  reorderer.set_capture_batch_size(capture_batch_size);
+  if (!reorderer.Reorder(reorder_generator, &order)) {
     LOG(ERROR) << "Reorder failed.";
     return 1;
   }
 
+  if (!save_statistics_path.empty()) {
+    LinearOrderGenerator* linear_order_generator =
+        static_cast<LinearOrderGenerator*>(order_generator.get());
+    if (!SaveStatistics(*linear_order_generator, save_statistics_path))
+      return 1;
+  }
+
   if (cmd_line->HasSwitch("output-stats"))
     order.OutputFaultEstimates(stdout);
 
+  if (simulate_working_set && !simulator.OutputFaults(order, stdout)) {
+    LOG(ERROR) << "Unable to simulate the working set.";
+    return 1;
+  }
+
   if (!order.SerializeToJSON(output_file, pretty_print)) {
     LOG(ERROR) << "Unable to output order.";
     return 1;
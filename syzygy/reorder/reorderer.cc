@@ -13,17 +13,20 @@
 // limitations under the License.
 #include "syzygy/reorder/reorderer.h"
 
+#include <algorithm>
 #include "base/file_util.h"
 #include "base/json/json_reader.h"
 #include "base/json/string_escape.h"
 #include "base/stringprintf.h"
 #include "base/utf_string_conversions.h"
 #include "base/values.h"
+#include "sawbuck/log_lib/event_capture.h"
 #include "syzygy/common/defs.h"
 #include "syzygy/common/syzygy_version.h"
 #include "syzygy/core/serialization.h"
 #include "syzygy/pe/metadata.h"
 #include "syzygy/pe/pe_file.h"
+#include "syzygy/reorder/trace_event_list.h"
 
 namespace {
 
@@ -157,17 +160,15 @@ Reorderer::Reorderer(const FilePath& module_path,
       instrumented_path_(instrumented_path),
       trace_paths_(trace_paths),
       flags_(flags),
+      num_threads_(1),
+      capture_batch_size_(0),
       code_block_entry_events_(0),
       consumer_errored_(false),
       order_generator_(NULL),
       image_(NULL) {
   DCHECK(consumer_ == NULL);
-  if (consumer_ == NULL) {
+  if (consumer_ == NULL)
     consumer_ = this;
-    kernel_log_parser_.set_module_event_sink(this);
-    kernel_log_parser_.set_process_event_sink(this);
-    call_trace_parser_.set_call_trace_event_sink(this);
-  }
 }
 
 Reorderer::~Reorderer() {
@@ -220,10 +221,24 @@ bool Reorderer::ReorderImpl(Order* order) {
     LOG(ERROR) << "Instrumented module metadata does not match input module.";
     return false;
   }
+  module_signature_ = input_signature;
 
-  // Open the log files. We do this before running the decomposer as if these
-  // fail we'll have wasted a lot of time!
+  // The traces are either all event captures, or all ETW logs.
+  size_t num_captures = 0;
   for (size_t i = 0; i < trace_paths_.size(); ++i) {
+    if (EventCaptureReader::IsCaptureFile(trace_paths_[i]))
+      ++num_captures;
+  }
+  bool use_captures = num_captures > 0;
+  if (use_captures && num_captures != trace_paths_.size()) {
+    LOG(ERROR) << "Event captures can't be mixed with ETW log files.";
+    return false;
+  }
+
+  // Open the log files. We do this before running the decomposer as if these
+  // fail we'll have wasted a lot of time! The captures are opened as they
+  // are parsed.
+  for (size_t i = 0; !use_captures && i < trace_paths_.size(); ++i) {
     std::wstring trace_path(trace_paths_[i].value());
     LOG(INFO) << "Reading " << trace_path << ".";
     if (FAILED(OpenFileSession(trace_path.c_str()))) {
@@ -241,13 +256,13 @@ bool Reorderer::ReorderImpl(Order* order) {
     return false;
   }
 
-  InitSectionReorderabilityCache(*order_generator_);
+  InitSectionReorderabilityCache(*image_, *order_generator_);
 
   // Parse the logs.
   if (trace_paths_.size() > 0) {
     LOG(INFO) << "Processing trace events.";
-    Consume();
-    if (consumer_errored_)
+    bool success = use_captures ? ConsumeCaptures() : ConsumeLogs();
+    if (!success)
       return false;
     if (code_block_entry_events_ == 0) {
       LOG(ERROR) << "No events originated from the given instrumented DLL.";
@@ -265,6 +280,88 @@ bool Reorderer::ReorderImpl(Order* order) {
   return true;
 }
 
+bool Reorderer::ConsumeLogs() {
+  parser_.reset(new BlockEntryParser(instrumented_path_, instr_signature_,
+                                     &image_->address_space, this));
+  Consume();
+  bool success = !consumer_errored_ && !parser_->errored();
+  parser_.reset();
+  return success;
+}
+
+bool Reorderer::ConsumeCaptures() {
+  // The events of a batch of captures are all held in memory until they are
+  // replayed, so large sets of captures are consumed a batch at a time.
+  size_t batch_size = capture_batch_size_;
+  if (batch_size == 0)
+    batch_size = trace_paths_.size();
+
+  for (size_t first = 0; first < trace_paths_.size(); first += batch_size) {
+    size_t last = std::min(first + batch_size, trace_paths_.size());
+    std::vector<FilePath> batch_paths(trace_paths_.begin() + first,
+                                      trace_paths_.begin() + last);
+    std::vector<TraceEventList*> lists;
+    for (size_t i = 0; i < batch_paths.size(); ++i)
+      lists.push_back(new TraceEventList());
+
+    LOG(INFO) << "Parsing event captures " << first + 1 << " to " << last
+        << " of " << trace_paths_.size() << " on up to " << num_threads_
+        << " threads.";
+    bool success = TraceEventList::ParseCaptures(batch_paths, num_threads_,
+                                                 instrumented_path_,
+                                                 instr_signature_,
+                                                 &image_->address_space,
+                                                 lists);
+
+    // Merge the events of the captures. The replay is in order of time, and
+    // doesn't depend on how the captures were shared between the threads.
+    if (success) {
+      std::vector<const TraceEventList*> const_lists(lists.begin(),
+                                                     lists.end());
+      success = TraceEventList::Replay(const_lists, &image_->image, this);
+    }
+
+    for (size_t i = 0; i < lists.size(); ++i)
+      delete lists[i];
+
+    if (!success || consumer_errored_)
+      return false;
+  }
+
+  return true;
+}
+
+bool Reorderer::OnProcessStarted(uint32 process_id, const base::Time& time) {
+  if (!order_generator_->OnProcessStarted(*this, process_id,
+                                          UniqueTime(time))) {
+    consumer_errored_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool Reorderer::OnProcessEnded(uint32 process_id, const base::Time& time) {
+  if (!order_generator_->OnProcessEnded(*this, process_id, UniqueTime(time))) {
+    consumer_errored_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool Reorderer::OnBlockEntry(const BlockGraph::Block* block,
+                             RelativeAddress address,
+                             uint32 process_id,
+                             uint32 thread_id,
+                             const base::Time& time) {
+  ++code_block_entry_events_;
+  if (!order_generator_->OnCodeBlockEntry(*this, block, address, process_id,
+                                          thread_id, UniqueTime(time))) {
+    consumer_errored_ = true;
+    return false;
+  }
+  return true;
+}
+
 bool Reorderer::ValidateInstrumentedModuleAndParseSignature(
     pe::PEFile::Signature* orig_signature) {
   DCHECK(orig_signature != NULL);
@@ -293,216 +390,9 @@ bool Reorderer::ValidateInstrumentedModuleAndParseSignature(
   return true;
 }
 
-bool Reorderer::MatchesInstrumentedModuleSignature(
-    const ModuleInformation& module_info) const {
-  // On Windows XP gathered traces, only the module size is non-zero.
-  if (module_info.image_checksum == 0 && module_info.time_date_stamp == 0) {
-    // If the size matches, then check that the names fit.
-    if (instr_signature_.module_size != module_info.module_size)
-      return false;
-
-    FilePath base_name = instrumented_path_.BaseName();
-    return (module_info.image_file_name.rfind(base_name.value()) !=
-        std::wstring::npos);
-  } else {
-    // On Vista and greater, we can check the full module signature.
-    return (instr_signature_.module_checksum == module_info.image_checksum &&
-        instr_signature_.module_size == module_info.module_size &&
-        instr_signature_.module_time_date_stamp == module_info.time_date_stamp);
-  }
-}
-
-// KernelModuleEvents implementation.
-void Reorderer::OnModuleIsLoaded(DWORD process_id,
-                                 const base::Time& time,
-                                 const ModuleInformation& module_info) {
-  // Simply forward this to OnModuleLoad.
-  OnModuleLoad(process_id, time, module_info);
-}
-
-void Reorderer::OnModuleUnload(DWORD process_id,
-                               const base::Time& time,
-                               const ModuleInformation& module_info) {
-  // Avoid doing needless work.
-  if (consumer_errored_ || module_info.module_size == 0)
-    return;
-
-  // This happens in Windows XP traces for some reason. They contain conflicing
-  // information, so we ignore them.
-  if (module_info.image_file_name.empty())
-    return;
-
-  if (last_event_time_ > time) {
-    LOG(ERROR) << "Messages out of temporal order.";
-    consumer_errored_ = true;
-    return;
-  }
-
-  ModuleSpace& module_space = processes_[process_id];
-  AbsoluteAddress64 addr(module_info.base_address);
-  ModuleSpace::Range range(addr, module_info.module_size);
-  ModuleSpace::RangeMapIter it =
-      module_space.FindFirstIntersection(range);
-  if (it == module_space.end()) {
-    // We occasionally see this, as certain modules fire off multiple Unload
-    // events, so we don't log an error. I'm looking at you, logman.exe.
-    return;
-  }
-  if (!(it->first == range)) {
-    LOG(ERROR) << "Trying to remove module with mismatching range: "
-               << module_info.image_file_name;
-    consumer_errored_ = true;
-    return;
-  }
-
-  module_space.Remove(it);
-  last_event_time_ = time;
-}
-
-void Reorderer::OnModuleLoad(DWORD process_id,
-                             const base::Time& time,
-                             const ModuleInformation& module_info) {
-  // Avoid doing needless work.
-  if (consumer_errored_ || module_info.module_size == 0)
-    return;
-
-  // This happens in Windows XP traces for some reason. They contain conflicing
-  // information, so we ignore them.
-  if (module_info.image_file_name.empty())
-    return;
-
-  if (last_event_time_ > time) {
-    LOG(ERROR) << "Messages out of temporal order.";
-    consumer_errored_ = true;
-    return;
-  }
-
-  ModuleSpace& module_space = processes_[process_id];
-  AbsoluteAddress64 addr(module_info.base_address);
-  ModuleSpace::Range range(addr, module_info.module_size);
-  if (!module_space.Insert(range, module_info)) {
-    ModuleSpace::RangeMapIter it = module_space.FindFirstIntersection(range);
-    DCHECK(it != module_space.end());
-    // We actually see this behaviour on Windows XP gathered traces. Since this
-    // is one of the platforms we target, we simply print out a warning for
-    // now.
-    LOG(WARNING) << "Trying to insert conflicting module: "
-        << module_info.image_file_name;
-  }
-
-  last_event_time_ = time;
-}
-
-// KernelProcessEvents implementation.
-void Reorderer::OnProcessIsRunning(const base::Time& time,
-                                   const ProcessInfo& process_info) {
-  // We don't care about these events.
-}
-
-void Reorderer::OnProcessStarted(const base::Time& time,
-                                   const ProcessInfo& process_info) {
-  // We don't care about these events.
-}
-
-void Reorderer::OnProcessEnded(const base::Time& time,
-                               const ProcessInfo& process_info,
-                               ULONG exit_status) {
-  uint32 process_id = process_info.process_id;
-  ProcessSet::iterator process_it = matching_process_ids_.find(process_id);
-  if (process_it == matching_process_ids_.end())
-    return;
-
-  matching_process_ids_.erase(process_it);
-
-  UniqueTime entry_time(time);
-  if (!order_generator_->OnProcessEnded(*this, process_id, entry_time)) {
-    consumer_errored_ = true;
-    return;
-  }
-
-  return;
-}
-
-// CallTraceEvents implementation.
-void Reorderer::OnTraceEntry(base::Time time,
-                             DWORD process_id,
-                             DWORD thread_id,
-                             const TraceEnterExitEventData* data) {
-  // We currently don't care about TraceEntry events.
-}
-
-void Reorderer::OnTraceExit(base::Time time,
-                            DWORD process_id,
-                            DWORD thread_id,
-                            const TraceEnterExitEventData* data) {
-  // We currently don't care about TraceExit events.
-}
-
-void Reorderer::OnTraceBatchEnter(base::Time time,
-                                  DWORD process_id,
-                                  DWORD thread_id,
-                                  const TraceBatchEnterData* data) {
-  // Avoid doing needless work.
-  if (consumer_errored_)
-    return;
-
-  for (size_t i = 0; i < data->num_calls; ++i) {
-    AbsoluteAddress64 function_address =
-        reinterpret_cast<AbsoluteAddress64>(data->calls[i].function);
-    const ModuleInformation* module_info =
-        GetModuleInformation(process_id, function_address);
-
-    // Don't parse this event unless it belongs to the instrumented module
-    // of interest.
-    if (module_info == NULL ||
-        !MatchesInstrumentedModuleSignature(*module_info))
-      continue;
-
-    // Get the block that this function call refers to. We can only instrument
-    // 32-bit DLLs, so we're sure that the following address conversion is safe.
-    RelativeAddress rva(
-        static_cast<uint32>(function_address - module_info->base_address));
-    const BlockGraph::Block* block =
-        image_->address_space.GetBlockByAddress(rva);
-    if (block == NULL) {
-      LOG(ERROR) << "Unable to map " << rva << " to a block.";
-      consumer_errored_ = true;
-      return;
-    }
-    if (block->type() != BlockGraph::CODE_BLOCK) {
-      LOG(ERROR) << rva << " maps to a non-code block.";
-      consumer_errored_ = true;
-      return;
-    }
-
-    // Get the actual time of the call. We ignore ticks_ago for now, as the
-    // low-resolution and rounding can cause inaccurate relative timings. We
-    // simply rely on the buffer ordering (via UniqueTime's internal counter)
-    // to maintain relative ordering. For future reference, ticks_ago are in
-    // milliseconds, according to MSDN.
-    UniqueTime entry_time(time);
-
-    // If this is the first call of interest by a given process, send an
-    // OnProcessStarted event.
-    if (matching_process_ids_.insert(process_id).second) {
-      if (!order_generator_->OnProcessStarted(*this, process_id, entry_time)) {
-        consumer_errored_ = true;
-        return;
-      }
-    }
-
-    ++code_block_entry_events_;
-    if (!order_generator_->OnCodeBlockEntry(*this, block, rva, process_id,
-                                            thread_id, entry_time)) {
-      consumer_errored_ = true;
-      return;
-    }
-  }
-}
-
 void Reorderer::OnEvent(PEVENT_TRACE event) {
-  if (!call_trace_parser_.ProcessOneEvent(event))
-    kernel_log_parser_.ProcessOneEvent(event);
+  DCHECK(parser_.get() != NULL);
+  parser_->ProcessEvent(event);
 }
 
 void Reorderer::ProcessEvent(PEVENT_TRACE event) {
@@ -513,27 +403,11 @@ void Reorderer::ProcessEvent(PEVENT_TRACE event) {
 bool Reorderer::ProcessBuffer(PEVENT_TRACE_LOGFILE buffer) {
   DCHECK(consumer_ != NULL);
   // If our consumer is errored, we bail early.
-  if (consumer_->consumer_errored_)
+  if (consumer_->consumer_errored_ || consumer_->parser_->errored())
     return false;
   return true;
 }
 
-const sym_util::ModuleInformation* Reorderer::GetModuleInformation(
-    uint32 process_id, AbsoluteAddress64 addr) const {
-  ProcessMap::const_iterator processes_it = processes_.find(process_id);
-  if (processes_it == processes_.end())
-    return NULL;
-
-  const ModuleSpace& module_space(processes_it->second);
-  ModuleSpace::Range range(addr, 1);
-  ModuleSpace::RangeMapConstIter module_it =
-      module_space.FindFirstIntersection(range);
-  if (module_it == module_space.end())
-    return NULL;
-
-  return &module_it->second;
-}
-
 bool Reorderer::Order::SerializeToJSON(const FilePath &path,
                                        bool pretty_print) const {
   file_util::ScopedFILE file(file_util::OpenFile(path, "wb"));
@@ -814,14 +688,16 @@ bool Reorderer::Order::OutputFaultEstimates(FILE* file) const {
 }
 
 void Reorderer::InitSectionReorderabilityCache(
+  const DecomposedImage& image,
   const Reorderer::OrderGenerator& order_generator) {
   const IMAGE_NT_HEADERS* nt_headers =
       reinterpret_cast<const IMAGE_NT_HEADERS*>(
-          image_->header.nt_headers->data());
+          image.header.nt_headers->data());
   DCHECK(nt_headers != NULL);
   const IMAGE_SECTION_HEADER* sections =
       reinterpret_cast<const IMAGE_SECTION_HEADER*>(nt_headers + 1);
 
+  section_reorderability_cache_.clear();
   for (size_t i = 0; i < nt_headers->FileHeader.NumberOfSections; ++i) {
     const IMAGE_SECTION_HEADER& section = sections[i];
     section_reorderability_cache_.push_back(
@@ -842,6 +718,61 @@ bool Reorderer::OrderGenerator::IsReorderable(
   return false;
 }
 
+bool Reorderer::OrderGenerator::InsertDataBlocks(
+    size_t max_recursion_depth,
+    const Reorderer& reorderer,
+    const BlockGraph::Block* block,
+    BlockSet* inserted_data_blocks,
+    Order* order) {
+  DCHECK(block != NULL);
+  DCHECK(inserted_data_blocks != NULL);
+  DCHECK(order != NULL);
+
+  // Stop the recursion.
+  if (max_recursion_depth == 0)
+    return true;
+
+  std::vector<const BlockGraph::Block*> data_blocks;
+
+  // Iterate through any data blocks that are referenced by this
+  // block, and also store them with the same time. This is a pessimistic
+  // optimization, and assumes that all data linked to a code block will
+  // be touched by that code block (and all data linked to by that data block,
+  // and so on, up to 'max_recursion_depth').
+  BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+      block->references().begin();
+  for (; ref_it != block->references().end(); ++ref_it) {
+    const BlockGraph::Block* ref = ref_it->second.referenced();
+    DCHECK(ref != NULL);
+    // We only touch data blocks with a valid section id.
+    if (ref->type() != BlockGraph::DATA_BLOCK ||
+        ref->section() == pe::kInvalidSection)
+      continue;
+
+    // Only insert data blocks that have not yet been seen.
+    if (!inserted_data_blocks->insert(ref).second)
+      continue;
+
+    // Finally, insert this block to the appropriate section ordering, but
+    // only if we're reordering that section.
+    if (reorderer.MustReorder(ref))
+      order->section_block_lists[ref->section()].push_back(ref);
+
+    data_blocks.push_back(ref);
+  }
+
+  // Recurse on the data blocks we just added.
+  if (max_recursion_depth > 1) {
+    for (size_t i = 0; i < data_blocks.size(); ++i) {
+      if (!InsertDataBlocks(max_recursion_depth - 1, reorderer,
+                            data_blocks[i], inserted_data_blocks, order))
+        return false;
+    }
+  }
+
+  return true;
+}
+
 bool Reorderer::MustReorder(size_t section_index) const {
   DCHECK_LT(section_index, section_reorderability_cache_.size());
   return section_reorderability_cache_[section_index];
@@ -19,16 +19,13 @@
 #ifndef SYZYGY_REORDER_REORDERER_H_
 #define SYZYGY_REORDER_REORDERER_H_
 
+#include "base/scoped_ptr.h"
 #include "base/win/event_trace_consumer.h"
-#include "sawbuck/log_lib/kernel_log_consumer.h"
-#include "syzygy/call_trace/call_trace_parser.h"
 #include "syzygy/pe/decomposer.h"
+#include "syzygy/reorder/block_entry_parser.h"
 
 namespace reorder {
 
-typedef uint64 AbsoluteAddress64;
-typedef uint64 Size64;
-
 using core::AddressSpace;
 using core::BlockGraph;
 using core::RelativeAddress;
@@ -36,14 +33,18 @@ using pe::Decomposer;
 using pe::PEFile;
 
 // Class encapsulating a DLL order generator. Is itself an ETW trace consumer,
-// consuming Kernel and CallTrace events, maintaining all necessary state and
-// correlating TRACE_ENTRY events to modules and blocks before handing them off
-// to a delegate.
+// consuming Kernel and CallTrace events, and handing them to a
+// BlockEntryParser which correlates TRACE_ENTRY events to modules and blocks
+// before they are handed off to a delegate.
+//
+// The traces may instead be event captures, each holding all the events of a
+// trace. These are parsed in parallel, each into a list of its own, and the
+// lists are merged in order of time before being handed off to the delegate.
+// The lists hold every block entry of their captures, so the captures may be
+// consumed in batches to bound memory use.
 class Reorderer
     : public base::win::EtwTraceConsumerBase<Reorderer>,
-      public KernelModuleEvents,
-      public KernelProcessEvents,
-      public CallTraceEvents {
+      public BlockEntryParser::Delegate {
  public:
   struct Order;
   class OrderGenerator;
@@ -58,6 +59,8 @@ class Reorderer
   };
   typedef uint32 Flags;
 
+  typedef Decomposer::DecomposedImage DecomposedImage;
+
   // This class needs to be a singleton due to the Windows ETW API. The
   // constructor will enforce this in debug builds. The module_path may be
   // left blank, in which case it will be inferred from the instrumented
@@ -76,27 +79,52 @@ class Reorderer
   // Returns the reorderer directives provided at Init time.
   Flags flags() const { return flags_; }
 
+  // Returns the signature of the module being reordered. This is only valid
+  // once Reorder has read the module.
+  const PEFile::Signature& module_signature() const {
+    return module_signature_;
+  }
+
+  // Sets the number of threads event captures are parsed on. The ordering
+  // doesn't depend on the number of threads. Defaults to one.
+  void set_num_threads(size_t num_threads) {
+    DCHECK_LT(0U, num_threads);
+    num_threads_ = num_threads;
+  }
+
+  // Sets the maximum number of event captures whose events are held in
+  // memory at once, at 24 bytes per block entry. The captures are parsed and
+  // replayed a batch at a time, in the order given, so captures that overlap
+  // in time must be in the same batch for their events to be replayed in
+  // order of time. Defaults to zero, which places all captures in a single
+  // batch.
+  void set_capture_batch_size(size_t capture_batch_size) {
+    capture_batch_size_ = capture_batch_size;
+  }
+
   // Returns true of the given section must be reordered.
   bool MustReorder(size_t section_index) const;
 
   // Returns true of the given block is in a section which must be reordered.
   bool MustReorder(const BlockGraph::Block* block) const;
 
- private:
-  // Initializes the section reorderability cache, so MustReorder is fast.
-  void InitSectionReorderabilityCache(const OrderGenerator& order_generator);
+ protected:
+  // Initializes the section reorderability cache for the sections of
+  // @p image, so MustReorder is fast. Reorder calls this once the module is
+  // decomposed. Derived classes may call it, along with
+  // set_module_signature, to drive an order generator without any traces.
+  void InitSectionReorderabilityCache(const DecomposedImage& image,
+                                      const OrderGenerator& order_generator);
 
+  void set_module_signature(const PEFile::Signature& module_signature) {
+    module_signature_ = module_signature;
+  }
+
+ private:
   // This allows our parent classes to access the necessary callbacks, but
   // hides them from derived classes.
   friend base::win::EtwTraceConsumerBase<Reorderer>;
 
-  typedef AddressSpace<AbsoluteAddress64, Size64, ModuleInformation>
-      ModuleSpace;
-  typedef std::map<uint32, ModuleSpace> ProcessMap;
-  typedef std::set<uint32> ProcessSet;
-  typedef Decomposer::DecomposedImage DecomposedImage;
-  typedef KernelProcessEvents::ProcessInfo ProcessInfo;
-
   // The actual implementation of Reorder.
   bool ReorderImpl(Order* order);
   // Parses the instrumented DLL headers, validating that it was produced
@@ -104,79 +132,48 @@ class Reorderer
   // information and metadata. Returns true on success, false otherwise.
   bool ValidateInstrumentedModuleAndParseSignature(
       PEFile::Signature* orig_signature);
-  // Returns true if the given ModuleInformation matches the instrumented
-  // module signature, false otherwise.
-  bool MatchesInstrumentedModuleSignature(
-      const ModuleInformation& module_info) const;
-
-  // KernelModuleEvents implementation.
-  virtual void OnModuleIsLoaded(DWORD process_id,
-                                const base::Time& time,
-                                const ModuleInformation& module_info);
-  virtual void OnModuleUnload(DWORD process_id,
-                              const base::Time& time,
-                              const ModuleInformation& module_info);
-  virtual void OnModuleLoad(DWORD process_id,
-                            const base::Time& time,
-                            const ModuleInformation& module_info);
-
-  // KernelProcessEvents implementation.
-  virtual void OnProcessIsRunning(const base::Time& time,
-                                  const ProcessInfo& process_info);
-  virtual void OnProcessStarted(const base::Time& time,
-                                const ProcessInfo& process_info);
-  virtual void OnProcessEnded(const base::Time& time,
-                              const ProcessInfo& process_info,
-                              ULONG exit_status);
-
-  // CallTraceEvents implementation.
-  virtual void OnTraceEntry(base::Time time,
-                            DWORD process_id,
-                            DWORD thread_id,
-                            const TraceEnterExitEventData* data);
-  virtual void OnTraceExit(base::Time time,
-                           DWORD process_id,
-                           DWORD thread_id,
-                           const TraceEnterExitEventData* data);
-  virtual void OnTraceBatchEnter(base::Time time,
-                                 DWORD process_id,
-                                 DWORD thread_id,
-                                 const TraceBatchEnterData* data);
+  // Consumes the ETW logs in trace_paths_. Returns true on success, false
+  // otherwise.
+  bool ConsumeLogs();
+  // Parses the event captures in trace_paths_ in parallel, and replays
+  // their events in order, a batch of captures at a time. Returns true on
+  // success, false otherwise.
+  bool ConsumeCaptures();
+
+  // BlockEntryParser::Delegate implementation.
+  virtual bool OnProcessStarted(uint32 process_id, const base::Time& time);
+  virtual bool OnProcessEnded(uint32 process_id, const base::Time& time);
+  virtual bool OnBlockEntry(const BlockGraph::Block* block,
+                            RelativeAddress address,
+                            uint32 process_id,
+                            uint32 thread_id,
+                            const base::Time& time);
 
   void OnEvent(PEVENT_TRACE event);
   static void ProcessEvent(PEVENT_TRACE event);
   static bool ProcessBuffer(PEVENT_TRACE_LOGFILE buffer);
 
-  // Given an address and a process id, returns the module in memory at that
-  // address. Returns NULL if no such module exists.
-  const sym_util::ModuleInformation* GetModuleInformation(
-      uint32 process_id, AbsoluteAddress64 addr) const;
-
-  KernelLogParser kernel_log_parser_;
-  CallTraceParser call_trace_parser_;
-
   FilePath module_path_;
   FilePath instrumented_path_;
   std::vector<FilePath> trace_paths_;
 
   // Signature of the instrumented DLL. Used for filtering call-trace events.
   PEFile::Signature instr_signature_;
+  // Signature of the DLL being reordered.
+  PEFile::Signature module_signature_;
   // A set of flags controlling the reorderer behaviour.
   Flags flags_;
+  // The number of threads event captures are parsed on.
+  size_t num_threads_;
+  // The maximum number of event captures held in memory at once, or zero
+  // for no limit.
+  size_t capture_batch_size_;
   // Number of CodeBlockEntry events processed.
   size_t code_block_entry_events_;
   // Is the consumer errored?
   bool consumer_errored_;
-  // The time of the last processed event.
-  base::Time last_event_time_;
-  // For each process, we store its point of view of the world.
-  ProcessMap processes_;
-  // The set of processes of interest. That is, those that have had code
-  // run in the instrumented module. These are the only processes for which
-  // we are interested in OnProcessEnded events.
-  ProcessSet matching_process_ids_;
-
-  // The following three variables are only valid while Reorder is executing.
+
+  // The following four variables are only valid while Reorder is executing.
   // A pointer to our order generator delegate.
   OrderGenerator* order_generator_;
   // A pointer to the PE file info for the module we're reordering. This
@@ -187,6 +184,8 @@ class Reorderer
   // a pointer to an image in the output structure, but several internals
   // make use of it during processing.
   DecomposedImage* image_;
+  // Maps the events of the ETW logs to entries into the blocks of image_.
+  scoped_ptr<BlockEntryParser> parser_;
 
   // A cache for whether or not to reorder each section.
   typedef std::vector<bool> SectionReorderabilityCache;
@@ -252,7 +251,7 @@ struct Reorderer::Order {
 
   // Estimates the number of hard faults that would be seen, both before and
   // after ordering. This assumes that everything in |blocks| is actually
-  // visited.
+  // visited. The WorkingSetSimulator gives a trace-driven estimate instead.
   bool OutputFaultEstimates(const FilePath& path) const;
   bool OutputFaultEstimates(FILE* file) const;
 
@@ -310,6 +309,26 @@ class Reorderer::OrderGenerator {
   // return true on success, false otherwise.
   virtual bool CalculateReordering(const Reorderer& reorderer,
                                    Order* order) = 0;
+
+ protected:
+  typedef std::set<const BlockGraph::Block*> BlockSet;
+
+  // This is effectively arbitrarily chosen for now. Higher is better from
+  // benchmarked reorderings. This value is effectively 'infinite' as far as
+  // the chrome data goes.
+  static const size_t kDataRecursionDepth = 100;
+
+  // Given a block, inserts the data blocks associated with it into the
+  // ordering. Will recursively traverse data blocks until the given maximum
+  // stack depth (that way, we include data referred to by data).
+  // @param inserted_data_blocks the data blocks inserted so far, which are
+  //     skipped. Those inserted by this call are added to it.
+  static bool InsertDataBlocks(size_t max_recursion_depth,
+                               const Reorderer& reorderer,
+                               const BlockGraph::Block* block,
+                               BlockSet* inserted_data_blocks,
+                               Order* order);
+
  private:
   DISALLOW_COPY_AND_ASSIGN(OrderGenerator);
 
@@ -0,0 +1,257 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/reorder/trace_event_list.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include "base/threading/simple_thread.h"
+#include "sawbuck/log_lib/event_capture.h"
+
+namespace reorder {
+
+namespace {
+
+typedef core::BlockGraph BlockGraph;
+
+// Parses a share of a set of event captures, each into a list of its own.
+// Parser i of n parses captures i, i + n, i + 2n, and so on.
+class CaptureParser : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param capture_paths the captures, which must outlive the parser.
+  // @param first the index of the first capture to parse.
+  // @param stride the distance between the captures to parse.
+  // @param instrumented_path the path to the instrumented module.
+  // @param instr_signature the signature of the instrumented module.
+  // @param address_space the address space of the original image.
+  // @param lists the lists the captures are parsed into, one per capture.
+  CaptureParser(const std::vector<FilePath>& capture_paths,
+                size_t first,
+                size_t stride,
+                const FilePath& instrumented_path,
+                const pe::PEFile::Signature& instr_signature,
+                const BlockGraph::AddressSpace* address_space,
+                const std::vector<TraceEventList*>& lists)
+      : capture_paths_(capture_paths), first_(first), stride_(stride),
+        instrumented_path_(instrumented_path),
+        instr_signature_(instr_signature), address_space_(address_space),
+        lists_(lists), error_(false) {
+    DCHECK_LT(0U, stride);
+    DCHECK(address_space != NULL);
+    DCHECK_EQ(capture_paths.size(), lists.size());
+  }
+
+  virtual void Run() {
+    for (size_t i = first_; i < capture_paths_.size(); i += stride_) {
+      if (!lists_[i]->ParseCapture(capture_paths_[i], instrumented_path_,
+                                   instr_signature_, address_space_)) {
+        error_ = true;
+        return;
+      }
+    }
+  }
+
+  bool error() const { return error_; }
+
+ private:
+  const std::vector<FilePath>& capture_paths_;
+  size_t first_;
+  size_t stride_;
+  const FilePath& instrumented_path_;
+  const pe::PEFile::Signature& instr_signature_;
+  const BlockGraph::AddressSpace* address_space_;
+  const std::vector<TraceEventList*>& lists_;
+  bool error_;
+
+  DISALLOW_COPY_AND_ASSIGN(CaptureParser);
+};
+
+}  // namespace
+
+TraceEventList::TraceEventList() {
+}
+
+TraceEventList::~TraceEventList() {
+}
+
+bool TraceEventList::ParseCapture(
+    const FilePath& capture_path,
+    const FilePath& instrumented_path,
+    const pe::PEFile::Signature& instr_signature,
+    const BlockGraph::AddressSpace* address_space) {
+  DCHECK(address_space != NULL);
+
+  EventCaptureReader reader;
+  if (!reader.Open(capture_path)) {
+    LOG(ERROR) << "Unable to open event capture: " << capture_path.value();
+    return false;
+  }
+
+  BlockEntryParser parser(instrumented_path, instr_signature, address_space,
+                          this);
+  EVENT_TRACE event;
+  while (!parser.errored() && reader.ReadEvent(&event))
+    parser.ProcessEvent(&event);
+
+  if (reader.error()) {
+    LOG(ERROR) << "Malformed event capture: " << capture_path.value();
+    return false;
+  }
+
+  return !parser.errored();
+}
+
+bool TraceEventList::ParseCaptures(
+    const std::vector<FilePath>& capture_paths,
+    size_t num_threads,
+    const FilePath& instrumented_path,
+    const pe::PEFile::Signature& instr_signature,
+    const BlockGraph::AddressSpace* address_space,
+    const std::vector<TraceEventList*>& lists) {
+  DCHECK_LT(0U, num_threads);
+  DCHECK(address_space != NULL);
+  DCHECK_EQ(capture_paths.size(), lists.size());
+
+  // No point in having more threads than captures.
+  size_t num_parsers = std::min(num_threads, capture_paths.size());
+  std::vector<CaptureParser*> parsers;
+  for (size_t i = 0; i < num_parsers; ++i) {
+    parsers.push_back(new CaptureParser(capture_paths, i, num_parsers,
+                                        instrumented_path, instr_signature,
+                                        address_space, lists));
+  }
+
+  // The first parser runs on this thread, the rest on threads of their own.
+  std::vector<base::DelegateSimpleThread*> threads;
+  for (size_t i = 1; i < parsers.size(); ++i) {
+    threads.push_back(
+        new base::DelegateSimpleThread(parsers[i], "Capture parser"));
+    threads.back()->Start();
+  }
+
+  if (!parsers.empty())
+    parsers[0]->Run();
+
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->Join();
+    delete threads[i];
+  }
+
+  bool success = true;
+  for (size_t i = 0; i < parsers.size(); ++i) {
+    success = success && !parsers[i]->error();
+    delete parsers[i];
+  }
+
+  return success;
+}
+
+bool TraceEventList::Replay(const std::vector<const TraceEventList*>& lists,
+                            BlockGraph* image,
+                            BlockEntryParser::Delegate* delegate) {
+  DCHECK(image != NULL);
+  DCHECK(delegate != NULL);
+
+  // Merge the lists through a heap holding the time of the next event of
+  // each list, along with the index of the list. Ties go to the list with
+  // the lowest index.
+  typedef std::pair<int64, size_t> NextEvent;
+  typedef std::priority_queue<NextEvent,
+                              std::vector<NextEvent>,
+                              std::greater<NextEvent> > NextEventQueue;
+  NextEventQueue next_events;
+  std::vector<size_t> positions(lists.size(), 0);
+  for (size_t i = 0; i < lists.size(); ++i) {
+    DCHECK(lists[i] != NULL);
+    if (!lists[i]->events_.empty())
+      next_events.push(NextEvent(lists[i]->events_[0].time, i));
+  }
+
+  while (!next_events.empty()) {
+    size_t list = next_events.top().second;
+    next_events.pop();
+
+    const std::vector<TraceEvent>& events = lists[list]->events_;
+    const TraceEvent& event = events[positions[list]];
+    base::Time time(base::Time::FromInternalValue(event.time));
+
+    bool success = false;
+    switch (event.block_id) {
+      case TraceEvent::kProcessStarted:
+        success = delegate->OnProcessStarted(event.process_id, time);
+        break;
+
+      case TraceEvent::kProcessEnded:
+        success = delegate->OnProcessEnded(event.process_id, time);
+        break;
+
+      default: {
+        const BlockGraph::Block* block = image->GetBlockById(event.block_id);
+        if (block == NULL) {
+          LOG(ERROR) << "Trace refers to nonexistent block " << event.block_id
+              << ".";
+          return false;
+        }
+        success = delegate->OnBlockEntry(block,
+                                         RelativeAddress(event.address),
+                                         event.process_id,
+                                         event.thread_id,
+                                         time);
+        break;
+      }
+    }
+    if (!success)
+      return false;
+
+    if (++positions[list] < events.size())
+      next_events.push(NextEvent(events[positions[list]].time, list));
+  }
+
+  return true;
+}
+
+bool TraceEventList::OnProcessStarted(uint32 process_id,
+                                      const base::Time& time) {
+  AddEvent(TraceEvent::kProcessStarted, 0, process_id, 0, time);
+  return true;
+}
+
+bool TraceEventList::OnProcessEnded(uint32 process_id,
+                                    const base::Time& time) {
+  AddEvent(TraceEvent::kProcessEnded, 0, process_id, 0, time);
+  return true;
+}
+
+bool TraceEventList::OnBlockEntry(const BlockGraph::Block* block,
+                                  RelativeAddress address,
+                                  uint32 process_id,
+                                  uint32 thread_id,
+                                  const base::Time& time) {
+  DCHECK(block != NULL);
+  DCHECK(block->id() < TraceEvent::kProcessStarted);
+  AddEvent(block->id(), address.value(), process_id, thread_id, time);
+  return true;
+}
+
+void TraceEventList::AddEvent(uint32 block_id,
+                              uint32 address,
+                              uint32 process_id,
+                              uint32 thread_id,
+                              const base::Time& time) {
+  TraceEvent event = { block_id, address, process_id, thread_id,
+                       time.ToInternalValue() };
+  events_.push_back(event);
+}
+
+}  // namespace reorder
@@ -0,0 +1,120 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the TraceEventList, which holds the block entries of a single
+// trace in a compact form. This lets many traces be parsed at once, each on
+// a thread of its own, and merged into a single stream of events afterwards.
+#ifndef SYZYGY_REORDER_TRACE_EVENT_LIST_H_
+#define SYZYGY_REORDER_TRACE_EVENT_LIST_H_
+
+#include <vector>
+#include "syzygy/reorder/block_entry_parser.h"
+
+namespace reorder {
+
+// A block entry, or the start or end of a process.
+struct TraceEvent {
+  // Marks the start and the end of a process, in place of a block id.
+  static const uint32 kProcessStarted = 0xFFFFFFFE;
+  static const uint32 kProcessEnded = 0xFFFFFFFF;
+
+  // The id of the block entered, or one of the values above.
+  uint32 block_id;
+  // The address of the function entered.
+  uint32 address;
+  uint32 process_id;
+  uint32 thread_id;
+  // The internal value of the time of the event.
+  int64 time;
+};
+
+class TraceEventList : public BlockEntryParser::Delegate {
+ public:
+  typedef core::BlockGraph BlockGraph;
+  typedef core::RelativeAddress RelativeAddress;
+
+  TraceEventList();
+  virtual ~TraceEventList();
+
+  // Parses the events of an event capture, appending them to the list. This
+  // only reads from @p address_space, so many lists may parse captures at
+  // once.
+  // @param capture_path the capture to parse.
+  // @param instrumented_path the path to the instrumented module.
+  // @param instr_signature the signature of the instrumented module.
+  // @param address_space the address space of the original image.
+  // @returns true on success, false otherwise.
+  bool ParseCapture(const FilePath& capture_path,
+                    const FilePath& instrumented_path,
+                    const pe::PEFile::Signature& instr_signature,
+                    const BlockGraph::AddressSpace* address_space);
+
+  // Parses event captures on up to @p num_threads threads, one of which is
+  // the calling thread, each capture into a list of its own.
+  // @param capture_paths the captures to parse.
+  // @param num_threads the maximum number of threads to parse on.
+  // @param instrumented_path the path to the instrumented module.
+  // @param instr_signature the signature of the instrumented module.
+  // @param address_space the address space of the original image.
+  // @param lists the lists to parse the captures into, one per capture.
+  // @returns true on success, false otherwise.
+  static bool ParseCaptures(const std::vector<FilePath>& capture_paths,
+                            size_t num_threads,
+                            const FilePath& instrumented_path,
+                            const pe::PEFile::Signature& instr_signature,
+                            const BlockGraph::AddressSpace* address_space,
+                            const std::vector<TraceEventList*>& lists);
+
+  // Returns the events, in the order they were added.
+  const std::vector<TraceEvent>& events() const { return events_; }
+
+  // Replays the events of @p lists into @p delegate, in order of time.
+  // Events of the same time are replayed in the order of the lists they
+  // come from, so the result doesn't depend on the order in which the lists
+  // were filled.
+  // @param lists the lists to replay. The events of each must be in order
+  //     of time.
+  // @param image the block graph the blocks of the events belong to.
+  // @param delegate the delegate to replay the events into.
+  // @returns true on success, false if the delegate failed or a block
+  //     doesn't exist.
+  static bool Replay(const std::vector<const TraceEventList*>& lists,
+                     BlockGraph* image,
+                     BlockEntryParser::Delegate* delegate);
+
+  // BlockEntryParser::Delegate implementation.
+  virtual bool OnProcessStarted(uint32 process_id, const base::Time& time);
+  virtual bool OnProcessEnded(uint32 process_id, const base::Time& time);
+  virtual bool OnBlockEntry(const BlockGraph::Block* block,
+                            RelativeAddress address,
+                            uint32 process_id,
+                            uint32 thread_id,
+                            const base::Time& time);
+
+ private:
+  // Appends an event to the list.
+  void AddEvent(uint32 block_id,
+                uint32 address,
+                uint32 process_id,
+                uint32 thread_id,
+                const base::Time& time);
+
+  std::vector<TraceEvent> events_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceEventList);
+};
+
+}  // namespace reorder
+
+#endif  // SYZYGY_REORDER_TRACE_EVENT_LIST_H_
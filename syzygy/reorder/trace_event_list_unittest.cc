@@ -0,0 +1,574 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/trace_event_list.h"
+
+#include <vector>
+#include "base/file_util.h"
+#include "base/logging.h"
+#include "base/time.h"
+#include "gtest/gtest.h"
+#include "sawbuck/log_lib/event_capture.h"
+#include "sawbuck/log_lib/kernel_log_types.h"
+#include "syzygy/call_trace/call_trace_defs.h"
+
+namespace reorder {
+
+namespace {
+
+using core::BlockGraph;
+using core::RelativeAddress;
+using kernel_log_types::ImageLoad32V2;
+using kernel_log_types::kImageLoadEventClass;
+using kernel_log_types::kImageNotifyLoadEvent;
+using kernel_log_types::kImageNotifyUnloadEvent;
+
+const RelativeAddress kCodeStart(0x1000);
+const size_t kFunctionSize = 16;
+
+// The instrumented module, as seen in the traces.
+const uint32 kModuleBase = 0x10000000;
+const uint32 kModuleSize = 0x100000;
+const uint32 kModuleChecksum = 0xC0FFEE;
+const uint32 kModuleTimeDateStamp = 0x4E000000;
+const wchar_t kModuleName[] = L"C:\\instrumented.dll";
+
+base::TimeDelta Ms(int64 ms) {
+  return base::TimeDelta::FromMilliseconds(ms);
+}
+
+// Counts the block entries it's handed, and does nothing else.
+class CountingDelegate : public BlockEntryParser::Delegate {
+ public:
+  CountingDelegate() : num_entries_(0) {
+  }
+
+  virtual bool OnProcessStarted(uint32 process_id, const base::Time& time) {
+    return true;
+  }
+
+  virtual bool OnProcessEnded(uint32 process_id, const base::Time& time) {
+    return true;
+  }
+
+  virtual bool OnBlockEntry(const BlockGraph::Block* block,
+                            RelativeAddress address,
+                            uint32 process_id,
+                            uint32 thread_id,
+                            const base::Time& time) {
+    ++num_entries_;
+    return true;
+  }
+
+  size_t num_entries() const { return num_entries_; }
+
+ private:
+  size_t num_entries_;
+};
+
+// Records the events it's handed, as a TraceEvent each.
+class RecordingDelegate : public BlockEntryParser::Delegate {
+ public:
+  virtual bool OnProcessStarted(uint32 process_id, const base::Time& time) {
+    Record(TraceEvent::kProcessStarted, 0, process_id, 0, time);
+    return true;
+  }
+
+  virtual bool OnProcessEnded(uint32 process_id, const base::Time& time) {
+    Record(TraceEvent::kProcessEnded, 0, process_id, 0, time);
+    return true;
+  }
+
+  virtual bool OnBlockEntry(const BlockGraph::Block* block,
+                            RelativeAddress address,
+                            uint32 process_id,
+                            uint32 thread_id,
+                            const base::Time& time) {
+    Record(block->id(), address.value(), process_id, thread_id, time);
+    return true;
+  }
+
+  const std::vector<TraceEvent>& events() const { return events_; }
+
+ private:
+  void Record(uint32 block_id, uint32 address, uint32 process_id,
+              uint32 thread_id, const base::Time& time) {
+    TraceEvent event = { block_id, address, process_id, thread_id,
+                         time.ToInternalValue() };
+    events_.push_back(event);
+  }
+
+  std::vector<TraceEvent> events_;
+};
+
+bool operator==(const TraceEvent& event1, const TraceEvent& event2) {
+  return event1.block_id == event2.block_id &&
+      event1.address == event2.address &&
+      event1.process_id == event2.process_id &&
+      event1.thread_id == event2.thread_id &&
+      event1.time == event2.time;
+}
+
+class TraceEventListTest : public testing::Test {
+ public:
+  TraceEventListTest() : address_space_(&image_) {
+  }
+
+  virtual void SetUp() {
+    signature_.path = kModuleName;
+    signature_.module_size = kModuleSize;
+    signature_.module_checksum = kModuleChecksum;
+    signature_.module_time_date_stamp = kModuleTimeDateStamp;
+  }
+
+  virtual void TearDown() {
+    for (size_t i = 0; i < capture_paths_.size(); ++i)
+      file_util::Delete(capture_paths_[i], false);
+  }
+
+  // Adds @p num_functions code blocks, one after the other.
+  void AddFunctions(size_t num_functions) {
+    for (size_t i = 0; i < num_functions; ++i) {
+      RelativeAddress addr(kCodeStart + i * kFunctionSize);
+      BlockGraph::Block* block = address_space_.AddBlock(
+          BlockGraph::CODE_BLOCK, addr, kFunctionSize, "function");
+      ASSERT_TRUE(block != NULL);
+      functions_.push_back(block);
+    }
+  }
+
+  // Creates a temporary event capture, whose first event loads the
+  // instrumented module into @p process_id at @p time.
+  void StartCapture(uint32 process_id, const base::Time& time) {
+    FilePath path;
+    ASSERT_TRUE(file_util::CreateTemporaryFile(&path));
+    capture_paths_.push_back(path);
+    ASSERT_TRUE(writer_.Open(path));
+
+    std::vector<uint8> data;
+    MakeImageLoad(process_id, kModuleBase, kModuleSize, kModuleChecksum,
+                  kModuleTimeDateStamp, kModuleName, &data);
+    ASSERT_TRUE(WriteEvent(kImageLoadEventClass, kImageNotifyLoadEvent, 2,
+                           process_id, time, &data));
+  }
+
+  // Appends a batch of calls to @p functions to the capture.
+  void AddBatch(uint32 process_id,
+                uint32 thread_id,
+                const base::Time& time,
+                const std::vector<size_t>& functions) {
+    std::vector<uint8> data;
+    MakeBatch(thread_id, functions, &data);
+    ASSERT_TRUE(WriteEvent(kCallTraceEventClass, TRACE_BATCH_ENTER, 0,
+                           process_id, time, &data));
+  }
+
+  void EndCapture() {
+    ASSERT_TRUE(writer_.Close());
+  }
+
+  // Returns a block entry event.
+  TraceEvent Entry(size_t function, uint32 process_id, uint32 thread_id,
+                   const base::Time& time) {
+    TraceEvent event = { functions_[function]->id(),
+                         functions_[function]->addr().value(),
+                         process_id, thread_id, time.ToInternalValue() };
+    return event;
+  }
+
+ protected:
+  // Fills @p data with the payload of an event loading the module at
+  // @p base into @p process_id.
+  static void MakeImageLoad(uint32 process_id, uint32 base, uint32 size,
+                            uint32 checksum, uint32 time_date_stamp,
+                            const wchar_t* name, std::vector<uint8>* data) {
+    size_t name_size = (wcslen(name) + 1) * sizeof(wchar_t);
+    data->assign(FIELD_OFFSET(ImageLoad32V2, ImageFileName) + name_size, 0);
+    ImageLoad32V2* load = reinterpret_cast<ImageLoad32V2*>(&(*data)[0]);
+    load->BaseAddress = base;
+    load->ModuleSize = size;
+    load->ProcessId = process_id;
+    load->ImageChecksum = checksum;
+    load->TimeDateStamp = time_date_stamp;
+    memcpy(load->ImageFileName, name, name_size);
+  }
+
+  // Fills @p data with the payload of a batch of calls to @p functions.
+  void MakeBatch(uint32 thread_id,
+                 const std::vector<size_t>& functions,
+                 std::vector<uint8>* data) {
+    data->assign(FIELD_OFFSET(TraceBatchEnterData, calls) +
+                 functions.size() * sizeof(FuncCall), 0);
+    TraceBatchEnterData* batch =
+        reinterpret_cast<TraceBatchEnterData*>(&(*data)[0]);
+    batch->thread_id = thread_id;
+    batch->num_calls = functions.size();
+    for (size_t i = 0; i < functions.size(); ++i) {
+      batch->calls[i].ticks_ago = 0;
+      batch->calls[i].function = reinterpret_cast<FuncAddr>(
+          kModuleBase + functions_[functions[i]]->addr().value());
+    }
+  }
+
+  // Returns an event of the given kind that carries @p data, which must
+  // outlive it.
+  static EVENT_TRACE MakeEvent(const GUID& guid, UCHAR type, UCHAR version,
+                               uint32 process_id, const base::Time& time,
+                               std::vector<uint8>* data) {
+    EVENT_TRACE event = {};
+    event.Header.Size = sizeof(event);
+    event.Header.Class.Type = type;
+    event.Header.Class.Version = version;
+    event.Header.ProcessId = process_id;
+    reinterpret_cast<FILETIME&>(event.Header.TimeStamp) = time.ToFileTime();
+    event.Header.Guid = guid;
+    event.MofData = &(*data)[0];
+    event.MofLength = data->size();
+    return event;
+  }
+
+  bool WriteEvent(const GUID& guid, UCHAR type, UCHAR version,
+                  uint32 process_id, const base::Time& time,
+                  std::vector<uint8>* data) {
+    return writer_.WriteEvent(
+        MakeEvent(guid, type, version, process_id, time, data));
+  }
+
+  BlockGraph image_;
+  BlockGraph::AddressSpace address_space_;
+  std::vector<BlockGraph::Block*> functions_;
+  pe::PEFile::Signature signature_;
+  EventCaptureWriter writer_;
+  std::vector<FilePath> capture_paths_;
+};
+
+}  // namespace
+
+TEST_F(TraceEventListTest, ReplayMergesInOrderOfTime) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(4));
+  base::Time time = base::Time::Now();
+
+  TraceEventList list1;
+  ASSERT_TRUE(list1.OnProcessStarted(1, time));
+  ASSERT_TRUE(list1.OnBlockEntry(functions_[0], functions_[0]->addr(), 1, 10,
+                                 time));
+  ASSERT_TRUE(list1.OnBlockEntry(functions_[1], functions_[1]->addr(), 1, 10,
+                                 time + Ms(2)));
+  ASSERT_TRUE(list1.OnProcessEnded(1, time + Ms(4)));
+
+  TraceEventList list2;
+  ASSERT_TRUE(list2.OnProcessStarted(2, time + Ms(1)));
+  ASSERT_TRUE(list2.OnBlockEntry(functions_[2], functions_[2]->addr(), 2, 20,
+                                 time + Ms(1)));
+  // Ties go to the first list.
+  ASSERT_TRUE(list2.OnBlockEntry(functions_[3], functions_[3]->addr(), 2, 20,
+                                 time + Ms(2)));
+  EXPECT_EQ(3U, list2.events().size());
+
+  std::vector<const TraceEventList*> lists;
+  lists.push_back(&list1);
+  lists.push_back(&list2);
+  RecordingDelegate delegate;
+  ASSERT_TRUE(TraceEventList::Replay(lists, &image_, &delegate));
+
+  const std::vector<TraceEvent>& events = delegate.events();
+  ASSERT_EQ(7U, events.size());
+  TraceEvent started1 = { TraceEvent::kProcessStarted, 0, 1, 0,
+                          time.ToInternalValue() };
+  TraceEvent started2 = { TraceEvent::kProcessStarted, 0, 2, 0,
+                          (time + Ms(1)).ToInternalValue() };
+  TraceEvent ended1 = { TraceEvent::kProcessEnded, 0, 1, 0,
+                        (time + Ms(4)).ToInternalValue() };
+  EXPECT_TRUE(events[0] == started1);
+  EXPECT_TRUE(events[1] == Entry(0, 1, 10, time));
+  EXPECT_TRUE(events[2] == started2);
+  EXPECT_TRUE(events[3] == Entry(2, 2, 20, time + Ms(1)));
+  EXPECT_TRUE(events[4] == Entry(1, 1, 10, time + Ms(2)));
+  EXPECT_TRUE(events[5] == Entry(3, 2, 20, time + Ms(2)));
+  EXPECT_TRUE(events[6] == ended1);
+}
+
+TEST_F(TraceEventListTest, ReplayFailsOnMissingBlock) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(1));
+
+  // A block of another image.
+  BlockGraph other_image;
+  other_image.AddBlock(BlockGraph::CODE_BLOCK, kFunctionSize, "function");
+  BlockGraph::Block* other_block =
+      other_image.AddBlock(BlockGraph::CODE_BLOCK, kFunctionSize, "function");
+
+  TraceEventList list;
+  ASSERT_TRUE(list.OnBlockEntry(other_block, kCodeStart, 1, 10,
+                                base::Time::Now()));
+  std::vector<const TraceEventList*> lists(1, &list);
+  RecordingDelegate delegate;
+  EXPECT_FALSE(TraceEventList::Replay(lists, &image_, &delegate));
+}
+
+TEST_F(TraceEventListTest, ParseCapture) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(4));
+  base::Time time = base::Time::Now();
+
+  ASSERT_NO_FATAL_FAILURE(StartCapture(1, time));
+  std::vector<size_t> calls;
+  calls.push_back(2);
+  calls.push_back(0);
+  ASSERT_NO_FATAL_FAILURE(AddBatch(1, 10, time + Ms(1), calls));
+  calls.clear();
+  calls.push_back(3);
+  ASSERT_NO_FATAL_FAILURE(AddBatch(1, 11, time + Ms(2), calls));
+  // The module isn't loaded in this process, so its calls are ignored.
+  ASSERT_NO_FATAL_FAILURE(AddBatch(2, 20, time + Ms(3), calls));
+  ASSERT_NO_FATAL_FAILURE(EndCapture());
+
+  TraceEventList list;
+  ASSERT_TRUE(list.ParseCapture(capture_paths_[0], FilePath(kModuleName),
+                                signature_, &address_space_));
+
+  const std::vector<TraceEvent>& events = list.events();
+  ASSERT_EQ(4U, events.size());
+  TraceEvent started = { TraceEvent::kProcessStarted, 0, 1, 0,
+                         (time + Ms(1)).ToInternalValue() };
+  EXPECT_TRUE(events[0] == started);
+  EXPECT_TRUE(events[1] == Entry(2, 1, 10, time + Ms(1)));
+  EXPECT_TRUE(events[2] == Entry(0, 1, 10, time + Ms(1)));
+  EXPECT_TRUE(events[3] == Entry(3, 1, 11, time + Ms(2)));
+}
+
+TEST_F(TraceEventListTest, ParseCaptureFailsOnUnknownFunction) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(1));
+  base::Time time = base::Time::Now();
+
+  ASSERT_NO_FATAL_FAILURE(StartCapture(1, time));
+  std::vector<size_t> calls(1, 0);
+  ASSERT_NO_FATAL_FAILURE(AddBatch(1, 10, time, calls));
+  ASSERT_NO_FATAL_FAILURE(EndCapture());
+
+  // The function isn't in the address space of this image.
+  BlockGraph other_image;
+  BlockGraph::AddressSpace other_address_space(&other_image);
+  TraceEventList list;
+  EXPECT_FALSE(list.ParseCapture(capture_paths_[0], FilePath(kModuleName),
+                                 signature_, &other_address_space));
+}
+
+TEST_F(TraceEventListTest, ParseCaptures) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(4));
+  base::Time time = base::Time::Now();
+
+  // Each capture calls a function of its own.
+  const size_t kNumCaptures = 3;
+  for (size_t i = 0; i < kNumCaptures; ++i) {
+    uint32 process_id = 1 + i;
+    ASSERT_NO_FATAL_FAILURE(StartCapture(process_id, time));
+    std::vector<size_t> calls(1, i);
+    ASSERT_NO_FATAL_FAILURE(AddBatch(process_id, 10, time + Ms(i), calls));
+    ASSERT_NO_FATAL_FAILURE(EndCapture());
+  }
+
+  // Fewer threads than captures, so that some parse several.
+  std::vector<TraceEventList*> lists;
+  for (size_t i = 0; i < kNumCaptures; ++i)
+    lists.push_back(new TraceEventList());
+  EXPECT_TRUE(TraceEventList::ParseCaptures(capture_paths_, 2,
+                                            FilePath(kModuleName), signature_,
+                                            &address_space_, lists));
+
+  for (size_t i = 0; i < kNumCaptures; ++i) {
+    const std::vector<TraceEvent>& events = lists[i]->events();
+    ASSERT_EQ(2U, events.size());
+    TraceEvent started = { TraceEvent::kProcessStarted, 0, 1 + i, 0,
+                           (time + Ms(i)).ToInternalValue() };
+    EXPECT_TRUE(events[0] == started);
+    EXPECT_TRUE(events[1] == Entry(i, 1 + i, 10, time + Ms(i)));
+    delete lists[i];
+  }
+}
+
+TEST_F(TraceEventListTest, ParseCapturesFailsOnUnknownFunction) {
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(1));
+  base::Time time = base::Time::Now();
+
+  ASSERT_NO_FATAL_FAILURE(StartCapture(1, time));
+  std::vector<size_t> calls(1, 0);
+  ASSERT_NO_FATAL_FAILURE(AddBatch(1, 10, time, calls));
+  ASSERT_NO_FATAL_FAILURE(EndCapture());
+
+  // The function isn't in the address space of this image.
+  BlockGraph other_image;
+  BlockGraph::AddressSpace other_address_space(&other_image);
+  TraceEventList list;
+  std::vector<TraceEventList*> lists(1, &list);
+  EXPECT_FALSE(TraceEventList::ParseCaptures(capture_paths_, 2,
+                                             FilePath(kModuleName),
+                                             signature_, &other_address_space,
+                                             lists));
+}
+
+// Parses sixteen single-process captures of two million calls each with one
+// to eight threads, and checks that every thread count gives the same events.
+// Parsing and replaying are timed separately. Disabled by default.
+TEST_F(TraceEventListTest, DISABLED_ParallelIngestionBenchmark) {
+  const size_t kNumFunctions = 4000;
+  const size_t kNumCaptures = 16;
+  const size_t kNumBatches = 2000;
+  const size_t kCallsPerBatch = 1000;
+  const size_t kThreadCounts[] = { 1, 2, 4, 8 };
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(kNumFunctions));
+
+  // Write out the captures, each of a process of its own, with calls to
+  // random functions skewed towards the first few.
+  base::Time start_time = base::Time::Now();
+  uint32 seed = 1;
+  for (size_t i = 0; i < kNumCaptures; ++i) {
+    uint32 process_id = 1000 + i;
+    ASSERT_NO_FATAL_FAILURE(StartCapture(process_id, start_time));
+    std::vector<size_t> calls(kCallsPerBatch);
+    for (size_t j = 0; j < kNumBatches; ++j) {
+      for (size_t k = 0; k < kCallsPerBatch; ++k) {
+        seed = seed * 1103515245 + 12345;
+        size_t function = (seed >> 8) % kNumFunctions;
+        calls[k] = function * function / kNumFunctions;
+      }
+      base::Time time = start_time + base::TimeDelta::FromMicroseconds(j);
+      ASSERT_NO_FATAL_FAILURE(AddBatch(process_id, j % 4, time, calls));
+    }
+    ASSERT_NO_FATAL_FAILURE(EndCapture());
+  }
+
+  std::vector<TraceEvent> reference;
+  for (size_t i = 0; i < arraysize(kThreadCounts); ++i) {
+    size_t num_threads = kThreadCounts[i];
+    std::vector<TraceEventList*> lists;
+    for (size_t j = 0; j < kNumCaptures; ++j)
+      lists.push_back(new TraceEventList());
+
+    base::Time start = base::Time::Now();
+    EXPECT_TRUE(TraceEventList::ParseCaptures(capture_paths_, num_threads,
+                                              FilePath(kModuleName),
+                                              signature_, &address_space_,
+                                              lists));
+    base::TimeDelta parse_time = base::Time::Now() - start;
+
+    start = base::Time::Now();
+    RecordingDelegate delegate;
+    std::vector<const TraceEventList*> const_lists(lists.begin(),
+                                                   lists.end());
+    EXPECT_TRUE(TraceEventList::Replay(const_lists, &image_, &delegate));
+    base::TimeDelta replay_time = base::Time::Now() - start;
+
+    for (size_t j = 0; j < kNumCaptures; ++j)
+      delete lists[j];
+
+    // The outcome doesn't depend on the number of threads.
+    if (i == 0) {
+      reference = delegate.events();
+    } else {
+      ASSERT_EQ(reference.size(), delegate.events().size());
+      for (size_t j = 0; j < reference.size(); ++j)
+        ASSERT_TRUE(reference[j] == delegate.events()[j]);
+    }
+
+    size_t num_calls = kNumCaptures * kNumBatches * kCallsPerBatch;
+    LOG(INFO) << num_threads << " threads: parsed " << num_calls
+              << " calls in " << parse_time.InMilliseconds() << " ms, "
+              << static_cast<int64>(num_calls / parse_time.InSecondsF())
+              << " calls/s, replayed in " << replay_time.InMilliseconds()
+              << " ms.";
+  }
+}
+
+// Feeds batches of calls straight to a BlockEntryParser, in a process that
+// has a couple of hundred other modules loaded, much as Chrome's browser
+// process does. In the steady state the instrumented module's ranges are
+// found once and reused for every batch. In the churning state, another
+// module is loaded and unloaded before each batch, so each batch has to
+// find them again. The delegate only counts the entries, so the times are
+// those of the parser and its FunctionBlockCache. Disabled by default.
+TEST_F(TraceEventListTest, DISABLED_BatchEntryBenchmark) {
+  const size_t kNumFunctions = 4000;
+  const size_t kNumOtherModules = 200;
+  const size_t kNumBatches = 20000;
+  const size_t kCallsPerBatch = 1000;
+  const uint32 kProcessId = 1000;
+  const uint32 kOtherModuleBase = 0x20000000;
+  const uint32 kOtherModuleSize = 0x10000;
+  const wchar_t kOtherModuleName[] = L"C:\\other.dll";
+  ASSERT_NO_FATAL_FAILURE(AddFunctions(kNumFunctions));
+
+  base::Time time = base::Time::Now();
+  std::vector<uint8> module_data;
+  MakeImageLoad(kProcessId, kModuleBase, kModuleSize, kModuleChecksum,
+                kModuleTimeDateStamp, kModuleName, &module_data);
+  EVENT_TRACE module_load = MakeEvent(kImageLoadEventClass,
+      kImageNotifyLoadEvent, 2, kProcessId, time, &module_data);
+
+  std::vector<std::vector<uint8> > other_data(kNumOtherModules + 1);
+  std::vector<EVENT_TRACE> other_loads;
+  for (size_t i = 0; i < other_data.size(); ++i) {
+    MakeImageLoad(kProcessId, kOtherModuleBase + i * kOtherModuleSize,
+                  kOtherModuleSize, i + 1, 0, kOtherModuleName,
+                  &other_data[i]);
+    other_loads.push_back(MakeEvent(kImageLoadEventClass,
+        kImageNotifyLoadEvent, 2, kProcessId, time, &other_data[i]));
+  }
+  // The last of the other modules is the one that comes and goes.
+  EVENT_TRACE churn_load = other_loads.back();
+  other_loads.pop_back();
+  EVENT_TRACE churn_unload = churn_load;
+  churn_unload.Header.Class.Type = kImageNotifyUnloadEvent;
+
+  // A batch of calls to random functions, skewed towards the first few,
+  // which is replayed over and over.
+  std::vector<size_t> calls(kCallsPerBatch);
+  uint32 seed = 1;
+  for (size_t i = 0; i < kCallsPerBatch; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t function = (seed >> 8) % kNumFunctions;
+    calls[i] = function * function / kNumFunctions;
+  }
+  std::vector<uint8> batch_data;
+  MakeBatch(1, calls, &batch_data);
+  EVENT_TRACE batch = MakeEvent(kCallTraceEventClass, TRACE_BATCH_ENTER, 0,
+                                kProcessId, time, &batch_data);
+
+  for (size_t churn = 0; churn < 2; ++churn) {
+    CountingDelegate delegate;
+    BlockEntryParser parser(FilePath(kModuleName), signature_,
+                            &address_space_, &delegate);
+    for (size_t i = 0; i < other_loads.size(); ++i)
+      parser.ProcessEvent(&other_loads[i]);
+    parser.ProcessEvent(&module_load);
+
+    base::Time start = base::Time::Now();
+    for (size_t i = 0; i < kNumBatches; ++i) {
+      if (churn) {
+        parser.ProcessEvent(&churn_load);
+        parser.ProcessEvent(&churn_unload);
+      }
+      parser.ProcessEvent(&batch);
+    }
+    base::TimeDelta elapsed = base::Time::Now() - start;
+
+    size_t num_calls = kNumBatches * kCallsPerBatch;
+    EXPECT_FALSE(parser.errored());
+    EXPECT_EQ(num_calls, delegate.num_entries());
+    LOG(INFO) << (churn ? "Churning: " : "Steady: ") << num_calls
+              << " calls in " << elapsed.InMilliseconds() << " ms, "
+              << static_cast<int64>(num_calls / elapsed.InSecondsF())
+              << " calls/s.";
+  }
+}
+
+}  // namespace reorder
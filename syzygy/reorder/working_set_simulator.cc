@@ -0,0 +1,285 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "syzygy/reorder/working_set_simulator.h"
+
+#include <algorithm>
+#include <list>
+#include <set>
+
+namespace reorder {
+
+namespace {
+
+typedef BlockGraph::AddressSpace AddressSpace;
+
+// The resident pages, in order of most to least recently touched.
+class PageCache {
+ public:
+  PageCache(size_t cluster_pages, size_t max_resident_pages)
+      : cluster_pages_(cluster_pages),
+        max_resident_pages_(max_resident_pages) {
+    DCHECK_LT(0U, cluster_pages_);
+  }
+
+  // Touches @p page, reading in its cluster if it isn't resident.
+  // @returns true if the page faulted, false otherwise.
+  bool Touch(size_t page) {
+    PageMap::iterator it = pages_.find(page);
+    if (it != pages_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return false;
+    }
+
+    // Read in the cluster. The faulting page goes in last, so that it's the
+    // most recently touched.
+    size_t cluster_start = page - page % cluster_pages_;
+    for (size_t i = cluster_start; i < cluster_start + cluster_pages_; ++i) {
+      if (i != page && pages_.find(i) == pages_.end())
+        Insert(i);
+    }
+    Insert(page);
+
+    return true;
+  }
+
+ private:
+  typedef std::list<size_t> PageList;
+  typedef stdext::hash_map<size_t, PageList::iterator> PageMap;
+
+  void Insert(size_t page) {
+    lru_.push_front(page);
+    pages_[page] = lru_.begin();
+
+    if (max_resident_pages_ != 0 && pages_.size() > max_resident_pages_) {
+      pages_.erase(lru_.back());
+      lru_.pop_back();
+    }
+  }
+
+  size_t cluster_pages_;
+  size_t max_resident_pages_;
+  PageList lru_;
+  PageMap pages_;
+};
+
+// Returns the reduction from @p pre to @p post faults as a percentage of
+// @p pre, or zero if there were no faults to begin with.
+double GetReduction(size_t pre, size_t post) {
+  if (pre == 0)
+    return 0.0;
+  return (static_cast<double>(pre) - post) * 100.0 / pre;
+}
+
+}  // namespace
+
+WorkingSetSimulator::Options::Options()
+    : page_size(4096),
+      cluster_pages(8),
+      max_resident_pages(0),
+      num_samples(10) {
+}
+
+WorkingSetSimulator::WorkingSetSimulator(const Options& options)
+    : options_(options) {
+  DCHECK_LT(0U, options_.page_size);
+  DCHECK_LT(0U, options_.cluster_pages);
+  DCHECK_LT(0U, options_.num_samples);
+}
+
+void WorkingSetSimulator::AddBlockEntry(const BlockGraph::Block* block) {
+  DCHECK(block != NULL);
+  if (entries_.empty() || entries_.back() != block)
+    entries_.push_back(block);
+}
+
+void WorkingSetSimulator::GetLayout(
+    const BlockGraph::AddressSpace& address_space,
+    const Order::BlockListMap& order,
+    Layout* layout) {
+  DCHECK(layout != NULL);
+
+  // Gather the blocks of each ordered section, in their original order.
+  typedef std::map<size_t, Order::BlockList> SectionBlockMap;
+  SectionBlockMap section_blocks;
+  AddressSpace::RangeMapConstIter block_it = address_space.begin();
+  for (; block_it != address_space.end(); ++block_it) {
+    const BlockGraph::Block* block = block_it->second;
+    if (order.find(block->section()) != order.end())
+      section_blocks[block->section()].push_back(block);
+  }
+
+  SectionBlockMap::const_iterator section_it = section_blocks.begin();
+  for (; section_it != section_blocks.end(); ++section_it) {
+    const Order::BlockList& original = section_it->second;
+    const Order::BlockList& ordered = order.find(section_it->first)->second;
+    RelativeAddress address = original.front()->addr();
+
+    std::set<const BlockGraph::Block*> placed;
+    for (size_t i = 0; i < ordered.size(); ++i) {
+      const BlockGraph::Block* block = ordered[i];
+      if (!placed.insert(block).second)
+        continue;
+      address = address.AlignUp(block->alignment());
+      (*layout)[block] = address;
+      address += block->size();
+    }
+
+    for (size_t i = 0; i < original.size(); ++i) {
+      const BlockGraph::Block* block = original[i];
+      if (placed.find(block) != placed.end())
+        continue;
+      address = address.AlignUp(block->alignment());
+      (*layout)[block] = address;
+      address += block->size();
+    }
+  }
+}
+
+void WorkingSetSimulator::Simulate(const Layout& layout,
+                                   FaultMap* faults) const {
+  DCHECK(faults != NULL);
+
+  faults->clear();
+  PageCache page_cache(options_.cluster_pages, options_.max_resident_pages);
+
+  size_t sample = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const BlockGraph::Block* block = entries_[i];
+
+    RelativeAddress address = block->addr();
+    Layout::const_iterator layout_it = layout.find(block);
+    if (layout_it != layout.end())
+      address = layout_it->second;
+
+    SectionFaults& section_faults = (*faults)[block->section()];
+    if (section_faults.faults_over_time.empty())
+      section_faults.faults_over_time.resize(options_.num_samples);
+
+    // Touch each of the pages the block spans.
+    size_t size = std::max<size_t>(block->size(), 1);
+    size_t first_page = address.value() / options_.page_size;
+    size_t last_page = (address.value() + size - 1) / options_.page_size;
+    for (size_t page = first_page; page <= last_page; ++page) {
+      if (page_cache.Touch(page))
+        ++section_faults.faults;
+    }
+
+    // Take samples at the end of each interval. A short trace may end more
+    // than one interval at a time.
+    while (sample < options_.num_samples &&
+           (i + 1) * options_.num_samples >= (sample + 1) * entries_.size()) {
+      FaultMap::iterator fault_it = faults->begin();
+      for (; fault_it != faults->end(); ++fault_it)
+        fault_it->second.faults_over_time[sample] = fault_it->second.faults;
+      ++sample;
+    }
+  }
+}
+
+bool WorkingSetSimulator::OutputFaults(const Order& order, FILE* file) const {
+  DCHECK(file != NULL);
+
+  Layout layout;
+  GetLayout(order.image.address_space, order.section_block_lists, &layout);
+
+  FaultMap pre_faults;
+  FaultMap post_faults;
+  Simulate(Layout(), &pre_faults);
+  Simulate(layout, &post_faults);
+
+  fprintf(file,
+          "working set: %d entries, %d byte pages, %d page clusters, "
+          "%d page limit\n",
+          entries_.size(), options_.page_size, options_.cluster_pages,
+          options_.max_resident_pages);
+
+  // Both simulations see the same sections, as the entries are the same.
+  size_t pre_total = 0, post_total = 0;
+  FaultMap::const_iterator pre_it = pre_faults.begin();
+  for (; pre_it != pre_faults.end(); ++pre_it) {
+    size_t section_id = pre_it->first;
+    const SectionFaults& pre = pre_it->second;
+    const SectionFaults& post = post_faults[section_id];
+
+    pre_total += pre.faults;
+    post_total += post.faults;
+    fprintf(file,
+            "section %d: pre = %8d, post = %8d, reduction = %6.1f%%\n",
+            section_id, pre.faults, post.faults,
+            GetReduction(pre.faults, post.faults));
+
+    // Output the faults seen by the end of each interval of the trace.
+    for (size_t i = 0; i < options_.num_samples; ++i) {
+      fprintf(file, "  %3d%%: pre = %8d, post = %8d\n",
+              (i + 1) * 100 / options_.num_samples,
+              pre.faults_over_time[i], post.faults_over_time[i]);
+    }
+  }
+
+  // Output summary statistics.
+  fprintf(file,
+          // "section x: "
+             "total    : pre = %8d, post = %8d, reduction = %6.1f%%\n",
+          pre_total, post_total, GetReduction(pre_total, post_total));
+
+  return true;
+}
+
+WorkingSetRecorder::WorkingSetRecorder(
+    Reorderer::OrderGenerator* order_generator,
+    WorkingSetSimulator* simulator)
+    : Reorderer::OrderGenerator(order_generator->name().c_str()),
+      order_generator_(order_generator),
+      simulator_(simulator) {
+  DCHECK(simulator != NULL);
+}
+
+WorkingSetRecorder::~WorkingSetRecorder() {
+}
+
+bool WorkingSetRecorder::IsReorderable(
+    const Reorderer& reorderer,
+    const IMAGE_SECTION_HEADER& section) const {
+  return order_generator_->IsReorderable(reorderer, section);
+}
+
+bool WorkingSetRecorder::OnProcessStarted(const Reorderer& reorderer,
+                                          uint32 process_id,
+                                          const UniqueTime& time) {
+  return order_generator_->OnProcessStarted(reorderer, process_id, time);
+}
+
+bool WorkingSetRecorder::OnProcessEnded(const Reorderer& reorderer,
+                                        uint32 process_id,
+                                        const UniqueTime& time) {
+  return order_generator_->OnProcessEnded(reorderer, process_id, time);
+}
+
+bool WorkingSetRecorder::OnCodeBlockEntry(const Reorderer& reorderer,
+                                          const BlockGraph::Block* block,
+                                          RelativeAddress address,
+                                          uint32 process_id,
+                                          uint32 thread_id,
+                                          const UniqueTime& time) {
+  simulator_->AddBlockEntry(block);
+  return order_generator_->OnCodeBlockEntry(reorderer, block, address,
+                                            process_id, thread_id, time);
+}
+
+bool WorkingSetRecorder::CalculateReordering(const Reorderer& reorderer,
+                                             Order* order) {
+  return order_generator_->CalculateReordering(reorderer, order);
+}
+
+}  // namespace reorder
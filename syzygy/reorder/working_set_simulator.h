@@ -0,0 +1,151 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the WorkingSetSimulator, which estimates the hard faults an
+// ordering causes by replaying the recorded sequence of code block entries
+// against the original and the reordered layouts of the image.
+//
+// A fault on a page reads in the whole aligned cluster of pages around it,
+// as the memory manager does for image pages. Optionally, the number of
+// resident pages is limited, in which case the least recently touched page
+// is evicted to make room for new ones. Only the code blocks that were
+// actually entered are touched, so data sections never fault.
+//
+// The WorkingSetRecorder wraps an order generator, and feeds the code block
+// entries it sees to a simulator.
+#ifndef SYZYGY_REORDER_WORKING_SET_SIMULATOR_H_
+#define SYZYGY_REORDER_WORKING_SET_SIMULATOR_H_
+
+#include <hash_map>
+#include <map>
+#include <vector>
+#include "syzygy/reorder/reorderer.h"
+
+namespace reorder {
+
+class WorkingSetSimulator {
+ public:
+  typedef Reorderer::Order Order;
+
+  // The addresses of blocks in a layout. Blocks that aren't in the layout
+  // are at their original address.
+  typedef stdext::hash_map<const BlockGraph::Block*, RelativeAddress> Layout;
+
+  struct Options {
+    Options();
+
+    // The size of a page, in bytes.
+    size_t page_size;
+    // The number of pages read in by a fault. Clusters are aligned to this
+    // many pages.
+    size_t cluster_pages;
+    // The maximum number of resident pages, or zero for no limit.
+    size_t max_resident_pages;
+    // The number of points in time at which the faults are sampled.
+    size_t num_samples;
+  };
+
+  // The faults seen in a section.
+  struct SectionFaults {
+    SectionFaults() : faults(0) {}
+
+    // The total number of faults.
+    size_t faults;
+    // The number of faults seen by the end of each sample interval. The
+    // intervals divide the recorded entries evenly.
+    std::vector<size_t> faults_over_time;
+  };
+  // Faults keyed by section id.
+  typedef std::map<size_t, SectionFaults> FaultMap;
+
+  explicit WorkingSetSimulator(const Options& options);
+
+  // Records an entry into a code block.
+  void AddBlockEntry(const BlockGraph::Block* block);
+
+  // Returns the number of entries recorded. Consecutive entries into the
+  // same block are only recorded once.
+  size_t num_entries() const { return entries_.size(); }
+
+  // Computes the layout of @p order. The blocks of each ordered section are
+  // laid out from the lowest address in the section, with the ordered
+  // blocks first, followed by the rest of the section's blocks in their
+  // original order.
+  // @param address_space the address space of the original image.
+  // @param order the ordering to lay out.
+  // @param layout receives the addresses of the blocks of the ordered
+  //     sections.
+  static void GetLayout(const BlockGraph::AddressSpace& address_space,
+                        const Order::BlockListMap& order,
+                        Layout* layout);
+
+  // Replays the recorded entries against @p layout.
+  // @param faults receives the faults of each section that was touched.
+  void Simulate(const Layout& layout, FaultMap* faults) const;
+
+  // Simulates the original layout and that of @p order, and outputs the
+  // faults of each.
+  // @returns true on success, false otherwise.
+  bool OutputFaults(const Order& order, FILE* file) const;
+
+ private:
+  Options options_;
+
+  // The code blocks entered, in order.
+  std::vector<const BlockGraph::Block*> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkingSetSimulator);
+};
+
+// An order generator that passes everything through to another one, while
+// recording the code block entries in a WorkingSetSimulator.
+class WorkingSetRecorder : public Reorderer::OrderGenerator {
+ public:
+  typedef Reorderer::UniqueTime UniqueTime;
+  typedef Reorderer::Order Order;
+
+  // @param order_generator the generator events are passed on to.
+  // @param simulator the simulator entries are recorded in.
+  WorkingSetRecorder(Reorderer::OrderGenerator* order_generator,
+                     WorkingSetSimulator* simulator);
+  virtual ~WorkingSetRecorder();
+
+  // OrderGenerator implementation.
+  virtual bool IsReorderable(const Reorderer& reorderer,
+                             const IMAGE_SECTION_HEADER& section) const;
+  virtual bool OnProcessStarted(const Reorderer& reorderer,
+                                uint32 process_id,
+                                const UniqueTime& time);
+  virtual bool OnProcessEnded(const Reorderer& reorderer,
+                              uint32 process_id,
+                              const UniqueTime& time);
+  virtual bool OnCodeBlockEntry(const Reorderer& reorderer,
+                                const BlockGraph::Block* block,
+                                RelativeAddress address,
+                                uint32 process_id,
+                                uint32 thread_id,
+                                const UniqueTime& time);
+  virtual bool CalculateReordering(const Reorderer& reorderer,
+                                   Order* order);
+
+ private:
+  Reorderer::OrderGenerator* order_generator_;
+  WorkingSetSimulator* simulator_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkingSetRecorder);
+};
+
+}  // namespace reorder
+
+#endif  // SYZYGY_REORDER_WORKING_SET_SIMULATOR_H_
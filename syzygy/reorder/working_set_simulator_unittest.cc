@@ -0,0 +1,188 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/working_set_simulator.h"
+
+#include "gtest/gtest.h"
+
+namespace reorder {
+
+namespace {
+
+typedef WorkingSetSimulator::FaultMap FaultMap;
+typedef WorkingSetSimulator::Layout Layout;
+typedef WorkingSetSimulator::Options Options;
+
+const size_t kPageSize = 4096;
+const size_t kCodeSection = 0;
+const RelativeAddress kCodeStart(0x1000);
+
+class WorkingSetSimulatorTest : public testing::Test {
+ public:
+  WorkingSetSimulatorTest() : address_space_(&image_) {
+    options_.page_size = kPageSize;
+    options_.cluster_pages = 1;
+    options_.num_samples = 4;
+  }
+
+  // Adds @p num_blocks code blocks of @p block_size bytes, one after the
+  // other at the start of the code section.
+  void AddBlocks(size_t num_blocks, size_t block_size) {
+    for (size_t i = 0; i < num_blocks; ++i) {
+      BlockGraph::Block* block =
+          address_space_.AddBlock(BlockGraph::CODE_BLOCK,
+                                  kCodeStart + i * block_size,
+                                  block_size,
+                                  "block");
+      ASSERT_TRUE(block != NULL);
+      block->set_section(kCodeSection);
+      blocks_.push_back(block);
+    }
+  }
+
+ protected:
+  Options options_;
+  BlockGraph image_;
+  BlockGraph::AddressSpace address_space_;
+  std::vector<BlockGraph::Block*> blocks_;
+};
+
+}  // namespace
+
+TEST_F(WorkingSetSimulatorTest, SkipsRepeatedEntries) {
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(2, 16));
+
+  WorkingSetSimulator simulator(options_);
+  simulator.AddBlockEntry(blocks_[0]);
+  simulator.AddBlockEntry(blocks_[0]);
+  simulator.AddBlockEntry(blocks_[1]);
+  simulator.AddBlockEntry(blocks_[0]);
+  EXPECT_EQ(3U, simulator.num_entries());
+}
+
+TEST_F(WorkingSetSimulatorTest, FaultsOncePerPage) {
+  // One block per page, and one spanning the last two pages.
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(3, kPageSize));
+  BlockGraph::Block* spanning =
+      address_space_.AddBlock(BlockGraph::CODE_BLOCK,
+                              kCodeStart + 3 * kPageSize + 16,
+                              kPageSize,
+                              "spanning");
+  ASSERT_TRUE(spanning != NULL);
+  spanning->set_section(kCodeSection);
+
+  WorkingSetSimulator simulator(options_);
+  simulator.AddBlockEntry(blocks_[0]);
+  simulator.AddBlockEntry(blocks_[2]);
+  simulator.AddBlockEntry(blocks_[0]);
+  simulator.AddBlockEntry(spanning);
+  simulator.AddBlockEntry(blocks_[2]);
+
+  FaultMap faults;
+  simulator.Simulate(Layout(), &faults);
+  ASSERT_EQ(1U, faults.size());
+  EXPECT_EQ(4U, faults[kCodeSection].faults);
+
+  // The faults are sampled after each quarter of the entries.
+  ASSERT_EQ(4U, faults[kCodeSection].faults_over_time.size());
+  EXPECT_EQ(2U, faults[kCodeSection].faults_over_time[0]);
+  EXPECT_EQ(2U, faults[kCodeSection].faults_over_time[1]);
+  EXPECT_EQ(4U, faults[kCodeSection].faults_over_time[2]);
+  EXPECT_EQ(4U, faults[kCodeSection].faults_over_time[3]);
+}
+
+TEST_F(WorkingSetSimulatorTest, ClustersReadNeighbouringPages) {
+  // The code starts one page in, so the first cluster holds a single code
+  // page.
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(6, kPageSize));
+  options_.cluster_pages = 4;
+
+  WorkingSetSimulator simulator(options_);
+  for (size_t i = 0; i < blocks_.size(); ++i)
+    simulator.AddBlockEntry(blocks_[i]);
+
+  FaultMap faults;
+  simulator.Simulate(Layout(), &faults);
+  EXPECT_EQ(2U, faults[kCodeSection].faults);
+}
+
+TEST_F(WorkingSetSimulatorTest, EvictsLeastRecentlyUsedPages) {
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(3, kPageSize));
+  options_.max_resident_pages = 2;
+
+  WorkingSetSimulator simulator(options_);
+  simulator.AddBlockEntry(blocks_[0]);
+  simulator.AddBlockEntry(blocks_[1]);
+  simulator.AddBlockEntry(blocks_[0]);
+  // Evicts the page of block 1.
+  simulator.AddBlockEntry(blocks_[2]);
+  simulator.AddBlockEntry(blocks_[0]);
+  simulator.AddBlockEntry(blocks_[1]);
+
+  FaultMap faults;
+  simulator.Simulate(Layout(), &faults);
+  EXPECT_EQ(4U, faults[kCodeSection].faults);
+
+  // Without a limit, each page only faults once.
+  options_.max_resident_pages = 0;
+  WorkingSetSimulator unlimited_simulator(options_);
+  for (size_t i = 0; i < 3; ++i)
+    unlimited_simulator.AddBlockEntry(blocks_[i]);
+  for (size_t i = 0; i < 3; ++i)
+    unlimited_simulator.AddBlockEntry(blocks_[i]);
+  unlimited_simulator.Simulate(Layout(), &faults);
+  EXPECT_EQ(3U, faults[kCodeSection].faults);
+}
+
+TEST_F(WorkingSetSimulatorTest, GetLayout) {
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(4, 16));
+  blocks_[1]->set_alignment(32);
+
+  WorkingSetSimulator::Order::BlockListMap order;
+  order[kCodeSection].push_back(blocks_[2]);
+  order[kCodeSection].push_back(blocks_[1]);
+
+  Layout layout;
+  WorkingSetSimulator::GetLayout(address_space_, order, &layout);
+  ASSERT_EQ(4U, layout.size());
+
+  // The ordered blocks come first, then the others in their original order.
+  EXPECT_EQ(kCodeStart, layout[blocks_[2]]);
+  EXPECT_EQ(kCodeStart + 32, layout[blocks_[1]]);
+  EXPECT_EQ(kCodeStart + 48, layout[blocks_[0]]);
+  EXPECT_EQ(kCodeStart + 64, layout[blocks_[3]]);
+}
+
+TEST_F(WorkingSetSimulatorTest, OrderingReducesFaults) {
+  // Use every fourth block, each on a page of its own.
+  ASSERT_NO_FATAL_FAILURE(AddBlocks(64, kPageSize / 4));
+
+  WorkingSetSimulator::Order::BlockListMap order;
+  WorkingSetSimulator simulator(options_);
+  for (size_t i = 0; i < blocks_.size(); i += 4) {
+    simulator.AddBlockEntry(blocks_[i]);
+    order[kCodeSection].push_back(blocks_[i]);
+  }
+
+  Layout layout;
+  WorkingSetSimulator::GetLayout(address_space_, order, &layout);
+
+  FaultMap faults;
+  simulator.Simulate(Layout(), &faults);
+  EXPECT_EQ(16U, faults[kCodeSection].faults);
+  simulator.Simulate(layout, &faults);
+  EXPECT_EQ(4U, faults[kCodeSection].faults);
+}
+
+}  // namespace reorder